@@ -182,6 +182,10 @@
 	#include "../../Source/portable/GCC/ARM_CM3/portmacro.h"
 #endif
 
+#ifdef GCC_POSIX
+	#include "../../Source/portable/GCC/Posix/portmacro.h"
+#endif
+
 #ifdef IAR_ARM_CM3
 	#include "../../Source/portable/IAR/ARM_CM3/portmacro.h"
 #endif
@@ -217,7 +217,7 @@ void vPortExitCritical( void )
 }
 /*-----------------------------------------------------------*/
 
-void PendSV_Handler( void )
+__attribute__(( section( ".ramfunc" ) )) void PendSV_Handler( void )
 {
 	/* This is a naked function. */
 
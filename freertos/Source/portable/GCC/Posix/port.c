@@ -0,0 +1,356 @@
+/*
+	POSIX simulation port, see portmacro.h.
+
+	The kernel sees one processor: of the task threads, only the one of
+	pxCurrentTCB runs, the others wait on their condition variable. The
+	thread of a task sits at the top of its stack, found from the TCB
+	through pxTopOfStack, left alone by the kernel.
+
+	The interrupt mask is a mutex: the critical sections, and the
+	interrupts run by xPortInterrupt() from the other threads, exclude
+	each other. A switch asked within a critical section or from an
+	interrupt is pending, like the PendSV of the Cortex-M3 port: taken at
+	the end of the critical section, or at the next yield or WFI.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Scheduler includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Host stack of the task threads: the libc calls need more than the task
+stack sizes, which stay for the kernel accounting only. Mapped below 4 GB
+as the rest of the firmware memory, the addresses fit the 32 bits
+registers (DMA) and records. */
+#define portTHREAD_STACK_SIZE	( 256 * 1024 )
+
+/* Longest idle sleep, in case the wake up of a switch was missed. */
+#define portWFI_TIMEOUT_NS		1000000
+
+typedef struct xPORT_THREAD
+{
+	pthread_t xThread;
+	pthread_cond_t xResume;
+	pdTASK_CODE pxCode;
+	void *pvParameters;
+} xPortThread;
+
+/* Provided by the simulation: starts calling SysTick_Handler() through
+xPortInterrupt() at configTICK_RATE_HZ. */
+extern void vPortSetupTimerInterrupt( void );
+
+extern void * volatile pxCurrentTCB;
+
+/* Interrupt mask, held by one thread at a time, re-entrant. */
+static pthread_mutex_t xMask = PTHREAD_MUTEX_INITIALIZER;
+static volatile pthread_t xMaskOwner;
+static volatile unsigned portBASE_TYPE uxMaskDepth = 0;
+
+/* Kept on the first critical section until the scheduler starts, as the
+Cortex-M3 port does: no interrupt runs the kernel meanwhile. */
+static unsigned portBASE_TYPE uxCriticalNesting = 0xaaaaaaaa;
+
+/* The running task thread, handed over under xRunLock. */
+static pthread_mutex_t xRunLock = PTHREAD_MUTEX_INITIALIZER;
+static xPortThread * volatile pxRunning = NULL;
+
+/* Switch asked by an interrupt or within a critical section. */
+static volatile portBASE_TYPE xSwitchPending = pdFALSE;
+static volatile portBASE_TYPE xStarted = pdFALSE;
+
+/* Idle sleep, woken by the interrupts asking a switch. */
+static pthread_mutex_t xWfiLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t xWfiCond = PTHREAD_COND_INITIALIZER;
+static volatile portBASE_TYPE xWaiting = pdFALSE;
+
+static xPortThread *prvCurrentThread( void );
+static void prvSwitchContext( void );
+static void *prvTaskThread( void *pvThread );
+/*-----------------------------------------------------------*/
+
+static portBASE_TYPE prvMaskOwned( void )
+{
+	return uxMaskDepth && pthread_equal( xMaskOwner, pthread_self() );
+}
+/*-----------------------------------------------------------*/
+
+void vPortDisableInterrupts( void )
+{
+	if( !prvMaskOwned() )
+	{
+		pthread_mutex_lock( &xMask );
+		xMaskOwner = pthread_self();
+	}
+	uxMaskDepth++;
+}
+/*-----------------------------------------------------------*/
+
+void vPortEnableInterrupts( void )
+{
+	if( prvMaskOwned() )
+	{
+		uxMaskDepth = 0;
+		pthread_mutex_unlock( &xMask );
+	}
+}
+/*-----------------------------------------------------------*/
+
+unsigned portBASE_TYPE uxPortSetInterruptMask( void )
+{
+	vPortDisableInterrupts();
+	return 0;
+}
+/*-----------------------------------------------------------*/
+
+void vPortClearInterruptMask( unsigned portBASE_TYPE uxMask )
+{
+	( void ) uxMask;
+	if( prvMaskOwned() && --uxMaskDepth == 0 )
+	{
+		pthread_mutex_unlock( &xMask );
+	}
+}
+/*-----------------------------------------------------------*/
+
+void vPortEnterCritical( void )
+{
+	vPortDisableInterrupts();
+	uxCriticalNesting++;
+}
+/*-----------------------------------------------------------*/
+
+void vPortExitCritical( void )
+{
+	uxCriticalNesting--;
+	if( uxCriticalNesting == 0 )
+	{
+		vPortEnableInterrupts();
+		if( xSwitchPending )
+		{
+			prvSwitchContext();
+		}
+	}
+}
+/*-----------------------------------------------------------*/
+
+portSTACK_TYPE *pxPortInitialiseStack( portSTACK_TYPE *pxTopOfStack, pdTASK_CODE pxCode, void *pvParameters )
+{
+xPortThread *pxThread;
+pthread_attr_t xAttr;
+void *pvStack;
+
+	/* The thread descriptor at the top of the stack, aligned down. */
+	pxThread = ( xPortThread * ) ( ( ( unsigned long ) ( pxTopOfStack + 1 ) - sizeof( xPortThread ) ) & ~( ( unsigned long ) portBYTE_ALIGNMENT_MASK ) );
+	memset( pxThread, 0, sizeof( xPortThread ) );
+	pxThread->pxCode = pxCode;
+	pxThread->pvParameters = pvParameters;
+	pthread_cond_init( &pxThread->xResume, NULL );
+
+	pvStack = mmap( NULL, portTHREAD_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0 );
+	if( pvStack == MAP_FAILED )
+	{
+		abort();
+	}
+
+	pthread_attr_init( &xAttr );
+	pthread_attr_setstack( &xAttr, pvStack, portTHREAD_STACK_SIZE );
+	if( pthread_create( &pxThread->xThread, &xAttr, prvTaskThread, pxThread ) != 0 )
+	{
+		abort();
+	}
+	pthread_attr_destroy( &xAttr );
+
+	return ( portSTACK_TYPE * ) pxThread;
+}
+/*-----------------------------------------------------------*/
+
+static void prvWaitRunning( xPortThread *pxThread )
+{
+	pthread_mutex_lock( &xRunLock );
+	while( pxRunning != pxThread )
+	{
+		pthread_cond_wait( &pxThread->xResume, &xRunLock );
+	}
+	pthread_mutex_unlock( &xRunLock );
+}
+/*-----------------------------------------------------------*/
+
+static void prvRun( xPortThread *pxThread )
+{
+	pthread_mutex_lock( &xRunLock );
+	pxRunning = pxThread;
+	pthread_cond_signal( &pxThread->xResume );
+	pthread_mutex_unlock( &xRunLock );
+}
+/*-----------------------------------------------------------*/
+
+static void *prvTaskThread( void *pvThread )
+{
+xPortThread *pxThread = ( xPortThread * ) pvThread;
+
+	prvWaitRunning( pxThread );
+	pxThread->pxCode( pxThread->pvParameters );
+
+	/* Tasks never return. */
+	abort();
+	return NULL;
+}
+/*-----------------------------------------------------------*/
+
+static xPortThread *prvCurrentThread( void )
+{
+	/* pxTopOfStack, the first member of the TCB. */
+	return *( xPortThread ** ) pxCurrentTCB;
+}
+/*-----------------------------------------------------------*/
+
+static void prvSwitchContext( void )
+{
+xPortThread *pxSelf, *pxNext;
+
+	/* From the running task only: an interrupt leaves it pending. */
+	if( !xStarted || !pthread_equal( pxRunning->xThread, pthread_self() ) )
+	{
+		return;
+	}
+
+	vPortDisableInterrupts();
+	xSwitchPending = pdFALSE;
+	pxSelf = prvCurrentThread();
+	vTaskSwitchContext();
+	pxNext = prvCurrentThread();
+	vPortEnableInterrupts();
+
+	if( pxNext != pxSelf )
+	{
+		prvRun( pxNext );
+		prvWaitRunning( pxSelf );
+	}
+}
+/*-----------------------------------------------------------*/
+
+void vPortYield( void )
+{
+	/* Taken when leaving the critical section, with the interrupts
+	enabled again. */
+	if( uxCriticalNesting != 0 || prvMaskOwned() )
+	{
+		xSwitchPending = pdTRUE;
+		return;
+	}
+	prvSwitchContext();
+}
+/*-----------------------------------------------------------*/
+
+void vPortYieldFromISR( void )
+{
+	xSwitchPending = pdTRUE;
+}
+/*-----------------------------------------------------------*/
+
+portBASE_TYPE xPortInterrupt( void ( *pxHandler )( void ) )
+{
+portBASE_TYPE xSwitch;
+
+	/* Masked: the interrupt stays pending, the peripherals run on. */
+	if( pthread_mutex_trylock( &xMask ) != 0 )
+	{
+		return pdFALSE;
+	}
+	xMaskOwner = pthread_self();
+	uxMaskDepth = 1;
+
+	pxHandler();
+	xSwitch = xSwitchPending;
+	vPortEnableInterrupts();
+
+	if( xSwitch )
+	{
+		pthread_mutex_lock( &xWfiLock );
+		xWaiting = pdFALSE;
+		pthread_cond_broadcast( &xWfiCond );
+		pthread_mutex_unlock( &xWfiLock );
+	}
+	return pdTRUE;
+}
+/*-----------------------------------------------------------*/
+
+portBASE_TYPE xPortWaitingForInterrupt( void )
+{
+	return xWaiting;
+}
+/*-----------------------------------------------------------*/
+
+void vPortWaitForInterrupt( void )
+{
+struct timespec xTimeout;
+
+	pthread_mutex_lock( &xWfiLock );
+	if( !xSwitchPending )
+	{
+		clock_gettime( CLOCK_REALTIME, &xTimeout );
+		xTimeout.tv_nsec += portWFI_TIMEOUT_NS;
+		if( xTimeout.tv_nsec >= 1000000000 )
+		{
+			xTimeout.tv_sec++;
+			xTimeout.tv_nsec -= 1000000000;
+		}
+		xWaiting = pdTRUE;
+		pthread_cond_timedwait( &xWfiCond, &xWfiLock, &xTimeout );
+		xWaiting = pdFALSE;
+	}
+	pthread_mutex_unlock( &xWfiLock );
+
+	if( xSwitchPending )
+	{
+		prvSwitchContext();
+	}
+}
+/*-----------------------------------------------------------*/
+
+void SysTick_Handler( void )
+{
+	/* If using preemption, also force a context switch. */
+	#if configUSE_PREEMPTION == 1
+		xSwitchPending = pdTRUE;
+	#endif
+
+	vTaskIncrementTick();
+}
+/*-----------------------------------------------------------*/
+
+portBASE_TYPE xPortStartScheduler( void )
+{
+	/* The interrupts, disabled by the kernel, are enabled again for the
+	first task. */
+	uxCriticalNesting = 0;
+	xSwitchPending = pdFALSE;
+	xStarted = pdTRUE;
+
+	vPortSetupTimerInterrupt();
+
+	prvRun( prvCurrentThread() );
+	vPortEnableInterrupts();
+
+	/* The main thread is done, the tasks run on. */
+	for( ;; )
+	{
+		pause();
+	}
+
+	/* Should not get here! */
+	return 0;
+}
+/*-----------------------------------------------------------*/
+
+void vPortEndScheduler( void )
+{
+	exit( 0 );
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,97 @@
+/*
+	POSIX simulation port, for the host build of the firmware ("waf sim").
+
+	Each task runs on its own thread, one at a time: a task gives the
+	processor away in a yield, and the next one resumes where it stopped.
+	The interrupts are the simulated peripherals threads, run through
+	xPortInterrupt() under the interrupt mask, a recursive mutex also taken
+	by the critical sections. A context switch asked by an interrupt (tick,
+	task woken) happens when the running task next enters the kernel, ends
+	a critical section or idles: a task computing without any kernel call
+	is not preempted.
+
+	The types keep their Cortex-M3 sizes, the firmware relies on them.
+*/
+
+#ifndef PORTMACRO_H
+#define PORTMACRO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Type definitions. */
+#define portCHAR		char
+#define portFLOAT		float
+#define portDOUBLE		double
+#define portLONG		int
+#define portSHORT		short
+#define portSTACK_TYPE	unsigned long
+#define portBASE_TYPE	int
+
+#if( configUSE_16_BIT_TICKS == 1 )
+	typedef unsigned portSHORT portTickType;
+	#define portMAX_DELAY ( portTickType ) 0xffff
+#else
+	typedef unsigned portLONG portTickType;
+	#define portMAX_DELAY ( portTickType ) 0xffffffff
+#endif
+/*-----------------------------------------------------------*/
+
+/* Architecture specifics. */
+#define portSTACK_GROWTH			( -1 )
+#define portTICK_RATE_MS			( ( portTickType ) 1000 / configTICK_RATE_HZ )
+#define portBYTE_ALIGNMENT			8
+/*-----------------------------------------------------------*/
+
+/* Scheduler utilities. */
+extern void vPortYield( void );
+extern void vPortYieldFromISR( void );
+
+#define portYIELD()					vPortYield()
+
+#define portEND_SWITCHING_ISR( xSwitchRequired ) if( xSwitchRequired ) vPortYieldFromISR()
+/*-----------------------------------------------------------*/
+
+/* Critical section management. */
+extern void vPortDisableInterrupts( void );
+extern void vPortEnableInterrupts( void );
+extern void vPortEnterCritical( void );
+extern void vPortExitCritical( void );
+extern unsigned portBASE_TYPE uxPortSetInterruptMask( void );
+extern void vPortClearInterruptMask( unsigned portBASE_TYPE uxMask );
+
+#define portSET_INTERRUPT_MASK_FROM_ISR()		uxPortSetInterruptMask()
+#define portCLEAR_INTERRUPT_MASK_FROM_ISR(x)	vPortClearInterruptMask(x)
+
+#define portDISABLE_INTERRUPTS()	vPortDisableInterrupts()
+#define portENABLE_INTERRUPTS()		vPortEnableInterrupts()
+#define portENTER_CRITICAL()		vPortEnterCritical()
+#define portEXIT_CRITICAL()			vPortExitCritical()
+/*-----------------------------------------------------------*/
+
+/* Simulated interrupts, from the threads of the simulated peripherals:
+the handler runs under the interrupt mask, a context switch it asks with
+portEND_SWITCHING_ISR is taken by the running task. pdFALSE when the mask
+is held: the handler has not run, the interrupt is still pending. */
+extern portBASE_TYPE xPortInterrupt( void ( *pxHandler )( void ) );
+
+/* The processor sleeps until the next interrupt (__WFI). */
+extern void vPortWaitForInterrupt( void );
+
+/* pdTRUE while the processor sleeps, no switch pending: the firmware is
+done with the interrupts so far. */
+extern portBASE_TYPE xPortWaitingForInterrupt( void );
+/*-----------------------------------------------------------*/
+
+/* Task function macros as described on the FreeRTOS.org WEB site. */
+#define portTASK_FUNCTION_PROTO( vFunction, pvParameters ) void vFunction( void *pvParameters )
+#define portTASK_FUNCTION( vFunction, pvParameters ) void vFunction( void *pvParameters )
+
+#define portNOP()
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PORTMACRO_H */
@@ -69,9 +69,12 @@ task.h is included from an application file. */
 #undef MPU_WRAPPERS_INCLUDED_FROM_API_FILE
 
 /*
- * Macro to define the amount of stack available to the idle task.
+ * Macro to define the amount of stack available to the idle task.  Can be
+ * set in FreeRTOSConfig.h: the co-routines run on it.
  */
-#define tskIDLE_STACK_SIZE	configMINIMAL_STACK_SIZE
+#ifndef tskIDLE_STACK_SIZE
+	#define tskIDLE_STACK_SIZE	configMINIMAL_STACK_SIZE
+#endif
 
 /*
  * Task control block.  A task control block (TCB) is allocated to each task,
@@ -97,8 +97,9 @@ class Adafruit_I2C :
   def readU16(self, reg):
     "Reads an unsigned 16-bit value from the I2C device"
     try:
-      hibyte = self.bus.read_byte_data(self.address, reg)
-      result = (hibyte << 8) + self.bus.read_byte_data(self.address, reg+1)
+      # One transaction, repeated start: both bytes of the same sample
+      hibyte, lobyte = self.bus.read_i2c_block_data(self.address, reg, 2)
+      result = (hibyte << 8) + lobyte
       if (self.debug):
         print "I2C: Device 0x%02X returned 0x%04X from reg 0x%02X" % (self.address, result & 0xFFFF, reg)
       return result
@@ -109,10 +110,10 @@ class Adafruit_I2C :
   def readS16(self, reg):
     "Reads a signed 16-bit value from the I2C device"
     try:
-      hibyte = self.bus.read_byte_data(self.address, reg)
+      hibyte, lobyte = self.bus.read_i2c_block_data(self.address, reg, 2)
       if (hibyte > 127):
         hibyte -= 256
-      result = (hibyte << 8) + self.bus.read_byte_data(self.address, reg+1)
+      result = (hibyte << 8) + lobyte
       if (self.debug):
         print "I2C: Device 0x%02X returned 0x%04X from reg 0x%02X" % (self.address, result & 0xFFFF, reg)
       return result
@@ -0,0 +1,130 @@
+import mmap
+import socket
+import struct
+
+# Client of the bridge daemon (raspberry/client/bridge.cpp), which owns
+# the board link: the scripts share it instead of opening the port
+
+SOCKET = '/tmp/swiftler.sock'
+
+# src/libglobal/protocol.h
+SYNC = 0xA5
+MOTORS_CMD = 0x01
+SENSORS_REQ = 0x02
+TELEM_CFG = 0x03
+ACK = 0x80
+NACK = 0x81
+SENSORS = 0x82
+TELEMETRY = 0x83
+EVENT = 0x85
+
+TELEMETRY_FIELDS = ['tick', 'sharp_left_mm', 'sonar_mm', 'sharp_right_mm',
+                    'motor_left', 'motor_right', 'battery_mv', 'current_ma',
+                    'cut_off', 'x_mm', 'y_mm', 'theta_mrad', 'sonar_left_mm',
+                    'sonar_right_mm', 'cpu_permille']
+TELEMETRY_FORMAT = '<IhhhhhHHBhhhhhH'
+
+def crc8(data, crc = 0):
+    for c in bytearray(data):
+        crc ^= c
+        for i in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+class Bridge:
+    def __init__(self, path = SOCKET, timeout = 1.0):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.settimeout(timeout)
+        self.sock.connect(path)
+        self.rx = bytearray()
+        # Events and telemetry received while waiting for a reply
+        self.events = []
+
+    def send(self, type, payload = b''):
+        header = bytearray([type, len(payload)])
+        frame = bytearray([SYNC]) + header + bytearray(payload)
+        frame.append(crc8(payload, crc8(header)))
+        self.sock.sendall(bytes(frame))
+
+    def receive(self):
+        """Next frame, (type, payload)"""
+        while True:
+            start = self.rx.find(bytearray([SYNC]))
+            if start >= 0 and len(self.rx) - start >= 4:
+                size = self.rx[start + 2]
+                end = start + 4 + size
+                if len(self.rx) >= end:
+                    frame = self.rx[start:end]
+                    del self.rx[:end]
+                    if crc8(frame[1:-1]) == frame[-1]:
+                        return frame[1], bytes(frame[3:-1])
+                    continue
+            data = self.sock.recv(4096)
+            if not data:
+                raise IOError('Bridge closed')
+            self.rx += bytearray(data)
+
+    def request(self, type, payload, reply):
+        self.send(type, payload)
+        while True:
+            got, data = self.receive()
+            if got == reply or (got in (ACK, NACK) and data[:1] == bytearray([type])):
+                if got == NACK:
+                    raise IOError('Frame 0x%02x rejected' % type)
+                return data
+            if got == EVENT:
+                self.events.append(data)
+
+    def motors(self, left, right):
+        self.request(MOTORS_CMD, struct.pack('<hh', left, right), ACK)
+
+    def sensors(self):
+        """Sharp left, sonar, sharp right in mm"""
+        return struct.unpack('<hhh', self.request(SENSORS_REQ, b'', SENSORS))
+
+    def telemetry(self):
+        """Latest telemetry, from the bridge cache, as a dict"""
+        data = self.request(TELEMETRY, b'', TELEMETRY)
+        return dict(zip(TELEMETRY_FIELDS, struct.unpack(TELEMETRY_FORMAT, data)))
+
+    def subscribe(self, period_ms):
+        """Telemetry every period_ms, 0 stops: read them with receive()"""
+        self.request(TELEM_CFG, struct.pack('<H', period_ms), ACK)
+
+    def close(self):
+        self.sock.close()
+
+# Shared memory state of the bridge (raspberry/client/swiftler_state.h)
+STATE_PATH = '/dev/shm/swiftler'
+STATE_MAGIC = 0x53544154
+STATE_HEADER = '<IIIIQQQ'
+STATE_SIZE = struct.calcsize(STATE_HEADER) + struct.calcsize(TELEMETRY_FORMAT) + 12
+
+class State:
+    """Latest state, read without asking the bridge: a snapshot is taken
+    again when the bridge wrote meanwhile (seqlock)"""
+
+    def __init__(self, path = STATE_PATH):
+        with open(path, 'rb') as f:
+            self.map = mmap.mmap(f.fileno(), STATE_SIZE, access=mmap.ACCESS_READ)
+        if struct.unpack_from('<I', self.map, 0)[0] != STATE_MAGIC:
+            raise IOError('Not a bridge state')
+
+    def read(self):
+        while True:
+            before = struct.unpack_from('<I', self.map, 8)[0]
+            data = self.map[:STATE_SIZE]
+            after = struct.unpack_from('<I', self.map, 8)[0]
+            if not before & 1 and before == after:
+                break
+        header = struct.unpack_from(STATE_HEADER, data, 0)
+        offset = struct.calcsize(STATE_HEADER)
+        telemetry = struct.unpack_from(TELEMETRY_FORMAT, data, offset)
+        offset += struct.calcsize(TELEMETRY_FORMAT)
+        sensors = struct.unpack_from('<hhh', data, offset)
+        event = struct.unpack_from('<IBB', data, offset + 6)
+        return {'sequence': header[2], 'events': header[3],
+                'telemetry_ns': header[4], 'sensors_ns': header[5],
+                'event_ns': header[6],
+                'telemetry': dict(zip(TELEMETRY_FIELDS, telemetry)),
+                'sensors': sensors, 'event': event}
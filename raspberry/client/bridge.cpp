@@ -0,0 +1,407 @@
+// Bridge daemon: owns the board link and serves the Pi processes on a
+// Unix socket, so they share it instead of opening the port each.
+//   bridge [device [socket]]
+//
+// Clients talk the board framing (src/libglobal/protocol.h). On the way:
+// - PROTO_SENSORS_REQ are coalesced, one board request answers all the
+//   clients waiting for it;
+// - the others are forwarded, the replies routed back in order; the
+//   requests of a poll round go out in one write;
+// - PROTO_TELEM_CFG subscribes the client to the telemetry: the board
+//   streams at the fastest period asked, each client gets its own rate;
+// - PROTO_TELEMETRY without payload reads the latest telemetry, from the
+//   cache, without a board transaction;
+// - PROTO_TELEM_DELTA_CFG is refused: the stream is shared, whole frames;
+// - PROTO_EVENT goes to every client.
+// The latest telemetry, sensors and event are also published in shared
+// memory (swiftler_state.h) for the readers that only poll the state.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <system_error>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "swiftler_link.h"
+#include "swiftler_state.h"
+
+namespace {
+
+// A client this far behind is dropped, the others must not wait for it
+const size_t CLIENT_TX_MAX = 64 * 1024;
+
+struct Client
+{
+  int fd;
+  swiftler::FrameParser parser;
+  std::string tx;
+  uint16_t telemetry_ms; // 0: not subscribed
+  uint64_t sent_ns;      // Last telemetry frame sent
+  std::vector<std::string> params; // PROTO_PARAMS_SET staged, sent with the last
+};
+
+typedef std::map<uint64_t, std::unique_ptr<Client> > Clients;
+
+Clients clients;
+uint64_t nextId = 1;
+
+// Clients waiting for the reply to a request, by request type, oldest
+// first. Ids, not fds: a closed client's fd may be reused.
+std::map<uint8_t, std::deque<uint64_t> > waiters;
+
+std::string telemetry;   // Latest PROTO_TELEMETRY frame, whole
+uint16_t streamMs;       // Asked from the board
+
+swiftler::StatePublisher* published;
+
+uint64_t nowNs()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void sendTo(Client& client_, const std::string& frame_)
+{
+  client_.tx += frame_;
+}
+
+void sendTo(uint64_t id_, const std::string& frame_)
+{
+  const Clients::iterator it = clients.find(id_);
+  if (it != clients.end())
+    sendTo(*it->second, frame_);
+}
+
+// The reply types, for the requests answered by the board
+uint8_t requestOf(const swiftler::Frame& frame_)
+{
+  switch (frame_.type)
+  {
+    case PROTO_ACK:
+    case PROTO_NACK:
+      return frame_.size ? frame_.payload[0] : 0;
+    case PROTO_SENSORS:
+      return PROTO_SENSORS_REQ;
+    case PROTO_SAMPLES:
+      return PROTO_SAMPLES_REQ;
+    case PROTO_LOG:
+      return PROTO_LOG_REQ;
+    case PROTO_TIME:
+      return PROTO_TIME_REQ;
+    case PROTO_ECHO:
+      return PROTO_ECHO_REQ;
+    case PROTO_POLAR:
+      return PROTO_POLAR_REQ;
+    case PROTO_DUMP:
+      return PROTO_DUMP_REQ;
+    case PROTO_PARAMS:
+      return PROTO_PARAMS_REQ;
+    case PROTO_BEHAVIOUR:
+      return PROTO_BEHAVIOUR_REQ;
+    case PROTO_VM:
+      return PROTO_VM_REQ;
+    case PROTO_ACTUATION:
+      return PROTO_ACTUATION_REQ;
+    case PROTO_IDENT:
+      return PROTO_IDENT_REQ;
+    case PROTO_CAPS:
+      return PROTO_CAPS_REQ;
+    case PROTO_SCHEMA:
+      return PROTO_SCHEMA_REQ;
+  }
+  return 0;
+}
+
+void updateStream(swiftler::Link& link_)
+{
+  uint16_t fastest = 0;
+
+  for (Clients::iterator it = clients.begin(); it != clients.end(); ++it)
+  {
+    const uint16_t ms = it->second->telemetry_ms;
+    if (ms && (!fastest || ms < fastest))
+      fastest = ms;
+  }
+  if (fastest != streamMs)
+  {
+    streamMs = fastest;
+    link_.setTelemetry(streamMs);
+  }
+}
+
+void fromBoard(const swiftler::Frame& frame_)
+{
+  const std::string bytes = swiftler::encodeFrame(frame_.type, frame_.payload,
+                                                  frame_.size);
+
+  if (frame_.type == PROTO_TELEMETRY)
+  {
+    if (const proto_telemetry_t* t = frame_.as<proto_telemetry_t>())
+      published->setTelemetry(*t, frame_.time_ns);
+    telemetry = bytes;
+    for (Clients::iterator it = clients.begin(); it != clients.end(); ++it)
+    {
+      Client& client = *it->second;
+      // Half a millisecond early is on time: the board period jitters
+      if (client.telemetry_ms &&
+          frame_.time_ns - client.sent_ns + 500000 >=
+          client.telemetry_ms * (uint64_t)1000000)
+      {
+        client.sent_ns = frame_.time_ns;
+        sendTo(client, bytes);
+      }
+    }
+    return;
+  }
+
+  const proto_sensors_t* sensors = frame_.as<proto_sensors_t>();
+  if (frame_.type == PROTO_SENSORS && sensors)
+    published->setSensors(*sensors, frame_.time_ns);
+
+  if (frame_.type == PROTO_EVENT)
+  {
+    if (const proto_event_t* e = frame_.as<proto_event_t>())
+      published->addEvent(*e, frame_.time_ns);
+    for (Clients::iterator it = clients.begin(); it != clients.end(); ++it)
+      sendTo(*it->second, bytes);
+    return;
+  }
+
+  const uint8_t request = requestOf(frame_);
+  std::deque<uint64_t>& queue = waiters[request];
+  if (!request || queue.empty())
+    return; // The bridge's own requests, or a client gone
+
+  if (request == PROTO_SENSORS_REQ)
+  {
+    // Coalesced: every waiting client
+    while (!queue.empty())
+    {
+      sendTo(queue.front(), bytes);
+      queue.pop_front();
+    }
+    return;
+  }
+
+  sendTo(queue.front(), bytes);
+  // Multi-frame replies end with an empty frame
+  const bool last = (frame_.type != PROTO_SAMPLES && frame_.type != PROTO_LOG &&
+                     frame_.type != PROTO_DUMP && frame_.type != PROTO_PARAMS) ||
+    frame_.size == 0;
+  if (last)
+    queue.pop_front();
+}
+
+void fromClient(swiftler::Link& link_, uint64_t id_, Client& client_,
+                const swiftler::Frame& frame_)
+{
+  switch (frame_.type)
+  {
+    case PROTO_ASCII:
+    case PROTO_TELEM_DELTA_CFG:
+      // The shell and the stream mode stay the bridge's: refused
+      sendTo(client_, swiftler::encodeFrame(PROTO_NACK, &frame_.type, 1));
+      return;
+
+    case PROTO_TELEMETRY:
+      if (telemetry.empty())
+        sendTo(client_, swiftler::encodeFrame(PROTO_NACK, &frame_.type, 1));
+      else
+        sendTo(client_, telemetry);
+      return;
+
+    case PROTO_TELEM_CFG:
+    {
+      const proto_telem_cfg_t* cfg = frame_.as<proto_telem_cfg_t>();
+      const uint8_t reply = cfg ? PROTO_ACK : PROTO_NACK;
+      if (cfg)
+      {
+        client_.telemetry_ms = cfg->period_ms;
+        client_.sent_ns = 0;
+        updateStream(link_);
+      }
+      sendTo(client_, swiftler::encodeFrame(reply, &frame_.type, 1));
+      return;
+    }
+
+    case PROTO_PARAMS_SET:
+    {
+      // A batch goes out in one piece, never mixed with another client's
+      client_.params.push_back(std::string((const char*)frame_.payload,
+                                           frame_.size));
+      if (frame_.size && (frame_.payload[0] & PROTO_PARAMS_MORE))
+        return;
+      waiters[frame_.type].push_back(id_);
+      for (size_t i = 0; i < client_.params.size(); i++)
+        link_.sendFrame(frame_.type, client_.params[i].data(),
+                        client_.params[i].size());
+      client_.params.clear();
+      return;
+    }
+
+    case PROTO_SENSORS_REQ:
+    {
+      std::deque<uint64_t>& queue = waiters[PROTO_SENSORS_REQ];
+      if (queue.empty())
+        link_.sendFrame(frame_.type, frame_.payload, frame_.size);
+      queue.push_back(id_);
+      return;
+    }
+  }
+
+  waiters[frame_.type].push_back(id_);
+  link_.sendFrame(frame_.type, frame_.payload, frame_.size);
+}
+
+int listenOn(const char* path_)
+{
+  struct sockaddr_un addr;
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  if (fd < 0)
+    throw std::system_error(errno, std::generic_category(), "socket");
+
+  memset(&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path_, sizeof (addr.sun_path) - 1);
+  unlink(path_);
+  if (bind(fd, (struct sockaddr*)&addr, sizeof (addr)) < 0 || listen(fd, 8) < 0)
+    throw std::system_error(errno, std::generic_category(), path_);
+  return fd;
+}
+
+// False when the client is gone
+bool flushClient(Client& client_)
+{
+  while (!client_.tx.empty())
+  {
+    const ssize_t n = send(client_.fd, client_.tx.data(), client_.tx.size(),
+                           MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    if (n < 0)
+      return false;
+    client_.tx.erase(0, n);
+  }
+  return client_.tx.size() < CLIENT_TX_MAX;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  const char* device = argc > 1 ? argv[1] : "/dev/ttyUSB0";
+  const char* path = argc > 2 ? argv[2] : "/tmp/swiftler.sock";
+
+  signal(SIGPIPE, SIG_IGN);
+
+  try
+  {
+    swiftler::Link link(device);
+    swiftler::StatePublisher state;
+    const int server = listenOn(path);
+    std::vector<struct pollfd> fds;
+    std::vector<uint64_t> ids;
+
+    published = &state;
+    link.onFrame(&fromBoard);
+    // Binary mode from the start, no stream until a client asks
+    link.setTelemetry(0);
+
+    for (;;)
+    {
+      fds.clear();
+      ids.clear();
+      const struct pollfd linkFd =
+        { link.fd(), (short)(POLLIN | (link.wantsWrite() ? POLLOUT : 0)), 0 };
+      const struct pollfd serverFd = { server, POLLIN, 0 };
+      fds.push_back(linkFd);
+      fds.push_back(serverFd);
+      for (Clients::iterator it = clients.begin(); it != clients.end(); ++it)
+      {
+        const struct pollfd clientFd =
+          { it->second->fd,
+            (short)(POLLIN | (it->second->tx.empty() ? 0 : POLLOUT)), 0 };
+        fds.push_back(clientFd);
+        ids.push_back(it->first);
+      }
+
+      if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR)
+        throw std::system_error(errno, std::generic_category(), "poll");
+
+      // Board first: the replies reach the clients in this round
+      link.process();
+
+      if (fds[1].revents & POLLIN)
+      {
+        const int fd = accept4(server, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd >= 0)
+        {
+          std::unique_ptr<Client> client(new Client());
+          const uint64_t id = nextId++;
+          client->fd = fd;
+          client->telemetry_ms = 0;
+          client->sent_ns = 0;
+          Client& ref = *client;
+          client->parser.onFrame([&link, id, &ref](const swiftler::Frame& frame_)
+            {
+              fromClient(link, id, ref, frame_);
+            });
+          clients[id] = std::move(client);
+        }
+      }
+
+      // All the requests of the round, one write to the board
+      link.setBatching(true);
+      for (size_t i = 0; i < ids.size(); i++)
+      {
+        const Clients::iterator it = clients.find(ids[i]);
+        if (it == clients.end() || !(fds[i + 2].revents & (POLLIN | POLLHUP)))
+          continue;
+
+        uint8_t buffer[512];
+        const ssize_t n = recv(it->second->fd, buffer, sizeof (buffer), 0);
+        if (n > 0)
+          it->second->parser.feed(buffer, n, nowNs());
+        else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+        {
+          close(it->second->fd);
+          clients.erase(it);
+        }
+      }
+      link.setBatching(false);
+
+      for (Clients::iterator it = clients.begin(); it != clients.end(); )
+      {
+        if (flushClient(*it->second))
+        {
+          ++it;
+          continue;
+        }
+        close(it->second->fd);
+        it = clients.erase(it);
+      }
+      // A subscriber may have left
+      updateStream(link);
+    }
+  }
+  catch (const std::system_error& e)
+  {
+    fprintf(stderr, "bridge: %s\n", e.what());
+    return 1;
+  }
+}
@@ -0,0 +1,473 @@
+// Codec benchmark of the client library, no board needed: the decoders
+// on synthetic traffic, and on a capture of a real link if given, a
+// "key value" report on stdout to diff across versions:
+//   codecbench [seconds [capture]]
+//
+// Each case runs for the given seconds (1 by default) and reports the
+// messages (lines, frames, dump records) and bytes decoded per second,
+// and the heap allocations per message, counted by the replaced
+// operator new of this program: the hot path should stay at 0.
+// link: Link::process() on a pseudo-terminal, console lines and frames
+// as read from the port, the read calls included. parser: FrameParser
+// in memory, the bridge clients. deltas: PROTO_TELEMETRY_DELTA frames
+// merged by TelemetryDeltas. dump: DumpDecoder on PROTO_DUMP frames of
+// the log source. The capture is the raw bytes of the link, as saved by
+// "cat /dev/ttyUSB0 > capture".
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "swiftler_link.h"
+
+// Every heap allocation of the program
+static uint64_t allocations;
+
+void* operator new(size_t size_)
+{
+  allocations++;
+  if (void* p = malloc(size_ ? size_ : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p_) noexcept
+{
+  free(p_);
+}
+
+namespace {
+
+// Synthetic traffic, the same at each run
+const uint32_t SEED = 12345;
+const int TRAFFIC_MESSAGES = 4096;
+
+uint64_t nowNs()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void report(const std::string& key_, double value_)
+{
+  printf("%s %.1f\n", key_.c_str(), value_);
+}
+
+// What a case decoded in its time
+struct Result
+{
+  uint64_t messages;
+  uint64_t bytes;
+  uint64_t allocations;
+  uint64_t ns;
+};
+
+void reportResult(const std::string& key_, const Result& result_)
+{
+  const double seconds = result_.ns / 1e9;
+
+  if (!result_.messages || !seconds)
+  {
+    printf("%s.messages 0\n", key_.c_str());
+    return;
+  }
+  report(key_ + ".msgs_per_s", result_.messages / seconds);
+  report(key_ + ".bytes_per_s", result_.bytes / seconds);
+  printf("%s.allocs_per_msg %.3f\n", key_.c_str(),
+         (double)result_.allocations / result_.messages);
+}
+
+class Random
+{
+public:
+  Random() : state(SEED) {}
+
+  // Within [min_, max_]
+  int32_t next(int32_t min_, int32_t max_)
+  {
+    state = state * 1103515245 + 12345;
+    return min_ + (int32_t)((state >> 8) % (uint32_t)(max_ - min_ + 1));
+  }
+
+private:
+  uint32_t state;
+};
+
+// The link bytes, and the messages in them
+struct Traffic
+{
+  std::string bytes;
+  uint64_t messages;
+};
+
+proto_telemetry_t makeTelemetry(Random& random_, uint32_t tick_)
+{
+  proto_telemetry_t t;
+
+  t.tick = tick_;
+  t.sharp_left_mm = random_.next(80, 800);
+  t.sonar_mm = random_.next(30, 3000);
+  t.sharp_right_mm = random_.next(80, 800);
+  t.motor_left = random_.next(-1000, 1000);
+  t.motor_right = random_.next(-1000, 1000);
+  t.battery_mv = random_.next(22000, 25000);
+  t.current_ma = random_.next(0, 2000);
+  t.cut_off = 0;
+  t.x_mm = random_.next(-5000, 5000);
+  t.y_mm = random_.next(-5000, 5000);
+  t.theta_mrad = random_.next(-3142, 3142);
+  t.sonar_left_mm = random_.next(30, 3000);
+  t.sonar_right_mm = random_.next(30, 3000);
+  t.cpu_permille = random_.next(100, 600);
+  t.link_errors = 0;
+  return t;
+}
+
+Traffic telemetryFrames()
+{
+  Random random;
+  Traffic traffic = { std::string(), TRAFFIC_MESSAGES };
+
+  for (int i = 0; i < TRAFFIC_MESSAGES; i++)
+  {
+    const proto_telemetry_t t = makeTelemetry(random, i * 20);
+    traffic.bytes += swiftler::encodeFrame(PROTO_TELEMETRY, &t, sizeof (t));
+  }
+  return traffic;
+}
+
+// As the shell answers in machine mode: values, then the status
+Traffic consoleLines()
+{
+  Random random;
+  Traffic traffic = { std::string(), TRAFFIC_MESSAGES };
+  char line[64];
+
+  for (int i = 0; i < TRAFFIC_MESSAGES; i++)
+  {
+    if (i % 4 == 3)
+      snprintf(line, sizeof (line), "OK\r\n");
+    else
+      snprintf(line, sizeof (line), "%d %d %d\r\n", random.next(0, 3000),
+               random.next(-1000, 1000), random.next(0, 100000));
+    traffic.bytes += line;
+  }
+  return traffic;
+}
+
+// Lines and frames in turn, the shell running with the stream on
+Traffic mixedTraffic()
+{
+  const Traffic frames = telemetryFrames();
+  const Traffic lines = consoleLines();
+  Traffic traffic = { std::string(), 0 };
+  size_t frame = 0, line = 0;
+  const size_t frameSize = sizeof (proto_telemetry_t) + PROTO_OVERHEAD;
+
+  while (traffic.messages < TRAFFIC_MESSAGES)
+  {
+    traffic.bytes.append(frames.bytes, frame, frameSize);
+    frame += frameSize;
+    const size_t end = lines.bytes.find('\n', line) + 1;
+    traffic.bytes.append(lines.bytes, line, end - line);
+    line = end;
+    traffic.messages += 2;
+  }
+  return traffic;
+}
+
+// A few channels moved each sample, all of them every 50
+Traffic deltaFrames()
+{
+  Random random;
+  Traffic traffic = { std::string(), TRAFFIC_MESSAGES };
+  uint8_t payload[PROTO_MAX_PAYLOAD];
+
+  for (int i = 0; i < TRAFFIC_MESSAGES; i++)
+  {
+    proto_telemetry_delta_t head = { (uint8_t)i, (uint32_t)i * 20, 0 };
+    size_t size = sizeof (head);
+    const int n = i % 50 ? random.next(1, 4) : PROTO_DELTA_CHANNELS_MAX;
+
+    for (int k = 0; k < n; k++)
+    {
+      const int channel = i % 50 ? random.next(0, PROTO_CHANNELS_NB - 1) : k;
+      if (head.mask & (1 << channel))
+        continue;
+      head.mask |= 1 << channel;
+    }
+    for (int k = 0; k < PROTO_CHANNELS_NB; k++)
+      if (head.mask & (1 << k))
+      {
+        const int16_t value = random.next(-3000, 3000);
+        memcpy(&payload[size], &value, sizeof (value));
+        size += sizeof (value);
+      }
+    memcpy(payload, &head, sizeof (head));
+    traffic.bytes += swiftler::encodeFrame(PROTO_TELEMETRY_DELTA, payload,
+                                           size);
+  }
+  return traffic;
+}
+
+void putVarint(std::string& out_, int32_t change_)
+{
+  // Zigzag, 7 bits a byte, LSB first
+  uint32_t u = ((uint32_t)change_ << 1) ^ (uint32_t)(change_ >> 31);
+
+  while (u >= 0x80)
+  {
+    out_ += (char)(u | 0x80);
+    u >>= 7;
+  }
+  out_ += (char)u;
+}
+
+// PROTO_DUMP_LOG: tick, value, event, arg, the last two flags, whole
+// records per frame, then the empty frame of the end
+std::vector<std::string> dumpFrames(uint64_t& records_)
+{
+  Random random;
+  std::vector<std::string> frames;
+  std::string payload;
+  int32_t last[PROTO_DUMP_LOG_FIELDS] = {};
+
+  records_ = TRAFFIC_MESSAGES;
+  for (int i = 0; i < TRAFFIC_MESSAGES; i++)
+  {
+    const int32_t fields[PROTO_DUMP_LOG_FIELDS] =
+      {
+        last[0] + random.next(1, 50),
+        last[1] + random.next(-200, 200),
+        random.next(0, 7) ? last[2] : random.next(0, 20),
+        random.next(0, 3) ? last[3] : random.next(0, 255),
+      };
+    std::string record(1, '\0');
+
+    for (int k = 0; k < PROTO_DUMP_LOG_FIELDS; k++)
+    {
+      if (PROTO_DUMP_LOG_FLAGS & (1 << k))
+      {
+        if (fields[k] == last[k])
+          continue;
+        // The mask bits in the order of the flag fields
+        record[0] |= 1 << __builtin_popcount(PROTO_DUMP_LOG_FLAGS &
+                                             ((1 << k) - 1));
+      }
+      putVarint(record, fields[k] - last[k]);
+      last[k] = fields[k];
+    }
+    if (payload.size() + record.size() > PROTO_MAX_PAYLOAD)
+    {
+      frames.push_back(payload);
+      payload.clear();
+    }
+    payload += record;
+  }
+  frames.push_back(payload);
+  frames.push_back(std::string());
+  return frames;
+}
+
+class Pty
+{
+public:
+  Pty() : master(posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC))
+  {
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+      throw std::system_error(errno, std::generic_category(), "pty");
+  }
+  ~Pty() { close(master); }
+
+  Pty(const Pty&) = delete;
+  Pty& operator=(const Pty&) = delete;
+
+  std::string slave() const { return ptsname(master); }
+
+  // As much as the terminal takes now
+  size_t write(const char* data_, size_t size_)
+  {
+    const ssize_t n = ::write(master, data_, size_);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+      return 0;
+    if (n < 0)
+      throw std::system_error(errno, std::generic_category(), "write");
+    return n;
+  }
+
+private:
+  int master;
+};
+
+// The traffic over and over through the read path of the navigation
+// process, for the given time
+Result benchLink(const std::string& bytes_, double seconds_)
+{
+  Pty pty;
+  swiftler::Link link(pty.slave());
+  uint64_t messages = 0;
+
+  link.onFrame([&messages](const swiftler::Frame&) { messages++; });
+  link.onLine([&messages](const swiftler::Line&) { messages++; });
+
+  const uint64_t allocated = allocations;
+  const uint64_t start = nowNs();
+  const uint64_t end = start + (uint64_t)(seconds_ * 1e9);
+  uint64_t bytes = 0;
+  size_t pos = 0;
+
+  while (nowNs() < end)
+  {
+    pos += pty.write(bytes_.data() + pos, bytes_.size() - pos);
+    if (pos == bytes_.size())
+      pos = 0;
+    bytes += link.process();
+  }
+  // What the terminal still holds
+  while (size_t n = link.process())
+    bytes += n;
+
+  const Result result =
+    { messages, bytes, allocations - allocated, nowNs() - start };
+  return result;
+}
+
+// In memory, by reads of a serial port's size
+const size_t FEED_SIZE = 256;
+
+template <typename Decoder>
+Result benchFeed(const std::string& bytes_, double seconds_,
+                 Decoder decoder_)
+{
+  swiftler::FrameParser parser;
+  uint64_t messages = 0;
+
+  parser.onFrame([&](const swiftler::Frame& frame_)
+                 {
+                   messages++;
+                   decoder_(frame_);
+                 });
+
+  const uint64_t allocated = allocations;
+  const uint64_t start = nowNs();
+  const uint64_t end = start + (uint64_t)(seconds_ * 1e9);
+  uint64_t bytes = 0;
+
+  while (nowNs() < end)
+    for (size_t pos = 0; pos < bytes_.size(); pos += FEED_SIZE)
+    {
+      const size_t n = std::min(FEED_SIZE, bytes_.size() - pos);
+      parser.feed((const uint8_t*)bytes_.data() + pos, n, 0);
+      bytes += n;
+    }
+
+  const Result result =
+    { messages, bytes, allocations - allocated, nowNs() - start };
+  return result;
+}
+
+Result benchDump(double seconds_)
+{
+  uint64_t records;
+  const std::vector<std::string> frames = dumpFrames(records);
+  uint64_t bytes = 0, decoded = 0, failed = 0;
+  int32_t sum = 0;
+
+  const uint64_t allocated = allocations;
+  const uint64_t start = nowNs();
+  const uint64_t end = start + (uint64_t)(seconds_ * 1e9);
+
+  // A decoder per dump, as for a request
+  while (nowNs() < end)
+  {
+    swiftler::DumpDecoder decoder(PROTO_DUMP_LOG);
+    decoder.onRecord([&sum](const int32_t* values_) { sum += values_[1]; });
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+      const swiftler::Frame frame =
+        { PROTO_DUMP, (uint8_t)frames[i].size(),
+          (const uint8_t*)frames[i].data(), 0, false, 0 };
+      failed += !decoder.feed(frame);
+      bytes += frames[i].size() + PROTO_OVERHEAD;
+    }
+    decoded += decoder.records();
+  }
+
+  if (failed || (decoded && decoded % records))
+    fprintf(stderr, "codecbench: dump decoded %llu records of %llu\n",
+            (unsigned long long)decoded, (unsigned long long)records);
+  // Kept, so that the decoding is not optimized away
+  if (sum == 0x7fffffff)
+    fprintf(stderr, "codecbench: %d\n", sum);
+  const Result result =
+    { decoded, bytes, allocations - allocated, nowNs() - start };
+  return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  const double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+
+  if (seconds <= 0 || argc > 3)
+  {
+    fprintf(stderr, "codecbench [seconds [capture]]\n");
+    return 2;
+  }
+
+  try
+  {
+    const Traffic frames = telemetryFrames();
+    const Traffic lines = consoleLines();
+    const Traffic mixed = mixedTraffic();
+    const Traffic deltas = deltaFrames();
+
+    reportResult("link.console", benchLink(lines.bytes, seconds));
+    reportResult("link.telemetry", benchLink(frames.bytes, seconds));
+    reportResult("link.mixed", benchLink(mixed.bytes, seconds));
+    reportResult("parser.telemetry",
+                 benchFeed(frames.bytes, seconds,
+                           [](const swiftler::Frame&) {}));
+
+    swiftler::TelemetryDeltas merged;
+    reportResult("deltas.telemetry",
+                 benchFeed(deltas.bytes, seconds,
+                           [&merged](const swiftler::Frame& frame_)
+                           { merged.feed(frame_); }));
+    reportResult("dump.log", benchDump(seconds));
+
+    if (argc > 2)
+    {
+      std::ifstream in(argv[2], std::ios::binary);
+      if (!in)
+        throw std::system_error(errno, std::generic_category(), argv[2]);
+      const std::string capture((std::istreambuf_iterator<char>(in)),
+                                std::istreambuf_iterator<char>());
+      report("capture.bytes", capture.size());
+      reportResult("link.capture", benchLink(capture, seconds));
+      reportResult("parser.capture",
+                   benchFeed(capture, seconds,
+                             [](const swiftler::Frame&) {}));
+    }
+  }
+  catch (const std::system_error& e)
+  {
+    fprintf(stderr, "codecbench: %s\n", e.what());
+    return 1;
+  }
+}
@@ -0,0 +1,94 @@
+// Telemetry of several robots to CSV on stdout, a line per frame:
+//   fleet [-w window_ms] [period_ms [device...]]
+// All the serial ports present without devices. -w gives the robots
+// their sonar time slots, a window of window_ms each. The boards are told
+// apart by the first column, the hexadecimal uid of their PROTO_IDENT;
+// the second is the host read time in microseconds since the start.
+// The identities and the losses go to stderr.
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <system_error>
+
+#include <time.h>
+
+#include "swiftler_fleet.h"
+
+namespace {
+
+uint64_t nowNs()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  int window_ms = 0;
+  if (argc > 2 && std::string(argv[1]) == "-w")
+  {
+    window_ms = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  const int period_ms = argc > 1 ? atoi(argv[1]) : 20;
+  std::vector<std::string> devices(argv + (argc > 1 ? 2 : 1), argv + argc);
+  const uint64_t start_ns = nowNs();
+
+  try
+  {
+    swiftler::Fleet fleet;
+
+    if (devices.empty())
+      devices = swiftler::Fleet::scan();
+    if (!fleet.addAll(devices))
+    {
+      fprintf(stderr, "No serial port opened\n");
+      return 1;
+    }
+
+    if (window_ms > 0)
+      fleet.setSonarWindows(window_ms);
+
+    fleet.onIdentified([&](swiftler::Robot& robot_)
+      {
+        fprintf(stderr, "%s: %08" PRIx32 " address %u image %08" PRIx32
+                " flash %u KB\n", robot_.device.c_str(), robot_.ident.uid,
+                robot_.ident.address, robot_.ident.image_crc,
+                robot_.ident.flash_kb);
+        // Streams from the boards known only
+        robot_.link->setTelemetry(period_ms);
+      });
+    fleet.onLost([](swiftler::Robot& robot_)
+      {
+        fprintf(stderr, "%s: lost\n", robot_.device.c_str());
+      });
+    fleet.onFrame([&](swiftler::Robot& robot_, const swiftler::Frame& frame_)
+      {
+        const proto_telemetry_t* t = frame_.as<proto_telemetry_t>();
+        if (frame_.type != PROTO_TELEMETRY || !t || !robot_.identified)
+          return;
+        printf("%08" PRIx32 ",%llu,%u,%d,%d,%d,%d,%d,%u,%u,%u,%d,%d,%d,%u\n",
+               robot_.ident.uid,
+               (unsigned long long)(frame_.time_ns - start_ns) / 1000,
+               t->tick, t->sharp_left_mm, t->sonar_mm, t->sharp_right_mm,
+               t->motor_left, t->motor_right, t->battery_mv, t->current_ma,
+               t->cut_off, t->x_mm, t->y_mm, t->theta_mrad, t->cpu_permille);
+      });
+
+    while (fleet.size())
+      fleet.poll(100);
+    fprintf(stderr, "No robot left\n");
+    return 1;
+  }
+  catch (const std::system_error& e)
+  {
+    fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+}
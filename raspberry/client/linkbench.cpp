@@ -0,0 +1,424 @@
+// Link benchmark against the board, a "key value" report on stdout to
+// diff across firmware versions:
+//   linkbench uart [device [seconds]]
+//   linkbench i2c [device [address [seconds]]]
+//   linkbench actuation [device [rounds]]
+//
+// uart: echo round trips one at a time (latency percentiles), then with
+// a window of requests in flight (sustained rate), then the telemetry
+// stream at a few periods (throughput, frames dropped by the board).
+// i2c: register file reads, one at a time, then the snapshots missed.
+// actuation: motor commands one at a time, wheels off the ground, on a
+// firmware built with --actuation-trace: each stage on the board from
+// the first byte (PROTO_ACTUATION), the link up estimated as half the
+// round trip to the ACK less the board part, then the write on the host
+// to the new duty cycles on the outputs.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "swiftler_link.h"
+
+extern "C" {
+#include "libglobal/regmap.h"
+}
+
+namespace {
+
+const int LATENCY_ROUNDS = 1000;
+const int WINDOW = 8;           // Echoes in flight for the rate
+const int ECHO_SIZE = 8;        // Payload of the echoes, a sequence number first
+const uint64_t TIMEOUT_NS = 200000000;
+const int ACTUATION_ROUNDS = 500;
+
+uint64_t nowNs()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void report(const char* key_, double value_)
+{
+  printf("%s %.1f\n", key_, value_);
+}
+
+void reportPercentiles(const std::string& key_, std::vector<uint64_t>& ns_)
+{
+  static const struct { const char* name; double at; } percentiles[] =
+    { { "p50", 0.50 }, { "p90", 0.90 }, { "p99", 0.99 }, { "max", 1.0 } };
+
+  if (ns_.empty())
+    return;
+  std::sort(ns_.begin(), ns_.end());
+  for (size_t i = 0; i < sizeof (percentiles) / sizeof (percentiles[0]); i++)
+  {
+    const size_t index = (size_t)(percentiles[i].at * (ns_.size() - 1));
+    report((key_ + "." + percentiles[i].name).c_str(), ns_[index] / 1000.0);
+  }
+}
+
+// Missed ticks in a sequence of tick stamps period_ms_ apart
+uint64_t countDrops(const std::vector<uint32_t>& ticks_, uint32_t period_ms_)
+{
+  uint64_t drops = 0;
+
+  for (size_t i = 1; i < ticks_.size(); i++)
+  {
+    const uint32_t gap = ticks_[i] - ticks_[i - 1];
+    // Half a period of jitter is on time
+    const uint32_t periods = (gap + period_ms_ / 2) / period_ms_;
+    if (periods > 1)
+      drops += periods - 1;
+  }
+  return drops;
+}
+
+class UartBench
+{
+public:
+  explicit UartBench(const char* device_)
+    : link(device_), next(0), lastEchoNs(0), echoes(0), ackNs(0),
+      acked(false), nacked(false), traced(false)
+  {
+    link.onFrame([this](const swiftler::Frame& frame_) { onFrame(frame_); });
+    // Binary mode, no stream
+    link.setTelemetry(0);
+    drain(100000000);
+  }
+
+  void latency()
+  {
+    std::vector<uint64_t> rtt;
+    int lost = 0;
+
+    for (int i = 0; i < LATENCY_ROUNDS; i++)
+    {
+      const uint32_t seq = sendEcho();
+      const uint64_t start = nowNs();
+      while (echoed.empty() || echoed.back() != seq)
+      {
+        if (nowNs() - start > TIMEOUT_NS)
+        {
+          lost++;
+          break;
+        }
+        link.poll(1);
+      }
+      if (!echoed.empty() && echoed.back() == seq)
+        rtt.push_back(lastEchoNs - start);
+      echoed.clear();
+    }
+    reportPercentiles("uart.echo_us", rtt);
+    report("uart.echo_lost", lost);
+  }
+
+  void rate(int seconds_)
+  {
+    const uint64_t end = nowNs() + seconds_ * 1000000000ull;
+    uint64_t sent = 0, given_up = 0;
+    uint64_t progress = nowNs();
+
+    echoes = 0;
+    while (nowNs() < end)
+    {
+      while (sent - echoes - given_up < WINDOW)
+      {
+        sendEcho();
+        sent++;
+      }
+      const uint64_t before = echoes;
+      link.poll(1);
+      if (echoes != before)
+        progress = nowNs();
+      // Lost echoes must not stall the window
+      else if (nowNs() - progress > TIMEOUT_NS)
+      {
+        given_up = sent - echoes;
+        progress = nowNs();
+      }
+    }
+    drain(TIMEOUT_NS);
+    echoed.clear();
+
+    report("uart.commands_per_s", (double)echoes / seconds_);
+    report("uart.commands_lost", sent - echoes);
+  }
+
+  void telemetry(int seconds_)
+  {
+    // The firmware clamps shorter periods (TELEMETRY_MIN_PERIOD_MS)
+    static const uint16_t periods[] = { 50, 20, 10 };
+
+    for (size_t p = 0; p < sizeof (periods) / sizeof (periods[0]); p++)
+    {
+      ticks.clear();
+      const swiftler::LinkStats before = link.stats();
+      link.setTelemetry(periods[p]);
+      const uint64_t start = nowNs();
+      while (nowNs() - start < seconds_ * 1000000000ull)
+        link.poll(10);
+      link.setTelemetry(0);
+      drain(100000000);
+
+      char key[64];
+      snprintf(key, sizeof (key), "uart.telemetry_%ums.frames_per_s", periods[p]);
+      report(key, (double)ticks.size() / seconds_);
+      snprintf(key, sizeof (key), "uart.telemetry_%ums.bytes_per_s", periods[p]);
+      report(key, (double)ticks.size() *
+             (sizeof (proto_telemetry_t) + PROTO_OVERHEAD) / seconds_);
+      snprintf(key, sizeof (key), "uart.telemetry_%ums.dropped", periods[p]);
+      report(key, countDrops(ticks, periods[p]));
+      snprintf(key, sizeof (key), "uart.telemetry_%ums.crc_errors", periods[p]);
+      report(key, link.stats().crc_errors - before.crc_errors);
+    }
+  }
+
+  void actuation(int rounds_)
+  {
+    static const char* const stages[PROTO_ACTUATION_STAGES] =
+      { "frame", "loop", "pwm", "shell" };
+    std::vector<uint64_t> ns[PROTO_ACTUATION_STAGES];
+    std::vector<uint64_t> up, total;
+    int lost = 0;
+
+    for (int i = 0; i < rounds_; i++)
+    {
+      // A new setpoint each time, the tag of the command on the board
+      proto_motors_t cmd;
+      cmd.left = (int16_t)(100 + i % 100);
+      cmd.right = (int16_t)-cmd.left;
+
+      acked = nacked = false;
+      const uint64_t start = nowNs();
+      link.send(PROTO_MOTORS_CMD, cmd);
+      if (!wait(acked))
+      {
+        lost++;
+        continue;
+      }
+      const uint64_t rtt = ackNs - start;
+
+      traced = nacked = false;
+      link.sendFrame(PROTO_ACTUATION_REQ, nullptr, 0);
+      if (!wait(traced))
+      {
+        if (nacked)
+        {
+          fprintf(stderr, "linkbench: no --actuation-trace on the board\n");
+          break;
+        }
+        lost++;
+        continue;
+      }
+      if (lastTrace.left != cmd.left || lastTrace.right != cmd.right)
+      {
+        lost++;
+        continue;
+      }
+
+      // Stages as eActuationStage: frame, loop, pwm, shell
+      const uint64_t board = lastTrace.us[3] * 1000ull;
+      const uint64_t link_up = rtt > board ? (rtt - board) / 2 : 0;
+      for (int s = 0; s < PROTO_ACTUATION_STAGES; s++)
+        ns[s].push_back(lastTrace.us[s] * 1000ull);
+      up.push_back(link_up);
+      total.push_back(link_up + lastTrace.us[2] * 1000ull);
+    }
+
+    proto_motors_t stop = { 0, 0 };
+    link.send(PROTO_MOTORS_CMD, stop);
+    drain(100000000);
+
+    for (int s = 0; s < PROTO_ACTUATION_STAGES; s++)
+      reportPercentiles(std::string("actuation.") + stages[s] + "_us", ns[s]);
+    reportPercentiles("actuation.link_up_us", up);
+    reportPercentiles("actuation.host_to_pwm_us", total);
+    report("actuation.lost", lost);
+  }
+
+private:
+  // Polls until flag_, false on a NACK or the timeout
+  bool wait(const bool& flag_)
+  {
+    const uint64_t start = nowNs();
+
+    while (!flag_ && !nacked && nowNs() - start < TIMEOUT_NS)
+      link.poll(1);
+    return flag_;
+  }
+
+  uint32_t sendEcho()
+  {
+    uint8_t payload[ECHO_SIZE] = { 0 };
+    const uint32_t seq = ++next;
+
+    memcpy(payload, &seq, sizeof (seq));
+    link.sendFrame(PROTO_ECHO_REQ, payload, sizeof (payload));
+    return seq;
+  }
+
+  void drain(uint64_t ns_)
+  {
+    const uint64_t start = nowNs();
+    while (nowNs() - start < ns_)
+      link.poll(1);
+  }
+
+  void onFrame(const swiftler::Frame& frame_)
+  {
+    if (frame_.type == PROTO_ECHO && frame_.size == ECHO_SIZE)
+    {
+      uint32_t seq;
+      memcpy(&seq, frame_.payload, sizeof (seq));
+      echoed.push_back(seq);
+      lastEchoNs = frame_.time_ns;
+      echoes++;
+    }
+    else if (frame_.type == PROTO_ACTUATION &&
+             frame_.size == sizeof (lastTrace))
+    {
+      memcpy(&lastTrace, frame_.payload, sizeof (lastTrace));
+      traced = true;
+    }
+    else if (const proto_telemetry_t* t = frame_.as<proto_telemetry_t>())
+    {
+      if (frame_.type == PROTO_TELEMETRY)
+        ticks.push_back(t->tick);
+    }
+    else if (frame_.type == PROTO_ACK && frame_.size == 1 &&
+             frame_.payload[0] == PROTO_MOTORS_CMD)
+    {
+      ackNs = frame_.time_ns;
+      acked = true;
+    }
+    else if (frame_.type == PROTO_NACK && frame_.size == 1)
+      nacked = true;
+  }
+
+  swiftler::Link link;
+  uint32_t next;
+  std::vector<uint32_t> echoed;
+  uint64_t lastEchoNs;
+  uint64_t echoes;
+  std::vector<uint32_t> ticks;
+  uint64_t ackNs;
+  bool acked;
+  bool nacked;
+  bool traced;
+  proto_actuation_t lastTrace;
+};
+
+// The whole register file from register 0, repeated start in between
+bool readRegs(int fd_, int address_, regmap_t& regs_)
+{
+  uint8_t reg = 0;
+  struct i2c_msg msgs[2] =
+    {
+      { (uint16_t)address_, 0, 1, &reg },
+      { (uint16_t)address_, I2C_M_RD, sizeof (regs_), (uint8_t*)&regs_ },
+    };
+  struct i2c_rdwr_ioctl_data data = { msgs, 2 };
+
+  return ioctl(fd_, I2C_RDWR, &data) == 2;
+}
+
+void i2cBench(const char* device_, int address_, int seconds_)
+{
+  const int fd = open(device_, O_RDWR | O_CLOEXEC);
+  std::vector<uint64_t> rtt;
+  std::vector<uint32_t> ticks;
+  uint64_t reads = 0, errors = 0;
+  regmap_t regs;
+
+  if (fd < 0)
+    throw std::system_error(errno, std::generic_category(), device_);
+
+  if (!readRegs(fd, address_, regs) || regs.device_id != REGMAP_DEVICE_ID)
+  {
+    close(fd);
+    throw std::system_error(ENODEV, std::generic_category(), "no board");
+  }
+  report("i2c.regmap_version", regs.version);
+
+  // As fast as the bus goes: latency and rate from the same reads
+  const uint64_t end = nowNs() + seconds_ * 1000000000ull;
+  while (nowNs() < end)
+  {
+    const uint64_t start = nowNs();
+    if (!readRegs(fd, address_, regs))
+    {
+      errors++;
+      continue;
+    }
+    rtt.push_back(nowNs() - start);
+    reads++;
+    if (ticks.empty() || regs.tick != ticks.back())
+      ticks.push_back(regs.tick);
+  }
+  close(fd);
+
+  reportPercentiles("i2c.read_us", rtt);
+  report("i2c.reads_per_s", (double)reads / seconds_);
+  report("i2c.bytes_per_s", (double)reads * (sizeof (regs) + 1) / seconds_);
+  report("i2c.errors", errors);
+  report("i2c.snapshots_missed", countDrops(ticks, REGMAP_PERIOD_MS));
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  const std::string transport = argc > 1 ? argv[1] : "uart";
+
+  try
+  {
+    if (transport == "uart")
+    {
+      const char* device = argc > 2 ? argv[2] : "/dev/ttyUSB0";
+      const int seconds = argc > 3 ? atoi(argv[3]) : 5;
+      UartBench bench(device);
+      bench.latency();
+      bench.rate(seconds);
+      bench.telemetry(seconds);
+    }
+    else if (transport == "i2c")
+    {
+      const char* device = argc > 2 ? argv[2] : "/dev/i2c-1";
+      const int address = argc > 3 ? strtol(argv[3], NULL, 0) : 0x08;
+      const int seconds = argc > 4 ? atoi(argv[4]) : 5;
+      i2cBench(device, address, seconds);
+    }
+    else if (transport == "actuation")
+    {
+      const char* device = argc > 2 ? argv[2] : "/dev/ttyUSB0";
+      const int rounds = argc > 3 ? atoi(argv[3]) : ACTUATION_ROUNDS;
+      UartBench bench(device);
+      bench.actuation(rounds);
+    }
+    else
+    {
+      fprintf(stderr, "linkbench uart|i2c|actuation ...\n");
+      return 2;
+    }
+  }
+  catch (const std::system_error& e)
+  {
+    fprintf(stderr, "linkbench: %s\n", e.what());
+    return 1;
+  }
+}
@@ -0,0 +1,518 @@
+// Command load generator against the board, a "key value" report on
+// stdout as linkbench, to find where the shell, the UART driver and the
+// control loop give up:
+//   loadgen [device [source [speed [seconds]]]]
+//
+// source: "frames", sensors requests and stopped motors commands in turn
+// (FRAMES_PERIOD_NS apart), "shell", read only commands tagged in machine
+// mode (SHELL_PERIOD_NS apart), or a file recorded by "waf monitor
+// --record", its lines typed again at their time.
+// speed: 1 at the pace of the source, N times faster, 0 as fast as the
+// replies come back, WINDOW in flight (the recorded lines back to back).
+// seconds: the run at most [default: 10].
+//
+// The queues, the profile and the motors jitter are reset first, read
+// back once the replies are in: the UART errors and drops ("us", on the
+// firmwares with it), each queue in registration order ("q"), the
+// motors loop period ("mj").
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <time.h>
+
+#include "swiftler_link.h"
+
+namespace {
+
+const uint64_t FRAMES_PERIOD_NS = 10000000;
+const uint64_t SHELL_PERIOD_NS = 50000000;
+const size_t WINDOW = 7;        // INTERPRETER_WINDOW, the frames alike
+const uint64_t TIMEOUT_NS = 500000000;
+
+uint64_t nowNs()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void report(const std::string& key_, double value_)
+{
+  printf("%s %.1f\n", key_.c_str(), value_);
+}
+
+void reportPercentiles(const std::string& key_, std::vector<uint64_t>& ns_)
+{
+  static const struct { const char* name; double at; } percentiles[] =
+    { { "p50", 0.50 }, { "p90", 0.90 }, { "p99", 0.99 }, { "max", 1.0 } };
+
+  if (ns_.empty())
+    return;
+  std::sort(ns_.begin(), ns_.end());
+  for (size_t i = 0; i < sizeof (percentiles) / sizeof (percentiles[0]); i++)
+  {
+    const size_t index = (size_t)(percentiles[i].at * (ns_.size() - 1));
+    report(key_ + "." + percentiles[i].name, ns_[index] / 1000.0);
+  }
+}
+
+struct Command
+{
+  uint64_t at_ns;       // From the start, at the pace of the source
+  bool frame;
+  uint8_t type;
+  std::string text;     // The line, or the payload of the frame
+  bool answered;        // A reply comes back, counted and timed
+};
+
+class Source
+{
+public:
+  virtual ~Source() {}
+  // False at the end
+  virtual bool next(Command& command_) = 0;
+};
+
+class FramesSource : public Source
+{
+public:
+  FramesSource() : n(0) {}
+
+  bool next(Command& command_)
+  {
+    static const proto_motors_t stop = { 0, 0 };
+
+    command_.at_ns = n * FRAMES_PERIOD_NS;
+    command_.frame = true;
+    command_.answered = true;
+    if (n++ & 1)
+    {
+      command_.type = PROTO_MOTORS_CMD;
+      command_.text.assign((const char*)&stop, sizeof (stop));
+    }
+    else
+    {
+      command_.type = PROTO_SENSORS_REQ;
+      command_.text.clear();
+    }
+    return true;
+  }
+
+private:
+  uint64_t n;
+};
+
+class ShellSource : public Source
+{
+public:
+  ShellSource() : n(0) {}
+
+  bool next(Command& command_)
+  {
+    static const char* const lines[] = { "a", "o", "mj" };
+
+    command_.at_ns = n * SHELL_PERIOD_NS;
+    command_.frame = false;
+    command_.answered = true;
+    command_.text = lines[n++ % (sizeof (lines) / sizeof (lines[0]))];
+    return true;
+  }
+
+private:
+  uint64_t n;
+};
+
+// The keys of a --record file ("host_s > hex" lines) made lines again at
+// their line ending, the received bytes skipped
+class ReplaySource : public Source
+{
+public:
+  explicit ReplaySource(const std::string& path_) : next_(0)
+  {
+    std::ifstream in(path_);
+    std::string text, line;
+    double first = -1;
+    bool ended = false;
+
+    if (!in)
+      throw std::system_error(errno, std::generic_category(), path_);
+    while (std::getline(in, line))
+    {
+      std::istringstream fields(line);
+      std::string arrow, hex;
+      double host_s;
+
+      if (!(fields >> host_s >> arrow >> hex) || arrow != ">")
+        continue;
+      for (size_t i = 0; i + 1 < hex.size(); i += 2)
+      {
+        const char c = (char)strtol(hex.substr(i, 2).c_str(), nullptr, 16);
+        if (c == '\r' || c == '\n')
+        {
+          // "\r\n" is one line ending
+          if (c == '\n' && ended)
+            continue;
+          if (first < 0)
+            first = host_s;
+          Command command;
+          command.at_ns = (uint64_t)((host_s - first) * 1e9);
+          command.frame = false;
+          command.type = 0;
+          command.text = text;
+          command.answered = false;
+          commands.push_back(command);
+          text.clear();
+        }
+        else if (c == '\b' || c == 0x7f)
+        {
+          if (!text.empty())
+            text.erase(text.size() - 1);
+        }
+        else
+          text += c;
+        ended = c == '\r';
+      }
+    }
+    if (commands.empty())
+      throw std::runtime_error(path_ + ": no keys recorded");
+  }
+
+  bool next(Command& command_)
+  {
+    if (next_ >= commands.size())
+      return false;
+    command_ = commands[next_++];
+    return true;
+  }
+
+private:
+  std::vector<Command> commands;
+  size_t next_;
+};
+
+class LoadGen
+{
+public:
+  explicit LoadGen(const char* device_)
+    : link(device_), seq(0), replies(0), nacks(0), errors(0), lines(0)
+  {
+    link.onFrame([this](const swiftler::Frame& frame_) { onFrame(frame_); });
+    link.onLine([this](const swiftler::Line& line_) { onLine(line_); });
+    // No stream competing, then the shell in machine mode
+    link.setTelemetry(0);
+    link.sendLine("");
+    link.sendLine("machine 1");
+    if (!waitOk())
+      throw std::runtime_error("no shell on the board");
+    std::vector<std::vector<long> > values;
+    query("qr", values);
+    query("fr", values);
+  }
+
+  // The shell as it was
+  void close()
+  {
+    link.sendLine("machine 0");
+    drain(100000000);
+  }
+
+  void run(Source& source_, double speed_, int seconds_)
+  {
+    const uint64_t start = nowNs();
+    const uint64_t end = start + seconds_ * 1000000000ull;
+    uint64_t sent = 0, lost = 0;
+    Command command;
+
+    while (source_.next(command))
+    {
+      const uint64_t due = speed_ > 0 ?
+        start + (uint64_t)(command.at_ns / speed_) : start;
+      if (due >= end)
+        break;
+      for (;;)
+      {
+        const uint64_t now = nowNs();
+        lost += expire(now);
+        if (now >= end)
+          break;
+        if (speed_ > 0 ? now >= due :
+            command.answered ? inFlight() < WINDOW : !link.wantsWrite())
+          break;
+        link.poll(1);
+      }
+      if (nowNs() >= end)
+        break;
+      send(command);
+      sent++;
+    }
+    const uint64_t elapsed = nowNs() - start;
+
+    // The replies still on their way, then whatever else came
+    const uint64_t drained = nowNs();
+    while (inFlight() && nowNs() - drained < TIMEOUT_NS)
+      link.poll(1);
+    lost += inFlight();
+    frames.clear();
+    tags.clear();
+    drain(100000000);
+
+    report("load.sent", sent);
+    report("load.commands_per_s", sent * 1e9 / elapsed);
+    report("load.replies", replies);
+    report("load.lost", lost);
+    report("load.nacks", nacks);
+    report("load.errors", errors);
+    report("load.lines", lines);
+    reportPercentiles("load.reply_us", latency);
+    report("load.crc_errors", link.stats().crc_errors);
+  }
+
+  void boardStats()
+  {
+    static const char* const uart[] =
+      { "overruns", "framing", "noise", "dropped", "pauses" };
+    static const char* const queue[] =
+      { "size", "high_water", "blocked", "blocked_ms", "dropped" };
+    static const char* const loop[] =
+      { "count", "min_us", "mean_us", "max_us" };
+    std::vector<std::vector<long> > values;
+
+    // Not on every firmware
+    if (query("us", values) && !values.empty())
+      reportValues("board.uart.", uart, 5, values[0]);
+    if (query("q", values))
+      for (size_t i = 0; i < values.size(); i++)
+        reportValues("board.queue." + std::to_string(i) + ".", queue, 5,
+                     values[i]);
+    if (query("mj", values) && !values.empty())
+      reportValues("board.loop.", loop, 4, values[0]);
+  }
+
+private:
+  size_t inFlight() const { return frames.size() + tags.size(); }
+
+  void send(const Command& command_)
+  {
+    const uint64_t now = nowNs();
+
+    if (command_.frame)
+    {
+      link.sendFrame(command_.type, command_.text.data(),
+                     (uint8_t)command_.text.size());
+      frames.push_back(std::make_pair(command_.type, now));
+    }
+    else if (command_.answered)
+    {
+      tags[++seq] = now;
+      link.sendLine("#" + std::to_string(seq) + " " + command_.text);
+    }
+    else
+      link.sendLine(command_.text);
+  }
+
+  // Given up on, the oldest ones first: the count
+  uint64_t expire(uint64_t now_)
+  {
+    uint64_t lost = 0;
+
+    while (!frames.empty() && now_ - frames.front().second > TIMEOUT_NS)
+    {
+      frames.pop_front();
+      lost++;
+    }
+    // The tags grow with the time sent
+    while (!tags.empty() && now_ - tags.begin()->second > TIMEOUT_NS)
+    {
+      tags.erase(tags.begin());
+      lost++;
+    }
+    return lost;
+  }
+
+  void replied(uint64_t sent_ns_, uint64_t time_ns_)
+  {
+    latency.push_back(time_ns_ > sent_ns_ ? time_ns_ - sent_ns_ : 0);
+    replies++;
+  }
+
+  void onFrame(const swiftler::Frame& frame_)
+  {
+    uint8_t request;
+
+    if (frame_.type == PROTO_SENSORS)
+      request = PROTO_SENSORS_REQ;
+    else if ((frame_.type == PROTO_ACK || frame_.type == PROTO_NACK) &&
+             frame_.size == 1)
+      request = frame_.payload[0];
+    else
+      return;
+    // In order, per request type
+    for (auto i = frames.begin(); i != frames.end(); ++i)
+      if (i->first == request)
+      {
+        replied(i->second, frame_.time_ns);
+        frames.erase(i);
+        if (frame_.type == PROTO_NACK)
+          nacks++;
+        return;
+      }
+  }
+
+  void onLine(const swiftler::Line& line_)
+  {
+    std::string text(line_.text, line_.size);
+
+    while (!text.empty() && (text.back() == '\r' || text.back() == ' '))
+      text.erase(text.size() - 1);
+    lines++;
+    if (text.size() > 1 && text[0] == '#')
+    {
+      // "#n ok", "#n eN" end the tagged command n
+      const size_t space = text.find(' ');
+      const uint32_t tag = (uint32_t)strtoul(text.c_str() + 1, nullptr, 10);
+      const std::string reply =
+        space == std::string::npos ? "" : text.substr(space + 1);
+      const bool error = isError(reply);
+      auto i = tags.find(tag);
+      if (i != tags.end() && (reply == "ok" || error))
+      {
+        replied(i->second, line_.time_ns);
+        tags.erase(i);
+        if (error)
+          errors++;
+      }
+      return;
+    }
+    pending.push_back(text);
+  }
+
+  static bool isError(const std::string& reply_)
+  {
+    return reply_.size() > 1 && reply_[0] == 'e' &&
+      reply_.find_first_not_of("0123456789", 1) == std::string::npos;
+  }
+
+  bool waitOk()
+  {
+    const uint64_t start = nowNs();
+
+    while (nowNs() - start < TIMEOUT_NS)
+    {
+      while (!pending.empty())
+      {
+        const std::string line = pending.front();
+        pending.pop_front();
+        if (line == "ok")
+          return true;
+      }
+      link.poll(1);
+    }
+    return false;
+  }
+
+  // An untagged command in machine mode, its values lines: false on an
+  // error or no answer
+  bool query(const std::string& line_, std::vector<std::vector<long> >& values_)
+  {
+    const uint64_t start = nowNs();
+
+    values_.clear();
+    pending.clear();
+    link.sendLine(line_);
+    while (nowNs() - start < TIMEOUT_NS)
+    {
+      link.poll(1);
+      while (!pending.empty())
+      {
+        const std::string line = pending.front();
+        pending.pop_front();
+        if (line == "ok")
+          return true;
+        if (isError(line))
+          return false;
+        std::istringstream fields(line);
+        std::vector<long> row;
+        long value;
+        while (fields >> value)
+          row.push_back(value);
+        if (!row.empty())
+          values_.push_back(row);
+      }
+    }
+    return false;
+  }
+
+  void reportValues(const std::string& prefix_, const char* const* names_,
+                    size_t n_, const std::vector<long>& row_)
+  {
+    for (size_t i = 0; i < n_ && i < row_.size(); i++)
+      report(prefix_ + names_[i], row_[i]);
+  }
+
+  void drain(uint64_t ns_)
+  {
+    const uint64_t start = nowNs();
+    while (nowNs() - start < ns_)
+      link.poll(1);
+  }
+
+  swiftler::Link link;
+  uint32_t seq;
+  // Request type and time sent, of the frames in flight
+  std::deque<std::pair<uint8_t, uint64_t> > frames;
+  // Time sent of the tagged lines in flight
+  std::map<uint32_t, uint64_t> tags;
+  std::deque<std::string> pending;
+  std::vector<uint64_t> latency;
+  uint64_t replies;
+  uint64_t nacks;
+  uint64_t errors;
+  uint64_t lines;
+};
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  const char* device = argc > 1 ? argv[1] : "/dev/ttyUSB0";
+  const std::string kind = argc > 2 ? argv[2] : "frames";
+  const double speed = argc > 3 ? atof(argv[3]) : 1;
+  const int seconds = argc > 4 ? atoi(argv[4]) : 10;
+
+  try
+  {
+    std::unique_ptr<Source> source;
+    if (kind == "frames")
+      source.reset(new FramesSource());
+    else if (kind == "shell")
+      source.reset(new ShellSource());
+    else
+      source.reset(new ReplaySource(kind));
+
+    LoadGen load(device);
+    report("load.speed", speed);
+    load.run(*source, speed, seconds);
+    load.boardStats();
+    load.close();
+  }
+  catch (const std::exception& e)
+  {
+    fprintf(stderr, "loadgen: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,462 @@
+// Statistics of telemetry session archives (.ses, wtools/session.py),
+// to compare two firmware versions on their recorded runs:
+//   sessionstats [-j threads] a.ses... [-- b.ses...]
+//
+// The sessions are read in parallel, one per worker thread at a time,
+// mapped and turned into columns, then reduced by plain loops over the
+// columns, which the compiler vectorizes. A "key value" report per
+// group, and with a second group, "key a b change%" lines:
+// - interval: the board ticks between the records (ms), percentiles,
+//   jitter their distance to the median;
+// - latency: host time of the read less the board tick, against the
+//   least of the session (ms), percentiles;
+// - drops: the records missing from the ticks, at the median interval;
+// - noise: of each sensor channel, the standard deviation of the first
+//   differences over sqrt(2), white noise on a slow signal;
+// - cpu: mean busy permille, link_errors: their increase.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "swiftler_c.h"
+
+namespace {
+
+// Kept in step with wtools/session.py
+const char MAGIC[8] = { 'S', 'W', 'S', 'E', 'S', 'S', '\r', '\n' };
+const char INDEX_MAGIC[8] = { 'S', 'W', 'S', 'E', 'S', 'I', 'D', 'X' };
+const uint16_t VERSION = 1;
+const size_t HEADER_SIZE = 64;
+
+struct Header
+{
+  char magic[8];
+  uint16_t version;
+  uint16_t record_size;
+  uint32_t chunk_records;
+  char format[48];
+} __attribute__((packed));
+
+struct Trailer
+{
+  char magic[8];
+  uint64_t index_offset;
+  uint32_t chunks;
+  uint32_t records;
+} __attribute__((packed));
+
+static_assert(sizeof (Header) == HEADER_SIZE, "Header layout");
+static_assert(sizeof (swiftler_telemetry_t) == 40, "Record layout");
+
+// The channels of the records, as in proto_telemetry_t
+enum {
+  SHARP_LEFT, SONAR, SHARP_RIGHT, MOTOR_LEFT, MOTOR_RIGHT, BATTERY,
+  CURRENT, CUT_OFF, X, Y, THETA, SONAR_LEFT, SONAR_RIGHT, CPU,
+  LINK_ERRORS, CHANNELS_NB
+};
+
+const char* const CHANNEL_NAMES[CHANNELS_NB] =
+  {
+    "sharp_left_mm", "sonar_mm", "sharp_right_mm", "motor_left",
+    "motor_right", "battery_mv", "current_ma", "cut_off", "x_mm", "y_mm",
+    "theta_mrad", "sonar_left_mm", "sonar_right_mm", "cpu_permille",
+    "link_errors",
+  };
+
+// Of the noise: the sensors, not the commands nor the pose
+const int NOISY[] =
+  {
+    SHARP_LEFT, SONAR, SHARP_RIGHT, BATTERY, CURRENT, SONAR_LEFT,
+    SONAR_RIGHT,
+  };
+
+// A session in columns
+struct Columns
+{
+  std::vector<double> host_s;
+  std::vector<uint32_t> tick;
+  std::vector<int32_t> channel[CHANNELS_NB];
+};
+
+// What a session adds to its group
+struct Partial
+{
+  uint64_t records;
+  uint64_t drops;
+  uint64_t linkErrors;
+  int64_t cpuSum;
+  double noiseSq[CHANNELS_NB];   // Sums of the squared differences
+  uint64_t noiseNb[CHANNELS_NB];
+  std::vector<int32_t> intervals;
+  std::vector<int32_t> jitter;
+  std::vector<float> latency;
+};
+
+// Maps the file, the records into columns. Throws std::system_error,
+// std::runtime_error.
+void load(const std::string& path_, Columns& out_)
+{
+  const int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+
+  if (fd < 0 || fstat(fd, &st) < 0)
+    throw std::system_error(errno, std::generic_category(), path_);
+  const size_t size = st.st_size;
+  void* map = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)
+    : MAP_FAILED;
+  close(fd);
+  if (map == MAP_FAILED)
+    throw std::system_error(errno, std::generic_category(), path_);
+
+  const uint8_t* data = static_cast<const uint8_t*>(map);
+  Header header = {};
+
+  if (size >= HEADER_SIZE)
+    memcpy(&header, data, sizeof (header));
+  if (memcmp(header.magic, MAGIC, sizeof (MAGIC)) ||
+      header.version != VERSION ||
+      header.record_size != sizeof (swiftler_telemetry_t))
+  {
+    munmap(map, size);
+    throw std::runtime_error(path_ + ": not a session archive");
+  }
+
+  // Cut short, without its trailer: the whole records there are
+  size_t records = (size - HEADER_SIZE) / sizeof (swiftler_telemetry_t);
+  Trailer trailer;
+  if (size >= HEADER_SIZE + sizeof (trailer))
+  {
+    memcpy(&trailer, data + size - sizeof (trailer), sizeof (trailer));
+    const uint64_t end =
+      HEADER_SIZE + (uint64_t)trailer.records * sizeof (swiftler_telemetry_t);
+    if (!memcmp(trailer.magic, INDEX_MAGIC, sizeof (INDEX_MAGIC)) &&
+        trailer.index_offset == end)
+      records = trailer.records;
+  }
+
+  // Sequential once, the kernel reads ahead
+  madvise(map, size, MADV_SEQUENTIAL);
+  out_.host_s.resize(records);
+  out_.tick.resize(records);
+  for (int c = 0; c < CHANNELS_NB; c++)
+    out_.channel[c].resize(records);
+  for (size_t i = 0; i < records; i++)
+  {
+    swiftler_telemetry_t r;
+    memcpy(&r, data + HEADER_SIZE + i * sizeof (r), sizeof (r));
+    const proto_telemetry_t& t = r.telemetry;
+
+    out_.host_s[i] = r.host_s;
+    out_.tick[i] = t.tick;
+    out_.channel[SHARP_LEFT][i] = t.sharp_left_mm;
+    out_.channel[SONAR][i] = t.sonar_mm;
+    out_.channel[SHARP_RIGHT][i] = t.sharp_right_mm;
+    out_.channel[MOTOR_LEFT][i] = t.motor_left;
+    out_.channel[MOTOR_RIGHT][i] = t.motor_right;
+    out_.channel[BATTERY][i] = t.battery_mv;
+    out_.channel[CURRENT][i] = t.current_ma;
+    out_.channel[CUT_OFF][i] = t.cut_off;
+    out_.channel[X][i] = t.x_mm;
+    out_.channel[Y][i] = t.y_mm;
+    out_.channel[THETA][i] = t.theta_mrad;
+    out_.channel[SONAR_LEFT][i] = t.sonar_left_mm;
+    out_.channel[SONAR_RIGHT][i] = t.sonar_right_mm;
+    out_.channel[CPU][i] = t.cpu_permille;
+    out_.channel[LINK_ERRORS][i] = t.link_errors;
+  }
+  munmap(map, size);
+}
+
+// The kernels, over whole columns
+
+void differences(const uint32_t* in_, size_t n_, int32_t* out_)
+{
+  for (size_t i = 1; i < n_; i++)
+    out_[i - 1] = (int32_t)(in_[i] - in_[i - 1]);
+}
+
+double sumSquaredDifferences(const int32_t* in_, size_t n_)
+{
+  int64_t sum = 0;
+
+  for (size_t i = 1; i < n_; i++)
+  {
+    const int64_t d = in_[i] - in_[i - 1];
+    sum += d * d;
+  }
+  return (double)sum;
+}
+
+int64_t sum(const int32_t* in_, size_t n_)
+{
+  int64_t total = 0;
+
+  for (size_t i = 0; i < n_; i++)
+    total += in_[i];
+  return total;
+}
+
+// Wrapping uint8_t counter
+uint64_t increase8(const int32_t* in_, size_t n_)
+{
+  uint64_t total = 0;
+
+  for (size_t i = 1; i < n_; i++)
+    total += (uint8_t)(in_[i] - in_[i - 1]);
+  return total;
+}
+
+template <typename T> T median(std::vector<T> values_)
+{
+  if (values_.empty())
+    return T();
+  std::nth_element(values_.begin(), values_.begin() + values_.size() / 2,
+                   values_.end());
+  return values_[values_.size() / 2];
+}
+
+void analyze(const Columns& c_, Partial& p_)
+{
+  const size_t n = c_.tick.size();
+
+  p_.records = n;
+  p_.drops = 0;
+  p_.cpuSum = sum(c_.channel[CPU].data(), n);
+  p_.linkErrors = increase8(c_.channel[LINK_ERRORS].data(), n);
+  for (int i = 0; i < CHANNELS_NB; i++)
+  {
+    p_.noiseSq[i] = 0;
+    p_.noiseNb[i] = 0;
+  }
+  if (n < 2)
+    return;
+
+  p_.intervals.resize(n - 1);
+  differences(c_.tick.data(), n, p_.intervals.data());
+  const int32_t period = median(p_.intervals);
+  p_.jitter.resize(n - 1);
+  for (size_t i = 0; i < n - 1; i++)
+  {
+    const int32_t d = p_.intervals[i] - period;
+    p_.jitter[i] = d < 0 ? -d : d;
+  }
+  if (period > 0)
+    for (size_t i = 0; i < n - 1; i++)
+    {
+      // Half a period of jitter is on time
+      const int32_t periods = (p_.intervals[i] + period / 2) / period;
+      if (periods > 1)
+        p_.drops += periods - 1;
+    }
+
+  // The link delay plus the host one, up to a constant: against the
+  // least of the session
+  double least = INFINITY;
+  for (size_t i = 0; i < n; i++)
+    least = std::min(least, c_.host_s[i] * 1000.0 - c_.tick[i]);
+  p_.latency.resize(n);
+  for (size_t i = 0; i < n; i++)
+    p_.latency[i] = c_.host_s[i] * 1000.0 - c_.tick[i] - least;
+
+  for (size_t k = 0; k < sizeof (NOISY) / sizeof (NOISY[0]); k++)
+  {
+    const int ch = NOISY[k];
+    p_.noiseSq[ch] = sumSquaredDifferences(c_.channel[ch].data(), n);
+    p_.noiseNb[ch] = n - 1;
+  }
+}
+
+struct Group
+{
+  std::vector<std::string> paths;
+  std::vector<Partial> partials;
+  std::vector<std::string> failed;
+};
+
+// The sessions of all groups by the workers, each taking the next one
+void process(std::vector<Group>& groups_, unsigned threads_)
+{
+  std::vector<std::pair<size_t, size_t> > jobs;
+  std::atomic<size_t> next(0);
+  std::mutex lock;
+
+  for (size_t g = 0; g < groups_.size(); g++)
+  {
+    groups_[g].partials.resize(groups_[g].paths.size());
+    for (size_t i = 0; i < groups_[g].paths.size(); i++)
+      jobs.push_back(std::make_pair(g, i));
+  }
+
+  auto worker = [&]()
+    {
+      Columns columns;
+
+      for (size_t j; (j = next++) < jobs.size(); )
+      {
+        Group& group = groups_[jobs[j].first];
+        const std::string& path = group.paths[jobs[j].second];
+        try
+        {
+          load(path, columns);
+          analyze(columns, group.partials[jobs[j].second]);
+        }
+        catch (const std::exception& e)
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          group.failed.push_back(e.what());
+        }
+      }
+    };
+
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < std::max(1u, threads_); i++)
+    workers.push_back(std::thread(worker));
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+}
+
+typedef std::vector<std::pair<std::string, double> > Report;
+
+template <typename T>
+void percentiles(Report& report_, const std::string& key_,
+                 std::vector<T>& values_)
+{
+  static const struct { const char* name; double at; } points[] =
+    { { "p50", 0.50 }, { "p90", 0.90 }, { "p99", 0.99 }, { "max", 1.0 } };
+
+  if (values_.empty())
+    return;
+  for (size_t i = 0; i < sizeof (points) / sizeof (points[0]); i++)
+  {
+    const size_t index = (size_t)(points[i].at * (values_.size() - 1));
+    std::nth_element(values_.begin(), values_.begin() + index,
+                     values_.end());
+    report_.push_back(std::make_pair(key_ + "." + points[i].name,
+                                     (double)values_[index]));
+  }
+}
+
+Report reduce(Group& group_)
+{
+  Report report;
+  uint64_t records = 0, drops = 0, linkErrors = 0;
+  int64_t cpu = 0;
+  double noiseSq[CHANNELS_NB] = {};
+  uint64_t noiseNb[CHANNELS_NB] = {};
+  std::vector<int32_t> intervals, jitter;
+  std::vector<float> latency;
+
+  for (size_t i = 0; i < group_.partials.size(); i++)
+  {
+    Partial& p = group_.partials[i];
+    records += p.records;
+    drops += p.drops;
+    linkErrors += p.linkErrors;
+    cpu += p.cpuSum;
+    for (int c = 0; c < CHANNELS_NB; c++)
+    {
+      noiseSq[c] += p.noiseSq[c];
+      noiseNb[c] += p.noiseNb[c];
+    }
+    intervals.insert(intervals.end(), p.intervals.begin(), p.intervals.end());
+    jitter.insert(jitter.end(), p.jitter.begin(), p.jitter.end());
+    latency.insert(latency.end(), p.latency.begin(), p.latency.end());
+  }
+
+  report.push_back(std::make_pair("sessions",
+                                  (double)(group_.paths.size() -
+                                           group_.failed.size())));
+  report.push_back(std::make_pair("records", (double)records));
+  percentiles(report, "interval", intervals);
+  percentiles(report, "jitter", jitter);
+  percentiles(report, "latency", latency);
+  report.push_back(std::make_pair("drops", (double)drops));
+  report.push_back(std::make_pair("drops.permille",
+                                  records + drops ?
+                                  1000.0 * drops / (records + drops) : 0));
+  for (size_t k = 0; k < sizeof (NOISY) / sizeof (NOISY[0]); k++)
+  {
+    const int c = NOISY[k];
+    if (noiseNb[c])
+      report.push_back(std::make_pair(std::string("noise.") +
+                                      CHANNEL_NAMES[c],
+                                      sqrt(noiseSq[c] / noiseNb[c] / 2)));
+  }
+  report.push_back(std::make_pair("cpu.mean",
+                                  records ? (double)cpu / records : 0));
+  report.push_back(std::make_pair("link_errors", (double)linkErrors));
+  return report;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  std::vector<Group> groups(1);
+  unsigned threads = std::thread::hardware_concurrency();
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-j") && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--") && groups.size() == 1)
+      groups.push_back(Group());
+    else
+      groups.back().paths.push_back(argv[i]);
+  }
+  if (groups[0].paths.empty() || groups.back().paths.empty())
+  {
+    fprintf(stderr, "sessionstats [-j threads] a.ses... [-- b.ses...]\n");
+    return 2;
+  }
+
+  process(groups, threads);
+
+  std::vector<Report> reports;
+  for (size_t g = 0; g < groups.size(); g++)
+  {
+    for (size_t i = 0; i < groups[g].failed.size(); i++)
+      fprintf(stderr, "sessionstats: %s\n", groups[g].failed[i].c_str());
+    reports.push_back(reduce(groups[g]));
+  }
+
+  if (reports.size() == 1)
+  {
+    for (size_t i = 0; i < reports[0].size(); i++)
+      printf("%s %.2f\n", reports[0][i].first.c_str(), reports[0][i].second);
+    return 0;
+  }
+
+  // The keys of the first group, in its order
+  for (size_t i = 0; i < reports[0].size(); i++)
+  {
+    const std::string& key = reports[0][i].first;
+    const double a = reports[0][i].second;
+    for (size_t j = 0; j < reports[1].size(); j++)
+      if (reports[1][j].first == key)
+      {
+        const double b = reports[1][j].second;
+        if (a)
+          printf("%s %.2f %.2f %+.1f%%\n", key.c_str(), a, b,
+                 100.0 * (b - a) / fabs(a));
+        else
+          printf("%s %.2f %.2f -\n", key.c_str(), a, b);
+      }
+  }
+}
@@ -0,0 +1,209 @@
+#include "swiftler_c.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <string>
+
+#include <time.h>
+
+#include "swiftler_link.h"
+
+struct swiftler_stream
+{
+  explicit swiftler_stream(const char* device_, int baudrate_)
+    : link(device_, baudrate_), dropped(0)
+  {
+    struct timespec wall, monotonic;
+
+    // Link stamps the reads with CLOCK_MONOTONIC, the scripts time.time()
+    clock_gettime(CLOCK_REALTIME, &wall);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    offsetS = (wall.tv_sec - monotonic.tv_sec) +
+      (wall.tv_nsec - monotonic.tv_nsec) / 1e9;
+
+    link.onFrame([this](const swiftler::Frame& frame_) { onFrame(frame_); });
+    link.onLine([this](const swiftler::Line& line_) { onLine(line_); });
+  }
+
+  void onFrame(const swiftler::Frame& frame_)
+  {
+    const double host_s = frame_.time_ns / 1e9 + offsetS;
+
+    if (frame_.type == PROTO_TELEMETRY && frame_.as<proto_telemetry_t>())
+    {
+      pushTelemetry(host_s, *frame_.as<proto_telemetry_t>());
+      return;
+    }
+    // A record per frame, as wtools/telemetry.Decoder
+    if (deltas.feed(frame_))
+    {
+      if (deltas.complete())
+        pushTelemetry(host_s, deltas.current());
+      return;
+    }
+
+    swiftler_frame_t f;
+    f.host_s = host_s;
+    f.type = frame_.type;
+    f.size = frame_.size;
+    memcpy(f.payload, frame_.payload, frame_.size);
+    push(frames, f);
+  }
+
+  void onLine(const swiftler::Line& line_)
+  {
+    lines.append(line_.text, line_.size);
+    lines += '\n';
+    if (lines.size() > SWIFTLER_PENDING_MAX * 16)
+    {
+      // Whole lines first
+      const size_t cut = lines.find('\n', lines.size() / 2) + 1;
+      lines.erase(0, cut);
+      dropped++;
+    }
+  }
+
+  void pushTelemetry(double host_s_, const proto_telemetry_t& telemetry_)
+  {
+    swiftler_telemetry_t record;
+    record.host_s = host_s_;
+    record.telemetry = telemetry_;
+    push(telemetry, record);
+  }
+
+  template <typename T> void push(std::deque<T>& queue_, const T& item_)
+  {
+    if (queue_.size() >= SWIFTLER_PENDING_MAX)
+    {
+      queue_.pop_front();
+      dropped++;
+    }
+    queue_.push_back(item_);
+  }
+
+  template <typename T> size_t take(std::deque<T>& queue_, T* out_,
+                                    size_t max_)
+  {
+    const size_t n = std::min(max_, queue_.size());
+    std::copy(queue_.begin(), queue_.begin() + n, out_);
+    queue_.erase(queue_.begin(), queue_.begin() + n);
+    return n;
+  }
+
+  swiftler::Link link;
+  swiftler::TelemetryDeltas deltas;
+  double offsetS;
+  std::deque<swiftler_telemetry_t> telemetry;
+  std::deque<swiftler_frame_t> frames;
+  std::string lines;
+  uint64_t dropped;
+};
+
+namespace {
+
+thread_local std::string lastError;
+
+// The exceptions stop here, C has none
+template <typename F> int guarded(F f_)
+{
+  try
+  {
+    return f_();
+  }
+  catch (const std::exception& e)
+  {
+    lastError = e.what();
+    return -1;
+  }
+}
+
+} // namespace
+
+swiftler_stream_t* swiftler_open(const char* device_, int baudrate_)
+{
+  swiftler_stream_t* stream = nullptr;
+
+  guarded([&]()
+          {
+            stream = new swiftler_stream(device_, baudrate_);
+            return 0;
+          });
+  return stream;
+}
+
+void swiftler_close(swiftler_stream_t* stream_)
+{
+  delete stream_;
+}
+
+const char* swiftler_last_error()
+{
+  return lastError.c_str();
+}
+
+int swiftler_poll(swiftler_stream_t* stream_, int timeout_ms_)
+{
+  return guarded([&]() { return (int)stream_->link.poll(timeout_ms_); });
+}
+
+size_t swiftler_take_telemetry(swiftler_stream_t* stream_,
+                               swiftler_telemetry_t* out_, size_t max_)
+{
+  return stream_->take(stream_->telemetry, out_, max_);
+}
+
+size_t swiftler_take_frames(swiftler_stream_t* stream_,
+                            swiftler_frame_t* out_, size_t max_)
+{
+  return stream_->take(stream_->frames, out_, max_);
+}
+
+size_t swiftler_take_lines(swiftler_stream_t* stream_, char* out_,
+                           size_t size_)
+{
+  std::string& lines = stream_->lines;
+
+  if (!size_ || lines.empty())
+    return 0;
+  size_t n = lines.rfind('\n', size_ - 1);
+  n = n == std::string::npos ? std::min(size_, lines.size()) : n + 1;
+  memcpy(out_, lines.data(), n);
+  lines.erase(0, n);
+  return n;
+}
+
+uint64_t swiftler_dropped(const swiftler_stream_t* stream_)
+{
+  return stream_->dropped;
+}
+
+int swiftler_send_line(swiftler_stream_t* stream_, const char* line_)
+{
+  return guarded([&]() { stream_->link.sendLine(line_); return 1; }) > 0;
+}
+
+int swiftler_send_frame(swiftler_stream_t* stream_, uint8_t type_,
+                        const void* payload_, uint8_t size_)
+{
+  return guarded([&]()
+                 {
+                   stream_->link.sendFrame(type_, payload_, size_);
+                   return 1;
+                 }) > 0;
+}
+
+int swiftler_set_telemetry(swiftler_stream_t* stream_, uint16_t period_ms_,
+                           uint16_t heartbeat_ms_)
+{
+  return guarded([&]()
+                 {
+                   if (heartbeat_ms_)
+                     stream_->link.setTelemetryOnChange(period_ms_,
+                                                        heartbeat_ms_);
+                   else
+                     stream_->link.setTelemetry(period_ms_);
+                   return 1;
+                 }) > 0;
+}
@@ -0,0 +1,76 @@
+#ifndef SWIFTLER_C_H
+# define SWIFTLER_C_H
+
+// C interface of the link library, for the Python scripts (ctypes,
+// wtools/native.py): the port read and decoded natively, the telemetry
+// handed out as packed records in bulk, straight into the caller's
+// buffer (a numpy array), no object per sample.
+//
+// Built by "waf client" as libswiftler.so.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "libglobal/protocol.h"
+
+typedef struct swiftler_stream swiftler_stream_t;
+
+// The layout of RECORD, wtools/telemetry.py: the host time, then the
+// frame. The report on change frames come merged into whole ones.
+typedef struct
+{
+  double host_s;            // time.time() of the read
+  proto_telemetry_t telemetry;
+} __attribute__((packed)) swiftler_telemetry_t;
+
+// Any other frame
+typedef struct
+{
+  double host_s;
+  uint8_t type;
+  uint8_t size;
+  uint8_t payload[PROTO_MAX_PAYLOAD];
+} __attribute__((packed)) swiftler_frame_t;
+
+// Kept until taken, each kind: the older ones are dropped beyond
+#define SWIFTLER_PENDING_MAX 65536
+
+// NULL on failure, the reason in swiftler_last_error()
+swiftler_stream_t* swiftler_open(const char* device_, int baudrate_);
+void swiftler_close(swiftler_stream_t* stream_);
+// Of the calling thread
+const char* swiftler_last_error();
+
+// Wait up to timeout_ms_ (-1: forever) for input, decode all of it, send
+// what is pending: the bytes read, -1 on an I/O error
+int swiftler_poll(swiftler_stream_t* stream_, int timeout_ms_);
+
+// Move up to max_ of the pending ones, oldest first, into out_: the count
+size_t swiftler_take_telemetry(swiftler_stream_t* stream_,
+                               swiftler_telemetry_t* out_, size_t max_);
+size_t swiftler_take_frames(swiftler_stream_t* stream_,
+                            swiftler_frame_t* out_, size_t max_);
+// Console lines, each ended by '\n', whole lines up to size_ bytes: the
+// bytes written. A line longer than size_ is cut.
+size_t swiftler_take_lines(swiftler_stream_t* stream_, char* out_,
+                           size_t size_);
+// Dropped for want of a taker so far, all kinds
+uint64_t swiftler_dropped(const swiftler_stream_t* stream_);
+
+// 0 on an I/O error
+int swiftler_send_line(swiftler_stream_t* stream_, const char* line_);
+int swiftler_send_frame(swiftler_stream_t* stream_, uint8_t type_,
+                        const void* payload_, uint8_t size_);
+// PROTO_TELEM_CFG, or PROTO_TELEM_DELTA_CFG with a heartbeat
+int swiftler_set_telemetry(swiftler_stream_t* stream_, uint16_t period_ms_,
+                           uint16_t heartbeat_ms_);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,125 @@
+#include "swiftler_clock.h"
+
+#include <algorithm>
+
+namespace swiftler {
+
+ClockSync::ClockSync()
+  : cookie(0), sentNs(0), count(0), next(0), lastUs(0), lastBoardUs(0),
+    tickOffsetUs(0), lastRtt(0), baseUs(0), baseNs(0), rate(1.0)
+{
+}
+
+uint32_t ClockSync::ping(uint64_t now_ns_)
+{
+  // A late reply to an older ping is refused
+  sentNs = now_ns_;
+  return ++cookie;
+}
+
+int64_t ClockSync::unwrap(uint32_t time_us_) const
+{
+  return lastBoardUs + (int32_t)(time_us_ - lastUs);
+}
+
+bool ClockSync::update(const proto_time_t& reply_, uint64_t received_ns_)
+{
+  if (reply_.cookie != cookie || !sentNs || received_ns_ < sentNs)
+    return false;
+
+  const int64_t board_us = count ? unwrap(reply_.time_us) : reply_.time_us;
+  const int32_t tick_us = (int32_t)(reply_.time_us - reply_.tick * 1000u);
+  Sample& sample = samples[next];
+
+  sample.board_us = board_us;
+  sample.rtt_ns = received_ns_ - sentNs;
+  sample.host_ns = sentNs + sample.rtt_ns / 2;
+  next = (next + 1) % SAMPLES;
+  if (count < SAMPLES)
+    count++;
+
+  if (count == 1 || tick_us < tickOffsetUs)
+    tickOffsetUs = tick_us;
+  lastUs = reply_.time_us;
+  lastBoardUs = board_us;
+  lastRtt = sample.rtt_ns;
+  sentNs = 0;
+
+  fit();
+  return true;
+}
+
+// Least squares through the fastest half of the round trips: the slow
+// ones waited in a queue on one side, their middle is off
+void ClockSync::fit()
+{
+  const Sample* best[SAMPLES] = { nullptr };
+  size_t n;
+
+  if (!count)
+    return;
+  for (n = 0; n < count; n++)
+    best[n] = &samples[n];
+  std::sort(best, best + n, [](const Sample* a_, const Sample* b_)
+    {
+      return a_->rtt_ns < b_->rtt_ns;
+    });
+  if (n >= 4)
+    n /= 2;
+
+  // Centered, the doubles keep the nanoseconds
+  const int64_t us0 = best[0]->board_us;
+  const int64_t ns0 = best[0]->host_ns;
+  double mx = 0, my = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    mx += best[i]->board_us - us0;
+    my += best[i]->host_ns - ns0;
+  }
+  mx /= n;
+  my /= n;
+
+  double sxx = 0, sxy = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    const double dx = best[i]->board_us - us0 - mx;
+    sxx += dx * dx;
+    sxy += dx * (best[i]->host_ns - ns0 - my);
+  }
+
+  baseUs = us0 + (int64_t)mx;
+  baseNs = ns0 + my - (mx - (int64_t)mx) * 1000 * rate;
+  // Drift needs the samples spread over a few seconds
+  if (sxx > 1e12)
+  {
+    rate = sxy / sxx / 1000;
+    baseNs = ns0 + my - (mx - (int64_t)mx) * 1000 * rate;
+  }
+}
+
+uint64_t ClockSync::usToHostNs(uint32_t time_us_) const
+{
+  return (uint64_t)(baseNs + (unwrap(time_us_) - baseUs) * 1000 * rate);
+}
+
+uint32_t ClockSync::hostNsToUs(uint64_t host_ns_) const
+{
+  return (uint32_t)(baseUs + (int64_t)((host_ns_ - baseNs) / (1000 * rate)));
+}
+
+uint64_t ClockSync::tickToHostNs(uint32_t tick_) const
+{
+  return usToHostNs(tick_ * 1000u + (uint32_t)tickOffsetUs);
+}
+
+uint64_t ClockSync::bestRttNs() const
+{
+  uint64_t best = 0;
+
+  for (size_t i = 0; i < count; i++)
+    if (!best || samples[i].rtt_ns < best)
+      best = samples[i].rtt_ns;
+  return best;
+}
+
+} // namespace swiftler
@@ -0,0 +1,88 @@
+#ifndef SWIFTLER_CLOCK_H
+# define SWIFTLER_CLOCK_H
+
+// Board time to host time (CLOCK_MONOTONIC), from PROTO_TIME_REQ pings:
+// each reply gives the board microseconds between the host send and
+// receive times. The fastest round trips bound the offset best, a line
+// fitted through them gives the offset and the drift of the board
+// crystal. Feed it a ping a second or so:
+//
+//   link.send(PROTO_TIME_REQ, clock.ping(nowNs()));
+//   ... on PROTO_TIME: clock.update(*frame.as<proto_time_t>(), frame.time_ns);
+//   ... clock.toHostNs(telemetry.tick)
+
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+#include "libglobal/protocol.h"
+}
+
+namespace swiftler {
+
+class ClockSync
+{
+public:
+  ClockSync();
+
+  // The cookie of the next request, sent at now_ns_
+  uint32_t ping(uint64_t now_ns_);
+  // False for a stale or unknown cookie
+  bool update(const proto_time_t& reply_, uint64_t received_ns_);
+
+  // Two pings at least
+  bool synced() const { return count >= 2; }
+
+  // Board clocks in host nanoseconds. Within 35 minutes of the last
+  // reply, past the 32 bits wrap of the board counters.
+  uint64_t usToHostNs(uint32_t time_us_) const;
+  // The kernel tick stamps of the frames (telemetry, events): the tick
+  // starts at the edge found by the pings
+  uint64_t tickToHostNs(uint32_t tick_) const;
+  // The other way, on the board microseconds (xTimeNowUs): the sonar
+  // windows of a fleet ("sw") placed on each board from one host time
+  uint32_t hostNsToUs(uint64_t host_ns_) const;
+
+  // Board clock rate error, parts per million
+  double driftPpm() const { return (rate - 1.0) * 1e6; }
+  // Round trip of the last reply, and the best one kept
+  uint64_t lastRttNs() const { return lastRtt; }
+  uint64_t bestRttNs() const;
+
+private:
+  struct Sample
+  {
+    int64_t board_us; // Unwrapped
+    int64_t host_ns;  // Middle of the round trip
+    uint64_t rtt_ns;
+  };
+
+  // Enough to average the jitter out, short enough to follow the drift
+  // with temperature: about a minute at a ping a second
+  static const size_t SAMPLES = 64;
+
+  int64_t unwrap(uint32_t time_us_) const;
+  void fit();
+
+  uint32_t cookie;
+  uint64_t sentNs;
+
+  Sample samples[SAMPLES];
+  size_t count;
+  size_t next;
+
+  uint32_t lastUs;    // Latest reply, the unwrapping reference
+  int64_t lastBoardUs;
+  // Smallest time_us - tick * 1000 seen: the tick edge in microseconds
+  int64_t tickOffsetUs;
+  uint64_t lastRtt;
+
+  // host_ns = base_ns + (board_us - base_us) * 1000 * rate
+  int64_t baseUs;
+  double baseNs;
+  double rate;
+};
+
+} // namespace swiftler
+
+#endif
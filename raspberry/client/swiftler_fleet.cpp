@@ -0,0 +1,338 @@
+#include "swiftler_fleet.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <system_error>
+
+#include <glob.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace swiftler {
+
+namespace {
+
+// PROTO_IDENT_REQ again while a board does not answer: still booting,
+// or in a command of the shell
+const uint64_t IDENT_RETRY_NS = 1000000000;
+const uint64_t TIME_PING_NS = 1000000000;
+// The boards drift apart by 0.5 ms at 50 ppm in that time, within the
+// guard of the windows (SONAR_FLEET_GUARD_MS)
+const uint64_t SONAR_RESEND_NS = 10000000000ull;
+// SONAR_FLEET_MAX of the firmware, the robots past it have no window
+const size_t SONAR_ROBOTS_MAX = 16;
+const int EVENTS_MAX = 16;
+
+uint64_t nowNs()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+std::system_error systemError(const char* what_)
+{
+  return std::system_error(errno, std::generic_category(), what_);
+}
+
+} // namespace
+
+Fleet::Fleet()
+  : sonarWindowMs(0), sonarEpochNs(0), sonarSentNs(0)
+{
+  epoll = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll < 0)
+    throw systemError("epoll_create1");
+}
+
+Fleet::~Fleet()
+{
+  // The links close their ports, which leaves the set
+  members.clear();
+  close(epoll);
+}
+
+std::vector<std::string> Fleet::scan()
+{
+  std::vector<std::string> devices;
+  glob_t found;
+
+  for (const char* pattern : { "/dev/ttyUSB*", "/dev/ttyACM*" })
+  {
+    if (glob(pattern, 0, nullptr, &found) == 0)
+      devices.insert(devices.end(), found.gl_pathv,
+                     found.gl_pathv + found.gl_pathc);
+    globfree(&found);
+  }
+  return devices;
+}
+
+Robot& Fleet::add(const std::string& device_, int baudrate_)
+{
+  std::unique_ptr<Robot> robot(new Robot());
+  Robot& r = *robot;
+
+  r.device = device_;
+  r.link.reset(new Link(device_, baudrate_));
+  r.identified = false;
+
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.ptr = &r;
+  if (epoll_ctl(epoll, EPOLL_CTL_ADD, r.link->fd(), &event) < 0)
+    throw systemError("epoll_ctl");
+
+  r.link->onFrame([this, &r](const Frame& frame_)
+    {
+      if (frame_.type == PROTO_IDENT && frame_.as<proto_ident_t>())
+      {
+        const bool first = !r.identified;
+        r.ident = *frame_.as<proto_ident_t>();
+        r.identified = true;
+        if (first && identifiedHandler)
+          identifiedHandler(r);
+      }
+      else if (frame_.type == PROTO_TELEMETRY &&
+               frame_.as<proto_telemetry_t>())
+      {
+        r.telemetry = *frame_.as<proto_telemetry_t>();
+        r.telemetry_ns = frame_.time_ns;
+      }
+      else if (frame_.type == PROTO_TIME && frame_.as<proto_time_t>())
+      {
+        // Its window once it can be placed
+        const bool synced = r.clock.synced();
+        if (r.clock.update(*frame_.as<proto_time_t>(), frame_.time_ns) &&
+            !synced && r.clock.synced())
+          sonarSentNs = 0;
+      }
+      if (frameHandler)
+        frameHandler(r, frame_);
+    });
+  r.link->onLine([this, &r](const Line& line_)
+    {
+      if (lineHandler)
+        lineHandler(r, line_);
+    });
+
+  members.push_back(std::move(robot));
+  sonarSentNs = 0;
+  r.ident_ns = nowNs();
+  r.link->requestIdent();
+  watch(r);
+  return r;
+}
+
+size_t Fleet::addAll(const std::vector<std::string>& devices_, int baudrate_)
+{
+  size_t opened = 0;
+
+  for (const std::string& device : devices_)
+  {
+    try
+    {
+      add(device, baudrate_);
+      opened++;
+    }
+    catch (const std::system_error&)
+    {
+    }
+  }
+  return opened;
+}
+
+// Writable wanted only while bytes wait: no wake up for an idle port
+void Fleet::watch(Robot& robot_)
+{
+  struct epoll_event event = {};
+
+  event.events = EPOLLIN | (robot_.link->wantsWrite() ? EPOLLOUT : 0);
+  event.data.ptr = &robot_;
+  if (epoll_ctl(epoll, EPOLL_CTL_MOD, robot_.link->fd(), &event) < 0)
+    throw systemError("epoll_ctl");
+}
+
+void Fleet::drop(size_t index_)
+{
+  std::unique_ptr<Robot> robot = std::move(members[index_]);
+
+  members.erase(members.begin() + index_);
+  epoll_ctl(epoll, EPOLL_CTL_DEL, robot->link->fd(), nullptr);
+  // The robots after it move down a window
+  sonarSentNs = 0;
+  if (lostHandler)
+    lostHandler(*robot);
+}
+
+size_t Fleet::poll(int timeout_ms_)
+{
+  struct epoll_event events[EVENTS_MAX];
+  std::vector<Robot*> failed;
+  size_t total = 0;
+
+  const int n = epoll_wait(epoll, events, EVENTS_MAX, timeout_ms_);
+  if (n < 0 && errno != EINTR)
+    throw systemError("epoll_wait");
+
+  for (int i = 0; i < n; i++)
+  {
+    Robot* robot = static_cast<Robot*>(events[i].data.ptr);
+
+    try
+    {
+      if (events[i].events & (EPOLLERR | EPOLLHUP))
+        throw std::system_error(EIO, std::generic_category(), robot->device);
+      total += robot->link->process();
+    }
+    catch (const std::system_error&)
+    {
+      failed.push_back(robot);
+    }
+  }
+
+  const uint64_t now_ns = nowNs();
+  for (size_t i = 0; i < members.size(); )
+  {
+    Robot& robot = *members[i];
+    bool lost = false;
+
+    for (Robot* f : failed)
+      lost = lost || f == &robot;
+    try
+    {
+      if (!lost && !robot.identified &&
+          now_ns - robot.ident_ns >= IDENT_RETRY_NS)
+      {
+        robot.ident_ns = now_ns;
+        robot.link->requestIdent();
+      }
+      if (!lost && robot.identified &&
+          now_ns - robot.time_ns >= TIME_PING_NS)
+      {
+        robot.time_ns = now_ns;
+        robot.link->send(PROTO_TIME_REQ, robot.clock.ping(now_ns));
+      }
+      if (!lost)
+        watch(robot);
+    }
+    catch (const std::system_error&)
+    {
+      lost = true;
+    }
+    if (lost)
+      drop(i);
+    else
+      i++;
+  }
+  if (sonarWindowMs &&
+      (!sonarSentNs || now_ns - sonarSentNs >= SONAR_RESEND_NS))
+    sendSonarWindows(now_ns);
+  return total;
+}
+
+void Fleet::broadcastFrame(uint8_t type_, const void* payload_, uint8_t size_)
+{
+  for (size_t i = 0; i < members.size(); )
+  {
+    try
+    {
+      members[i]->link->sendFrame(type_, payload_, size_);
+      watch(*members[i]);
+      i++;
+    }
+    catch (const std::system_error&)
+    {
+      drop(i);
+    }
+  }
+}
+
+void Fleet::broadcastLine(const std::string& line_)
+{
+  for (size_t i = 0; i < members.size(); )
+  {
+    try
+    {
+      members[i]->link->sendLine(line_);
+      watch(*members[i]);
+      i++;
+    }
+    catch (const std::system_error&)
+    {
+      drop(i);
+    }
+  }
+}
+
+void Fleet::setMotors(int16_t left_, int16_t right_)
+{
+  const proto_motors_t motors = { left_, right_ };
+  broadcast(PROTO_MOTORS_CMD, motors);
+}
+
+void Fleet::setTelemetry(uint16_t period_ms_)
+{
+  const proto_telem_cfg_t cfg = { period_ms_ };
+  broadcast(PROTO_TELEM_CFG, cfg);
+}
+
+void Fleet::setSonarWindows(uint16_t window_ms_)
+{
+  sonarWindowMs = window_ms_;
+  sonarEpochNs = nowNs();
+  sonarSentNs = 0;
+  if (!window_ms_)
+    broadcastLine("sw 0 0 0 0");
+}
+
+// The phase of each board is the frame start before now in its
+// microseconds, modulo the frame: near its counter, away from the wrap
+void Fleet::sendSonarWindows(uint64_t now_ns_)
+{
+  const size_t robots = std::min(members.size(), SONAR_ROBOTS_MAX);
+  const uint64_t frame_ns = (uint64_t)robots * sonarWindowMs * 1000000;
+
+  sonarSentNs = now_ns_;
+  if (!robots)
+    return;
+
+  const uint64_t start_ns = now_ns_ - (now_ns_ - sonarEpochNs) % frame_ns;
+  for (size_t i = 0; i < robots && i < members.size(); )
+  {
+    Robot& robot = *members[i];
+    char line[48];
+
+    if (!robot.clock.synced())
+    {
+      i++;
+      continue;
+    }
+    snprintf(line, sizeof line, "sw %u %u %u %u", (unsigned)robots,
+             (unsigned)i, (unsigned)sonarWindowMs,
+             (unsigned)(robot.clock.hostNsToUs(start_ns) % (frame_ns / 1000)));
+    try
+    {
+      robot.link->sendLine(line);
+      watch(robot);
+      i++;
+    }
+    catch (const std::system_error&)
+    {
+      // Sent again at the next poll, the indexes moved
+      drop(i);
+    }
+  }
+}
+
+Robot* Fleet::find(uint32_t uid_)
+{
+  for (std::unique_ptr<Robot>& robot : members)
+    if (robot->identified && robot->ident.uid == uid_)
+      return robot.get();
+  return nullptr;
+}
+
+} // namespace swiftler
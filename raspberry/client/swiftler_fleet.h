@@ -0,0 +1,112 @@
+#ifndef SWIFTLER_FLEET_H
+# define SWIFTLER_FLEET_H
+
+// Several robots from one process: a Link per board, all of them in one
+// epoll set, so a supervisor thread waits on the whole fleet at once and
+// wakes only for the ports with bytes in. Each board is known by its
+// PROTO_IDENT, asked on open and again until it answers: the device
+// names move around when the USB adapters are replugged, the identity
+// does not. A board whose port fails (unplugged) is dropped. The
+// identified ones are pinged a second, their ClockSync maps their clocks.
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "swiftler_clock.h"
+#include "swiftler_link.h"
+
+namespace swiftler {
+
+struct Robot
+{
+  std::string device;
+  std::unique_ptr<Link> link;
+  bool identified;
+  proto_ident_t ident;
+  // Latest telemetry frame, telemetry_ns 0 before the first
+  proto_telemetry_t telemetry;
+  uint64_t telemetry_ns;
+  uint64_t ident_ns; // Last PROTO_IDENT_REQ sent
+  ClockSync clock;
+  uint64_t time_ns;  // Last PROTO_TIME_REQ sent
+};
+
+class Fleet
+{
+public:
+  typedef std::function<void (Robot&)> RobotHandler;
+  typedef std::function<void (Robot&, const Frame&)> FrameHandler;
+  typedef std::function<void (Robot&, const Line&)> LineHandler;
+
+  // Throws std::system_error
+  Fleet();
+  ~Fleet();
+
+  Fleet(const Fleet&) = delete;
+  Fleet& operator=(const Fleet&) = delete;
+
+  // The serial ports of the adapters and virtual COM ports present
+  static std::vector<std::string> scan();
+
+  // Open a board, asked for its identity. Throws std::system_error.
+  Robot& add(const std::string& device_, int baudrate_ = 115200);
+  // Each device that opens: those that fail are skipped. Returns the count.
+  size_t addAll(const std::vector<std::string>& devices_,
+                int baudrate_ = 115200);
+
+  // Once its PROTO_IDENT came, and when its port failed, before it goes
+  void onIdentified(RobotHandler handler_) { identifiedHandler = handler_; }
+  void onLost(RobotHandler handler_) { lostHandler = handler_; }
+  // Every frame and line of every board, PROTO_IDENT and the telemetry
+  // included (kept in the Robot before)
+  void onFrame(FrameHandler handler_) { frameHandler = handler_; }
+  void onLine(LineHandler handler_) { lineHandler = handler_; }
+
+  // Wait up to timeout_ms_ (-1: forever) for any board, then process the
+  // ready ones. Returns the bytes read.
+  size_t poll(int timeout_ms_);
+
+  // The same frame to each board, queued on the busy ports
+  void broadcastFrame(uint8_t type_, const void* payload_, uint8_t size_);
+  template <typename T> void broadcast(uint8_t type_, const T& payload_)
+  {
+    broadcastFrame(type_, &payload_, sizeof (T));
+  }
+  void broadcastLine(const std::string& line_);
+  void setMotors(int16_t left_, int16_t right_);
+  void setTelemetry(uint16_t period_ms_);
+  // Sonar time slots of the robots sharing a room ("sw"): a window of
+  // window_ms_ each, in the order of robots(), the frames placed from one
+  // host time through the clock of each board. Sent to each board once
+  // synchronized, again as the crystals drift and when the fleet changes.
+  // 0: off.
+  void setSonarWindows(uint16_t window_ms_);
+
+  // nullptr when no board has this identity
+  Robot* find(uint32_t uid_);
+  std::vector<std::unique_ptr<Robot> >& robots() { return members; }
+  size_t size() const { return members.size(); }
+
+private:
+  void watch(Robot& robot_);
+  void drop(size_t index_);
+  void sendSonarWindows(uint64_t now_ns_);
+
+  int epoll;
+  std::vector<std::unique_ptr<Robot> > members;
+  RobotHandler identifiedHandler;
+  RobotHandler lostHandler;
+  FrameHandler frameHandler;
+  LineHandler lineHandler;
+
+  uint16_t sonarWindowMs;
+  uint64_t sonarEpochNs; // A frame start, host time
+  uint64_t sonarSentNs;  // 0: again at the next poll
+};
+
+} // namespace swiftler
+
+#endif
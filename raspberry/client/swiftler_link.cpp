@@ -0,0 +1,751 @@
+#include "swiftler_link.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace swiftler {
+
+namespace {
+
+// CRC-8, polynomial 0x07, as uProtoCrc8: a byte per lookup
+struct CrcTable
+{
+  uint8_t values[256];
+
+  CrcTable()
+  {
+    for (int i = 0; i < 256; i++)
+    {
+      uint8_t crc = i;
+      for (int b = 0; b < 8; b++)
+        crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+      values[i] = crc;
+    }
+  }
+};
+
+const CrcTable crcTable;
+
+// CRC-32, polynomial 0x04C11DB7, not reflected: a byte per lookup
+struct Crc32Table
+{
+  uint32_t values[256];
+
+  Crc32Table()
+  {
+    for (uint32_t i = 0; i < 256; i++)
+    {
+      uint32_t crc = i << 24;
+      for (int b = 0; b < 8; b++)
+        crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+      values[i] = crc;
+    }
+  }
+};
+
+const Crc32Table crc32Table;
+
+uint64_t nowNs()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+speed_t toSpeed(int baudrate_)
+{
+  switch (baudrate_)
+  {
+    case 9600:    return B9600;
+    case 19200:   return B19200;
+    case 38400:   return B38400;
+    case 57600:   return B57600;
+    case 115200:  return B115200;
+    case 230400:  return B230400;
+    case 460800:  return B460800;
+    case 921600:  return B921600;
+  }
+  throw std::system_error(EINVAL, std::generic_category(), "baudrate");
+}
+
+std::system_error systemError(const char* what_)
+{
+  return std::system_error(errno, std::generic_category(), what_);
+}
+
+} // namespace
+
+uint8_t Link::crc8(uint8_t crc_, const uint8_t* data_, size_t size_)
+{
+  while (size_--)
+    crc_ = crcTable.values[crc_ ^ *data_++];
+  return crc_;
+}
+
+uint32_t Link::crc32(const uint8_t* data_, size_t size_)
+{
+  uint32_t crc = 0xffffffff;
+
+  for (size_t i = 0; i + 4 <= size_; i += 4)
+    for (int b = 3; b >= 0; b--)
+      crc = (crc << 8) ^ crc32Table.values[(crc >> 24) ^ data_[i + b]];
+  return crc;
+}
+
+Link::Link(const std::string& device_, int baudrate_)
+  : port(-1), binaryMode(false), batching(false), address(NO_ADDRESS),
+    rxSize(0), counters()
+{
+  const speed_t speed = toSpeed(baudrate_);
+  struct termios tio;
+
+  port = open(device_.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (port < 0)
+    throw systemError(device_.c_str());
+
+  if (tcgetattr(port, &tio) < 0)
+  {
+    close(port);
+    throw systemError("tcgetattr");
+  }
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  if (tcsetattr(port, TCSANOW, &tio) < 0)
+  {
+    close(port);
+    throw systemError("tcsetattr");
+  }
+  tcflush(port, TCIOFLUSH);
+}
+
+bool Link::supports(int baudrate_)
+{
+  try
+  {
+    toSpeed(baudrate_);
+    return true;
+  }
+  catch (const std::system_error&)
+  {
+    return false;
+  }
+}
+
+void Link::setBaudrate(int baudrate_)
+{
+  const speed_t speed = toSpeed(baudrate_);
+  struct termios tio;
+
+  if (tcdrain(port) < 0 || tcgetattr(port, &tio) < 0)
+    throw systemError("tcgetattr");
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  if (tcsetattr(port, TCSANOW, &tio) < 0)
+    throw systemError("tcsetattr");
+  tcflush(port, TCIFLUSH);
+}
+
+Link::~Link()
+{
+  close(port);
+}
+
+size_t Link::process()
+{
+  size_t total = 0;
+
+  flush();
+
+  for (;;)
+  {
+    const ssize_t n = read(port, rx + rxSize, sizeof (rx) - rxSize);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    if (n < 0)
+      throw systemError("read");
+    if (n == 0)
+      break;
+
+    counters.bytes += n;
+    counters.reads++;
+    rxSize += n;
+    total += n;
+    decode(nowNs());
+  }
+
+  return total;
+}
+
+size_t Link::poll(int timeout_ms_)
+{
+  struct pollfd fds = { port, (short)(POLLIN | (wantsWrite() ? POLLOUT : 0)), 0 };
+
+  if (::poll(&fds, 1, timeout_ms_) < 0 && errno != EINTR)
+    throw systemError("poll");
+  return process();
+}
+
+// The shell prints no SYNC byte: a valid frame is told from the text
+// wherever it starts, in both modes
+void Link::decode(uint64_t time_ns_)
+{
+  size_t pos = 0;
+  size_t lineStart = 0;
+
+  while (pos < rxSize)
+  {
+    if (rx[pos] == PROTO_SYNC || rx[pos] == PROTO_SYNC_ADDR)
+    {
+      // The address, if any, is covered by the CRC as the header
+      const bool addressed = rx[pos] == PROTO_SYNC_ADDR;
+      const size_t header = pos + addressed;
+
+      // Wait for the header, then the payload and CRC
+      if (rxSize - header < 3)
+        break;
+      const uint8_t size = rx[header + 2];
+      if (size > PROTO_MAX_PAYLOAD)
+      {
+        counters.crc_errors++;
+        lineStart = ++pos;
+        continue;
+      }
+      if (rxSize - header < size + (size_t)PROTO_OVERHEAD)
+        break;
+      if (crc8(0, &rx[pos + 1], size + 2 + addressed) != rx[header + 3 + size])
+      {
+        counters.crc_errors++;
+        lineStart = ++pos;
+        continue;
+      }
+
+      // Text without its line ending before the frame, the prompt
+      if (pos > lineStart)
+        emitLine(lineStart, pos, time_ns_);
+
+      counters.frames++;
+      if (frameHandler)
+      {
+        const Frame frame = { rx[header + 1], size, &rx[header + 3], time_ns_,
+                              addressed, addressed ? rx[pos + 1] : (uint8_t)0 };
+        frameHandler(frame);
+      }
+      pos = header + size + PROTO_OVERHEAD;
+      lineStart = pos;
+      continue;
+    }
+
+    if (rx[pos] == '\n')
+    {
+      size_t end = pos;
+      if (end > lineStart && rx[end - 1] == '\r')
+        end--;
+      emitLine(lineStart, end, time_ns_);
+      lineStart = ++pos;
+      continue;
+    }
+
+    pos++;
+  }
+
+  // A line filling the whole buffer is cut
+  if (lineStart == 0 && rxSize == sizeof (rx))
+  {
+    counters.overflows++;
+    emitLine(0, pos, time_ns_);
+    lineStart = pos;
+  }
+
+  // Keep the incomplete line or frame, scanned again with the next read
+  memmove(rx, rx + lineStart, rxSize - lineStart);
+  rxSize -= lineStart;
+}
+
+void Link::emitLine(size_t start_, size_t end_, uint64_t time_ns_)
+{
+  counters.lines++;
+  if (lineHandler)
+  {
+    const Line line = { (const char*)&rx[start_], end_ - start_, time_ns_ };
+    lineHandler(line);
+  }
+}
+
+void Link::queue(const uint8_t* data_, size_t size_)
+{
+  tx.append((const char*)data_, size_);
+  if (!batching)
+    flush();
+}
+
+void Link::setBatching(bool on_)
+{
+  batching = on_;
+  if (!batching)
+    flush();
+}
+
+void Link::flush()
+{
+  while (!tx.empty())
+  {
+    const ssize_t n = write(port, tx.data(), tx.size());
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+    if (n < 0)
+      throw systemError("write");
+    tx.erase(0, n);
+  }
+}
+
+std::string encodeFrame(uint8_t type_, const void* payload_, uint8_t size_,
+                        int address_)
+{
+  uint8_t frame[PROTO_MAX_PAYLOAD + PROTO_OVERHEAD_ADDR];
+  const size_t addressed = address_ != NO_ADDRESS;
+  uint8_t* header = &frame[addressed];
+
+  if (size_ > PROTO_MAX_PAYLOAD)
+    throw std::system_error(EMSGSIZE, std::generic_category(), "frame");
+
+  frame[0] = addressed ? PROTO_SYNC_ADDR : PROTO_SYNC;
+  if (addressed)
+    frame[1] = address_;
+  header[1] = type_;
+  header[2] = size_;
+  if (size_)
+    memcpy(&header[3], payload_, size_);
+  header[3 + size_] = Link::crc8(0, &frame[1], size_ + 2 + addressed);
+  return std::string((const char*)frame, size_ + PROTO_OVERHEAD + addressed);
+}
+
+bool Schema::feed(const Frame& frame_)
+{
+  static const uint8_t kindSizes[] = { 1, 1, 2, 2, 4, 4 };
+
+  if (frame_.type == PROTO_CAPS && frame_.as<proto_caps_t>())
+  {
+    info = *frame_.as<proto_caps_t>();
+    hasCaps = true;
+    received = 0;
+    layouts.clear();
+    return true;
+  }
+  if (frame_.type != PROTO_SCHEMA)
+    return false;
+  // Past the last index
+  if (frame_.size < sizeof (proto_schema_t))
+  {
+    received = info.schemas;
+    return true;
+  }
+
+  proto_schema_t header;
+  memcpy(&header, frame_.payload, sizeof (header));
+  Layout layout;
+  layout.flags = header.flags;
+  layout.size = header.size;
+  layout.fields.assign(frame_.payload + sizeof (header),
+                       frame_.payload + frame_.size);
+  // Kept only when its fields add up
+  size_t size = 0;
+  for (uint8_t field : layout.fields)
+    size += PROTO_FIELD_KIND(field) < sizeof (kindSizes) ?
+      kindSizes[PROTO_FIELD_KIND(field)] * PROTO_FIELD_COUNT(field) : 0x100;
+  if (size == layout.size)
+    layouts[header.type] = layout;
+  received = std::max<int>(received, header.index + 1);
+  return true;
+}
+
+bool Schema::agrees(uint8_t type_, size_t size_) const
+{
+  const auto it = layouts.find(type_);
+
+  return hasCaps && info.version == PROTO_VERSION &&
+    it != layouts.end() && it->second.size == size_;
+}
+
+std::vector<uint8_t> Schema::fields(uint8_t type_) const
+{
+  const auto it = layouts.find(type_);
+
+  return it != layouts.end() ? it->second.fields : std::vector<uint8_t>();
+}
+
+int Schema::fastestBaudrate(int current_) const
+{
+  // Standard rates down to the default one, fastest first
+  static const int rates[] = { 921600, 460800, 230400, 115200 };
+
+  if (!hasCaps || !(info.link & PROTO_TRANSPORT_UART))
+    return current_;
+  for (int rate : rates)
+    if (rate <= (int)info.max_bauds && Link::supports(rate))
+      return std::max(rate, current_);
+  return current_;
+}
+
+bool TelemetryDeltas::feed(const Frame& frame_)
+{
+  proto_telemetry_delta_t head;
+
+  if (frame_.type != PROTO_TELEMETRY_DELTA || frame_.size < sizeof (head))
+    return false;
+  memcpy(&head, frame_.payload, sizeof (head));
+
+  const uint8_t* in = frame_.payload + sizeof (head);
+  size_t n = 0;
+  for (int i = 0; i < PROTO_CHANNELS_NB; i++)
+    n += (head.mask >> i) & 1;
+  if (frame_.size != sizeof (head) + n * sizeof (int16_t))
+    return true;
+
+  if (started)
+    lostNb += (uint8_t)(head.seq - seq - 1);
+  started = true;
+  seq = head.seq;
+  tick = head.tick;
+  for (int i = 0; i < PROTO_CHANNELS_NB; i++)
+    if (head.mask & (1u << i))
+    {
+      memcpy(&values[i], in, sizeof (int16_t));
+      in += sizeof (int16_t);
+      seen |= 1u << i;
+    }
+  return true;
+}
+
+proto_telemetry_t TelemetryDeltas::current() const
+{
+  proto_telemetry_t t;
+
+  t.tick = tick;
+  t.sharp_left_mm = values[PROTO_CHANNEL_SHARP_LEFT];
+  t.sonar_mm = values[PROTO_CHANNEL_SONAR];
+  t.sharp_right_mm = values[PROTO_CHANNEL_SHARP_RIGHT];
+  t.motor_left = values[PROTO_CHANNEL_MOTOR_LEFT];
+  t.motor_right = values[PROTO_CHANNEL_MOTOR_RIGHT];
+  t.battery_mv = values[PROTO_CHANNEL_BATTERY];
+  t.current_ma = values[PROTO_CHANNEL_CURRENT];
+  t.cut_off = values[PROTO_CHANNEL_CUT_OFF];
+  t.x_mm = values[PROTO_CHANNEL_X];
+  t.y_mm = values[PROTO_CHANNEL_Y];
+  t.theta_mrad = values[PROTO_CHANNEL_THETA];
+  t.sonar_left_mm = values[PROTO_CHANNEL_SONAR_LEFT];
+  t.sonar_right_mm = values[PROTO_CHANNEL_SONAR_RIGHT];
+  t.cpu_permille = values[PROTO_CHANNEL_CPU];
+  t.link_errors = values[PROTO_CHANNEL_LINK_ERRORS];
+  return t;
+}
+
+DumpDecoder::DumpDecoder(uint8_t source_)
+  : ended(false), broken(false), count(0), last()
+{
+  switch (source_)
+  {
+    case PROTO_DUMP_SAMPLES:
+      fieldsNb = PROTO_DUMP_SAMPLES_FIELDS;
+      flags = PROTO_DUMP_SAMPLES_FLAGS;
+      break;
+    case PROTO_DUMP_LOG:
+      fieldsNb = PROTO_DUMP_LOG_FIELDS;
+      flags = PROTO_DUMP_LOG_FLAGS;
+      break;
+    case PROTO_DUMP_SYSID:
+      fieldsNb = PROTO_DUMP_SYSID_FIELDS;
+      flags = PROTO_DUMP_SYSID_FLAGS;
+      break;
+    default:
+      throw std::invalid_argument("dump source");
+  }
+}
+
+bool DumpDecoder::feed(const Frame& frame_)
+{
+  const uint8_t* in = frame_.payload;
+  const uint8_t* const end = in + frame_.size;
+
+  if (frame_.type != PROTO_DUMP || broken)
+    return !broken;
+  if (!frame_.size)
+  {
+    ended = true;
+    return true;
+  }
+
+  while (in < end)
+  {
+    int32_t values[PROTO_DUMP_FIELDS_MAX];
+    uint8_t mask = flags ? *in++ : 0;
+
+    for (size_t i = 0; i < fieldsNb; i++)
+    {
+      if (flags & (1 << i))
+      {
+        const bool changed = mask & 1;
+        mask >>= 1;
+        if (!changed)
+        {
+          values[i] = last[i];
+          continue;
+        }
+      }
+
+      uint32_t u = 0;
+      int shift = 0;
+      do
+      {
+        if (in == end || shift > 28)
+        {
+          broken = true;
+          return false;
+        }
+        u |= (uint32_t)(*in & 0x7f) << shift;
+        shift += 7;
+      } while (*in++ & 0x80);
+
+      // Zigzag back, the change added modulo 2^32 as on the board
+      last[i] += (u >> 1) ^ (0 - (u & 1));
+      values[i] = last[i];
+    }
+    count++;
+    if (recordHandler)
+      recordHandler(values);
+  }
+  return true;
+}
+
+void Link::sendFrame(uint8_t type_, const void* payload_, uint8_t size_)
+{
+  const std::string frame = encodeFrame(type_, payload_, size_, address);
+
+  // The shell takes a frame at the start of a line only
+  if (!binaryMode && type_ != PROTO_ASCII)
+    queue((const uint8_t*)"\r", 1);
+  queue((const uint8_t*)frame.data(), frame.size());
+
+  binaryMode = type_ != PROTO_ASCII;
+}
+
+// Same states as iProtoDecode
+void FrameParser::feed(const uint8_t* data_, size_t size_, uint64_t time_ns_)
+{
+  enum { SYNC, ADDR, TYPE, SIZE, PAYLOAD, CRC };
+
+  for (size_t i = 0; i < size_; i++)
+  {
+    const uint8_t c = data_[i];
+
+    switch (state)
+    {
+      case SYNC:
+        addressed = c == PROTO_SYNC_ADDR;
+        if (c == PROTO_SYNC)
+          state = TYPE;
+        else if (addressed)
+          state = ADDR;
+        break;
+      case ADDR:
+        address = c;
+        state = TYPE;
+        break;
+      case TYPE:
+        type = c;
+        state = SIZE;
+        break;
+      case SIZE:
+        if (c > PROTO_MAX_PAYLOAD)
+        {
+          crcErrors++;
+          state = SYNC;
+          break;
+        }
+        size = c;
+        pos = 0;
+        state = size ? PAYLOAD : CRC;
+        break;
+      case PAYLOAD:
+        payload[pos++] = c;
+        if (pos == size)
+          state = CRC;
+        break;
+      case CRC:
+      {
+        state = SYNC;
+        const uint8_t header[3] = { address, type, size };
+        if (c != Link::crc8(Link::crc8(0, &header[!addressed], 2 + addressed),
+                            payload, size))
+        {
+          crcErrors++;
+          break;
+        }
+        if (frameHandler)
+        {
+          const Frame frame = { type, size, payload, time_ns_, addressed,
+                                addressed ? address : (uint8_t)0 };
+          frameHandler(frame);
+        }
+        break;
+      }
+    }
+  }
+}
+
+void Link::sendLine(const std::string& line_)
+{
+  if (binaryMode)
+    sendFrame(PROTO_ASCII, nullptr, 0);
+  queue((const uint8_t*)line_.data(), line_.size());
+  queue((const uint8_t*)"\r", 1);
+}
+
+void Link::setMotors(int16_t left_, int16_t right_)
+{
+  const proto_motors_t motors = { left_, right_ };
+  send(PROTO_MOTORS_CMD, motors);
+}
+
+void Link::setVelocity(int16_t v_mm_s_, int16_t omega_mrad_s_)
+{
+  const proto_velocity_t velocity = { v_mm_s_, omega_mrad_s_ };
+  send(PROTO_VELOCITY, velocity);
+}
+
+void Link::setTelemetry(uint16_t period_ms_)
+{
+  const proto_telem_cfg_t cfg = { period_ms_ };
+  send(PROTO_TELEM_CFG, cfg);
+}
+
+void Link::setTelemetryOnChange(uint16_t period_ms_, uint16_t heartbeat_ms_,
+                                const std::vector<uint16_t>& deadbands_)
+{
+  const proto_telem_delta_cfg_t cfg = { period_ms_, heartbeat_ms_ };
+  uint8_t payload[PROTO_MAX_PAYLOAD];
+  const size_t n = std::min<size_t>(deadbands_.size(), PROTO_CHANNELS_NB);
+
+  memcpy(payload, &cfg, sizeof (cfg));
+  memcpy(payload + sizeof (cfg), deadbands_.data(), n * sizeof (uint16_t));
+  sendFrame(PROTO_TELEM_DELTA_CFG, payload,
+            sizeof (cfg) + n * sizeof (uint16_t));
+}
+
+void Link::requestSensors()
+{
+  sendFrame(PROTO_SENSORS_REQ, nullptr, 0);
+}
+
+void Link::requestIdent()
+{
+  sendFrame(PROTO_IDENT_REQ, nullptr, 0);
+}
+
+void Link::requestCaps()
+{
+  sendFrame(PROTO_CAPS_REQ, nullptr, 0);
+}
+
+void Link::requestSchema(uint8_t index_)
+{
+  sendFrame(PROTO_SCHEMA_REQ, &index_, 1);
+}
+
+void Link::setParams(const std::vector<std::pair<uint16_t, int32_t> >& params_)
+{
+  const size_t per_frame = (PROTO_MAX_PAYLOAD - 1) / sizeof (proto_param_t);
+  uint8_t payload[PROTO_MAX_PAYLOAD];
+  size_t i = 0;
+
+  do
+  {
+    const size_t n = std::min(per_frame, params_.size() - i);
+
+    payload[0] = i + n < params_.size() ? PROTO_PARAMS_MORE : 0;
+    for (size_t j = 0; j < n; j++)
+    {
+      const proto_param_t param = { params_[i + j].first, params_[i + j].second };
+      memcpy(&payload[1 + j * sizeof (param)], &param, sizeof (param));
+    }
+    sendFrame(PROTO_PARAMS_SET, payload, 1 + n * sizeof (proto_param_t));
+    i += n;
+  } while (i < params_.size());
+}
+
+void Link::requestParams(const std::vector<uint16_t>& keys_)
+{
+  if (keys_.size() * sizeof (uint16_t) > PROTO_MAX_PAYLOAD)
+    throw std::system_error(EMSGSIZE, std::generic_category(), "keys");
+  sendFrame(PROTO_PARAMS_REQ, keys_.data(), keys_.size() * sizeof (uint16_t));
+}
+
+void Link::setBehaviour(const proto_behaviour_t& state_)
+{
+  send(PROTO_BEHAVIOUR_SET, state_);
+}
+
+void Link::requestBehaviour(uint8_t state_)
+{
+  send(PROTO_BEHAVIOUR_REQ, state_);
+}
+
+void Link::runBehaviour(int8_t state_)
+{
+  send(PROTO_BEHAVIOUR_RUN, state_);
+}
+
+void Link::loadVm(const std::vector<uint8_t>& code_)
+{
+  const size_t per_frame = PROTO_MAX_PAYLOAD - sizeof (uint16_t);
+  uint8_t payload[PROTO_MAX_PAYLOAD];
+  size_t i = 0;
+
+  do
+  {
+    const size_t n = std::min(per_frame, code_.size() - i);
+    const uint16_t offset = i;
+
+    memcpy(payload, &offset, sizeof (offset));
+    if (n)
+      memcpy(&payload[sizeof (offset)], &code_[i], n);
+    sendFrame(PROTO_VM_LOAD, payload, sizeof (offset) + n);
+    i += n;
+  } while (i < code_.size());
+}
+
+void Link::runVm(uint16_t period_ms_, uint16_t budget_)
+{
+  const proto_vm_run_t run = { period_ms_, budget_ };
+  send(PROTO_VM_RUN, run);
+}
+
+void Link::requestVm()
+{
+  sendFrame(PROTO_VM_REQ, nullptr, 0);
+}
+
+void Link::requestDump(uint8_t source_, uint16_t n_)
+{
+  const proto_dump_req_t req = { source_, n_ };
+  send(PROTO_DUMP_REQ, req);
+}
+
+} // namespace swiftler
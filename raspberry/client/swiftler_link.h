@@ -0,0 +1,314 @@
+#ifndef SWIFTLER_LINK_H
+# define SWIFTLER_LINK_H
+
+// Host side of the firmware link (src/libglobal/protocol.h), for the
+// navigation process on the Pi: the console lines and the binary frames
+// on one non-blocking serial port, decoded in place in the read buffer.
+//
+// Built by "waf client", or on the Pi itself:
+//   g++ -std=c++11 -O2 -I../../src swiftler_link.cpp your_code.cpp
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include "libglobal/protocol.h"
+}
+
+namespace swiftler {
+
+// Valid during the handler only: payload and text point into the read
+// buffer, copy what is kept
+struct Frame
+{
+  uint8_t type;
+  uint8_t size;
+  const uint8_t* payload;
+  uint64_t time_ns; // CLOCK_MONOTONIC, at the read that completed it
+  bool addressed;   // PROTO_SYNC_ADDR: the node address of the sender
+  uint8_t address;
+
+  // The packed payload struct, nullptr when the size does not match
+  template <typename T> const T* as() const
+  {
+    return size == sizeof (T) ? reinterpret_cast<const T*>(payload) : nullptr;
+  }
+
+  // Arrays of records (PROTO_SAMPLES, PROTO_LOG)
+  template <typename T> size_t count() const
+  {
+    return size / sizeof (T);
+  }
+  template <typename T> const T* array() const
+  {
+    return reinterpret_cast<const T*>(payload);
+  }
+};
+
+// Frames from any byte stream (the bridge clients), copied: the
+// payload is valid during the handler only
+class FrameParser
+{
+public:
+  typedef std::function<void (const Frame&)> FrameHandler;
+
+  FrameParser() : state(0), crcErrors(0) {}
+
+  void onFrame(FrameHandler handler_) { frameHandler = handler_; }
+  void feed(const uint8_t* data_, size_t size_, uint64_t time_ns_);
+
+  uint64_t errors() const { return crcErrors; }
+
+private:
+  int state;
+  bool addressed;
+  uint8_t address;
+  uint8_t type;
+  uint8_t size;
+  uint8_t pos;
+  uint8_t payload[PROTO_MAX_PAYLOAD];
+  uint64_t crcErrors;
+  FrameHandler frameHandler;
+};
+
+// The PROTO_DUMP records of one dump, in the order of the source fields
+// (libglobal/protocol.h): frame after frame, from the first one
+class DumpDecoder
+{
+public:
+  typedef std::function<void (const int32_t* values_)> RecordHandler;
+
+  // Throws std::invalid_argument on an unknown source
+  explicit DumpDecoder(uint8_t source_);
+
+  void onRecord(RecordHandler handler_) { recordHandler = handler_; }
+  // False on a truncated record: the rest of the dump is lost
+  bool feed(const Frame& frame_);
+
+  size_t fields() const { return fieldsNb; }
+  bool done() const { return ended; }
+  uint64_t records() const { return count; }
+
+private:
+  size_t fieldsNb;
+  uint8_t flags;
+  bool ended;
+  bool broken;
+  uint64_t count;
+  uint32_t last[PROTO_DUMP_FIELDS_MAX];
+  RecordHandler recordHandler;
+};
+
+// The PROTO_TELEMETRY_DELTA frames of a report on change stream
+// (Link::setTelemetryOnChange), merged over the last values into a whole
+// proto_telemetry_t
+class TelemetryDeltas
+{
+public:
+  TelemetryDeltas() : seen(0), started(false), seq(0), lostNb(0), values(),
+                      tick(0) {}
+
+  // True when frame_ was one of them
+  bool feed(const Frame& frame_);
+  // Once every channel came at least once
+  bool complete() const { return seen == (1u << PROTO_CHANNELS_NB) - 1; }
+  proto_telemetry_t current() const;
+  // Of the samples as sent: longer than the one set on a congested link
+  uint16_t periodMs() const { return values[PROTO_CHANNEL_PERIOD]; }
+  // Frames missing from the sequence
+  uint64_t lost() const { return lostNb; }
+
+private:
+  uint32_t seen;
+  bool started;
+  uint8_t seq;
+  uint64_t lostNb;
+  int16_t values[PROTO_CHANNELS_NB];
+  uint32_t tick;
+};
+
+// What the board speaks: fed the PROTO_CAPS of Link::requestCaps(), then
+// the PROTO_SCHEMA of a Link::requestSchema() per index until complete().
+// The structs of libglobal/protocol.h are mapped on the payloads
+// (Frame::as) only once the board agrees with them.
+class Schema
+{
+public:
+  Schema() : hasCaps(false), info(), received(0) {}
+
+  // True when frame_ was one of them
+  bool feed(const Frame& frame_);
+  bool complete() const { return hasCaps && next() >= info.schemas; }
+  // The index to request next
+  uint8_t next() const { return received; }
+  const proto_caps_t& caps() const { return info; }
+
+  // Same protocol version, and a layout of sizeof (T) bytes for type_
+  template <typename T> bool agrees(uint8_t type_) const
+  {
+    return agrees(type_, sizeof (T));
+  }
+  bool agrees(uint8_t type_, size_t size_) const;
+  // Fields of type_ (PROTO_FIELD bytes), empty when unknown
+  std::vector<uint8_t> fields(uint8_t type_) const;
+  // Fastest line rate of both ends, current_ off the UART
+  int fastestBaudrate(int current_) const;
+
+private:
+  struct Layout
+  {
+    uint8_t flags;
+    uint8_t size;
+    std::vector<uint8_t> fields;
+  };
+
+  bool hasCaps;
+  proto_caps_t info;
+  uint8_t received;
+  std::map<uint8_t, Layout> layouts;
+};
+
+// Frame bytes, SYNC to CRC: plain, or addressed when address_ is
+// NO_ADDRESS
+enum { NO_ADDRESS = -1 };
+std::string encodeFrame(uint8_t type_, const void* payload_, uint8_t size_,
+                        int address_ = NO_ADDRESS);
+
+// A console line, without its line ending
+struct Line
+{
+  const char* text;
+  size_t size;
+  uint64_t time_ns;
+};
+
+struct LinkStats
+{
+  uint64_t bytes;
+  uint64_t reads;
+  uint64_t frames;
+  uint64_t lines;
+  uint64_t crc_errors; // Frames dropped, resynchronized on the next SYNC
+  uint64_t overflows;  // Lines cut at the buffer size
+};
+
+class Link
+{
+public:
+  typedef std::function<void (const Frame&)> FrameHandler;
+  typedef std::function<void (const Line&)> LineHandler;
+
+  // Raw 8N1, non-blocking. Throws std::system_error.
+  explicit Link(const std::string& device_, int baudrate_ = 115200);
+  // Rates of the port, up to 921600
+  static bool supports(int baudrate_);
+  ~Link();
+
+  Link(const Link&) = delete;
+  Link& operator=(const Link&) = delete;
+
+  // For the caller's poll loop: readable, and writable while wantsWrite()
+  int fd() const { return port; }
+  bool wantsWrite() const { return !tx.empty(); }
+
+  void onFrame(FrameHandler handler_) { frameHandler = handler_; }
+  void onLine(LineHandler handler_) { lineHandler = handler_; }
+
+  // Read all that is available and call the handlers, send what is
+  // pending. Never blocks, returns the bytes read. Throws on I/O errors.
+  size_t process();
+  // Wait up to timeout_ms_ (-1: forever) for input, then process()
+  size_t poll(int timeout_ms_);
+
+  // The port only, nothing queued, once the board switched ("ub", then
+  // "uc" at the new rate). Throws std::system_error.
+  void setBaudrate(int baudrate_);
+
+  // Queued when the port is busy. The first frame switches the board to
+  // binary mode, a line switches it back to the shell.
+  void sendFrame(uint8_t type_, const void* payload_, uint8_t size_);
+  template <typename T> void send(uint8_t type_, const T& payload_)
+  {
+    sendFrame(type_, &payload_, sizeof (T));
+  }
+  void sendLine(const std::string& line_);
+  // The boards sharing the link: the frames sent from now on go to this
+  // node address, PROTO_ADDR_BROADCAST for all of them at once (not
+  // answered), NO_ADDRESS for plain frames
+  void setAddress(int address_) { address = address_; }
+
+  void setMotors(int16_t left_, int16_t right_);
+  void setVelocity(int16_t v_mm_s_, int16_t omega_mrad_s_);
+  void setTelemetry(uint16_t period_ms_);
+  // Report on change, to a TelemetryDeltas: sampled every period_ms_, all
+  // channels every heartbeat_ms_. The deadbands of the first channels
+  // (eProtoChannel), the others as they are.
+  void setTelemetryOnChange(uint16_t period_ms_, uint16_t heartbeat_ms_,
+                            const std::vector<uint16_t>& deadbands_ =
+                            std::vector<uint16_t>());
+  void requestSensors();
+  // PROTO_IDENT: which board is at the other end
+  void requestIdent();
+  // PROTO_CAPS, then PROTO_SCHEMA of index_: to a Schema
+  void requestCaps();
+  void requestSchema(uint8_t index_);
+  // The last n_ records of a source, all of them when 0: PROTO_DUMP
+  // frames, to a DumpDecoder
+  void requestDump(uint8_t source_, uint16_t n_ = 0);
+  // Parameters by key, in as many PROTO_PARAMS_SET frames as it takes:
+  // applied together on the board, one ACK or NACK for all of them
+  void setParams(const std::vector<std::pair<uint16_t, int32_t> >& params_);
+  // PROTO_PARAMS frames, all the parameters when keys_ is empty
+  void requestParams(const std::vector<uint16_t>& keys_);
+  // A state of the behaviour table: ACK or NACK, PROTO_BEHAVIOUR for the
+  // request
+  void setBehaviour(const proto_behaviour_t& state_);
+  void requestBehaviour(uint8_t state_);
+  // Into a state, -1 stops: ACK or NACK
+  void runBehaviour(int8_t state_);
+  // A bytecode program (libglobal/vm.h), in PROTO_VM_LOAD chunks each
+  // ACKed, then run every period_ms_, 0 stops: ACK or NACK, PROTO_VM for
+  // the request
+  void loadVm(const std::vector<uint8_t>& code_);
+  void runVm(uint16_t period_ms_, uint16_t budget_);
+  void requestVm();
+
+  // While on, the frames and lines sent wait in the queue: turned off,
+  // they go out in one write (requests batched by the bridge)
+  void setBatching(bool on_);
+
+  bool binary() const { return binaryMode; }
+  const LinkStats& stats() const { return counters; }
+
+  static uint8_t crc8(uint8_t crc_, const uint8_t* data_, size_t size_);
+  // As the CRC unit of the board (libperiph/crc.h): the little endian
+  // words of size_ / 4 * 4 bytes, MSB first, from 0xFFFFFFFF
+  static uint32_t crc32(const uint8_t* data_, size_t size_);
+
+private:
+  void decode(uint64_t time_ns_);
+  void emitLine(size_t start_, size_t end_, uint64_t time_ns_);
+  void queue(const uint8_t* data_, size_t size_);
+  void flush();
+
+  int port;
+  bool binaryMode;
+  bool batching;
+  int address;
+  // Decoded in place, the incomplete end is moved to the front
+  uint8_t rx[4096];
+  size_t rxSize;
+  std::string tx;
+  FrameHandler frameHandler;
+  LineHandler lineHandler;
+  LinkStats counters;
+};
+
+} // namespace swiftler
+
+#endif
@@ -0,0 +1,133 @@
+#include "swiftler_state.h"
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace swiftler {
+
+namespace {
+
+State* mapState(const std::string& name_, bool writer_)
+{
+  const int fd = shm_open(name_.c_str(), writer_ ? O_RDWR | O_CREAT : O_RDONLY,
+                          0644);
+  if (fd < 0)
+    throw std::system_error(errno, std::generic_category(), name_);
+  if (writer_ && ftruncate(fd, sizeof (State)) < 0)
+  {
+    close(fd);
+    throw std::system_error(errno, std::generic_category(), "ftruncate");
+  }
+
+  void* map = mmap(NULL, sizeof (State), writer_ ? PROT_READ | PROT_WRITE : PROT_READ,
+                   MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    throw std::system_error(errno, std::generic_category(), "mmap");
+  return static_cast<State*>(map);
+}
+
+} // namespace
+
+StatePublisher::StatePublisher(const std::string& name_)
+  : name(name_), state(mapState(name_, true))
+{
+  // A bridge restarting over an old state starts from scratch, readers
+  // see an odd sequence meanwhile
+  begin();
+  const uint32_t sequence = state->sequence;
+  memset(state, 0, sizeof (State));
+  state->sequence = sequence;
+  state->magic = SWIFTLER_STATE_MAGIC;
+  state->version = SWIFTLER_STATE_VERSION;
+  end();
+}
+
+StatePublisher::~StatePublisher()
+{
+  munmap(state, sizeof (State));
+  shm_unlink(name.c_str());
+}
+
+void StatePublisher::begin()
+{
+  __atomic_store_n(&state->sequence, state->sequence + 1, __ATOMIC_RELAXED);
+  // The odd sequence is visible before any change
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void StatePublisher::end()
+{
+  __atomic_store_n(&state->sequence, state->sequence + 1, __ATOMIC_RELEASE);
+}
+
+void StatePublisher::setTelemetry(const proto_telemetry_t& telemetry_,
+                                  uint64_t time_ns_)
+{
+  begin();
+  state->telemetry = telemetry_;
+  state->telemetry_ns = time_ns_;
+  end();
+}
+
+void StatePublisher::setSensors(const proto_sensors_t& sensors_,
+                                uint64_t time_ns_)
+{
+  begin();
+  state->sensors = sensors_;
+  state->sensors_ns = time_ns_;
+  end();
+}
+
+void StatePublisher::addEvent(const proto_event_t& event_, uint64_t time_ns_)
+{
+  begin();
+  state->event = event_;
+  state->event_ns = time_ns_;
+  state->events++;
+  end();
+}
+
+StateReader::StateReader(const std::string& name_)
+  : state(mapState(name_, false))
+{
+  if (state->magic != SWIFTLER_STATE_MAGIC ||
+      state->version != SWIFTLER_STATE_VERSION)
+  {
+    munmap(const_cast<State*>(state), sizeof (State));
+    throw std::system_error(EPROTO, std::generic_category(), name_);
+  }
+}
+
+StateReader::~StateReader()
+{
+  munmap(const_cast<State*>(state), sizeof (State));
+}
+
+void StateReader::read(State& state_) const
+{
+  uint32_t before, after;
+
+  do
+  {
+    before = __atomic_load_n(&state->sequence, __ATOMIC_ACQUIRE);
+    memcpy(&state_, state, sizeof (State));
+    // The copy completes before the sequence is checked again
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&state->sequence, __ATOMIC_RELAXED);
+  } while ((before & 1) || before != after);
+
+  state_.sequence = before;
+}
+
+bool StateReader::changed(uint32_t sequence_) const
+{
+  return __atomic_load_n(&state->sequence, __ATOMIC_ACQUIRE) != sequence_;
+}
+
+} // namespace swiftler
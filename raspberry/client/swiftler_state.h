@@ -0,0 +1,85 @@
+#ifndef SWIFTLER_STATE_H
+# define SWIFTLER_STATE_H
+
+// Latest board state, published by the bridge in a POSIX shared memory
+// object (/dev/shm/swiftler): one writer, any number of readers, no
+// syscall and no lock on the read side. A seqlock keeps the snapshots
+// coherent: the sequence is odd while the bridge writes, a reader copies
+// the state then retries if the sequence moved meanwhile.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+extern "C" {
+#include "libglobal/protocol.h"
+}
+
+namespace swiftler {
+
+#define SWIFTLER_STATE_NAME    "/swiftler"
+#define SWIFTLER_STATE_MAGIC   0x53544154
+#define SWIFTLER_STATE_VERSION 1
+
+// Fixed layout, read by raspberry/bridge.py too: the packed board
+// structs last
+struct State
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t sequence;     // Seqlock, odd while written, __atomic builtins
+  uint32_t events;       // Events received so far
+  uint64_t telemetry_ns; // CLOCK_MONOTONIC of the read, 0 before the first
+  uint64_t sensors_ns;
+  uint64_t event_ns;
+  proto_telemetry_t telemetry;
+  proto_sensors_t sensors;
+  proto_event_t event;   // Latest one
+};
+
+static_assert(offsetof(State, telemetry) == 40, "State layout");
+
+// The bridge side
+class StatePublisher
+{
+public:
+  explicit StatePublisher(const std::string& name_ = SWIFTLER_STATE_NAME);
+  ~StatePublisher();
+
+  StatePublisher(const StatePublisher&) = delete;
+  StatePublisher& operator=(const StatePublisher&) = delete;
+
+  void setTelemetry(const proto_telemetry_t& telemetry_, uint64_t time_ns_);
+  void setSensors(const proto_sensors_t& sensors_, uint64_t time_ns_);
+  void addEvent(const proto_event_t& event_, uint64_t time_ns_);
+
+private:
+  void begin();
+  void end();
+
+  std::string name;
+  State* state;
+};
+
+class StateReader
+{
+public:
+  explicit StateReader(const std::string& name_ = SWIFTLER_STATE_NAME);
+  ~StateReader();
+
+  StateReader(const StateReader&) = delete;
+  StateReader& operator=(const StateReader&) = delete;
+
+  // A coherent copy of the state, under 100 bytes: spins while the
+  // bridge writes, a few hundred nanoseconds at most
+  void read(State& state_) const;
+  // Changed since the last read with this sequence
+  bool changed(uint32_t sequence_) const;
+
+private:
+  const State* state;
+};
+
+} // namespace swiftler
+
+#endif
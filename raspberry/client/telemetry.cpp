@@ -0,0 +1,93 @@
+// Telemetry stream to CSV on stdout, a line per frame:
+//   telemetry [device [period_ms [heartbeat_ms]]]
+// With a heartbeat the board reports on change: a line per frame still,
+// the channels not in it as last received.
+// The first two columns are host times in microseconds since the first
+// frame: the read time, and the sample time from the board tick once the
+// clocks are synchronized (pings every second), else empty.
+
+#include <cstdio>
+#include <cstdlib>
+#include <system_error>
+
+#include <time.h>
+
+#include "swiftler_clock.h"
+#include "swiftler_link.h"
+
+namespace {
+
+const uint64_t PING_NS = 1000000000;
+
+uint64_t nowNs()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  const char* device = argc > 1 ? argv[1] : "/dev/ttyUSB0";
+  const int period_ms = argc > 2 ? atoi(argv[2]) : 20;
+  const int heartbeat_ms = argc > 3 ? atoi(argv[3]) : 0;
+  uint64_t start_ns = 0;
+  uint64_t ping_ns = 0;
+  swiftler::ClockSync clock;
+  swiftler::TelemetryDeltas deltas;
+
+  try
+  {
+    swiftler::Link link(device);
+
+    link.onFrame([&](const swiftler::Frame& frame_)
+      {
+        if (frame_.type == PROTO_TIME && frame_.as<proto_time_t>())
+          clock.update(*frame_.as<proto_time_t>(), frame_.time_ns);
+
+        const proto_telemetry_t* t = frame_.as<proto_telemetry_t>();
+        proto_telemetry_t merged;
+        if (deltas.feed(frame_) && deltas.complete())
+        {
+          merged = deltas.current();
+          t = &merged;
+        }
+        else if (frame_.type != PROTO_TELEMETRY || !t)
+          return;
+        if (!start_ns)
+          start_ns = frame_.time_ns;
+        if (clock.synced())
+          printf("%llu,%lld,", (unsigned long long)(frame_.time_ns - start_ns) / 1000,
+                 ((long long)clock.tickToHostNs(t->tick) - (long long)start_ns) / 1000);
+        else
+          printf("%llu,,", (unsigned long long)(frame_.time_ns - start_ns) / 1000);
+        printf("%u,%d,%d,%d,%d,%d,%u,%u,%u,%d,%d,%d,%u\n",
+               t->tick, t->sharp_left_mm, t->sonar_mm, t->sharp_right_mm,
+               t->motor_left, t->motor_right, t->battery_mv, t->current_ma,
+               t->cut_off, t->x_mm, t->y_mm, t->theta_mrad, t->cpu_permille);
+      });
+
+    if (heartbeat_ms)
+      link.setTelemetryOnChange(period_ms, heartbeat_ms);
+    else
+      link.setTelemetry(period_ms);
+    for (;;)
+    {
+      const uint64_t now_ns = nowNs();
+      if (now_ns - ping_ns >= PING_NS)
+      {
+        ping_ns = now_ns;
+        link.send(PROTO_TIME_REQ, clock.ping(nowNs()));
+      }
+      link.poll(100);
+    }
+  }
+  catch (const std::system_error& e)
+  {
+    fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+}
@@ -1,36 +1,133 @@
-import subprocess
+import ctypes
+import errno
+import fcntl
+import os
+import struct
 
 import raspberrypi
 
-def scan_i2c():
+# linux/i2c-dev.h
+I2C_RETRIES = 0x0701
+I2C_TIMEOUT = 0x0702 # In 10 ms
+I2C_SLAVE = 0x0703
+I2C_RDWR = 0x0707
+# linux/i2c.h
+I2C_M_RD = 0x0001
 
-    proc = subprocess.Popen(['sudo', 'i2cdetect', '-y', raspberrypi.i2c_bus_num()],
-                            stdout = subprocess.PIPE,
-                            close_fds = True)
-    std_out_txt, std_err_txt = proc.communicate()
+# src/libglobal/regmap.h, register 0
+REGMAP_DEVICE_ID = 0x5B
+# regmap_t of REGMAP_VERSION, little endian
+REGMAP_VERSION = 2
+REGMAP_FIELDS = ['device_id', 'version', 'status', 'tick', 'sharp_left_mm',
+                 'sonar_mm', 'sharp_right_mm', 'sonar_left_mm',
+                 'sonar_right_mm', 'battery_mv', 'current_ma', 'motor_left',
+                 'motor_right', 'speed_left', 'speed_right', 'x_mm', 'y_mm',
+                 'theta_mrad', 'target_left', 'target_right']
+REGMAP_FORMAT = '<BBBIhhhhhHHhhhhhhhhh'
 
-    addr = []
-    lines = std_out_txt.rstrip().split("\n")
+class _I2CMsg(ctypes.Structure):
+    _fields_ = [('addr', ctypes.c_uint16), ('flags', ctypes.c_uint16),
+                ('len', ctypes.c_uint16),
+                ('buf', ctypes.POINTER(ctypes.c_uint8))]
 
-    if lines[0] in "command not found":
-        raise RuntimeError("i2cdetect not found")
+class _I2CRdwr(ctypes.Structure):
+    _fields_ = [('msgs', ctypes.POINTER(_I2CMsg)), ('nmsgs', ctypes.c_uint32)]
 
-    for i in range(0,8):
-        for j in range(0,16):
-            idx_i = i+1
-            idx_j = j*3+4
-            cell = lines[idx_i][idx_j:idx_j+2].strip()
-            if cell and cell != "--":
-                hexAddr = 16*i+j
-                if cell == "UU":
-                    addr.append([hexAddr, True])
-                else:
-                    addr.append([hexAddr, False])
+# Addresses i2cdetect leaves alone by default: reserved, and 10 bits
+FIRST_ADDRESS = 0x03
+LAST_ADDRESS = 0x77
 
-    return addr
+def probe(fd, addr):
+    """True when a device acks addr, None when a kernel driver owns it
+    (i2cdetect's UU)"""
+    try:
+        fcntl.ioctl(fd, I2C_SLAVE, addr)
+    except IOError as err:
+        if err.errno == errno.EBUSY:
+            return None
+        raise
+    # A one byte read, as i2cdetect -r: a write probe could latch a
+    # register pointer or worse on some chips
+    try:
+        os.read(fd, 1)
+        return True
+    except OSError:
+        return False
 
+def read_block(fd, addr, reg, length):
+    """length bytes from register reg in one combined transaction: the
+    register pointer written, then read after a repeated start. The board
+    answers from a single snapshot of its register file."""
+    pointer = (ctypes.c_uint8 * 1)(reg)
+    data = (ctypes.c_uint8 * length)()
+    msgs = (_I2CMsg * 2)(_I2CMsg(addr, 0, 1, pointer),
+                         _I2CMsg(addr, I2C_M_RD, length, data))
+    fcntl.ioctl(fd, I2C_RDWR, _I2CRdwr(msgs, 2))
+    return bytearray(data)
 
-i2c_addresses = scan_i2c()
-print i2c_addresses
+def read_id(fd, addr):
+    """Register 0 of an answering device, None when it does not take a
+    register pointer"""
+    try:
+        return read_block(fd, addr, 0, 2)
+    except (IOError, OSError):
+        return None
 
+def read_regmap(fd, addr):
+    """The whole register file of the board in one transaction, as a
+    dict of REGMAP_FIELDS; None when the device or the version differ"""
+    size = struct.calcsize(REGMAP_FORMAT)
+    regs = dict(zip(REGMAP_FIELDS,
+                    struct.unpack(REGMAP_FORMAT,
+                                  bytes(read_block(fd, addr, 0, size)))))
+    if regs['device_id'] != REGMAP_DEVICE_ID or \
+            regs['version'] != REGMAP_VERSION:
+        return None
+    return regs
 
+def scan_i2c(bus = None):
+    """[address, in_use] of the devices answering on the bus: direct
+    probes through /dev/i2c-N with a short timeout, no root needed with
+    the i2c group"""
+    if bus is None:
+        bus = raspberrypi.i2c_bus_num()
+    fd = os.open('/dev/i2c-%s' % bus, os.O_RDWR)
+    try:
+        fcntl.ioctl(fd, I2C_RETRIES, 0)
+        fcntl.ioctl(fd, I2C_TIMEOUT, 1)
+        addr = []
+        for a in range(FIRST_ADDRESS, LAST_ADDRESS + 1):
+            found = probe(fd, a)
+            if found is None:
+                addr.append([a, True])
+            elif found:
+                addr.append([a, False])
+        return addr
+    finally:
+        os.close(fd)
+
+def find_board(bus = None):
+    """(address, regmap version) of the swiftler board, None when absent"""
+    if bus is None:
+        bus = raspberrypi.i2c_bus_num()
+    devices = [a for a, in_use in scan_i2c(bus) if not in_use]
+    fd = os.open('/dev/i2c-%s' % bus, os.O_RDWR)
+    try:
+        for a in devices:
+            regs = read_id(fd, a)
+            if regs and len(regs) == 2 and regs[0] == REGMAP_DEVICE_ID:
+                return a, regs[1]
+        return None
+    finally:
+        os.close(fd)
+
+if __name__ == '__main__':
+    print(scan_i2c())
+    board = find_board()
+    print(board)
+    if board:
+        fd = os.open('/dev/i2c-%s' % raspberrypi.i2c_bus_num(), os.O_RDWR)
+        try:
+            print(read_regmap(fd, board[0]))
+        finally:
+            os.close(fd)
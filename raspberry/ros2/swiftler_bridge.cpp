@@ -0,0 +1,353 @@
+// ROS 2 node on the board link, for the navigation stack: the telemetry
+// frames to topics, cmd_vel to PROTO_VELOCITY frames, straight from the
+// packed payloads of the C++ client (raspberry/client/swiftler_link.h).
+//   colcon build  (raspberry/ros2 linked in the src of a workspace)
+//   ros2 run swiftler_bridge swiftler_bridge --ros-args -p device:=/dev/ttyUSB0
+//
+// Published, each PROTO_TELEMETRY frame (every telemetry_ms):
+// - odom (nav_msgs/Odometry) and the odom -> base_link transform, the
+//   pose of the board odometry, the twist from two poses in a row;
+// - sonar/left, sonar/center, sonar/right, sharp/left, sharp/right
+//   (sensor_msgs/Range), +inf out of range as REP 117 has it;
+// - battery (sensor_msgs/BatteryState).
+// Stamped at the board tick of the sample, through the clock pings
+// (swiftler_clock.h), the read time until they converge.
+//
+// The link is the board's own: not shared with the bridge daemon. The
+// board stops the motors when cmd_vel stops, after its command timeout.
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <poll.h>
+#include <time.h>
+
+#include "geometry_msgs/msg/transform_stamped.hpp"
+#include "geometry_msgs/msg/twist.hpp"
+#include "nav_msgs/msg/odometry.hpp"
+#include "rclcpp/rclcpp.hpp"
+#include "sensor_msgs/msg/battery_state.hpp"
+#include "sensor_msgs/msg/range.hpp"
+#include "tf2_ros/transform_broadcaster.h"
+
+#include "swiftler_clock.h"
+#include "swiftler_link.h"
+
+namespace {
+
+const uint64_t PING_NS = 1000000000;
+const int POLL_MS = 100;
+
+// As the firmware: libperiph/sonar.h, libperiph/sharps.h
+const int16_t BAD_VALUE = -1;
+
+uint64_t nowNs()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+int16_t clamp16(double value_)
+{
+  if (value_ > INT16_MAX)
+    return INT16_MAX;
+  if (value_ < INT16_MIN)
+    return INT16_MIN;
+  return (int16_t)std::lround(value_);
+}
+
+class Bridge : public rclcpp::Node
+{
+public:
+  Bridge();
+  ~Bridge();
+
+private:
+  struct Ranger
+  {
+    rclcpp::Publisher<sensor_msgs::msg::Range>::SharedPtr publisher;
+    sensor_msgs::msg::Range message;
+  };
+
+  void declareRanger(Ranger& ranger_, const std::string& topic_,
+                     const std::string& kind_, uint8_t radiation_);
+  void run();
+  void onFrame(const swiftler::Frame& frame_);
+  void onTelemetry(const proto_telemetry_t& t_, uint64_t read_ns_);
+  void publishRange(Ranger& ranger_, int16_t mm_,
+                    const builtin_interfaces::msg::Time& stamp_);
+  void onCmdVel(const geometry_msgs::msg::Twist& twist_);
+
+  std::unique_ptr<swiftler::Link> link;
+  // The link between the poll thread and the cmd_vel callback
+  std::mutex linkMutex;
+  swiftler::ClockSync clock;
+  uint64_t pingNs;
+  std::thread poller;
+  std::atomic<bool> stopping;
+
+  std::string odomFrame;
+  std::string baseFrame;
+  bool publishTf;
+
+  rclcpp::Publisher<nav_msgs::msg::Odometry>::SharedPtr odomPublisher;
+  rclcpp::Publisher<sensor_msgs::msg::BatteryState>::SharedPtr batteryPublisher;
+  std::unique_ptr<tf2_ros::TransformBroadcaster> tfBroadcaster;
+  rclcpp::Subscription<geometry_msgs::msg::Twist>::SharedPtr cmdVel;
+  Ranger sonars[3];
+  Ranger sharps[2];
+
+  // Pose unwrapped out of the 16 bits millimeters of the frames
+  bool posed;
+  int16_t lastX, lastY;
+  double x, y, theta;
+  uint32_t lastTick;
+};
+
+Bridge::Bridge()
+  : rclcpp::Node("swiftler_bridge"), pingNs(0), stopping(false),
+    posed(false), lastX(0), lastY(0), x(0), y(0), theta(0), lastTick(0)
+{
+  const std::string device =
+    declare_parameter("device", std::string("/dev/ttyUSB0"));
+  const int baudrate = declare_parameter("baudrate", 115200);
+  const int telemetryMs = declare_parameter("telemetry_ms", 20);
+
+  odomFrame = declare_parameter("odom_frame", std::string("odom"));
+  baseFrame = declare_parameter("base_frame", std::string("base_link"));
+  publishTf = declare_parameter("publish_tf", true);
+
+  const rclcpp::QoS sensorQos = rclcpp::SensorDataQoS();
+  odomPublisher = create_publisher<nav_msgs::msg::Odometry>("odom", 10);
+  batteryPublisher =
+    create_publisher<sensor_msgs::msg::BatteryState>("battery", sensorQos);
+  if (publishTf)
+    tfBroadcaster.reset(new tf2_ros::TransformBroadcaster(*this));
+  declareRanger(sonars[0], "sonar/left", "sonar",
+                sensor_msgs::msg::Range::ULTRASOUND);
+  declareRanger(sonars[1], "sonar/center", "sonar",
+                sensor_msgs::msg::Range::ULTRASOUND);
+  declareRanger(sonars[2], "sonar/right", "sonar",
+                sensor_msgs::msg::Range::ULTRASOUND);
+  declareRanger(sharps[0], "sharp/left", "sharp",
+                sensor_msgs::msg::Range::INFRARED);
+  declareRanger(sharps[1], "sharp/right", "sharp",
+                sensor_msgs::msg::Range::INFRARED);
+
+  link.reset(new swiftler::Link(device, baudrate));
+  link->onFrame([this](const swiftler::Frame& frame_) { onFrame(frame_); });
+  link->setTelemetry(telemetryMs);
+
+  cmdVel = create_subscription<geometry_msgs::msg::Twist>(
+    "cmd_vel", 10, [this](const geometry_msgs::msg::Twist::SharedPtr twist_)
+    {
+      onCmdVel(*twist_);
+    });
+
+  poller = std::thread(&Bridge::run, this);
+}
+
+Bridge::~Bridge()
+{
+  stopping = true;
+  poller.join();
+  try
+  {
+    link->setTelemetry(0);
+    link->setVelocity(0, 0);
+  }
+  catch (const std::system_error&)
+  {
+  }
+}
+
+// Range limits and beam width per kind, the datasheet ones by default
+void Bridge::declareRanger(Ranger& ranger_, const std::string& topic_,
+                           const std::string& kind_, uint8_t radiation_)
+{
+  const bool sonar = kind_ == "sonar";
+  const std::string frame = topic_.substr(0, topic_.find('/')) + "_" +
+    topic_.substr(topic_.find('/') + 1) + "_link";
+  sensor_msgs::msg::Range& range = ranger_.message;
+
+  range.header.frame_id = frame;
+  range.radiation_type = radiation_;
+  if (!has_parameter(kind_ + ".min_range"))
+  {
+    declare_parameter(kind_ + ".min_range", sonar ? 0.02 : 0.10);
+    declare_parameter(kind_ + ".max_range", sonar ? 4.0 : 0.80);
+    declare_parameter(kind_ + ".field_of_view", sonar ? 0.26 : 0.05);
+  }
+  range.min_range = get_parameter(kind_ + ".min_range").as_double();
+  range.max_range = get_parameter(kind_ + ".max_range").as_double();
+  range.field_of_view = get_parameter(kind_ + ".field_of_view").as_double();
+  ranger_.publisher =
+    create_publisher<sensor_msgs::msg::Range>(topic_, rclcpp::SensorDataQoS());
+}
+
+// The link outside of the lock while it waits: cmd_vel goes out at once
+void Bridge::run()
+{
+  while (!stopping && rclcpp::ok())
+  {
+    struct pollfd fds;
+    {
+      std::lock_guard<std::mutex> lock(linkMutex);
+      fds.fd = link->fd();
+      fds.events = POLLIN | (link->wantsWrite() ? POLLOUT : 0);
+      fds.revents = 0;
+    }
+    ::poll(&fds, 1, POLL_MS);
+
+    std::lock_guard<std::mutex> lock(linkMutex);
+    try
+    {
+      link->process();
+      const uint64_t now = nowNs();
+      if (now - pingNs >= PING_NS)
+      {
+        pingNs = now;
+        link->send(PROTO_TIME_REQ, clock.ping(now));
+      }
+    }
+    catch (const std::system_error& e)
+    {
+      RCLCPP_FATAL(get_logger(), "link: %s", e.what());
+      rclcpp::shutdown();
+      return;
+    }
+  }
+}
+
+void Bridge::onFrame(const swiftler::Frame& frame_)
+{
+  if (frame_.type == PROTO_TIME && frame_.as<proto_time_t>())
+    clock.update(*frame_.as<proto_time_t>(), frame_.time_ns);
+  else if (frame_.type == PROTO_TELEMETRY && frame_.as<proto_telemetry_t>())
+    onTelemetry(*frame_.as<proto_telemetry_t>(), frame_.time_ns);
+}
+
+void Bridge::onTelemetry(const proto_telemetry_t& t_, uint64_t read_ns_)
+{
+  // Sample time on the monotonic clock, moved to the ROS clock
+  const uint64_t sample_ns = clock.synced() ? clock.tickToHostNs(t_.tick)
+    : read_ns_;
+  const rclcpp::Time stamp =
+    now() - rclcpp::Duration::from_nanoseconds((int64_t)(nowNs() - sample_ns));
+
+  if (!posed)
+  {
+    posed = true;
+    lastX = t_.x_mm;
+    lastY = t_.y_mm;
+    x = t_.x_mm / 1000.0;
+    y = t_.y_mm / 1000.0;
+    theta = t_.theta_mrad / 1000.0;
+    lastTick = t_.tick;
+  }
+  const double dx = (int16_t)(t_.x_mm - lastX) / 1000.0;
+  const double dy = (int16_t)(t_.y_mm - lastY) / 1000.0;
+  const double newTheta = t_.theta_mrad / 1000.0;
+  const double dtheta = std::remainder(newTheta - theta, 2 * M_PI);
+  const double dt = (uint32_t)(t_.tick - lastTick) / 1000.0;
+  lastX = t_.x_mm;
+  lastY = t_.y_mm;
+  lastTick = t_.tick;
+  x += dx;
+  y += dy;
+  theta = newTheta;
+
+  nav_msgs::msg::Odometry odom;
+  odom.header.stamp = stamp;
+  odom.header.frame_id = odomFrame;
+  odom.child_frame_id = baseFrame;
+  odom.pose.pose.position.x = x;
+  odom.pose.pose.position.y = y;
+  odom.pose.pose.orientation.z = std::sin(theta / 2);
+  odom.pose.pose.orientation.w = std::cos(theta / 2);
+  if (dt > 0)
+  {
+    // In the robot frame: forward along the heading of the motion
+    odom.twist.twist.linear.x =
+      (dx * std::cos(theta) + dy * std::sin(theta)) / dt;
+    odom.twist.twist.angular.z = dtheta / dt;
+  }
+  odomPublisher->publish(odom);
+
+  if (tfBroadcaster)
+  {
+    geometry_msgs::msg::TransformStamped transform;
+    transform.header = odom.header;
+    transform.child_frame_id = baseFrame;
+    transform.transform.translation.x = x;
+    transform.transform.translation.y = y;
+    transform.transform.rotation = odom.pose.pose.orientation;
+    tfBroadcaster->sendTransform(transform);
+  }
+
+  publishRange(sonars[0], t_.sonar_left_mm, stamp);
+  publishRange(sonars[1], t_.sonar_mm, stamp);
+  publishRange(sonars[2], t_.sonar_right_mm, stamp);
+  publishRange(sharps[0], t_.sharp_left_mm, stamp);
+  publishRange(sharps[1], t_.sharp_right_mm, stamp);
+
+  sensor_msgs::msg::BatteryState battery;
+  battery.header.stamp = stamp;
+  battery.voltage = t_.battery_mv / 1000.0;
+  // Drawn by the robot, discharging
+  battery.current = -t_.current_ma / 1000.0;
+  battery.percentage = std::numeric_limits<float>::quiet_NaN();
+  battery.present = true;
+  batteryPublisher->publish(battery);
+}
+
+void Bridge::publishRange(Ranger& ranger_, int16_t mm_,
+                          const builtin_interfaces::msg::Time& stamp_)
+{
+  ranger_.message.header.stamp = stamp_;
+  ranger_.message.range = mm_ == BAD_VALUE ?
+    std::numeric_limits<float>::infinity() : mm_ / 1000.0;
+  ranger_.publisher->publish(ranger_.message);
+}
+
+void Bridge::onCmdVel(const geometry_msgs::msg::Twist& twist_)
+{
+  std::lock_guard<std::mutex> lock(linkMutex);
+  try
+  {
+    link->setVelocity(clamp16(twist_.linear.x * 1000),
+                      clamp16(twist_.angular.z * 1000));
+  }
+  catch (const std::system_error& e)
+  {
+    RCLCPP_ERROR(get_logger(), "cmd_vel: %s", e.what());
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  rclcpp::init(argc, argv);
+  try
+  {
+    rclcpp::spin(std::make_shared<Bridge>());
+  }
+  catch (const std::system_error& e)
+  {
+    fprintf(stderr, "%s\n", e.what());
+    rclcpp::shutdown();
+    return 1;
+  }
+  rclcpp::shutdown();
+  return 0;
+}
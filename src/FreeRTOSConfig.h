@@ -65,13 +65,18 @@
  * See http://www.freertos.org/a00110.html.
  *----------------------------------------------------------*/
 
+#include "libperiph/priorities.h"
+
 #define configUSE_PREEMPTION		1
-#define configUSE_IDLE_HOOK			0
-#define configUSE_TICK_HOOK			0
+#define configUSE_IDLE_HOOK			1
+#define configUSE_TICK_HOOK			1
 #define configCPU_CLOCK_HZ			( ( unsigned portLONG ) 72000000 )
 #define configTICK_RATE_HZ			( ( portTickType ) 1000 )
 #define configMINIMAL_STACK_SIZE	( ( unsigned portSHORT ) 128 )
-#ifdef PROGRAM_MODE_FLASH
+#if defined(SIMULATION)
+/* Host simulation: stack words of 8 bytes */
+# define configTOTAL_HEAP_SIZE		( ( size_t ) ( 40 * 1024 ) )
+#elif defined(PROGRAM_MODE_FLASH)
 # define configTOTAL_HEAP_SIZE		( ( size_t ) ( 17 * 1024 ) )
 #else
 # define configTOTAL_HEAP_SIZE		( ( size_t ) ( 8 * 1024 ) )
@@ -80,8 +85,69 @@
 #define configUSE_TRACE_FACILITY	0
 #define configUSE_16_BIT_TICKS		0
 #define configIDLE_SHOULD_YIELD		0
-#define configUSE_CO_ROUTINES 		0
+#ifdef CO_ROUTINES
+/* The idle hook schedules them: one stack for all, as deep as the
+   deepest (libperiph/priorities.h) */
+# define configUSE_CO_ROUTINES 		1
+# define tskIDLE_STACK_SIZE		( configMINIMAL_STACK_SIZE + 64 )
+#else
+# define configUSE_CO_ROUTINES 		0
+#endif
 #define configUSE_MUTEXES               1
+#define configUSE_APPLICATION_TASK_TAG  1
+#ifdef STACK_GUARD
+/* The MPU guards the stack of the running task instead (libperiph/mpu.h) */
+# define configCHECK_FOR_STACK_OVERFLOW 0
+void vMpuSwitchedIn(void* stack_);
+# define traceMPU_SWITCHED_IN(stack) vMpuSwitchedIn(stack)
+#else
+# define configCHECK_FOR_STACK_OVERFLOW 2
+# define traceMPU_SWITCHED_IN(stack)
+#endif
+
+/* Timer service task, runs the libperiph/periodic jobs */
+#define configUSE_TIMERS                1
+#define configTIMER_TASK_PRIORITY       PRIORITY_COMMS
+#define configTIMER_QUEUE_LENGTH        4
+#define configTIMER_TASK_STACK_DEPTH    configMINIMAL_STACK_SIZE
+
+/* Per task CPU time, the task tag is its libglobal/sysmon slot */
+void vSysmonSwitchedOut(void* tag_);
+
+/* With --itm, the task switched in goes out on SWO (libperiph/itm.h) */
+#ifdef ITM_TRACE
+void vItmTaskSwitchedIn(void* tag_);
+# define traceITM_SWITCHED_IN(tag) vItmTaskSwitchedIn(tag)
+#else
+# define traceITM_SWITCHED_IN(tag)
+#endif
+
+/* With --timeline, the switches and the waits go to libglobal/timeline */
+#ifdef TIMELINE
+void vTimelineSwitchedIn(void* tag_);
+void vTimelineSwitchedOut(void* tag_);
+void vTimelineWait(unsigned char event_);
+# define traceTIMELINE_SWITCHED_IN(tag)  vTimelineSwitchedIn(tag)
+# define traceTIMELINE_SWITCHED_OUT(tag) vTimelineSwitchedOut(tag)
+/* TIMELINE_WAIT_QUEUE and TIMELINE_WAIT_DELAY */
+# define traceBLOCKING_ON_QUEUE_SEND(queue)    vTimelineWait(3)
+# define traceBLOCKING_ON_QUEUE_RECEIVE(queue) vTimelineWait(3)
+# define traceTASK_DELAY()                     vTimelineWait(5)
+# define traceTASK_DELAY_UNTIL()               vTimelineWait(5)
+#else
+# define traceTIMELINE_SWITCHED_IN(tag)
+# define traceTIMELINE_SWITCHED_OUT(tag)
+#endif
+
+#define traceTASK_SWITCHED_OUT() do { \
+    vSysmonSwitchedOut((void*)pxCurrentTCB->pxTaskTag); \
+    traceTIMELINE_SWITCHED_OUT((void*)pxCurrentTCB->pxTaskTag); \
+  } while (0)
+#define traceTASK_SWITCHED_IN() do { \
+    traceMPU_SWITCHED_IN((void*)pxCurrentTCB->pxStack); \
+    traceITM_SWITCHED_IN((void*)pxCurrentTCB->pxTaskTag); \
+    traceTIMELINE_SWITCHED_IN((void*)pxCurrentTCB->pxTaskTag); \
+  } while (0)
 
 #define configMAX_PRIORITIES		( ( unsigned portBASE_TYPE ) 5 )
 #define configMAX_CO_ROUTINE_PRIORITIES ( 2 )
@@ -96,9 +162,11 @@ to exclude the API function. */
 #define INCLUDE_vTaskSuspend			1
 #define INCLUDE_vTaskDelayUntil			1
 #define INCLUDE_vTaskDelay				1
+#define INCLUDE_uxTaskGetStackHighWaterMark	1
+#define INCLUDE_xTaskGetCurrentTaskHandle	1
 
 #define configKERNEL_INTERRUPT_PRIORITY 		255
-#define configMAX_SYSCALL_INTERRUPT_PRIORITY 	191	/* equivalent to 0xa0, or priority 5. */
+#define configMAX_SYSCALL_INTERRUPT_PRIORITY 	191	/* equivalent to 0xa0, or priority 5: IRQ_PRIORITY_KERNEL_MAX */
 
 
 
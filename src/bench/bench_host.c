@@ -0,0 +1,57 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libglobal/bench.h"
+#include "libglobal/trig.h"
+
+#define TURN 4294967296.0
+#define PI   3.14159265358979323846
+
+// Largest errors of the fixed-point trigonometry against the C library,
+// over a sweep of the angles and of the vectors
+static void prvTrigAccuracy()
+{
+  double sin_error = 0, atan2_error = 0;
+
+  for (uint64_t a = 0; a < (1ull << 32); a += 65521)
+  {
+    const double e = fabs(iTrigSin(a) / 32768.0 - sin(a * 2 * PI / TURN));
+    if (e > sin_error)
+      sin_error = e;
+  }
+  for (int32_t y = -1000; y <= 1000; y += 7)
+    for (int32_t x = -1000; x <= 1000; x += 7)
+    {
+      // Large vectors too: the CORDIC scales them down first
+      const int32_t scale = (x & 1) ? 1 : 1 << 21;
+      const double t = atan2(y, x) / (2 * PI);
+      const double e =
+        fabs(remainder((int32_t)uTrigAtan2(y * scale, x * scale) / TURN - t,
+                       1.0));
+      if (e > atan2_error)
+        atan2_error = e;
+    }
+  printf("sin error %.1e, atan2 error %.1e turn\n", sin_error, atan2_error);
+}
+
+// Host side of the libglobal benchmarks ("waf bench"), times in ns, no
+// budget: the checks only. Optional argument: number of samples per
+// benchmark. Exits with 1 on a wrong result.
+int main(int argc, char** argv)
+{
+  const int samples = argc > 1 ? atoi(argv[1]) : 100000;
+  bench_result_t results[BENCH_NB];
+  const int n = iBenchRun(results, samples);
+
+  printf("%-10s %8s %8s %8s  (ns per call, %d samples of %d calls)\n",
+         "", "min", "mean", "max", samples, BENCH_BATCH);
+  for (int i = 0; i < n; i++)
+    printf("%-10s %8u %8u %8u  %s\n", results[i].name,
+           (unsigned)results[i].min, (unsigned)results[i].mean,
+           (unsigned)results[i].max,
+           results[i].status == BENCH_PASS ? "ok" : "WRONG");
+  prvTrigAccuracy();
+
+  return iBenchFailures(results, n) ? 1 : 0;
+}
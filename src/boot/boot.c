@@ -0,0 +1,341 @@
+#include <string.h>
+
+#include "stm32f10x.h"
+
+#include "boot/boot.h"
+
+// Resident bootloader: bare metal, on the 8 MHz HSI out of reset, polled
+// peripherals. The application sets its own clocks from scratch.
+
+// BRR at 8 MHz: 115942 bauds, 0.6% off
+#define BOOT_UART_BRR (8000000 / 115200)
+
+#define BOOT_FLASH_KEY1 0x45670123
+#define BOOT_FLASH_KEY2 0xCDEF89AB
+
+#define BOOT_SYNC 0xA5
+#define BOOT_MAX_DATA (BOOT_MAX_PAYLOAD - sizeof (uint32_t))
+
+enum eBootDecode {
+  DECODE_SYNC,
+  DECODE_TYPE,
+  DECODE_SIZE,
+  DECODE_PAYLOAD,
+  DECODE_CRC,
+};
+
+typedef struct
+{
+  uint8_t type;
+  uint8_t size;
+  uint8_t payload[BOOT_MAX_PAYLOAD];
+} boot_frame_t;
+
+static const boot_image_t* const image = (const boot_image_t*)BOOT_IMAGE_ADDRESS;
+
+// Same as uProtoCrc8 (libglobal/protocol.c): CRC-8, polynomial 0x07
+static uint8_t prvBootCrc8(uint8_t crc_, const uint8_t* data_, int size_)
+{
+  while (size_--)
+  {
+    crc_ ^= *data_++;
+    for (int i = 0; i < 8; i++)
+      crc_ = (crc_ & 0x80) ? (crc_ << 1) ^ 0x07 : crc_ << 1;
+  }
+  return crc_;
+}
+
+// CRC unit, a word per cycle
+static uint32_t prvBootCrc32(uint32_t offset_, uint32_t length_)
+{
+  const uint32_t* word = (const uint32_t*)(BOOT_APP_BASE + offset_);
+
+  CRC->CR = CRC_CR_RESET;
+  for (uint32_t i = 0; i < length_ / 4; i++)
+    CRC->DR = word[i];
+  return CRC->DR;
+}
+
+static int prvBootIsValidRange(uint32_t offset_, uint32_t length_)
+{
+  return !(offset_ & 3) && !(length_ & 3) && offset_ <= BOOT_APP_SIZE &&
+    length_ <= BOOT_APP_SIZE - offset_;
+}
+
+static int prvBootIsImageValid()
+{
+  const uint32_t sp = *(const uint32_t*)BOOT_APP_BASE;
+
+  return image->magic == BOOT_IMAGE_MAGIC &&
+    prvBootIsValidRange(0, image->length) && image->length >= 8 &&
+    sp > SRAM_BASE && sp <= (uint32_t)&BOOT_REQUEST &&
+    prvBootCrc32(0, image->length) == image->crc;
+}
+
+// The vector table of the application gives its stack and entry point
+static void prvBootStart()
+{
+  const uint32_t* vectors = (const uint32_t*)BOOT_APP_BASE;
+
+  SCB->VTOR = BOOT_APP_BASE;
+  __asm volatile
+    (
+      "msr msp, %0  \n"
+      "bx %1        \n"
+      : : "r" (vectors[0]), "r" (vectors[1])
+    );
+}
+
+static void prvBootUartInit()
+{
+  RCC->APB2ENR |= RCC_APB2ENR_IOPAEN | RCC_APB2ENR_USART1EN;
+
+  // PA9 TX alternate push-pull 2 MHz, PA10 RX floating input
+  GPIOA->CRH = (GPIOA->CRH & ~0x00000FF0) | 0x000004A0;
+
+  USART1->BRR = BOOT_UART_BRR;
+  USART1->CR1 = USART_CR1_UE | USART_CR1_TE | USART_CR1_RE;
+}
+
+static uint8_t prvBootGetc()
+{
+  while (!(USART1->SR & USART_SR_RXNE));
+  return USART1->DR;
+}
+
+static void prvBootPutc(uint8_t c_)
+{
+  while (!(USART1->SR & USART_SR_TXE));
+  USART1->DR = c_;
+}
+
+static void prvBootSend(uint8_t type_, const void* payload_, uint8_t size_)
+{
+  const uint8_t header[2] = { type_, size_ };
+  uint8_t crc;
+
+  crc = prvBootCrc8(0, header, 2);
+  crc = prvBootCrc8(crc, payload_, size_);
+
+  prvBootPutc(BOOT_SYNC);
+  prvBootPutc(type_);
+  prvBootPutc(size_);
+  for (int i = 0; i < size_; i++)
+    prvBootPutc(((const uint8_t*)payload_)[i]);
+  prvBootPutc(crc);
+}
+
+static void prvBootReply(int ok_, uint8_t type_)
+{
+  prvBootSend(ok_ ? BOOT_ACK : BOOT_NACK, &type_, 1);
+}
+
+// Bad CRC frames are dropped: the host times out and sends again
+static void prvBootReceive(boot_frame_t* frame_)
+{
+  int state = DECODE_SYNC;
+  int pos = 0;
+  uint8_t crc = 0;
+
+  for (;;)
+  {
+    const uint8_t c = prvBootGetc();
+
+    switch (state)
+    {
+      case DECODE_SYNC:
+        if (c == BOOT_SYNC)
+          state = DECODE_TYPE;
+        break;
+      case DECODE_TYPE:
+        frame_->type = c;
+        crc = prvBootCrc8(0, &c, 1);
+        state = DECODE_SIZE;
+        break;
+      case DECODE_SIZE:
+        if (c > BOOT_MAX_PAYLOAD)
+        {
+          state = DECODE_SYNC;
+          break;
+        }
+        frame_->size = c;
+        crc = prvBootCrc8(crc, &c, 1);
+        pos = 0;
+        state = c ? DECODE_PAYLOAD : DECODE_CRC;
+        break;
+      case DECODE_PAYLOAD:
+        frame_->payload[pos++] = c;
+        crc = prvBootCrc8(crc, &c, 1);
+        if (pos == frame_->size)
+          state = DECODE_CRC;
+        break;
+      case DECODE_CRC:
+        if (c == crc)
+          return;
+        state = DECODE_SYNC;
+        break;
+    }
+  }
+}
+
+static int prvBootFlashWait()
+{
+  while (FLASH->SR & FLASH_SR_BSY);
+  const int ok = !(FLASH->SR & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR));
+  FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPRTERR;
+  return ok;
+}
+
+static int prvBootErase(uint32_t address_)
+{
+  const uint32_t* page =
+    (const uint32_t*)(address_ & ~(uint32_t)(BOOT_PAGE_SIZE - 1));
+  int ok;
+
+  FLASH->CR |= FLASH_CR_PER;
+  FLASH->AR = address_;
+  FLASH->CR |= FLASH_CR_STRT;
+  ok = prvBootFlashWait();
+  FLASH->CR &= ~FLASH_CR_PER;
+
+  // Checked: an erase of a protected page does not flag an error
+  for (int i = 0; ok && i < BOOT_PAGE_SIZE / 4; i++)
+    ok = page[i] == 0xFFFFFFFF;
+  return ok;
+}
+
+static int prvBootProgram(uint32_t address_, const void* data_, int size_)
+{
+  const uint16_t* half = data_;
+  int ok = 1;
+
+  // Sent again after a lost reply
+  if (!memcmp((const void*)address_, data_, size_))
+    return 1;
+
+  FLASH->CR |= FLASH_CR_PG;
+  for (int i = 0; ok && i < size_ / 2; i++)
+  {
+    ((volatile uint16_t*)address_)[i] = half[i];
+    ok = prvBootFlashWait();
+  }
+  FLASH->CR &= ~FLASH_CR_PG;
+
+  return ok && !memcmp((const void*)address_, data_, size_);
+}
+
+// Before the first change: an interrupted update never starts
+static int prvBootInvalidate()
+{
+  if (image->magic == 0xFFFFFFFF)
+    return 1;
+  return prvBootErase(BOOT_IMAGE_ADDRESS);
+}
+
+static void prvBootHandle(const boot_frame_t* frame_)
+{
+  uint32_t offset, length;
+  int ok = 0;
+
+  switch (frame_->type)
+  {
+    case BOOT_INFO_REQ:
+    {
+      const boot_info_t info =
+        {
+          .version     = BOOT_VERSION,
+          .page_size   = BOOT_PAGE_SIZE,
+          .app_base    = BOOT_APP_BASE,
+          .app_size    = BOOT_APP_SIZE,
+          .image_valid = prvBootIsImageValid(),
+        };
+      prvBootSend(BOOT_INFO, &info, sizeof (info));
+      return;
+    }
+
+    case BOOT_CRC_REQ:
+    {
+      boot_range_t range;
+      if (frame_->size != sizeof (range))
+        break;
+      memcpy(&range, frame_->payload, sizeof (range));
+      if (!prvBootIsValidRange(range.offset, range.length))
+        break;
+      const uint32_t crc = prvBootCrc32(range.offset, range.length);
+      prvBootSend(BOOT_CRC, &crc, sizeof (crc));
+      return;
+    }
+
+    case BOOT_ERASE:
+    {
+      uint16_t page;
+      if (frame_->size != sizeof (page))
+        break;
+      memcpy(&page, frame_->payload, sizeof (page));
+      if (page >= BOOT_APP_SIZE / BOOT_PAGE_SIZE)
+        break;
+      ok = prvBootInvalidate() &&
+        prvBootErase(BOOT_APP_BASE + page * BOOT_PAGE_SIZE);
+      break;
+    }
+
+    case BOOT_WRITE:
+      if (frame_->size < sizeof (offset))
+        break;
+      memcpy(&offset, frame_->payload, sizeof (offset));
+      length = frame_->size - sizeof (offset);
+      if (!prvBootIsValidRange(offset, length))
+        break;
+      ok = prvBootInvalidate() &&
+        prvBootProgram(BOOT_APP_BASE + offset,
+                       &frame_->payload[sizeof (offset)], length);
+      break;
+
+    case BOOT_COMMIT:
+    {
+      boot_image_t committed = { .magic = BOOT_IMAGE_MAGIC };
+      if (frame_->size != sizeof (committed.length) + sizeof (committed.crc))
+        break;
+      memcpy(&committed.length, frame_->payload, frame_->size);
+      if (!prvBootIsValidRange(0, committed.length) ||
+          prvBootCrc32(0, committed.length) != committed.crc)
+        break;
+      ok = prvBootInvalidate() &&
+        prvBootProgram(BOOT_IMAGE_ADDRESS, &committed, sizeof (committed));
+      break;
+    }
+
+    case BOOT_RUN:
+      ok = prvBootIsImageValid();
+      prvBootReply(ok, frame_->type);
+      if (ok)
+      {
+        while (!(USART1->SR & USART_SR_TC));
+        NVIC_SystemReset();
+      }
+      return;
+  }
+
+  prvBootReply(ok, frame_->type);
+}
+
+int main()
+{
+  static boot_frame_t frame;
+
+  RCC->AHBENR |= RCC_AHBENR_CRCEN;
+
+  if (BOOT_REQUEST != BOOT_REQUEST_MAGIC && prvBootIsImageValid())
+    prvBootStart();
+  BOOT_REQUEST = 0;
+
+  prvBootUartInit();
+  FLASH->KEYR = BOOT_FLASH_KEY1;
+  FLASH->KEYR = BOOT_FLASH_KEY2;
+
+  for (;;)
+  {
+    prvBootReceive(&frame);
+    prvBootHandle(&frame);
+  }
+}
@@ -0,0 +1,76 @@
+#ifndef BOOT_H
+# define BOOT_H
+
+#include <stdint.h>
+
+#include "libperiph/mcu.h"
+
+// Resident bootloader, the first 8 KB of the flash: it starts the
+// application when its image checks against the descriptor, otherwise it
+// waits for an update on the UART (USART1, 115200 bauds, 8N1). The
+// application asks for it with the "boot" console command.
+//
+// Flash map, kept in step with the linker scripts:
+//   0x08000000  bootloader (7 KB, 6 KB with 2 KB pages)
+//   0x08001C00  image descriptor (boot_image_t), alone in its page
+//   0x08002000  application (BOOT_APP_SIZE), vector table first
+//   MCU_PARAMS_BASE  parameters, then the black box: left alone
+#define BOOT_IMAGE_ADDRESS 0x08001C00
+#define BOOT_APP_BASE      0x08002000
+#define BOOT_APP_SIZE      (MCU_PARAMS_BASE - BOOT_APP_BASE)
+#define BOOT_PAGE_SIZE     MCU_PAGE_SIZE
+
+#define BOOT_VERSION 1
+
+// Last RAM word, outside of the RAM of both programs: kept across the
+// reset by the "boot" command
+#define BOOT_REQUEST \
+  (*(volatile uint32_t*)(MCU_RAM_BASE + MCU_RAM_SIZE - 4))
+#define BOOT_REQUEST_MAGIC 0xB007B007
+
+// Image descriptor, programmed once the whole image checked. Erased
+// before the first change, an interrupted update stays in the bootloader.
+#define BOOT_IMAGE_MAGIC 0x1AA6E0C5
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t length; // Bytes from BOOT_APP_BASE, a multiple of 4
+  uint32_t crc;    // CRC unit of the STM32: CRC-32, words, not reflected
+} boot_image_t;
+
+// Frames as the binary protocol (libglobal/protocol.h), up to
+// BOOT_MAX_PAYLOAD bytes, one reply per frame: SYNC | type | size |
+// payload[size] | crc8(type, size, payload). Offsets are from
+// BOOT_APP_BASE, data and lengths multiples of 4.
+#define BOOT_MAX_PAYLOAD 132
+
+enum eBootType {
+  BOOT_INFO_REQ = 0x20, // No payload, answered by BOOT_INFO
+  BOOT_CRC_REQ  = 0x21, // boot_range_t, answered by BOOT_CRC
+  BOOT_ERASE    = 0x22, // uint16_t page of the application
+  BOOT_WRITE    = 0x23, // uint32_t offset then up to 128 bytes, erased before
+  BOOT_COMMIT   = 0x24, // boot_image_t without magic: checked, then saved
+  BOOT_RUN      = 0x25, // No payload, acknowledged then start the image
+  BOOT_ACK      = 0x80, // Type of the acknowledged frame
+  BOOT_NACK     = 0x81, // Type of the rejected frame
+  BOOT_INFO     = 0xA0, // boot_info_t
+  BOOT_CRC      = 0xA1, // uint32_t
+};
+
+typedef struct
+{
+  uint32_t offset;
+  uint32_t length;
+} __attribute__((packed)) boot_range_t;
+
+typedef struct
+{
+  uint16_t version;
+  uint16_t page_size;
+  uint32_t app_base;
+  uint32_t app_size;
+  uint8_t image_valid;
+} __attribute__((packed)) boot_info_t;
+
+#endif
@@ -0,0 +1,163 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/actuation.h"
+
+#include "libperiph/cycles.h"
+
+#define ACTUATION_ALL ((1 << ACTUATION_STAGES_NB) - 1)
+
+typedef struct
+{
+  uint32_t min;                  // us
+  uint32_t max;
+  // 32 bits would do, until a stuck command
+  uint64_t total;
+  uint16_t bins[ACTUATION_BINS];
+} actuation_accumulator_t;
+
+// Command in flight
+static uint32_t setpoint;
+static uint32_t first;
+static uint32_t stamped;         // Mask of the stages
+static uint32_t us[ACTUATION_STAGES_NB];
+// Set with the LOOP stage, for the next update event
+static volatile int pwmPending;
+
+static uint32_t samples;
+static uint32_t incomplete;
+static actuation_accumulator_t accumulators[ACTUATION_STAGES_NB];
+static uint32_t lastSetpoint;
+static uint16_t lastUs[ACTUATION_STAGES_NB];
+
+static int prvActuationBin(uint32_t us_)
+{
+  int bin = 0;
+
+  while (us_ > 1 && bin < ACTUATION_BINS - 1)
+  {
+    us_ >>= 1;
+    bin++;
+  }
+  return bin;
+}
+
+// Under the mask: the last stage of the command closes it
+static void prvActuationRecord()
+{
+  samples++;
+  lastSetpoint = setpoint;
+  for (int i = 0; i < ACTUATION_STAGES_NB; i++)
+  {
+    actuation_accumulator_t* acc = &accumulators[i];
+
+    if (samples == 1 || us[i] < acc->min)
+      acc->min = us[i];
+    if (us[i] > acc->max)
+      acc->max = us[i];
+    acc->total += us[i];
+    acc->bins[prvActuationBin(us[i])]++;
+    lastUs[i] = us[i] > 0xffff ? 0xffff : us[i];
+  }
+  stamped = 0;
+}
+
+static void prvActuationStamp(int stage_)
+{
+  us[stage_] = (uCyclesNow() - first) / CYCLES_PER_US;
+  stamped |= 1 << stage_;
+  if (stage_ == ACTUATION_LOOP)
+    pwmPending = 1;
+  if (stamped == ACTUATION_ALL)
+    prvActuationRecord();
+}
+
+void vActuationStart(uint32_t first_, uint32_t setpoint_)
+{
+  const unsigned portBASE_TYPE mask = portSET_INTERRUPT_MASK_FROM_ISR();
+
+  if (stamped)
+    incomplete++;
+  setpoint = setpoint_;
+  first = first_;
+  stamped = 0;
+  pwmPending = 0;
+  prvActuationStamp(ACTUATION_FRAME);
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+void vActuationStamp(int stage_, uint32_t setpoint_)
+{
+  const unsigned portBASE_TYPE mask = portSET_INTERRUPT_MASK_FROM_ISR();
+
+  // The first time only: the loop applies the same target each period
+  if (stamped && setpoint_ == setpoint && !(stamped & 1 << stage_))
+    prvActuationStamp(stage_);
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+void vActuationUpdate()
+{
+  unsigned portBASE_TYPE mask;
+
+  if (!pwmPending)
+    return;
+  mask = portSET_INTERRUPT_MASK_FROM_ISR();
+  pwmPending = 0;
+  if (stamped)
+    prvActuationStamp(ACTUATION_PWM);
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+void vActuationGet(actuation_result_t* result_)
+{
+  actuation_accumulator_t acc;
+
+  taskENTER_CRITICAL();
+  result_->samples = samples;
+  result_->incomplete = incomplete;
+  taskEXIT_CRITICAL();
+  for (int i = 0; i < ACTUATION_STAGES_NB; i++)
+  {
+    actuation_stats_t* stats = &result_->stages[i];
+
+    taskENTER_CRITICAL();
+    acc = accumulators[i];
+    taskEXIT_CRITICAL();
+
+    stats->min_us  = result_->samples ? acc.min : 0;
+    stats->mean_us = result_->samples ? acc.total / result_->samples : 0;
+    stats->max_us  = acc.max;
+    for (int j = 0; j < ACTUATION_BINS; j++)
+      stats->bins[j] = acc.bins[j];
+  }
+}
+
+int xActuationLast(uint32_t* setpoint_, uint16_t* us_)
+{
+  int ok;
+
+  taskENTER_CRITICAL();
+  ok = samples != 0;
+  *setpoint_ = lastSetpoint;
+  for (int i = 0; i < ACTUATION_STAGES_NB; i++)
+    us_[i] = lastUs[i];
+  taskEXIT_CRITICAL();
+  return ok;
+}
+
+void vActuationReset()
+{
+  taskENTER_CRITICAL();
+  samples = 0;
+  incomplete = 0;
+  for (int i = 0; i < ACTUATION_STAGES_NB; i++)
+  {
+    accumulators[i].min = 0;
+    accumulators[i].max = 0;
+    accumulators[i].total = 0;
+    for (int j = 0; j < ACTUATION_BINS; j++)
+      accumulators[i].bins[j] = 0;
+  }
+  taskEXIT_CRITICAL();
+}
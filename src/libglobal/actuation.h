@@ -0,0 +1,72 @@
+#ifndef ACTUATION_H
+# define ACTUATION_H
+
+#include <stdint.h>
+
+// Command to actuation latency, with --actuation-trace: the motor
+// commands on USART1 are followed from their first byte to the update
+// event that loads their duty cycles in TIM2. The setpoint (both wheels
+// in one word, as motors_command_t) tags the command along the way: a
+// stage stamped with another one is not counted. One command in flight,
+// a new one before the end of the previous counts it incomplete.
+// "at" reports the distributions, PROTO_ACTUATION the last command for
+// linkbench, which adds the host side.
+
+// Tag of a command, the layout of motors_command_t
+#define ACTUATION_SETPOINT(left_, right_) \
+  ((uint16_t)(left_) | (uint32_t)(uint16_t)(right_) << 16)
+
+// Each stage is timed from the first byte, estimated from the baud rate
+enum eActuationStage {
+  ACTUATION_FRAME, // Frame checked and published by the RX interrupt
+  ACTUATION_LOOP,  // Through the limits, in the timer preload registers
+  ACTUATION_PWM,   // Update event: the new duty cycles on the outputs
+  ACTUATION_SHELL, // ACKed by the interpreter, the host sees it then
+  ACTUATION_STAGES_NB
+};
+
+// Log2 histogram: bin i for [2^i, 2^(i + 1)) us, the last one above
+#define ACTUATION_BINS 12
+
+typedef struct
+{
+  uint32_t min_us;
+  uint32_t mean_us;
+  uint32_t max_us;
+  uint16_t bins[ACTUATION_BINS];
+} actuation_stats_t;
+
+typedef struct
+{
+  uint32_t samples;              // Commands through all the stages
+  uint32_t incomplete;
+  actuation_stats_t stages[ACTUATION_STAGES_NB];
+} actuation_result_t;
+
+// Markers, compiled in with --actuation-trace only
+#ifdef ACTUATION_TRACE
+# define ACTUATION_START(first_, setpoint_) vActuationStart(first_, setpoint_)
+# define ACTUATION_STAMP(stage_, setpoint_) vActuationStamp(stage_, setpoint_)
+# define ACTUATION_UPDATE()                 vActuationUpdate()
+#else
+# define ACTUATION_START(first_, setpoint_)
+# define ACTUATION_STAMP(stage_, setpoint_)
+# define ACTUATION_UPDATE()
+#endif
+
+// From the RX interrupt: cycle count of the first byte
+void vActuationStart(uint32_t first_, uint32_t setpoint_);
+// From anywhere but a kernel critical section
+void vActuationStamp(int stage_, uint32_t setpoint_);
+// From the TIM2 interrupt, at each update event: a few cycles until a
+// command is in the preload registers
+void vActuationUpdate();
+
+// From a task
+void vActuationGet(actuation_result_t* result_);
+// Last command through all the stages, us per stage. Returns 0 when
+// none yet.
+int xActuationLast(uint32_t* setpoint_, uint16_t* us_);
+void vActuationReset();
+
+#endif
@@ -3,13 +3,13 @@
 
 #include "stm32f10x.h"
 
+// libglobal/fault.c, included by the drivers library too
+void vFaultAssert(const char* file_, int line_);
+
 # define assert_param(expr)                      \
   {                                              \
     if ((expr) == 0)                             \
-    {                                            \
-      __disable_irq();                           \
-      for(;;);                                   \
-    }                                            \
+      vFaultAssert(__FILE__, __LINE__);          \
   }
 
 #endif
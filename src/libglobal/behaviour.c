@@ -0,0 +1,283 @@
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/behaviour.h"
+#include "libglobal/odometry.h"
+#include "libglobal/polar.h"
+#include "libglobal/wall.h"
+
+#include "libperiph/bumpers.h"
+#include "libperiph/motors.h"
+#include "libperiph/periodic.h"
+#include "libperiph/sharps.h"
+
+// Sectors of the polar histogram ahead on each side, 45 degrees out
+#define BEHAVIOUR_LEFT_SECTOR  (POLAR_SECTORS / 8)
+#define BEHAVIOUR_RIGHT_SECTOR (POLAR_SECTORS - POLAR_SECTORS / 8)
+
+#define T(predicate, arg, next) { BEHAVIOUR_##predicate, next, arg }
+
+enum {
+  STATE_IDLE,
+  STATE_SPIRAL,
+  STATE_WALL,
+  STATE_BOUNCE,
+  STATE_BACK,
+  STATE_TURN,
+};
+
+static const behaviour_state_t defaults[] =
+  {
+    { STATE_IDLE, BEHAVIOUR_STOP, { 0, 0, 0 }, { T(NONE, 0, 0) } },
+    { STATE_SPIRAL, BEHAVIOUR_SPIRAL, { 200, 2000, 8000 },
+      { T(BUMPER, 0, STATE_BACK), T(FRONT_MM, 200, STATE_BACK),
+        T(TIME_MS, 40000, STATE_WALL) } },
+    { STATE_WALL, BEHAVIOUR_WALL, { SHARP_RIGHT, 120, 300 },
+      { T(BUMPER, 0, STATE_BACK), T(TIME_MS, 30000, STATE_BOUNCE) } },
+    { STATE_BOUNCE, BEHAVIOUR_DRIVE, { 250, 0, 0 },
+      { T(BUMPER, 0, STATE_BACK), T(FRONT_MM, 200, STATE_TURN),
+        T(TIME_MS, 20000, STATE_SPIRAL) } },
+    { STATE_BACK, BEHAVIOUR_DRIVE, { -150, 0, 0 },
+      { T(TRAVELED, 80, STATE_TURN), T(TIME_MS, 2000, STATE_TURN) } },
+    { STATE_TURN, BEHAVIOUR_TURN_AWAY, { 1500, 0, 0 },
+      { T(TURNED, 1300, STATE_BOUNCE), T(TIME_MS, 3000, STATE_BOUNCE) } },
+  };
+
+static behaviour_state_t table[BEHAVIOUR_STATES_NB];
+static periodic_t loop;
+
+static volatile int current = -1;
+static volatile int forced = -1;    // Entered at the next period
+static portTickType entryTick;
+static pose_t entryPose;
+static uint32_t entryHeading;
+static int turnSign;
+static int bumped;                  // The motors cut off by a bumper
+static volatile uint32_t transitions;
+
+static void vBehaviourStep();
+
+void vBehaviourInit()
+{
+  vPeriodicInit(&loop, "behave", &vBehaviourStep);
+  vBehaviourReset();
+}
+
+void vBehaviourReset()
+{
+  vBehaviourStop();
+  memset(table, 0, sizeof (table));
+  for (int i = 0; i < sizeof (defaults) / sizeof (defaults[0]); i++)
+    table[i] = defaults[i];
+  for (int i = 0; i < BEHAVIOUR_STATES_NB; i++)
+    table[i].state = i;
+}
+
+int xBehaviourStart(int state_)
+{
+  if (state_ < 0 || state_ >= BEHAVIOUR_STATES_NB)
+    return 0;
+
+  forced = state_;
+  if (current < 0)
+  {
+    transitions = 0;
+    vPeriodicSetPeriod(&loop, BEHAVIOUR_PERIOD_MS);
+  }
+  return 1;
+}
+
+void vBehaviourStop()
+{
+  vPeriodicSetPeriod(&loop, 0);
+  if (current >= 0 && table[current].action == BEHAVIOUR_WALL)
+    vWallStop();
+  current = forced = -1;
+  vMotorsStopNow();
+}
+
+int iBehaviourGetState()
+{
+  return current;
+}
+
+uint32_t uBehaviourGetStateMs()
+{
+  return current < 0 ? 0 : (xTaskGetTickCount() - entryTick) * portTICK_RATE_MS;
+}
+
+uint32_t uBehaviourGetTransitions()
+{
+  return transitions;
+}
+
+int xBehaviourSetState(const behaviour_state_t* state_)
+{
+  if (state_->state >= BEHAVIOUR_STATES_NB ||
+      state_->action >= BEHAVIOUR_ACTIONS_NB)
+    return 0;
+  for (int i = 0; i < PROTO_BEHAVIOUR_TRANSITIONS; i++)
+    if (state_->transitions[i].predicate >= BEHAVIOUR_PREDICATES_NB ||
+        state_->transitions[i].next >= BEHAVIOUR_STATES_NB)
+      return 0;
+
+  // Copied between two periods of the job
+  vTaskSuspendAll();
+  table[state_->state] = *state_;
+  xTaskResumeAll();
+  return 1;
+}
+
+void vBehaviourGetState(int index_, behaviour_state_t* state_)
+{
+  *state_ = table[index_];
+}
+
+static int prvBehaviourIsBumped(uint16_t mask_)
+{
+  for (int i = 0; i < BUMPERS_NB; i++)
+    if ((!mask_ || (mask_ & (1 << i))) && iBumpersIsPressed(i))
+      return 1;
+  return 0;
+}
+
+static int prvBehaviourCheck(const proto_transition_t* transition_)
+{
+  const int arg = transition_->arg;
+
+  switch (transition_->predicate)
+  {
+    case BEHAVIOUR_TIME_MS:
+      return (xTaskGetTickCount() - entryTick) * portTICK_RATE_MS >= arg;
+    case BEHAVIOUR_FRONT_MM:
+    {
+      const int front = iPolarSectorMm(0);
+      return front >= 0 && front < arg;
+    }
+    case BEHAVIOUR_CLEAR_MM:
+    {
+      const int front = iPolarSectorMm(0);
+      return front < 0 || front >= arg;
+    }
+    case BEHAVIOUR_SIDE_MM:
+      for (int i = 0; i < SHARPS_NB; i++)
+      {
+        const int mm = iSharpsMeasureDistMm(i);
+        if (mm != SHARPS_BAD_VALUE && mm < arg)
+          return 1;
+      }
+      return 0;
+    case BEHAVIOUR_BUMPER:
+      return prvBehaviourIsBumped(arg);
+    case BEHAVIOUR_TURNED:
+    {
+      // Binary angle, 2^32 for 2 pi
+      const int32_t turned = uOdometryGetHeading() - entryHeading;
+      const int mrad = ((int64_t)turned * 6283) >> 32;
+      return mrad >= arg || mrad <= -arg;
+    }
+    case BEHAVIOUR_TRAVELED:
+    {
+      pose_t pose;
+      vOdometryGetPose(&pose);
+      const int64_t dx = pose.x_mm - entryPose.x_mm;
+      const int64_t dy = pose.y_mm - entryPose.y_mm;
+      return dx * dx + dy * dy >= (int64_t)arg * arg;
+    }
+  }
+  return 0;
+}
+
+static void prvBehaviourEnter(int state_)
+{
+  const behaviour_state_t* state = &table[state_];
+
+  if (current >= 0 && table[current].action == BEHAVIOUR_WALL &&
+      state->action != BEHAVIOUR_WALL)
+    vWallStop();
+
+  current = state_;
+  entryTick = xTaskGetTickCount();
+  vOdometryGetPose(&entryPose);
+  entryHeading = uOdometryGetHeading();
+
+  switch (state->action)
+  {
+    case BEHAVIOUR_WALL:
+      vWallFollow(state->args[0], state->args[1], state->args[2]);
+      break;
+    case BEHAVIOUR_TURN_AWAY:
+    {
+      // Counterclockwise when the right side is the nearer one
+      const int left = iPolarSectorMm(BEHAVIOUR_LEFT_SECTOR);
+      const int right = iPolarSectorMm(BEHAVIOUR_RIGHT_SECTOR);
+      turnSign = iBumpersIsPressed(BUMPER_RIGHT) ||
+        (right >= 0 && (left < 0 || right < left)) ? 1 : -1;
+      break;
+    }
+  }
+}
+
+// Periodic job, from the timer service task
+static void vBehaviourStep()
+{
+  const behaviour_state_t* state;
+
+  if (forced >= 0)
+  {
+    const int next = forced;
+    forced = -1;
+    prvBehaviourEnter(next);
+  }
+  if (current < 0)
+    return;
+
+  state = &table[current];
+  for (int i = 0; i < PROTO_BEHAVIOUR_TRANSITIONS; i++)
+  {
+    const proto_transition_t* transition = &state->transitions[i];
+
+    if (transition->predicate == BEHAVIOUR_NONE)
+      break;
+    if (prvBehaviourCheck(transition))
+    {
+      if (transition->predicate == BEHAVIOUR_BUMPER)
+        bumped = 1;
+      transitions++;
+      prvBehaviourEnter(transition->next);
+      state = &table[current];
+      break;
+    }
+  }
+
+  // The cut off of a bumper is lifted once it is released, not the one
+  // of an overcurrent
+  if (bumped && iMotorsIsCutOff() && !prvBehaviourIsBumped(0))
+  {
+    vMotorsEnable();
+    bumped = 0;
+  }
+
+  switch (state->action)
+  {
+    case BEHAVIOUR_STOP:
+      vSetMotorsCommand(0, 0);
+      break;
+    case BEHAVIOUR_DRIVE:
+      vSetMotorsVelocity(state->args[0], state->args[1]);
+      break;
+    case BEHAVIOUR_SPIRAL:
+    {
+      // The rate halves after args[2] ms: an opening spiral
+      const int32_t ms = (xTaskGetTickCount() - entryTick) * portTICK_RATE_MS;
+      const int32_t half = state->args[2] > 0 ? state->args[2] : 1;
+      vSetMotorsVelocity(state->args[0], state->args[1] * half / (half + ms));
+      break;
+    }
+    case BEHAVIOUR_TURN_AWAY:
+      vSetMotorsVelocity(0, turnSign * state->args[0]);
+      break;
+  }
+}
@@ -0,0 +1,63 @@
+#ifndef BEHAVIOUR_H
+# define BEHAVIOUR_H
+
+#include <stdint.h>
+
+#include "libglobal/protocol.h"
+
+// Coverage behaviours on board, without the host: a table of states,
+// each one an action on the motors and the transitions to the others on
+// sensor predicates and timers, run by a periodic job. The default
+// table chains a spiral, the wall following, bouncing across the room
+// and the escape from an obstacle; the host starts it at any state,
+// forces another one meanwhile, and rewrites the states to tune or
+// replace them (PROTO_BEHAVIOUR_SET).
+#define BEHAVIOUR_PERIOD_MS 5
+#define BEHAVIOUR_STATES_NB 16
+
+enum eBehaviourAction {
+  BEHAVIOUR_STOP      = 0,
+  BEHAVIOUR_DRIVE     = 1, // mm/s, mrad/s (vSetMotorsVelocity)
+  BEHAVIOUR_SPIRAL    = 2, // mm/s, mrad/s at the entry, ms to halve it
+  BEHAVIOUR_WALL      = 3, // sharp, mm, command (vWallFollow)
+  BEHAVIOUR_TURN_AWAY = 4, // mrad/s, away from the nearer obstacle side
+  BEHAVIOUR_ACTIONS_NB
+};
+
+// Checked against the entry in the state, the time or the pose then
+enum eBehaviourPredicate {
+  BEHAVIOUR_NONE      = 0, // Never, the end of the transitions
+  BEHAVIOUR_TIME_MS   = 1, // In the state for arg ms
+  BEHAVIOUR_FRONT_MM  = 2, // Obstacle ahead under arg mm (polar sector 0)
+  BEHAVIOUR_CLEAR_MM  = 3, // Nothing ahead under arg mm
+  BEHAVIOUR_SIDE_MM   = 4, // Either sharp under arg mm
+  BEHAVIOUR_BUMPER    = 5, // A bumper of the mask arg pressed, any if 0
+  BEHAVIOUR_TURNED    = 6, // Turned by arg mrad, either way
+  BEHAVIOUR_TRAVELED  = 7, // Moved by arg mm, straight line
+  BEHAVIOUR_PREDICATES_NB
+};
+
+typedef proto_behaviour_t behaviour_state_t;
+
+void vBehaviourInit();
+
+// Enter a state, from a stop or while running. 0 on a bad state.
+int xBehaviourStart(int state_);
+// Stops the motors too
+void vBehaviourStop();
+
+// The current state, -1 when stopped, its time so far and the count of
+// transitions since the start
+int iBehaviourGetState();
+uint32_t uBehaviourGetStateMs();
+uint32_t uBehaviourGetTransitions();
+
+// A state of the table, index in state_->state. 0 on a bad index, action,
+// predicate or next state. Rewriting the current state takes effect at
+// the next period, at the next entry for a WALL action.
+int xBehaviourSetState(const behaviour_state_t* state_);
+void vBehaviourGetState(int index_, behaviour_state_t* state_);
+// Back to the default table, stopped
+void vBehaviourReset();
+
+#endif
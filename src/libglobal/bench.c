@@ -0,0 +1,454 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "libglobal/bench.h"
+#include "libglobal/cmdline.h"
+#include "libglobal/fixed.h"
+#include "libglobal/format.h"
+#include "libglobal/strutils.h"
+#include "libglobal/trig.h"
+
+#ifdef BENCH_HOST
+# include <time.h>
+#else
+# include "libperiph/cycles.h"
+#endif
+
+// Inputs cycle through these corpora, indexed by the sample and batch
+#define BENCH_CORPUS_NB 16
+
+static const int32_t integers[BENCH_CORPUS_NB] =
+{
+  0, 7, -42, 100, 9999, -32768, 65535, 123456,
+  -1000000, 2147483647, -2147483647 - 1, 31, -5, 420000, 86400, 1
+};
+
+static const float floats[BENCH_CORPUS_NB] =
+{
+  0.0f, 1.5f, -0.25f, 3.14159f, 100.001f, -42.42f, 0.000001f, 65535.5f,
+  1.05f, -7.0f, 2.718281f, 0.1f, 12345.678f, -0.5f, 99.99f, 1000000.0f
+};
+
+static const char* const numbers[BENCH_CORPUS_NB] =
+{
+  "0", "7", "-42", "100", "9999", "-32768", "65535", "123456",
+  "-1000000", "2147483647", "-2147483648", "0x1F", "-5", "420000",
+  "86400", "1"
+};
+
+static const char* const padded[BENCH_CORPUS_NB] =
+{
+  "a", "  mb 10:20  ", "ml500", "   ", "", " t 100", "mq500:300:300 ",
+  "  s", "p  ", "  os 10 20 30  ", "bt", "        mx", "mv", "#12 ml500",
+  "i   ", " o "
+};
+
+// Command lines as left by the line editor, forwarded to no-op handlers
+static const char* const lines[BENCH_CORPUS_NB] =
+{
+  "a", "mb10:20", "ml500", "mq500:300:300", "t100", "s", "os10 20 30",
+  "mx", "p", "i", "ir1", "mr-200", "zz", "mb10", "rt100:200", "md0x1F4"
+};
+
+static void prvBenchHandler(int argc_, const int32_t* argv_)
+{
+}
+
+static const command_t commands[] =
+  {
+    { "a",  0, 0, 0, &prvBenchHandler },
+    { "i",  0, 0, 0, &prvBenchHandler },
+    { "ir", 1, 1, 0, &prvBenchHandler },
+    { "mb", 2, 2, 0, &prvBenchHandler },
+    { "md", 1, 1, 0, &prvBenchHandler },
+    { "ml", 1, 1, 0, &prvBenchHandler },
+    { "mq", 3, 3, 0, &prvBenchHandler },
+    { "mr", 1, 1, 0, &prvBenchHandler },
+    { "mx", 0, 0, 0, &prvBenchHandler },
+    { "os", 3, 3, 0, &prvBenchHandler },
+    { "p",  0, 0, 0, &prvBenchHandler },
+    { "rt", 2, 2, 0, &prvBenchHandler },
+    { "s",  0, 0, 0, &prvBenchHandler },
+    { "t",  0, 1, 0, &prvBenchHandler },
+  };
+
+// Results are kept in a volatile sink so the calls are not optimized out
+static volatile int sink;
+
+static uint32_t prvBenchClock()
+{
+#ifdef BENCH_HOST
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint32_t)(now.tv_sec * 1000000000ull + now.tv_nsec);
+#else
+  return uCyclesNow();
+#endif
+}
+
+static void prvBenchItoa(int i_)
+{
+  char buffer[12];
+
+  sink = itoa_len(integers[i_], buffer);
+}
+
+static void prvBenchFltoa(int i_)
+{
+  char buffer[24];
+
+  sink = fltoa(floats[i_], buffer)[0];
+}
+
+static void prvBenchAtoi(int i_)
+{
+  sink = atoi_eol(numbers[i_], 0);
+}
+
+static void prvBenchTrim(int i_)
+{
+  char buffer[20];
+
+  // The copy is part of the timing, trim works in place
+  strcpy(buffer, padded[i_]);
+  sink = trim_in_place(buffer)[0];
+}
+
+static void prvBenchFormatPutc(void* ctx_, char c_)
+{
+  sink = c_;
+}
+
+static int prvBenchFormatArgs(int i_, ...)
+{
+  va_list args;
+  int size;
+
+  va_start(args, i_);
+  size = iFormat(prvBenchFormatPutc, NULL, "%d\t%x\t%.2q", args);
+  va_end(args);
+  return size;
+}
+
+static void prvBenchPrintf(int i_)
+{
+  sink = prvBenchFormatArgs(i_, integers[i_], integers[i_], integers[i_], 8);
+}
+
+static void prvBenchCmdline(int i_)
+{
+  cmdline_t cmd;
+
+  sink = iCmdlineParse(commands, sizeof (commands) / sizeof (commands[0]),
+                       lines[i_], &cmd);
+}
+
+static void prvBenchDiv(int i_)
+{
+  sink = iQ16Div(integers[i_], integers[(i_ + 1) % BENCH_CORPUS_NB]);
+}
+
+static void prvBenchSqrt(int i_)
+{
+  sink = iQ16Sqrt(integers[i_]);
+}
+
+static void prvBenchSin(int i_)
+{
+  sink = iTrigSin((uint32_t)integers[i_] * 2654435761u);
+}
+
+static void prvBenchAtan2(int i_)
+{
+  sink = uTrigAtan2(integers[i_], integers[(i_ + 5) % BENCH_CORPUS_NB]);
+}
+
+// Checks of the results over the corpora, 1 when right
+
+static int prvCheckItoa()
+{
+  char buffer[12];
+
+  for (int i = 0; i < BENCH_CORPUS_NB; i++)
+    if (itoa_len(integers[i], buffer) != (int)strlen(buffer) ||
+        atoi_eol(buffer, 0) != integers[i])
+      return 0;
+  return 1;
+}
+
+static int prvCheckFltoa()
+{
+  char buffer[24];
+
+  // 6 decimals, then the float precision
+  for (int i = 0; i < BENCH_CORPUS_NB; i++)
+  {
+    const float error = atofl(fltoa(floats[i], buffer)) - floats[i];
+    const float bound = 1e-6f + (floats[i] < 0 ? -floats[i] : floats[i]) *
+      1e-6f;
+
+    if (error > bound || error < -bound)
+      return 0;
+  }
+  return 1;
+}
+
+static int prvCheckAtoi()
+{
+  // The corpus of the numbers is the one of the integers, written out
+  for (int i = 0; i < BENCH_CORPUS_NB; i++)
+    if (atoi_eol(numbers[i], 0) != integers[i])
+      return 0;
+  return 1;
+}
+
+static int prvCheckTrim()
+{
+  char buffer[20];
+
+  for (int i = 0; i < BENCH_CORPUS_NB; i++)
+  {
+    const char* from = padded[i];
+    int n = strlen(from);
+
+    while (*from == ' ')
+      from++, n--;
+    while (n > 0 && from[n - 1] == ' ')
+      n--;
+    strcpy(buffer, padded[i]);
+    const char* trimmed = trim_in_place(buffer);
+    if ((int)strlen(trimmed) != n || strncmp(trimmed, from, n))
+      return 0;
+  }
+  return 1;
+}
+
+typedef struct
+{
+  char* p;
+  char* end;
+} bench_buffer_t;
+
+static void prvCheckFormatPutc(void* ctx_, char c_)
+{
+  bench_buffer_t* buffer = ctx_;
+
+  if (buffer->p < buffer->end)
+    *buffer->p++ = c_;
+}
+
+static int prvCheckFormatArgs(char* out_, int size_, const char* fmt_, ...)
+{
+  bench_buffer_t buffer = { out_, out_ + size_ - 1 };
+  va_list args;
+  int n;
+
+  va_start(args, fmt_);
+  n = iFormat(prvCheckFormatPutc, &buffer, fmt_, args);
+  va_end(args);
+  *buffer.p = '\0';
+  return n;
+}
+
+static int prvCheckFormat()
+{
+  char formatted[40];
+  char expected[40];
+
+  for (int i = 0; i < BENCH_CORPUS_NB; i++)
+  {
+    const int n = prvCheckFormatArgs(formatted, sizeof (formatted), "%d|%s",
+                                     integers[i], "ok");
+
+    itoa(integers[i], expected);
+    strcat(expected, "|ok");
+    if (n != (int)strlen(expected) || strcmp(formatted, expected))
+      return 0;
+  }
+  prvCheckFormatArgs(formatted, sizeof (formatted), "%04x %.2q %-3d|",
+                     0x1f, 384, 8, 7);
+  return !strcmp(formatted, "001f 1.50 7  |");
+}
+
+static int prvCheckCmdline()
+{
+  // By the lines: the two that fail, and the arguments of the others
+  static const int8_t argcs[BENCH_CORPUS_NB] =
+    { 0, 2, 1, 3, 1, 0, 3, 0, 0, 0, 1, 1, -1, -1, 2, 1 };
+  cmdline_t cmd;
+
+  for (int i = 0; i < BENCH_CORPUS_NB; i++)
+  {
+    const int status = iCmdlineParse(commands,
+                                     sizeof (commands) / sizeof (commands[0]),
+                                     lines[i], &cmd);
+
+    if (argcs[i] < 0 ? status == CMDLINE_OK :
+        status != CMDLINE_OK || cmd.argc != argcs[i])
+      return 0;
+  }
+  return iCmdlineParse(commands, sizeof (commands) / sizeof (commands[0]),
+                       "md0x1F4", &cmd) == CMDLINE_OK && cmd.argv[0] == 500;
+}
+
+static int prvCheckDiv()
+{
+  for (int i = 0; i < BENCH_CORPUS_NB; i++)
+  {
+    const int32_t a = integers[i];
+    const int32_t b = integers[(i + 1) % BENCH_CORPUS_NB];
+    int64_t expected;
+
+    if (!b)
+      continue;
+    expected = ((int64_t)a << 16) / b;
+    if (expected > INT32_MAX)
+      expected = INT32_MAX;
+    else if (expected < INT32_MIN)
+      expected = INT32_MIN;
+    // From the reciprocal: within its relative precision
+    if (llabs(iQ16Div(a, b) - expected) > (llabs(expected) >> 14) + 1)
+      return 0;
+  }
+  return 1;
+}
+
+static int prvCheckSqrt()
+{
+  for (int i = 0; i < BENCH_CORPUS_NB; i++)
+  {
+    const int32_t x = integers[i];
+    const int64_t r = iQ16Sqrt(x);
+
+    const int64_t above = r + (r >> 15) + 1;
+
+    // Below the root of x << 16, within 16 significant bits
+    if (x < 0 ? r != 0 :
+        r * r > (int64_t)x << 16 || above * above <= (int64_t)x << 16)
+      return 0;
+  }
+  return 1;
+}
+
+static int prvCheckSin()
+{
+  for (int d = -360; d <= 360; d += 30)
+  {
+    const int32_t s = iTrigSin(TRIG_DEGREES(d));
+    const int32_t c = iTrigCos(TRIG_DEGREES(d));
+    const int32_t norm = (s * s + c * c) >> 15;
+
+    if (norm < 32768 - 8 || norm > 32768 + 8)
+      return 0;
+  }
+  return iTrigSin(0) == 0 && iTrigSin(TRIG_QUARTER_TURN) >= 32767 &&
+    abs(iTrigSin(TRIG_DEGREES(30)) - 16384) <= 2;
+}
+
+static int prvCheckAtan2()
+{
+  // Angles of the eight directions, within a few steps of the CORDIC
+  for (int d = -180; d < 180; d += 45)
+  {
+    const int32_t x = iTrigCos(TRIG_DEGREES(d)) << 8;
+    const int32_t y = iTrigSin(TRIG_DEGREES(d)) << 8;
+    const int32_t error = (int32_t)(uTrigAtan2(y, x) - TRIG_DEGREES(d));
+
+    if (abs(error) > TRIG_DEGREES(1) / 64)
+      return 0;
+  }
+  return uTrigAtan2(0, 0) == 0;
+}
+
+// Budgets: mean cycles per call on the target, with room over what the
+// F103 at 72 MHz runs from the flash. fltoa goes through the software
+// float.
+static const struct
+{
+  const char* name;
+  void (*run)(int i_);
+  int (*check)();
+  uint32_t budget;
+} benchmarks[BENCH_NB] =
+  {
+    { "itoa",    &prvBenchItoa,    &prvCheckItoa,    400 },
+    { "fltoa",   &prvBenchFltoa,   &prvCheckFltoa,   2000 },
+    { "atoi",    &prvBenchAtoi,    &prvCheckAtoi,    300 },
+    { "trim",    &prvBenchTrim,    &prvCheckTrim,    300 },
+    { "format",  &prvBenchPrintf,  &prvCheckFormat,  2500 },
+    { "cmdline", &prvBenchCmdline, &prvCheckCmdline, 1500 },
+    { "q16div",  &prvBenchDiv,     &prvCheckDiv,     150 },
+    { "q16sqrt", &prvBenchSqrt,    &prvCheckSqrt,    250 },
+    { "sin",     &prvBenchSin,     &prvCheckSin,     80 },
+    { "atan2",   &prvBenchAtan2,   &prvCheckAtan2,   500 },
+  };
+
+int iBenchRun(bench_result_t* results_, int samples_)
+{
+  uint32_t start, elapsed, overhead;
+
+#ifndef BENCH_HOST
+  vCyclesInit();
+#endif
+
+  // Cost of reading the clock, taken off each sample
+  overhead = ~0u;
+  for (int s = 0; s < samples_; s++)
+  {
+    start = prvBenchClock();
+    elapsed = prvBenchClock() - start;
+    if (elapsed < overhead)
+      overhead = elapsed;
+  }
+
+  for (int b = 0; b < BENCH_NB; b++)
+  {
+    bench_result_t* result = &results_[b];
+    uint64_t total = 0;
+
+    result->name = benchmarks[b].name;
+    result->min = ~0u;
+    result->max = 0;
+    for (int s = 0; s < samples_; s++)
+    {
+      start = prvBenchClock();
+      for (int i = 0; i < BENCH_BATCH; i++)
+        benchmarks[b].run((s + i) % BENCH_CORPUS_NB);
+      elapsed = prvBenchClock() - start;
+      elapsed = (elapsed > overhead ? elapsed - overhead : 0) / BENCH_BATCH;
+
+      total += elapsed;
+      if (elapsed < result->min)
+        result->min = elapsed;
+      if (elapsed > result->max)
+        result->max = elapsed;
+    }
+    result->mean = samples_ ? total / samples_ : 0;
+
+    // Checked apart from the timing, the checks cost more than the calls
+#ifdef BENCH_HOST
+    result->budget = 0;
+#else
+    result->budget = benchmarks[b].budget;
+#endif
+    if (!benchmarks[b].check())
+      result->status = BENCH_WRONG;
+    else if (result->budget && result->mean > result->budget)
+      result->status = BENCH_SLOW;
+    else
+      result->status = BENCH_PASS;
+  }
+
+  return BENCH_NB;
+}
+
+int iBenchFailures(const bench_result_t* results_, int n_)
+{
+  int failures = 0;
+
+  for (int i = 0; i < n_; i++)
+    if (results_[i].status != BENCH_PASS)
+      failures++;
+  return failures;
+}
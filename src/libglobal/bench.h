@@ -0,0 +1,44 @@
+#ifndef BENCH_H
+# define BENCH_H
+
+#include <stdint.h>
+
+// Micro-benchmarks of the formatting and parsing paths, and of the
+// fixed-point division, square root and trigonometry. The same code runs
+// on target, timed in core cycles by the DWT counter, and on the host
+// ("waf bench", BENCH_HOST defined), timed in nanoseconds.
+// Each sample times BENCH_BATCH calls, results are per call.
+//
+// Each benchmark also checks its results over its corpus, and on target
+// holds its mean against a budget of cycles: a run flags the functional
+// regressions and the ones of the speed of the hot paths together.
+#define BENCH_BATCH 16
+
+enum eBenchStatus {
+  BENCH_PASS  = 0,
+  BENCH_WRONG = 1, // Results off
+  BENCH_SLOW  = 2, // Right, mean over the budget
+};
+
+typedef struct
+{
+  const char* name;
+  uint32_t min;
+  uint32_t max;
+  uint32_t mean;
+  uint32_t budget;       // Cycles, 0 on the host
+  uint8_t status;
+} bench_result_t;
+
+// itoa, fltoa, atoi, trim, format, cmdline, q16div, q16sqrt, sin and
+// atan2, in this order
+#define BENCH_NB 10
+
+// Run the BENCH_NB benchmarks over samples_ samples each, returns the
+// number of results. Does not yield: from a task, starves lower
+// priorities meanwhile.
+int iBenchRun(bench_result_t* results_, int samples_);
+// Results not BENCH_PASS
+int iBenchFailures(const bench_result_t* results_, int n_);
+
+#endif
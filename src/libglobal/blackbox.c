@@ -0,0 +1,384 @@
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#ifdef CO_ROUTINES
+# include "croutine.h"
+#endif
+
+#include "stm32f10x.h"
+
+#include "libglobal/blackbox.h"
+#include "libglobal/fault.h"
+#include "libglobal/sysmon.h"
+
+#include "libperiph/flash.h"
+#include "libperiph/hardware.h"
+#include "libperiph/motors.h"
+
+// Tells a valid ring or page header from the power up content
+#define BLACKBOX_RING_MAGIC 0xB1AC0B0A
+#define BLACKBOX_PAGE_MAGIC 0xB1AC0B0B
+#define BLACKBOX_ERASED     0xFFFFFFFF
+
+#define BLACKBOX_RAM_MASK (BLACKBOX_RAM_NB - 1)
+
+// BLACKBOX region, from the linker script
+extern const uint8_t _sblackbox[];
+extern const uint8_t _eblackbox[];
+
+#define BLACKBOX_PAGES ((_eblackbox - _sblackbox) / FLASH_PAGE_SIZE)
+
+typedef struct
+{
+  uint32_t sequence;
+  uint32_t magic;    // Programmed last: the sequence is complete
+} blackbox_page_t;
+
+#define BLACKBOX_PAGE_RECORDS \
+  ((FLASH_PAGE_SIZE - sizeof (blackbox_page_t)) / sizeof (blackbox_record_t))
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t head;     // Claimed by the loggers, free running
+  uint32_t tail;     // Copied to the flash by the daemon
+  uint16_t dropped;  // Not reported yet by a BLACKBOX_DROPPED record
+  blackbox_record_t records[BLACKBOX_RAM_NB];
+} blackbox_ring_t;
+
+static blackbox_ring_t ring __attribute__((section(".noinit")));
+
+// Flash position, owned by the daemon and the dump under the mutex
+static int page;
+static int slot;
+static uint32_t sequence;
+static int spare;            // The page after the current one is erased
+static xSemaphoreHandle xBlackboxMutex;
+
+static uint32_t logged;
+static uint32_t flushed;
+static uint16_t dropped;
+
+#ifndef CO_ROUTINES
+static void vBlackboxTask(void* pvParameters_);
+#else
+static void vBlackboxCoRoutine(xCoRoutineHandle xHandle_,
+                               unsigned portBASE_TYPE index_);
+#endif
+static void prvBlackboxScan();
+
+static const blackbox_page_t* prvBlackboxPage(int page_)
+{
+  return (const blackbox_page_t*)(_sblackbox + page_ * FLASH_PAGE_SIZE);
+}
+
+static const blackbox_record_t* prvBlackboxRecord(int page_, int slot_)
+{
+  return (const blackbox_record_t*)(prvBlackboxPage(page_) + 1) + slot_;
+}
+
+void vBlackboxInit(unsigned portBASE_TYPE blackboxDaemonPriority_)
+{
+  fault_record_t fault;
+
+  // Keep the records a reset left in the ring
+  if (ring.magic != BLACKBOX_RING_MAGIC ||
+      ring.head - ring.tail > BLACKBOX_RAM_NB)
+  {
+    ring.head = 0;
+    ring.tail = 0;
+    ring.dropped = 0;
+    ring.magic = BLACKBOX_RING_MAGIC;
+  }
+
+  // Before the scheduler: an erase stalls nobody yet
+  prvBlackboxScan();
+
+  xBlackboxMutex = xSemaphoreCreateMutex();
+  if (!xBlackboxMutex)
+    vFaultAllocation("blackbox");
+#ifndef CO_ROUTINES
+  if (xTaskCreate(vBlackboxTask, (const signed char * const)"blackboxd",
+                  BLACKBOX_STACK_SIZE, NULL, blackboxDaemonPriority_,
+                  NULL) != pdPASS)
+#else
+  if (xCoRoutineCreate(vBlackboxCoRoutine, CO_PRIORITY_BLACKBOX,
+                       0) != pdPASS)
+#endif
+    vFaultAllocation("blackboxd");
+
+  // Reset flags in the top byte, cleared for the next boot
+  vBlackboxLog(BLACKBOX_BOOT, RCC->CSR >> 24,
+               iFaultGet(&fault) ? fault.cause : FAULT_NONE);
+  RCC->CSR |= RCC_CSR_RMVF;
+}
+
+void vBlackboxGetStats(blackbox_stats_t* stats_)
+{
+  portBASE_TYPE mask = portSET_INTERRUPT_MASK_FROM_ISR();
+  stats_->logged = logged;
+  stats_->flushed = flushed;
+  stats_->pending = ring.head - ring.tail;
+  stats_->dropped = dropped;
+  stats_->sequence = sequence;
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+void vBlackboxLog(uint8_t event_, uint8_t arg_, int16_t value_)
+{
+  // Masks and unmasks: not under our mask
+  const portTickType tick = xTaskGetTickCountFromISR();
+
+  portBASE_TYPE mask = portSET_INTERRUPT_MASK_FROM_ISR();
+  if (ring.head - ring.tail < BLACKBOX_RAM_NB)
+  {
+    blackbox_record_t* record = &ring.records[ring.head & BLACKBOX_RAM_MASK];
+    record->tick = tick;
+    record->event = event_;
+    record->arg = arg_;
+    record->value = value_;
+    ring.head++;
+    logged++;
+  }
+  else
+  {
+    // The oldest records stay: they lead to the failure
+    if (ring.dropped != UINT16_MAX)
+      ring.dropped++;
+    if (dropped != UINT16_MAX)
+      dropped++;
+  }
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+static int prvBlackboxIsErased(const void* flash_, int size_)
+{
+  const uint32_t* word = flash_;
+
+  for (int i = 0; i < size_ / 4; i++)
+    if (word[i] != BLACKBOX_ERASED)
+      return 0;
+  return 1;
+}
+
+// Records in a page, up to the first erased slot: a record cut by a
+// reset is kept
+static int prvBlackboxPageUsed(int page_)
+{
+  int used;
+
+  if (prvBlackboxPage(page_)->magic != BLACKBOX_PAGE_MAGIC)
+    return 0;
+  for (used = 0; used < BLACKBOX_PAGE_RECORDS; used++)
+    if (prvBlackboxIsErased(prvBlackboxRecord(page_, used),
+                            sizeof (blackbox_record_t)))
+      break;
+  return used;
+}
+
+static void prvBlackboxErase(int page_)
+{
+  vFlashErasePage((uint32_t)prvBlackboxPage(page_));
+}
+
+// Start the next page, erased beforehand
+static void prvBlackboxOpen(int page_)
+{
+  const blackbox_page_t header =
+    {
+      .sequence = sequence + 1,
+      .magic    = BLACKBOX_PAGE_MAGIC,
+    };
+
+  vFlashProgram((uint32_t)prvBlackboxPage(page_), (const uint32_t*)&header,
+                sizeof (header) / 4);
+
+  page = page_;
+  slot = 0;
+  sequence++;
+  spare = 0;
+}
+
+// Resume after the newest page
+static void prvBlackboxScan()
+{
+  const int pages = BLACKBOX_PAGES;
+  int newest = -1;
+
+  for (int i = 0; i < pages; i++)
+  {
+    const blackbox_page_t* header = prvBlackboxPage(i);
+    if (header->magic == BLACKBOX_PAGE_MAGIC &&
+        (newest < 0 || header->sequence > prvBlackboxPage(newest)->sequence))
+      newest = i;
+  }
+
+  if (newest < 0)
+  {
+    // Blank region
+    sequence = 0;
+    prvBlackboxErase(0);
+    prvBlackboxOpen(0);
+  }
+  else
+  {
+    page = newest;
+    slot = prvBlackboxPageUsed(newest);
+    sequence = prvBlackboxPage(newest)->sequence;
+  }
+
+  spare = prvBlackboxIsErased(prvBlackboxPage((page + 1) % pages),
+                              FLASH_PAGE_SIZE);
+}
+
+// The erase stalls the core: not while the motors run
+static int prvBlackboxCanErase()
+{
+  motors_state_t state;
+
+  vMotorsGetState(&state);
+  return !state.enabled || state.cut_off ||
+    (state.command_left == 0 && state.command_right == 0 &&
+     state.speed_left == 0 && state.speed_right == 0);
+}
+
+static void prvBlackboxFlush()
+{
+  const int next = (page + 1) % BLACKBOX_PAGES;
+  uint32_t words[sizeof (blackbox_record_t) / 4];
+
+  // Prepare the next page halfway through the current one, or once full
+  if (!spare && slot >= BLACKBOX_PAGE_RECORDS / 2 && prvBlackboxCanErase())
+  {
+    prvBlackboxErase(next);
+    spare = 1;
+  }
+
+  while (ring.tail != ring.head)
+  {
+    if (slot == BLACKBOX_PAGE_RECORDS)
+    {
+      // The records wait in the ring for the erase
+      if (!spare)
+        return;
+      prvBlackboxOpen(next);
+    }
+
+    // Only the loggers move the head: the slot is stable
+    memcpy(words, &ring.records[ring.tail & BLACKBOX_RAM_MASK],
+           sizeof (words));
+    vFlashProgram((uint32_t)prvBlackboxRecord(page, slot), words,
+                  sizeof (words) / 4);
+    slot++;
+
+    portBASE_TYPE mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    ring.tail++;
+    flushed++;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+  }
+}
+
+// Reported once there is room again
+static void prvBlackboxReportDropped()
+{
+  portBASE_TYPE mask = portSET_INTERRUPT_MASK_FROM_ISR();
+  const uint16_t lost = ring.dropped;
+  ring.dropped = 0;
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+  if (lost)
+    vBlackboxLog(BLACKBOX_DROPPED, 0, lost > INT16_MAX ? INT16_MAX : lost);
+}
+
+#ifndef CO_ROUTINES
+static void vBlackboxTask(void* pvParameters_)
+{
+  portTickType xLastWakeTime = xTaskGetTickCount();
+
+  vSysmonRegisterTask("blackboxd");
+
+  for (;;)
+  {
+    vTaskDelayUntil(&xLastWakeTime, MS_TO_TICKS(BLACKBOX_FLUSH_MS));
+
+    xSemaphoreTake(xBlackboxMutex, portMAX_DELAY);
+    prvBlackboxFlush();
+    xSemaphoreGive(xBlackboxMutex);
+
+    prvBlackboxReportDropped();
+  }
+}
+#else
+// Same from the idle task, which never blocks: during a dump the flush
+// waits for the next period
+static void vBlackboxCoRoutine(xCoRoutineHandle xHandle_,
+                               unsigned portBASE_TYPE index_)
+{
+  crSTART(xHandle_);
+
+  for (;;)
+  {
+    crDELAY(xHandle_, MS_TO_TICKS(BLACKBOX_FLUSH_MS));
+
+    if (xSemaphoreTake(xBlackboxMutex, 0) == pdTRUE)
+    {
+      prvBlackboxFlush();
+      xSemaphoreGive(xBlackboxMutex);
+    }
+
+    prvBlackboxReportDropped();
+  }
+
+  crEND();
+}
+#endif
+
+int iBlackboxDump(int n_, pfunBlackboxRecord callback_, void* context_)
+{
+  const int pages = BLACKBOX_PAGES;
+  int total = 0;
+  int count = 0;
+  int skip;
+
+  xSemaphoreTake(xBlackboxMutex, portMAX_DELAY);
+
+  // Oldest page first, the current one last
+  const uint32_t head = ring.head;
+  for (int i = 1; i <= pages; i++)
+    total += prvBlackboxPageUsed((page + i) % pages);
+  total += head - ring.tail;
+  skip = (n_ > 0 && total > n_) ? total - n_ : 0;
+
+  for (int i = 1; i <= pages; i++)
+  {
+    const int p = (page + i) % pages;
+    const int used = prvBlackboxPageUsed(p);
+    for (int s = 0; s < used; s++)
+    {
+      if (skip)
+        skip--;
+      else
+      {
+        callback_(prvBlackboxRecord(p, s), context_);
+        count++;
+      }
+    }
+  }
+
+  // The flush waits on the mutex, the loggers stay after the head
+  for (uint32_t i = ring.tail; i != head; i++)
+  {
+    if (skip)
+      skip--;
+    else
+    {
+      callback_(&ring.records[i & BLACKBOX_RAM_MASK], context_);
+      count++;
+    }
+  }
+
+  xSemaphoreGive(xBlackboxMutex);
+
+  return count;
+}
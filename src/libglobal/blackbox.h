@@ -0,0 +1,72 @@
+#ifndef BLACKBOX_H
+# define BLACKBOX_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+// Black box: compact event records for the post-mortem, logged into a RAM
+// ring and copied by a low priority daemon to the BLACKBOX flash region
+// (see the linker script). The ring is kept across resets (.noinit): the
+// records logged just before a watchdog or fault reset reach the flash
+// after the reboot.
+//
+// The flash region is a rotation of pages, each one a header then
+// records: the oldest page is erased when the current one is full, so
+// all the pages wear evenly. An erase stalls the flash for about 20 ms,
+// interrupts included (the vector table is in flash): it only happens
+// with the motors stopped, the records wait in the ring until then.
+// Each program stalls it for about 50 us per halfword.
+
+// Records in the RAM ring. Must be a power of 2.
+#define BLACKBOX_RAM_NB 64
+
+#define BLACKBOX_FLUSH_MS 100
+
+// Daemon stack, in words
+#ifndef BLACKBOX_STACK_SIZE
+# define BLACKBOX_STACK_SIZE configMINIMAL_STACK_SIZE
+#endif
+
+enum eBlackboxEvent {
+  BLACKBOX_BOOT    = 0x01, // arg: RCC_CSR reset flags, value: eFaultCause
+  BLACKBOX_DROPPED = 0x02, // value: records lost, ring full
+  BLACKBOX_STANDBY = 0x03, // value: minutes to the alarm, -1 on the pin only
+  BLACKBOX_BUMPER  = 0x10, // arg: bumper, value: 1 when pressed
+  BLACKBOX_SLIP    = 0x11, // arg: encoder, value: 1 slipping, 0 gripping
+};
+
+typedef struct
+{
+  uint32_t tick;
+  uint8_t event;
+  uint8_t arg;
+  int16_t value;
+} __attribute__((packed)) blackbox_record_t;
+
+typedef struct
+{
+  uint32_t logged;    // Since the boot
+  uint32_t flushed;
+  uint16_t pending;   // In the ring
+  uint16_t dropped;   // Ring full
+  uint32_t sequence;  // Of the current flash page, pages written so far
+} blackbox_stats_t;
+
+void vBlackboxInit(unsigned portBASE_TYPE blackboxDaemonPriority_);
+void vBlackboxGetStats(blackbox_stats_t* stats_);
+
+// Never blocks, a few dozen cycles. From the tasks out of the critical
+// sections and the interrupts in the kernel range (IRQ_PRIORITY_KERNEL_MAX
+// and below) only.
+void vBlackboxLog(uint8_t event_, uint8_t arg_, int16_t value_);
+
+// Called for each record, oldest first
+typedef void (*pfunBlackboxRecord)(const blackbox_record_t* record_,
+                                   void* context_);
+
+// Walk the last n_ records (all of them when 0), flash then ring, from a
+// task: the flush waits meanwhile. Returns the count.
+int iBlackboxDump(int n_, pfunBlackboxRecord callback_, void* context_);
+
+#endif
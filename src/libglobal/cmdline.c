@@ -0,0 +1,78 @@
+#include <string.h>
+
+#include "libglobal/cmdline.h"
+#include "libglobal/strutils.h"
+
+const command_t* pxCmdlineLookup(const command_t* commands_, int n_,
+                                 const char* name_)
+{
+  int low = 0;
+  int high = n_ - 1;
+
+  while (low <= high)
+  {
+    const int mid = (low + high) / 2;
+    const int order = strcmp(name_, commands_[mid].name);
+
+    if (order == 0)
+      return &commands_[mid];
+    if (order < 0)
+      high = mid - 1;
+    else
+      low = mid + 1;
+  }
+  return NULL;
+}
+
+// Integers separated by spaces or ':', returns their number or -1 on
+// anything else
+static int prvCmdlineParseArgs(const char* str, int32_t* argv)
+{
+  int argc = 0;
+
+  for (;;)
+  {
+    while (is_space(*str) || *str == ':')
+      str++;
+    if (*str == 0)
+      return argc;
+    if (argc == CMDLINE_ARGS_MAX)
+      return -1;
+
+    if (strtoi(str, &str, &argv[argc++]) != STRTOI_OK)
+      return -1;
+
+    if (*str && !is_space(*str) && *str != ':')
+      return -1;
+  }
+}
+
+int iCmdlineParse(const command_t* commands_, int n_, const char* line_,
+                  cmdline_t* cmd_)
+{
+  int size;
+
+  cmd_->command = NULL;
+  cmd_->name[0] = 0;
+
+  // Name is the leading letters
+  for (size = 0; is_letter(line_[size]); size++);
+  if (size >= sizeof (cmd_->name))
+    return CMDLINE_UNDEFINED;
+  memcpy(cmd_->name, line_, size);
+  cmd_->name[size] = 0;
+
+  cmd_->command = pxCmdlineLookup(commands_, n_, cmd_->name);
+  if (!cmd_->command)
+    return CMDLINE_UNDEFINED;
+
+  cmd_->argc = prvCmdlineParseArgs(line_ + size, cmd_->argv);
+  if (cmd_->argc < cmd_->command->min_args
+      || cmd_->argc > cmd_->command->max_args)
+  {
+    cmd_->command = NULL;
+    return CMDLINE_BAD_ARGS;
+  }
+
+  return CMDLINE_OK;
+}
@@ -0,0 +1,49 @@
+#ifndef CMDLINE_H
+# define CMDLINE_H
+
+#include <stdint.h>
+
+// A command line is a name (leading letters, command then subcommand
+// letters, e.g. "mq") followed by integers separated by spaces or ':'.
+// Integers are decimal or "0x" hexadecimal, out of range ones are
+// rejected.
+#define CMDLINE_ARGS_MAX  4
+#define CMDLINE_NAME_SIZE 8
+
+// Status of iCmdlineParse
+#define CMDLINE_OK         0
+#define CMDLINE_UNDEFINED -1 // Unknown or too long name
+#define CMDLINE_BAD_ARGS  -2 // Wrong arguments number or syntax
+
+typedef void (*pfunCommandHandle) (int argc_, const int32_t* argv_);
+
+// Command flags
+#define COMMAND_BACKGROUND 0x01 // Run apart, see the interpreter
+
+typedef struct
+{
+  const char* name;
+  uint8_t min_args;
+  uint8_t max_args;
+  uint8_t flags;
+  pfunCommandHandle handler;
+} command_t;
+
+typedef struct
+{
+  const command_t* command;
+  char name[CMDLINE_NAME_SIZE];
+  int argc;
+  int32_t argv[CMDLINE_ARGS_MAX];
+} cmdline_t;
+
+// Binary search, the table must be sorted by name (strcmp order)
+const command_t* pxCmdlineLookup(const command_t* commands_, int n_,
+                                 const char* name_);
+
+// Split a trimmed command line and look its command up. The name is
+// filled in unless too long, the command on success only.
+int iCmdlineParse(const command_t* commands_, int n_, const char* line_,
+                  cmdline_t* cmd_);
+
+#endif
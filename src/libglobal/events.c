@@ -0,0 +1,107 @@
+#include "FreeRTOS.h"
+#include "task.h"
+#ifdef CO_ROUTINES
+# include "croutine.h"
+#endif
+
+#include "libglobal/blackbox.h"
+#include "libglobal/events.h"
+#include "libglobal/fault.h"
+#include "libglobal/protocol.h"
+#include "libglobal/sysmon.h"
+
+#include "libperiph/bumpers.h"
+#include "libperiph/hardware.h"
+
+#ifndef CO_ROUTINES
+static void vEventsTask(void* pvParameters_);
+#else
+static void vEventsCoRoutine(xCoRoutineHandle xHandle_,
+                             unsigned portBASE_TYPE index_);
+#endif
+static void vEventsSend(const bumper_event_t* event_);
+
+void vEventsInit(unsigned portBASE_TYPE eventsDaemonPriority_)
+{
+  // Create the daemon
+#ifndef CO_ROUTINES
+  if (xTaskCreate(vEventsTask, (const signed char * const)"eventd",
+                  EVENTS_STACK_SIZE, NULL, eventsDaemonPriority_,
+                  NULL) != pdPASS)
+#else
+  if (xCoRoutineCreate(vEventsCoRoutine, CO_PRIORITY_EVENTS, 0) != pdPASS)
+#endif
+    vFaultAllocation("eventd");
+}
+
+static void vEventsSend(const bumper_event_t* event_)
+{
+  proto_event_t frame =
+    {
+      .tick   = event_->tick,
+      .source = PROTO_EVENT_BUMPER + event_->bumper,
+      .value  = event_->pressed,
+    };
+#ifndef CO_ROUTINES
+  vProtoSend(PROTO_EVENT, &frame, sizeof (frame));
+#else
+  xProtoTrySend(PROTO_EVENT, &frame, sizeof (frame), 0);
+#endif
+  vBlackboxLog(BLACKBOX_BUMPER, event_->bumper, event_->pressed);
+}
+
+#ifndef CO_ROUTINES
+static void vEventsTask(void* pvParameters_)
+{
+  bumper_event_t event;
+
+  vSysmonRegisterTask("eventd");
+
+  for (;;)
+  {
+    if (!xBumpersWaitEvent(&event, portMAX_DELAY))
+      continue;
+    vEventsSend(&event);
+
+    // The last bounce may fall in the debounce window: check the level
+    // once it settled
+    vTaskDelay(MS_TO_TICKS(BUMPERS_DEBOUNCE_MS));
+    if (iBumpersIsPressed(event.bumper) != event.pressed)
+    {
+      event.tick = xTaskGetTickCount();
+      event.pressed = !event.pressed;
+      vEventsSend(&event);
+    }
+  }
+}
+#else
+// Same, the queue polled every EVENTS_POLL_MS: the idle task never
+// blocks. The frame is only tried, a full link drops it (uLinkDropped).
+static void vEventsCoRoutine(xCoRoutineHandle xHandle_,
+                             unsigned portBASE_TYPE index_)
+{
+  static bumper_event_t event;
+
+  crSTART(xHandle_);
+
+  for (;;)
+  {
+    if (!xBumpersWaitEvent(&event, 0))
+    {
+      crDELAY(xHandle_, MS_TO_TICKS(EVENTS_POLL_MS));
+      continue;
+    }
+    vEventsSend(&event);
+
+    crDELAY(xHandle_, MS_TO_TICKS(BUMPERS_DEBOUNCE_MS));
+    if (iBumpersIsPressed(event.bumper) != event.pressed)
+    {
+      event.tick = xTaskGetTickCount();
+      event.pressed = !event.pressed;
+      vEventsSend(&event);
+    }
+  }
+
+  crEND();
+}
+#endif
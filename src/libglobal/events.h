@@ -0,0 +1,17 @@
+#ifndef EVENTS_H
+# define EVENTS_H
+
+#include "FreeRTOS.h"
+
+// Forward bumper edges to the host as PROTO_EVENT frames
+// Daemon stack, in words
+#ifndef EVENTS_STACK_SIZE
+# define EVENTS_STACK_SIZE configMINIMAL_STACK_SIZE
+#endif
+
+// Bumper queue polls of the co-routine (--coroutines)
+#define EVENTS_POLL_MS 10
+
+void vEventsInit(unsigned portBASE_TYPE eventsDaemonPriority_);
+
+#endif
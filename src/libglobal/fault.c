@@ -0,0 +1,216 @@
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "stm32f10x.h"
+
+#include "libglobal/fault.h"
+#include "libglobal/sysmon.h"
+
+#ifdef STACK_GUARD
+# include "libperiph/mpu.h"
+#endif
+
+#ifdef SIMULATION
+# include "sim/sim.h"
+#endif
+
+// Tells a record from the RAM content at power up
+#define FAULT_MAGIC 0xFA017ED5
+
+// Stack words searched for the trace, past the exception frame
+#define FAULT_TRACE_SCAN 64
+
+// From the linker script
+extern const uint8_t _start[];
+extern const uint8_t _etext[];
+extern const uint8_t _eram[];
+
+static fault_record_t record __attribute__((section(".noinit")));
+
+static void prvFaultRecord(int cause_, const char* name_)
+{
+  // PRIMASK, left alone by the kernel masking (BASEPRI)
+  __disable_irq();
+
+  if (record.magic != FAULT_MAGIC)
+  {
+    record.magic = FAULT_MAGIC;
+    record.count = 0;
+  }
+  record.count++;
+  record.cause = cause_;
+  record.tick = xTaskGetTickCountFromISR();
+  strncpy(record.task, name_ ? name_ : "", FAULT_TASK_NAME_SIZE - 1);
+  record.task[FAULT_TASK_NAME_SIZE - 1] = 0;
+  record.line = 0;
+  memset(&record.crash, 0, sizeof (record.crash));
+}
+
+static int prvFaultIsCode(uint32_t address_)
+{
+  // Thumb bit set
+  return (address_ & 1) && address_ >= (uint32_t)_start &&
+    address_ < (uint32_t)_etext;
+}
+
+static int prvFaultIsStack(const uint32_t* p_, int words_)
+{
+  return (uint32_t)p_ >= SRAM_BASE && !((uint32_t)p_ & 3) &&
+    (uint32_t)(p_ + words_) <= (uint32_t)_eram;
+}
+
+void vFaultStackOverflow(const char* task_)
+{
+  prvFaultRecord(FAULT_STACK_OVERFLOW, task_);
+
+  // The stack below the task is corrupted: start over
+  NVIC_SystemReset();
+}
+
+static void prvFaultCrash(int cause_, const uint32_t* frame_,
+                          uint32_t exc_return_)
+{
+  const char* name;
+
+  // Faulting code: a task, main before the scheduler or an interrupt
+  if (!(exc_return_ & 8))
+    name = "isr";
+  else if (!(exc_return_ & 4))
+    name = "main";
+  else
+    name = pcSysmonTaskName(xTaskGetCurrentTaskHandle());
+  prvFaultRecord(cause_, name);
+
+  fault_crash_t* crash = &record.crash;
+  crash->cfsr = SCB->CFSR;
+  crash->hfsr = SCB->HFSR;
+  crash->mmfar = SCB->MMFAR;
+  crash->bfar = SCB->BFAR;
+
+  // A bad stack pointer may be the fault itself: no frame then
+  if (prvFaultIsStack(frame_, 8))
+  {
+    crash->r0 = frame_[0];
+    crash->r1 = frame_[1];
+    crash->r2 = frame_[2];
+    crash->r3 = frame_[3];
+    crash->r12 = frame_[4];
+    crash->lr = frame_[5];
+    crash->pc = frame_[6];
+    crash->psr = frame_[7];
+
+    int n = 0;
+    for (const uint32_t* p = frame_ + 8;
+         n < FAULT_TRACE_NB && p < frame_ + 8 + FAULT_TRACE_SCAN &&
+           prvFaultIsStack(p, 1); p++)
+      if (prvFaultIsCode(*p))
+        crash->trace[n++] = *p;
+  }
+
+  NVIC_SystemReset();
+}
+
+void vFaultCrash(const uint32_t* frame_, uint32_t exc_return_)
+{
+#ifdef STACK_GUARD
+  // The frame may be in the guard, a MemManage escalated
+  vMpuDisable();
+#endif
+  prvFaultCrash(FAULT_CRASH, frame_, exc_return_);
+}
+
+#ifdef STACK_GUARD
+void vFaultMemManage(const uint32_t* frame_, uint32_t exc_return_)
+{
+  const uint32_t cfsr = SCB->CFSR;
+
+  vMpuDisable();
+  // Pushed into the guard by the exception entry, or by the code
+  const int overflow = (cfsr & SCB_CFSR_MSTKERR) ||
+    ((cfsr & SCB_CFSR_MMARVALID) && iMpuIsGuard(SCB->MMFAR));
+  prvFaultCrash(overflow ? FAULT_STACK_OVERFLOW : FAULT_CRASH, frame_,
+                exc_return_);
+}
+
+// As the HardFault one
+__attribute__((naked)) void MemManage_Handler()
+{
+  __asm volatile
+    (
+      "tst lr, #4       \n"
+      "ite eq           \n"
+      "mrseq r0, msp    \n"
+      "mrsne r0, psp    \n"
+      "mov r1, lr       \n"
+      "b vFaultMemManage \n"
+    );
+}
+#endif
+
+#ifdef SIMULATION
+// Host simulation: called on SIGSEGV or SIGBUS (sim/sim.c), without any
+// frame. Thread mode, process stack: a task.
+void HardFault_Handler()
+{
+  vFaultCrash(NULL, 0xfffffffd);
+}
+#else
+// Stacked frame on the stack in use when the fault hit, MSP or PSP
+__attribute__((naked)) void HardFault_Handler()
+{
+  __asm volatile
+    (
+      "tst lr, #4     \n"
+      "ite eq         \n"
+      "mrseq r0, msp  \n"
+      "mrsne r0, psp  \n"
+      "mov r1, lr     \n"
+      "b vFaultCrash  \n"
+    );
+}
+#endif
+
+void vFaultAssert(const char* file_, int line_)
+{
+  const int size = strlen(file_);
+
+  // The end of the path: the file name, its directory if it fits
+  prvFaultRecord(FAULT_ASSERT, size < FAULT_TASK_NAME_SIZE ?
+                 file_ : file_ + size - (FAULT_TASK_NAME_SIZE - 1));
+  record.line = line_;
+  record.crash.pc = (uint32_t)__builtin_return_address(0);
+#ifdef SIMULATION
+  vSimLog("assert %s:%d", file_, line_);
+#endif
+
+  if (xTaskGetTickCountFromISR() == 0)
+    for (;;);
+  NVIC_SystemReset();
+}
+
+void vFaultAllocation(const char* what_)
+{
+  prvFaultRecord(FAULT_ALLOCATION, what_);
+
+  for (;;);
+}
+
+void vFaultResource(const char* what_)
+{
+  prvFaultRecord(FAULT_RESOURCE, what_);
+  __enable_irq();
+}
+
+int iFaultGet(fault_record_t* record_)
+{
+  if (record.magic != FAULT_MAGIC)
+    return 0;
+  *record_ = record;
+  return 1;
+}
+
+void vFaultClear()
+{
+  record.magic = 0;
+}
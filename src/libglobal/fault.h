@@ -0,0 +1,72 @@
+#ifndef FAULT_H
+# define FAULT_H
+
+#include <stdint.h>
+
+// Last fault, kept across resets in RAM not cleared at boot (.noinit),
+// lost at power off
+enum eFaultCause {
+  FAULT_NONE,
+  FAULT_STACK_OVERFLOW, // With the crash dump under --stack-guard
+  FAULT_ALLOCATION, // Kernel object or task not created at init
+  FAULT_CRASH,      // HardFault (the other faults escalate), see crash
+  FAULT_ASSERT,     // assert_param failed, see line
+  FAULT_RESOURCE,   // Hardware claimed by two drivers, see resources.h
+};
+
+#define FAULT_TASK_NAME_SIZE 12
+#define FAULT_TRACE_NB       8
+
+// Core state at the fault
+typedef struct
+{
+  uint32_t r0, r1, r2, r3, r12, lr, pc, psr; // Stacked by the exception
+  uint32_t cfsr, hfsr, mmfar, bfar;
+  // Code addresses found up the stack, likely return addresses: no frame
+  // pointers to follow. 0 after the last one.
+  uint32_t trace[FAULT_TRACE_NB];
+} fault_crash_t;
+
+typedef struct
+{
+  uint32_t magic;
+  uint16_t count;   // Faults since power up
+  uint8_t cause;    // eFaultCause of the last one
+  uint32_t tick;
+  char task[FAULT_TASK_NAME_SIZE]; // Or object, for an allocation, or
+                                   // end of the file name, for an assert
+  uint16_t line;                   // Of the assert
+  fault_crash_t crash;             // Crash only, pc and lr for an assert
+} fault_record_t;
+
+// Record the fault and reset the system, from the kernel hooks
+void vFaultStackOverflow(const char* task_);
+
+// Record the fault and halt: the heap is sized at compile time
+// (configTOTAL_HEAP_SIZE), a reset would fail the same way
+void vFaultAllocation(const char* what_);
+
+// Record the conflict on a resource and go on: the board boots, to tell
+// it on the console. From the inits, the interrupts on.
+void vFaultResource(const char* what_);
+
+// Record the crash and reset, from the HardFault handler with the stacked
+// frame and EXC_RETURN
+void vFaultCrash(const uint32_t* frame_, uint32_t exc_return_);
+
+#ifdef STACK_GUARD
+// The same from the MemManage handler: a stack overflow when the access
+// hit the guard (libperiph/mpu.h)
+void vFaultMemManage(const uint32_t* frame_, uint32_t exc_return_);
+#endif
+
+// Record the failed assert_param and reset. Before the scheduler, halt: a
+// reset would fail the same way.
+void vFaultAssert(const char* file_, int line_);
+
+// Copy the record, returns 0 when there was no fault since power up or
+// the last clear
+int iFaultGet(fault_record_t* record_);
+void vFaultClear();
+
+#endif
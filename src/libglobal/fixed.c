@@ -0,0 +1,84 @@
+#include "libglobal/fixed.h"
+
+// 2^63 / u for u normalized, top bit set: result in [2^31, 2^32]
+static uint32_t prvFixedRecip(uint32_t u_)
+{
+  // 16 bits estimate by UDIV, from below: the divisor is rounded up
+  const uint32_t d = (u_ >> 16) + 1;
+  const uint32_t r = (0xffffffffu / d) << 15;
+  // Newton step on the error, 2^63 - u * r, less than 2^48
+  const uint64_t e = (1ull << 63) - (uint64_t)u_ * r;
+
+  return r + (uint32_t)(((uint64_t)r * (uint32_t)(e >> 31)) >> 32);
+}
+
+int32_t iQ16Recip(int32_t x_)
+{
+  const uint32_t v = x_ < 0 ? -(uint32_t)x_ : (uint32_t)x_;
+
+  // 1/x overflows from x = 2^-15 down
+  if (v <= 2)
+    return x_ < 0 ? Q16_MIN : Q16_MAX;
+
+  // 2^32 / v, from 2^(63 - n) / v
+  const int n = iFixedClz(v);
+  uint32_t r = prvFixedRecip(v << n) >> (31 - n);
+
+  // The estimate is from below, by at most one
+  if ((uint64_t)(r + 1) * v <= 1ull << 32)
+    r++;
+  return x_ < 0 ? -(int32_t)r : (int32_t)r;
+}
+
+int32_t iQ16Div(int32_t a_, int32_t b_)
+{
+  const uint32_t a = a_ < 0 ? -(uint32_t)a_ : (uint32_t)a_;
+  const uint32_t b = b_ < 0 ? -(uint32_t)b_ : (uint32_t)b_;
+  const int negative = (a_ < 0) != (b_ < 0);
+
+  if (!b)
+    return negative ? Q16_MIN : Q16_MAX;
+
+  // a * 2^16 / b = a * (2^63 / (b << n)) >> (47 - n)
+  const int n = iFixedClz(b);
+  uint64_t q = ((uint64_t)a * prvFixedRecip(b << n)) >> (47 - n);
+  const uint64_t limit = negative ? (uint64_t)1 << 31 : INT32_MAX;
+
+  // Short by a few units at most once in range
+  if (q <= limit)
+    while ((q + 1) * b <= (uint64_t)a << 16)
+      q++;
+  if (q > limit)
+    return negative ? Q16_MIN : Q16_MAX;
+  return negative ? -(int64_t)q : (int64_t)q;
+}
+
+uint32_t uFixedSqrt(uint32_t x_)
+{
+  uint32_t s, next;
+
+  if (x_ < 2)
+    return x_;
+
+  // 2^ceil(bits / 2) is above the root: Newton decreases to its floor
+  s = 1u << ((33 - iFixedClz(x_)) / 2);
+  for (;;)
+  {
+    next = (s + x_ / s) / 2;
+    if (next >= s)
+      return s;
+    s = next;
+  }
+}
+
+int32_t iQ16Sqrt(int32_t x_)
+{
+  if (x_ <= 0)
+    return 0;
+
+  // sqrt(x * 2^16): shifted up by an even count to keep 16 root bits
+  const int n = iFixedClz(x_) & ~1;
+  const uint32_t s = uFixedSqrt((uint32_t)x_ << n);
+
+  return n <= 16 ? s << ((16 - n) / 2) : s >> ((n - 16) / 2);
+}
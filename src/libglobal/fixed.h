@@ -0,0 +1,105 @@
+#ifndef FIXED_H
+# define FIXED_H
+
+#include <stdint.h>
+
+// Fixed-point arithmetic for the control code, on a core without FPU:
+// Q15 in int16_t, [-1, 1), and Q16 in int32_t, 16 integer and 16
+// fraction bits. The operations saturate instead of wrapping, the shifts
+// round towards minus infinity. Printed with %q (libglobal/format.h): "%q", x,
+// 16 for a Q16.
+#define Q15_ONE 32768
+#define Q16_ONE 65536
+#define Q15_MAX INT16_MAX
+#define Q15_MIN INT16_MIN
+#define Q16_MAX INT32_MAX
+#define Q16_MIN INT32_MIN
+
+// From a constant, folded at compile time
+#define Q15(x) ((int16_t)((x) >= 1.0 ? Q15_MAX : (x) * Q15_ONE))
+#define Q16(x) ((int32_t)((x) * Q16_ONE + ((x) < 0 ? -0.5 : 0.5)))
+
+// Leading zeros, 32 for 0 (CLZ)
+static inline int iFixedClz(uint32_t x_)
+{
+  return x_ ? __builtin_clz(x_) : 32;
+}
+
+// Saturate to a signed 16 bits (SSAT)
+static inline int32_t iFixedSat16(int32_t x_)
+{
+#if defined(__ARM_ARCH_7M__)
+  int32_t r;
+
+  __asm ("ssat %0, #16, %1" : "=r" (r) : "r" (x_));
+  return r;
+#else
+  return x_ > INT16_MAX ? INT16_MAX : x_ < INT16_MIN ? INT16_MIN : x_;
+#endif
+}
+
+// Saturate a 64 bits intermediate to 32 bits
+static inline int32_t iFixedSat32(int64_t x_)
+{
+  return x_ > INT32_MAX ? INT32_MAX : x_ < INT32_MIN ? INT32_MIN : x_;
+}
+
+static inline int16_t iQ15Add(int16_t a_, int16_t b_)
+{
+  return iFixedSat16((int32_t)a_ + b_);
+}
+
+static inline int16_t iQ15Sub(int16_t a_, int16_t b_)
+{
+  return iFixedSat16((int32_t)a_ - b_);
+}
+
+// -1 * -1 is the only product to saturate
+static inline int16_t iQ15Mul(int16_t a_, int16_t b_)
+{
+  return iFixedSat16(((int32_t)a_ * b_) >> 15);
+}
+
+static inline int32_t iQ16Add(int32_t a_, int32_t b_)
+{
+  int32_t r;
+
+  if (__builtin_add_overflow(a_, b_, &r))
+    return a_ < 0 ? Q16_MIN : Q16_MAX;
+  return r;
+}
+
+static inline int32_t iQ16Sub(int32_t a_, int32_t b_)
+{
+  int32_t r;
+
+  if (__builtin_sub_overflow(a_, b_, &r))
+    return a_ < 0 ? Q16_MIN : Q16_MAX;
+  return r;
+}
+
+// One SMULL, then the shift and the saturation of its high word
+static inline int32_t iQ16Mul(int32_t a_, int32_t b_)
+{
+  return iFixedSat32(((int64_t)a_ * b_) >> 16);
+}
+
+// Q16 times a Q15 gain, into Q16
+static inline int32_t iQ16MulQ15(int32_t a_, int16_t b_)
+{
+  return ((int64_t)a_ * b_) >> 15;
+}
+
+// 1 / x, saturated when |x| <= 2^-15 (and for 0): one UDIV for an
+// estimate, one Newton step, one fix up multiply, no 64 bits division.
+// Truncated towards 0, as a division.
+int32_t iQ16Recip(int32_t x_);
+// a / b, saturated, from the reciprocal of b
+int32_t iQ16Div(int32_t a_, int32_t b_);
+
+// Floor of the square root, from a CLZ estimate and Newton steps on UDIV
+uint32_t uFixedSqrt(uint32_t x_);
+// Square root of a Q16, 0 for negative values, 16 significant bits
+int32_t iQ16Sqrt(int32_t x_);
+
+#endif
@@ -0,0 +1,100 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/flags.h"
+#include "libglobal/sysmon.h"
+#include "libglobal/timeline.h"
+
+static int prvFlagsMet(uint32_t bits_, uint32_t wanted_, int mode_)
+{
+  if (mode_ == FLAGS_ALL)
+    return (bits_ & wanted_) == wanted_;
+  return (bits_ & wanted_) != 0;
+}
+
+void vFlagsInit(flags_t* flags_)
+{
+  flags_->bits = 0;
+  flags_->wanted = 0;
+  vListInitialise(&flags_->waiting);
+}
+
+// Interrupts masked
+static portBASE_TYPE prvFlagsSet(flags_t* flags_, uint32_t bits_)
+{
+  portBASE_TYPE woken = pdFALSE;
+
+  flags_->bits |= bits_;
+  if (!prvFlagsMet(flags_->bits, flags_->wanted, flags_->mode))
+    return pdFALSE;
+  // The first to run takes the bits, the others wait again
+  while (!listLIST_IS_EMPTY(&flags_->waiting))
+  {
+#ifdef TIMELINE
+    vTimelineLog(TIMELINE_WAKE, iSysmonTaskSlot(
+                   listGET_OWNER_OF_HEAD_ENTRY(&flags_->waiting)));
+#endif
+    if (xTaskRemoveFromEventList(&flags_->waiting))
+      woken = pdTRUE;
+  }
+  return woken;
+}
+
+void vFlagsSet(flags_t* flags_, uint32_t bits_)
+{
+  portBASE_TYPE woken;
+
+  taskENTER_CRITICAL();
+  woken = prvFlagsSet(flags_, bits_);
+  taskEXIT_CRITICAL();
+  if (woken)
+    portYIELD_WITHIN_API();
+}
+
+void vFlagsClear(flags_t* flags_, uint32_t bits_)
+{
+  taskENTER_CRITICAL();
+  flags_->bits &= ~bits_;
+  taskEXIT_CRITICAL();
+}
+
+void vFlagsSetFromISR(flags_t* flags_, uint32_t bits_, portBASE_TYPE* woken_)
+{
+  const unsigned portBASE_TYPE mask = portSET_INTERRUPT_MASK_FROM_ISR();
+
+  if (prvFlagsSet(flags_, bits_))
+    *woken_ = pdTRUE;
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+uint32_t uFlagsWait(flags_t* flags_, uint32_t bits_, int mode_,
+                    portTickType ticks_)
+{
+  xTimeOutType timeout;
+  uint32_t got;
+
+  vTaskSetTimeOutState(&timeout);
+  for (;;)
+  {
+    taskENTER_CRITICAL();
+    if (!ticks_ || prvFlagsMet(flags_->bits, bits_, mode_))
+    {
+      got = flags_->bits & bits_;
+      flags_->bits &= ~got;
+      taskEXIT_CRITICAL();
+      return got;
+    }
+    // Woken by the set that meets the wait, or the timeout
+    flags_->wanted = bits_;
+    flags_->mode = mode_;
+#ifdef TIMELINE
+    vTimelineWait(TIMELINE_WAIT_FLAGS);
+#endif
+    vTaskPlaceOnEventList(&flags_->waiting, ticks_);
+    taskEXIT_CRITICAL();
+    portYIELD_WITHIN_API();
+
+    if (xTaskCheckForTimeOut(&timeout, &ticks_))
+      ticks_ = 0;
+  }
+}
@@ -0,0 +1,36 @@
+#ifndef FLAGS_H
+# define FLAGS_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "list.h"
+
+// Event flags: wakeups from the interrupts, one bit per source, waited
+// for by one task at a time, any or all of them, or by several for the
+// same bits. No queue behind: a set is an OR, and wakes the waiters only
+// once what they wait for is there.
+typedef struct
+{
+  volatile uint32_t bits;
+  uint32_t wanted;       // Of the waiting task
+  int mode;
+  xList waiting;
+} flags_t;
+
+#define FLAGS_ANY 0
+#define FLAGS_ALL 1
+
+void vFlagsInit(flags_t* flags_);
+// From tasks
+void vFlagsSet(flags_t* flags_, uint32_t bits_);
+void vFlagsClear(flags_t* flags_, uint32_t bits_);
+// From the interrupts under IRQ_PRIORITY_KERNEL_MAX, as the FromISR
+// calls of the kernel: ends with portEND_SWITCHING_ISR(*woken_)
+void vFlagsSetFromISR(flags_t* flags_, uint32_t bits_, portBASE_TYPE* woken_);
+// Wait up to ticks_ (portMAX_DELAY forever, 0 polls) for any or all of
+// bits_. Returns those set, cleared: fewer than asked on timeout.
+uint32_t uFlagsWait(flags_t* flags_, uint32_t bits_, int mode_,
+                    portTickType ticks_);
+
+#endif
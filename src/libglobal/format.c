@@ -0,0 +1,142 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "libglobal/format.h"
+#include "libglobal/strutils.h"
+
+#define FORMAT_PRECISION_DEFAULT 3
+
+typedef struct
+{
+  pfunFormatPutc putc;
+  void* ctx;
+  int count;
+} format_out_t;
+
+static void prvFormatPutc(format_out_t* out_, char c_)
+{
+  out_->putc(out_->ctx, c_);
+  out_->count++;
+}
+
+// Converted field padded up to width_ ('-' pads on the right, zeros go
+// after the sign)
+static void prvFormatField(format_out_t* out_, const char* s_, int size_,
+                           int width_, char pad_, int left_)
+{
+  width_ -= size_;
+  if (pad_ == '0' && *s_ == '-')
+  {
+    prvFormatPutc(out_, *s_++);
+    size_--;
+  }
+  if (!left_)
+    for (; width_ > 0; width_--)
+      prvFormatPutc(out_, pad_);
+  while (size_--)
+    prvFormatPutc(out_, *s_++);
+  for (; width_ > 0; width_--)
+    prvFormatPutc(out_, ' ');
+}
+
+static int prvFormatHex(uint32_t value_, char* s_)
+{
+  int size = 0;
+
+  for (uint32_t v = value_; v; v >>= 4)
+    size++;
+  if (!size)
+    size = 1;
+  s_[size] = '\0';
+  for (int i = size - 1; i >= 0; i--, value_ >>= 4)
+    s_[i] = "0123456789abcdef"[value_ & 0xF];
+
+  return size;
+}
+
+int iFormat(pfunFormatPutc putc_, void* ctx_, const char* fmt_,
+            va_list args_)
+{
+  format_out_t out = { .putc = putc_, .ctx = ctx_, .count = 0 };
+
+  for (; *fmt_; fmt_++)
+  {
+    // Large enough for any conversion but %s
+    char buffer[20];
+    int left = 0, width = 0, precision = -1, size;
+    char pad = ' ';
+
+    if (*fmt_ != '%')
+    {
+      prvFormatPutc(&out, *fmt_);
+      continue;
+    }
+
+    fmt_++;
+    for (;; fmt_++)
+    {
+      if (*fmt_ == '-')
+        left = 1;
+      else if (*fmt_ == '0')
+        pad = '0';
+      else
+        break;
+    }
+    if (left)
+      pad = ' ';
+    while (*fmt_ >= '0' && *fmt_ <= '9')
+      width = 10 * width + *fmt_++ - '0';
+    if (*fmt_ == '.')
+    {
+      precision = 0;
+      while (*++fmt_ >= '0' && *fmt_ <= '9')
+        precision = 10 * precision + *fmt_ - '0';
+    }
+    // int and long are the same size here
+    if (*fmt_ == 'l')
+      fmt_++;
+
+    switch (*fmt_)
+    {
+      case 'd':
+        size = itoa_len(va_arg(args_, int), buffer);
+        break;
+      case 'u':
+        size = utoa_len(va_arg(args_, unsigned), buffer);
+        break;
+      case 'x':
+        size = prvFormatHex(va_arg(args_, unsigned), buffer);
+        break;
+      case 'q':
+      {
+        const int value = va_arg(args_, int);
+        const int bits = va_arg(args_, int);
+
+        size = fixtoa_len(value, bits, precision < 0 ?
+                          FORMAT_PRECISION_DEFAULT : precision, buffer);
+        break;
+      }
+      case 'c':
+        buffer[0] = (char)va_arg(args_, int);
+        size = 1;
+        break;
+      case 's':
+      {
+        const char* s = va_arg(args_, const char*);
+
+        prvFormatField(&out, s, strlen(s), width, ' ', left);
+        continue;
+      }
+      case '%':
+        buffer[0] = '%';
+        size = 1;
+        break;
+      // Unknown conversion or end of format: stop there
+      default:
+        return out.count;
+    }
+    prvFormatField(&out, buffer, size, width, pad, left);
+  }
+
+  return out.count;
+}
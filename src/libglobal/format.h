@@ -0,0 +1,18 @@
+#ifndef FORMAT_H
+# define FORMAT_H
+
+#include <stdarg.h>
+
+// Called for each output character
+typedef void (*pfunFormatPutc)(void* ctx_, char c_);
+
+// printf subset, without allocation nor float:
+//   %d %u %x %c %s %%, with optional '-' or '0' flag and width
+//   %q fixed-point, takes the value then its number of fraction bits
+//      ("%.2q", 384, 8 gives "1.50"), 3 decimals unless a precision
+//      from 0 to 6 is given, rounded to nearest
+// Returns the number of characters output.
+int iFormat(pfunFormatPutc putc_, void* ctx_, const char* fmt_,
+            va_list args_);
+
+#endif
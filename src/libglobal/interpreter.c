@@ -1,125 +1,772 @@
+#include <stdarg.h>
 #include <string.h>
 #include "FreeRTOS.h"
 #include "task.h"
+#include "semphr.h"
 #include "interpreter.h"
+#include "libglobal/assert_param.h"
+#include "libglobal/fault.h"
+#include "libglobal/flags.h"
+#include "libglobal/format.h"
+#include "libglobal/message.h"
+#include "libglobal/protocol.h"
+#include "libglobal/startup.h"
 #include "libglobal/strutils.h"
-#include "libperiph/uart.h"
+#include "libglobal/sysmon.h"
+#include "libperiph/cycles.h"
+#include "libperiph/hardware.h"
+#include "libperiph/leds.h"
+#include "libperiph/link.h"
 
 static char prompt[32];
-static token_t tokens[32];
-static int n_tokens;
+// The INTERPRETER_COMMAND descriptors, between these linker symbols
+extern const command_t _scommands[];
+extern const command_t _ecommands[];
+#define COMMANDS_NB ((int)(_ecommands - _scommands))
 static unsigned portBASE_TYPE priority;
+static const char* start_command;
+
+// Machine mode
+static int machine;
+// Every command timed, not only the "time" ones
+static int timing;
+
+// Replies of the commands run by a task: the daemon (and the others of
+// vInterpreterRun, under the mutex), or the worker
+typedef struct
+{
+  message_t reply;
+  char tag[12];   // "#<seq> " of the running command, empty if untagged
+  int failed;     // Reported by the running handler
+} interpreter_output_t;
+
+static interpreter_output_t shell;
+
+// Background job on the worker, one at a time
+#define JOB_RUN 0x01
+
+static struct
+{
+  interpreter_output_t output;
+  cmdline_t call;
+  int timed;
+  volatile int running;
+  volatile int cancel;
+  volatile int done;
+  volatile int total;
+  portTickType start;
+  uint32_t runs;
+} job;
+
+static xTaskHandle worker;
+static flags_t jobFlags;
+
+// Held by the daemon but while it waits for input, and by vInterpreterRun
+static xSemaphoreHandle xInterpreterMutex;
+static pfunInterpreterHook hook;
+
+// Binary framing mode, entered when a line starts with PROTO_SYNC or
+// PROTO_SYNC_ADDR
+static frame_token_t frame_tokens[24];
+static int n_frame_tokens;
+static int binary;
+static proto_decoder_t decoder;
+
+// Line being edited and the last ones, static to keep the daemon stack
+// small
+static char line[INTERPRETER_LINE_SIZE];
+static char history[INTERPRETER_HISTORY_NB][INTERPRETER_LINE_SIZE];
+static int n_history;
+
+// Bytes received from the host link but not yet processed
+static char input[32];
+static int input_size;
+static int input_pos;
 
 static void prvInterpreterDaemon(void* pvParameters);
+static void prvInterpreterWorker(void* pvParameters);
+static char prvInterpreterGetc();
+static void prvInterpreterLine();
+static void prvInterpreterPutc(char c);
+static void prvInterpreterPuts(const char* s);
+static void prvInterpreterReplaceLine(int* size, const char* str);
+static const char* prvInterpreterHistory(int recall);
+static void prvInterpreterRemember(const char* cmd);
+static void prvInterpreterFrame();
+static void prvInterpreterDispatch(int status);
+static void prvInterpreterExecute(char* cmd);
+static const char* prvInterpreterTimed(const char* cmd, int* timed);
+static void prvInterpreterCall(const char* cmd, int timed);
+static void prvInterpreterHandle(const cmdline_t* call, int timed);
+static void prvInterpreterSubmit(const cmdline_t* call, int timed);
+static void prvInterpreterStatus(const char* status, const char* msg,
+                                 const char* name);
+static char* prvInterpreterTag(char* cmd);
+
+void vInterpreterInit(const char* pr, unsigned portBASE_TYPE daemon_priority)
+{
+  strncpy(prompt, pr, sizeof (prompt) - 1);
+  for (int i = 1; i < COMMANDS_NB; i++)
+    assert_param(strcmp(_scommands[i - 1].name, _scommands[i].name) < 0);
+  priority = daemon_priority;
+}
 
-void vInterpreterInit(const char* pr, token_t* tok, int n,
-                      unsigned portBASE_TYPE daemon_priority)
+void vInterpreterSetFrameHandlers(frame_token_t* tok, int n)
 {
-  memcpy(prompt, pr, strlen(pr) * sizeof (char));
-  n_tokens = n;
+  if (n > sizeof (frame_tokens) / sizeof (frame_tokens[0]))
+    n = sizeof (frame_tokens) / sizeof (frame_tokens[0]);
+  n_frame_tokens = n;
   for (int i = 0; i < n; i++)
   {
-    tokens[i].command = tok[i].command;
-    tokens[i].handler = tok[i].handler;
+    frame_tokens[i].type = tok[i].type;
+    frame_tokens[i].handler = tok[i].handler;
   }
-  priority = daemon_priority;
+}
+
+void vInterpreterSetStartCommand(const char* cmd_)
+{
+  start_command = cmd_;
 }
 
 void vInterpreterStart()
 {
-  xTaskCreate(prvInterpreterDaemon,
-              (signed portCHAR*)"Interpreter",
-              configMINIMAL_STACK_SIZE, NULL,
-              priority, NULL);
+  xInterpreterMutex = xSemaphoreCreateMutex();
+  if (!xInterpreterMutex)
+    vFaultAllocation("Interpreter");
+  if (xTaskCreate(prvInterpreterDaemon,
+                  (signed portCHAR*)"Interpreter",
+                  INTERPRETER_STACK_SIZE, NULL,
+                  priority, NULL) != pdPASS)
+    vFaultAllocation("Interpreter");
+  vFlagsInit(&jobFlags);
+  if (xTaskCreate(prvInterpreterWorker, (signed portCHAR*)"jobd",
+                  INTERPRETER_WORKER_STACK_SIZE, NULL, priority,
+                  &worker) != pdPASS)
+    vFaultAllocation("jobd");
+}
+
+// The replies of the worker go apart, the daemon goes on meanwhile
+static interpreter_output_t* prvInterpreterOutput()
+{
+  return xTaskGetCurrentTaskHandle() == worker ? &job.output : &shell;
+}
+
+static void prvInterpreterPutc(char c)
+{
+  vMessagePutc(&prvInterpreterOutput()->reply, c);
+}
+
+static void prvInterpreterPuts(const char* s)
+{
+  vMessagePuts(&prvInterpreterOutput()->reply, s);
+}
+
+static void prvInterpreterFormatPutc(void* ctx, char c)
+{
+  vMessagePutc(&prvInterpreterOutput()->reply, c);
+}
+
+void vInterpreterSetHook(pfunInterpreterHook hook_)
+{
+  hook = hook_;
+}
+
+void vInterpreterRun(const char* cmd_, const char* tag_)
+{
+  char saved[sizeof (shell.tag)];
+  int timed;
+
+  xSemaphoreTake(xInterpreterMutex, portMAX_DELAY);
+  // The echo of a line being typed goes first
+  vMessageSend(&shell.reply);
+  strcpy(saved, shell.tag);
+  strncpy(shell.tag, tag_, sizeof (shell.tag) - 1);
+  shell.tag[sizeof (shell.tag) - 1] = 0;
+  cmd_ = prvInterpreterTimed(cmd_, &timed);
+  prvInterpreterCall(cmd_, timed);
+  strcpy(shell.tag, saved);
+  xSemaphoreGive(xInterpreterMutex);
+}
+
+int iInterpreterCancelled()
+{
+  return job.cancel;
+}
+
+void vInterpreterProgress(int done_, int total_)
+{
+  job.done = done_;
+  job.total = total_;
+}
+
+void vInterpreterGetJob(interpreter_job_t* job_)
+{
+  job_->name = job.runs ? job.call.command->name : NULL;
+  job_->running = job.running;
+  job_->done = job.done;
+  job_->total = job.total;
+  job_->elapsed_ms = job.runs ?
+    (xTaskGetTickCount() - job.start) * portTICK_RATE_MS : 0;
+  job_->runs = job.runs;
+}
+
+int xInterpreterCancelJob()
+{
+  if (!job.running)
+    return 0;
+  job.cancel = 1;
+  return 1;
+}
+
+void vInterpreterSetMachine(int enable_)
+{
+  machine = enable_;
+}
+
+int iInterpreterIsMachine()
+{
+  return machine;
+}
+
+void vInterpreterSetTiming(int enable_)
+{
+  timing = enable_;
+}
+
+int iInterpreterIsTiming()
+{
+  return timing;
+}
+
+void vInterpreterValues(const int* values_, int n_)
+{
+  interpreter_output_t* out = prvInterpreterOutput();
+
+  vMessagePuts(&out->reply, out->tag);
+  for (int i = 0; i < n_; i++)
+  {
+    vMessagePutInt(&out->reply, values_[i]);
+    if (i != n_ - 1)
+      vMessagePutc(&out->reply, '\t');
+  }
+  vMessagePuts(&out->reply, "\r\n");
+  vMessageSend(&out->reply);
+}
+
+void vInterpreterInfo(const char* msg_)
+{
+  interpreter_output_t* out = prvInterpreterOutput();
+
+  if (machine)
+    return;
+  vMessagePuts(&out->reply, msg_);
+  vMessagePuts(&out->reply, "\r\n");
+  vMessageSend(&out->reply);
+}
+
+void vInterpreterInfoValue(const char* msg_, int value_)
+{
+  vInterpreterInfof("%s%d", msg_, value_);
+}
+
+void vInterpreterInfof(const char* fmt_, ...)
+{
+  va_list args;
+
+  if (machine)
+    return;
+  va_start(args, fmt_);
+  iFormat(prvInterpreterFormatPutc, NULL, fmt_, args);
+  va_end(args);
+  prvInterpreterPuts("\r\n");
+  vMessageSend(&prvInterpreterOutput()->reply);
+}
+
+void vInterpreterFail(const char* msg_)
+{
+  interpreter_output_t* out = prvInterpreterOutput();
+
+  out->failed = 1;
+  if (machine)
+    return;
+  vMessagePuts(&out->reply, "error: ");
+  vMessagePuts(&out->reply, msg_);
+  vMessagePuts(&out->reply, "\r\n");
+  vMessageSend(&out->reply);
+}
+
+// Status code in machine mode or for a tagged command, else message for
+// a human
+static void prvInterpreterStatus(const char* status, const char* msg,
+                                 const char* name)
+{
+  interpreter_output_t* out = prvInterpreterOutput();
+
+  if (machine || out->tag[0])
+  {
+    prvInterpreterPuts(out->tag);
+    prvInterpreterPuts(status);
+  }
+  else if (msg)
+  {
+    prvInterpreterPuts(msg);
+    if (name)
+    {
+      prvInterpreterPuts(" '");
+      prvInterpreterPuts(name);
+      prvInterpreterPutc('\'');
+    }
+  }
+  else
+    return;
+  prvInterpreterPuts("\r\n");
+  vMessageSend(&out->reply);
+}
+
+// Process as many bytes as possible per wakeup: refill the input buffer
+// with everything the host link received only once it is exhausted. The
+// echo and prompt queued meanwhile go out as one message before blocking.
+static char prvInterpreterGetc()
+{
+  if (input_pos == input_size)
+  {
+    vMessageSend(&shell.reply);
+    xSemaphoreGive(xInterpreterMutex);
+    input_size = xLinkReadAvailable(input, sizeof (input));
+    xSemaphoreTake(xInterpreterMutex, portMAX_DELAY);
+    input_pos = 0;
+  }
+  return input[input_pos++];
 }
 
 static void prvInterpreterDaemon(void* pvParameters)
+{
+  vSysmonRegisterTask("Interpreter");
+  xSemaphoreTake(xInterpreterMutex, portMAX_DELAY);
+
+  vTaskDelay(MS_TO_TICKS(INTERPRETER_START_MS));
+  vStartupMark(STARTUP_SHELL);
+  prvInterpreterPuts("\r\n");
+  if (start_command)
+  {
+    strncpy(line, start_command, sizeof (line) - 1);
+    prvInterpreterExecute(line);
+  }
+  vProtoDecoderReset(&decoder);
+  for (;;)
+  {
+    if (binary)
+      prvInterpreterFrame();
+    else
+      prvInterpreterLine();
+  }
+}
+
+// Runs the background commands, their replies and status line tagged
+static void prvInterpreterWorker(void* pvParameters)
+{
+  vSysmonRegisterTask("jobd");
+  for (;;)
+  {
+    uFlagsWait(&jobFlags, JOB_RUN, FLAGS_ANY, portMAX_DELAY);
+    prvInterpreterHandle(&job.call, job.timed);
+    job.running = 0;
+  }
+}
+
+static void prvInterpreterFrame()
+{
+  int status = iProtoDecode(&decoder, (uint8_t)prvInterpreterGetc());
+
+  // The frames to the other boards of a shared link are ignored
+  if (status == 0 || !iProtoIsForUs(&decoder))
+    return;
+
+  // A broadcast is run on every board, none of them answers
+  const int broadcast = decoder.addressed &&
+    decoder.address == PROTO_ADDR_BROADCAST;
+  if (broadcast)
+    vProtoMute(1);
+  prvInterpreterDispatch(status);
+  if (broadcast)
+    vProtoMute(0);
+}
+
+static void prvInterpreterDispatch(int status)
+{
+  if (status < 0)
+  {
+    vProtoSend(PROTO_NACK, &decoder.type, 1);
+    return;
+  }
+
+  // Back to the ASCII shell
+  if (decoder.type == PROTO_ASCII)
+  {
+    binary = 0;
+    vProtoSend(PROTO_ACK, &decoder.type, 1);
+    return;
+  }
+
+  for (int i = 0; i < n_frame_tokens; i++)
+  {
+    if (decoder.type == frame_tokens[i].type)
+    {
+      vLedsLinkActivity();
+      (*frame_tokens[i].handler)(decoder.payload, decoder.size);
+      return;
+    }
+  }
+
+  vProtoSend(PROTO_NACK, &decoder.type, 1);
+}
+
+// Replace the echoed line by another one
+static void prvInterpreterReplaceLine(int* size, const char* str)
+{
+  if (!machine)
+    for (int i = 0; i < *size; i++)
+      prvInterpreterPuts("\b \b");
+  *size = strlen(str);
+  memcpy(line, str, *size);
+  line[*size] = 0;
+  if (!machine)
+    prvInterpreterPuts(line);
+}
+
+// History entry recall steps back from the last one, 0 for an empty line
+static const char* prvInterpreterHistory(int recall)
+{
+  if (recall == 0)
+    return "";
+  return history[(n_history - recall) % INTERPRETER_HISTORY_NB];
+}
+
+static void prvInterpreterRemember(const char* cmd)
+{
+  if (n_history && !strcmp(cmd, prvInterpreterHistory(1)))
+    return;
+  strcpy(history[n_history % INTERPRETER_HISTORY_NB], cmd);
+  n_history++;
+}
+
+static void prvInterpreterLine()
 {
   char c;
-  char buffer[32];
   char* cmd;
-  int abort, size;
-  vTaskDelay(1000);
-  vUartPuts("\r\n");
-  for (;;)
+  char* next;
+  int abort, size, recall, escape;
+
+  abort = 0;
+  size = 0;
+  recall = 0;
+  escape = 0;
+
+  if (!machine)
   {
-    abort = 0;
-    size = 0;
+    prvInterpreterPuts(prompt);
+    prvInterpreterPuts(" # ");
+  }
+
+  line[0] = 0;
+  while ((c = prvInterpreterGetc()))
+  {
+    // A frame at the start of a line switches to binary mode
+    if (size == 0 &&
+        ((uint8_t)c == PROTO_SYNC || (uint8_t)c == PROTO_SYNC_ADDR))
+    {
+      binary = 1;
+      iProtoDecode(&decoder, (uint8_t)c);
+      return;
+    }
 
-    vUartPuts(prompt);
-    vUartPuts(" # ");
+    // Arrow keys: ESC [ A (up) and ESC [ B (down)
+    if (escape)
+    {
+      escape = (escape == 1 && c == '[') ? 2 : 0;
+      if (c == 'A')
+        c = 0x10;
+      else if (c == 'B')
+        c = 0x0e;
+      else
+        continue;
+    }
 
-    buffer[0] = 0;
-    while ((c = cUartGetc()))
+    if (c == 0x1b)
     {
-      if (size == 32)
-      {
-        abort = 1;
-        vUartPuts("\r\nerror: command too long...\r\n");
-        break;
-      }
+      escape = 1;
+      continue;
+    }
+    else if (c == 0x10) // Ctrl-P: previous history entry
+    {
+      if (recall < n_history && recall < INTERPRETER_HISTORY_NB)
+        prvInterpreterReplaceLine(&size, prvInterpreterHistory(++recall));
+      continue;
+    }
+    else if (c == 0x0e) // Ctrl-N: next history entry
+    {
+      if (recall > 0)
+        prvInterpreterReplaceLine(&size, prvInterpreterHistory(--recall));
+      continue;
+    }
 
-      if (c == '\r' || c == '\n')
+    if (size == INTERPRETER_LINE_SIZE - 1)
+    {
+      abort = 1;
+      if (!machine)
+        prvInterpreterPuts("\r\n");
+      prvInterpreterStatus(INTERPRETER_TOO_LONG, "error: command too long...",
+                           NULL);
+      break;
+    }
+
+    if (c == '\r' || c == '\n')
+    {
+      if (!machine)
+        prvInterpreterPuts("\r\n");
+      line[size] = 0;
+      break;
+    }
+    else if (c == 0x03)
+    {
+      abort = 1;
+      // On an empty line, the background job is asked to stop
+      if (size == 0 && xInterpreterCancelJob())
       {
-        vUartPuts("\r\n");
-        buffer[size] = 0;
+        if (!machine)
+          prvInterpreterPuts("\r\njob cancelled\r\n");
         break;
       }
-      else if (c == 0x03)
+      if (!machine)
       {
-        abort = 1;
-        vUartPuts("\r\n");
-        buffer[size] = 0;
-        vUartPuts(buffer);
-        vUartPuts(": abort\r\n");
-        break;
+        prvInterpreterPuts("\r\n");
+        line[size] = 0;
+        prvInterpreterPuts(line);
+        prvInterpreterPuts(": abort\r\n");
       }
-      else if (c == 0x08 || c == 0x7f)
+      break;
+    }
+    else if (c == 0x08 || c == 0x7f)
+    {
+      if (size > 0)
       {
-        if (size > 0)
+        size--;
+        if (!machine)
         {
-          size--;
-          vUartPutc(c);
-          vUartPutc(' ');
-          vUartPutc(c);
+          prvInterpreterPutc(c);
+          prvInterpreterPutc(' ');
+          prvInterpreterPutc(c);
         }
-        continue;
       }
-      else if (!is_letter(c) && !is_number(c)
-               && !is_space(c) && c != '-'
-               && c != ':'     && c != '.')
-        continue;
-
-      vUartPutc(c);
-      buffer[size++] = c;
+      continue;
     }
-
-    if (abort)
+    else if (!is_letter(c) && !is_number(c)
+             && !is_space(c) && c != '-'
+             && c != ':'     && c != '.'
+             && c != '#'     && c != ';'
+             && c != '!')
       continue;
 
-    cmd = trim_in_place(buffer);
+    if (!machine)
+      prvInterpreterPutc(c);
+    line[size++] = c;
+  }
 
-    // Skip empty command
-    if (cmd[0] == 0)
-      continue;
+  if (abort)
+    return;
+
+  cmd = trim_in_place(line);
 
-    abort = 1;
-    for (int i = 0; i < n_tokens; i++)
+  // Skip empty command
+  if (cmd[0] == 0)
+    return;
+
+  // "!" runs the last line again
+  if (!strcmp(cmd, "!"))
+  {
+    if (!n_history)
+      return;
+    strcpy(line, prvInterpreterHistory(1));
+    cmd = line;
+    if (!machine)
     {
-      if (cmd[0] == tokens[i].command)
-      {
-        (*tokens[i].handler)(cmd + 1);
-        abort = 0;
-        vUartPuts("\r\n");
-        break;
-      }
+      prvInterpreterPuts(cmd);
+      prvInterpreterPuts("\r\n");
     }
+  }
+  else
+    prvInterpreterRemember(cmd);
+
+  // Commands separated by ';' run in turn
+  for (; cmd; cmd = next)
+  {
+    next = strchr(cmd, ';');
+    if (next)
+      *next++ = 0;
+    cmd = trim_in_place(cmd);
+    if (cmd[0])
+      prvInterpreterExecute(cmd);
+  }
+}
+
+// Extract the sequence tag, returns the command after it or NULL
+static char* prvInterpreterTag(char* cmd)
+{
+  int size;
+
+  shell.tag[0] = 0;
+  if (cmd[0] != '#')
+    return cmd;
 
-    if (abort)
+  for (size = 1; is_number(cmd[size]); size++);
+  if (size == 1 || size > sizeof (shell.tag) - 2)
+    return NULL;
+  memcpy(shell.tag, cmd, size);
+  shell.tag[size] = ' ';
+  shell.tag[size + 1] = 0;
+
+  while (is_space(cmd[size]))
+    size++;
+  return cmd + size;
+}
+
+static void prvInterpreterExecute(char* cmd)
+{
+  cmdline_t call;
+  const char* command;
+  int timed;
+
+  cmd = prvInterpreterTag(cmd);
+  if (!cmd)
+  {
+    prvInterpreterStatus(INTERPRETER_BAD_ARGS, "error: bad sequence tag", NULL);
+    return;
+  }
+  command = prvInterpreterTimed(cmd, &timed);
+
+  if (hook &&
+      iCmdlineParse(_scommands, COMMANDS_NB, command, &call) == CMDLINE_OK)
+  {
+    shell.failed = 0;
+    if (hook(command, call.command))
     {
-      vUartPuts("error: undefined command '");
-      vUartPutc(cmd[0]);
-      vUartPuts("\r\n");
+      prvInterpreterStatus(shell.failed ? INTERPRETER_FAILED : INTERPRETER_OK,
+                           NULL, NULL);
+      return;
     }
   }
+  prvInterpreterCall(command, timed);
+}
+
+// Strip the "time" prefix, timed tells whether to time the command
+static const char* prvInterpreterTimed(const char* cmd, int* timed)
+{
+  const int size = sizeof (INTERPRETER_TIME) - 1;
+
+  *timed = timing;
+  if (strncmp(cmd, INTERPRETER_TIME, size) || !is_space(cmd[size]))
+    return cmd;
+  *timed = 1;
+  for (cmd += size; is_space(*cmd); cmd++);
+  return cmd;
+}
+
+static void prvInterpreterTiming(uint32_t cycles, uint32_t bytes)
+{
+  const int values[2] = { cycles, bytes };
+
+  if (machine || prvInterpreterOutput()->tag[0])
+    vInterpreterValues(values, 2);
+  else
+    vInterpreterInfof("time: %u cycles (%u us), %u bytes", cycles,
+                      cycles / CYCLES_PER_US, bytes);
+}
+
+static void prvInterpreterCall(const char* cmd, int timed)
+{
+  cmdline_t call;
+
+  switch (iCmdlineParse(_scommands, COMMANDS_NB, cmd, &call))
+  {
+    case CMDLINE_UNDEFINED:
+      prvInterpreterStatus(INTERPRETER_UNDEFINED, "error: undefined command",
+                           call.name[0] ? call.name : NULL);
+      return;
+    case CMDLINE_BAD_ARGS:
+      prvInterpreterStatus(INTERPRETER_BAD_ARGS, "error: bad arguments for",
+                           call.name);
+      return;
+  }
+
+  if (call.command->flags & COMMAND_BACKGROUND)
+    prvInterpreterSubmit(&call, timed);
+  else
+    prvInterpreterHandle(&call, timed);
+}
+
+static void prvInterpreterHandle(const cmdline_t* call, int timed)
+{
+  interpreter_output_t* out = prvInterpreterOutput();
+  uint32_t start = 0;
+
+  out->failed = 0;
+  if (timed)
+  {
+    // Without the echo of the line, queued before
+    vMessageSend(&out->reply);
+    vLinkCountStart();
+    start = uCyclesNow();
+  }
+  (*call->command->handler)(call->argc, call->argv);
+  if (timed)
+  {
+    const uint32_t cycles = uCyclesNow() - start;
+
+    prvInterpreterTiming(cycles, uLinkCountStop());
+  }
+  prvInterpreterStatus(out->failed ? INTERPRETER_FAILED : INTERPRETER_OK, NULL,
+                       NULL);
+}
+
+// Hand a background command to the worker. A tagged line keeps its tag,
+// the job then answers it; an untagged one is answered at once and the
+// job tagged "&<n> ".
+static void prvInterpreterSubmit(const cmdline_t* call, int timed)
+{
+  if (job.running)
+  {
+    prvInterpreterStatus(INTERPRETER_FAILED, "error: busy with",
+                         job.call.command->name);
+    return;
+  }
+
+  job.call = *call;
+  job.timed = timed;
+  job.runs++;
+  if (shell.tag[0])
+    strcpy(job.output.tag, shell.tag);
+  else
+  {
+    job.output.tag[0] = '&';
+    job.output.tag[1] = '0' + job.runs % 10;
+    job.output.tag[2] = ' ';
+    job.output.tag[3] = 0;
+  }
+  job.cancel = 0;
+  job.done = 0;
+  job.total = 0;
+  job.start = xTaskGetTickCount();
+  job.running = 1;
+  vFlagsSet(&jobFlags, JOB_RUN);
+
+  if (shell.tag[0])
+    return;
+  if (machine)
+    prvInterpreterStatus(INTERPRETER_OK, NULL, NULL);
+  else
+  {
+    vMessagePrintf(&shell.reply, "%s%s: started\r\n", job.output.tag,
+                   call->command->name);
+    vMessageSend(&shell.reply);
+  }
 }
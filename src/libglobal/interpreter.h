@@ -1,18 +1,136 @@
 #ifndef INTERPRETER_H
 # define INTERPRETER_H
 
+#include <stdint.h>
+
 #include "FreeRTOS.h"
+#include "libglobal/cmdline.h"
+#include "libglobal/protocol.h"
+
+// Command line syntax in libglobal/cmdline.h
+#define INTERPRETER_ARGS_MAX CMDLINE_ARGS_MAX
+
+// Command lines, including ';' separated batches ("mq500:300:300;mx"),
+// are edited in a static buffer, and the last ones are kept for recall
+// (Ctrl-P/Ctrl-N or arrows, "!" runs the last line again)
+#ifndef INTERPRETER_LINE_SIZE
+# define INTERPRETER_LINE_SIZE 96
+#endif
+#ifndef INTERPRETER_HISTORY_NB
+# define INTERPRETER_HISTORY_NB 4
+#endif
+
+// Daemon stack, in words: the command handlers run on it
+#ifndef INTERPRETER_STACK_SIZE
+# define INTERPRETER_STACK_SIZE 160
+#endif
+// Worker stack, the background commands run on it
+#ifndef INTERPRETER_WORKER_STACK_SIZE
+# define INTERPRETER_WORKER_STACK_SIZE INTERPRETER_STACK_SIZE
+#endif
+
+// Wait before the first prompt, for the host link to settle
+#ifndef INTERPRETER_START_MS
+# define INTERPRETER_START_MS 20
+#endif
+
+// Machine mode: no echo, no prompt, no messages. Each command line is
+// answered by its values lines, if any, then one status line.
+#define INTERPRETER_OK        "ok"
+#define INTERPRETER_UNDEFINED "e1" // Unknown command
+#define INTERPRETER_BAD_ARGS  "e2" // Wrong arguments number or syntax
+#define INTERPRETER_FAILED    "e3" // Reported by the handler
+#define INTERPRETER_TOO_LONG  "e4" // Line too long
+
+// Pipelining: a line prefixed by '#' and a sequence number ("#12 ml500")
+// gets its values and status lines prefixed by the same tag, in any
+// mode. Lines wait in the 256 bytes link receive ring meanwhile: the host
+// may keep up to INTERPRETER_WINDOW lines of 32 characters unanswered.
+#define INTERPRETER_WINDOW 7
 
-typedef void (*pfunTokenHandle) (char*);
+// Console command, declared after its handler: the descriptor goes to the
+// flash, in the commands table gathered by the linker (.commands of
+// stm32/stm32f10x_flash_md.ld) and sorted by section name, so by command
+// name for the binary search. The name is a C identifier, unique. At its
+// own alignment, not more: the descriptors follow each other as an array.
+#define INTERPRETER_COMMAND(name_, min_args_, max_args_, handler_)      \
+  INTERPRETER_COMMAND_FLAGS(name_, min_args_, max_args_, 0, handler_)
+
+// Long commands (dumps, calibrations) run on a worker task, jobd, at the
+// priority of the daemon, one at a time: the daemon goes on with the
+// other commands meanwhile, a stop among them. The replies and status
+// line of the job carry the tag of its line, or "&<n> " if it had none;
+// an untagged line is answered at once ("ok"). A second job is refused
+// while one runs. Its handler polls iInterpreterCancelled ("jk", or
+// Ctrl-C on an empty line) and may report its progress.
+#define INTERPRETER_BACKGROUND_COMMAND(name_, min_args_, max_args_,     \
+                                       handler_)                        \
+  INTERPRETER_COMMAND_FLAGS(name_, min_args_, max_args_,                \
+                            COMMAND_BACKGROUND, handler_)
+
+#define INTERPRETER_COMMAND_FLAGS(name_, min_args_, max_args_, flags_,  \
+                                  handler_)                             \
+  static const command_t xCommand_##name_                               \
+  __attribute__((section(".commands." #name_), used,                    \
+                 aligned(__alignof__(command_t)))) =                    \
+    { #name_, min_args_, max_args_, flags_, handler_ }
+
+void vInterpreterInit(const char* pr, unsigned portBASE_TYPE daemon_priority);
+void vInterpreterSetFrameHandlers(frame_token_t* tok, int n);
+// Line run once before the first prompt, as if typed: kept, not copied
+void vInterpreterSetStartCommand(const char* cmd_);
+void vInterpreterStart();
+
+// Before each command of a console line, once parsed: 1 when it took
+// the command instead of running it (a recorder), the status line then
+// says "ok" unless it called vInterpreterFail. NULL to stop.
+typedef int (*pfunInterpreterHook)(const char* cmd_,
+                                   const command_t* command_);
+void vInterpreterSetHook(pfunInterpreterHook hook_);
+
+// Run a command from another task, on its stack, in turn with the
+// console ones. Its replies and status line are tagged by tag_, as the
+// pipelined lines.
+void vInterpreterRun(const char* cmd_, const char* tag_);
+
+// From the handler of a background command: 1 once asked to stop
+int iInterpreterCancelled();
+// From the handler of a background command, total_ 0 if unknown
+void vInterpreterProgress(int done_, int total_);
 
 typedef struct
 {
-  char command;
-  pfunTokenHandle handler;
-} token_t;
+  const char* name;     // Of the last job, NULL before the first one
+  int running;
+  int done;
+  int total;
+  uint32_t elapsed_ms;  // Since it started
+  uint32_t runs;
+} interpreter_job_t;
 
-void vInterpreterInit(const char* pr, token_t* tok, int n,
-                      unsigned portBASE_TYPE daemon_priority);
-void vInterpreterStart();
+void vInterpreterGetJob(interpreter_job_t* job_);
+// Ask the running job to stop, 0 if there is none
+int xInterpreterCancelJob();
+
+void vInterpreterSetMachine(int enable_);
+int iInterpreterIsMachine();
+
+// "time <command>", after the tag if any, runs the command then reports
+// the cycles of its handler (at the core clock, preemption and waits for
+// the link included) and the bytes it sent on the host link, before the
+// status line: a values line "cycles bytes", or a message for a human.
+// With vInterpreterSetTiming(1), every command is timed.
+#define INTERPRETER_TIME "time"
+void vInterpreterSetTiming(int enable_);
+int iInterpreterIsTiming();
+
+// Replies, from the handlers only. Values are tab separated on one line
+// and always sent, messages only in human mode.
+void vInterpreterValues(const int* values_, int n_);
+void vInterpreterInfo(const char* msg_);
+void vInterpreterInfoValue(const char* msg_, int value_);
+// Message line formatted by iFormat (libglobal/format.h)
+void vInterpreterInfof(const char* fmt_, ...);
+void vInterpreterFail(const char* msg_);
 
 #endif
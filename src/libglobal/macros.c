@@ -0,0 +1,188 @@
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/fault.h"
+#include "libglobal/flags.h"
+#include "libglobal/macros.h"
+#include "libglobal/sysmon.h"
+
+#include "libperiph/hardware.h"
+
+#define MACROS_PLAY 0x01
+#define MACROS_STOP 0x02
+
+typedef struct
+{
+  uint8_t data[MACROS_SIZE];
+  uint16_t size;
+  uint8_t steps;
+} macro_t;
+
+static macro_t macros[MACROS_NB];
+
+// Interpreter side
+static int recording = -1;
+static uint16_t pending;         // ms, before the next step
+
+static flags_t wake;
+static volatile int playing = -1;
+static int playTimes;
+
+static void vMacrosTask(void* pvParameters_);
+
+void vMacrosInit(unsigned portBASE_TYPE daemonPriority_)
+{
+  vFlagsInit(&wake);
+  if (xTaskCreate(vMacrosTask, (const signed char * const)"macrod",
+                  MACROS_STACK_SIZE, NULL, daemonPriority_, NULL) != pdPASS)
+    vFaultAllocation("macrod");
+}
+
+static int prvMacrosAdd(const char* cmd_)
+{
+  macro_t* macro = &macros[recording];
+  const int size = strlen(cmd_) + 1;
+
+  if (macro->size + 2 + size > MACROS_SIZE)
+    return 0;
+  macro->data[macro->size++] = pending;
+  macro->data[macro->size++] = pending >> 8;
+  memcpy(&macro->data[macro->size], cmd_, size);
+  macro->size += size;
+  macro->steps++;
+  pending = 0;
+  return 1;
+}
+
+int xMacrosRecord(int slot_)
+{
+  if (slot_ < 0 || slot_ >= MACROS_NB || slot_ == playing)
+    return 0;
+  macros[slot_].size = 0;
+  macros[slot_].steps = 0;
+  recording = slot_;
+  pending = 0;
+  return 1;
+}
+
+int iMacrosRecording()
+{
+  return recording;
+}
+
+int xMacrosAppend(const char* cmd_)
+{
+  return recording >= 0 && prvMacrosAdd(cmd_);
+}
+
+int xMacrosWait(uint16_t ms_)
+{
+  // Beyond 16 bits, a step without a command takes the first part
+  if (pending + ms_ > UINT16_MAX && !prvMacrosAdd(""))
+    return 0;
+  pending += ms_;
+  return 1;
+}
+
+int iMacrosEnd()
+{
+  const int slot = recording;
+
+  if (slot < 0)
+    return 0;
+  // The delay at the end, before the next run
+  if (pending)
+    prvMacrosAdd("");
+  recording = -1;
+  return macros[slot].steps;
+}
+
+void vMacrosGetInfo(int slot_, macro_info_t* info_)
+{
+  const macro_t* macro = &macros[slot_];
+
+  info_->steps = macro->steps;
+  info_->size = macro->size;
+  info_->duration_ms = 0;
+  for (int pos = 0; pos < macro->size; )
+  {
+    info_->duration_ms += macro->data[pos] | macro->data[pos + 1] << 8;
+    pos += 2 + strlen((const char*)&macro->data[pos + 2]) + 1;
+  }
+}
+
+int xMacrosPlay(int slot_, int times_)
+{
+  macro_info_t info;
+
+  if (slot_ < 0 || slot_ >= MACROS_NB || slot_ == recording || playing >= 0)
+    return 0;
+  vMacrosGetInfo(slot_, &info);
+  // Forever without a delay, the lower priorities would never run
+  if (!info.steps || (!times_ && !info.duration_ms))
+    return 0;
+
+  playTimes = times_;
+  playing = slot_;
+  vFlagsClear(&wake, MACROS_STOP);
+  vFlagsSet(&wake, MACROS_PLAY);
+  return 1;
+}
+
+void vMacrosStop()
+{
+  if (playing >= 0)
+    vFlagsSet(&wake, MACROS_STOP);
+}
+
+int iMacrosPlaying()
+{
+  return playing;
+}
+
+// Steps of one run, 0 once stopped
+static int prvMacrosRun(const macro_t* macro_, const char* tag_,
+                        portTickType* last_)
+{
+  for (int pos = 0; pos < macro_->size; )
+  {
+    const char* cmd = (const char*)&macro_->data[pos + 2];
+    const portTickType delay =
+      MS_TO_TICKS(macro_->data[pos] | macro_->data[pos + 1] << 8);
+    const portTickType now = xTaskGetTickCount();
+
+    pos += 2 + strlen(cmd) + 1;
+    // From the last step, late or not: no drift over the runs
+    *last_ += delay;
+    if ((int32_t)(*last_ - now) > 0 &&
+        uFlagsWait(&wake, MACROS_STOP, FLAGS_ANY, *last_ - now))
+      return 0;
+    if (uFlagsWait(&wake, MACROS_STOP, FLAGS_ANY, 0))
+      return 0;
+    if (cmd[0])
+      vInterpreterRun(cmd, tag_);
+  }
+  return 1;
+}
+
+static void vMacrosTask(void* pvParameters_)
+{
+  char tag[6] = "@0 ";
+  portTickType last;
+
+  vSysmonRegisterTask("macrod");
+
+  for (;;)
+  {
+    uFlagsWait(&wake, MACROS_PLAY, FLAGS_ANY, portMAX_DELAY);
+
+    tag[1] = '0' + playing;
+    last = xTaskGetTickCount();
+    for (int run = 0; !playTimes || run < playTimes; run++)
+      if (!prvMacrosRun(&macros[playing], tag, &last))
+        break;
+    playing = -1;
+  }
+}
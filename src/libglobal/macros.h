@@ -0,0 +1,59 @@
+#ifndef MACROS_H
+# define MACROS_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "libglobal/interpreter.h"
+
+// Console command sequences recorded into RAM slots and played by the
+// "macrod" daemon, without the host: each step a command and the delay
+// before it. The delays run from the start of the step before, at the
+// tick, whatever the commands take; the commands go through the
+// interpreter (vInterpreterRun), in turn with the console ones, their
+// replies tagged "@<slot> ".
+#ifndef MACROS_NB
+# define MACROS_NB 4
+#endif
+// Bytes of a slot: per step, 2 for the delay then the command and its NUL
+#ifndef MACROS_SIZE
+# define MACROS_SIZE 128
+#endif
+
+// Daemon stack, in words: the command handlers run on it
+#ifndef MACROS_STACK_SIZE
+# define MACROS_STACK_SIZE INTERPRETER_STACK_SIZE
+#endif
+
+typedef struct
+{
+  uint8_t steps;
+  uint16_t size;         // Bytes used
+  uint32_t duration_ms;  // Of one run, the delays
+} macro_info_t;
+
+void vMacrosInit(unsigned portBASE_TYPE daemonPriority_);
+
+// Recording, from the interpreter task: the slot is emptied, then the
+// commands appended in turn. 0 on a bad slot or while it plays.
+int xMacrosRecord(int slot_);
+// The slot being recorded, -1 when none
+int iMacrosRecording();
+// 0 when the slot is full, the step is left out
+int xMacrosAppend(const char* cmd_);
+// Delay before the next step, 0 when the slot is full
+int xMacrosWait(uint16_t ms_);
+// Returns the steps recorded
+int iMacrosEnd();
+
+// times_ runs, 0 until stopped. 0 on a bad or empty slot, one being
+// recorded, another playing, or 0 times without any delay.
+int xMacrosPlay(int slot_, int times_);
+// At the next step, or in the middle of a delay
+void vMacrosStop();
+// The slot playing, -1 when none
+int iMacrosPlaying();
+
+void vMacrosGetInfo(int slot_, macro_info_t* info_);
+
+#endif
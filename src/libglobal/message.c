@@ -0,0 +1,54 @@
+#include <stdarg.h>
+
+#include "libglobal/format.h"
+#include "libglobal/message.h"
+#include "libglobal/strutils.h"
+
+#include "libperiph/link.h"
+
+void vMessagePutc(message_t* msg_, char c_)
+{
+  if (msg_->size == MESSAGE_SIZE)
+    vMessageSend(msg_);
+  msg_->data[msg_->size++] = c_;
+}
+
+void vMessageWrite(message_t* msg_, const char* s_, int size_)
+{
+  while (size_--)
+    vMessagePutc(msg_, *s_++);
+}
+
+void vMessagePuts(message_t* msg_, const char* s_)
+{
+  while (*s_)
+    vMessagePutc(msg_, *s_++);
+}
+
+void vMessagePutInt(message_t* msg_, int value_)
+{
+  char buffer[12];
+
+  vMessageWrite(msg_, buffer, itoa_len(value_, buffer));
+}
+
+static void prvMessageFormatPutc(void* ctx_, char c_)
+{
+  vMessagePutc((message_t*)ctx_, c_);
+}
+
+void vMessagePrintf(message_t* msg_, const char* fmt_, ...)
+{
+  va_list args;
+
+  va_start(args, fmt_);
+  iFormat(prvMessageFormatPutc, msg_, fmt_, args);
+  va_end(args);
+}
+
+void vMessageSend(message_t* msg_)
+{
+  if (msg_->size)
+    vLinkSendMessage(msg_->data, msg_->size);
+  msg_->size = 0;
+}
@@ -0,0 +1,24 @@
+#ifndef MESSAGE_H
+# define MESSAGE_H
+
+// Output built by a task in its own buffer and submitted whole to the
+// host link, so that concurrent writers never interleave within a message
+#define MESSAGE_SIZE 64
+
+typedef struct
+{
+  int size;
+  char data[MESSAGE_SIZE];
+} message_t;
+
+void vMessagePutc(message_t* msg_, char c_);
+void vMessageWrite(message_t* msg_, const char* s_, int size_);
+void vMessagePuts(message_t* msg_, const char* s_);
+void vMessagePutInt(message_t* msg_, int value_);
+// Format straight into the message, see iFormat
+void vMessagePrintf(message_t* msg_, const char* fmt_, ...);
+// Submit and empty the message. A full message is submitted on its own
+// before more is appended.
+void vMessageSend(message_t* msg_);
+
+#endif
@@ -0,0 +1,101 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/odometry.h"
+#include "libglobal/trig.h"
+
+#include "libperiph/imu.h"
+
+// Angles are binary: a full turn is 2^32, so they wrap around for free
+#define MRAD_PER_TURN 6283
+
+// (2^32 / 2pi) / track in um, with 8 fractional bits
+#define ANGLE_PER_UM_Q8 ((int64_t)((4294967296.0 / 6.283185307 * 256) / \
+                                   (ODOMETRY_TRACK_MM * 1000)))
+
+// Position in um, headings as binary angles. Only written by the motors
+// daemon, or by the setters in a critical section.
+static int32_t x_um;
+static int32_t y_um;
+static uint32_t theta;        // Fused
+static uint32_t thetaWheels;  // From the encoders only
+
+// Gyro yaw at the previous period, valid while gyro is set
+static uint32_t lastYaw;
+static uint8_t gyro;
+
+void vOdometryUpdate(int counts_left_, int counts_right_)
+{
+  const int32_t left = counts_left_ * ODOMETRY_UM_PER_COUNT;
+  const int32_t right = counts_right_ * ODOMETRY_UM_PER_COUNT;
+  const int32_t distance = (left + right) / 2;
+  const int32_t dthetaWheels = (int32_t)(((int64_t)(right - left) *
+                                          ANGLE_PER_UM_Q8) >> 8);
+  int32_t dtheta = dthetaWheels;
+
+  // Complementary filter: gyro rate, wheels heading at low frequency
+  if (iImuIsReady())
+  {
+    const uint32_t yaw = uImuGetYaw();
+    if (gyro)
+      dtheta = (int32_t)(yaw - lastYaw) +
+        ((int32_t)(thetaWheels + dthetaWheels - theta) >> ODOMETRY_FUSION_SHIFT);
+    lastYaw = yaw;
+    gyro = 1;
+  }
+  else
+    gyro = 0;
+
+  // Midpoint heading over the period
+  const uint32_t heading = theta + dtheta / 2;
+  const int32_t dx = (distance * iTrigCos(heading)) >> 15;
+  const int32_t dy = (distance * iTrigSin(heading)) >> 15;
+
+  taskENTER_CRITICAL();
+  x_um += dx;
+  y_um += dy;
+  theta += dtheta;
+  thetaWheels += dthetaWheels;
+  taskEXIT_CRITICAL();
+}
+
+void vOdometryGetPose(pose_t* pose_)
+{
+  int32_t x, y;
+  uint32_t t;
+
+  taskENTER_CRITICAL();
+  x = x_um;
+  y = y_um;
+  t = theta;
+  taskEXIT_CRITICAL();
+
+  pose_->x_mm = x / 1000;
+  pose_->y_mm = y / 1000;
+  pose_->theta_mrad = ((int64_t)(int32_t)t * MRAD_PER_TURN) >> 32;
+}
+
+uint32_t uOdometryGetHeading()
+{
+  return theta;
+}
+
+void vOdometrySetPose(const pose_t* pose_)
+{
+  const uint32_t t = (uint32_t)(((int64_t)pose_->theta_mrad << 32) /
+                                MRAD_PER_TURN);
+
+  taskENTER_CRITICAL();
+  x_um = pose_->x_mm * 1000;
+  y_um = pose_->y_mm * 1000;
+  theta = t;
+  thetaWheels = t;
+  taskEXIT_CRITICAL();
+}
+
+void vOdometryReset()
+{
+  const pose_t origin = { 0, 0, 0 };
+
+  vOdometrySetPose(&origin);
+}
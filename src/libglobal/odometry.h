@@ -0,0 +1,31 @@
+#ifndef ODOMETRY_H
+# define ODOMETRY_H
+
+#include <stdint.h>
+
+// Wheel travel per encoder count (um) and distance between wheels (mm)
+#define ODOMETRY_UM_PER_COUNT 150
+#define ODOMETRY_TRACK_MM     230
+
+// With the gyro, the heading follows its rate and is pulled towards the
+// wheels heading by 1/2^shift of the gap each period (about 1.3 s time
+// constant), which cancels the gyro drift
+#define ODOMETRY_FUSION_SHIFT 8
+
+typedef struct
+{
+  int32_t x_mm;
+  int32_t y_mm;
+  int16_t theta_mrad; // -3141 .. 3141, 0 along x, gyro aided
+} pose_t;
+
+// Integrate one control period, from the motors daemon only
+void vOdometryUpdate(int counts_left_, int counts_right_);
+
+void vOdometryGetPose(pose_t* pose_);
+// Fused heading of the pose, as a binary angle (libglobal/trig.h)
+uint32_t uOdometryGetHeading();
+void vOdometrySetPose(const pose_t* pose_);
+void vOdometryReset();
+
+#endif
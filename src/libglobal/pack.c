@@ -0,0 +1,80 @@
+#include <stddef.h>
+
+#include "libglobal/pack.h"
+
+// Mask byte and fields, 5 bytes at most for a varint of 32 bits
+#define PACK_RECORD_MAX (1 + 5 * PROTO_DUMP_FIELDS_MAX)
+
+#if PACK_RECORD_MAX > PROTO_MAX_PAYLOAD
+# error "A record must fit in a frame"
+#endif
+
+static uint8_t* prvPackVarint(uint8_t* out_, uint32_t delta_)
+{
+  // Zigzag: the small changes of either sign in the low bits
+  uint32_t u = (delta_ << 1) ^ (uint32_t)((int32_t)delta_ >> 31);
+
+  while (u >= 0x80)
+  {
+    *out_++ = (u & 0x7f) | 0x80;
+    u >>= 7;
+  }
+  *out_++ = u;
+  return out_;
+}
+
+void vPackInit(pack_t* pack_, int fields_nb_, uint8_t flags_)
+{
+  pack_->fields_nb = fields_nb_;
+  pack_->flags = flags_;
+  pack_->size = 0;
+  for (int i = 0; i < PROTO_DUMP_FIELDS_MAX; i++)
+    pack_->last[i] = 0;
+}
+
+void vPackRecord(pack_t* pack_, const int32_t* values_)
+{
+  uint8_t record[PACK_RECORD_MAX];
+  uint8_t* out = record;
+  uint8_t mask = 0, bit = 1;
+  int size;
+
+  if (pack_->flags)
+    out++;
+  for (int i = 0; i < pack_->fields_nb; i++)
+  {
+    const uint32_t delta = (uint32_t)values_[i] - pack_->last[i];
+
+    if (pack_->flags & (1 << i))
+    {
+      // Left out when unchanged, the mask tells
+      const uint8_t changed = delta ? bit : 0;
+
+      bit <<= 1;
+      if (!changed)
+        continue;
+      mask |= changed;
+    }
+    out = prvPackVarint(out, delta);
+    pack_->last[i] = values_[i];
+  }
+  if (pack_->flags)
+    record[0] = mask;
+
+  size = out - record;
+  if (pack_->size + size > PROTO_MAX_PAYLOAD)
+  {
+    vProtoSend(PROTO_DUMP, pack_->payload, pack_->size);
+    pack_->size = 0;
+  }
+  for (int i = 0; i < size; i++)
+    pack_->payload[pack_->size++] = record[i];
+}
+
+void vPackEnd(pack_t* pack_)
+{
+  if (pack_->size)
+    vProtoSend(PROTO_DUMP, pack_->payload, pack_->size);
+  vProtoSend(PROTO_DUMP, NULL, 0);
+  pack_->size = 0;
+}
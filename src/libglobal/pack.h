@@ -0,0 +1,28 @@
+#ifndef PACK_H
+# define PACK_H
+
+#include <stdint.h>
+
+#include "libglobal/protocol.h"
+
+// Encoder of the PROTO_DUMP records (libglobal/protocol.h): the records
+// go out as the frames fill up. Clock ticks and slowly varying readings
+// take a byte or two a field instead of their full width, repeated flags
+// nothing but their bit of the mask.
+typedef struct
+{
+  uint8_t fields_nb;
+  uint8_t flags;                         // Mask of the flag fields
+  uint8_t size;                          // Of the frame being filled
+  uint32_t last[PROTO_DUMP_FIELDS_MAX];
+  uint8_t payload[PROTO_MAX_PAYLOAD];
+} pack_t;
+
+// Up to PROTO_DUMP_FIELDS_MAX fields
+void vPackInit(pack_t* pack_, int fields_nb_, uint8_t flags_);
+// The fields of one record, in the order of the source
+void vPackRecord(pack_t* pack_, const int32_t* values_);
+// Send the last frame, then the empty one that ends the dump
+void vPackEnd(pack_t* pack_);
+
+#endif
@@ -0,0 +1,255 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/assert_param.h"
+#include "libglobal/params.h"
+
+#include "libperiph/flash.h"
+
+// Tells a valid page header from an erased or torn one
+#define PARAMS_MAGIC  0x9A7A3E7E
+#define PARAMS_ERASED 0xFFFFFFFF
+
+// PARAMS region, from the linker script: two pages
+extern const uint8_t _sparams[];
+
+typedef struct
+{
+  uint32_t sequence;
+  uint32_t magic;    // Programmed last: the entries are complete
+} params_page_t;
+
+typedef struct
+{
+  int32_t value;
+  uint16_t key;      // Programmed after the value, with its complement
+  uint16_t check;
+} params_entry_t;
+
+#define PARAMS_ENTRIES \
+  ((FLASH_PAGE_SIZE - sizeof (params_page_t)) / sizeof (params_entry_t))
+
+static const param_t* params;
+static int n_params;
+static int32_t values[PARAMS_MAX];
+
+// Journal position: no page before the first save
+static int page = -1;
+static int slot;
+static uint32_t sequence;
+
+static const params_page_t* prvParamsPage(int page_)
+{
+  return (const params_page_t*)(_sparams + page_ * FLASH_PAGE_SIZE);
+}
+
+static const params_entry_t* prvParamsEntry(int page_, int slot_)
+{
+  return (const params_entry_t*)(prvParamsPage(page_) + 1) + slot_;
+}
+
+// Binary search, the table is sorted by key
+static int prvParamsIndex(uint16_t key_)
+{
+  int low = 0;
+  int high = n_params - 1;
+
+  while (low <= high)
+  {
+    const int mid = (low + high) / 2;
+    if (params[mid].key == key_)
+      return mid;
+    if (params[mid].key < key_)
+      low = mid + 1;
+    else
+      high = mid - 1;
+  }
+  return -1;
+}
+
+static int prvParamsIsValid(int index_, int32_t value_)
+{
+  return value_ >= params[index_].min && value_ <= params[index_].max;
+}
+
+static void prvParamsApply(int index_)
+{
+  if (params[index_].apply)
+    params[index_].apply(values[index_]);
+}
+
+// Replay the newest page, stops at the first erased entry. Entries of
+// unknown keys (removed parameters) or out of range are skipped.
+static void prvParamsLoad()
+{
+  for (int p = 0; p < 2; p++)
+  {
+    const params_page_t* header = prvParamsPage(p);
+    if (header->magic == PARAMS_MAGIC &&
+        (page < 0 || header->sequence > sequence))
+    {
+      page = p;
+      sequence = header->sequence;
+    }
+  }
+  if (page < 0)
+    return;
+
+  for (slot = 0; slot < PARAMS_ENTRIES; slot++)
+  {
+    const params_entry_t* entry = prvParamsEntry(page, slot);
+    const uint32_t* words = (const uint32_t*)entry;
+
+    if (words[0] == PARAMS_ERASED && words[1] == PARAMS_ERASED)
+      break;
+    if (entry->check != (uint16_t)~entry->key)
+      continue;
+
+    const int index = prvParamsIndex(entry->key);
+    if (index >= 0 && prvParamsIsValid(index, entry->value))
+      values[index] = entry->value;
+  }
+}
+
+static void prvParamsAppend(int page_, int index_)
+{
+  const params_entry_t entry =
+    {
+      .value = values[index_],
+      .key   = params[index_].key,
+      .check = ~params[index_].key,
+    };
+
+  vFlashProgram((uint32_t)prvParamsEntry(page_, slot),
+                (const uint32_t*)&entry, sizeof (entry) / 4);
+  slot++;
+}
+
+// The values apart from the defaults into the other page, then its
+// header: until then the load still finds the current page
+static void prvParamsCompact()
+{
+  const int next = page < 0 ? 0 : !page;
+  const params_page_t header =
+    {
+      .sequence = sequence + 1,
+      .magic    = PARAMS_MAGIC,
+    };
+
+  vFlashErasePage((uint32_t)prvParamsPage(next));
+  slot = 0;
+  for (int i = 0; i < n_params; i++)
+    if (values[i] != params[i].def)
+      prvParamsAppend(next, i);
+  vFlashProgram((uint32_t)prvParamsPage(next), (const uint32_t*)&header,
+                sizeof (header) / 4);
+
+  page = next;
+  sequence++;
+}
+
+void vParamsInit(const param_t* params_, int n_)
+{
+  assert_param(n_ <= PARAMS_MAX);
+  for (int i = 1; i < n_; i++)
+    assert_param(params_[i - 1].key < params_[i].key);
+
+  params = params_;
+  n_params = n_;
+  for (int i = 0; i < n_params; i++)
+    values[i] = params[i].def;
+
+  prvParamsLoad();
+
+  for (int i = 0; i < n_params; i++)
+    prvParamsApply(i);
+}
+
+const param_t* pxParamsFind(uint16_t key_)
+{
+  const int index = prvParamsIndex(key_);
+
+  return index < 0 ? NULL : &params[index];
+}
+
+int32_t xParamsGet(uint16_t key_)
+{
+  const int index = prvParamsIndex(key_);
+
+  return index < 0 ? 0 : values[index];
+}
+
+int iParamsSet(uint16_t key_, int32_t value_)
+{
+  const int index = prvParamsIndex(key_);
+
+  if (index < 0 || !prvParamsIsValid(index, value_))
+    return 0;
+
+  if (values[index] != value_)
+  {
+    values[index] = value_;
+    // The compaction saves the new value with the others
+    if (page < 0 || slot == PARAMS_ENTRIES)
+      prvParamsCompact();
+    else
+      prvParamsAppend(page, index);
+  }
+
+  prvParamsApply(index);
+  return 1;
+}
+
+int iParamsSetBatch(const uint16_t* keys_, const int32_t* values_, int n_)
+{
+  int8_t indexes[PARAMS_MAX];
+  uint32_t dirty = 0;
+  int changed = 0;
+
+  if (n_ > PARAMS_MAX)
+    return 0;
+  for (int i = 0; i < n_; i++)
+  {
+    indexes[i] = prvParamsIndex(keys_[i]);
+    if (indexes[i] < 0 || !prvParamsIsValid(indexes[i], values_[i]))
+      return 0;
+  }
+
+  for (int i = 0; i < n_; i++)
+    if (values[indexes[i]] != values_[i])
+    {
+      values[indexes[i]] = values_[i];
+      dirty |= 1u << i;
+      changed++;
+    }
+  // All saved by a compaction when they do not fit in the page. A key
+  // given twice is saved as it stands after the batch, the last one wins.
+  if (changed && (page < 0 || slot + changed > PARAMS_ENTRIES))
+    prvParamsCompact();
+  else
+    for (int i = 0; i < n_; i++)
+      if (dirty & (1u << i))
+        prvParamsAppend(page, indexes[i]);
+
+  // The apply functions of a group read all its values: each one sees
+  // the batch complete
+  vTaskSuspendAll();
+  for (int i = 0; i < n_; i++)
+    prvParamsApply(indexes[i]);
+  xTaskResumeAll();
+  return 1;
+}
+
+void vParamsReset()
+{
+  for (int p = 0; p < 2; p++)
+    vFlashErasePage((uint32_t)prvParamsPage(p));
+  page = -1;
+  sequence = 0;
+
+  for (int i = 0; i < n_params; i++)
+  {
+    values[i] = params[i].def;
+    prvParamsApply(i);
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef PARAMS_H
+# define PARAMS_H
+
+#include <stdint.h>
+
+// Tuning parameters, kept in the PARAMS flash region (see the linker
+// script) instead of compile time constants. The application gives the
+// table; each value is range checked then handed to its apply function,
+// which stores it where the hot path reads it (the module setters, plain
+// RAM variables), at the load and at each change.
+//
+// Two pages are used in turn as a journal: each change appends a (key,
+// value) entry to the current page and the load replays them in one
+// pass, the last one wins. A full page is compacted into the other one,
+// its header completed last: a reset at any point leaves a whole page.
+#define PARAMS_MAX 48
+
+typedef void (*pfunParamApply)(int32_t value_);
+
+typedef struct
+{
+  uint16_t key;          // Saved in the flash: never reuse one
+  const char* name;
+  int32_t def;
+  int32_t min;
+  int32_t max;
+  pfunParamApply apply;  // May be NULL
+} param_t;
+
+// Load and apply all the parameters, once the modules are initialized.
+// The table must be sorted by key and stay valid, it is not copied.
+void vParamsInit(const param_t* params_, int n_);
+
+// NULL for an unknown key
+const param_t* pxParamsFind(uint16_t key_);
+// Current value, 0 for an unknown key
+int32_t xParamsGet(uint16_t key_);
+
+// Save and apply, from one task at a time. Returns 0 for an unknown key
+// or a value out of range. A compaction erases a page, see
+// libperiph/flash.h.
+int iParamsSet(uint16_t key_, int32_t value_);
+// The same for n_ values at once: all of them checked before any is
+// saved, then applied with the scheduler suspended, the tasks that read
+// them see either none or all. Returns 0, nothing changed, for an
+// unknown key, a value out of range or more than PARAMS_MAX values.
+int iParamsSetBatch(const uint16_t* keys_, const int32_t* values_, int n_);
+// Back to the defaults, both pages erased
+void vParamsReset();
+
+#endif
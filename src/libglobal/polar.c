@@ -0,0 +1,168 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/odometry.h"
+#include "libglobal/polar.h"
+#include "libglobal/trig.h"
+
+#include "libperiph/periodic.h"
+#include "libperiph/sharps.h"
+#include "libperiph/sonar.h"
+
+#if POLAR_SECTORS != PROTO_POLAR_SECTORS
+# error "the PROTO_POLAR frame carries POLAR_SECTORS"
+#endif
+
+#define SECTOR_ANGLE ((uint32_t)(0x100000000ull / POLAR_SECTORS))
+#define DECAY_STEPS  (POLAR_DECAY_MS / POLAR_PERIOD_MS)
+
+// Farthest distances the sensors see: a measure out of range only clears
+// the nearer sectors
+#define SONAR_RANGE_MM 4000
+#define SHARP_RANGE_MM 400
+
+typedef struct
+{
+  int32_t dist_mm;
+  uint8_t certainty;
+} sector_t;
+
+static periodic_t update;
+
+// By sector of the floor, only used by the job
+static sector_t sectors[POLAR_SECTORS];
+static portTickType sonarTicks[SONARS_NB];
+static int32_t lastX, lastY;
+static int decay;
+// Published by the job, -1 when empty
+static volatile int16_t nearest[POLAR_SECTORS];
+
+static const uint32_t sonarBearings[SONARS_NB] =
+  {
+    [SONAR_LEFT]   = TRIG_DEGREES(SONAR_SIDE_ANGLE_DEG),
+    [SONAR_CENTER] = 0,
+    [SONAR_RIGHT]  = TRIG_DEGREES(-SONAR_SIDE_ANGLE_DEG),
+  };
+static const uint32_t sharpBearings[SHARPS_NB] =
+  {
+    [SHARP_LEFT]  = TRIG_DEGREES(SHARPS_MOUNT_ANGLE_DEG),
+    [SHARP_RIGHT] = TRIG_DEGREES(-SHARPS_MOUNT_ANGLE_DEG),
+  };
+
+static void vPolarUpdate();
+
+static int prvSector(uint32_t angle_)
+{
+  return ((angle_ + SECTOR_ANGLE / 2) / SECTOR_ANGLE) % POLAR_SECTORS;
+}
+
+void vPolarInit()
+{
+  pose_t pose;
+
+  for (int s = 0; s < POLAR_SECTORS; s++)
+    nearest[s] = -1;
+  vOdometryGetPose(&pose);
+  lastX = pose.x_mm;
+  lastY = pose.y_mm;
+  vPeriodicInit(&update, "polar", &vPolarUpdate);
+  vPeriodicSetPeriod(&update, POLAR_PERIOD_MS);
+}
+
+// A measure along angle_ of the floor: a hit at dist_mm_, or nothing up
+// to range_mm_ when negative
+static void prvPolarMeasure(uint32_t angle_, int dist_mm_, int range_mm_)
+{
+  sector_t* sector = &sectors[prvSector(angle_)];
+
+  if (dist_mm_ >= 0)
+  {
+    // The latest hit places the obstacle
+    sector->dist_mm = dist_mm_;
+    sector->certainty = sector->certainty + POLAR_HIT > POLAR_CERTAINTY_MAX ?
+      POLAR_CERTAINTY_MAX : sector->certainty + POLAR_HIT;
+  }
+  else if (sector->dist_mm <= range_mm_)
+    sector->certainty = sector->certainty > POLAR_HIT ?
+      sector->certainty - POLAR_HIT : 0;
+}
+
+// Periodic job, from the timer service task
+static void vPolarUpdate()
+{
+  const uint32_t heading = uOdometryGetHeading();
+  pose_t pose;
+
+  // Translation since the last period: obstacles ahead of the motion
+  // come closer by its projection on their direction
+  vOdometryGetPose(&pose);
+  const int32_t dx = pose.x_mm - lastX;
+  const int32_t dy = pose.y_mm - lastY;
+  lastX = pose.x_mm;
+  lastY = pose.y_mm;
+
+  if (++decay == DECAY_STEPS)
+    decay = 0;
+  for (int s = 0; s < POLAR_SECTORS; s++)
+  {
+    sector_t* sector = &sectors[s];
+    if (!sector->certainty)
+      continue;
+    if (dx || dy)
+    {
+      const uint32_t angle = s * SECTOR_ANGLE;
+      sector->dist_mm -= (dx * iTrigCos(angle) + dy * iTrigSin(angle)) >> 15;
+      if (sector->dist_mm < 0)
+        sector->dist_mm = 0;
+    }
+    if (!decay)
+      sector->certainty--;
+  }
+
+  // New sonar measures, the sharps at each period
+  for (int i = 0; i < SONARS_NB; i++)
+  {
+    sonar_measure_t measure;
+    vSonarGetMeasure(i, &measure);
+    if (measure.tick == sonarTicks[i])
+      continue;
+    sonarTicks[i] = measure.tick;
+    prvPolarMeasure(heading + sonarBearings[i],
+                    measure.valid ? measure.dist_mm : -1, SONAR_RANGE_MM);
+  }
+  for (int i = 0; i < SHARPS_NB; i++)
+    prvPolarMeasure(heading + sharpBearings[i], iSharpsMeasureDistMm(i),
+                    SHARP_RANGE_MM);
+
+  for (int s = 0; s < POLAR_SECTORS; s++)
+    nearest[s] = sectors[s].certainty ? sectors[s].dist_mm : -1;
+}
+
+int iPolarNearestMm(uint32_t bearing_)
+{
+  return nearest[prvSector(uOdometryGetHeading() + bearing_)];
+}
+
+int iPolarSectorMm(int sector_)
+{
+  return nearest[(prvSector(uOdometryGetHeading()) + sector_) % POLAR_SECTORS];
+}
+
+void vPolarGetFrame(proto_polar_t* frame_)
+{
+  const uint32_t heading = uOdometryGetHeading();
+  const int first = prvSector(heading);
+  pose_t pose;
+
+  vOdometryGetPose(&pose);
+  frame_->tick = xTaskGetTickCount();
+  // Sector 0 is centred on the heading rounded to a sector
+  frame_->theta_mrad = pose.theta_mrad;
+  for (int s = 0; s < POLAR_SECTORS; s++)
+  {
+    const int mm = nearest[(first + s) % POLAR_SECTORS];
+    const int units = mm / PROTO_POLAR_UNIT_MM;
+    frame_->sectors[s] = mm < 0 ? PROTO_POLAR_EMPTY :
+      units >= PROTO_POLAR_EMPTY ? PROTO_POLAR_EMPTY - 1 : units;
+  }
+}
@@ -0,0 +1,35 @@
+#ifndef POLAR_H
+# define POLAR_H
+
+#include <stdint.h>
+
+#include "libglobal/protocol.h"
+
+// Polar obstacle histogram: the nearest obstacle in each sector around
+// the robot, from the sonars and the sharps. A periodic job adds the
+// latest measures, moves the distances with the odometry and lowers the
+// certainty of each sector over time. The sectors are kept in the frame
+// of the floor, indexed by the heading: a turn rotates them for free.
+#define POLAR_SECTORS   16  // Power of two, sector 0 centred on the heading
+#define POLAR_PERIOD_MS 20
+
+// Certainty of a sector: raised by each hit up to the maximum, lowered by
+// each measure that sees through it and by one every POLAR_DECAY_MS. The
+// sector is empty at 0.
+#define POLAR_CERTAINTY_MAX 15
+#define POLAR_HIT           3
+#define POLAR_DECAY_MS      100
+
+void vPolarInit();
+
+// Nearest obstacle (mm from the edge of the robot) in the sector of
+// bearing_, a binary angle counterclockwise from the heading; -1 when
+// empty
+int iPolarNearestMm(uint32_t bearing_);
+// Same, by sector, 0 ahead then counterclockwise
+int iPolarSectorMm(int sector_);
+
+// The histogram in the frame of the robot, for PROTO_POLAR
+void vPolarGetFrame(proto_polar_t* frame_);
+
+#endif
@@ -0,0 +1,141 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/assert_param.h"
+#include "libglobal/fault.h"
+#include "libglobal/pool.h"
+
+// By block size
+static pool_t* pools[POOL_MAX];
+static int poolsNb;
+
+void vPoolInit(pool_t* pool_, const char* name_, size_t block_size_,
+               int blocks_nb_)
+{
+  const size_t size =
+    (block_size_ + portBYTE_ALIGNMENT - 1) & ~(size_t)portBYTE_ALIGNMENT_MASK;
+  int i;
+
+  if (poolsNb == POOL_MAX)
+    vFaultAllocation(name_);
+  pool_->name = name_;
+  pool_->block_size = size;
+  pool_->blocks_nb = blocks_nb_;
+  pool_->start = pvPortMalloc(size * blocks_nb_);
+  if (!pool_->start)
+    vFaultAllocation(name_);
+
+  pool_->free = NULL;
+  for (i = blocks_nb_ - 1; i >= 0; i--)
+  {
+    pool_block_t* block = (pool_block_t*)(pool_->start + i * size);
+    block->next = pool_->free;
+    pool_->free = block;
+  }
+
+  for (i = poolsNb++; i > 0 && pools[i - 1]->block_size > size; i--)
+    pools[i] = pools[i - 1];
+  pools[i] = pool_;
+}
+
+// Interrupts masked
+static void* prvPoolAlloc(size_t size_)
+{
+  pool_t* fitting = NULL;
+
+  for (int i = 0; i < poolsNb; i++)
+  {
+    pool_t* pool = pools[i];
+    pool_block_t* block = pool->free;
+
+    if (pool->block_size < size_)
+      continue;
+    if (!block)
+    {
+      fitting = fitting ? fitting : pool;
+      continue;
+    }
+    pool->free = block->next;
+    if (++pool->used > pool->high_water)
+      pool->high_water = pool->used;
+    return block;
+  }
+  // Counted against the smallest pool that would have done
+  if (fitting)
+    fitting->failures++;
+  return NULL;
+}
+
+static void prvPoolFree(void* block_)
+{
+  uint8_t* const p = block_;
+
+  if (!block_)
+    return;
+  for (int i = 0; i < poolsNb; i++)
+  {
+    pool_t* pool = pools[i];
+
+    if (p < pool->start ||
+        p >= pool->start + pool->block_size * pool->blocks_nb)
+      continue;
+    assert_param((p - pool->start) % pool->block_size == 0 && pool->used);
+    ((pool_block_t*)p)->next = pool->free;
+    pool->free = (pool_block_t*)p;
+    pool->used--;
+    return;
+  }
+  assert_param(0);
+}
+
+void* pvPoolAlloc(size_t size_)
+{
+  void* block;
+
+  taskENTER_CRITICAL();
+  block = prvPoolAlloc(size_);
+  taskEXIT_CRITICAL();
+  return block;
+}
+
+void* pvPoolAllocFromISR(size_t size_)
+{
+  const unsigned portBASE_TYPE mask = portSET_INTERRUPT_MASK_FROM_ISR();
+  void* block = prvPoolAlloc(size_);
+
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+  return block;
+}
+
+void vPoolFree(void* block_)
+{
+  taskENTER_CRITICAL();
+  prvPoolFree(block_);
+  taskEXIT_CRITICAL();
+}
+
+void vPoolFreeFromISR(void* block_)
+{
+  const unsigned portBASE_TYPE mask = portSET_INTERRUPT_MASK_FROM_ISR();
+
+  prvPoolFree(block_);
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+int iPoolGetStats(pool_stats_t* stats_, int n_)
+{
+  int i;
+
+  taskENTER_CRITICAL();
+  for (i = 0; i < poolsNb && i < n_; i++)
+  {
+    stats_[i].name = pools[i]->name;
+    stats_[i].block_size = pools[i]->block_size;
+    stats_[i].blocks_nb = pools[i]->blocks_nb;
+    stats_[i].used = pools[i]->used;
+    stats_[i].high_water = pools[i]->high_water;
+    stats_[i].failures = pools[i]->failures;
+  }
+  taskEXIT_CRITICAL();
+  return i;
+}
@@ -0,0 +1,57 @@
+#ifndef POOL_H
+# define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed size blocks, carved from the kernel heap once at init (heap_1
+// never frees) and recycled: transient buffers share one budget instead
+// of a worst case array each, and go from an interrupt to a task by
+// pointer. Allocation takes the smallest blocks that fit, from the first
+// pool with one free, freeing finds the pool by address: both O(1) in the
+// blocks, under the interrupt mask.
+#define POOL_MAX 4
+
+typedef struct pool_block
+{
+  struct pool_block* next;
+} pool_block_t;
+
+typedef struct pool
+{
+  const char* name;
+  uint8_t* start;        // Of the blocks, contiguous
+  uint16_t block_size;   // Rounded up to portBYTE_ALIGNMENT
+  uint16_t blocks_nb;
+  pool_block_t* free;
+  uint16_t used;
+  uint16_t high_water;
+  uint32_t failures;     // Nothing free for an allocation that fits
+} pool_t;
+
+typedef struct
+{
+  const char* name;
+  uint16_t block_size;
+  uint16_t blocks_nb;
+  uint16_t used;
+  uint16_t high_water;
+  uint32_t failures;
+} pool_stats_t;
+
+// Before the scheduler starts, up to POOL_MAX pools
+void vPoolInit(pool_t* pool_, const char* name_, size_t block_size_,
+               int blocks_nb_);
+
+// NULL when no block of size_ is free. From the interrupts under
+// IRQ_PRIORITY_KERNEL_MAX with the FromISR variants.
+void* pvPoolAlloc(size_t size_);
+void* pvPoolAllocFromISR(size_t size_);
+// Any block of any pool, NULL ignored
+void vPoolFree(void* block_);
+void vPoolFreeFromISR(void* block_);
+
+// Copy up to n_ pools, by block size. Returns the count.
+int iPoolGetStats(pool_stats_t* stats_, int n_);
+
+#endif
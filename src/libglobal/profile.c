@@ -0,0 +1,90 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/profile.h"
+
+#include "libperiph/itm.h"
+
+typedef struct
+{
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  // 32 bits hold 59 s of cycles only
+  uint64_t total;
+} profile_accumulator_t;
+
+static const char* const names[PROFILE_NB] =
+{
+  [PROFILE_USART1_IRQ]  = "usart1",
+  [PROFILE_TIM3_IRQ]    = "tim3",
+  [PROFILE_I2C1_EV_IRQ] = "i2c1ev",
+  [PROFILE_MOTORS_LOOP] = "motors",
+  [PROFILE_SONAR_SLOT]  = "sonar",
+  [PROFILE_TIM2_IRQ]    = "tim2",
+  [PROFILE_ADC_DMA_IRQ] = "adc",
+  [PROFILE_ENCODER_IRQ] = "enc",
+};
+
+static profile_accumulator_t accumulators[PROFILE_NB];
+
+void vProfileInit()
+{
+  vCyclesInit();
+  vProfileReset();
+}
+
+void vProfileRecord(int probe_, uint32_t cycles_)
+{
+  profile_accumulator_t* acc = &accumulators[probe_];
+
+  // Single writer per probe. Readers mask the recording interrupts, a
+  // task probe may still be read halfway through, one sample off.
+  acc->count++;
+  acc->total += cycles_;
+  if (cycles_ < acc->min)
+    acc->min = cycles_;
+  if (cycles_ > acc->max)
+    acc->max = cycles_;
+#ifdef ITM_TRACE
+  // Each sample on SWO as well, for the distributions
+  vItmWrite32(ITM_PORT_PROFILE, (uint32_t)probe_ << 24 |
+              (cycles_ > 0xffffff ? 0xffffff : cycles_));
+#endif
+}
+
+void vProfileGet(profile_probe_t* probes_)
+{
+  profile_accumulator_t acc;
+
+  for (int i = 0; i < PROFILE_NB; i++)
+  {
+    taskENTER_CRITICAL();
+    acc = accumulators[i];
+    taskEXIT_CRITICAL();
+
+    probes_[i].name  = names[i];
+    probes_[i].count = acc.count;
+    probes_[i].min   = acc.count ? acc.min : 0;
+    probes_[i].max   = acc.max;
+    probes_[i].mean  = acc.count ? acc.total / acc.count : 0;
+  }
+}
+
+uint32_t uProfileCycles(int probe_)
+{
+  return accumulators[probe_].total;
+}
+
+void vProfileReset()
+{
+  taskENTER_CRITICAL();
+  for (int i = 0; i < PROFILE_NB; i++)
+  {
+    accumulators[i].count = 0;
+    accumulators[i].min = ~0u;
+    accumulators[i].max = 0;
+    accumulators[i].total = 0;
+  }
+  taskEXIT_CRITICAL();
+}
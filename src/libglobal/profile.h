@@ -0,0 +1,52 @@
+#ifndef PROFILE_H
+# define PROFILE_H
+
+#include <stdint.h>
+
+#include "libperiph/cycles.h"
+
+// Cycle counts of the hot paths, between a PROFILE_BEGIN and its
+// PROFILE_END in the same scope. The markers are compiled in when
+// configured with --profile only.
+enum eProfileProbe {
+  PROFILE_USART1_IRQ,
+  PROFILE_TIM3_IRQ,
+  PROFILE_I2C1_EV_IRQ,
+  PROFILE_MOTORS_LOOP, // Control loop, without the wait for the period
+  PROFILE_SONAR_SLOT,  // Processing of the echoes of a slot
+  PROFILE_TIM2_IRQ,    // Each PWM update event, the loop trigger
+  PROFILE_ADC_DMA_IRQ, // Filtering of a half buffer
+  PROFILE_ENCODER_IRQ, // Right wheel edges (EXTI15_10)
+  PROFILE_NB
+};
+
+typedef struct
+{
+  const char* name;
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint32_t mean;
+} profile_probe_t;
+
+#ifdef PROFILE
+# define PROFILE_BEGIN(probe) \
+  const uint32_t profileStart_##probe = uCyclesNow()
+# define PROFILE_END(probe) \
+  vProfileRecord(probe, uCyclesNow() - profileStart_##probe)
+#else
+# define PROFILE_BEGIN(probe)
+# define PROFILE_END(probe)
+#endif
+
+// Start the DWT cycle counter
+void vProfileInit();
+// Each probe is recorded by a single task or interrupt
+void vProfileRecord(int probe_, uint32_t cycles_);
+// Copy the PROFILE_NB probes, from a task
+void vProfileGet(profile_probe_t* probes_);
+// Total cycles of a probe, modulo 2^32, with the kernel interrupts masked
+uint32_t uProfileCycles(int probe_);
+void vProfileReset();
+
+#endif
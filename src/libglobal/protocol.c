@@ -0,0 +1,298 @@
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "protocol.h"
+#include "libperiph/link.h"
+
+enum eDecoderState {
+  DECODE_SYNC,
+  DECODE_ADDR,
+  DECODE_TYPE,
+  DECODE_SIZE,
+  DECODE_PAYLOAD,
+  DECODE_CRC
+};
+
+static volatile uint8_t nodeAddress;
+// Task answering a broadcast, NULL for none
+static volatile xTaskHandle muted;
+
+/* CRC-8, polynomial x^8 + x^2 + x + 1 (0x07) */
+uint8_t uProtoCrc8(uint8_t crc_, const uint8_t* data_, int size_)
+{
+  while (size_--)
+  {
+    crc_ ^= *data_++;
+    for (int i = 0; i < 8; i++)
+      crc_ = (crc_ & 0x80) ? (crc_ << 1) ^ 0x07 : crc_ << 1;
+  }
+  return crc_;
+}
+
+void vProtoDecoderReset(proto_decoder_t* dec_)
+{
+  dec_->state = DECODE_SYNC;
+}
+
+int iProtoDecode(proto_decoder_t* dec_, uint8_t c_)
+{
+  switch (dec_->state)
+  {
+    case DECODE_SYNC:
+      dec_->addressed = c_ == PROTO_SYNC_ADDR;
+      if (c_ == PROTO_SYNC)
+        dec_->state = DECODE_TYPE;
+      else if (c_ == PROTO_SYNC_ADDR)
+        dec_->state = DECODE_ADDR;
+      break;
+
+    case DECODE_ADDR:
+      dec_->address = c_;
+      dec_->state = DECODE_TYPE;
+      break;
+
+    case DECODE_TYPE:
+      dec_->type = c_;
+      dec_->crc = uProtoCrc8(dec_->addressed ?
+                             uProtoCrc8(0, &dec_->address, 1) : 0, &c_, 1);
+      dec_->state = DECODE_SIZE;
+      break;
+
+    case DECODE_SIZE:
+      if (c_ > PROTO_MAX_PAYLOAD)
+      {
+        dec_->state = DECODE_SYNC;
+        return -1;
+      }
+      dec_->size = c_;
+      dec_->pos = 0;
+      dec_->crc = uProtoCrc8(dec_->crc, &c_, 1);
+      dec_->state = c_ ? DECODE_PAYLOAD : DECODE_CRC;
+      break;
+
+    case DECODE_PAYLOAD:
+      dec_->payload[dec_->pos++] = c_;
+      if (dec_->pos == dec_->size)
+      {
+        dec_->crc = uProtoCrc8(dec_->crc, dec_->payload, dec_->size);
+        dec_->state = DECODE_CRC;
+      }
+      break;
+
+    case DECODE_CRC:
+      dec_->state = DECODE_SYNC;
+      return (c_ == dec_->crc) ? 1 : -1;
+  }
+
+  return 0;
+}
+
+void vProtoSetAddress(uint8_t address_)
+{
+  nodeAddress = address_;
+}
+
+uint8_t uProtoGetAddress()
+{
+  return nodeAddress;
+}
+
+int iProtoIsForUs(const proto_decoder_t* dec_)
+{
+  return !dec_->addressed || dec_->address == PROTO_ADDR_BROADCAST ||
+    (nodeAddress && dec_->address == nodeAddress);
+}
+
+void vProtoMute(int mute_)
+{
+  muted = mute_ ? xTaskGetCurrentTaskHandle() : NULL;
+}
+
+// The address is read once: a frame is either plain or addressed
+static int prvProtoFrame(uint8_t* frame_, uint8_t type_,
+                         const void* payload_, uint8_t size_)
+{
+  const uint8_t address = nodeAddress;
+  uint8_t* header = frame_;
+
+  if (address)
+  {
+    *header++ = PROTO_SYNC_ADDR;
+    *header = address;
+  }
+  else
+    *header = PROTO_SYNC;
+  header[1] = type_;
+  header[2] = size_;
+  memcpy(&header[3], payload_, size_);
+  header[3 + size_] = uProtoCrc8(0, address ? header : &header[1],
+                                 size_ + (address ? 3 : 2));
+  return size_ + (address ? PROTO_OVERHEAD_ADDR : PROTO_OVERHEAD);
+}
+
+void vProtoSend(uint8_t type_, const void* payload_, uint8_t size_)
+{
+  uint8_t frame[PROTO_MAX_PAYLOAD + PROTO_OVERHEAD_ADDR];
+
+  if (muted && muted == xTaskGetCurrentTaskHandle())
+    return;
+  const int size = prvProtoFrame(frame, type_, payload_, size_);
+
+  // Whole frame in a single write, not byte per byte
+  vLinkSendMessage((const char*)frame, size);
+}
+
+int xProtoTrySend(uint8_t type_, const void* payload_, uint8_t size_,
+                  int timeout_ms_)
+{
+  uint8_t frame[PROTO_MAX_PAYLOAD + PROTO_OVERHEAD_ADDR];
+
+  if (muted && muted == xTaskGetCurrentTaskHandle())
+    return 1;
+  const int size = prvProtoFrame(frame, type_, payload_, size_);
+
+  return xLinkTrySendMessage((const char*)frame, size, timeout_ms_);
+}
+
+int xProtoTryStream(uint8_t type_, const void* payload_, uint8_t size_,
+                    int timeout_ms_)
+{
+  uint8_t frame[PROTO_MAX_PAYLOAD + PROTO_OVERHEAD_ADDR];
+  const int size = prvProtoFrame(frame, type_, payload_, size_);
+
+  return xLinkTrySendStream((const char*)frame, size, timeout_ms_);
+}
+
+static void prvProtoPutRaw(proto_writer_t* w_, uint8_t c_)
+{
+  const ring_slot_t* slot = &w_->slot;
+
+  if (w_->pos < slot->size[0])
+    slot->span[0][w_->pos] = c_;
+  else
+    slot->span[1][w_->pos - slot->size[0]] = c_;
+  w_->pos++;
+}
+
+int xProtoStreamBegin(proto_writer_t* w_, uint8_t type_, uint8_t size_,
+                      int timeout_ms_)
+{
+  const uint8_t address = nodeAddress;
+
+  w_->size = size_ + (address ? PROTO_OVERHEAD_ADDR : PROTO_OVERHEAD);
+  if (!xLinkReserveStream(&w_->slot, w_->size, timeout_ms_))
+    return 0;
+
+  w_->pos = 0;
+  w_->crc = 0;
+  prvProtoPutRaw(w_, address ? PROTO_SYNC_ADDR : PROTO_SYNC);
+  if (address)
+    vProtoPut(w_, &address, 1);
+  vProtoPut(w_, &type_, 1);
+  vProtoPut(w_, &size_, 1);
+  return 1;
+}
+
+void vProtoPut(proto_writer_t* w_, const void* data_, uint8_t size_)
+{
+  const uint8_t* data = data_;
+
+  w_->crc = uProtoCrc8(w_->crc, data, size_);
+  while (size_--)
+    prvProtoPutRaw(w_, *data++);
+}
+
+void vProtoStreamEnd(proto_writer_t* w_)
+{
+  prvProtoPutRaw(w_, w_->crc);
+  vLinkCommitStream(w_->size);
+}
+
+#define U8(n_)  PROTO_FIELD(PROTO_FIELD_U8, n_)
+#define I8(n_)  PROTO_FIELD(PROTO_FIELD_I8, n_)
+#define U16(n_) PROTO_FIELD(PROTO_FIELD_U16, n_)
+#define I16(n_) PROTO_FIELD(PROTO_FIELD_I16, n_)
+#define U32(n_) PROTO_FIELD(PROTO_FIELD_U32, n_)
+#define I32(n_) PROTO_FIELD(PROTO_FIELD_I32, n_)
+
+// Kept in step with the structs of protocol.h
+static const uint8_t motorsFields[] = { I16(2) };
+static const uint8_t velocityFields[] = { I16(2) };
+static const uint8_t telemCfgFields[] = { U16(1) };
+static const uint8_t segmentFields[] = { U16(1), I16(2) };
+static const uint8_t dumpReqFields[] = { U8(1), U16(1) };
+static const uint8_t paramFields[] = { U16(1), I32(1) };
+static const uint8_t behaviourFields[] =
+  {
+    U8(2), I16(3),
+    U8(2), U16(1), U8(2), U16(1), U8(2), U16(1), U8(2), U16(1),
+  };
+static const uint8_t vmRunFields[] = { U16(2) };
+static const uint8_t sensorsFields[] = { I16(3) };
+static const uint8_t telemetryFields[] =
+  {
+    U32(1), I16(5), U16(2), U8(1), I16(5), U16(1), U8(1),
+  };
+static const uint8_t eventFields[] = { U32(1), U8(2) };
+static const uint8_t timeFields[] = { U32(3) };
+static const uint8_t polarFields[] =
+  {
+    U32(1), I16(1), U8(PROTO_POLAR_SECTORS),
+  };
+static const uint8_t vmFields[] = { U8(2), U16(3), U32(1) };
+static const uint8_t actuationFields[] =
+  {
+    I16(2), U16(PROTO_ACTUATION_STAGES),
+  };
+static const uint8_t identFields[] = { U32(2), U16(1), U8(1) };
+static const uint8_t capsFields[] = { U16(1), U32(1), U8(2), U32(1), U8(2) };
+static const uint8_t deltaCfgFields[] = { U16(2) };
+static const uint8_t deltaFields[] = { U8(1), U32(1), U16(1) };
+
+#define SCHEMA(type_, flags_, struct_, fields_) \
+  { { 0, type_, flags_, sizeof (struct_) }, fields_, sizeof (fields_) }
+
+static const struct
+{
+  proto_schema_t header;
+  const uint8_t* fields;
+  uint8_t size;
+} schemas[] =
+  {
+    SCHEMA(PROTO_MOTORS_CMD, 0, proto_motors_t, motorsFields),
+    SCHEMA(PROTO_VELOCITY, 0, proto_velocity_t, velocityFields),
+    SCHEMA(PROTO_TELEM_CFG, 0, proto_telem_cfg_t, telemCfgFields),
+    SCHEMA(PROTO_SEGMENTS, PROTO_SCHEMA_ARRAY, proto_segment_t,
+           segmentFields),
+    SCHEMA(PROTO_DUMP_REQ, 0, proto_dump_req_t, dumpReqFields),
+    SCHEMA(PROTO_BEHAVIOUR_SET, 0, proto_behaviour_t, behaviourFields),
+    SCHEMA(PROTO_VM_RUN, 0, proto_vm_run_t, vmRunFields),
+    SCHEMA(PROTO_SENSORS, 0, proto_sensors_t, sensorsFields),
+    SCHEMA(PROTO_TELEMETRY, 0, proto_telemetry_t, telemetryFields),
+    SCHEMA(PROTO_EVENT, 0, proto_event_t, eventFields),
+    SCHEMA(PROTO_TIME, 0, proto_time_t, timeFields),
+    SCHEMA(PROTO_POLAR, 0, proto_polar_t, polarFields),
+    SCHEMA(PROTO_PARAMS, PROTO_SCHEMA_ARRAY, proto_param_t, paramFields),
+    SCHEMA(PROTO_BEHAVIOUR, 0, proto_behaviour_t, behaviourFields),
+    SCHEMA(PROTO_VM, 0, proto_vm_t, vmFields),
+    SCHEMA(PROTO_ACTUATION, 0, proto_actuation_t, actuationFields),
+    SCHEMA(PROTO_IDENT, 0, proto_ident_t, identFields),
+    SCHEMA(PROTO_CAPS, 0, proto_caps_t, capsFields),
+    SCHEMA(PROTO_TELEM_DELTA_CFG, PROTO_SCHEMA_HEAD, proto_telem_delta_cfg_t,
+           deltaCfgFields),
+    SCHEMA(PROTO_TELEMETRY_DELTA, PROTO_SCHEMA_HEAD, proto_telemetry_delta_t,
+           deltaFields),
+  };
+
+int iProtoSchemaCount()
+{
+  return sizeof (schemas) / sizeof (schemas[0]);
+}
+
+int iProtoSchema(int index_, proto_schema_t* header_, const uint8_t** fields_)
+{
+  *header_ = schemas[index_].header;
+  header_->index = index_;
+  *fields_ = schemas[index_].fields;
+  return schemas[index_].size;
+}
@@ -0,0 +1,442 @@
+#ifndef PROTOCOL_H
+# define PROTOCOL_H
+
+#include <stdint.h>
+
+#include "libglobal/ring.h"
+
+// Frame layout: SYNC | type | size | payload[size] | crc8(type, size, payload)
+#define PROTO_SYNC        0xA5
+#define PROTO_MAX_PAYLOAD 32
+#define PROTO_OVERHEAD    4
+
+// Addressed frames, for several boards on one link (multi-drop UART):
+// SYNC_ADDR | address | type | size | payload[size] | crc8(address, type,
+// size, payload). A board takes the ones to its node address and the
+// broadcasts, which it does not answer: the frames it sends carry its own
+// address once it has one. The plain frames are still taken, for a board
+// alone on its link.
+#define PROTO_SYNC_ADDR      0xA6
+#define PROTO_OVERHEAD_ADDR  5
+#define PROTO_ADDR_BROADCAST 0x00
+#define PROTO_ADDR_MAX       0x77 // As the 7-bit I2C addresses
+
+// Frame types, replies from the board have the MSB set
+enum eProtoType {
+  PROTO_ASCII       = 0x00, // Leave binary mode
+  PROTO_MOTORS_CMD  = 0x01, // proto_motors_t
+  PROTO_SENSORS_REQ = 0x02, // No payload, answered by PROTO_SENSORS
+  PROTO_TELEM_CFG   = 0x03, // proto_telem_cfg_t
+  PROTO_SAMPLES_REQ = 0x04, // uint8_t number of samples, answered by PROTO_SAMPLES
+  PROTO_SEGMENTS    = 0x05, // Array of proto_segment_t, empty to clear
+  PROTO_LOG_REQ     = 0x06, // uint16_t number of records, 0 for all, answered by PROTO_LOG
+  PROTO_TIME_REQ    = 0x07, // uint32_t cookie, answered by PROTO_TIME
+  PROTO_ECHO_REQ    = 0x08, // Any payload, sent back in PROTO_ECHO (link benchmark)
+  PROTO_POLAR_REQ   = 0x09, // No payload, answered by PROTO_POLAR
+  PROTO_VELOCITY    = 0x0A, // proto_velocity_t
+  PROTO_DUMP_REQ    = 0x0B, // proto_dump_req_t, answered by PROTO_DUMP
+  PROTO_PARAMS_SET  = 0x0C, // uint8_t flags, then an array of proto_param_t
+  PROTO_PARAMS_REQ  = 0x0D, // Array of uint16_t keys, empty for all,
+                            // answered by PROTO_PARAMS
+  PROTO_BEHAVIOUR_SET = 0x0E, // proto_behaviour_t, a state of the table
+  PROTO_BEHAVIOUR_REQ = 0x0F, // uint8_t state, answered by PROTO_BEHAVIOUR
+  PROTO_BEHAVIOUR_RUN = 0x10, // int8_t state to enter, -1 stops
+  PROTO_VM_LOAD     = 0x11, // uint16_t offset, then code (libglobal/vm.h)
+  PROTO_VM_RUN      = 0x12, // proto_vm_run_t
+  PROTO_VM_REQ      = 0x13, // Empty, answered by PROTO_VM
+  PROTO_ACTUATION_REQ = 0x14, // Empty, answered by PROTO_ACTUATION
+  PROTO_IDENT_REQ   = 0x15, // Empty, answered by PROTO_IDENT
+  PROTO_CAPS_REQ    = 0x16, // Empty, answered by PROTO_CAPS
+  PROTO_SCHEMA_REQ  = 0x17, // uint8_t index, answered by PROTO_SCHEMA
+  PROTO_TELEM_DELTA_CFG = 0x18, // proto_telem_delta_cfg_t, then optionally
+                                // the uint16_t deadbands of the first
+                                // channels (eProtoChannel)
+  PROTO_ACK         = 0x80, // Type of the acknowledged frame
+  PROTO_NACK        = 0x81, // Type of the rejected frame
+  PROTO_SENSORS     = 0x82, // proto_sensors_t
+  PROTO_TELEMETRY   = 0x83, // proto_telemetry_t
+  PROTO_SAMPLES     = 0x84, // Array of sample_t, empty when done
+  PROTO_EVENT       = 0x85, // proto_event_t, sent unsolicited
+  PROTO_LOG         = 0x86, // Array of blackbox_record_t, empty when done
+  PROTO_TIME        = 0x87, // proto_time_t
+  PROTO_ECHO        = 0x88, // The PROTO_ECHO_REQ payload
+  PROTO_POLAR       = 0x89, // proto_polar_t
+  PROTO_DUMP        = 0x8A, // Packed records, empty when done
+  PROTO_PARAMS      = 0x8B, // Array of proto_param_t, empty when done
+  PROTO_BEHAVIOUR   = 0x8C, // proto_behaviour_t
+  PROTO_VM          = 0x8D, // proto_vm_t
+  PROTO_ACTUATION   = 0x8E, // proto_actuation_t
+  PROTO_IDENT       = 0x8F, // proto_ident_t
+  PROTO_CAPS        = 0x90, // proto_caps_t
+  PROTO_SCHEMA      = 0x91, // proto_schema_t then its fields, empty past
+                            // the last index
+  PROTO_TELEMETRY_DELTA = 0x92, // proto_telemetry_delta_t, then the
+                                // int16_t of the channels of its mask
+};
+
+typedef struct
+{
+  int16_t left;  // -1000 .. 1000 (MOTORS_COMMAND_MAX)
+  int16_t right;
+} __attribute__((packed)) proto_motors_t;
+
+typedef struct
+{
+  int16_t v_mm_s;        // Forward
+  int16_t omega_mrad_s;  // Counterclockwise
+} __attribute__((packed)) proto_velocity_t;
+
+typedef struct
+{
+  int16_t sharp_left_mm;
+  int16_t sonar_mm;
+  int16_t sharp_right_mm;
+} __attribute__((packed)) proto_sensors_t;
+
+typedef struct
+{
+  uint16_t duration_ms;
+  int16_t left;
+  int16_t right;
+} __attribute__((packed)) proto_segment_t;
+
+typedef struct
+{
+  uint16_t period_ms; // 0 stops the stream
+} __attribute__((packed)) proto_telem_cfg_t;
+
+typedef struct
+{
+  uint32_t tick;
+  int16_t sharp_left_mm;
+  int16_t sonar_mm;
+  int16_t sharp_right_mm;
+  int16_t motor_left;
+  int16_t motor_right;
+  uint16_t battery_mv;
+  uint16_t current_ma;
+  uint8_t cut_off;   // 1 after an overcurrent, until the fault is reset
+  int16_t x_mm;      // Odometry pose
+  int16_t y_mm;
+  int16_t theta_mrad; // Gyro aided when the IMU is ready
+  int16_t sonar_left_mm;
+  int16_t sonar_right_mm;
+  uint16_t cpu_permille; // Busy time over the last second
+  uint8_t link_errors;   // Host link input errors and drops, wrapping
+} __attribute__((packed)) proto_telemetry_t;
+
+// Report on change: the fields of proto_telemetry_t after its tick, as
+// channels, each sent once it moved beyond its deadband since last sent,
+// and all of them every heartbeat. The unsigned ones go as their int16_t.
+// The last one is the period of the samples as sent, longer than the one
+// set while the link is congested.
+enum eProtoChannel {
+  PROTO_CHANNEL_SHARP_LEFT,
+  PROTO_CHANNEL_SONAR,
+  PROTO_CHANNEL_SHARP_RIGHT,
+  PROTO_CHANNEL_MOTOR_LEFT,
+  PROTO_CHANNEL_MOTOR_RIGHT,
+  PROTO_CHANNEL_BATTERY,
+  PROTO_CHANNEL_CURRENT,
+  PROTO_CHANNEL_CUT_OFF,
+  PROTO_CHANNEL_X,
+  PROTO_CHANNEL_Y,
+  PROTO_CHANNEL_THETA,
+  PROTO_CHANNEL_SONAR_LEFT,
+  PROTO_CHANNEL_SONAR_RIGHT,
+  PROTO_CHANNEL_CPU,
+  PROTO_CHANNEL_LINK_ERRORS,
+  PROTO_CHANNEL_PERIOD,
+  PROTO_CHANNELS_NB
+};
+
+typedef struct
+{
+  uint16_t period_ms;    // Sampling, 0 stops the stream
+  uint16_t heartbeat_ms; // All channels at least this often, 0 back to
+                         // the PROTO_TELEMETRY frames
+} __attribute__((packed)) proto_telem_delta_cfg_t;
+
+// The channels of a sample over as many frames as they take, the same
+// tick in each
+typedef struct
+{
+  uint8_t seq;       // Per frame, wrapping, dropped ones included: a gap
+                     // is a loss
+  uint32_t tick;
+  uint16_t mask;     // Channels that follow, 1 << PROTO_CHANNEL_x
+} __attribute__((packed)) proto_telemetry_delta_t;
+
+#define PROTO_DELTA_CHANNELS_MAX \
+  ((PROTO_MAX_PAYLOAD - sizeof (proto_telemetry_delta_t)) / sizeof (int16_t))
+
+// Clock sync ping: the board time when the request was handled. The
+// host pairs it with its send and receive times (NTP style).
+typedef struct
+{
+  uint32_t cookie;  // From the request
+  uint32_t time_us; // xTimeNowUs
+  uint32_t tick;    // Kernel tick at the same time, to place the tick stamps
+} __attribute__((packed)) proto_time_t;
+
+// Polar obstacle histogram (libglobal/polar.h), in the frame of the
+// robot: sector 0 ahead, then counterclockwise
+#define PROTO_POLAR_SECTORS 16
+#define PROTO_POLAR_UNIT_MM 16   // Unit of the sector distances
+#define PROTO_POLAR_EMPTY   0xff // Nothing seen in the sector
+
+typedef struct
+{
+  uint32_t tick;
+  int16_t theta_mrad;                   // Heading, within sector 0
+  uint8_t sectors[PROTO_POLAR_SECTORS]; // Nearest obstacle, in units
+} __attribute__((packed)) proto_polar_t;
+
+// Bulk dumps, packed: each record is a mask byte, bit i set when the
+// i-th flag field changed, then the fields in order, each one the zigzag
+// varint (7 bits a byte, LSB first) of its change since the previous
+// record, the first from 0. The unchanged flags are left out, and so is
+// the mask when the source has no flag. A frame holds whole records.
+enum eProtoDumpSource {
+  PROTO_DUMP_SAMPLES = 0x00, // tick, value_mm, sensor (flag)
+  PROTO_DUMP_LOG     = 0x01, // tick, value, event, arg (flags)
+  PROTO_DUMP_SYSID   = 0x02, // command, pwm_left, speed_left, speed_right,
+                             // current_ma, of each period (--sysid)
+};
+
+// Fields of each source, and the mask of its flags
+#define PROTO_DUMP_SAMPLES_FIELDS 3
+#define PROTO_DUMP_SAMPLES_FLAGS  0x04
+#define PROTO_DUMP_LOG_FIELDS     4
+#define PROTO_DUMP_LOG_FLAGS      0x0c
+#define PROTO_DUMP_SYSID_FIELDS   5
+#define PROTO_DUMP_SYSID_FLAGS    0x00
+#define PROTO_DUMP_FIELDS_MAX     6
+
+typedef struct
+{
+  uint8_t source;  // eProtoDumpSource
+  uint16_t n;      // The last records, 0 for all
+} __attribute__((packed)) proto_dump_req_t;
+
+// Parameters by key (libglobal/params.h). The PROTO_PARAMS_SET frames
+// with PROTO_PARAMS_MORE are staged without a reply, up to PARAMS_MAX
+// values: the next frame without it checks the whole batch, then saves
+// and applies it in one go, between two periods of the control loops,
+// and is answered by an ACK. A NACK when a key is unknown, a value out
+// of range or the batch too long: none of it is applied.
+#define PROTO_PARAMS_MORE 0x01
+
+typedef struct
+{
+  uint16_t key;
+  int32_t value;
+} __attribute__((packed)) proto_param_t;
+
+// Behaviour engine (libglobal/behaviour.h): a state is an action and the
+// transitions checked in turn at each period, the first one true wins
+// (eBehaviourAction, eBehaviourPredicate in libglobal/behaviour.h)
+#define PROTO_BEHAVIOUR_TRANSITIONS 4
+
+typedef struct
+{
+  uint8_t predicate;
+  uint8_t next;       // State entered
+  uint16_t arg;       // ms, mm, mrad or bumper mask, by predicate
+} __attribute__((packed)) proto_transition_t;
+
+typedef struct
+{
+  uint8_t state;      // Index in the table
+  uint8_t action;
+  int16_t args[3];    // By action
+  proto_transition_t transitions[PROTO_BEHAVIOUR_TRANSITIONS];
+} __attribute__((packed)) proto_behaviour_t;
+
+// Bytecode program: loaded in PROTO_VM_LOAD chunks from offset 0, each
+// one ACKed, then started by a PROTO_VM_RUN with a period, NACKed when
+// the code does not check (the error in PROTO_VM). A period of 0 stops.
+typedef struct
+{
+  uint16_t period_ms;
+  uint16_t budget;    // Instructions per period
+} __attribute__((packed)) proto_vm_run_t;
+
+typedef struct
+{
+  uint8_t state;      // eVmState
+  uint8_t error;      // eVmError
+  uint16_t pc;        // Of the fault
+  uint16_t size;      // Of the code loaded
+  uint16_t peak;      // Most instructions run in a period
+  uint32_t periods;
+} __attribute__((packed)) proto_vm_t;
+
+// Last motor command followed to the outputs (--actuation-trace, see
+// libglobal/actuation.h), NACKed by the other builds and before the
+// first one: us from its first byte to each stage (eActuationStage)
+#define PROTO_ACTUATION_STAGES 4
+
+typedef struct
+{
+  int16_t left;       // Setpoint of the command
+  int16_t right;
+  uint16_t us[PROTO_ACTUATION_STAGES];
+} __attribute__((packed)) proto_actuation_t;
+
+// Identity of a board, for the hosts that run several: the same on
+// every link and across the updates
+typedef struct
+{
+  uint32_t uid;        // Hash of the 96-bit unique ID of the part
+  uint32_t image_crc;  // Of the image descriptor, 0 without one
+  uint16_t flash_kb;   // Of the part (libperiph/mcu.h)
+  uint8_t address;     // Node address, 0 for none
+} __attribute__((packed)) proto_ident_t;
+
+// Revision of the frames of this file, raised when a layout changes
+#define PROTO_VERSION 1
+
+// Host transports of a build
+enum eProtoTransport {
+  PROTO_TRANSPORT_UART      = 0x01, // The shell UART, "ub" rates
+  PROTO_TRANSPORT_USB       = 0x02, // --usb-link
+  PROTO_TRANSPORT_RTT       = 0x04, // --rtt-link
+  PROTO_TRANSPORT_SPI       = 0x08, // --spi-link, the register file
+  PROTO_TRANSPORT_CAN       = 0x10, // --can
+  PROTO_TRANSPORT_TELEMETRY = 0x20, // --telemetry-uart, one way
+};
+
+// What a board speaks, asked once on connect instead of waiting for the
+// prompt: the host picks the fastest line, then checks its frame layouts
+// against the PROTO_SCHEMA ones before it maps the payloads on them
+typedef struct
+{
+  uint16_t version;      // PROTO_VERSION
+  uint32_t image_crc;    // Firmware build, as in proto_ident_t
+  uint8_t transports;    // eProtoTransport of the build
+  uint8_t link;          // The one of this reply
+  uint32_t max_bauds;    // Fastest "ub" rate, 0 off the UART
+  uint8_t max_payload;   // PROTO_MAX_PAYLOAD
+  uint8_t schemas;       // PROTO_SCHEMA_REQ indexes
+} __attribute__((packed)) proto_caps_t;
+
+// Layout of a frame type, little endian and packed as the structs of
+// this file: the header, then a byte per run of fields of one kind
+// (eProtoField in the 3 MSB, the run length in the rest)
+enum eProtoField {
+  PROTO_FIELD_U8  = 0,
+  PROTO_FIELD_I8  = 1,
+  PROTO_FIELD_U16 = 2,
+  PROTO_FIELD_I16 = 3,
+  PROTO_FIELD_U32 = 4,
+  PROTO_FIELD_I32 = 5,
+};
+#define PROTO_FIELD(kind_, n_)     (((kind_) << 5) | (n_))
+#define PROTO_FIELD_KIND(field_)   ((field_) >> 5)
+#define PROTO_FIELD_COUNT(field_)  ((field_) & 0x1F)
+
+// The payload is an array of such records
+#define PROTO_SCHEMA_ARRAY 0x01
+// The struct heads the payload, a variable tail follows (see the type)
+#define PROTO_SCHEMA_HEAD  0x02
+
+typedef struct
+{
+  uint8_t index;
+  uint8_t type;          // eProtoType
+  uint8_t flags;
+  uint8_t size;          // Of the payload, or of a record
+} __attribute__((packed)) proto_schema_t;
+
+#define PROTO_SCHEMA_FIELDS_MAX (PROTO_MAX_PAYLOAD - sizeof (proto_schema_t))
+
+// Event sources
+enum eProtoEventSource {
+  PROTO_EVENT_BUMPER = 0x00, // + bumper index, value 1 when pressed
+  PROTO_EVENT_SLIP   = 0x08, // + encoder, value 1 while it slips
+};
+
+typedef struct
+{
+  uint32_t tick;
+  uint8_t source;
+  uint8_t value;
+} __attribute__((packed)) proto_event_t;
+
+typedef void (*pfunFrameHandle) (const uint8_t*, uint8_t);
+
+typedef struct
+{
+  uint8_t type;
+  pfunFrameHandle handler;
+} frame_token_t;
+
+typedef struct
+{
+  uint8_t state;
+  uint8_t addressed;  // Started by PROTO_SYNC_ADDR
+  uint8_t address;
+  uint8_t type;
+  uint8_t size;
+  uint8_t pos;
+  uint8_t crc;
+  uint8_t payload[PROTO_MAX_PAYLOAD];
+} proto_decoder_t;
+
+uint8_t uProtoCrc8(uint8_t crc_, const uint8_t* data_, int size_);
+void vProtoDecoderReset(proto_decoder_t* dec_);
+// Node address of the frames sent, 0 for plain frames
+void vProtoSetAddress(uint8_t address_);
+uint8_t uProtoGetAddress();
+// 1 when the decoded frame is to this board: plain, to its address or a
+// broadcast
+int iProtoIsForUs(const proto_decoder_t* dec_);
+// Returns 1 when a valid frame is complete, -1 on a corrupted frame, else 0
+int iProtoDecode(proto_decoder_t* dec_, uint8_t c_);
+// Dropped while muted, see vProtoMute
+void vProtoSend(uint8_t type_, const void* payload_, uint8_t size_);
+// Under a policy of xLinkTrySendMessage: 1 if sent
+int xProtoTrySend(uint8_t type_, const void* payload_, uint8_t size_,
+                  int timeout_ms_);
+// The same on the stream transport (xLinkTrySendStream)
+int xProtoTryStream(uint8_t type_, const void* payload_, uint8_t size_,
+                    int timeout_ms_);
+// Layouts of the fixed frames: header and fields of an index below
+// iProtoSchemaCount(), the count of field bytes
+int iProtoSchemaCount();
+int iProtoSchema(int index_, proto_schema_t* header_, const uint8_t** fields_);
+// A frame serialized in place on the stream lane (xLinkReserveStream):
+// each byte written once, in the buffer the DMA sends from
+typedef struct
+{
+  ring_slot_t slot;
+  uint8_t pos;
+  uint8_t size;       // Of the whole frame
+  uint8_t crc;
+} proto_writer_t;
+
+// Header written, 0 when the room did not come within timeout_ms_
+int xProtoStreamBegin(proto_writer_t* w_, uint8_t type_, uint8_t size_,
+                      int timeout_ms_);
+// The payload fields in order, little endian as the core
+void vProtoPut(proto_writer_t* w_, const void* data_, uint8_t size_);
+static inline void vProtoPutU8(proto_writer_t* w_, uint8_t value_)
+{
+  vProtoPut(w_, &value_, 1);
+}
+static inline void vProtoPutU16(proto_writer_t* w_, uint16_t value_)
+{
+  vProtoPut(w_, &value_, 2);
+}
+static inline void vProtoPutU32(proto_writer_t* w_, uint32_t value_)
+{
+  vProtoPut(w_, &value_, 4);
+}
+// The CRC, and the frame goes
+void vProtoStreamEnd(proto_writer_t* w_);
+// The frames sent by the calling task are dropped until unmuted (0): the
+// replies to a broadcast, the other tasks keep sending
+void vProtoMute(int mute_);
+
+#endif
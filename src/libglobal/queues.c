@@ -0,0 +1,59 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/fault.h"
+#include "libglobal/queues.h"
+
+#include "libperiph/cycles.h"
+
+static queue_stats_t* queues[QUEUES_MAX];
+static int queuesNb;
+
+void vQueuesRegister(queue_stats_t* queue_, const char* name_, uint16_t size_)
+{
+  if (queuesNb == QUEUES_MAX)
+    vFaultAllocation(name_);
+  queue_->name = name_;
+  queue_->size = size_;
+  queue_->high_water = 0;
+  queue_->blocked = 0;
+  queue_->blocked_us = 0;
+  queue_->dropped = 0;
+  queues[queuesNb++] = queue_;
+}
+
+uint32_t uQueuesBlockStart()
+{
+  return uCyclesNow();
+}
+
+void vQueuesBlockEnd(queue_stats_t* queue_, uint32_t start_)
+{
+  queue_->blocked++;
+  queue_->blocked_us += (uCyclesNow() - start_) / CYCLES_PER_US;
+}
+
+int iQueuesGetStats(queue_stats_t* stats_, int n_)
+{
+  if (n_ > queuesNb)
+    n_ = queuesNb;
+
+  taskENTER_CRITICAL();
+  for (int i = 0; i < n_; i++)
+    stats_[i] = *queues[i];
+  taskEXIT_CRITICAL();
+  return n_;
+}
+
+void vQueuesReset()
+{
+  taskENTER_CRITICAL();
+  for (int i = 0; i < queuesNb; i++)
+  {
+    queues[i]->high_water = 0;
+    queues[i]->blocked = 0;
+    queues[i]->blocked_us = 0;
+    queues[i]->dropped = 0;
+  }
+  taskEXIT_CRITICAL();
+}
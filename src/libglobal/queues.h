@@ -0,0 +1,48 @@
+#ifndef QUEUES_H
+# define QUEUES_H
+
+#include <stdint.h>
+
+// Fill and back-pressure of the channels between the tasks and the
+// interrupts, the kernel queues and the byte rings alike: the deepest
+// level seen, the sends that had to wait and for how long, the items
+// dropped by the sides that cannot wait (interrupts, zero timeouts).
+// Each counter has a single writer in practice, the producer: they are
+// kept without a lock, a sample may be off under contention.
+#define QUEUES_MAX 8
+
+typedef struct
+{
+  const char* name;
+  uint16_t size;         // Items, or bytes for a ring
+  uint16_t high_water;
+  uint32_t blocked;      // Sends that waited
+  uint32_t blocked_us;   // Total time they waited
+  uint32_t dropped;      // Items lost, nothing waited for room
+} queue_stats_t;
+
+// Before the scheduler starts, up to QUEUES_MAX channels: the stats stay
+// the caller's, listed by iQueuesGetStats
+void vQueuesRegister(queue_stats_t* queue_, const char* name_, uint16_t size_);
+
+// Level after a send
+static inline void vQueuesLevel(queue_stats_t* queue_, uint16_t used_)
+{
+  if (used_ > queue_->high_water)
+    queue_->high_water = used_;
+}
+
+static inline void vQueuesDrop(queue_stats_t* queue_, uint32_t n_)
+{
+  queue_->dropped += n_;
+}
+
+// Around a wait for room: the cycle count when it began, then the end
+uint32_t uQueuesBlockStart();
+void vQueuesBlockEnd(queue_stats_t* queue_, uint32_t start_);
+
+// Copy up to n_ channels, in the order registered. Returns the count.
+int iQueuesGetStats(queue_stats_t* stats_, int n_);
+void vQueuesReset();
+
+#endif
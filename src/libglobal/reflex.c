@@ -0,0 +1,93 @@
+#include "FreeRTOS.h"
+
+#include "libglobal/reflex.h"
+
+#include "libperiph/motors.h"
+#include "libperiph/sharps.h"
+#include "libperiph/sonar.h"
+
+static volatile int enabled = 1;
+static volatile int useSharps = 1;
+static volatile int stopMm = REFLEX_DEFAULT_STOP_MM;
+static volatile int slowMm = REFLEX_DEFAULT_SLOW_MM;
+
+static volatile int closestMm = -1;
+static volatile int16_t limit = MOTORS_COMMAND_MAX;
+
+static int16_t iReflexLimit();
+static int iReflexCloser(int closest_, int dist_);
+
+void vReflexInit()
+{
+  vMotorsSetForwardLimit(&iReflexLimit);
+}
+
+void vReflexEnable(int enable_)
+{
+  enabled = enable_;
+}
+
+int iReflexIsEnabled()
+{
+  return enabled;
+}
+
+void vReflexSetThresholds(int stop_mm_, int slow_mm_)
+{
+  if (slow_mm_ <= stop_mm_)
+    slow_mm_ = stop_mm_ + 1;
+  // Updated one after the other, the limit stays consistent either way
+  stopMm = stop_mm_;
+  slowMm = slow_mm_;
+}
+
+void vReflexUseSharps(int use_)
+{
+  useSharps = use_;
+}
+
+int iReflexGetClosestMm()
+{
+  return closestMm;
+}
+
+int iReflexGetLimit()
+{
+  return limit;
+}
+
+// Out of range readings (negative) see nothing
+static int iReflexCloser(int closest_, int dist_)
+{
+  if (dist_ < 0)
+    return closest_;
+  if (closest_ < 0 || dist_ < closest_)
+    return dist_;
+  return closest_;
+}
+
+// Motors daemon, at each period: the latest sensor values are always
+// published, so reacting costs at most one sensor period
+static int16_t iReflexLimit()
+{
+  const int stop = stopMm;
+  const int slow = slowMm;
+  int closest = -1;
+
+  closest = iReflexCloser(closest, iSonarMeasureDistMm(SONAR_CENTER));
+  if (useSharps)
+  {
+    closest = iReflexCloser(closest, iSharpsMeasureDistMm(SHARP_LEFT));
+    closest = iReflexCloser(closest, iSharpsMeasureDistMm(SHARP_RIGHT));
+  }
+  closestMm = closest;
+
+  if (!enabled || closest < 0 || closest >= slow)
+    limit = MOTORS_COMMAND_MAX;
+  else if (closest <= stop)
+    limit = 0;
+  else
+    limit = ((closest - stop) * MOTORS_COMMAND_MAX) / (slow - stop);
+
+  return limit;
+}
@@ -0,0 +1,22 @@
+#ifndef REFLEX_H
+# define REFLEX_H
+
+// Forward motion stops under the stop distance and slows down linearly
+// up to the slow distance, from the closest front sensor
+#define REFLEX_DEFAULT_STOP_MM 150
+#define REFLEX_DEFAULT_SLOW_MM 400
+
+void vReflexInit();
+void vReflexEnable(int enable_);
+int iReflexIsEnabled();
+void vReflexSetThresholds(int stop_mm_, int slow_mm_);
+// The sharps count as front sensors, unless a behaviour follows a wall
+// with them (libglobal/wall.h)
+void vReflexUseSharps(int use_);
+
+// Closest front obstacle seen at the last period (-1 if none), and the
+// forward limit applied
+int iReflexGetClosestMm();
+int iReflexGetLimit();
+
+#endif
@@ -0,0 +1,114 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/odometry.h"
+#include "libglobal/regmap.h"
+
+#include "libperiph/bumpers.h"
+#include "libperiph/hardware.h"
+#include "libperiph/i2c.h"
+#include "libperiph/leds.h"
+#include "libperiph/motors.h"
+#include "libperiph/periodic.h"
+#include "libperiph/power.h"
+#include "libperiph/sharps.h"
+#include "libperiph/sonar.h"
+#include "libperiph/spi.h"
+
+static void vRegmapRefresh();
+static void vRegmapWrite(uint8_t reg_, const uint8_t* data_, int size_);
+#ifdef SPI_LINK
+static void vRegmapSpiFrame(const uint8_t* payload_);
+#endif
+
+static periodic_t refresh;
+
+void vRegmapInit()
+{
+  vI2CSetWriteHandler(&vRegmapWrite);
+#ifdef SPI_LINK
+  vSpiSetFrameHandler(&vRegmapSpiFrame);
+#endif
+
+  vPeriodicInit(&refresh, "regmap", &vRegmapRefresh);
+  vPeriodicSetPeriod(&refresh, REGMAP_PERIOD_MS);
+}
+
+static int16_t iRegmapGet16(const uint8_t* data_)
+{
+  return (int16_t)(data_[0] | (data_[1] << 8));
+}
+
+// I2C interrupt context
+static void vRegmapWrite(uint8_t reg_, const uint8_t* data_, int size_)
+{
+  vLedsLinkActivity();
+
+  if (reg_ == REGMAP_REG(target_left) && size_ >= 4)
+    vSetMotorsCommand(iRegmapGet16(data_), iRegmapGet16(data_ + 2));
+  else if (reg_ == REGMAP_REG(target_left) && size_ >= 2)
+    vSetMotorLeftCommand(iRegmapGet16(data_));
+  else if (reg_ == REGMAP_REG(target_right) && size_ >= 2)
+    vSetMotorRightCommand(iRegmapGet16(data_));
+}
+
+#ifdef SPI_LINK
+// SPI DMA interrupt context
+static void vRegmapSpiFrame(const uint8_t* payload_)
+{
+  const regmap_spi_command_t* command = (const regmap_spi_command_t*)payload_;
+
+  vLedsLinkActivity();
+
+  if (command->flags & REGMAP_SPI_TARGETS)
+    vSetMotorsCommand(command->target_left, command->target_right);
+}
+#endif
+
+// Snapshot job, from the timer service task
+static void vRegmapRefresh()
+{
+  static regmap_t regs = { .device_id = REGMAP_DEVICE_ID,
+                           .version = REGMAP_VERSION };
+  motors_state_t motors;
+  pose_t pose;
+
+  vMotorsGetState(&motors);
+  vOdometryGetPose(&pose);
+
+  regs.status = 0;
+  if (motors.enabled)
+    regs.status |= REGMAP_STATUS_ENABLED;
+  if (motors.cut_off)
+    regs.status |= REGMAP_STATUS_CUT_OFF;
+  if (motors.closed_loop)
+    regs.status |= REGMAP_STATUS_CLOSED_LOOP;
+  for (int i = 0; i < BUMPERS_NB; i++)
+    if (iBumpersIsPressed(i))
+      regs.status |= REGMAP_STATUS_BUMPER << i;
+  regs.status |= motors.slipping * REGMAP_STATUS_SLIP;
+
+  regs.tick           = xTaskGetTickCount();
+  regs.sharp_left_mm  = iSharpsMeasureDistMm(SHARP_LEFT);
+  regs.sonar_mm       = iSonarMeasureDistMm(SONAR_CENTER);
+  regs.sharp_right_mm = iSharpsMeasureDistMm(SHARP_RIGHT);
+  regs.sonar_left_mm  = iSonarMeasureDistMm(SONAR_LEFT);
+  regs.sonar_right_mm = iSonarMeasureDistMm(SONAR_RIGHT);
+  regs.battery_mv     = iPowerGetBatteryMv();
+  regs.current_ma     = iPowerGetCurrentMa();
+  regs.motor_left     = motors.command_left;
+  regs.motor_right    = motors.command_right;
+  regs.speed_left     = motors.speed_left;
+  regs.speed_right    = motors.speed_right;
+  regs.x_mm           = pose.x_mm;
+  regs.y_mm           = pose.y_mm;
+  regs.theta_mrad     = pose.theta_mrad;
+  regs.target_left    = motors.target_left;
+  regs.target_right   = motors.target_right;
+  vI2CPublish(&regs, sizeof (regs));
+  iI2CCheckBus();
+#ifdef SPI_LINK
+  vSpiPublish(&regs, sizeof (regs));
+  iSpiCheckSync();
+#endif
+}
@@ -0,0 +1,69 @@
+#ifndef REGMAP_H
+# define REGMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// No kernel header: the host tools share the layout
+// Layout of the I2C slave register file, little endian. Read from any
+// register up to the end in one transaction; only the motors targets are
+// writable.
+#define REGMAP_VERSION 2
+
+// Register 0, fixed across the versions: the host tools tell the board
+// from the other devices on the bus by it
+#define REGMAP_DEVICE_ID 0x5B
+
+// Status register bits
+#define REGMAP_STATUS_ENABLED     0x01
+#define REGMAP_STATUS_CUT_OFF     0x02
+#define REGMAP_STATUS_CLOSED_LOOP 0x04
+#define REGMAP_STATUS_BUMPER      0x08 // << bumper index, set when pressed
+#define REGMAP_STATUS_SLIP        0x40 // << encoder, set while it slips
+
+// Snapshot refresh period
+#define REGMAP_PERIOD_MS 20
+
+typedef struct
+{
+  uint8_t device_id;     // REGMAP_DEVICE_ID
+  uint8_t version;
+  uint8_t status;
+  uint32_t tick;
+  int16_t sharp_left_mm;
+  int16_t sonar_mm;
+  int16_t sharp_right_mm;
+  int16_t sonar_left_mm;
+  int16_t sonar_right_mm;
+  uint16_t battery_mv;
+  uint16_t current_ma;
+  int16_t motor_left;    // Applied commands
+  int16_t motor_right;
+  int16_t speed_left;    // Encoder counts per motors period
+  int16_t speed_right;
+  int16_t x_mm;          // Odometry pose
+  int16_t y_mm;
+  int16_t theta_mrad;
+  int16_t target_left;   // Writable: both or one of them
+  int16_t target_right;
+} __attribute__((packed)) regmap_t;
+
+#define REGMAP_REG(field) ((uint8_t)offsetof(regmap_t, field))
+
+#ifdef SPI_LINK
+// SPI link frames (libperiph/spi): the whole register file out, the
+// writable registers in, at each transaction
+#define REGMAP_SPI_TARGETS 0x01 // Apply the targets
+
+typedef struct
+{
+  uint8_t flags;
+  int16_t target_left;
+  int16_t target_right;
+} __attribute__((packed)) regmap_spi_command_t;
+#endif
+
+// Refreshed by a periodic job (libperiph/periodic)
+void vRegmapInit();
+
+#endif
@@ -0,0 +1,110 @@
+#include <string.h>
+
+#include "libglobal/assert_param.h"
+#include "libglobal/ring.h"
+
+// Keep the compiler and the core from reordering memory accesses: the
+// bytes are in place before an index says so, and read (or sent) before
+// the other side may reuse them
+#ifdef SIMULATION
+# define MEMORY_BARRIER() __sync_synchronize()
+#else
+# define MEMORY_BARRIER() __asm volatile ("dmb" ::: "memory")
+#endif
+
+void vRingInit(ring_t* ring_, void* buffer_, uint16_t size_)
+{
+  assert_param(size_ && !(size_ & (size_ - 1)));
+
+  ring_->buffer = buffer_;
+  ring_->mask = size_ - 1;
+  ring_->head = 0;
+  ring_->tail = 0;
+}
+
+uint16_t uRingWriteSpan(const ring_t* ring_, uint8_t** span_)
+{
+  const uint16_t start = ring_->head & ring_->mask;
+  const uint16_t room = uRingRoom(ring_);
+  const uint16_t end = ring_->mask + 1 - start;
+
+  *span_ = &ring_->buffer[start];
+  return room < end ? room : end;
+}
+
+void vRingCommit(ring_t* ring_, uint16_t n_)
+{
+  MEMORY_BARRIER();
+  ring_->head += n_;
+}
+
+int xRingReserve(const ring_t* ring_, uint16_t size_, ring_slot_t* slot_)
+{
+  if (uRingRoom(ring_) < size_)
+    return 0;
+
+  uint16_t n = uRingWriteSpan(ring_, &slot_->span[0]);
+  if (n > size_)
+    n = size_;
+  slot_->size[0] = n;
+  slot_->span[1] = ring_->buffer;
+  slot_->size[1] = size_ - n;
+  return 1;
+}
+
+uint16_t uRingReadSpan(const ring_t* ring_, const uint8_t** span_)
+{
+  const uint16_t start = ring_->tail & ring_->mask;
+  const uint16_t used = uRingUsed(ring_);
+  const uint16_t end = ring_->mask + 1 - start;
+
+  // The bytes are read after the head that counts them
+  MEMORY_BARRIER();
+  *span_ = &ring_->buffer[start];
+  return used < end ? used : end;
+}
+
+void vRingRelease(ring_t* ring_, uint16_t n_)
+{
+  MEMORY_BARRIER();
+  ring_->tail += n_;
+}
+
+uint16_t uRingWrite(ring_t* ring_, const void* data_, uint16_t size_)
+{
+  const uint8_t* data = data_;
+  uint16_t count = 0;
+
+  // At most two spans, when wrapping around the end of the buffer
+  for (int i = 0; i < 2 && count < size_; i++)
+  {
+    uint8_t* span;
+    uint16_t n = uRingWriteSpan(ring_, &span);
+
+    if (n > size_ - count)
+      n = size_ - count;
+    memcpy(span, data + count, n);
+    vRingCommit(ring_, n);
+    count += n;
+  }
+  return count;
+}
+
+uint16_t uRingRead(ring_t* ring_, void* data_, uint16_t size_)
+{
+  uint8_t* data = data_;
+  uint16_t count = 0;
+
+  for (int i = 0; i < 2 && count < size_; i++)
+  {
+    const uint8_t* span;
+    uint16_t n = uRingReadSpan(ring_, &span);
+
+    if (n > size_ - count)
+      n = size_ - count;
+    memcpy(data + count, span, n);
+    vRingRelease(ring_, n);
+    count += n;
+  }
+  return count;
+}
@@ -0,0 +1,58 @@
+#ifndef RING_H
+# define RING_H
+
+#include <stdint.h>
+
+// Byte ring between one producer and one consumer, an interrupt and a
+// task or the other way round, without any lock: each side only writes
+// its own free running index, and publishes it after the bytes it moved.
+// Copies go by contiguous spans, at most two per call, and a DMA or a
+// packet buffer can work in place on the spans. Several producers (or
+// consumers) must be serialized by their caller.
+typedef struct
+{
+  uint8_t* buffer;
+  uint16_t mask;                 // Size - 1, the size a power of 2
+  volatile uint16_t head;        // Written by the producer only
+  volatile uint16_t tail;        // Written by the consumer only
+} ring_t;
+
+void vRingInit(ring_t* ring_, void* buffer_, uint16_t size_);
+
+static inline uint16_t uRingUsed(const ring_t* ring_)
+{
+  return (uint16_t)(ring_->head - ring_->tail);
+}
+
+static inline uint16_t uRingRoom(const ring_t* ring_)
+{
+  return ring_->mask + 1 - uRingUsed(ring_);
+}
+
+// Producer: copy in up to size_ bytes, as many as there is room for.
+// Returns the count.
+uint16_t uRingWrite(ring_t* ring_, const void* data_, uint16_t size_);
+// Producer, in place: the room up to the end of the buffer, then publish
+// what was written there
+uint16_t uRingWriteSpan(const ring_t* ring_, uint8_t** span_);
+void vRingCommit(ring_t* ring_, uint16_t n_);
+
+// Producer, in place across the wrap: size_ bytes of room, one span then
+// the start of the buffer when it wraps, published whole by
+// vRingCommit(size_). 0 when there is not that much room.
+typedef struct
+{
+  uint8_t* span[2];
+  uint16_t size[2];
+} ring_slot_t;
+
+int xRingReserve(const ring_t* ring_, uint16_t size_, ring_slot_t* slot_);
+
+// Consumer: copy out up to size_ bytes. Returns the count.
+uint16_t uRingRead(ring_t* ring_, void* data_, uint16_t size_);
+// Consumer, in place: the bytes up to the end of the buffer, then give
+// back the room of those done with
+uint16_t uRingReadSpan(const ring_t* ring_, const uint8_t** span_);
+void vRingRelease(ring_t* ring_, uint16_t n_);
+
+#endif
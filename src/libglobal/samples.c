@@ -0,0 +1,64 @@
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/samples.h"
+
+#define SAMPLES_MASK (SAMPLES_NB - 1)
+
+// Keep the compiler and the core from reordering memory accesses
+#ifdef SIMULATION
+# define MEMORY_BARRIER() __sync_synchronize()
+#else
+# define MEMORY_BARRIER() __asm volatile ("dmb" ::: "memory")
+#endif
+
+static sample_t samples[SAMPLES_NB];
+// Free running count of pushed samples, only written by the producer
+static volatile uint32_t head;
+
+void vSamplesPush(uint8_t sensor_, int16_t value_mm_)
+{
+  sample_t* sample = &samples[head & SAMPLES_MASK];
+
+  sample->tick = xTaskGetTickCount();
+  sample->value_mm = value_mm_;
+  sample->sensor = sensor_;
+
+  // Publish the sample only once it is fully written
+  MEMORY_BARRIER();
+  head++;
+}
+
+int iSamplesReadLast(sample_t* out_, int n_)
+{
+  uint32_t first, last, delta;
+  int lost;
+
+  last = head;
+  if (n_ > SAMPLES_NB)
+    n_ = SAMPLES_NB;
+  if ((uint32_t)n_ > last)
+    n_ = last;
+  first = last - n_;
+
+  MEMORY_BARRIER();
+  for (int i = 0; i < n_; i++)
+    out_[i] = samples[(first + i) & SAMPLES_MASK];
+  MEMORY_BARRIER();
+
+  // Drop the oldest samples if the producer overwrote (or is overwriting)
+  // their slots while they were copied
+  delta = head - last;
+  if (delta >= SAMPLES_NB)
+    return 0;
+  lost = (int)delta + n_ - SAMPLES_NB + 1;
+  if (lost <= 0)
+    return n_;
+  if (lost >= n_)
+    return 0;
+  memmove(out_, out_ + lost, (n_ - lost) * sizeof (sample_t));
+
+  return n_ - lost;
+}
@@ -0,0 +1,29 @@
+#ifndef SAMPLES_H
+# define SAMPLES_H
+
+#include <stdint.h>
+
+// Number of samples kept in the ring. Must be a power of 2.
+#define SAMPLES_NB 64
+
+enum eSampleSensor {
+  SAMPLE_SONAR       = 0,
+  SAMPLE_SHARP_LEFT  = 1,
+  SAMPLE_SHARP_RIGHT = 2,
+  SAMPLE_SONAR_LEFT  = 3,
+  SAMPLE_SONAR_RIGHT = 4
+};
+
+typedef struct
+{
+  uint32_t tick;
+  int16_t value_mm;
+  uint8_t sensor;
+} __attribute__((packed)) sample_t;
+
+// Single producer: must only be called from one task (the sonar daemon)
+void vSamplesPush(uint8_t sensor_, int16_t value_mm_);
+// Copy up to n_ of the latest samples, oldest first. Returns the count.
+int iSamplesReadLast(sample_t* out_, int n_);
+
+#endif
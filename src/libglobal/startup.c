@@ -0,0 +1,20 @@
+#include "libglobal/startup.h"
+
+#include "libperiph/hardware.h"
+#include "libperiph/timebase.h"
+
+// Single words: written once each, read by the console
+static volatile uint32_t marks[STARTUP_NB];
+
+void vStartupMark(int phase_)
+{
+  if (marks[phase_])
+    return;
+  marks[phase_] = uHardwareClocksUs() + xTimeNowUs();
+}
+
+void vStartupGet(uint32_t* times_us_)
+{
+  for (int i = 0; i < STARTUP_NB; i++)
+    times_us_[i] = marks[i];
+}
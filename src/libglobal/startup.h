@@ -0,0 +1,26 @@
+#ifndef STARTUP_H
+# define STARTUP_H
+
+#include <stdint.h>
+
+// Boot phases, in microseconds since the reset: the clock setup on the
+// HSI (see uHardwareClocksUs), then the timebase. The C runtime startup
+// before main is not counted.
+enum eStartupPhase {
+  STARTUP_CLOCKS,    // 72 MHz core clock, the crystal started
+  STARTUP_INIT,      // Drivers initialized, scheduler start
+  STARTUP_ANALOG,    // First ADC scan: sharps, battery and current
+  STARTUP_SONAR,     // First distance from every sonar
+  STARTUP_GYRO,      // Gyro calibrated, heading integrated
+  STARTUP_SHELL,     // Console prompt
+  STARTUP_NB,
+};
+
+// The first mark of a phase stays, later ones cost a test. From any task
+// or interrupt.
+void vStartupMark(int phase_);
+
+// Times of the phases, 0 when not reached yet
+void vStartupGet(uint32_t* times_us_);
+
+#endif
@@ -1,4 +1,5 @@
 #include <string.h>
+
 #include "strutils.h"
 
 /* Source: Wikipédia */
@@ -15,112 +16,272 @@ void reverse(char* s)
   }
 }
 
-/* Adapted from Wikipédia */
-/* itoa:  convert n to characters in s */
-char* itoa(int n, char* s)
+// Two digits per division, the constant divisions by 100 compile to a
+// multiplication by the reciprocal
+static const char digits_pairs[200] =
+  "00010203040506070809" "10111213141516171819"
+  "20212223242526272829" "30313233343536373839"
+  "40414243444546474849" "50515253545556575859"
+  "60616263646566676869" "70717273747576777879"
+  "80818283848586878889" "90919293949596979899";
+
+static int digits_nb(uint32_t n)
+{
+  int nb = 1;
+
+  for (; n >= 10000; n /= 10000)
+    nb += 4;
+  if (n >= 1000)
+    return nb + 3;
+  if (n >= 100)
+    return nb + 2;
+  if (n >= 10)
+    return nb + 1;
+  return nb;
+}
+
+int utoa_len(uint32_t n, char* s)
 {
-  int i, sign;
+  const int size = digits_nb(n);
+  char* p = s + size;
 
-  if ((sign = n) < 0)       /* record sign */
-    n = -n;                 /* make n positive */
-  i = 0;
-  do                        /* generate digits in reverse order */
+  // Right to left from the known end, no reverse pass
+  *p = '\0';
+  while (n >= 100)
   {
-    s[i++] = n % 10 + '0';  /* get next digit */
-  } while ((n /= 10) > 0);  /* delete it */
-  if (sign < 0)
-    s[i++] = '-';
-  s[i] = '\0';
-  reverse(s);
+    const uint32_t q = n / 100;
+    const int pair = 2 * (n - 100 * q);
+
+    *--p = digits_pairs[pair + 1];
+    *--p = digits_pairs[pair];
+    n = q;
+  }
+  if (n >= 10)
+  {
+    *--p = digits_pairs[2 * n + 1];
+    *--p = digits_pairs[2 * n];
+  }
+  else
+    *--p = '0' + n;
 
+  return size;
+}
+
+int itoa_len(int n, char* s)
+{
+  // Negate as unsigned: INT_MIN has no positive int counterpart
+  if (n < 0)
+  {
+    *s = '-';
+    return 1 + utoa_len(-(uint32_t)n, s + 1);
+  }
+  return utoa_len(n, s);
+}
+
+char* itoa(int n, char* s)
+{
+  itoa_len(n, s);
   return s;
 }
 
-#define FLTOA_PRECISION 0.000001
+static const uint32_t powers10[FIXTOA_DECIMALS_MAX + 1] =
+{
+  1, 10, 100, 1000, 10000, 100000, 1000000
+};
+
+int fixtoa_len(int32_t value, int bits, int decimals, char* s)
+{
+  const uint32_t magnitude = value < 0 ? -(uint32_t)value : (uint32_t)value;
+  uint32_t integer, fraction;
+  int size = 0;
+
+  if (bits < 0)
+    bits = 0;
+  if (bits > 31)
+    bits = 31;
+  if (decimals < 0)
+    decimals = 0;
+  if (decimals > FIXTOA_DECIMALS_MAX)
+    decimals = FIXTOA_DECIMALS_MAX;
+
+  // Fraction scaled to the decimals, rounded to nearest, the carry of a
+  // round up goes to the integer part
+  integer = magnitude >> bits;
+  fraction = magnitude & ((1u << bits) - 1);
+  fraction = ((uint64_t)fraction * powers10[decimals]
+              + ((1u << bits) >> 1)) >> bits;
+  if (fraction == powers10[decimals])
+  {
+    integer++;
+    fraction = 0;
+  }
+
+  // No sign for what rounds to zero
+  if (value < 0 && (integer || fraction))
+    s[size++] = '-';
+  size += utoa_len(integer, s + size);
+  if (decimals)
+  {
+    s[size++] = '.';
+    // Leading zeros of the fraction first
+    for (int i = digits_nb(fraction); i < decimals; i++)
+      s[size++] = '0';
+    size += utoa_len(fraction, s + size);
+  }
+
+  return size;
+}
+
+#define FLTOA_DECIMALS 6
 
 char* fltoa(float f, char *s)
 {
-  int f_int;
-  int f_frac;
-  char* const str = s;
+  char* p = s;
+  const int negative = f < 0;
+  uint32_t f_int, f_frac;
 
-  if (f < 0) {
-    *s++ = '-';
+  if (negative)
     f = -f;
-  }
 
-  f_int  = f;
-  f_frac = (f - f_int) / FLTOA_PRECISION;
+  // Rounded to FLTOA_DECIMALS, trailing zeros removed
+  f_int = f;
+  f_frac = (f - f_int) * powers10[FLTOA_DECIMALS] + 0.5f;
+  if (f_frac >= powers10[FLTOA_DECIMALS])
+  {
+    f_int++;
+    f_frac = 0;
+  }
 
-  itoa(f_int, s);
+  if (negative && (f_int || f_frac))
+    *p++ = '-';
+  p += utoa_len(f_int, p);
+  if (f_frac)
+  {
+    *p++ = '.';
+    for (int i = digits_nb(f_frac); i < FLTOA_DECIMALS; i++)
+      *p++ = '0';
+    while (f_frac % 10 == 0)
+      f_frac /= 10;
+    p += utoa_len(f_frac, p);
+  }
+  *p = '\0';
 
-  while (*s)
-    s++;
+  return s;
+}
 
-  *s++ = '.';
+static int hex_digit(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
 
-  itoa(f_frac, s);
+static int strtou_base(const char* str, const char** end, uint32_t max,
+                       int base, uint32_t* value)
+{
+  const char* s = str;
+  uint32_t v = 0;
+  int digit, status = STRTOI_OK;
 
-  while (*s)
+  while ((digit = hex_digit(*s)) >= 0 && digit < base)
+  {
+    // Keep scanning the digits when out of range, to end after them
+    if (v > (max - digit) / base)
+      status = STRTOI_RANGE;
+    else
+      v = v * base + digit;
     s++;
+  }
+  if (s == str)
+    status = STRTOI_EMPTY;
 
-  while (*(--s) == '0')
-    *s = '\0';
+  *end = s;
+  *value = status == STRTOI_OK ? v : 0;
+  return status;
+}
 
-  if (*s == '.')
-    *s = '\0';
+int strtoi(const char* str, const char** end, int32_t* value)
+{
+  const char* s = str;
+  const int negative = *s == '-';
+  const char* dummy;
+  uint32_t magnitude;
+  int status;
+
+  if (!end)
+    end = &dummy;
+  if (*s == '-' || *s == '+')
+    s++;
 
-  return str;
+  if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X') && hex_digit(s[2]) >= 0)
+    status = strtou_base(s + 2, end, negative ? 0x80000000u : 0xFFFFFFFFu,
+                         16, &magnitude);
+  else
+    status = strtou_base(s, end, negative ? 0x80000000u : 0x7FFFFFFFu, 10,
+                         &magnitude);
+
+  if (status == STRTOI_EMPTY)
+    *end = str;
+  *value = negative ? -magnitude : magnitude;
+  return status;
 }
 
-float atofl(const char* str)
+int strtoh(const char* str, const char** end, uint32_t* value)
 {
-  float value = 0, f = 0;
-  int i = 0;
-
-  while (!(('0' <= str[i]) && (str[i] <= '9')) && (str[i] != 0))
-    i++;
+  const char* dummy;
+  return strtou_base(str, end ? end : &dummy, 0xFFFFFFFFu, 16, value);
+}
 
-  while (str[i] != 0)
-  {
-    if (str[i] == '.')
-    {
-      f = 10;
-      i++;
-      continue;
-    }
+int strtofl(const char* str, const char** end, float* value)
+{
+  const char* s = str;
+  const int negative = *s == '-';
+  const char* dummy;
+  float v = 0, f = 0.1f;
+  int digits = 0;
+
+  if (!end)
+    end = &dummy;
+  if (*s == '-' || *s == '+')
+    s++;
 
-    if (f)
-    {
-      value += (float)(str[i] - '0') / f;
-      f *= 10;
-    }
-    else
-      value = 10 * value + str[i] - '0';
+  for (; is_number(*s); s++, digits++)
+    v = 10 * v + *s - '0';
+  if (*s == '.')
+    for (s++; is_number(*s); s++, digits++, f /= 10)
+      v += (*s - '0') * f;
 
-    i++;
+  if (!digits)
+  {
+    *end = str;
+    *value = 0;
+    return STRTOI_EMPTY;
   }
+  *end = s;
+  *value = negative ? -v : v;
+  return STRTOI_OK;
+}
 
-  if (str[0] == '-')
-    value = -value;
+float atofl(const char* str)
+{
+  float value;
 
+  while (*str && !is_number(*str) && *str != '-' && *str != '.')
+    str++;
+  strtofl(str, NULL, &value);
   return value;
 }
 
+// The _eol variants stop at the first unexpected character, eol or not
 int atoi_eol(const char* str, char eol)
 {
-  const char* s = str;
-  int value = 0;
-
-  if (*s == '-')
-    s++;
-
-  while (*s != eol)
-    value = 10 * value + *s++ - '0';
-
-  if (*str == '-')
-    value = -value;
+  int32_t value;
 
+  strtoi(str, NULL, &value);
   return value;
 }
 
@@ -131,20 +292,9 @@ int atoi(const char* str)
 
 int htoi_eol(const char* str, char eol)
 {
-  int value = 0, i = 0, tmp;
-  while (str[i] != eol)
-  {
-    tmp = str[i];
-    if (str[i] <= '9' && str[i] >= '0')
-      tmp -= '0';
-    else if (str[i] <= 'F' && str[i] >= 'A')
-      tmp = tmp - 'A' + 10;
-    else if (str[i] <= 'f' && str[i] >= 'a')
-      tmp = tmp - 'a' + 10;
-
-    value = 16 * value + tmp;
-    i++;
-  }
+  uint32_t value;
+
+  strtoh(str, NULL, &value);
   return value;
 }
 
@@ -155,8 +305,6 @@ int htoi(const char* str)
 
 int xtoi_eol(const char* str, char eol)
 {
-  if (str[0] == '0' && str[1] == 'x')
-    return htoi_eol(str + 2, eol);
   return atoi_eol(str, eol);
 }
 
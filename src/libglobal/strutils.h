@@ -1,8 +1,27 @@
 #ifndef STRUTILS_H
 # define STRUTILS_H
 
+#include <stdint.h>
+
+// Decimals of fixtoa_len
+#define FIXTOA_DECIMALS_MAX 6
+
 void reverse(char* s);
+// Conversions that return the length written, not counting the final '\0'
+int utoa_len(uint32_t n, char* s);
+int itoa_len(int n, char* s);
+// Fixed-point value with bits fraction bits, rounded to decimals
+int fixtoa_len(int32_t value, int bits, int decimals, char* s);
 char* itoa(int n, char* s);
+// strtol style parsers: the value, the first character not parsed in
+// *end (str when nothing was) and a status. strtoi takes an optional
+// sign then decimal or "0x" hexadecimal. end may be NULL.
+#define STRTOI_OK     0
+#define STRTOI_EMPTY -1 // No digit
+#define STRTOI_RANGE -2 // Does not fit, value is 0
+int strtoi(const char* str, const char** end, int32_t* value);
+int strtoh(const char* str, const char** end, uint32_t* value);
+int strtofl(const char* str, const char** end, float* value);
 float atofl(const char* str);
 char* fltoa(float f, char *s);
 int atoi_eol(const char* str, char eol);
@@ -0,0 +1,147 @@
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/profile.h"
+#include "libglobal/sysmon.h"
+
+#include "libperiph/cycles.h"
+
+// Slot 0 gathers the idle and unregistered tasks, its tag is NULL
+typedef struct
+{
+  const char* name;
+  xTaskHandle handle;
+  uint32_t cycles;        // In the current window
+  uint16_t cpu_permille;  // Over the last window
+} sysmon_task_t;
+
+static sysmon_task_t tasks[SYSMON_TASKS_MAX + 1] = { [0] = { .name = "idle" } };
+static volatile int n_tasks = 1;
+
+// Both updated with the kernel interrupts masked: from the context switch
+// or the tick
+static uint32_t lastSwitch;
+static uint32_t windowStart;
+static int windowTicks;
+
+#ifdef PROFILE
+static uint32_t probeCycles[PROFILE_NB];
+static uint16_t probePermille[PROFILE_NB];
+#endif
+
+void vSysmonRegisterTask(const char* name_)
+{
+  taskENTER_CRITICAL();
+  if (n_tasks <= SYSMON_TASKS_MAX)
+  {
+    tasks[n_tasks].name = name_;
+    tasks[n_tasks].handle = xTaskGetCurrentTaskHandle();
+    vTaskSetApplicationTaskTag(NULL, (pdTASK_HOOK_CODE)n_tasks);
+    n_tasks++;
+  }
+  taskEXIT_CRITICAL();
+}
+
+void vSysmonSwitchedOut(void* tag_)
+{
+  const uint32_t now = uCyclesNow();
+
+  tasks[(uintptr_t)tag_].cycles += now - lastSwitch;
+  lastSwitch = now;
+}
+
+static uint16_t prvSysmonPermille(uint32_t cycles_, uint32_t window_)
+{
+  // Without overflow: a window holds up to 72 M cycles
+  window_ /= 1000;
+  if (!window_ || cycles_ / window_ > 1000)
+    return 1000;
+  return cycles_ / window_;
+}
+
+void vSysmonTick()
+{
+  uint32_t now, window;
+
+  if (++windowTicks < SYSMON_WINDOW_MS / portTICK_RATE_MS)
+    return;
+  windowTicks = 0;
+
+  // The running task time since its switch in goes to the next window
+  now = uCyclesNow();
+  window = now - windowStart;
+  windowStart = now;
+
+  for (int i = 0; i < n_tasks; i++)
+  {
+    tasks[i].cpu_permille = prvSysmonPermille(tasks[i].cycles, window);
+    tasks[i].cycles = 0;
+  }
+
+#ifdef PROFILE
+  for (int i = 0; i < PROFILE_NB; i++)
+  {
+    const uint32_t cycles = uProfileCycles(i);
+
+    // A reset in the window restarts the count from 0
+    probePermille[i] = prvSysmonPermille(cycles >= probeCycles[i] ?
+                                         cycles - probeCycles[i] : cycles,
+                                         window);
+    probeCycles[i] = cycles;
+  }
+#endif
+}
+
+int iSysmonGetLoads(sysmon_load_t* loads_, int n_)
+{
+  if (n_ > n_tasks)
+    n_ = n_tasks;
+
+  taskENTER_CRITICAL();
+  for (int i = 0; i < n_; i++)
+  {
+    loads_[i].name = tasks[i].name;
+    loads_[i].cpu_permille = tasks[i].cpu_permille;
+  }
+  taskEXIT_CRITICAL();
+
+  // Scans the stacks, out of the critical section
+  for (int i = 0; i < n_; i++)
+    loads_[i].stack_free = tasks[i].handle ?
+      (int16_t)uxTaskGetStackHighWaterMark(tasks[i].handle) : -1;
+
+  return n_;
+}
+
+const char* pcSysmonTaskName(void* task_)
+{
+  for (int i = 1; i < n_tasks; i++)
+    if (tasks[i].handle == task_)
+      return tasks[i].name;
+  return NULL;
+}
+
+int iSysmonTaskSlot(void* task_)
+{
+  for (int i = 1; i < n_tasks; i++)
+    if (tasks[i].handle == task_)
+      return i;
+  return 0;
+}
+
+int iSysmonGetBusyPermille()
+{
+  return 1000 - tasks[0].cpu_permille;
+}
+
+#ifdef PROFILE
+void vSysmonGetProbeLoads(uint16_t* permille_)
+{
+  taskENTER_CRITICAL();
+  for (int i = 0; i < PROFILE_NB; i++)
+    permille_[i] = probePermille[i];
+  taskEXIT_CRITICAL();
+}
+#endif
@@ -0,0 +1,43 @@
+#ifndef SYSMON_H
+# define SYSMON_H
+
+#include <stdint.h>
+
+// Per task CPU load, measured in core cycles between the context
+// switches and latched over each window. Interrupt time is charged to
+// the task it preempts; with --profile, the probes load is reported
+// too. Stack use is the kernel high-water mark (stacks are painted at
+// creation).
+#define SYSMON_TASKS_MAX 12 // Registered tasks, the idle task comes extra
+#define SYSMON_WINDOW_MS 1000
+
+typedef struct
+{
+  const char* name;
+  uint16_t cpu_permille; // Over the last window
+  int16_t stack_free;    // Words never used, -1 when unknown (idle)
+} sysmon_load_t;
+
+// From each task, before its loop. The tasks not registered are counted
+// as idle.
+void vSysmonRegisterTask(const char* name_);
+
+// From the kernel: context switch (traceTASK_SWITCHED_OUT) and tick hook
+void vSysmonSwitchedOut(void* tag_);
+void vSysmonTick();
+
+// Copy the loads of the idle then registered tasks, returns the count
+int iSysmonGetLoads(sysmon_load_t* loads_, int n_);
+// Name of a registered task, NULL for the others. Does not lock.
+const char* pcSysmonTaskName(void* task_);
+// Slot of a registered task (its tag), 0 for the others. Does not lock.
+int iSysmonTaskSlot(void* task_);
+// Time not spent idle over the last window
+int iSysmonGetBusyPermille();
+
+#ifdef PROFILE
+// Load of each profile probe over the last window (PROFILE_NB)
+void vSysmonGetProbeLoads(uint16_t* permille_);
+#endif
+
+#endif
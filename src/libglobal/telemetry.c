@@ -0,0 +1,320 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/odometry.h"
+#include "libglobal/protocol.h"
+#include "libglobal/sysmon.h"
+#include "libglobal/telemetry.h"
+#include "libglobal/topics.h"
+
+#include "libperiph/encoders.h"
+#include "libperiph/hardware.h"
+#include "libperiph/link.h"
+#include "libperiph/motors.h"
+#include "libperiph/periodic.h"
+#include "libperiph/power.h"
+#include "libperiph/sharps.h"
+#include "libperiph/sonar.h"
+
+// Left to the heartbeat while congested
+#define TELEMETRY_LOW_PRIORITY                                          \
+  (1 << PROTO_CHANNEL_BATTERY | 1 << PROTO_CHANNEL_CURRENT |            \
+   1 << PROTO_CHANNEL_CPU | 1 << PROTO_CHANNEL_LINK_ERRORS)
+
+static periodic_t stream;
+static int timeout = LINK_DROP;
+static uint32_t dropped;
+static volatile int periodMs;
+
+// Rate control, job state but the decimation
+static volatile int decimation;
+static uint32_t runs;
+static portTickType clearSince;
+static int lost;
+
+// Report on change, off while 0
+static volatile int heartbeatMs;
+static volatile uint16_t deadbands[PROTO_CHANNELS_NB] =
+  {
+    [PROTO_CHANNEL_SHARP_LEFT]  = 10,
+    [PROTO_CHANNEL_SONAR]       = 10,
+    [PROTO_CHANNEL_SHARP_RIGHT] = 10,
+    [PROTO_CHANNEL_BATTERY]     = 50,
+    [PROTO_CHANNEL_CURRENT]     = 20,
+    [PROTO_CHANNEL_X]           = 5,
+    [PROTO_CHANNEL_Y]           = 5,
+    [PROTO_CHANNEL_THETA]       = 10,
+    [PROTO_CHANNEL_SONAR_LEFT]  = 10,
+    [PROTO_CHANNEL_SONAR_RIGHT] = 10,
+    [PROTO_CHANNEL_CPU]         = 20,
+    [PROTO_CHANNEL_PERIOD]      = 0,
+  };
+// Job state: the values as last sent, and when all of them were
+static int16_t sent[PROTO_CHANNELS_NB];
+static portTickType sentAll;
+static int primed;
+static uint8_t seq;
+// Slipping wheels as last reported
+static uint8_t slipping;
+
+static void vTelemetrySend();
+
+void vTelemetryInit()
+{
+  vPeriodicInit(&stream, "telemetry", &vTelemetrySend);
+}
+
+void vTelemetrySetTimeout(int timeout_ms_)
+{
+  timeout = timeout_ms_ < 0 ? LINK_BLOCK : timeout_ms_;
+}
+
+uint32_t uTelemetryDropped()
+{
+  return dropped;
+}
+
+void vTelemetrySetHeartbeat(int heartbeat_ms_)
+{
+  if (heartbeat_ms_ > 0 && heartbeat_ms_ < TELEMETRY_MIN_HEARTBEAT_MS)
+    heartbeat_ms_ = TELEMETRY_MIN_HEARTBEAT_MS;
+  else if (heartbeat_ms_ < 0)
+    heartbeat_ms_ = 0;
+  // All of them in the first frames
+  primed = 0;
+  heartbeatMs = heartbeat_ms_;
+}
+
+int iTelemetryGetHeartbeat()
+{
+  return heartbeatMs;
+}
+
+void vTelemetrySetDeadband(int channel_, int deadband_)
+{
+  if (channel_ >= 0 && channel_ < PROTO_CHANNELS_NB)
+    deadbands[channel_] = deadband_ < 0 ? 0 :
+      deadband_ > INT16_MAX ? INT16_MAX : deadband_;
+}
+
+int iTelemetryGetDeadband(int channel_)
+{
+  return deadbands[channel_];
+}
+
+void vTelemetrySetPeriod(int period_ms_)
+{
+  if (period_ms_ > 0 && period_ms_ < TELEMETRY_MIN_PERIOD_MS)
+    period_ms_ = TELEMETRY_MIN_PERIOD_MS;
+  else if (period_ms_ < 0)
+    period_ms_ = 0;
+
+  // The full rate first, the job sees it before its next run
+  decimation = 0;
+  periodMs = period_ms_;
+  vPeriodicSetPeriod(&stream, period_ms_);
+}
+
+int iTelemetryGetDecimation()
+{
+  return decimation;
+}
+
+int iTelemetryGetEffectivePeriod()
+{
+  return periodMs << decimation;
+}
+
+// Once per frame sent, so one step per effective period at most
+static void prvTelemetryAdapt(uint32_t tick_)
+{
+  const int backlog = iLinkStreamBacklog();
+
+  if (backlog >= TELEMETRY_CONGESTED_PERMILLE || lost)
+  {
+    if (decimation < TELEMETRY_MAX_DECIMATION)
+      decimation++;
+    clearSince = tick_;
+  }
+  else if (backlog > TELEMETRY_CLEAR_PERMILLE)
+    clearSince = tick_;
+  else if (decimation &&
+           tick_ - clearSince >= MS_TO_TICKS(TELEMETRY_RESTORE_MS))
+  {
+    decimation--;
+    clearSince = tick_;
+  }
+  lost = 0;
+}
+
+// Channels of a sample, by eProtoChannel. Returns the slipping wheels.
+static uint8_t prvTelemetrySample(int16_t* values_)
+{
+  motors_state_t motors;
+  sonar_measures_t sonars;
+  pose_t pose;
+
+  vMotorsGetState(&motors);
+  if (!uTopicsRead(TOPIC_SONAR, &sonars))
+    vSonarClearMeasures(&sonars);
+  vOdometryGetPose(&pose);
+
+  values_[PROTO_CHANNEL_SHARP_LEFT] = iSharpsMeasureDistMm(SHARP_LEFT);
+  values_[PROTO_CHANNEL_SONAR] = sonars.sonar[SONAR_CENTER].dist_mm;
+  values_[PROTO_CHANNEL_SHARP_RIGHT] = iSharpsMeasureDistMm(SHARP_RIGHT);
+  values_[PROTO_CHANNEL_MOTOR_LEFT] = motors.command_left;
+  values_[PROTO_CHANNEL_MOTOR_RIGHT] = motors.command_right;
+  values_[PROTO_CHANNEL_BATTERY] = iPowerGetBatteryMv();
+  values_[PROTO_CHANNEL_CURRENT] = iPowerGetCurrentMa();
+  values_[PROTO_CHANNEL_CUT_OFF] = motors.cut_off;
+  values_[PROTO_CHANNEL_X] = pose.x_mm;
+  values_[PROTO_CHANNEL_Y] = pose.y_mm;
+  values_[PROTO_CHANNEL_THETA] = pose.theta_mrad;
+  values_[PROTO_CHANNEL_SONAR_LEFT] = sonars.sonar[SONAR_LEFT].dist_mm;
+  values_[PROTO_CHANNEL_SONAR_RIGHT] = sonars.sonar[SONAR_RIGHT].dist_mm;
+  values_[PROTO_CHANNEL_CPU] = iSysmonGetBusyPermille();
+  values_[PROTO_CHANNEL_LINK_ERRORS] = uLinkErrors();
+  values_[PROTO_CHANNEL_PERIOD] = iTelemetryGetEffectivePeriod();
+  return motors.slipping;
+}
+
+// The traction control flags out of the channels, as PROTO_EVENT frames
+// on the stream transport: one per wheel changed, tried again next run
+// when dropped
+static void prvTelemetrySlip(uint8_t slipping_, uint32_t tick_, int timeout_)
+{
+  for (int i = 0; i < ENCODERS_NB; i++)
+    if ((slipping_ ^ slipping) & (1 << i))
+    {
+      const proto_event_t frame =
+        {
+          .tick   = tick_,
+          .source = PROTO_EVENT_SLIP + i,
+          .value  = !!(slipping_ & (1 << i)),
+        };
+
+      if (xProtoTryStream(PROTO_EVENT, &frame, sizeof (frame), timeout_))
+        slipping ^= 1 << i;
+    }
+}
+
+// The channels of mask_ in PROTO_TELEMETRY_DELTA frames, as many as they
+// take. The sent values follow the frames that went out only.
+static int prvTelemetrySendDelta(const int16_t* values_, uint16_t mask_,
+                                 uint32_t tick_, int timeout_)
+{
+  int all = 1;
+
+  while (mask_)
+  {
+    uint16_t chunk = 0;
+    int n = 0;
+    proto_writer_t w;
+
+    for (int i = 0; i < PROTO_CHANNELS_NB && n < PROTO_DELTA_CHANNELS_MAX; i++)
+      if (mask_ & (1 << i))
+      {
+        chunk |= 1 << i;
+        n++;
+      }
+    mask_ &= ~chunk;
+
+    if (!xProtoStreamBegin(&w, PROTO_TELEMETRY_DELTA,
+                           sizeof (proto_telemetry_delta_t) +
+                           n * sizeof (int16_t), timeout_))
+    {
+      dropped++;
+      lost = 1;
+      seq++;
+      all = 0;
+      continue;
+    }
+    vProtoPutU8(&w, seq++);
+    vProtoPutU32(&w, tick_);
+    vProtoPutU16(&w, chunk);
+    for (int i = 0; i < PROTO_CHANNELS_NB; i++)
+      if (chunk & (1 << i))
+      {
+        vProtoPutU16(&w, values_[i]);
+        sent[i] = values_[i];
+      }
+    vProtoStreamEnd(&w);
+  }
+  return all;
+}
+
+// Report on change: the channels beyond their deadband, all of them
+// at the heartbeat or until a whole sample went out, the slow ones only
+// then while congested
+static void prvTelemetryOnChange(const int16_t* values_, uint32_t tick_,
+                                 int heartbeat_ms_, int timeout_)
+{
+  const uint16_t skipped = decimation ? TELEMETRY_LOW_PRIORITY : 0;
+  const int heartbeat = !primed ||
+    tick_ - sentAll >= MS_TO_TICKS(heartbeat_ms_);
+  uint16_t mask = 0;
+
+  for (int i = 0; i < PROTO_CHANNELS_NB; i++)
+  {
+    // Wrapping difference, for the heading
+    const int16_t diff = values_[i] - sent[i];
+
+    if (heartbeat ||
+        (!(skipped & (1 << i)) && (diff < 0 ? -diff : diff) > deadbands[i]))
+      mask |= 1 << i;
+  }
+  if (prvTelemetrySendDelta(values_, mask, tick_, timeout_) && heartbeat)
+  {
+    sentAll = tick_;
+    primed = 1;
+  }
+}
+
+// Stream job, from the timer service task, with the other periodic jobs
+// behind it, on the stream transport (the host link unless set): a frame
+// that does not fit in the link within the timeout is dropped, the next
+// one comes a period later. Serialized straight into the transmit
+// buffer, in the order of proto_telemetry_t, the snapshots taken first:
+// the runs decimated away sample nothing, the frames sent are fresh.
+static void vTelemetrySend()
+{
+  const uint32_t tick = xTaskGetTickCount();
+  const int heartbeat_ms = heartbeatMs;
+  const int wait = timeout;
+  int16_t values[PROTO_CHANNELS_NB];
+  proto_writer_t w;
+
+  if (wait == LINK_BLOCK)
+    decimation = 0;
+  else
+  {
+    if (runs++ & ((1 << decimation) - 1))
+      return;
+    prvTelemetryAdapt(tick);
+  }
+
+  prvTelemetrySlip(prvTelemetrySample(values), tick,
+                   decimation ? LINK_DROP : wait);
+  if (heartbeat_ms)
+  {
+    prvTelemetryOnChange(values, tick, heartbeat_ms,
+                         decimation ? LINK_DROP : wait);
+    return;
+  }
+
+  if (!xProtoStreamBegin(&w, PROTO_TELEMETRY, sizeof (proto_telemetry_t),
+                         decimation ? LINK_DROP : wait))
+  {
+    dropped++;
+    lost = 1;
+    return;
+  }
+  vProtoPutU32(&w, tick);
+  // The period channel is for the report on change only
+  for (int i = 0; i < PROTO_CHANNEL_PERIOD; i++)
+    if (i == PROTO_CHANNEL_CUT_OFF || i == PROTO_CHANNEL_LINK_ERRORS)
+      vProtoPutU8(&w, values[i]);
+    else
+      vProtoPutU16(&w, values[i]);
+  vProtoStreamEnd(&w);
+}
@@ -0,0 +1,45 @@
+#ifndef TELEMETRY_H
+# define TELEMETRY_H
+
+#include "FreeRTOS.h"
+
+#include "libglobal/protocol.h"
+
+#define TELEMETRY_MIN_PERIOD_MS 10
+
+// Streamed by a periodic job (libperiph/periodic)
+void vTelemetryInit();
+// Stream a PROTO_TELEMETRY frame every period_ms_, 0 to stop
+void vTelemetrySetPeriod(int period_ms_);
+// Wait for the host link up to timeout_ms_, LINK_DROP (the default) or
+// LINK_BLOCK, then drop the frame
+void vTelemetrySetTimeout(int timeout_ms_);
+// Frames dropped so far
+uint32_t uTelemetryDropped();
+
+// Rate control: while the stream lane backs up (iLinkStreamBacklog) or a
+// frame is dropped, the samples go one run out of 2, 4, up to 2^N, and
+// no longer wait for the link; the report on change leaves the slow
+// channels to the heartbeat. Back a step once the lane stayed clear for
+// TELEMETRY_RESTORE_MS. Off with the LINK_BLOCK timeout, every sample
+// wanted.
+#define TELEMETRY_CONGESTED_PERMILLE 500
+#define TELEMETRY_CLEAR_PERMILLE     125
+#define TELEMETRY_MAX_DECIMATION     3
+#define TELEMETRY_RESTORE_MS         1000
+// Samples sent one run out of 2^N
+int iTelemetryGetDecimation();
+// The period of the samples as sent, in ms, 0 when stopped
+int iTelemetryGetEffectivePeriod();
+
+// Report on change: sampled every period, PROTO_TELEMETRY_DELTA frames
+// of the channels that moved beyond their deadband since last sent, all
+// of them every heartbeat_ms_ (0 back to the PROTO_TELEMETRY frames).
+// No frame at all while nothing moves. A deadband of 0 sends any change.
+#define TELEMETRY_MIN_HEARTBEAT_MS 100
+void vTelemetrySetHeartbeat(int heartbeat_ms_);
+int iTelemetryGetHeartbeat();
+void vTelemetrySetDeadband(int channel_, int deadband_);
+int iTelemetryGetDeadband(int channel_);
+
+#endif
@@ -0,0 +1,86 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/sysmon.h"
+#include "libglobal/timeline.h"
+
+#include "libperiph/cycles.h"
+
+#define TIMELINE_MASK (TIMELINE_NB - 1)
+
+// PRIMASK saved and set, then put back: nests under any mask, BASEPRI of
+// the kernel included, where the FromISR mask would clear it on the way
+// out
+#ifdef SIMULATION
+# define TIMELINE_LOCK() \
+  const unsigned portBASE_TYPE lock = portSET_INTERRUPT_MASK_FROM_ISR()
+# define TIMELINE_UNLOCK() portCLEAR_INTERRUPT_MASK_FROM_ISR(lock)
+#else
+# define TIMELINE_LOCK() \
+  uint32_t lock; \
+  __asm volatile ("mrs %0, primask\n\tcpsid i" : "=r" (lock) :: "memory")
+# define TIMELINE_UNLOCK() \
+  __asm volatile ("msr primask, %0" :: "r" (lock) : "memory")
+#endif
+
+static timeline_event_t events[TIMELINE_NB];
+// Free running, the slots below head - TIMELINE_NB are written over
+static uint32_t head;
+static uint32_t start;
+static volatile int frozen;
+
+void vTimelineLog(uint8_t event_, uint8_t arg_)
+{
+  TIMELINE_LOCK();
+  if (!frozen)
+  {
+    timeline_event_t* event = &events[head++ & TIMELINE_MASK];
+    event->cycles = uCyclesNow();
+    event->event = event_;
+    event->arg = arg_;
+  }
+  TIMELINE_UNLOCK();
+}
+
+void vTimelineSwitchedIn(void* tag_)
+{
+  vTimelineLog(TIMELINE_SWITCH_IN, (uintptr_t)tag_);
+}
+
+void vTimelineSwitchedOut(void* tag_)
+{
+  vTimelineLog(TIMELINE_SWITCH_OUT, (uintptr_t)tag_);
+}
+
+// The running task, out of the context switch: no lock in the handle nor
+// the slot lookup
+void vTimelineWait(uint8_t event_)
+{
+  vTimelineLog(event_, iSysmonTaskSlot(xTaskGetCurrentTaskHandle()));
+}
+
+int iTimelineDump(pfunTimelineEvent callback_, void* context_,
+                  uint32_t* lost_)
+{
+  uint32_t first, last;
+
+  // Seen by each writer under its lock: none is left halfway
+  frozen = 1;
+  taskENTER_CRITICAL();
+  first = start;
+  last = head;
+  taskEXIT_CRITICAL();
+
+  *lost_ = 0;
+  if (last - first > TIMELINE_NB)
+  {
+    *lost_ = last - first - TIMELINE_NB;
+    first = last - TIMELINE_NB;
+  }
+  for (uint32_t i = first; i != last; i++)
+    callback_(&events[i & TIMELINE_MASK], context_);
+
+  start = head;
+  frozen = 0;
+  return last - first;
+}
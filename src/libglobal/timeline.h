@@ -0,0 +1,64 @@
+#ifndef TIMELINE_H
+# define TIMELINE_H
+
+#include <stdint.h>
+
+// Scheduling timeline, with --timeline: task switches, waits and wakes,
+// interrupt entries and exits, stamped with the cycle counter into a RAM
+// ring, the newest over the oldest. "tl" dumps what came since the last
+// dump, "waf trace" turns it into a trace for chrome://tracing or
+// Perfetto.
+
+// Events in the ring. Must be a power of 2.
+#ifndef TIMELINE_NB
+# define TIMELINE_NB 256
+#endif
+
+enum eTimelineEvent {
+  TIMELINE_SWITCH_IN  = 1, // arg: sysmon slot, 0 for idle and unregistered
+  TIMELINE_SWITCH_OUT = 2, // arg: sysmon slot
+  TIMELINE_WAIT_QUEUE = 3, // arg: slot of the task blocking on a queue
+  TIMELINE_WAIT_FLAGS = 4, // arg: slot of the task blocking on flags
+  TIMELINE_WAIT_DELAY = 5, // arg: slot of the task delaying
+  TIMELINE_WAKE       = 6, // arg: slot of the task made ready by flags
+  TIMELINE_ISR_ENTER  = 7, // arg: IRQn_Type
+  TIMELINE_ISR_EXIT   = 8, // arg: IRQn_Type
+};
+
+typedef struct
+{
+  uint32_t cycles;
+  uint8_t event;
+  uint8_t arg;
+} __attribute__((packed)) timeline_event_t;
+
+// Markers at the top and the bottom of the handlers, compiled in with
+// --timeline only
+#ifdef TIMELINE
+# define TIMELINE_ISR_ENTER(irq) vTimelineLog(TIMELINE_ISR_ENTER, irq)
+# define TIMELINE_ISR_EXIT(irq)  vTimelineLog(TIMELINE_ISR_EXIT, irq)
+#else
+# define TIMELINE_ISR_ENTER(irq)
+# define TIMELINE_ISR_EXIT(irq)
+#endif
+
+// Never blocks, about 20 cycles, from anywhere: the interrupts are off
+// (PRIMASK) for the time of the slot, the kernel critical sections
+// included
+void vTimelineLog(uint8_t event_, uint8_t arg_);
+
+// Kernel hooks (FreeRTOSConfig.h): the tag is the sysmon slot
+void vTimelineSwitchedIn(void* tag_);
+void vTimelineSwitchedOut(void* tag_);
+void vTimelineWait(uint8_t event_);
+
+// Called for each event, oldest first
+typedef void (*pfunTimelineEvent)(const timeline_event_t* event_,
+                                  void* context_);
+
+// From a task: the recording stops for the walk, then starts over from
+// an empty ring. Returns the count, and the events lost to the wrap.
+int iTimelineDump(pfunTimelineEvent callback_, void* context_,
+                  uint32_t* lost_);
+
+#endif
@@ -0,0 +1,116 @@
+#include <string.h>
+
+#include "FreeRTOS.h"
+
+#include "libglobal/topics.h"
+
+// Keep the compiler and the core from reordering memory accesses
+#ifdef SIMULATION
+# define MEMORY_BARRIER() __sync_synchronize()
+#else
+# define MEMORY_BARRIER() __asm volatile ("dmb" ::: "memory")
+#endif
+
+static topic_t topics[TOPICS_NB];
+
+void vTopicsInit(int topic_, const char* name_, void* slots_, uint16_t size_)
+{
+  topic_t* topic = &topics[topic_];
+
+  memset(slots_, 0, 2 * size_);
+  topic->name = name_;
+  topic->size = size_;
+  topic->slots = slots_;
+  topic->seq = 0;
+}
+
+int xTopicsSubscribe(int topic_, flags_t* flags_, uint32_t bits_)
+{
+  topic_t* topic = &topics[topic_];
+
+  if (topic->subscribers_nb == TOPICS_SUBSCRIBERS_NB)
+    return 0;
+  topic->subscribers[topic->subscribers_nb].flags = flags_;
+  topic->subscribers[topic->subscribers_nb].bits = bits_;
+  topic->subscribers_nb++;
+  return 1;
+}
+
+static void* prvTopicsSlot(const topic_t* topic_, uint32_t seq_)
+{
+  return (uint8_t*)topic_->slots + (seq_ & 1) * topic_->size;
+}
+
+// Into the slot of the next sequence, the readers are on the other one
+static void prvTopicsWrite(topic_t* topic_, const void* sample_)
+{
+  const uint32_t seq = topic_->seq + 1;
+
+  memcpy(prvTopicsSlot(topic_, seq), sample_, topic_->size);
+  MEMORY_BARRIER();
+  topic_->seq = seq;
+}
+
+void vTopicsPublish(int topic_, const void* sample_)
+{
+  topic_t* topic = &topics[topic_];
+
+  if (!topic->slots)
+    return;
+  prvTopicsWrite(topic, sample_);
+  for (int i = 0; i < topic->subscribers_nb; i++)
+    vFlagsSet(topic->subscribers[i].flags, topic->subscribers[i].bits);
+}
+
+void vTopicsPublishFromISR(int topic_, const void* sample_,
+                           portBASE_TYPE* woken_)
+{
+  topic_t* topic = &topics[topic_];
+
+  if (!topic->slots)
+    return;
+  prvTopicsWrite(topic, sample_);
+  for (int i = 0; i < topic->subscribers_nb; i++)
+    vFlagsSetFromISR(topic->subscribers[i].flags, topic->subscribers[i].bits,
+                     woken_);
+}
+
+const void* pvTopicsPeek(int topic_, uint32_t* seq_)
+{
+  const topic_t* topic = &topics[topic_];
+
+  *seq_ = topic->seq;
+  MEMORY_BARRIER();
+  return prvTopicsSlot(topic, *seq_);
+}
+
+// The slot of seq_ is only written again by the publish after the next
+// one, which starts once the next one has ended
+int xTopicsIsValid(int topic_, uint32_t seq_)
+{
+  MEMORY_BARRIER();
+  return topics[topic_].seq == seq_;
+}
+
+uint32_t uTopicsRead(int topic_, void* sample_)
+{
+  const topic_t* topic = &topics[topic_];
+  uint32_t seq;
+
+  if (!topic->slots)
+    return 0;
+  do
+    memcpy(sample_, pvTopicsPeek(topic_, &seq), topic->size);
+  while (!xTopicsIsValid(topic_, seq));
+  return seq;
+}
+
+uint32_t uTopicsSeq(int topic_)
+{
+  return topics[topic_].seq;
+}
+
+const topic_t* pxTopicsGet(int topic_)
+{
+  return &topics[topic_];
+}
@@ -0,0 +1,61 @@
+#ifndef TOPICS_H
+# define TOPICS_H
+
+#include <stdint.h>
+
+#include "libglobal/flags.h"
+
+// Latest value of the state and sensor data, each published by its one
+// producer and read by any number of consumers, without locks: the
+// producer writes the slot the readers are not on, then bumps the
+// sequence. A reader only retries when a publish ended while it copied,
+// never waits on a producer it preempted. Consumers can also be woken at
+// each publish.
+enum eTopic {
+  TOPIC_MOTORS = 0,   // motors_state_t, each period of the motors daemon
+  TOPIC_SONAR  = 1,   // sonar_measures_t, after each slot of the sonars
+  TOPICS_NB
+};
+
+// Subscribers woken by a publish, per topic
+#define TOPICS_SUBSCRIBERS_NB 2
+
+typedef struct
+{
+  const char* name;
+  uint16_t size;
+  uint16_t subscribers_nb;
+  void* slots;              // Two samples of size bytes
+  // Count of publishes, the latest in the slot of its lowest bit
+  volatile uint32_t seq;
+  struct
+  {
+    flags_t* flags;
+    uint32_t bits;
+  } subscribers[TOPICS_SUBSCRIBERS_NB];
+} topic_t;
+
+// By the producer, before the scheduler starts: slots_ holds two samples
+void vTopicsInit(int topic_, const char* name_, void* slots_, uint16_t size_);
+// Before the scheduler starts too. Returns 0 when the topic is full.
+int xTopicsSubscribe(int topic_, flags_t* flags_, uint32_t bits_);
+
+// Single producer, from one task or one interrupt (woken_ as the FromISR
+// calls of the kernel)
+void vTopicsPublish(int topic_, const void* sample_);
+void vTopicsPublishFromISR(int topic_, const void* sample_,
+                           portBASE_TYPE* woken_);
+
+// Copy of the latest sample, zeroed before the first one. Returns its
+// sequence, 0 before the first one.
+uint32_t uTopicsRead(int topic_, void* sample_);
+// Zero copy: the latest sample where it lies, still good to use while
+// xTopicsIsValid() of its sequence
+const void* pvTopicsPeek(int topic_, uint32_t* seq_);
+int xTopicsIsValid(int topic_, uint32_t seq_);
+// Latest sequence, to see whether there is anything new
+uint32_t uTopicsSeq(int topic_);
+
+const topic_t* pxTopicsGet(int topic_);
+
+#endif
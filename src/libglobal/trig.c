@@ -0,0 +1,128 @@
+#include "libglobal/fixed.h"
+#include "libglobal/trig.h"
+
+// sin over a quarter turn in Q15, 256 steps
+#define TRIG_SIN_STEPS 256
+static const int16_t table_sin[TRIG_SIN_STEPS + 1] = {
+      0,   201,   402,   603,   804,  1005,  1206,  1407,
+   1608,  1809,  2009,  2210,  2411,  2611,  2811,  3012,
+   3212,  3412,  3612,  3812,  4011,  4211,  4410,  4609,
+   4808,  5007,  5205,  5404,  5602,  5800,  5998,  6195,
+   6393,  6590,  6787,  6983,  7180,  7376,  7571,  7767,
+   7962,  8157,  8351,  8546,  8740,  8933,  9127,  9319,
+   9512,  9704,  9896, 10088, 10279, 10469, 10660, 10850,
+  11039, 11228, 11417, 11605, 11793, 11980, 12167, 12354,
+  12540, 12725, 12910, 13095, 13279, 13463, 13646, 13828,
+  14010, 14192, 14373, 14553, 14733, 14912, 15091, 15269,
+  15447, 15624, 15800, 15976, 16151, 16326, 16500, 16673,
+  16846, 17018, 17190, 17361, 17531, 17700, 17869, 18037,
+  18205, 18372, 18538, 18703, 18868, 19032, 19195, 19358,
+  19520, 19681, 19841, 20001, 20160, 20318, 20475, 20632,
+  20788, 20943, 21097, 21251, 21403, 21555, 21706, 21856,
+  22006, 22154, 22302, 22449, 22595, 22740, 22884, 23028,
+  23170, 23312, 23453, 23593, 23732, 23870, 24008, 24144,
+  24279, 24414, 24548, 24680, 24812, 24943, 25073, 25202,
+  25330, 25457, 25583, 25708, 25833, 25956, 26078, 26199,
+  26320, 26439, 26557, 26674, 26791, 26906, 27020, 27133,
+  27246, 27357, 27467, 27576, 27684, 27791, 27897, 28002,
+  28106, 28209, 28311, 28411, 28511, 28610, 28707, 28803,
+  28899, 28993, 29086, 29178, 29269, 29359, 29448, 29535,
+  29622, 29707, 29792, 29875, 29957, 30038, 30118, 30196,
+  30274, 30350, 30425, 30499, 30572, 30644, 30715, 30784,
+  30853, 30920, 30986, 31050, 31114, 31177, 31238, 31298,
+  31357, 31415, 31471, 31527, 31581, 31634, 31686, 31737,
+  31786, 31834, 31881, 31927, 31972, 32015, 32058, 32099,
+  32138, 32177, 32214, 32251, 32286, 32319, 32352, 32383,
+  32413, 32442, 32470, 32496, 32522, 32546, 32568, 32590,
+  32610, 32629, 32647, 32664, 32679, 32693, 32706, 32718,
+  32729, 32738, 32746, 32753, 32758, 32762, 32766, 32767,
+  32767,
+};
+
+// atan(2^-i) as binary angles
+#define TRIG_CORDIC_STEPS 24
+static const uint32_t table_atan[TRIG_CORDIC_STEPS] = {
+  536870912, 316933406, 167458907, 85004756, 42667331, 21354465,
+  10679838, 5340245, 2670163, 1335087, 667544, 333772,
+  166886, 83443, 41722, 20861, 10430, 5215,
+  2608, 1304, 652, 326, 163, 81,
+};
+
+int32_t iTrigSin(uint32_t angle_)
+{
+  const uint32_t quadrant = angle_ >> 30;
+  uint32_t index = (angle_ >> 22) & (TRIG_SIN_STEPS - 1);
+  // 16 bits between two entries
+  const int32_t frac = (angle_ >> 6) & 0xffff;
+  int32_t low, high, value;
+
+  if (quadrant & 1) // Mirror on the second and fourth quarters
+  {
+    index = TRIG_SIN_STEPS - index;
+    low = table_sin[index];
+    high = table_sin[index - 1];
+  }
+  else
+  {
+    low = table_sin[index];
+    high = table_sin[index + 1];
+  }
+  value = low + (((high - low) * frac) >> 16);
+
+  return quadrant & 2 ? -value : value;
+}
+
+uint32_t uTrigAtan2(int32_t y_, int32_t x_)
+{
+  const uint32_t ax = x_ < 0 ? -(uint32_t)x_ : (uint32_t)x_;
+  const uint32_t ay = y_ < 0 ? -(uint32_t)y_ : (uint32_t)y_;
+  const int leading = iFixedClz(ax | ay);
+  uint32_t angle = 0;
+  int32_t x, y;
+
+  if (leading == 32)
+    return 0;
+
+  // Largest coordinate at bit 28: room for the length, up to sqrt(2)
+  // times that, grown by the CORDIC gain of 1.65, and all the bits of
+  // small vectors
+  if (leading >= 3)
+  {
+    x = (int32_t)((uint32_t)x_ << (leading - 3));
+    y = (int32_t)((uint32_t)y_ << (leading - 3));
+  }
+  else
+  {
+    x = x_ >> (3 - leading);
+    y = y_ >> (3 - leading);
+  }
+
+  // Into the right half plane
+  if (x < 0)
+  {
+    angle = TRIG_HALF_TURN;
+    x = -x;
+    y = -y;
+  }
+
+  // Rotate towards the x axis, adding up the rotations
+  for (int i = 0; i < TRIG_CORDIC_STEPS; i++)
+  {
+    const int32_t dx = y >> i;
+    const int32_t dy = x >> i;
+
+    if (y > 0)
+    {
+      x += dx;
+      y -= dy;
+      angle += table_atan[i];
+    }
+    else
+    {
+      x -= dx;
+      y += dy;
+      angle -= table_atan[i];
+    }
+  }
+  return angle;
+}
@@ -0,0 +1,25 @@
+#ifndef TRIG_H
+# define TRIG_H
+
+#include <stdint.h>
+
+// Fixed-point trigonometry on binary angles: a full turn is 2^32, so
+// that angles wrap around for free and the top bits index the tables.
+#define TRIG_QUARTER_TURN (1u << 30)
+#define TRIG_HALF_TURN    (1u << 31)
+// Binary angle of a constant in degrees, negative ones too
+#define TRIG_DEGREES(d)   ((uint32_t)((int64_t)(d) * 0x100000000ll / 360))
+
+// Q15, from a quarter turn table of 257 entries, linear interpolation
+// between them: within 5e-5 ("waf bench" measures it)
+int32_t iTrigSin(uint32_t angle_);
+static inline int32_t iTrigCos(uint32_t angle_)
+{
+  return iTrigSin(angle_ + TRIG_QUARTER_TURN);
+}
+
+// Angle of (x, y), CORDIC vectoring in 24 steps of shifts and adds: within
+// 3e-8 turn, 0 for (0, 0)
+uint32_t uTrigAtan2(int32_t y_, int32_t x_);
+
+#endif
@@ -0,0 +1,372 @@
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/polar.h"
+#include "libglobal/topics.h"
+#include "libglobal/vm.h"
+
+#include "libperiph/bumpers.h"
+#include "libperiph/motors.h"
+#include "libperiph/periodic.h"
+#include "libperiph/sharps.h"
+#include "libperiph/sonar.h"
+
+static periodic_t loop;
+
+static uint8_t code[VM_CODE_SIZE];
+static int32_t vars[VM_VARS_NB];
+static volatile int budget;
+static portTickType startTick;
+
+static volatile vm_status_t status;
+
+static void vVmStep();
+
+void vVmInit()
+{
+  vPeriodicInit(&loop, "vm", &vVmStep);
+}
+
+// Bytes after the opcode, -1 for an unknown one
+static int prvVmImmediate(uint8_t op_)
+{
+  switch (op_)
+  {
+    case VM_PUSH8:
+    case VM_IN:
+    case VM_LOAD:
+    case VM_STORE:
+    case VM_JMP:
+    case VM_JZ:
+      return 1;
+    case VM_PUSH16:
+      return 2;
+    case VM_HALT:
+    case VM_DUP: case VM_DROP: case VM_SWAP: case VM_OVER:
+    case VM_ADD: case VM_SUB: case VM_MUL: case VM_DIV:
+    case VM_NEG: case VM_ABS: case VM_MIN: case VM_MAX:
+    case VM_AND: case VM_OR: case VM_NOT:
+    case VM_LT: case VM_LE: case VM_GT: case VM_GE: case VM_EQ: case VM_NE:
+    case VM_VEL: case VM_MOT:
+      return 0;
+  }
+  return -1;
+}
+
+// Stamps the start of each instruction, then checks the jumps land on one
+static int prvVmCheck(uint16_t* pc_)
+{
+  uint32_t starts[VM_CODE_SIZE / 32 + 1];
+  const int size = status.size;
+  int pc, next, target;
+
+  memset(starts, 0, sizeof (starts));
+  for (pc = 0; pc < size; pc = next)
+  {
+    const int immediate = prvVmImmediate(code[pc]);
+    *pc_ = pc;
+    next = pc + 1 + immediate;
+    if (immediate < 0 || next > size)
+      return VM_BAD_CODE;
+    if ((code[pc] == VM_IN && code[pc + 1] >= VM_IN_NB) ||
+        ((code[pc] == VM_LOAD || code[pc] == VM_STORE) &&
+         code[pc + 1] >= VM_VARS_NB))
+      return VM_BAD_CODE;
+    starts[pc / 32] |= 1u << (pc % 32);
+  }
+  // The end of the code is a halt
+  starts[size / 32] |= 1u << (size % 32);
+
+  for (pc = 0; pc < size; pc = next)
+  {
+    *pc_ = pc;
+    next = pc + 1 + prvVmImmediate(code[pc]);
+    if (code[pc] != VM_JMP && code[pc] != VM_JZ)
+      continue;
+    target = next + (int8_t)code[pc + 1];
+    if (target < 0 || target > size ||
+        !(starts[target / 32] & (1u << (target % 32))))
+      return VM_BAD_CODE;
+  }
+  return VM_OK;
+}
+
+int xVmLoad(uint16_t offset_, const uint8_t* code_, int size_)
+{
+  if (!offset_)
+  {
+    vVmStop();
+    status.state = VM_STOPPED;
+    status.error = VM_OK;
+    status.size = 0;
+  }
+  if (offset_ != status.size || offset_ + size_ > VM_CODE_SIZE)
+    return 0;
+
+  memcpy(&code[offset_], code_, size_);
+  status.size += size_;
+  return 1;
+}
+
+int iVmStart(int period_ms_, int budget_)
+{
+  uint16_t pc = 0;
+  int error;
+
+  vVmStop();
+  if (period_ms_ <= 0 || budget_ <= 0 || budget_ > VM_MAX_BUDGET)
+    return VM_BAD_CODE;
+  error = prvVmCheck(&pc);
+  status.error = error;
+  status.pc = error ? pc : 0;
+  if (error)
+  {
+    status.state = VM_FAULT;
+    return error;
+  }
+
+  memset(vars, 0, sizeof (vars));
+  budget = budget_;
+  status.peak = 0;
+  status.periods = 0;
+  startTick = xTaskGetTickCount();
+  status.state = VM_RUNNING;
+  vPeriodicSetPeriod(&loop, period_ms_);
+  return VM_OK;
+}
+
+void vVmStop()
+{
+  vPeriodicSetPeriod(&loop, 0);
+  if (status.state == VM_RUNNING)
+  {
+    status.state = VM_STOPPED;
+    vMotorsStopNow();
+  }
+}
+
+void vVmGetStatus(vm_status_t* status_)
+{
+  taskENTER_CRITICAL();
+  *status_ = status;
+  taskEXIT_CRITICAL();
+}
+
+int32_t xVmGetVar(int var_)
+{
+  return vars[var_];
+}
+
+static void prvVmFault(int error_, int pc_)
+{
+  vPeriodicSetPeriod(&loop, 0);
+  status.error = error_;
+  status.pc = pc_;
+  status.state = VM_FAULT;
+  vSetMotorsCommand(0, 0);
+}
+
+static int32_t prvVmInput(int input_, const sonar_measures_t* sonars_,
+                          const motors_state_t* motors_)
+{
+  int value;
+
+  switch (input_)
+  {
+    case VM_IN_SONAR_LEFT:
+    case VM_IN_SONAR_CENTER:
+    case VM_IN_SONAR_RIGHT:
+    {
+      const sonar_measure_t* sonar = &sonars_->sonar[input_ - VM_IN_SONAR_LEFT];
+      return sonar->valid ? sonar->dist_mm : -1;
+    }
+    case VM_IN_SHARP_LEFT:
+    case VM_IN_SHARP_RIGHT:
+      value = iSharpsMeasureDistMm(input_ == VM_IN_SHARP_LEFT ?
+                                   SHARP_LEFT : SHARP_RIGHT);
+      return value == SHARPS_BAD_VALUE ? -1 : value;
+    case VM_IN_FRONT:
+      return iPolarSectorMm(0);
+    case VM_IN_BUMPERS:
+      value = 0;
+      for (int i = 0; i < BUMPERS_NB; i++)
+        if (iBumpersIsPressed(i))
+          value |= 1 << i;
+      return value;
+    case VM_IN_SPEED_LEFT:
+      return motors_->speed_left;
+    case VM_IN_SPEED_RIGHT:
+      return motors_->speed_right;
+    case VM_IN_HEADING:
+      return motors_->heading_mrad;
+    case VM_IN_TIME_MS:
+      return (xTaskGetTickCount() - startTick) * portTICK_RATE_MS;
+  }
+  return 0;
+}
+
+static int16_t prvVmClamp(int32_t value_)
+{
+  return value_ < INT16_MIN ? INT16_MIN : value_ > INT16_MAX ? INT16_MAX : value_;
+}
+
+#define POP()     (stack[--sp])
+#define PUSH(v)   (stack[sp++] = (v))
+#define NEED(n)   if (sp < (n)) { error = VM_UNDERFLOW; break; }
+#define ROOM(n)   if (sp + (n) > VM_STACK_NB) { error = VM_OVERFLOW; break; }
+#define BINARY(expr)                            \
+  NEED(2);                                      \
+  b = POP(); a = POP(); PUSH(expr);             \
+  break
+
+// Periodic job, from the timer service task: the code checked at the
+// start, only the stack is checked here
+static void vVmStep()
+{
+  int32_t stack[VM_STACK_NB];
+  sonar_measures_t sonars;
+  motors_state_t motors;
+  int32_t a, b;
+  int sp = 0, pc = 0, steps = 0, op = VM_HALT;
+  int error = VM_OK;
+
+  if (status.state != VM_RUNNING)
+    return;
+
+  // The topics once a period: the same values for all the inputs
+  if (!uTopicsRead(TOPIC_SONAR, &sonars))
+    vSonarClearMeasures(&sonars);
+  uTopicsRead(TOPIC_MOTORS, &motors);
+
+  while (pc < status.size && error == VM_OK)
+  {
+    if (steps++ == budget)
+    {
+      error = VM_BUDGET;
+      break;
+    }
+
+    op = code[pc];
+    switch (op)
+    {
+      case VM_HALT:
+        pc = status.size;
+        continue;
+      case VM_PUSH8:
+        ROOM(1);
+        PUSH((int8_t)code[pc + 1]);
+        break;
+      case VM_PUSH16:
+        ROOM(1);
+        PUSH((int16_t)(code[pc + 1] | code[pc + 2] << 8));
+        break;
+      case VM_IN:
+        ROOM(1);
+        PUSH(prvVmInput(code[pc + 1], &sonars, &motors));
+        break;
+      case VM_LOAD:
+        ROOM(1);
+        PUSH(vars[code[pc + 1]]);
+        break;
+      case VM_STORE:
+        NEED(1);
+        vars[code[pc + 1]] = POP();
+        break;
+      case VM_DUP:
+        NEED(1);
+        ROOM(1);
+        a = stack[sp - 1];
+        PUSH(a);
+        break;
+      case VM_DROP:
+        NEED(1);
+        sp--;
+        break;
+      case VM_SWAP:
+        NEED(2);
+        a = stack[sp - 1];
+        stack[sp - 1] = stack[sp - 2];
+        stack[sp - 2] = a;
+        break;
+      case VM_OVER:
+        NEED(2);
+        ROOM(1);
+        a = stack[sp - 2];
+        PUSH(a);
+        break;
+      case VM_ADD: BINARY(a + b);
+      case VM_SUB: BINARY(a - b);
+      case VM_MUL: BINARY(a * b);
+      case VM_DIV:
+        NEED(2);
+        if (!stack[sp - 1])
+        {
+          error = VM_DIVIDE;
+          break;
+        }
+        b = POP();
+        a = POP();
+        PUSH(a / b);
+        break;
+      case VM_NEG:
+        NEED(1);
+        stack[sp - 1] = -stack[sp - 1];
+        break;
+      case VM_ABS:
+        NEED(1);
+        if (stack[sp - 1] < 0)
+          stack[sp - 1] = -stack[sp - 1];
+        break;
+      case VM_MIN: BINARY(a < b ? a : b);
+      case VM_MAX: BINARY(a > b ? a : b);
+      case VM_AND: BINARY(a & b);
+      case VM_OR:  BINARY(a | b);
+      case VM_NOT:
+        NEED(1);
+        stack[sp - 1] = !stack[sp - 1];
+        break;
+      case VM_LT: BINARY(a < b);
+      case VM_LE: BINARY(a <= b);
+      case VM_GT: BINARY(a > b);
+      case VM_GE: BINARY(a >= b);
+      case VM_EQ: BINARY(a == b);
+      case VM_NE: BINARY(a != b);
+      case VM_JMP:
+        pc += 2 + (int8_t)code[pc + 1];
+        continue;
+      case VM_JZ:
+        NEED(1);
+        if (!POP())
+        {
+          pc += 2 + (int8_t)code[pc + 1];
+          continue;
+        }
+        break;
+      case VM_VEL:
+        NEED(2);
+        b = POP();
+        a = POP();
+        vSetMotorsVelocity(prvVmClamp(a), prvVmClamp(b));
+        break;
+      case VM_MOT:
+        NEED(2);
+        b = POP();
+        a = POP();
+        vSetMotorsCommand(prvVmClamp(a), prvVmClamp(b));
+        break;
+    }
+    if (error == VM_OK)
+      pc += 1 + prvVmImmediate(op);
+  }
+
+  if (error != VM_OK)
+  {
+    prvVmFault(error, pc);
+    return;
+  }
+  if (steps > status.peak)
+    status.peak = steps;
+  status.periods++;
+}
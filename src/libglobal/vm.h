@@ -0,0 +1,104 @@
+#ifndef VM_H
+# define VM_H
+
+#include <stdint.h>
+
+#include "libglobal/protocol.h"
+
+// Control logic uploaded by the host (PROTO_VM_LOAD), run without a new
+// firmware: a stack machine of int32_t, run from the start of the code
+// at each period by a periodic job, on the latest sensor values, up to a
+// budget of instructions. The variables last from one period to the
+// next. A fault (budget spent, stack out of bounds, division by zero)
+// stops the program and the motors. Shared with the host, plain C.
+#define VM_CODE_SIZE      256
+#define VM_STACK_NB       16
+#define VM_VARS_NB        8
+#define VM_DEFAULT_PERIOD_MS 5
+#define VM_DEFAULT_BUDGET 256
+#define VM_MAX_BUDGET     2048
+
+// One byte each, then the immediate if any. Jumps are relative to the
+// next instruction. Comparisons push 1 or 0; JZ pops.
+enum eVmOp {
+  VM_HALT  = 0x00, // End of the period
+  VM_PUSH8 = 0x01, // int8_t
+  VM_PUSH16 = 0x02, // int16_t
+  VM_IN    = 0x03, // uint8_t input (eVmInput)
+  VM_LOAD  = 0x04, // uint8_t variable
+  VM_STORE = 0x05, // uint8_t variable
+  VM_DUP   = 0x06,
+  VM_DROP  = 0x07,
+  VM_SWAP  = 0x08,
+  VM_OVER  = 0x09,
+  VM_ADD   = 0x10,
+  VM_SUB   = 0x11,
+  VM_MUL   = 0x12,
+  VM_DIV   = 0x13,
+  VM_NEG   = 0x14,
+  VM_ABS   = 0x15,
+  VM_MIN   = 0x16,
+  VM_MAX   = 0x17,
+  VM_AND   = 0x18, // Bitwise
+  VM_OR    = 0x19,
+  VM_NOT   = 0x1A, // Logical
+  VM_LT    = 0x20,
+  VM_LE    = 0x21,
+  VM_GT    = 0x22,
+  VM_GE    = 0x23,
+  VM_EQ    = 0x24,
+  VM_NE    = 0x25,
+  VM_JMP   = 0x30, // int8_t
+  VM_JZ    = 0x31, // int8_t
+  VM_VEL   = 0x40, // Pops omega mrad/s, then v mm/s (vSetMotorsVelocity)
+  VM_MOT   = 0x41, // Pops right, then left (vSetMotorsCommand)
+};
+
+// Read by VM_IN, -1 for a distance without a valid measure
+enum eVmInput {
+  VM_IN_SONAR_LEFT   = 0,  // mm, TOPIC_SONAR
+  VM_IN_SONAR_CENTER = 1,
+  VM_IN_SONAR_RIGHT  = 2,
+  VM_IN_SHARP_LEFT   = 3,  // mm
+  VM_IN_SHARP_RIGHT  = 4,
+  VM_IN_FRONT        = 5,  // mm, polar sector 0
+  VM_IN_BUMPERS      = 6,  // Mask of the pressed ones, by BUMPER_x
+  VM_IN_SPEED_LEFT   = 7,  // Encoder counts per period, TOPIC_MOTORS
+  VM_IN_SPEED_RIGHT  = 8,
+  VM_IN_HEADING      = 9,  // mrad, TOPIC_MOTORS
+  VM_IN_TIME_MS      = 10, // Since the start of the program
+  VM_IN_NB
+};
+
+// proto_vm_t state
+enum eVmState {
+  VM_STOPPED = 0,
+  VM_RUNNING = 1,
+  VM_FAULT   = 2,
+};
+
+enum eVmError {
+  VM_OK        = 0,
+  VM_BAD_CODE  = 1, // Unknown opcode, index or jump out of the code
+  VM_BUDGET    = 2,
+  VM_OVERFLOW  = 3,
+  VM_UNDERFLOW = 4,
+  VM_DIVIDE    = 5,
+};
+
+typedef proto_vm_t vm_status_t;
+
+void vVmInit();
+
+// Code at an offset, 0 for a new program: stops the one running.
+// Returns 0 past VM_CODE_SIZE or at an offset other than the end.
+int xVmLoad(uint16_t offset_, const uint8_t* code_, int size_);
+// Checks the code before the start: opcodes, immediates, indexes and
+// jump targets. Returns the error, VM_OK when started.
+int iVmStart(int period_ms_, int budget_);
+// Stops the motors too
+void vVmStop();
+void vVmGetStatus(vm_status_t* status_);
+int32_t xVmGetVar(int var_);
+
+#endif
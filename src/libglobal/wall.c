@@ -0,0 +1,126 @@
+#include "FreeRTOS.h"
+
+#include "libglobal/reflex.h"
+#include "libglobal/wall.h"
+
+#include "libperiph/motors.h"
+#include "libperiph/periodic.h"
+#include "libperiph/sharps.h"
+#include "libperiph/sonar.h"
+
+static periodic_t loop;
+
+static volatile int following;
+static volatile int side;
+static volatile int setpointMm;
+static volatile int speed;
+static volatile int kp = WALL_DEFAULT_KP;
+static volatile int kd = WALL_DEFAULT_KD;
+
+static volatile int error;
+static volatile int turn;
+// Previous error of the derivative, none after a start or a loss
+static int lastError;
+static int lastValid;
+
+static void vWallStep();
+
+void vWallInit()
+{
+  vPeriodicInit(&loop, "wall", &vWallStep);
+}
+
+void vWallFollow(int sharp_, int distance_mm_, int speed_)
+{
+  if (speed_ < 0)
+    speed_ = 0;
+  else if (speed_ > MOTORS_COMMAND_MAX)
+    speed_ = MOTORS_COMMAND_MAX;
+
+  following = 0;
+  side = sharp_;
+  setpointMm = distance_mm_;
+  speed = speed_;
+  lastValid = 0;
+  following = 1;
+  // The reflex sees the front only: the followed wall is not an obstacle
+  vReflexUseSharps(0);
+  vPeriodicSetPeriod(&loop, WALL_PERIOD_MS);
+}
+
+void vWallStop()
+{
+  vPeriodicSetPeriod(&loop, 0);
+  following = 0;
+  vSetMotorsCommand(0, 0);
+  vReflexUseSharps(1);
+}
+
+void vWallSetGains(int kp_, int kd_)
+{
+  kp = kp_;
+  kd = kd_;
+}
+
+int iWallIsFollowing()
+{
+  return following;
+}
+
+int iWallGetError()
+{
+  return error;
+}
+
+int iWallGetTurn()
+{
+  return turn;
+}
+
+// Periodic job, from the timer service task
+static void vWallStep()
+{
+  const int dist = iSharpsMeasureDistMm(side);
+  const int front = iSonarMeasureDistMm(SONAR_CENTER);
+  const int limit = speed;
+  int t;
+
+  if (!following)
+    return;
+
+  if (front != SONAR_BAD_VALUE && front < WALL_FRONT_MM)
+  {
+    // Corner: turn away, pivoting on the outer wheel
+    t = -limit;
+    lastValid = 0;
+    error = 0;
+  }
+  else if (dist == SHARPS_BAD_VALUE)
+  {
+    // Lost: curve towards the wall
+    t = WALL_SEARCH_TURN;
+    lastValid = 0;
+    error = 0;
+  }
+  else
+  {
+    const int e = dist - setpointMm;
+    const int de = lastValid ? e - lastError : 0;
+
+    t = (kp * e + kd * de) / WALL_GAIN_ONE;
+    if (t > limit)
+      t = limit;
+    else if (t < -limit)
+      t = -limit;
+    lastError = e;
+    lastValid = 1;
+    error = e;
+  }
+  turn = t;
+
+  // Positive turns go towards the wall
+  if (side == SHARP_LEFT)
+    vSetMotorsCommand(speed - t, speed + t);
+  else
+    vSetMotorsCommand(speed + t, speed - t);
+}
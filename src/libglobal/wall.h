@@ -0,0 +1,37 @@
+#ifndef WALL_H
+# define WALL_H
+
+// Wall following on board: a periodic job reads the sharp on the side of
+// the wall at the rate the ADC publishes it, and steers the motor targets
+// with a PD controller to keep its distance. The central sonar turns the
+// robot away at a corner; out of range of the sharp, it turns towards the
+// wall to find it again.
+#define WALL_PERIOD_MS 16
+
+// Gains in 1/256 (WALL_GAIN_ONE): turn command per mm of error, and per
+// mm of error change per period
+#define WALL_GAIN_ONE     256
+#define WALL_DEFAULT_KP   (2 * WALL_GAIN_ONE)
+#define WALL_DEFAULT_KD   (16 * WALL_GAIN_ONE)
+
+// A front obstacle closer than that is a corner
+#define WALL_FRONT_MM     250
+// Turn to find the wall again, in command units
+#define WALL_SEARCH_TURN  60
+
+void vWallInit();
+// Follow the wall on the side of sharp_ at distance_mm_ from it, along
+// the axis of the sharp, forward at speed_. The targets of the motors are
+// overwritten at each period until vWallStop().
+void vWallFollow(int sharp_, int distance_mm_, int speed_);
+// Stops the motors too
+void vWallStop();
+void vWallSetGains(int kp_, int kd_);
+
+// Non zero while following, and the last error (mm, 0 when lost) and
+// turn command
+int iWallIsFollowing();
+int iWallGetError();
+int iWallGetTurn();
+
+#endif
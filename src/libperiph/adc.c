@@ -0,0 +1,594 @@
+#include "stm32f10x_adc.h"
+#include "stm32f10x_dma.h"
+#include "stm32f10x_gpio.h"
+#include "stm32f10x_rcc.h"
+#include "stm32f10x_tim.h"
+
+#include "FreeRTOS.h"
+#include "misc.h"
+
+#include "libglobal/profile.h"
+#include "libglobal/startup.h"
+
+#include "libperiph/adc.h"
+#include "libperiph/atomic.h"
+#include "libperiph/hardware.h"
+#include "libperiph/priorities.h"
+#include "libperiph/resources.h"
+#include "libperiph/timebase.h"
+
+// Samples per channel in the DMA buffer, decimated by halves
+#define AVERAGE_NB (2 * ADC_OVERSAMPLE)
+#define DMA_BUFFER_MAX (AVERAGE_NB * ADC_CHANNELS_MAX)
+
+// Weight of a new half buffer code in the IIR filter: 1 / 2^FILTER_SHIFT
+#define FILTER_SHIFT 2
+// Fractional bits kept in the filter state, over the decimated code
+#define FILTER_FRAC  4
+
+// Power up time of the ADC, datasheet maximum
+#define ADC_TSTAB_US 1
+// Temperature sensor start up, datasheet maximum
+#define ADC_TSTART_US 10
+
+// Supply gain, Q.GAIN_SHIFT: the reference as at ADC_VDDA_MV over the
+// one seen
+#define GAIN_SHIFT 14
+
+// ADC clock ceiling, from PCLK2 by 2, 4, 6 or 8
+#define ADC_CLOCK_MAX 14000000
+
+// Trigger timer clock: 72 MHz / 72 = 1 MHz, APB2 divided or not
+#define TRIGGER_PSC   71
+#define TRIGGER_CLOCK 1000000
+
+#ifdef ADC_PWM_SYNC
+// Update events of the PWM per scan, at least
+# define SYNC_MIN_EVENTS 2
+
+// Of TIM2, 0 until the motors start it
+static volatile uint32_t pwmEventsHz;
+#endif
+// As set, applied again at a PWM frequency change and out of the parked
+// rate
+static volatile int rateHz = ADC_DEFAULT_RATE_HZ;
+static volatile int parked;
+
+static adc_t adc = { .ADCx = ADC1,
+                     .ADCx_slave = ADC2,
+                     .DMAx = DMA1,
+                     .DMA_Channelx = DMA1_Channel1,
+                     .TIMx = TIM1 };
+
+static adc_channel_t channels[ADC_CHANNELS_MAX];
+static int n_channels;
+
+// Injected pair, when set
+static adc_channel_t injected[2];
+static int injectedSet;
+
+// The slave converts this one, on Vss, after an odd last channel and
+// with the internal channels
+#define ADC_SLAVE_PADDING ADC_Channel_17
+
+// At least 17.1 us: 239.5 cycles at 12 MHz
+static const adc_channel_t vrefint =
+  {.ADC_Channel_x = ADC_Channel_17,
+   .ADC_SampleTime_x = ADC_SampleTime_239Cycles5};
+static const adc_channel_t temperature =
+  {.ADC_Channel_x = ADC_Channel_16,
+   .ADC_SampleTime_x = ADC_SampleTime_239Cycles5};
+static const adc_channel_t padding =
+  {.ADC_Channel_x = ADC_SLAVE_PADDING,
+   .ADC_SampleTime_x = ADC_SampleTime_1Cycles5};
+
+static int vrefintChannel;
+static int temperatureChannel;
+// Vrefint as at ADC_VDDA_MV, filter state units
+static volatile uint32_t vrefintState =
+  ((ADC_VREFINT_MV * ADC_CODE_MAX) / ADC_VDDA_MV) << FILTER_FRAC;
+static volatile uint16_t vrefintMv = ADC_VREFINT_MV;
+static volatile uint32_t supplyGain = 1 << GAIN_SHIFT;
+
+// Interleaved samples: AVERAGE_NB scans of n_slots, the master result
+// of each pair in the low half of the DMA word
+static volatile uint16_t ADC_DMA_Buffer[DMA_BUFFER_MAX]
+  __attribute__((aligned(4)));
+static int dmaHalfSize;
+// Channels rounded up to the pairs
+static int n_slots;
+
+// Filter state (Q.FILTER_FRAC), only used by the DMA interrupt
+static int32_t filterState[ADC_CHANNELS_MAX];
+// Filtered raw code of each channel, published by the DMA interrupt
+static volatile uint16_t filteredValue[ADC_CHANNELS_MAX];
+// The filter starts from the first average, not from 0
+static int filterSeeded;
+
+static pfunAdcWatchdog watchdogHandler;
+static int watchdogChannel;
+// The converter of the guarded channel
+static ADC_TypeDef* watchdogAdc;
+
+// The fastest clock under ADC_CLOCK_MAX: 72 MHz / 6 = 12 MHz, docked
+// (libperiph/hardware.h) 36 MHz / 4 = 9 MHz
+static int prvAdcClocks(int phase_, const RCC_ClocksTypeDef* clocks_)
+{
+  static const uint32_t dividers[4] =
+    { RCC_PCLK2_Div2, RCC_PCLK2_Div4, RCC_PCLK2_Div6, RCC_PCLK2_Div8 };
+  int i;
+
+  if (phase_ != HARDWARE_CLOCKS_AFTER)
+    return 1;
+  for (i = 0; i < 3; i++)
+    if (clocks_->PCLK2_Frequency / (2 * (i + 1)) <= ADC_CLOCK_MAX)
+      break;
+  RCC_ADCCLKConfig(dividers[i]);
+  return 1;
+}
+
+void vAdcSetInjected(const adc_channel_t* master_, const adc_channel_t* slave_)
+{
+  injected[0] = *master_;
+  injected[1] = *slave_;
+  injectedSet = 1;
+}
+
+int iAdcRegisterChannel(const adc_channel_t* channel_)
+{
+  if (n_channels == ADC_CHANNELS_MAX - ADC_INTERNAL_SLOTS)
+    return -1;
+
+  channels[n_channels] = *channel_;
+  return n_channels++;
+}
+
+// Internal channels on the master alone: even indexes, the slave of
+// their pairs on the padding
+static int prvAdcAddInternal(const adc_channel_t* channel_)
+{
+  if (n_channels & 1)
+    channels[n_channels++] = padding;
+  channels[n_channels] = *channel_;
+  return n_channels++;
+}
+
+void vAdcStart()
+{
+  ADC_TypeDef* const converters[2] = { adc.ADCx, adc.ADCx_slave };
+  vrefintChannel = prvAdcAddInternal(&vrefint);
+  temperatureChannel = prvAdcAddInternal(&temperature);
+  n_slots = (n_channels + 1) & ~1;
+  const int bufferSize = AVERAGE_NB * n_slots;
+  dmaHalfSize = bufferSize / 2;
+
+  // DMA1 channel 1, the ADC1 requests; TIM1 CC1 the external trigger
+  xResourceClaim(RESOURCE_DMA1_CH1, "adc");
+  xResourceClaim(RESOURCE_TIM1, "adc");
+  // Configure DMA clock
+  vDmaClockInit(adc.DMAx);
+  // Configure ADC clocks
+  vAdcClockInit(adc.ADCx);
+  vAdcClockInit(adc.ADCx_slave);
+
+  // Default GPIO config
+  GPIO_InitTypeDef GPIO_InitStructure =
+    {
+      .GPIO_Pin   = 0,
+      .GPIO_Mode  = GPIO_Mode_AIN,
+      .GPIO_Speed = GPIO_Speed_2MHz
+    };
+
+  // GPIO config
+  for (int i = 0; i < n_channels; i++)
+  {
+    if (!channels[i].GPIOx) // Internal channel
+      continue;
+    vGpioClockInit(channels[i].GPIOx);
+    GPIO_InitStructure.GPIO_Pin = channels[i].GPIO_Pin_x;
+    GPIO_Init(channels[i].GPIOx, &GPIO_InitStructure);
+  }
+  for (int i = 0; injectedSet && i < 2; i++)
+  {
+    vGpioClockInit(injected[i].GPIOx);
+    GPIO_InitStructure.GPIO_Pin = injected[i].GPIO_Pin_x;
+    GPIO_Init(injected[i].GPIOx, &GPIO_InitStructure);
+  }
+
+  // ADC clock, again on each APB2 divider change
+  RCC_ClocksTypeDef clocks;
+  RCC_GetClocksFreq(&clocks);
+  prvAdcClocks(HARDWARE_CLOCKS_AFTER, &clocks);
+  vHardwareOnClocks(&prvAdcClocks);
+
+  for (int a = 0; a < 2; a++)
+  {
+    ADC_TypeDef* const ADCx = converters[a];
+
+    // Reset ADC
+    ADC_DeInit(ADCx);
+    // Wake up ADC from Power Down mode
+    ADC_Cmd(ADCx, ENABLE);
+  }
+  // Internal channels, lost by the reset
+  ADC_TempSensorVrefintCmd(ENABLE);
+  // Wait until they stabilize (tSTAB, tSTART of the sensor)
+  vTimeDelayUs(ADC_TSTART_US > ADC_TSTAB_US ? ADC_TSTART_US : ADC_TSTAB_US);
+
+  for (int a = 0; a < 2; a++)
+  {
+    ADC_TypeDef* const ADCx = converters[a];
+
+    // Configure ADC
+    ADC_InitTypeDef ADC_InitStructure;
+    ADC_StructInit(&ADC_InitStructure);
+    /* Dual mode, the slave converts its sequence with the master, and
+       its injected channel with that of the master */
+    ADC_InitStructure.ADC_Mode =
+      injectedSet ? ADC_Mode_RegInjecSimult : ADC_Mode_RegSimult;
+    /* Scan mode -> multichannels conversion */
+    ADC_InitStructure.ADC_ScanConvMode = ENABLE;
+    /* Single mode, each scan is started by the trigger timer */
+    ADC_InitStructure.ADC_ContinuousConvMode = DISABLE;
+    /* Trigger timer channel 1 starts conversions of the master, the
+       slave follows it */
+    ADC_InitStructure.ADC_ExternalTrigConv =
+      ADCx == adc.ADCx ? ADC_ExternalTrigConv_T1_CC1 : ADC_ExternalTrigConv_None;
+    /* Number of channels to be converted, the same on both */
+    ADC_InitStructure.ADC_NbrOfChannel = n_slots / 2;
+    /* Converted data are aligned to the right (0 0 0 0 D11 D10 ... D0) */
+    ADC_InitStructure.ADC_DataAlign = ADC_DataAlign_Right;
+    ADC_Init(ADCx, &ADC_InitStructure);
+
+    // Calibrate ADC
+    /* Reset ADC calibration */
+    ADC_ResetCalibration(ADCx);
+    /* Wait for the end of the reset calibration */
+    while (ADC_GetResetCalibrationStatus(ADCx));
+    /* Start ADC calibration */
+    ADC_StartCalibration(ADCx);
+    /* Wait for the end of the calibration */
+    while (ADC_GetCalibrationStatus(ADCx));
+  }
+
+  // Configure ADC channels
+  /* Set the order and the sample time of each pair */
+  for (int i = 0; i < n_slots; i += 2)
+  {
+    uint8_t sampleTime = channels[i].ADC_SampleTime_x;
+    uint8_t slaveChannel = ADC_SLAVE_PADDING;
+    if (i + 1 < n_channels)
+    {
+      slaveChannel = channels[i + 1].ADC_Channel_x;
+      if (channels[i + 1].ADC_SampleTime_x > sampleTime)
+        sampleTime = channels[i + 1].ADC_SampleTime_x;
+    }
+    ADC_RegularChannelConfig(adc.ADCx, channels[i].ADC_Channel_x,
+                             i / 2 + 1, sampleTime);
+    ADC_RegularChannelConfig(adc.ADCx_slave, slaveChannel,
+                             i / 2 + 1, sampleTime);
+  }
+
+  // Injected pair, started by software (JSWSTART) on the master
+  if (injectedSet)
+  {
+    uint8_t sampleTime = injected[0].ADC_SampleTime_x;
+    if (injected[1].ADC_SampleTime_x > sampleTime)
+      sampleTime = injected[1].ADC_SampleTime_x;
+    for (int a = 0; a < 2; a++)
+    {
+      ADC_TypeDef* const ADCx = converters[a];
+
+      ADC_InjectedSequencerLengthConfig(ADCx, 1);
+      ADC_InjectedChannelConfig(ADCx, injected[a].ADC_Channel_x, 1,
+                                sampleTime);
+      ADC_ExternalTrigInjectedConvConfig(ADCx,
+                                         ADC_ExternalTrigInjecConv_None);
+      ADC_ExternalTrigInjectedConvCmd(ADCx, ENABLE);
+    }
+  }
+
+  // Enable ADC DMA request
+  ADC_DMACmd(adc.ADCx, ENABLE);
+
+  // Start ADC conversions on trigger, the slave on the master
+  ADC_ExternalTrigConvCmd(adc.ADCx, ENABLE);
+  ADC_ExternalTrigConvCmd(adc.ADCx_slave, ENABLE);
+
+  // Initialize DMA
+  /* Reset DMA */
+  DMA_DeInit(adc.DMA_Channelx);
+
+  DMA_InitTypeDef DMA_InitStructure;
+  DMA_StructInit(&DMA_InitStructure);
+  /* Set DMA peripheral base addr to ADC buffer */
+  DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)(&adc.ADCx->DR);
+  /* Disable the increment of the periphal addr (always ADC buffer DR reg) */
+  DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+  /* Set DMA memory base addr to DMA buffer */
+  DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)ADC_DMA_Buffer;
+  /* Enable the increment of the mem addr */
+  DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+  /* Set the peripheral as the src of the DMA */
+  DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
+  /* Set the number of data to transfer, a word per pair */
+  DMA_InitStructure.DMA_BufferSize = bufferSize / 2;
+  /* Set the DMA as a circular DMA (so that the DMA transfer never stop) */
+  DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
+  /* In dual mode, the ADC buffer register holds both results -> word */
+  DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+  /* Each word is stored as two halfwords of the DMA buffer */
+  DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Word;
+  /* Set the DMA priority (not important as only ADC1 use DMA1) */
+  DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+  /* Disable Mem to Mem (here it's peripheral to mem) */
+  DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+
+  DMA_Init(adc.DMA_Channelx, &DMA_InitStructure);
+
+  /* Filter each half of the buffer as soon as it is complete */
+  DMA_ITConfig(adc.DMA_Channelx, DMA_IT_TE, DISABLE);
+  DMA_ITConfig(adc.DMA_Channelx, DMA_IT_TC | DMA_IT_HT, ENABLE);
+
+  NVIC_InitTypeDef NVIC_InitStructure =
+    {
+      .NVIC_IRQChannel = DMA1_Channel1_IRQn,
+      .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_ADC,
+      .NVIC_IRQChannelSubPriority = 0,
+      .NVIC_IRQChannelCmd = ENABLE,
+    };
+  NVIC_Init(&NVIC_InitStructure);
+
+  // Start DMA
+  DMA_Cmd(adc.DMA_Channelx, ENABLE);
+
+  // Configure trigger timer: one rising edge on channel 1 per scan
+  vTimerClockInit(adc.TIMx);
+
+#ifdef ADC_PWM_SYNC
+  // Counts the update events of TIM2, the period set with their rate
+  TIM_TimeBaseInitTypeDef Timer_InitStructure =
+  {
+    .TIM_ClockDivision      = TIM_CKD_DIV1,
+    .TIM_Prescaler          = 0,
+    .TIM_Period             = SYNC_MIN_EVENTS - 1,
+    .TIM_CounterMode        = TIM_CounterMode_Up
+  };
+  TIM_TimeBaseInit(adc.TIMx, &Timer_InitStructure);
+  TIM_SelectInputTrigger(adc.TIMx, TIM_TS_ITR1);
+  TIM_SelectSlaveMode(adc.TIMx, TIM_SlaveMode_External1);
+#else
+  TIM_TimeBaseInitTypeDef Timer_InitStructure =
+  {
+    .TIM_ClockDivision      = TIM_CKD_DIV1,
+    .TIM_Prescaler          = TRIGGER_PSC,
+    .TIM_Period             = TRIGGER_CLOCK / ADC_DEFAULT_RATE_HZ - 1,
+    .TIM_CounterMode        = TIM_CounterMode_Up
+  };
+  TIM_TimeBaseInit(adc.TIMx, &Timer_InitStructure);
+#endif
+
+  TIM_OCInitTypeDef OC_InitStructure;
+  TIM_OCStructInit(&OC_InitStructure);
+  OC_InitStructure.TIM_OCMode = TIM_OCMode_PWM1;
+  OC_InitStructure.TIM_OutputState = TIM_OutputState_Enable;
+  OC_InitStructure.TIM_Pulse = Timer_InitStructure.TIM_Period / 2;
+  TIM_OC1Init(adc.TIMx, &OC_InitStructure);
+  TIM_OC1PreloadConfig(adc.TIMx, TIM_OCPreload_Enable);
+  TIM_ARRPreloadConfig(adc.TIMx, ENABLE);
+
+  TIM_Cmd(adc.TIMx, ENABLE);
+  // Advanced timer compare events need the main output enabled, the pin
+  // itself is left as a GPIO
+  TIM_CtrlPWMOutputs(adc.TIMx, ENABLE);
+}
+
+static void prvAdcApplyRate(int rate_hz_)
+{
+  uint16_t period;
+
+#ifdef ADC_PWM_SYNC
+  const uint32_t events_hz = pwmEventsHz;
+  uint32_t events;
+
+  if (!events_hz)
+    return;
+  events = (events_hz + rate_hz_ / 2) / rate_hz_;
+  if (events < SYNC_MIN_EVENTS)
+    events = SYNC_MIN_EVENTS;
+  period = events - 1;
+#else
+  period = TRIGGER_CLOCK / rate_hz_ - 1;
+#endif
+  // Preloaded: applied at the next update event
+  TIM_SetAutoreload(adc.TIMx, period);
+  TIM_SetCompare1(adc.TIMx, period / 2);
+}
+
+void vAdcSetSampleRate(int rate_hz_)
+{
+  if (rate_hz_ < ADC_MIN_RATE_HZ)
+    rate_hz_ = ADC_MIN_RATE_HZ;
+  else if (rate_hz_ > ADC_MAX_RATE_HZ)
+    rate_hz_ = ADC_MAX_RATE_HZ;
+  rateHz = rate_hz_;
+  prvAdcApplyRate(parked ? ADC_PARKED_RATE_HZ : rate_hz_);
+}
+
+void vAdcSetParked(int parked_)
+{
+  parked = parked_;
+  prvAdcApplyRate(parked_ ? ADC_PARKED_RATE_HZ : rateHz);
+}
+
+int iAdcGetSampleRate()
+{
+#ifdef ADC_PWM_SYNC
+  return pwmEventsHz / (adc.TIMx->ARR + 1);
+#else
+  return TRIGGER_CLOCK / (adc.TIMx->ARR + 1);
+#endif
+}
+
+#ifdef ADC_PWM_SYNC
+void vAdcSetPwmEvents(uint32_t events_hz_)
+{
+  pwmEventsHz = events_hz_;
+  prvAdcApplyRate(parked ? ADC_PARKED_RATE_HZ : rateHz);
+}
+#endif
+
+void vAdcInjectedStart()
+{
+  // No read-modify-write of CR2 from the interrupts
+  vAtomicBitWrite(&adc.ADCx->CR2, ATOMIC_BIT(ADC_CR2_JSWSTART), 1);
+}
+
+void vAdcInjectedRead(uint16_t* master_, uint16_t* slave_)
+{
+  *master_ = adc.ADCx->JDR1;
+  *slave_ = adc.ADCx_slave->JDR1;
+}
+
+void DMA1_Channel1_IRQHandler()
+{
+  uint32_t status = DMA1->ISR;
+  const uint16_t* half;
+  uint32_t sum;
+  PROFILE_BEGIN(PROFILE_ADC_DMA_IRQ);
+
+  DMA1->IFCR = DMA_IFCR_CGIF1;
+
+  // The DMA is now filling the other half of the buffer
+  if (status & DMA_ISR_TCIF1)
+    half = (const uint16_t*)&ADC_DMA_Buffer[dmaHalfSize];
+  else if (status & DMA_ISR_HTIF1)
+    half = (const uint16_t*)&ADC_DMA_Buffer[0];
+  else
+  {
+    PROFILE_END(PROFILE_ADC_DMA_IRQ);
+    return;
+  }
+
+  for (int c = 0; c < n_channels; c++)
+  {
+    sum = 0;
+    for (int i = c; i < dmaHalfSize; i += n_slots)
+      sum += half[i];
+
+    // Decimated: 4^n samples summed weigh 2n bits more than one, n of
+    // them kept. With the fraction of the filter, no bit is dropped.
+    const int32_t code =
+      (int32_t)sum << (FILTER_FRAC - ADC_OVERSAMPLE_BITS);
+    // First order IIR over the half buffer codes
+    if (filterSeeded)
+      filterState[c] += (code - filterState[c]) >> FILTER_SHIFT;
+    else
+      filterState[c] = code;
+  }
+
+  // Scaled as at ADC_VDDA_MV, a multiply per channel
+  if (filterState[vrefintChannel] > 0)
+    supplyGain = (vrefintState << GAIN_SHIFT) / filterState[vrefintChannel];
+  for (int c = 0; c < n_channels; c++)
+  {
+    const uint32_t value = ((uint64_t)filterState[c] * supplyGain) >>
+      (GAIN_SHIFT + FILTER_FRAC);
+
+    filteredValue[c] = value < ADC_CODE_MAX ? value : ADC_CODE_MAX - 1;
+  }
+
+  if (!filterSeeded)
+  {
+    filterSeeded = 1;
+    vStartupMark(STARTUP_ANALOG);
+  }
+  PROFILE_END(PROFILE_ADC_DMA_IRQ);
+}
+
+uint16_t uAdcGetRaw(int channel_)
+{
+  return filteredValue[channel_];
+}
+
+int iAdcGetValue(int channel_)
+{
+  if (channels[channel_].convert)
+    return channels[channel_].convert(filteredValue[channel_]);
+  return filteredValue[channel_];
+}
+
+int iAdcGetVddaMv()
+{
+  return (ADC_VDDA_MV * supplyGain) >> GAIN_SHIFT;
+}
+
+int iAdcGetTemperatureDc()
+{
+  // Before the first codes: the 20 C the sonar used to assume
+  if (!filterSeeded)
+    return 200;
+  const int32_t uv = (int64_t)filteredValue[temperatureChannel] *
+    ADC_VDDA_MV * 1000 / ADC_CODE_MAX;
+
+  return 250 + (ADC_TEMP_V25_MV * 1000 - uv) * 10 / ADC_TEMP_SLOPE_UV;
+}
+
+void vAdcSetVrefintMv(int mv_)
+{
+  if (mv_ < ADC_VREFINT_MIN_MV)
+    mv_ = ADC_VREFINT_MIN_MV;
+  else if (mv_ > ADC_VREFINT_MAX_MV)
+    mv_ = ADC_VREFINT_MAX_MV;
+  vrefintMv = mv_;
+  vrefintState = ((mv_ * ADC_CODE_MAX) / ADC_VDDA_MV) << FILTER_FRAC;
+}
+
+int iAdcGetVrefintMv()
+{
+  return vrefintMv;
+}
+
+void vAdcSetWatchdog(int channel_, uint16_t low_, uint16_t high_,
+                     pfunAdcWatchdog handler_)
+{
+  if (watchdogAdc)
+    ADC_ITConfig(watchdogAdc, ADC_IT_AWD, DISABLE);
+
+  watchdogChannel = channel_;
+  watchdogHandler = handler_;
+  // Odd channels are converted by the slave, with its own watchdog
+  watchdogAdc = channel_ & 1 ? adc.ADCx_slave : adc.ADCx;
+
+  ADC_AnalogWatchdogThresholdsConfig(watchdogAdc, high_, low_);
+  ADC_AnalogWatchdogSingleChannelConfig(watchdogAdc,
+                                        channels[channel_].ADC_Channel_x);
+  ADC_AnalogWatchdogCmd(watchdogAdc, ADC_AnalogWatchdog_SingleRegEnable);
+
+  NVIC_InitTypeDef NVIC_InitStructure =
+    {
+      .NVIC_IRQChannel = ADC1_2_IRQn,
+      .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_OVERCURRENT,
+      .NVIC_IRQChannelSubPriority = 0,
+      .NVIC_IRQChannelCmd = ENABLE,
+    };
+  NVIC_Init(&NVIC_InitStructure);
+
+  vAdcRearmWatchdog();
+}
+
+void vAdcRearmWatchdog()
+{
+  ADC_ClearFlag(watchdogAdc, ADC_FLAG_AWD);
+  ADC_ITConfig(watchdogAdc, ADC_IT_AWD, ENABLE);
+}
+
+void ADC1_2_IRQHandler()
+{
+  // Disarm: the flag is set again by each conversion out of the window
+  watchdogAdc->CR1 &= ~ADC_CR1_AWDIE;
+  watchdogAdc->SR = ~ADC_SR_AWD;
+
+  if (watchdogHandler)
+    watchdogHandler(watchdogChannel);
+}
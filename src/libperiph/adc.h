@@ -0,0 +1,141 @@
+#ifndef LIBPERIPH_ADC_H
+# define LIBPERIPH_ADC_H
+
+#include <stdint.h>
+
+#include "stm32f10x_adc.h"
+#include "stm32f10x_dma.h"
+#include "stm32f10x_gpio.h"
+#include "stm32f10x_tim.h"
+
+#include "FreeRTOS.h"
+
+// Maximum number of channels in the scan sequence, of which the last
+// ADC_INTERNAL_SLOTS are the internal channels and their padding
+#define ADC_CHANNELS_MAX   8
+#define ADC_INTERNAL_SLOTS 4
+
+// Oversampling and decimation: each published code sums ADC_OVERSAMPLE
+// conversions of its channel, 4^ADC_OVERSAMPLE_BITS, for that many more
+// bits than the converter. 2 by default (16x, 14 bits), up to 3 (64x, 15
+// bits, a DMA buffer of 2 KB).
+#ifndef ADC_OVERSAMPLE_BITS
+# define ADC_OVERSAMPLE_BITS 2
+#endif
+#if ADC_OVERSAMPLE_BITS < 0 || ADC_OVERSAMPLE_BITS > 3
+# error "ADC_OVERSAMPLE_BITS out of 0 to 3"
+#endif
+#define ADC_OVERSAMPLE (1 << (2 * ADC_OVERSAMPLE_BITS))
+
+// Default and bounds of the scan rate (all channels converted at each
+// scan). The default publishes codes at 62.5 Hz, whatever the
+// oversampling. A scan of four pairs, two of the internal channels at
+// 17 us, takes some 95 us on the docked ADC clock.
+#define ADC_DEFAULT_RATE_HZ (ADC_OVERSAMPLE * 1000 / 16)
+#define ADC_MIN_RATE_HZ     20
+#define ADC_MAX_RATE_HZ     10000
+
+// Conversions, as the watchdog thresholds, are of 12 bits
+#define ADC_MAX_VALUE 4096
+// Filtered codes, of 12 + ADC_OVERSAMPLE_BITS bits
+#define ADC_CODE_MAX  (ADC_MAX_VALUE << ADC_OVERSAMPLE_BITS)
+
+// Supply compensation: the internal reference (Vrefint, channel 17) and
+// the temperature sensor (channel 16) of the master are converted in
+// the scan after the registered channels, each in a pair of its own,
+// the slave on Vss. Each half buffer, the filtered codes are scaled by
+// the reference seen, as if the converter ran at ADC_VDDA_MV: the
+// readings hold while the regulator drifts. The watchdog and the
+// injected pair see the raw conversions.
+#define ADC_VDDA_MV          3300
+// Vrefint, 1160 to 1240 mV from part to part, no factory calibration on
+// the F1: measured against a meter ("ia")
+#define ADC_VREFINT_MV       1200
+#define ADC_VREFINT_MIN_MV   1150
+#define ADC_VREFINT_MAX_MV   1250
+// Temperature sensor, typical: 1.43 V at 25 C, -4.3 mV per degree
+#define ADC_TEMP_V25_MV      1430
+#define ADC_TEMP_SLOPE_UV    4300
+
+// Converts a filtered raw code into the channel unit
+typedef int (*pfunAdcConvert) (uint16_t);
+// Called from the analog watchdog interrupt with the guarded channel index
+typedef void (*pfunAdcWatchdog) (int);
+
+typedef struct
+{
+  GPIO_TypeDef* GPIOx;
+  uint16_t GPIO_Pin_x;
+  uint8_t ADC_Channel_x;
+  uint8_t ADC_SampleTime_x;
+  pfunAdcConvert convert; // NULL to get the raw code
+} adc_channel_t;
+
+// Dual regular simultaneous mode: the master converts the channels of
+// even index, the slave the odd ones at the same instants, and the DMA
+// moves both results in one word
+typedef struct
+{
+  ADC_TypeDef* ADCx;
+  ADC_TypeDef* ADCx_slave;
+  DMA_TypeDef* DMAx;
+  DMA_Channel_TypeDef* DMA_Channelx;
+  TIM_TypeDef* TIMx; // Conversion trigger (channel 1)
+} adc_t;
+
+// Add a channel to the scan sequence, before vAdcStart(). Returns its
+// index, or -1 if the sequence is full. Channels are converted by pairs
+// in the order of registration, both of a pair at the same instant with
+// the longer of their sample times: register the channels to compare
+// (both sharps, the battery and its current) one after the other.
+int iAdcRegisterChannel(const adc_channel_t* channel_);
+void vAdcStart();
+void vAdcSetSampleRate(int rate_hz_);
+// As run: the parked rate while parked
+int iAdcGetSampleRate();
+// Parked: scans at ADC_PARKED_RATE_HZ, the rate set kept for the end of
+// it. The filtered values follow as slowly.
+#define ADC_PARKED_RATE_HZ ADC_MIN_RATE_HZ
+void vAdcSetParked(int parked_);
+
+#ifdef ADC_PWM_SYNC
+// Scans synchronized to the motors PWM (--adc-sync): the trigger timer
+// counts the update events of TIM2 (its TRGO, ITR1 of TIM1), at the top
+// and the bottom of the centre aligned count, mid-way between the
+// switching edges of the bridges. Each scan starts there, the rate the
+// nearest to the one set that is a whole number of events, two at
+// least. No scan until the motors give their rate, then again at each
+// PWM frequency change.
+void vAdcSetPwmEvents(uint32_t events_hz_);
+#endif
+
+// Filtered raw code of a channel, supply compensated
+uint16_t uAdcGetRaw(int channel_);
+// Filtered value of a channel, converted by its conversion function
+int iAdcGetValue(int channel_);
+
+// Supply of the converter, from the reference seen
+int iAdcGetVddaMv();
+// Die temperature, tenths of a degree: a few degrees above the air
+int iAdcGetTemperatureDc();
+void vAdcSetVrefintMv(int mv_);
+int iAdcGetVrefintMv();
+
+// Injected pair, one channel on each converter, both converted at the
+// same instant on demand, between two conversions of the scan (dual
+// combined regular and injected simultaneous mode). Set before
+// vAdcStart(), no filter: the raw 12 bits codes.
+void vAdcSetInjected(const adc_channel_t* master_, const adc_channel_t* slave_);
+// From any task or interrupt: the codes are there some 3 us later
+void vAdcInjectedStart();
+void vAdcInjectedRead(uint16_t* master_, uint16_t* slave_);
+
+// Guard a channel with the analog watchdog: the handler is called on the
+// first raw conversion outside [low_, high_], then the watchdog is disarmed
+// until vAdcRearmWatchdog(). The handler runs above
+// configMAX_SYSCALL_INTERRUPT_PRIORITY and must not call FreeRTOS.
+void vAdcSetWatchdog(int channel_, uint16_t low_, uint16_t high_,
+                     pfunAdcWatchdog handler_);
+void vAdcRearmWatchdog();
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef LIBPERIPH_ATOMIC_H
+# define LIBPERIPH_ATOMIC_H
+
+#include <stdint.h>
+
+#include "stm32f10x.h"
+
+// Single store updates, safe against any interrupt without masking one:
+// - a pin through BSRR, set in the low half, reset in the high half;
+// - a bit of the SRAM or of a peripheral register through its bit-band
+//   alias, a word of its own in the region 32 MB above, which the bus
+//   turns into a locked read-modify-write of that bit alone.
+// Several bits of a register still need a lock, or a bit each.
+
+// Alias word of bit_ of the word (or byte) at addr_, in the first MB of
+// the SRAM (0x20000000) or of the peripherals (0x40000000)
+#define ATOMIC_BITBAND_ADDRESS(addr_, bit_) \
+  (((uint32_t)(addr_) & 0xF0000000) + 0x02000000 + \
+   (((uint32_t)(addr_) & 0x000FFFFF) << 5) + ((bit_) << 2))
+
+static inline void vAtomicPinWrite(GPIO_TypeDef* GPIOx_, uint16_t pins_,
+                                   int on_)
+{
+  GPIOx_->BSRR = on_ ? pins_ : (uint32_t)pins_ << 16;
+}
+
+// bit_ an index, ATOMIC_BIT() of a mask
+static inline void vAtomicBitWrite(volatile void* addr_, int bit_, int on_)
+{
+#ifdef SIMULATION
+  // Host simulation: no alias region behind the peripherals (sim/sim.c),
+  // the locked instruction of the host instead
+  if (on_)
+    __atomic_fetch_or((volatile uint32_t*)addr_, 1u << bit_,
+                      __ATOMIC_SEQ_CST);
+  else
+    __atomic_fetch_and((volatile uint32_t*)addr_, ~(1u << bit_),
+                       __ATOMIC_SEQ_CST);
+#else
+  *(volatile uint32_t*)ATOMIC_BITBAND_ADDRESS(addr_, bit_) = on_ != 0;
+#endif
+}
+
+static inline int iAtomicBitRead(const volatile void* addr_, int bit_)
+{
+#ifdef SIMULATION
+  return (*(const volatile uint32_t*)addr_ >> bit_) & 1;
+#else
+  return *(const volatile uint32_t*)ATOMIC_BITBAND_ADDRESS(addr_, bit_);
+#endif
+}
+
+// Index of a single bit mask, folded at compile time for a constant
+#define ATOMIC_BIT(mask_) (__builtin_ctz(mask_))
+
+#endif /* LIBPERIPH_ATOMIC_H */
@@ -0,0 +1,137 @@
+#include "stm32f10x_exti.h"
+#include "stm32f10x_gpio.h"
+#include "stm32f10x.h"
+
+#include "FreeRTOS.h"
+#include "misc.h"
+#include "queue.h"
+#include "task.h"
+
+#include "libglobal/fault.h"
+#include "libglobal/queues.h"
+
+#include "libperiph/bumpers.h"
+#include "libperiph/hardware.h"
+#include "libperiph/motors.h"
+#include "libperiph/priorities.h"
+
+#define BUMPERS_QUEUE_SIZE 8
+
+// Bumpers on lines with their own EXTI vector
+static const bumper_t bumpers[BUMPERS_NB] =
+  {
+    { .GPIOx = GPIOB, .GPIO_Pin_x = GPIO_Pin_0, .cut_off = 1 }, // BUMPER_LEFT
+    { .GPIOx = GPIOB, .GPIO_Pin_x = GPIO_Pin_1, .cut_off = 1 }, // BUMPER_RIGHT
+    { .GPIOx = GPIOA, .GPIO_Pin_x = GPIO_Pin_4, .cut_off = 1 }, // BUMPER_CLIFF
+  };
+
+static const uint8_t portSource[BUMPERS_NB] =
+  { GPIO_PortSourceGPIOB, GPIO_PortSourceGPIOB, GPIO_PortSourceGPIOA };
+static const uint8_t pinSource[BUMPERS_NB] =
+  { GPIO_PinSource0, GPIO_PinSource1, GPIO_PinSource4 };
+static const uint8_t irq[BUMPERS_NB] =
+  { EXTI0_IRQn, EXTI1_IRQn, EXTI4_IRQn };
+
+static portTickType lastEdge[BUMPERS_NB];
+
+static xQueueHandle xBumpersQueue;
+static queue_stats_t bumpersQueue;
+
+static void vBumpersEdge(int bumper_);
+
+void vBumpersInit()
+{
+  xBumpersQueue = xQueueCreate(BUMPERS_QUEUE_SIZE, sizeof (bumper_event_t));
+  if (!xBumpersQueue)
+    vFaultAllocation("bumpers");
+  vQueuesRegister(&bumpersQueue, "bumpers", BUMPERS_QUEUE_SIZE);
+
+  GPIO_InitTypeDef GPIO_InitStructure =
+    {
+      .GPIO_Pin   = 0,
+      .GPIO_Mode  = GPIO_Mode_IPU,
+      .GPIO_Speed = GPIO_Speed_2MHz
+    };
+
+  EXTI_InitTypeDef EXTI_InitStructure =
+    {
+      .EXTI_Line    = 0,
+      .EXTI_Mode    = EXTI_Mode_Interrupt,
+      .EXTI_Trigger = EXTI_Trigger_Rising_Falling,
+      .EXTI_LineCmd = ENABLE
+    };
+
+  NVIC_InitTypeDef NVIC_InitStructure =
+    {
+      .NVIC_IRQChannel = 0,
+      .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_BUMPERS,
+      .NVIC_IRQChannelSubPriority = 0,
+      .NVIC_IRQChannelCmd = ENABLE,
+    };
+
+  for (int i = 0; i < BUMPERS_NB; i++)
+  {
+    vGpioClockInit(bumpers[i].GPIOx);
+    GPIO_InitStructure.GPIO_Pin = bumpers[i].GPIO_Pin_x;
+    GPIO_Init(bumpers[i].GPIOx, &GPIO_InitStructure);
+
+    GPIO_EXTILineConfig(portSource[i], pinSource[i]);
+    EXTI_InitStructure.EXTI_Line = GPIO_TO_EXTI_LINE(bumpers[i].GPIO_Pin_x);
+    EXTI_Init(&EXTI_InitStructure);
+
+    NVIC_InitStructure.NVIC_IRQChannel = irq[i];
+    NVIC_Init(&NVIC_InitStructure);
+  }
+}
+
+int iBumpersIsPressed(int bumper_)
+{
+  return !(bumpers[bumper_].GPIOx->IDR & bumpers[bumper_].GPIO_Pin_x);
+}
+
+portBASE_TYPE xBumpersWaitEvent(bumper_event_t* event_, portTickType timeout_)
+{
+  return xQueueReceive(xBumpersQueue, event_, timeout_);
+}
+
+static void vBumpersEdge(int bumper_)
+{
+  portBASE_TYPE reschedNeeded = pdFALSE;
+  const bumper_t* bumper = &bumpers[bumper_];
+  bumper_event_t event;
+
+  EXTI->PR = GPIO_TO_EXTI_LINE(bumper->GPIO_Pin_x);
+
+  event.pressed = !(bumper->GPIOx->IDR & bumper->GPIO_Pin_x);
+
+  // React first, before any bookkeeping
+  if (event.pressed && bumper->cut_off)
+    vMotorsCutOff();
+
+  event.tick = xTaskGetTickCountFromISR();
+  if (event.tick - lastEdge[bumper_] < MS_TO_TICKS(BUMPERS_DEBOUNCE_MS))
+    return;
+  lastEdge[bumper_] = event.tick;
+
+  event.bumper = bumper_;
+  // Full: the reader is that far behind, the edge is lost
+  if (xQueueSendFromISR(xBumpersQueue, &event, &reschedNeeded) != pdTRUE)
+    vQueuesDrop(&bumpersQueue, 1);
+  vQueuesLevel(&bumpersQueue, uxQueueMessagesWaitingFromISR(xBumpersQueue));
+  portEND_SWITCHING_ISR(reschedNeeded);
+}
+
+void EXTI0_IRQHandler()
+{
+  vBumpersEdge(BUMPER_LEFT);
+}
+
+void EXTI1_IRQHandler()
+{
+  vBumpersEdge(BUMPER_RIGHT);
+}
+
+void EXTI4_IRQHandler()
+{
+  vBumpersEdge(BUMPER_CLIFF);
+}
@@ -0,0 +1,38 @@
+#ifndef LIBPERIPH_BUMPERS_H
+# define LIBPERIPH_BUMPERS_H
+
+#include <stdint.h>
+
+#include "stm32f10x_gpio.h"
+
+#include "FreeRTOS.h"
+
+#define BUMPERS_NB 3
+
+#define BUMPER_LEFT  0
+#define BUMPER_RIGHT 1
+#define BUMPER_CLIFF 2
+
+// Edges closer than this to the last accepted one are contact bounce
+#define BUMPERS_DEBOUNCE_MS 20
+
+typedef struct
+{
+  GPIO_TypeDef* GPIOx;
+  uint16_t GPIO_Pin_x;  // Active low, pulled up
+  uint8_t cut_off;      // Cut the motors off when triggered
+} bumper_t;
+
+typedef struct
+{
+  portTickType tick;
+  uint8_t bumper;
+  uint8_t pressed;
+} bumper_event_t;
+
+void vBumpersInit();
+int iBumpersIsPressed(int bumper_);
+// Block until the next accepted edge, pdFALSE on timeout
+portBASE_TYPE xBumpersWaitEvent(bumper_event_t* event_, portTickType timeout_);
+
+#endif
@@ -0,0 +1,288 @@
+#include <string.h>
+
+#include "FreeRTOS.h"
+
+#include "misc.h"
+#include "task.h"
+
+#include "stm32f10x_can.h"
+#include "stm32f10x_gpio.h"
+
+#include "libperiph/can.h"
+#include "libperiph/hardware.h"
+#include "libperiph/periodic.h"
+#include "libperiph/priorities.h"
+
+#define CAN_GPIOx  GPIOA
+#define CAN_RX_Pin GPIO_Pin_11
+#define CAN_TX_Pin GPIO_Pin_12
+
+// 18 time quanta per bit from the 36 MHz APB1 clock, sampled at 72%
+#define CAN_QUANTA_HZ (36000000 / 18)
+#define CAN_BANK_IDS  4
+
+// Written by the RX interrupt, read under critical sections
+static can_frame_t mailboxes[CAN_MAILBOXES_NB];
+static uint8_t mailboxesFresh[CAN_MAILBOXES_NB];
+static int mailboxesNb;
+
+typedef struct
+{
+  uint16_t id;
+  uint8_t size;
+  uint8_t ready;
+  uint8_t data[8];
+  uint16_t period; // In CAN_PERIODIC_MS steps
+  uint16_t countdown;
+} can_periodic_t;
+
+static can_periodic_t periodics[CAN_PERIODIC_NB];
+static int periodicsNb;
+static periodic_t scheduler;
+
+static can_stats_t stats;
+
+static void prvCanFilters(int bank_);
+static void prvCanSchedule();
+
+void vCanInit(int bitrate_)
+{
+  vCanClockInit(CAN1);
+  vGpioClockInit(CAN_GPIOx);
+
+  GPIO_InitTypeDef GPIO_InitStruct =
+    {
+      .GPIO_Pin   = CAN_RX_Pin,
+      .GPIO_Speed = GPIO_Speed_50MHz,
+      .GPIO_Mode  = GPIO_Mode_IPU,
+    };
+  GPIO_Init(CAN_GPIOx, &GPIO_InitStruct);
+  GPIO_InitStruct.GPIO_Pin  = CAN_TX_Pin;
+  GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF_PP;
+  GPIO_Init(CAN_GPIOx, &GPIO_InitStruct);
+
+  CAN_DeInit(CAN1);
+  CAN_InitTypeDef CAN_InitStruct;
+  CAN_StructInit(&CAN_InitStruct);
+  CAN_InitStruct.CAN_Mode = CAN_Mode_Normal;
+  CAN_InitStruct.CAN_SJW = CAN_SJW_1tq;
+  CAN_InitStruct.CAN_BS1 = CAN_BS1_12tq;
+  CAN_InitStruct.CAN_BS2 = CAN_BS2_5tq;
+  CAN_InitStruct.CAN_Prescaler = CAN_QUANTA_HZ / bitrate_;
+  // Back on the bus by itself after a bus-off, oldest pending frame first
+  CAN_InitStruct.CAN_ABOM = ENABLE;
+  CAN_InitStruct.CAN_TXFP = ENABLE;
+  CAN_Init(CAN1, &CAN_InitStruct);
+
+  // Nothing gets in before the first mailbox
+  for (int bank = 0; bank * CAN_BANK_IDS < CAN_MAILBOXES_NB; bank++)
+    prvCanFilters(bank);
+
+  NVIC_InitTypeDef NVIC_InitStruct =
+    {
+      .NVIC_IRQChannel                   = USB_LP_CAN1_RX0_IRQn,
+      .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_CAN,
+      .NVIC_IRQChannelSubPriority        = 0,
+      .NVIC_IRQChannelCmd                = ENABLE,
+    };
+  NVIC_Init(&NVIC_InitStruct);
+  CAN_ITConfig(CAN1, CAN_IT_FMP0, ENABLE);
+
+  vPeriodicInit(&scheduler, "can", &prvCanSchedule);
+  vPeriodicSetPeriod(&scheduler, CAN_PERIODIC_MS);
+}
+
+// Program the four identifiers of a bank, unused ones repeat the first:
+// on a match the lowest filter number wins
+static void prvCanFilters(int bank_)
+{
+  uint16_t ids[CAN_BANK_IDS];
+  const int first = bank_ * CAN_BANK_IDS;
+
+  if (first >= mailboxesNb)
+  {
+    CAN_FilterInitTypeDef CAN_FilterInitStruct =
+      {
+        .CAN_FilterNumber = bank_,
+        .CAN_FilterActivation = DISABLE,
+      };
+    CAN_FilterInit(&CAN_FilterInitStruct);
+    return;
+  }
+
+  for (int i = 0; i < CAN_BANK_IDS; i++)
+  {
+    const int mailbox = (first + i < mailboxesNb) ? first + i : first;
+    // STID[10:0] RTR IDE EXID[17:15]: data frames, standard identifier
+    ids[i] = mailboxes[mailbox].id << 5;
+  }
+
+  // Filter numbers in a bank: FR1 low, FR1 high, FR2 low, FR2 high
+  CAN_FilterInitTypeDef CAN_FilterInitStruct =
+    {
+      .CAN_FilterIdLow          = ids[0],
+      .CAN_FilterMaskIdLow      = ids[1],
+      .CAN_FilterIdHigh         = ids[2],
+      .CAN_FilterMaskIdHigh     = ids[3],
+      .CAN_FilterFIFOAssignment = CAN_FilterFIFO0,
+      .CAN_FilterNumber         = bank_,
+      .CAN_FilterMode           = CAN_FilterMode_IdList,
+      .CAN_FilterScale          = CAN_FilterScale_16bit,
+      .CAN_FilterActivation     = ENABLE,
+    };
+  CAN_FilterInit(&CAN_FilterInitStruct);
+}
+
+int iCanAddMailbox(uint16_t id_)
+{
+  int mailbox;
+
+  taskENTER_CRITICAL();
+  mailbox = mailboxesNb < CAN_MAILBOXES_NB ? mailboxesNb++ : -1;
+  if (mailbox >= 0)
+  {
+    memset(&mailboxes[mailbox], 0, sizeof (mailboxes[mailbox]));
+    mailboxes[mailbox].id = id_;
+  }
+  taskEXIT_CRITICAL();
+
+  if (mailbox >= 0)
+    prvCanFilters(mailbox / CAN_BANK_IDS);
+  return mailbox;
+}
+
+int iCanRead(int mailbox_, can_frame_t* frame_)
+{
+  int fresh;
+
+  taskENTER_CRITICAL();
+  *frame_ = mailboxes[mailbox_];
+  fresh = mailboxesFresh[mailbox_];
+  mailboxesFresh[mailbox_] = 0;
+  taskEXIT_CRITICAL();
+
+  return fresh;
+}
+
+void vCanGetStats(can_stats_t* stats_)
+{
+  const uint32_t esr = CAN1->ESR;
+
+  taskENTER_CRITICAL();
+  *stats_ = stats;
+  taskEXIT_CRITICAL();
+  stats_->tx_errors = (esr & CAN_ESR_TEC) >> 16;
+  stats_->rx_errors = (esr & CAN_ESR_REC) >> 24;
+  stats_->bus_off = !!(esr & CAN_ESR_BOFF);
+}
+
+int iCanSend(uint16_t id_, const void* data_, int size_)
+{
+  CanTxMsg msg =
+    {
+      .StdId = id_,
+      .IDE = CAN_ID_STD,
+      .RTR = CAN_RTR_DATA,
+      .DLC = size_ > 8 ? 8 : size_,
+    };
+  uint8_t sent;
+
+  memcpy(msg.Data, data_, msg.DLC);
+
+  // The TX mailboxes are shared by the tasks, the job and the interrupts
+  portBASE_TYPE mask = portSET_INTERRUPT_MASK_FROM_ISR();
+  sent = CAN_Transmit(CAN1, &msg) != CAN_NO_MB;
+  if (!sent)
+    stats.tx_dropped++;
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+
+  return sent;
+}
+
+int iCanAddPeriodic(uint16_t id_, int period_ms_)
+{
+  int slot;
+  int period = period_ms_ / CAN_PERIODIC_MS;
+
+  if (period < 1)
+    period = 1;
+
+  taskENTER_CRITICAL();
+  slot = periodicsNb < CAN_PERIODIC_NB ? periodicsNb++ : -1;
+  if (slot >= 0)
+  {
+    memset(&periodics[slot], 0, sizeof (periodics[slot]));
+    periodics[slot].id = id_;
+    periodics[slot].period = period;
+    periodics[slot].countdown = period;
+  }
+  taskEXIT_CRITICAL();
+
+  return slot;
+}
+
+void vCanSetPeriodicData(int slot_, const void* data_, int size_)
+{
+  can_periodic_t* periodic = &periodics[slot_];
+
+  if (size_ > 8)
+    size_ = 8;
+
+  taskENTER_CRITICAL();
+  memcpy(periodic->data, data_, size_);
+  periodic->size = size_;
+  periodic->ready = 1;
+  taskEXIT_CRITICAL();
+}
+
+// Scheduler job, from the timer service task
+static void prvCanSchedule()
+{
+  uint8_t data[8];
+
+  for (int i = 0; i < periodicsNb; i++)
+  {
+    can_periodic_t* periodic = &periodics[i];
+
+    if (--periodic->countdown)
+      continue;
+    periodic->countdown = periodic->period;
+
+    taskENTER_CRITICAL();
+    const int ready = periodic->ready;
+    const int size = periodic->size;
+    memcpy(data, periodic->data, size);
+    taskEXIT_CRITICAL();
+
+    if (ready)
+      iCanSend(periodic->id, data, size);
+  }
+}
+
+// Shared with the USB, excluded by --usb-link
+void USB_LP_CAN1_RX0_IRQHandler()
+{
+  CanRxMsg msg;
+
+  if (CAN1->RF0R & CAN_RF0R_FOVR0)
+  {
+    CAN1->RF0R = CAN_RF0R_FOVR0;
+    stats.overruns++;
+  }
+
+  // Drain the FIFO: three frames deep
+  while (CAN1->RF0R & CAN_RF0R_FMP0)
+  {
+    CAN_Receive(CAN1, CAN_FIFO0, &msg);
+    stats.received++;
+
+    if (msg.FMI >= mailboxesNb)
+      continue;
+
+    can_frame_t* frame = &mailboxes[msg.FMI];
+    frame->tick = xTaskGetTickCountFromISR();
+    frame->size = msg.DLC;
+    memcpy(frame->data, msg.Data, msg.DLC);
+    mailboxesFresh[msg.FMI] = 1;
+  }
+}
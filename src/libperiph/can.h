@@ -0,0 +1,60 @@
+#ifndef LIBPERIPH_CAN_H
+# define LIBPERIPH_CAN_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+// CAN1 network to the other boards (configure with --can), standard
+// identifiers, data frames. On PA11 (RX) / PA12 (TX) with an external
+// transceiver: the Olimexino one is on PB8/PB9, the I2C slave pins. The
+// USB shares its RAM and pins, --usb-link excludes --can.
+#define CAN_DEFAULT_BITRATE 500000 // 125000 to 1000000, divides 2 MHz
+
+// Received frames land in the mailbox of their identifier, with latest
+// value semantics: a new frame overwrites the previous one. The hardware
+// filters (16 bits list mode, 4 identifiers per bank) drop all the
+// others and their match index is the mailbox, no lookup.
+#define CAN_MAILBOXES_NB 16
+
+// Periodic transmissions, sent from a job at this granularity
+#define CAN_PERIODIC_NB 8
+#define CAN_PERIODIC_MS 5
+
+typedef struct
+{
+  portTickType tick; // Of the reception, 0 before the first one
+  uint16_t id;
+  uint8_t size;
+  uint8_t data[8];
+} can_frame_t;
+
+typedef struct
+{
+  uint32_t received;
+  uint16_t overruns;    // Frames lost, FIFO full
+  uint16_t tx_dropped;  // No free TX mailbox
+  uint8_t tx_errors;    // Error counters, from the peripheral
+  uint8_t rx_errors;
+  uint8_t bus_off;
+} can_stats_t;
+
+void vCanInit(int bitrate_);
+void vCanGetStats(can_stats_t* stats_);
+
+// Returns the mailbox, -1 once all are taken
+int iCanAddMailbox(uint16_t id_);
+// Latest frame of the mailbox. Returns 1 when it is new since the last
+// read, 0 otherwise.
+int iCanRead(int mailbox_, can_frame_t* frame_);
+
+// Send once, from a task or an interrupt. Returns 0 when the three TX
+// mailboxes are busy.
+int iCanSend(uint16_t id_, const void* data_, int size_);
+
+// Returns the periodic slot, -1 once all are taken. Sent every
+// period_ms_, rounded to CAN_PERIODIC_MS, once data is set.
+int iCanAddPeriodic(uint16_t id_, int period_ms_);
+void vCanSetPeriodicData(int slot_, const void* data_, int size_);
+
+#endif /* LIBPERIPH_CAN_H */
@@ -0,0 +1,179 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "stm32f10x.h"
+#include "stm32f10x_gpio.h"
+#include "stm32f10x_tim.h"
+
+#include "libperiph/cleaning.h"
+#include "libperiph/hardware.h"
+#include "libperiph/periodic.h"
+#include "libperiph/power.h"
+
+// Held by the ADC (RESOURCE_TIM1): its period is the sample rate, only
+// the compare values of CH2 and CH3 are written here
+#define CLEANING_TIMx      TIM1
+#define CLEANING_GPIOx     GPIOB
+#define CLEANING_BRUSH_Pin GPIO_Pin_14
+#define CLEANING_FAN_Pin   GPIO_Pin_15
+
+#define DIRT_HOLD_RUNS (CLEANING_DIRT_HOLD_MS / CLEANING_PERIOD_MS)
+
+static periodic_t loop;
+
+static volatile uint16_t setpoints[CLEANING_CHANNELS_NB];
+// Adaptive fan, manual while boost is 0
+static volatile uint16_t eco;
+static volatile uint16_t boost;
+static volatile uint16_t carpetMa = CLEANING_DEFAULT_CARPET_MA;
+static volatile int dirt;
+
+// Job state
+static uint16_t duties[CLEANING_CHANNELS_NB];
+static int32_t currentQ;        // CLEANING_FILTER_SHIFT bits
+static int holdRuns;
+static int boosted;
+
+// Written by the job, read in critical sections
+static cleaning_state_t state;
+
+static void vCleaningStep();
+
+static int prvCleaningClamp(int permille_)
+{
+  if (permille_ < 0)
+    return 0;
+  if (permille_ > CLEANING_DUTY_MAX)
+    return CLEANING_DUTY_MAX;
+  return permille_;
+}
+
+void vCleaningInit()
+{
+  vGpioClockInit(CLEANING_GPIOx);
+  GPIO_InitTypeDef GPIO_InitStructure =
+    {
+      .GPIO_Pin   = CLEANING_BRUSH_Pin | CLEANING_FAN_Pin,
+      .GPIO_Speed = GPIO_Speed_2MHz,
+      .GPIO_Mode  = GPIO_Mode_AF_PP,
+    };
+  GPIO_Init(CLEANING_GPIOx, &GPIO_InitStructure);
+
+  // Complementary outputs alone: OCxN follows the reference, high from
+  // the counter start to the compare value. Off at the start.
+  TIM_OCInitTypeDef OC_InitStructure;
+  TIM_OCStructInit(&OC_InitStructure);
+  OC_InitStructure.TIM_OCMode = TIM_OCMode_PWM1;
+  OC_InitStructure.TIM_OutputState = TIM_OutputState_Disable;
+  OC_InitStructure.TIM_OutputNState = TIM_OutputNState_Enable;
+  OC_InitStructure.TIM_OCNPolarity = TIM_OCNPolarity_High;
+  OC_InitStructure.TIM_OCNIdleState = TIM_OCNIdleState_Reset;
+  OC_InitStructure.TIM_Pulse = 0;
+  TIM_OC2Init(CLEANING_TIMx, &OC_InitStructure);
+  TIM_OC3Init(CLEANING_TIMx, &OC_InitStructure);
+  TIM_OC2PreloadConfig(CLEANING_TIMx, TIM_OCPreload_Enable);
+  TIM_OC3PreloadConfig(CLEANING_TIMx, TIM_OCPreload_Enable);
+
+  vPeriodicInit(&loop, "cleaning", &vCleaningStep);
+  vPeriodicSetPeriod(&loop, CLEANING_PERIOD_MS);
+}
+
+void vCleaningSet(int channel_, int permille_)
+{
+  if (channel_ == CLEANING_FAN)
+    boost = 0;
+  setpoints[channel_] = prvCleaningClamp(permille_);
+}
+
+void vCleaningSetAdaptive(int eco_, int boost_)
+{
+  eco_ = prvCleaningClamp(eco_);
+  boost_ = prvCleaningClamp(boost_);
+  eco = eco_;
+  boost = boost_ > eco_ ? boost_ : eco_;
+}
+
+void vCleaningSetCarpetMa(int carpet_ma_)
+{
+  carpetMa = carpet_ma_ < 0 ? 0 : carpet_ma_;
+}
+
+void vCleaningDirt()
+{
+  dirt = 1;
+}
+
+void vCleaningGetState(cleaning_state_t* state_)
+{
+  taskENTER_CRITICAL();
+  *state_ = state;
+  taskEXIT_CRITICAL();
+}
+
+static void vCleaningStep()
+{
+  const uint32_t period = CLEANING_TIMx->ARR + 1;
+  const int adaptive = boost != 0;
+  const int was = boosted;
+  int targets[CLEANING_CHANNELS_NB];
+
+  // Drive current, both wheels: it rises on carpet
+  currentQ += iPowerGetCurrentMa() - (currentQ >> CLEANING_FILTER_SHIFT);
+  if (currentQ < 0)
+    currentQ = 0;
+  if (dirt)
+  {
+    dirt = 0;
+    holdRuns = DIRT_HOLD_RUNS;
+  }
+  else if (holdRuns)
+    holdRuns--;
+
+  for (int i = 0; i < CLEANING_CHANNELS_NB; i++)
+    targets[i] = setpoints[i];
+  boosted = 0;
+  if (adaptive)
+  {
+    boosted = !iPowerIsBatteryLow() &&
+      (holdRuns || (currentQ >> CLEANING_FILTER_SHIFT) >= carpetMa);
+    targets[CLEANING_FAN] = boosted ? boost : eco;
+  }
+
+  // Soft start, and soft stop alike
+  for (int i = 0; i < CLEANING_CHANNELS_NB; i++)
+  {
+    const int target = targets[i];
+
+    if (target > duties[i] + CLEANING_SLEW)
+      duties[i] += CLEANING_SLEW;
+    else if (target < duties[i] - CLEANING_SLEW)
+      duties[i] -= CLEANING_SLEW;
+    else
+      duties[i] = target;
+  }
+
+  // At the next update event, whatever the sample rate
+  TIM_SetCompare2(CLEANING_TIMx,
+                  duties[CLEANING_BRUSH] * period / CLEANING_DUTY_MAX);
+  TIM_SetCompare3(CLEANING_TIMx,
+                  duties[CLEANING_FAN] * period / CLEANING_DUTY_MAX);
+
+  taskENTER_CRITICAL();
+  for (int i = 0; i < CLEANING_CHANNELS_NB; i++)
+  {
+    state.setpoint[i] = targets[i];
+    state.duty[i] = duties[i];
+  }
+  state.eco = adaptive ? eco : 0;
+  state.boost = adaptive ? boost : 0;
+  state.current_ma = currentQ >> CLEANING_FILTER_SHIFT;
+  state.carpet_ma = carpetMa;
+  state.boosted = boosted;
+  if (boosted)
+  {
+    if (!was)
+      state.boosts++;
+    state.boost_ms += CLEANING_PERIOD_MS;
+  }
+  taskEXIT_CRITICAL();
+}
@@ -0,0 +1,61 @@
+#ifndef LIBPERIPH_CLEANING_H
+# define LIBPERIPH_CLEANING_H
+
+#include <stdint.h>
+
+// Side brush and suction fan (--cleaning), on low side MOSFETs driven by
+// the spare channels of TIM1, the ADC trigger timer: brush on PB14 (CH2N),
+// fan on PB15 (CH3N). No other timer has a free channel: their PWM
+// frequency is the ADC sample rate, 1 kHz by default, and the duties
+// follow a change of it at the next job run. PB14 and PB15 are SPI2,
+// the card of --sdcard.
+//
+// Soft start: the duties ramp toward their setpoints, against the inrush
+// current of the motors. Adaptive suction: the fan runs at its eco duty,
+// and boosts while the drive current, filtered, says the wheels are on
+// carpet, or for a while after a dirt event. Never boosted on a low
+// battery.
+enum eCleaningChannel {
+  CLEANING_BRUSH,
+  CLEANING_FAN,
+  CLEANING_CHANNELS_NB
+};
+
+// Duties in permille
+#define CLEANING_DUTY_MAX 1000
+
+#define CLEANING_PERIOD_MS 20
+// Per job run: from 0 to full in a second
+#define CLEANING_SLEW 20
+// Drive current filter, an exponential average over 2^N runs
+#define CLEANING_FILTER_SHIFT 4
+// Carpet: the filtered drive current above this
+#define CLEANING_DEFAULT_CARPET_MA 600
+// Boosted for this long after a dirt event
+#define CLEANING_DIRT_HOLD_MS 3000
+
+typedef struct
+{
+  uint16_t setpoint[CLEANING_CHANNELS_NB]; // Fan: as adapted
+  uint16_t duty[CLEANING_CHANNELS_NB];     // As output, after the ramp
+  uint16_t eco;          // Adaptive fan duties, 0 when manual
+  uint16_t boost;
+  uint16_t current_ma;   // Drive current, filtered
+  uint16_t carpet_ma;
+  uint8_t boosted;
+  uint32_t boosts;       // Switches to the boost duty
+  uint32_t boost_ms;     // Time spent boosted
+} cleaning_state_t;
+
+// After vAdcStart(), the trigger timer running
+void vCleaningInit();
+// Setpoint of a channel, in permille. The fan leaves the adaptive mode.
+void vCleaningSet(int channel_, int permille_);
+// Fan between eco_ and boost_, in permille
+void vCleaningSetAdaptive(int eco_, int boost_);
+void vCleaningSetCarpetMa(int carpet_ma_);
+// Dirt seen (a sensor, the host): boosted for CLEANING_DIRT_HOLD_MS
+void vCleaningDirt();
+void vCleaningGetState(cleaning_state_t* state_);
+
+#endif /* LIBPERIPH_CLEANING_H */
@@ -0,0 +1,112 @@
+#include "libperiph/crc.h"
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "stm32f10x.h"
+#include "stm32f10x_rcc.h"
+#include "misc.h"
+
+#include "libglobal/assert_param.h"
+#include "libglobal/fault.h"
+#include "libglobal/flags.h"
+
+#include "libperiph/hardware.h"
+#include "libperiph/priorities.h"
+#include "libperiph/resources.h"
+
+#ifndef SPI_LINK
+# define CRC_DMA
+#endif
+
+#define CRC_DMA_CHANNEL   DMA1_Channel3
+// Largest transfer count
+#define CRC_DMA_MAX_WORDS 0xffff
+#define CRC_DONE          0x01
+
+// One block at a time on the unit
+static xSemaphoreHandle xCrcMutex;
+#ifdef CRC_DMA
+static flags_t done;
+#endif
+
+void vCrcInit()
+{
+  xCrcMutex = xSemaphoreCreateMutex();
+  if (!xCrcMutex)
+    vFaultAllocation("crc");
+  RCC_AHBPeriphClockCmd(RCC_AHBPeriph_CRC, ENABLE);
+
+#ifdef CRC_DMA
+  vFlagsInit(&done);
+  xResourceClaim(RESOURCE_DMA1_CH3, "crc");
+  vDmaClockInit(DMA1);
+  CRC_DMA_CHANNEL->CCR = 0;
+  CRC_DMA_CHANNEL->CPAR = (uint32_t)&CRC->DR;
+
+  NVIC_InitTypeDef NVIC_InitStructure =
+    {
+      .NVIC_IRQChannel = DMA1_Channel3_IRQn,
+      .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_CRC,
+      .NVIC_IRQChannelSubPriority = 0,
+      .NVIC_IRQChannelCmd = ENABLE,
+    };
+  NVIC_Init(&NVIC_InitStructure);
+#endif
+}
+
+#ifdef CRC_DMA
+// Memory to the data register, words, the memory side incremented. Low
+// priority: the peripheral channels go first.
+static void prvCrcDma(const uint32_t* words_, uint32_t n_)
+{
+  while (n_)
+  {
+    const uint32_t count = n_ < CRC_DMA_MAX_WORDS ? n_ : CRC_DMA_MAX_WORDS;
+
+    CRC_DMA_CHANNEL->CMAR = (uint32_t)words_;
+    CRC_DMA_CHANNEL->CNDTR = count;
+    CRC_DMA_CHANNEL->CCR = DMA_CCR3_MEM2MEM | DMA_CCR3_MSIZE_1 |
+      DMA_CCR3_PSIZE_1 | DMA_CCR3_MINC | DMA_CCR3_DIR | DMA_CCR3_TCIE |
+      DMA_CCR3_EN;
+    uFlagsWait(&done, CRC_DONE, FLAGS_ANY, portMAX_DELAY);
+
+    words_ += count;
+    n_ -= count;
+  }
+}
+#endif
+
+uint32_t uCrc32(const void* data_, uint32_t size_)
+{
+  const uint32_t* words = data_;
+  const uint32_t n = size_ / 4;
+  uint32_t crc;
+
+  assert_param(!(size_ & 3) && !((uint32_t)data_ & 3));
+
+  xSemaphoreTake(xCrcMutex, portMAX_DELAY);
+  CRC->CR = CRC_CR_RESET;
+#ifdef CRC_DMA
+  if (n >= CRC_DMA_MIN_WORDS)
+    prvCrcDma(words, n);
+  else
+#endif
+    for (uint32_t i = 0; i < n; i++)
+      CRC->DR = words[i];
+  crc = CRC->DR;
+  xSemaphoreGive(xCrcMutex);
+
+  return crc;
+}
+
+#ifdef CRC_DMA
+void DMA1_Channel3_IRQHandler()
+{
+  portBASE_TYPE reschedNeeded = pdFALSE;
+
+  DMA1->IFCR = DMA_IFCR_CGIF3;
+  CRC_DMA_CHANNEL->CCR = 0;
+  vFlagsSetFromISR(&done, CRC_DONE, &reschedNeeded);
+  portEND_SWITCHING_ISR(reschedNeeded);
+}
+#endif
@@ -0,0 +1,22 @@
+#ifndef LIBPERIPH_CRC_H
+# define LIBPERIPH_CRC_H
+
+#include <stdint.h>
+
+// CRC unit of the STM32, as the bootloader checks the image (boot/boot.h):
+// CRC-32, polynomial 0x04C11DB7, initial 0xFFFFFFFF, fed by little
+// endian words MSB first, not reflected nor inverted. The host side is
+// swiftler::crc32 (raspberry/client) and crc32 in wtools/bootloader.py.
+//
+// Blocks of CRC_DMA_MIN_WORDS and more are fed by DMA1 channel 3, memory
+// to memory, while the caller sleeps; shorter ones, and all of them with
+// SPI_LINK (the channel is the SPI1 TX one), by the core, a word per
+// store. From tasks only, one block at a time.
+#define CRC_DMA_MIN_WORDS 32
+
+void vCrcInit();
+
+// Words, size_ in bytes a multiple of 4, from the flash or the RAM
+uint32_t uCrc32(const void* data_, uint32_t size_);
+
+#endif /* LIBPERIPH_CRC_H */
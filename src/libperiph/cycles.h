@@ -0,0 +1,42 @@
+#ifndef LIBPERIPH_CYCLES_H
+# define LIBPERIPH_CYCLES_H
+
+#include <stdint.h>
+
+// Cortex-M3 DWT cycle counter, at the 72 MHz core clock: wraps around
+// every 59 s, differences of uint32_t stay right across a wrap. The
+// CMSIS version shipped here has no DWT definitions.
+#define CYCLES_DEMCR         (*(volatile uint32_t*)0xE000EDFC)
+#define CYCLES_DEMCR_TRCENA  (1 << 24)
+#define CYCLES_DWT_CTRL      (*(volatile uint32_t*)0xE0001000)
+#define CYCLES_DWT_CYCCNTENA (1 << 0)
+#define CYCLES_DWT_CYCCNT    (*(volatile uint32_t*)0xE0001004)
+// Keeps the core clock, so the counter, running through the idle WFI
+#define CYCLES_DBGMCU_CR     (*(volatile uint32_t*)0xE0042004)
+#define CYCLES_DBG_SLEEP     (1 << 0)
+
+#define CYCLES_PER_US 72
+
+#ifdef SIMULATION
+// Host simulation: the simulated core clock (sim/sim.c)
+uint32_t uSimCycles();
+#endif
+
+// Free running once started: not reset, for the measures in progress
+static inline void vCyclesInit()
+{
+  CYCLES_DEMCR |= CYCLES_DEMCR_TRCENA;
+  CYCLES_DWT_CTRL |= CYCLES_DWT_CYCCNTENA;
+  CYCLES_DBGMCU_CR |= CYCLES_DBG_SLEEP;
+}
+
+static inline uint32_t uCyclesNow()
+{
+#ifdef SIMULATION
+  return uSimCycles();
+#else
+  return CYCLES_DWT_CYCCNT;
+#endif
+}
+
+#endif /* LIBPERIPH_CYCLES_H */
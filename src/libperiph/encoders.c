@@ -0,0 +1,199 @@
+#include "stm32f10x_exti.h"
+#include "stm32f10x_gpio.h"
+#include "stm32f10x_tim.h"
+#include "stm32f10x.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "misc.h"
+
+#include "libglobal/profile.h"
+
+#include "libperiph/cycles.h"
+#include "libperiph/encoders.h"
+#include "libperiph/hardware.h"
+#include "libperiph/priorities.h"
+#include "libperiph/resources.h"
+
+// Left encoder: TIM4 encoder mode on PB6 (CH1) / PB7 (CH2), counted by
+// the timer without any interrupt.
+#define LEFT_TIMx     TIM4
+#define LEFT_GPIOx    GPIOB
+#define LEFT_A_Pin    GPIO_Pin_6
+#define LEFT_B_Pin    GPIO_Pin_7
+
+// Right encoder: no other timer has its two first channels free (TIM1 CH2
+// is the uart TX, TIM2 the motors, TIM3 the sonar), so it is decoded by
+// EXTI on both edges of PB12 / PB13.
+#define RIGHT_GPIOx   GPIOB
+#define RIGHT_A_Pin   GPIO_Pin_12
+#define RIGHT_B_Pin   GPIO_Pin_13
+#define RIGHT_A_Shift 12
+#ifdef SDCARD
+// PB13 is the clock of the card: B rewired to PC13 (D21), the same EXTI
+// line from the other port
+# define RIGHT_B_GPIOx      GPIOC
+# define RIGHT_B_PortSource GPIO_PortSourceGPIOC
+#else
+# define RIGHT_B_GPIOx      RIGHT_GPIOx
+# define RIGHT_B_PortSource GPIO_PortSourceGPIOB
+#endif
+
+// Input filter: 8 samples at fDTS / 8 (~1 us at 72 MHz)
+#define ENCODER_FILTER 0x0a
+
+// Count increment from (previous AB << 2 | current AB), 0 when invalid
+static const int8_t quadrature[16] =
+  {
+     0, -1,  1,  0,
+     1,  0,  0, -1,
+    -1,  0,  0,  1,
+     0,  1, -1,  0
+  };
+
+static volatile uint16_t rightCount;
+static uint8_t rightState;
+
+// Last edge of each encoder
+static volatile uint32_t edgeCycles[ENCODERS_NB];
+static volatile uint16_t edgeCount[ENCODERS_NB];
+
+// AB, A the low bit
+static inline uint8_t prvEncodersRightState()
+{
+#ifdef SDCARD
+  return ((RIGHT_GPIOx->IDR >> RIGHT_A_Shift) & 1) |
+    ((RIGHT_B_GPIOx->IDR >> RIGHT_A_Shift) & 2);
+#else
+  return (RIGHT_GPIOx->IDR >> RIGHT_A_Shift) & 3;
+#endif
+}
+
+void vEncodersInit()
+{
+  vGpioClockInit(LEFT_GPIOx);
+  vGpioClockInit(RIGHT_GPIOx);
+  vGpioClockInit(RIGHT_B_GPIOx);
+
+  GPIO_InitTypeDef GPIO_InitStructure =
+    {
+      .GPIO_Pin   = LEFT_A_Pin | LEFT_B_Pin,
+      .GPIO_Mode  = GPIO_Mode_IPU,
+      .GPIO_Speed = GPIO_Speed_2MHz
+    };
+  GPIO_Init(LEFT_GPIOx, &GPIO_InitStructure);
+
+  GPIO_InitStructure.GPIO_Pin = RIGHT_A_Pin;
+  GPIO_Init(RIGHT_GPIOx, &GPIO_InitStructure);
+  GPIO_InitStructure.GPIO_Pin = RIGHT_B_Pin;
+  GPIO_Init(RIGHT_B_GPIOx, &GPIO_InitStructure);
+
+  // Left: count on both edges of both channels
+  xResourceClaim(RESOURCE_TIM4, "encoders");
+  vTimerClockInit(LEFT_TIMx);
+
+  TIM_TimeBaseInitTypeDef Timer_InitStructure =
+  {
+    .TIM_ClockDivision      = TIM_CKD_DIV1,
+    .TIM_Prescaler          = 0,
+    .TIM_Period             = 0xffff,
+    .TIM_CounterMode        = TIM_CounterMode_Up
+  };
+  TIM_TimeBaseInit(LEFT_TIMx, &Timer_InitStructure);
+
+  TIM_EncoderInterfaceConfig(LEFT_TIMx, TIM_EncoderMode_TI12,
+                             TIM_ICPolarity_Rising, TIM_ICPolarity_Rising);
+
+  TIM_ICInitTypeDef TIM_ICInitStructure;
+  TIM_ICStructInit(&TIM_ICInitStructure);
+  TIM_ICInitStructure.TIM_ICFilter = ENCODER_FILTER;
+  TIM_ICInitStructure.TIM_Channel = TIM_Channel_1;
+  TIM_ICInit(LEFT_TIMx, &TIM_ICInitStructure);
+  TIM_ICInitStructure.TIM_Channel = TIM_Channel_2;
+  TIM_ICInit(LEFT_TIMx, &TIM_ICInitStructure);
+  // TIM_ICInit resets the encoder mode selection
+  TIM_EncoderInterfaceConfig(LEFT_TIMx, TIM_EncoderMode_TI12,
+                             TIM_ICPolarity_Rising, TIM_ICPolarity_Rising);
+
+  TIM_SetCounter(LEFT_TIMx, 0);
+  TIM_Cmd(LEFT_TIMx, ENABLE);
+
+  // CH1 captures the count on the rising edges of A, the interrupt stamps
+  // them once armed
+  NVIC_InitTypeDef NVIC_InitStructure =
+    {
+      .NVIC_IRQChannel = TIM4_IRQn,
+      .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_ENCODERS,
+      .NVIC_IRQChannelSubPriority = 0,
+      .NVIC_IRQChannelCmd = ENABLE,
+    };
+  NVIC_Init(&NVIC_InitStructure);
+
+  // Right: one interrupt per edge
+  rightState = prvEncodersRightState();
+
+  GPIO_EXTILineConfig(GPIO_PortSourceGPIOB, GPIO_PinSource12);
+  GPIO_EXTILineConfig(RIGHT_B_PortSource, GPIO_PinSource13);
+
+  EXTI_InitTypeDef EXTI_InitStructure =
+    {
+      .EXTI_Line    = EXTI_Line12 | EXTI_Line13,
+      .EXTI_Mode    = EXTI_Mode_Interrupt,
+      .EXTI_Trigger = EXTI_Trigger_Rising_Falling,
+      .EXTI_LineCmd = ENABLE
+    };
+  EXTI_Init(&EXTI_InitStructure);
+
+  NVIC_InitStructure.NVIC_IRQChannel = EXTI15_10_IRQn;
+  NVIC_Init(&NVIC_InitStructure);
+}
+
+uint16_t uEncodersGetCount(int encoder_)
+{
+  if (encoder_ == ENCODER_LEFT)
+    return LEFT_TIMx->CNT;
+  return rightCount;
+}
+
+void vEncodersGetEdge(int encoder_, encoder_edge_t* edge_)
+{
+  taskENTER_CRITICAL();
+  edge_->cycles = edgeCycles[encoder_];
+  edge_->count = edgeCount[encoder_];
+  taskEXIT_CRITICAL();
+}
+
+void vEncodersArmEdges(int enable_)
+{
+  if (enable_)
+  {
+    LEFT_TIMx->SR = ~TIM_SR_CC1IF;
+    LEFT_TIMx->DIER |= TIM_DIER_CC1IE;
+  }
+  else
+    LEFT_TIMx->DIER &= ~TIM_DIER_CC1IE;
+}
+
+void EXTI15_10_IRQHandler()
+{
+  uint8_t state;
+  PROFILE_BEGIN(PROFILE_ENCODER_IRQ);
+
+  EXTI->PR = EXTI_Line12 | EXTI_Line13;
+
+  state = prvEncodersRightState();
+  rightCount += quadrature[(rightState << 2) | state];
+  rightState = state;
+  edgeCount[ENCODER_RIGHT] = rightCount;
+  edgeCycles[ENCODER_RIGHT] = uCyclesNow();
+  PROFILE_END(PROFILE_ENCODER_IRQ);
+}
+
+void TIM4_IRQHandler()
+{
+  const uint32_t cycles = uCyclesNow();
+
+  LEFT_TIMx->SR = ~TIM_SR_CC1IF;
+  edgeCount[ENCODER_LEFT] = LEFT_TIMx->CCR1;
+  edgeCycles[ENCODER_LEFT] = cycles;
+}
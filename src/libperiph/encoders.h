@@ -0,0 +1,34 @@
+#ifndef LIBPERIPH_ENCODERS_H
+# define LIBPERIPH_ENCODERS_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#define ENCODERS_NB 2
+
+#define ENCODER_LEFT  0
+#define ENCODER_RIGHT 1
+
+void vEncodersInit();
+// Raw quadrature count (4 per encoder line), wraps around
+uint16_t uEncodersGetCount(int encoder_);
+
+// Edge timing, for the speed at low speeds: the cycle counter
+// (libperiph/cycles.h) at the last edge and the count then. Right: each
+// edge, from its interrupt. Left: the rising edges of A, one per line,
+// the count captured by TIM4, while armed only.
+#define ENCODERS_LEFT_EDGE_COUNTS  4
+#define ENCODERS_RIGHT_EDGE_COUNTS 1
+
+typedef struct
+{
+  uint32_t cycles;
+  uint16_t count;
+} encoder_edge_t;
+
+void vEncodersGetEdge(int encoder_, encoder_edge_t* edge_);
+// Left capture interrupt, one per line: for the low speeds, off above
+void vEncodersArmEdges(int enable_);
+
+#endif
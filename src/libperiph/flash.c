@@ -0,0 +1,29 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "stm32f10x_flash.h"
+
+#include "libperiph/flash.h"
+
+#define FLASH_FLAGS (FLASH_FLAG_EOP | FLASH_FLAG_PGERR | FLASH_FLAG_WRPRTERR)
+
+void vFlashErasePage(uint32_t address_)
+{
+  vTaskSuspendAll();
+  FLASH_Unlock();
+  FLASH_ClearFlag(FLASH_FLAGS);
+  FLASH_ErasePage(address_);
+  FLASH_Lock();
+  xTaskResumeAll();
+}
+
+void vFlashProgram(uint32_t address_, const uint32_t* words_, int n_)
+{
+  vTaskSuspendAll();
+  FLASH_Unlock();
+  FLASH_ClearFlag(FLASH_FLAGS);
+  for (int i = 0; i < n_; i++)
+    FLASH_ProgramWord(address_ + 4 * i, words_[i]);
+  FLASH_Lock();
+  xTaskResumeAll();
+}
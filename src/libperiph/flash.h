@@ -0,0 +1,18 @@
+#ifndef LIBPERIPH_FLASH_H
+# define LIBPERIPH_FLASH_H
+
+#include <stdint.h>
+
+#include "libperiph/mcu.h"
+
+// Internal flash writes, for the regions the linker script reserves past
+// the code (black box, parameters). One operation at a time, the
+// scheduler suspended meanwhile: the interrupts still run, stalled while
+// the flash is busy, about 20 ms per page erase and 50 us per halfword.
+#define FLASH_PAGE_SIZE MCU_PAGE_SIZE
+
+void vFlashErasePage(uint32_t address_);
+// Programmed in order, a word is two halfwords: low then high
+void vFlashProgram(uint32_t address_, const uint32_t* words_, int n_);
+
+#endif /* LIBPERIPH_FLASH_H */
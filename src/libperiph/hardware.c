@@ -1,13 +1,60 @@
+#ifdef SIMULATION
+# include <unistd.h>
+#endif
+
 #include "misc.h"
 #include "stm32f10x.h"
 #include "stm32f10x_flash.h"
 #include "stm32f10x_gpio.h"
 #include "stm32f10x_rcc.h"
 
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/fault.h"
+
+#include "cycles.h"
 #include "hardware.h"
+#include "timebase.h"
+
+// HSI clock, until the PLL takes over
+#define HSI_CYCLES_PER_US 8
+// Device electronic signature, in the system memory
+#define HARDWARE_UID_ADDRESS 0x1FFFF7E8
+
+// Vector table, first in the image: after the bootloader
+extern const uint8_t _start[];
+
+static uint32_t clocksUs;
+
+typedef struct
+{
+  const char* name;
+  uint32_t pclk2;                // RCC_HCLK_DivN
+  uint8_t pclk2_shift;           // Of HCLK, log2 N
+  uint32_t apb1_gated;           // RCC_APB1Periph_x
+} hardware_profile_t;
+
+static const hardware_profile_t profiles[HARDWARE_PROFILES_NB] =
+  {
+    [HARDWARE_DRIVE]  = { "drive",  RCC_HCLK_Div1, 0, 0 },
+    // Encoders: the left one on TIM4, the right one on EXTI lines
+    [HARDWARE_DOCKED] = { "docked", RCC_HCLK_Div2, 1, RCC_APB1Periph_TIM4 },
+  };
+
+static int profile = HARDWARE_DRIVE;
+// Clocks gated by the profile which were on before
+static uint32_t apb1Gated;
+
+static pfunHardwareClocks clients[HARDWARE_CLOCKS_CLIENTS_MAX];
+static int clientsNb;
 
 void vHardwareInit()
 {
+  // Count the crystal start up, in HSI cycles:
+  vCyclesInit();
+  const uint32_t start = uCyclesNow();
+
   // Enable HSE:
   RCC_HSEConfig(RCC_HSE_ON);
 
@@ -22,10 +69,13 @@ void vHardwareInit()
   // Wait for PLL to be ready:
   while (RCC_GetFlagStatus(RCC_FLAG_PLLRDY) != SET);
 
-  // Two wait states, if 48 MHz < SYSCLK <= 72 MHz:
+  // Two wait states, if 48 MHz < SYSCLK <= 72 MHz, hidden by the prefetch
+  // buffer on sequential fetches (branches still stall, see RAMFUNC):
+  FLASH_PrefetchBufferCmd(FLASH_PrefetchBuffer_Enable);
   FLASH_SetLatency(FLASH_Latency_2);
 
   // Set PLL as system clock:
+  clocksUs = (uCyclesNow() - start) / HSI_CYCLES_PER_US;
   RCC_SYSCLKConfig(RCC_SYSCLKSource_PLLCLK);
 
   // Disable HSI:
@@ -46,12 +96,89 @@ void vHardwareInit()
   // Set core clock as SYSTICK source:
   SysTick_CLKSourceConfig(SysTick_CLKSource_HCLK);
 
-#ifdef RAM_BOOT
+  // Microseconds timebase, from the core cycles:
+  vTimebaseInit();
+
+#if defined(SIMULATION)
+  // No vector table, the simulation calls the handlers
+#elif defined(RAM_BOOT)
   // Put vector interrupt table in RAM:
   NVIC_SetVectorTable(NVIC_VectTab_RAM, SCB_VTOR_TBLBASE);
+#else
+  // Relocated vector table, the bootloader one is at the flash start:
+  NVIC_SetVectorTable(NVIC_VectTab_FLASH,
+                      (uint32_t)_start - NVIC_VectTab_FLASH);
 #endif
 }
 
+uint32_t uHardwareClocksUs()
+{
+  return clocksUs;
+}
+
+uint32_t uHardwareUid()
+{
+#ifdef SIMULATION
+  // No system memory: the process, kept across the simulated resets
+  return 0x51D00000 ^ (uint32_t)getpid();
+#else
+  const uint32_t* id = (const uint32_t*)HARDWARE_UID_ADDRESS;
+
+  return id[0] ^ id[1] ^ id[2];
+#endif
+}
+
+void vHardwareOnClocks(pfunHardwareClocks callback_)
+{
+  if (clientsNb == HARDWARE_CLOCKS_CLIENTS_MAX)
+    vFaultAllocation("clocks");
+  clients[clientsNb++] = callback_;
+}
+
+int xHardwareSetProfile(int profile_)
+{
+  const hardware_profile_t* next = &profiles[profile_];
+  RCC_ClocksTypeDef clocks;
+  int i;
+
+  if (profile_ == profile)
+    return 1;
+
+  RCC_GetClocksFreq(&clocks);
+  clocks.PCLK2_Frequency = clocks.HCLK_Frequency >> next->pclk2_shift;
+  for (i = 0; i < clientsNb; i++)
+    if (!clients[i](HARDWARE_CLOCKS_CHECK, &clocks))
+      return 0;
+
+  RCC_GetClocksFreq(&clocks);
+  for (i = 0; i < clientsNb; i++)
+    clients[i](HARDWARE_CLOCKS_BEFORE, &clocks);
+
+  // Gating keeps the registers: the peripherals come back as they were
+  taskENTER_CRITICAL();
+  RCC->APB1ENR |= apb1Gated;
+  apb1Gated = RCC->APB1ENR & next->apb1_gated;
+  RCC->APB1ENR &= ~apb1Gated;
+  RCC_PCLK2Config(next->pclk2);
+  profile = profile_;
+  taskEXIT_CRITICAL();
+
+  RCC_GetClocksFreq(&clocks);
+  for (i = 0; i < clientsNb; i++)
+    clients[i](HARDWARE_CLOCKS_AFTER, &clocks);
+  return 1;
+}
+
+int iHardwareGetProfile()
+{
+  return profile;
+}
+
+const char* pcHardwareProfileName(int profile_)
+{
+  return profiles[profile_].name;
+}
+
 #define GPIO_CASE(GPIO)                                          \
   case (uint32_t)GPIO:                                           \
   RCC_APB2PeriphClockCmd(RCC_APB2Periph_##GPIO, ENABLE);         \
@@ -145,10 +272,3 @@ void vI2CClockInit(I2C_TypeDef* I2Cx_)
   else if (I2Cx_ == I2C2)
     RCC_APB1PeriphClockCmd(RCC_APB1Periph_I2C2, ENABLE);
 }
-
-void vWaitUs(int x_)
-{
-  int i, j;
-  for(i = 0; i < x_; i++)
-    for(j = 0; j < 50; j++);
-}
@@ -4,12 +4,54 @@
 #include "stm32f10x_gpio.h"
 #include "stm32f10x_tim.h"
 #include "stm32f10x_adc.h"
+#include "stm32f10x_rcc.h"
 
 #define MS_TO_TICKS(time_ms) ((portTickType)((time_ms) / portTICK_RATE_MS))
 
 #define GPIO_TO_EXTI_LINE(GPIO_Pin) (GPIO_Pin)
 
+// Run from SRAM, without the flash wait states: the hot interrupts and
+// the control loop. Copied with .data at boot; calls to and from flash
+// go through linker veneers.
+#define RAMFUNC __attribute__((section(".ramfunc")))
+// Into each caller even at -Os: with the board constants as arguments,
+// the register addresses fold
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
 void vHardwareInit();
+// Spent by vHardwareInit on the 8 MHz HSI: crystal start up and PLL lock
+uint32_t uHardwareClocksUs();
+// 32 bits of the 96-bit unique ID of the part, the words XORed: the
+// USB serial number and the PROTO_IDENT of the board
+uint32_t uHardwareUid();
+
+// Power profiles, HARDWARE_DRIVE out of vHardwareInit. The core, AHB and
+// APB1 clocks stay at 72, 72 and 36 MHz in all of them: the kernel tick,
+// the cycle counter and the timers hang on them. Docked, APB2 runs at
+// 36 MHz (its timers, doubled, still at 72) and the left encoder timer
+// is gated, the motors must be stopped.
+enum eHardwareProfile {
+  HARDWARE_DRIVE,
+  HARDWARE_DOCKED,
+  HARDWARE_PROFILES_NB
+};
+
+// Phases of a switch, for the drivers of the peripherals on APB2
+enum eHardwareClocksPhase {
+  HARDWARE_CLOCKS_CHECK,   // clocks_ to come: 0 refuses the switch
+  HARDWARE_CLOCKS_BEFORE,  // clocks_ still in use: quiesce
+  HARDWARE_CLOCKS_AFTER,   // clocks_ now in use: re-derive the dividers
+};
+typedef int (*pfunHardwareClocks)(int phase_, const RCC_ClocksTypeDef* clocks_);
+
+#define HARDWARE_CLOCKS_CLIENTS_MAX 4
+
+// Before the scheduler starts
+void vHardwareOnClocks(pfunHardwareClocks callback_);
+// From one task at a time, the callbacks run in it. 0 if refused.
+int xHardwareSetProfile(int profile_);
+int iHardwareGetProfile();
+const char* pcHardwareProfileName(int profile_);
 void vGpioClockInit(GPIO_TypeDef* GPIOx_);
 void vTimerClockInit(TIM_TypeDef* TIMx_);
 void vDmaClockInit(DMA_TypeDef* DMAx_);
@@ -17,6 +59,5 @@ void vAdcClockInit(ADC_TypeDef* ADCx_);
 void vSpiClockInit(SPI_TypeDef* SPIx_);
 void vCanClockInit(CAN_TypeDef* CANx_);
 void vI2CClockInit(I2C_TypeDef* I2Cx_);
-void vWaitUs(int x_);
 
 #endif
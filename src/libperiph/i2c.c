@@ -1,131 +1,454 @@
+#include <string.h>
+
 #include "FreeRTOS.h"
 
 #include "misc.h"
-#include "queue.h"
 #include "task.h"
 
+#include "stm32f10x_dma.h"
 #include "stm32f10x_gpio.h"
 #include "stm32f10x_i2c.h"
 #include "stm32f10x_rcc.h"
 
 #include "libglobal/assert_param.h"
+#include "libglobal/profile.h"
+#include "libglobal/timeline.h"
 #include "libperiph/hardware.h"
 #include "libperiph/i2c.h"
+#include "libperiph/priorities.h"
+#include "libperiph/resources.h"
+#include "libperiph/timebase.h"
 
 #define I2C_GPIOx   GPIOB
-#define I2C_SCL_Pin GPIO_Pin_6
-#define I2C_SDA_Pin GPIO_Pin_7
+// Remapped: PB6/PB7 are the left encoder inputs
+#define I2C_SCL_Pin GPIO_Pin_8
+#define I2C_SDA_Pin GPIO_Pin_9
+
+
+// I2C1_TX and I2C1_RX DMA requests
+#define I2C_TX_DMA_CHANNEL DMA1_Channel6
+#define I2C_RX_DMA_CHANNEL DMA1_Channel7
+
+// Clock pulses to shift out a byte held by a stuck slave, at 100 kHz
+#define I2C_UNSTICK_PULSES 9
+#define I2C_UNSTICK_HALF_PERIOD_US 5
+
+// Byte sent for reads past the end of the register file
+#define I2C_PAD_BYTE 0xFF
+
+#ifdef I2C_TRACE
+// High during the I2C interrupts, for a scope
+# define I2C_TRACE_GPIOx GPIOC
+# define I2C_TRACE_Pin   GPIO_Pin_5
+# define I2C_TRACE_ENTER() (I2C_TRACE_GPIOx->BSRR = I2C_TRACE_Pin)
+# define I2C_TRACE_EXIT()  (I2C_TRACE_GPIOx->BRR = I2C_TRACE_Pin)
+# define I2C_TRACE_EVENT(event, sr1) prvI2CTrace(event, sr1)
+
+static i2c_trace_t trace[I2C_TRACE_NB];
+static volatile uint32_t traceHead;
+
+static void prvI2CTraceInit();
+static void prvI2CTrace(uint8_t event_, uint16_t sr1_);
+#else
+# define I2C_TRACE_ENTER()
+# define I2C_TRACE_EXIT()
+# define I2C_TRACE_EVENT(event, sr1)
+#endif
 
-#define I2C_QUEUE_SIZE 10
-static xQueueHandle xI2COutQueue;
-static xQueueHandle xI2CInQueue;
+// Double buffered register file: the DMA reads the front one, snapshots
+// are copied to the back one and swapped when no transaction is running
+static uint8_t regs[2][I2C_REGS_SIZE];
+static volatile uint8_t front;
+static volatile uint8_t busy;
+static volatile uint8_t swapPending;
+
+// Register pointer followed by the register writes of a master write
+static uint8_t rxBuffer[1 + I2C_REGS_SIZE];
+static uint8_t pointer;
+
+static pfunI2CWrite writeHandler;
+
+static uint8_t ownAddress = I2C_DEFAULT_ADDRESS;
+
+static i2c_stats_t stats;
+// Tick of the last interrupt, to detect a stuck bus
+static volatile portTickType lastEvent;
+
+static void prvI2CConfigure();
+static void prvI2CPinsInit(GPIOMode_TypeDef mode_);
+static void prvI2CUnstick();
+static void prvI2CDmaInit();
+static void prvI2CStartWrite();
+static void prvI2CEndWrite();
+static void prvI2CStartRead();
+static void prvI2CEndTransaction();
 
 void vI2CInit()
 {
-  // Create i2c queues
-  xI2COutQueue = xQueueCreate(I2C_QUEUE_SIZE, sizeof (uint8_t));
-  xI2CInQueue = xQueueCreate(I2C_QUEUE_SIZE, sizeof (uint8_t));
-
   // Configure I2C clock
   vI2CClockInit(I2C1);
 
-  I2C_InitTypeDef I2C_InitStruct =
-    {
-      .I2C_ClockSpeed = 200000,
-      .I2C_Mode = I2C_Mode_I2C,
-      .I2C_DutyCycle = I2C_DutyCycle_2,
-      .I2C_OwnAddress1 = 0x08,
-      .I2C_Ack = I2C_Ack_Enable,
-      .I2C_AcknowledgedAddress = I2C_AcknowledgedAddress_7bit,
-    };
-  I2C_Init(I2C1, &I2C_InitStruct);
+  prvI2CDmaInit();
+#ifdef I2C_TRACE
+  prvI2CTraceInit();
+#endif
 
-  // Enable interrupts
-  I2C_ITConfig(I2C1, (I2C_IT_BUF | I2C_IT_EVT), ENABLE);
+  // Snapshots are published under a kernel critical section: these
+  // interrupts must stay in the range masked by the kernel.
   NVIC_InitTypeDef NVIC_InitStruct =
     {
       .NVIC_IRQChannel                   = I2C1_EV_IRQn,
-      .NVIC_IRQChannelPreemptionPriority = 6,  // I2C MUST HAVE THE MAXIMUM
-      .NVIC_IRQChannelSubPriority        = 0,  // PRIORITY AVAILABLE!
+      .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_I2C_SLAVE,
+      .NVIC_IRQChannelSubPriority        = 0,
       .NVIC_IRQChannelCmd                = ENABLE,
     };
   NVIC_Init(&NVIC_InitStruct);
+  NVIC_InitStruct.NVIC_IRQChannel = I2C1_ER_IRQn;
+  NVIC_Init(&NVIC_InitStruct);
+  NVIC_InitStruct.NVIC_IRQChannel = DMA1_Channel6_IRQn;
+  NVIC_Init(&NVIC_InitStruct);
+  NVIC_InitStruct.NVIC_IRQChannel = DMA1_Channel7_IRQn;
+  NVIC_Init(&NVIC_InitStruct);
 
   // Configure SCL and SDA as alternate function open-drain outputs
+  xResourceClaim(RESOURCE_REMAP_I2C1, "i2c");
+  GPIO_PinRemapConfig(GPIO_Remap_I2C1, ENABLE);
+  prvI2CPinsInit(GPIO_Mode_AF_OD);
+
+  prvI2CConfigure();
+}
+
+// Also used to restore the peripheral after a software reset
+static void prvI2CConfigure()
+{
+  I2C_InitTypeDef I2C_InitStruct =
+    {
+      .I2C_ClockSpeed = I2C_SPEED_HZ,
+      .I2C_Mode = I2C_Mode_I2C,
+      .I2C_DutyCycle = I2C_DUTY_CYCLE,
+      // OAR1 value, the address bits start at bit 1
+      .I2C_OwnAddress1 = ownAddress << 1,
+      .I2C_Ack = I2C_Ack_Enable,
+      .I2C_AcknowledgedAddress = I2C_AcknowledgedAddress_7bit,
+    };
+  I2C_Init(I2C1, &I2C_InitStruct);
+  // Writes to address 0 reach every board of the bus at once
+  I2C_GeneralCallCmd(I2C1, ENABLE);
+
+  // The buffer interrupt is only enabled once the DMA is done, to pad or
+  // drop the bytes beyond the register file
+  I2C_ITConfig(I2C1, (I2C_IT_EVT | I2C_IT_ERR), ENABLE);
+  I2C_DMACmd(I2C1, ENABLE);
+
+  // Enable I2C
+  I2C_Cmd(I2C1, ENABLE);
+}
+
+static void prvI2CPinsInit(GPIOMode_TypeDef mode_)
+{
   GPIO_InitTypeDef GPIO_InitStruct =
     {
       .GPIO_Pin   = I2C_SCL_Pin | I2C_SDA_Pin,
       .GPIO_Speed = GPIO_Speed_2MHz,
-      .GPIO_Mode  = GPIO_Mode_AF_OD,
+      .GPIO_Mode  = mode_,
     };
   GPIO_Init(I2C_GPIOx, &GPIO_InitStruct);
+}
 
-  // Enable I2C
-  I2C_Cmd(I2C1, ENABLE);
+void vI2CSetAddress(uint8_t address_)
+{
+  assert_param(address_ && address_ <= I2C_MAX_ADDRESS);
+
+  taskENTER_CRITICAL();
+  ownAddress = address_;
+  prvI2CEndTransaction();
+  prvI2CConfigure();
+  taskEXIT_CRITICAL();
 }
 
-void I2C1_EV_IRQHandler()
+uint8_t uI2CGetAddress()
 {
-  portBASE_TYPE xNeedsRescheduling = pdFALSE;
+  return ownAddress;
+}
 
-  // Address matched flag
-  if (I2C_GetFlagStatus(I2C1, I2C_FLAG_ADDR)) {
+void vI2CGetStats(i2c_stats_t* stats_)
+{
+  taskENTER_CRITICAL();
+  *stats_ = stats;
+  taskEXIT_CRITICAL();
+}
 
-    // Transmitter mode
-    if (I2C_GetFlagStatus(I2C1, I2C_FLAG_TRA)) {
-      uint8_t data_out;
-      if (xQueueReceiveFromISR(xI2COutQueue, &data_out, &xNeedsRescheduling))
-	I2C_SendData(I2C1, data_out);
-      else
-        I2C_GenerateSTOP(I2C1, ENABLE);
-    }
+// Shift out the byte a slave holds SDA low for, then a stop condition
+static void prvI2CUnstick()
+{
+  GPIO_SetBits(I2C_GPIOx, I2C_SCL_Pin | I2C_SDA_Pin);
+  prvI2CPinsInit(GPIO_Mode_Out_OD);
 
-    // Receiver mode
-    else {
-      uint8_t data_in = I2C1->DR;
-      static int test = 1;
-      xQueueSendToBackFromISR(xI2CInQueue, &data_in, &xNeedsRescheduling);
-
-      vGpioClockInit(GPIOC);
-      GPIO_InitTypeDef init =
-        {
-          .GPIO_Pin   = GPIO_Pin_5,
-          .GPIO_Speed = GPIO_Speed_2MHz,
-          .GPIO_Mode  = GPIO_Mode_Out_PP,
-        };
-      GPIO_Init(GPIOC, &init);
-      if (test) {
-        GPIO_SetBits(GPIOC, GPIO_Pin_5);
-        test = 0;
-      }
-      else {
-        GPIO_ResetBits(GPIOC, GPIO_Pin_5);
-        test = 1;
-      }
+  for (int i = 0; i < I2C_UNSTICK_PULSES &&
+         !GPIO_ReadInputDataBit(I2C_GPIOx, I2C_SDA_Pin); i++)
+  {
+    GPIO_ResetBits(I2C_GPIOx, I2C_SCL_Pin);
+    vTimeDelayUs(I2C_UNSTICK_HALF_PERIOD_US);
+    GPIO_SetBits(I2C_GPIOx, I2C_SCL_Pin);
+    vTimeDelayUs(I2C_UNSTICK_HALF_PERIOD_US);
+  }
 
-    }
+  GPIO_ResetBits(I2C_GPIOx, I2C_SDA_Pin);
+  vTimeDelayUs(I2C_UNSTICK_HALF_PERIOD_US);
+  GPIO_SetBits(I2C_GPIOx, I2C_SDA_Pin);
 
+  prvI2CPinsInit(GPIO_Mode_AF_OD);
+}
+
+int iI2CCheckBus()
+{
+  int stuck;
+
+  taskENTER_CRITICAL();
+  stuck = (busy || (I2C1->SR2 & I2C_SR2_BUSY)) &&
+    xTaskGetTickCount() - lastEvent > MS_TO_TICKS(I2C_TIMEOUT_MS);
+  if (stuck)
+  {
+    prvI2CEndTransaction();
+    I2C_Cmd(I2C1, DISABLE);
+    if (!GPIO_ReadInputDataBit(I2C_GPIOx, I2C_SDA_Pin))
+      prvI2CUnstick();
+    I2C_SoftwareResetCmd(I2C1, ENABLE);
+    I2C_SoftwareResetCmd(I2C1, DISABLE);
+    prvI2CConfigure();
+    stats.recoveries++;
+    lastEvent = xTaskGetTickCount();
   }
+  taskEXIT_CRITICAL();
+
+  return stuck;
+}
+
+static void prvI2CDmaInit()
+{
+  xResourceClaim(RESOURCE_DMA1_CH6, "i2c");
+  xResourceClaim(RESOURCE_DMA1_CH7, "i2c");
+  vDmaClockInit(DMA1);
 
-  // Data register empty flag (Transmitter)
-  else if (I2C_GetFlagStatus(I2C1, I2C_FLAG_TXE)) {
-      uint8_t data_out;
-      if (xQueueReceiveFromISR(xI2COutQueue, &data_out, &xNeedsRescheduling))
-        I2C_SendData(I2C1, data_out);
-      else
-        I2C_GenerateSTOP(I2C1, ENABLE);
+  // TX: front register file to I2C data register, armed at each read
+  DMA_DeInit(I2C_TX_DMA_CHANNEL);
+  DMA_InitTypeDef DMA_InitStructure;
+  DMA_StructInit(&DMA_InitStructure);
+  DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)(&I2C1->DR);
+  DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)regs[0];
+  DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralDST;
+  DMA_InitStructure.DMA_BufferSize = 1;    // Set per read, 0 fails the check
+  DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+  DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+  DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+  DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+  DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+  DMA_InitStructure.DMA_Priority = DMA_Priority_Medium;
+  DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+  DMA_Init(I2C_TX_DMA_CHANNEL, &DMA_InitStructure);
+  DMA_ITConfig(I2C_TX_DMA_CHANNEL, DMA_IT_TC, ENABLE);
+
+  // RX: I2C data register to the write buffer, armed at each write
+  DMA_DeInit(I2C_RX_DMA_CHANNEL);
+  DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)rxBuffer;
+  DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
+  DMA_Init(I2C_RX_DMA_CHANNEL, &DMA_InitStructure);
+  DMA_ITConfig(I2C_RX_DMA_CHANNEL, DMA_IT_TC, ENABLE);
+}
+
+void vI2CSetWriteHandler(pfunI2CWrite handler_)
+{
+  writeHandler = handler_;
+}
+
+void vI2CPublish(const void* regs_, int size_)
+{
+  if (size_ > I2C_REGS_SIZE)
+    size_ = I2C_REGS_SIZE;
+
+  taskENTER_CRITICAL();
+  memcpy(regs[!front], regs_, size_);
+  if (busy)
+    swapPending = 1;
+  else
+    front = !front;
+  taskEXIT_CRITICAL();
+}
+
+#ifdef I2C_TRACE
+static void prvI2CTraceInit()
+{
+  vGpioClockInit(I2C_TRACE_GPIOx);
+  GPIO_InitTypeDef GPIO_InitStruct =
+    {
+      .GPIO_Pin   = I2C_TRACE_Pin,
+      .GPIO_Speed = GPIO_Speed_50MHz,
+      .GPIO_Mode  = GPIO_Mode_Out_PP,
+    };
+  GPIO_Init(I2C_TRACE_GPIOx, &GPIO_InitStruct);
+  I2C_TRACE_EXIT();
+}
+
+static void prvI2CTrace(uint8_t event_, uint16_t sr1_)
+{
+  i2c_trace_t* record = &trace[traceHead++ & (I2C_TRACE_NB - 1)];
+
+  record->tick = xTaskGetTickCountFromISR();
+  record->sr1 = sr1_;
+  record->event = event_;
+  record->pointer = pointer;
+}
+
+int iI2CGetTrace(i2c_trace_t* trace_, int n_)
+{
+  taskENTER_CRITICAL();
+  uint32_t head = traceHead;
+  if (n_ > I2C_TRACE_NB)
+    n_ = I2C_TRACE_NB;
+  if (n_ > head)
+    n_ = head;
+  for (int i = 0; i < n_; i++)
+    trace_[i] = trace[(head - n_ + i) & (I2C_TRACE_NB - 1)];
+  taskEXIT_CRITICAL();
+
+  return n_;
+}
+#endif
+
+static void prvI2CStartWrite()
+{
+  I2C_RX_DMA_CHANNEL->CCR &= ~DMA_CCR7_EN;
+  I2C_RX_DMA_CHANNEL->CNDTR = sizeof (rxBuffer);
+  I2C_RX_DMA_CHANNEL->CCR |= DMA_CCR7_EN;
+}
+
+static void prvI2CEndWrite()
+{
+  if (!(I2C_RX_DMA_CHANNEL->CCR & DMA_CCR7_EN))
+    return;
+
+  int count = sizeof (rxBuffer) - I2C_RX_DMA_CHANNEL->CNDTR;
+  I2C_RX_DMA_CHANNEL->CCR &= ~DMA_CCR7_EN;
+
+  if (count > 0)
+    pointer = rxBuffer[0];
+  if (count > 1 && writeHandler)
+    writeHandler(rxBuffer[0], &rxBuffer[1], count - 1);
+}
+
+static void prvI2CStartRead()
+{
+  if (pointer >= I2C_REGS_SIZE) {
+    I2C1->CR2 |= I2C_CR2_ITBUFEN;
+    return;
+  }
+
+  I2C_TX_DMA_CHANNEL->CCR &= ~DMA_CCR6_EN;
+  I2C_TX_DMA_CHANNEL->CMAR = (uint32_t)&regs[front][pointer];
+  I2C_TX_DMA_CHANNEL->CNDTR = I2C_REGS_SIZE - pointer;
+  I2C_TX_DMA_CHANNEL->CCR |= DMA_CCR6_EN;
+}
+
+static void prvI2CEndTransaction()
+{
+  I2C_TX_DMA_CHANNEL->CCR &= ~DMA_CCR6_EN;
+  I2C_RX_DMA_CHANNEL->CCR &= ~DMA_CCR7_EN;
+  I2C1->CR2 &= ~I2C_CR2_ITBUFEN;
+
+  busy = 0;
+  if (swapPending) {
+    front = !front;
+    swapPending = 0;
   }
+}
+
+RAMFUNC void I2C1_EV_IRQHandler()
+{
+  uint16_t sr1 = I2C1->SR1;
+  PROFILE_BEGIN(PROFILE_I2C1_EV_IRQ);
+  TIMELINE_ISR_ENTER(I2C1_EV_IRQn);
+  I2C_TRACE_ENTER();
+  lastEvent = xTaskGetTickCountFromISR();
+
+  // Address matched: cleared by reading SR1 then SR2. SCL is stretched
+  // until the DMA feeds or empties the data register.
+  if (sr1 & I2C_SR1_ADDR) {
+    uint16_t sr2 = I2C1->SR2;
+    busy = 1;
 
-  // Data Register not empty flag (Receiver)
-  else if (I2C_GetFlagStatus(I2C1, I2C_FLAG_RXNE)) {
-    uint8_t data_in = I2C1->DR;
-    xQueueSendToBackFromISR(xI2CInQueue, &data_in, &xNeedsRescheduling);
+    // Transmitter: repeated start after the register pointer, or read
+    // from the last pointer
+    if (sr2 & I2C_SR2_TRA) {
+      prvI2CEndWrite();
+      I2C_TRACE_EVENT(I2C_TRACE_ADDR_TX, sr1);
+      prvI2CStartRead();
+    }
+    // Receiver: register pointer then register writes
+    else {
+      I2C_TRACE_EVENT(I2C_TRACE_ADDR_RX, sr1);
+      prvI2CStartWrite();
+    }
   }
 
-  // Stop detection flag
-  else if (I2C_GetFlagStatus(I2C1, I2C_FLAG_STOPF)) {
-    I2C_Cmd(I2C1, ENABLE);
+  // Stop of a master write: cleared by reading SR1 then writing CR1
+  else if (sr1 & I2C_SR1_STOPF) {
+    I2C1->CR1 |= I2C_CR1_PE;
+    prvI2CEndWrite();
+    I2C_TRACE_EVENT(I2C_TRACE_STOP, sr1);
+    prvI2CEndTransaction();
   }
 
-  portEND_SWITCHING_ISR(xNeedsRescheduling);
+  // Past the end of the register file
+  else if (sr1 & I2C_SR1_TXE) {
+    I2C1->DR = I2C_PAD_BYTE;
+    I2C_TRACE_EVENT(I2C_TRACE_PAD, sr1);
+  }
+  else if (sr1 & I2C_SR1_RXNE) {
+    (void)I2C1->DR;
+    I2C_TRACE_EVENT(I2C_TRACE_DROP, sr1);
+  }
+
+  I2C_TRACE_EXIT();
+  TIMELINE_ISR_EXIT(I2C1_EV_IRQn);
+  PROFILE_END(PROFILE_I2C1_EV_IRQ);
+}
+
+void I2C1_ER_IRQHandler()
+{
+  uint16_t sr1 = I2C1->SR1;
+  I2C_TRACE_ENTER();
+  I2C_TRACE_EVENT(I2C_TRACE_ERROR, sr1);
+  lastEvent = xTaskGetTickCountFromISR();
+
+  // Error flags are cleared by writing 0
+  I2C1->SR1 = ~(sr1 & (I2C_SR1_AF | I2C_SR1_BERR | I2C_SR1_OVR | I2C_SR1_ARLO));
+
+  if (sr1 & I2C_SR1_BERR)
+    stats.bus_errors++;
+  if (sr1 & I2C_SR1_ARLO)
+    stats.arbitrations++;
+  if (sr1 & I2C_SR1_OVR)
+    stats.overruns++;
+
+  // Acknowledge failure is the master ending a read. The hardware
+  // releases the lines on a bus error or a lost arbitration: drop the
+  // pending writes.
+  if (sr1 & (I2C_SR1_AF | I2C_SR1_BERR | I2C_SR1_ARLO))
+    prvI2CEndTransaction();
+
+  I2C_TRACE_EXIT();
+}
+
+void DMA1_Channel6_IRQHandler()
+{
+  // Register file sent: pad from the buffer interrupt
+  DMA1->IFCR = DMA_IFCR_CGIF6;
+  I2C1->CR2 |= I2C_CR2_ITBUFEN;
+}
+
+void DMA1_Channel7_IRQHandler()
+{
+  // Write buffer full: drop from the buffer interrupt
+  DMA1->IFCR = DMA_IFCR_CGIF7;
+  I2C1->CR2 |= I2C_CR2_ITBUFEN;
 }
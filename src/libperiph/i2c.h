@@ -1,6 +1,82 @@
 #ifndef LIBPERIPH_I2C_H
 # define LIBPERIPH_I2C_H
 
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "stm32f10x_i2c.h"
+
+// Slave register file. The first byte written by the master is the
+// register pointer, following bytes are register writes. Reads start at
+// the pointer and go on up to the end of the file (then 0xFF).
+#define I2C_REGS_SIZE 64
+
+// 7-bit slave address, the node address when one is set. The writes to
+// the general call address (0) are taken as well, the same way: one
+// transaction for all the boards of the bus (e.g. a stop).
+#define I2C_DEFAULT_ADDRESS 0x04
+#define I2C_MAX_ADDRESS     0x77
+
+// Called from the I2C interrupt at the stop of a master write, with the
+// bytes written after the register pointer. Must not block.
+typedef void (*pfunI2CWrite)(uint8_t reg_, const uint8_t* data_, int size_);
+
+// The master clocks the bus, a slave leaves its CCR unused: only a valid
+// one for I2C_Init, fast mode so that the timings of the peripheral allow
+// the master 400 kHz
+#define I2C_SPEED_HZ   400000
+#define I2C_DUTY_CYCLE I2C_DutyCycle_2
+
+// A transaction or a busy bus without interrupt for this long is stuck
+#define I2C_TIMEOUT_MS 50
+
+typedef struct
+{
+  uint16_t bus_errors;   // Misplaced start or stop (BERR)
+  uint16_t arbitrations; // Arbitration lost (ARLO)
+  uint16_t overruns;     // Overrun or underrun (OVR)
+  uint16_t recoveries;   // Peripheral reset after a stuck bus
+} i2c_stats_t;
+
+#ifdef I2C_TRACE
+// Slave events recorded by the interrupts (configure with --i2c-trace)
+#define I2C_TRACE_NB 32 // Must be a power of 2
+
+enum eI2CTraceEvent {
+  I2C_TRACE_ADDR_RX, // Address matched, master write
+  I2C_TRACE_ADDR_TX, // Address matched, master read
+  I2C_TRACE_STOP,
+  I2C_TRACE_PAD,     // Byte read past the end of the register file
+  I2C_TRACE_DROP,    // Byte written past the end of the register file
+  I2C_TRACE_ERROR,
+};
+
+typedef struct
+{
+  portTickType tick;
+  uint16_t sr1;
+  uint8_t event;
+  uint8_t pointer;
+} i2c_trace_t;
+
+// Copy up to n_ of the last records, oldest first, returns the number
+// copied
+int iI2CGetTrace(i2c_trace_t* trace_, int n_);
+#endif
+
 void vI2CInit();
+void vI2CSetWriteHandler(pfunI2CWrite handler_);
+void vI2CSetAddress(uint8_t address_);
+uint8_t uI2CGetAddress();
+void vI2CGetStats(i2c_stats_t* stats_);
+
+// Reset the peripheral and clock SDA free when the bus has been stuck for
+// I2C_TIMEOUT_MS, from a task. Returns 1 after a recovery.
+int iI2CCheckBus();
+
+// Copy a new snapshot of the register file, served from the next read
+// transaction on (a read in progress keeps the previous one)
+void vI2CPublish(const void* regs_, int size_);
 
 #endif /* LIBPERIPH_I2C_H */
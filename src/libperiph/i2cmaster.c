@@ -0,0 +1,319 @@
+#include "FreeRTOS.h"
+
+#include "misc.h"
+#include "semphr.h"
+#include "task.h"
+
+#include "stm32f10x_gpio.h"
+#include "stm32f10x_i2c.h"
+
+#include "libglobal/fault.h"
+#include "libglobal/timeline.h"
+
+#include "libperiph/hardware.h"
+#include "libperiph/i2cmaster.h"
+#include "libperiph/priorities.h"
+
+#define I2C_MASTER_GPIOx   GPIOB
+#define I2C_MASTER_SCL_Pin GPIO_Pin_10
+#define I2C_MASTER_SDA_Pin GPIO_Pin_11
+
+// Queued transfers, the head one is running
+static i2c_transfer_t* volatile head;
+static i2c_transfer_t* tail;
+
+// Running transfer progress
+static uint8_t position;
+static uint8_t reading;
+
+static int speed = I2C_MASTER_SPEED_HZ;
+static uint16_t dutyCycle = I2C_DutyCycle_2;
+
+// Completion of the blocking helpers, one caller at a time
+#define I2C_MASTER_DONE_BIT 0x01
+static xSemaphoreHandle xI2CMasterMutex;
+static flags_t doneFlags;
+
+static void prvI2CMasterConfigure();
+static void prvI2CMasterStart();
+static void prvI2CMasterEnd(int8_t status_, portBASE_TYPE* reschedNeeded_);
+
+void vI2CMasterInit()
+{
+  xI2CMasterMutex = xSemaphoreCreateMutex();
+  if (!xI2CMasterMutex)
+    vFaultAllocation("i2cmaster");
+  vFlagsInit(&doneFlags);
+
+  vI2CClockInit(I2C2);
+
+  // Configure SCL and SDA as alternate function open-drain outputs
+  GPIO_InitTypeDef GPIO_InitStruct =
+    {
+      .GPIO_Pin   = I2C_MASTER_SCL_Pin | I2C_MASTER_SDA_Pin,
+      .GPIO_Speed = GPIO_Speed_2MHz,
+      .GPIO_Mode  = GPIO_Mode_AF_OD,
+    };
+  GPIO_Init(I2C_MASTER_GPIOx, &GPIO_InitStruct);
+
+  prvI2CMasterConfigure();
+
+  // Completion gives semaphores: stay in the range masked by the kernel
+  I2C_ITConfig(I2C2, (I2C_IT_EVT | I2C_IT_ERR), ENABLE);
+  NVIC_InitTypeDef NVIC_InitStruct =
+    {
+      .NVIC_IRQChannel                   = I2C2_EV_IRQn,
+      .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_I2C_MASTER,
+      .NVIC_IRQChannelSubPriority        = 0,
+      .NVIC_IRQChannelCmd                = ENABLE,
+    };
+  NVIC_Init(&NVIC_InitStruct);
+  NVIC_InitStruct.NVIC_IRQChannel = I2C2_ER_IRQn;
+  NVIC_Init(&NVIC_InitStruct);
+
+  I2C_Cmd(I2C2, ENABLE);
+}
+
+// Clears PE for the time of it: never within a transfer
+static void prvI2CMasterConfigure()
+{
+  I2C_InitTypeDef I2C_InitStruct =
+    {
+      .I2C_ClockSpeed = speed,
+      .I2C_Mode = I2C_Mode_I2C,
+      .I2C_DutyCycle = dutyCycle,
+      .I2C_OwnAddress1 = 0,
+      .I2C_Ack = I2C_Ack_Enable,
+      .I2C_AcknowledgedAddress = I2C_AcknowledgedAddress_7bit,
+    };
+  I2C_Init(I2C2, &I2C_InitStruct);
+}
+
+void vI2CMasterSetClock(int speed_hz_, uint16_t dutyCycle_)
+{
+  assert_param(IS_I2C_DUTY_CYCLE(dutyCycle_));
+
+  if (speed_hz_ < I2C_MASTER_MIN_SPEED_HZ)
+    speed_hz_ = I2C_MASTER_MIN_SPEED_HZ;
+  if (speed_hz_ > I2C_MASTER_MAX_SPEED_HZ)
+    speed_hz_ = I2C_MASTER_MAX_SPEED_HZ;
+
+  // The blocking callers kept out, the queued transfers waited for, the
+  // stop of the last one included
+  xSemaphoreTake(xI2CMasterMutex, portMAX_DELAY);
+  for (;;)
+  {
+    taskENTER_CRITICAL();
+    if (!head && !(I2C2->SR2 & I2C_SR2_BUSY))
+      break;
+    taskEXIT_CRITICAL();
+    vTaskDelay(1);
+  }
+  speed = speed_hz_;
+  dutyCycle = dutyCycle_;
+  prvI2CMasterConfigure();
+  taskEXIT_CRITICAL();
+  xSemaphoreGive(xI2CMasterMutex);
+}
+
+void vI2CMasterSubmit(i2c_transfer_t* transfer_)
+{
+  transfer_->status = I2C_MASTER_PENDING;
+  transfer_->next = NULL;
+
+  taskENTER_CRITICAL();
+  if (head)
+    tail->next = transfer_;
+  else
+    head = transfer_;
+  tail = transfer_;
+  if (head == transfer_)
+    prvI2CMasterStart();
+  taskEXIT_CRITICAL();
+}
+
+void vI2CMasterAbort(i2c_transfer_t* transfer_)
+{
+  taskENTER_CRITICAL();
+  if (head == transfer_)
+  {
+    I2C2->CR1 |= I2C_CR1_STOP;
+    prvI2CMasterEnd(I2C_MASTER_ERROR, NULL);
+  }
+  else
+  {
+    for (i2c_transfer_t* t = head; t; t = t->next)
+      if (t->next == transfer_)
+      {
+        t->next = transfer_->next;
+        if (tail == transfer_)
+          tail = t;
+        transfer_->status = I2C_MASTER_ERROR;
+        break;
+      }
+  }
+  taskEXIT_CRITICAL();
+}
+
+int iI2CMasterTransfer(i2c_transfer_t* transfer_, portTickType timeout_)
+{
+  xSemaphoreTake(xI2CMasterMutex, portMAX_DELAY);
+
+  transfer_->done = &doneFlags;
+  transfer_->done_bits = I2C_MASTER_DONE_BIT;
+  vI2CMasterSubmit(transfer_);
+  if (!uFlagsWait(&doneFlags, I2C_MASTER_DONE_BIT, FLAGS_ANY, timeout_))
+  {
+    vI2CMasterAbort(transfer_);
+    // Ended meanwhile
+    vFlagsClear(&doneFlags, I2C_MASTER_DONE_BIT);
+  }
+
+  xSemaphoreGive(xI2CMasterMutex);
+  return transfer_->status;
+}
+
+int iI2CMasterReadRegs(uint8_t address_, uint8_t reg_, uint8_t* data_,
+                       int size_, portTickType timeout_)
+{
+  i2c_transfer_t transfer =
+    {
+      .address = address_,
+      .tx      = &reg_,
+      .tx_size = 1,
+      .rx      = data_,
+      .rx_size = size_,
+    };
+  return iI2CMasterTransfer(&transfer, timeout_);
+}
+
+int iI2CMasterWriteReg(uint8_t address_, uint8_t reg_, uint8_t value_,
+                       portTickType timeout_)
+{
+  uint8_t data[2] = { reg_, value_ };
+  i2c_transfer_t transfer =
+    {
+      .address = address_,
+      .tx      = data,
+      .tx_size = 2,
+    };
+  return iI2CMasterTransfer(&transfer, timeout_);
+}
+
+// Start the head transfer, with the interrupts masked
+static void prvI2CMasterStart()
+{
+  position = 0;
+  reading = !head->tx_size;
+  I2C2->CR1 |= I2C_CR1_ACK;
+  I2C2->CR2 |= I2C_CR2_ITBUFEN;
+  I2C2->CR1 |= I2C_CR1_START;
+}
+
+// End the head transfer and start the next one
+static void prvI2CMasterEnd(int8_t status_, portBASE_TYPE* reschedNeeded_)
+{
+  i2c_transfer_t* transfer = head;
+
+  I2C2->CR2 &= ~I2C_CR2_ITBUFEN;
+  head = transfer->next;
+  transfer->status = status_;
+  if (transfer->callback)
+    transfer->callback(transfer);
+  if (transfer->done)
+  {
+    if (reschedNeeded_)
+      vFlagsSetFromISR(transfer->done, transfer->done_bits, reschedNeeded_);
+    else
+      vFlagsSet(transfer->done, transfer->done_bits);
+  }
+
+  if (head)
+    prvI2CMasterStart();
+}
+
+RAMFUNC void I2C2_EV_IRQHandler()
+{
+  portBASE_TYPE reschedNeeded = pdFALSE;
+  uint16_t sr1 = I2C2->SR1;
+  i2c_transfer_t* transfer = head;
+  TIMELINE_ISR_ENTER(I2C2_EV_IRQn);
+
+  if (!transfer) {
+    // Stale event after an abort
+    (void)I2C2->SR2;
+    I2C2->CR2 &= ~I2C_CR2_ITBUFEN;
+    TIMELINE_ISR_EXIT(I2C2_EV_IRQn);
+    return;
+  }
+
+  // Start sent: address and direction
+  if (sr1 & I2C_SR1_SB)
+    I2C2->DR = (transfer->address << 1) | (reading ? 1 : 0);
+
+  // Address acknowledged: cleared by reading SR1 then SR2
+  else if (sr1 & I2C_SR1_ADDR) {
+    // A single byte is not acknowledged, and the stop is requested as
+    // soon as the address is cleared
+    if (reading && transfer->rx_size == 1) {
+      I2C2->CR1 &= ~I2C_CR1_ACK;
+      (void)I2C2->SR2;
+      I2C2->CR1 |= I2C_CR1_STOP;
+    }
+    else
+      (void)I2C2->SR2;
+  }
+
+  else if (reading) {
+    if (sr1 & I2C_SR1_RXNE) {
+      transfer->rx[position++] = I2C2->DR;
+      // Last byte on its way: not acknowledged, followed by a stop
+      if (position == transfer->rx_size - 1) {
+        I2C2->CR1 &= ~I2C_CR1_ACK;
+        I2C2->CR1 |= I2C_CR1_STOP;
+      }
+      else if (position == transfer->rx_size)
+        prvI2CMasterEnd(I2C_MASTER_DONE, &reschedNeeded);
+    }
+  }
+
+  else {
+    if ((sr1 & I2C_SR1_TXE) && position < transfer->tx_size)
+      I2C2->DR = transfer->tx[position++];
+    // Last byte still shifting out: wait for the byte transfer finished
+    else if (!(sr1 & I2C_SR1_BTF))
+      I2C2->CR2 &= ~I2C_CR2_ITBUFEN;
+    // Written: repeated start for the read, or stop
+    else if (transfer->rx_size) {
+      position = 0;
+      reading = 1;
+      I2C2->CR2 |= I2C_CR2_ITBUFEN;
+      I2C2->CR1 |= I2C_CR1_START;
+    }
+    else {
+      I2C2->CR1 |= I2C_CR1_STOP;
+      prvI2CMasterEnd(I2C_MASTER_DONE, &reschedNeeded);
+    }
+  }
+
+  TIMELINE_ISR_EXIT(I2C2_EV_IRQn);
+  portEND_SWITCHING_ISR(reschedNeeded);
+}
+
+void I2C2_ER_IRQHandler()
+{
+  portBASE_TYPE reschedNeeded = pdFALSE;
+  uint16_t sr1 = I2C2->SR1;
+
+  // Error flags are cleared by writing 0
+  I2C2->SR1 = ~(sr1 & (I2C_SR1_AF | I2C_SR1_BERR | I2C_SR1_OVR | I2C_SR1_ARLO));
+
+  // Not acknowledged: release the bus. The bus is already released on a
+  // lost arbitration.
+  if (sr1 & (I2C_SR1_AF | I2C_SR1_BERR))
+    I2C2->CR1 |= I2C_CR1_STOP;
+  if (head && (sr1 & (I2C_SR1_AF | I2C_SR1_BERR | I2C_SR1_ARLO)))
+    prvI2CMasterEnd(I2C_MASTER_ERROR, &reschedNeeded);
+
+  portEND_SWITCHING_ISR(reschedNeeded);
+}
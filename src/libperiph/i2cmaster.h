@@ -0,0 +1,63 @@
+#ifndef LIBPERIPH_I2CMASTER_H
+# define LIBPERIPH_I2CMASTER_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "libglobal/flags.h"
+
+// I2C2 master for the on-board sensors (PB10 SCL, PB11 SDA). Fast mode by
+// default, 100 to 400 kHz. Duty cycle is I2C_DutyCycle_2 or
+// I2C_DutyCycle_16_9.
+#define I2C_MASTER_SPEED_HZ     400000
+#define I2C_MASTER_MIN_SPEED_HZ 100000
+#define I2C_MASTER_MAX_SPEED_HZ 400000
+
+// Transfer status
+#define I2C_MASTER_PENDING 0
+#define I2C_MASTER_DONE    1
+#define I2C_MASTER_ERROR   -1 // No acknowledge, bus error or aborted
+
+struct i2c_transfer;
+
+// Called from the I2C2 interrupt when a transfer ends. Must not block.
+typedef void (*pfunI2CMasterDone)(struct i2c_transfer* transfer_);
+
+// Write tx_size bytes (usually a register address) then, after a
+// repeated start, read rx_size bytes. Either size may be 0. Transfers
+// are run in submission order and must stay valid until they end.
+typedef struct i2c_transfer
+{
+  uint8_t address;            // 7-bit
+  const uint8_t* tx;
+  uint8_t tx_size;
+  uint8_t* rx;
+  uint8_t rx_size;
+  volatile int8_t status;
+  flags_t* done;              // Set when the transfer ends, may be NULL
+  uint32_t done_bits;
+  pfunI2CMasterDone callback; // May be NULL
+  struct i2c_transfer* next;  // Queue link, owned by the driver
+} i2c_transfer_t;
+
+void vI2CMasterInit();
+// Applied between two transfers, once the bus is free. From a task.
+void vI2CMasterSetClock(int speed_hz_, uint16_t dutyCycle_);
+
+// Queue a transfer without waiting for it
+void vI2CMasterSubmit(i2c_transfer_t* transfer_);
+// Drop a transfer, running or queued; it ends with I2C_MASTER_ERROR
+void vI2CMasterAbort(i2c_transfer_t* transfer_);
+
+// Queue a transfer and block until it ends; aborted after timeout_.
+// Returns I2C_MASTER_DONE or I2C_MASTER_ERROR.
+int iI2CMasterTransfer(i2c_transfer_t* transfer_, portTickType timeout_);
+
+// Register helpers on top of iI2CMasterTransfer
+int iI2CMasterReadRegs(uint8_t address_, uint8_t reg_, uint8_t* data_,
+                       int size_, portTickType timeout_);
+int iI2CMasterWriteReg(uint8_t address_, uint8_t reg_, uint8_t value_,
+                       portTickType timeout_);
+
+#endif /* LIBPERIPH_I2CMASTER_H */
@@ -0,0 +1,158 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/fault.h"
+#include "libglobal/startup.h"
+#include "libglobal/sysmon.h"
+#include "libperiph/hardware.h"
+#include "libperiph/i2cmaster.h"
+#include "libperiph/imu.h"
+#include "libperiph/timebase.h"
+
+// MPU-6050 registers
+#define IMU_REG_SMPLRT_DIV   0x19
+#define IMU_REG_CONFIG       0x1A
+#define IMU_REG_GYRO_CONFIG  0x1B
+#define IMU_REG_GYRO_ZOUT_H  0x47
+#define IMU_REG_PWR_MGMT_1   0x6B
+#define IMU_REG_WHO_AM_I     0x75
+
+#define IMU_WHO_AM_I         0x68
+#define IMU_PWR_CLK_GYRO_Z   0x03 // PLL on the Z gyro, out of sleep
+#define IMU_DLPF_44HZ        0x03
+#define IMU_GYRO_500DPS      0x08
+
+// 65.5 LSB per deg/s at 500 deg/s full scale
+#define IMU_LSB_PER_DPS_X10  655
+
+// Binary angle per LSB over one microsecond, 24 fractional bits
+#define IMU_ANGLE_PER_LSB_US_Q24 ((int64_t)(4294967296.0 * 16777216 / \
+                                            (1000000.0 * 36 *         \
+                                             IMU_LSB_PER_DPS_X10)))
+// Longest integration step, keeps the product in 64 bits
+#define IMU_STEP_MAX_US 100000
+
+// mrad/s per LSB, 8 fractional bits
+#define IMU_MRAD_PER_LSB_Q8  ((int32_t)(17453.29 * 256 / IMU_LSB_PER_DPS_X10))
+
+#define IMU_TIMEOUT_MS 2
+
+static volatile uint32_t yaw;
+static volatile int32_t rate;
+static volatile uint8_t ready;
+
+static void vImuTask(void* pvParameters_);
+static int iImuConfigure();
+static int iImuReadRate(int16_t* raw_);
+
+void vImuInit(unsigned portBASE_TYPE imuDaemonPriority_)
+{
+  // Create the daemon
+  if (xTaskCreate(vImuTask, (const signed char * const)"imud",
+                  IMU_STACK_SIZE, NULL, imuDaemonPriority_, NULL) != pdPASS)
+    vFaultAllocation("imud");
+}
+
+int iImuIsReady()
+{
+  return ready;
+}
+
+uint32_t uImuGetYaw()
+{
+  return yaw;
+}
+
+int iImuGetRateMrad()
+{
+  return rate;
+}
+
+static int iImuConfigure()
+{
+  const portTickType timeout = MS_TO_TICKS(IMU_TIMEOUT_MS) + 1;
+  uint8_t id;
+
+  if (iI2CMasterReadRegs(IMU_ADDRESS, IMU_REG_WHO_AM_I, &id, 1, timeout) !=
+      I2C_MASTER_DONE || id != IMU_WHO_AM_I)
+    return 0;
+
+  // 1 kHz internal rate with the low pass filter, sampled every period
+  return
+    iI2CMasterWriteReg(IMU_ADDRESS, IMU_REG_PWR_MGMT_1, IMU_PWR_CLK_GYRO_Z,
+                       timeout) == I2C_MASTER_DONE &&
+    iI2CMasterWriteReg(IMU_ADDRESS, IMU_REG_CONFIG, IMU_DLPF_44HZ,
+                       timeout) == I2C_MASTER_DONE &&
+    iI2CMasterWriteReg(IMU_ADDRESS, IMU_REG_SMPLRT_DIV, 0,
+                       timeout) == I2C_MASTER_DONE &&
+    iI2CMasterWriteReg(IMU_ADDRESS, IMU_REG_GYRO_CONFIG, IMU_GYRO_500DPS,
+                       timeout) == I2C_MASTER_DONE;
+}
+
+static int iImuReadRate(int16_t* raw_)
+{
+  uint8_t data[2];
+
+  if (iI2CMasterReadRegs(IMU_ADDRESS, IMU_REG_GYRO_ZOUT_H, data, 2,
+                         MS_TO_TICKS(IMU_TIMEOUT_MS) + 1) != I2C_MASTER_DONE)
+    return 0;
+
+  // Big endian
+  *raw_ = (int16_t)((data[0] << 8) | data[1]);
+  return 1;
+}
+
+static void vImuTask(void* pvParameters_)
+{
+  portTickType time;
+  uint32_t sampled_us, elapsed_us;
+  int32_t bias, sum;
+  int16_t raw;
+  int n;
+
+  vSysmonRegisterTask("imud");
+
+  for (;;)
+  {
+    // Probe and calibrate
+    while (!iImuConfigure())
+      vTaskDelay(MS_TO_TICKS(IMU_RETRY_MS));
+
+    time = xTaskGetTickCount();
+    for (sum = 0, n = 0; n < IMU_CALIBRATION_NB; n++)
+    {
+      vTaskDelayUntil(&time, MS_TO_TICKS(IMU_PERIOD_MS));
+      if (!iImuReadRate(&raw))
+        break;
+      sum += raw;
+    }
+    if (n < IMU_CALIBRATION_NB)
+      continue;
+    // Bias in 1/256 LSB
+    bias = (sum << 8) / IMU_CALIBRATION_NB;
+    sampled_us = xTimeNowUs();
+    ready = 1;
+    vStartupMark(STARTUP_GYRO);
+
+    // Integrate until a read fails, then start over
+    while (ready)
+    {
+      vTaskDelayUntil(&time, MS_TO_TICKS(IMU_PERIOD_MS));
+      if (!iImuReadRate(&raw))
+      {
+        ready = 0;
+        break;
+      }
+      // Over the time actually elapsed since the previous read, a late
+      // wakeup or a slow transfer does not lose angle
+      elapsed_us = xTimeNowUs() - sampled_us;
+      sampled_us += elapsed_us;
+      if (elapsed_us > IMU_STEP_MAX_US)
+        elapsed_us = IMU_STEP_MAX_US;
+      const int32_t value = (raw << 8) - bias;
+      yaw += (uint32_t)(((int64_t)value * elapsed_us * IMU_ANGLE_PER_LSB_US_Q24)
+                        >> 32);
+      rate = ((int64_t)value * IMU_MRAD_PER_LSB_Q8) >> 16;
+    }
+  }
+}
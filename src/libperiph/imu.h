@@ -0,0 +1,41 @@
+#ifndef LIBPERIPH_IMU_H
+# define LIBPERIPH_IMU_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+// MPU-6050 gyro on the I2C2 master, yaw rate sampled at the motors rate
+#define IMU_ADDRESS   0x68
+#define IMU_PERIOD_MS 5
+
+// Bias averaged at start up, the robot must stand still meanwhile
+#define IMU_CALIBRATION_NB 200
+
+// Probe again after this delay while the sensor does not answer
+#define IMU_RETRY_MS 1000
+
+// Daemon stack, in words
+#ifndef IMU_STACK_SIZE
+# define IMU_STACK_SIZE configMINIMAL_STACK_SIZE
+#endif
+
+#ifndef NO_IMU
+void vImuInit(unsigned portBASE_TYPE imuDaemonPriority_);
+
+// 1 once calibrated and while the reads succeed
+int iImuIsReady();
+// Integrated yaw as a binary angle (a full turn is 2^32), counter
+// clockwise; only differences are meaningful
+uint32_t uImuGetYaw();
+// Last yaw rate, mrad/s
+int iImuGetRateMrad();
+#else
+// Built without (--without imu): never ready, the heading from the
+// encoders alone
+static inline int iImuIsReady() { return 0; }
+static inline uint32_t uImuGetYaw() { return 0; }
+static inline int iImuGetRateMrad() { return 0; }
+#endif
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdarg.h>
+
+#include "stm32f10x.h"
+#include "stm32f10x_rcc.h"
+
+#include "libglobal/format.h"
+
+#include "libperiph/cycles.h"
+#include "libperiph/hardware.h"
+#include "libperiph/itm.h"
+
+// Async trace pin, TRACE_MODE 00 (DBGMCU_CR, part of the cycles.h register)
+#define ITM_DBG_TRACE_IOEN   (1 << 5)
+
+// TPIU, not in the CMSIS version shipped here
+#define ITM_TPIU_CSPSR       (*(volatile uint32_t*)0xE0040004)
+#define ITM_TPIU_ACPR        (*(volatile uint32_t*)0xE0040010)
+#define ITM_TPIU_SPPR        (*(volatile uint32_t*)0xE00400F0)
+#define ITM_TPIU_FFCR        (*(volatile uint32_t*)0xE0040304)
+#define ITM_TPIU_SPPR_NRZ    2
+#define ITM_TPIU_FFCR_TRIGIN (1 << 8) // Formatter off, ITM packets only
+
+#define ITM_LAR_KEY          0xC5ACCE55
+#define ITM_TCR_SYNCENA      (1 << 2)
+#define ITM_TCR_DWTENA       (1 << 3)
+#define ITM_TCR_TRACEBUSID   (1 << 16)
+
+// PC sampling off the cycle counter: CYCTAP picks bit 10, POSTPRESET
+// counts taps down to a sample
+#define ITM_DWT_POSTPRESET_SHIFT 1
+#define ITM_DWT_POSTPRESET_MASK  (0xf << ITM_DWT_POSTPRESET_SHIFT)
+#define ITM_DWT_CYCTAP           (1 << 9)
+#define ITM_DWT_PCSAMPLENA       (1 << 12)
+
+typedef struct
+{
+  uint32_t word;
+  int n;
+} itm_line_t;
+
+static volatile uint32_t dropped[ITM_PORTS_NB];
+
+void vItmInit()
+{
+  RCC_ClocksTypeDef clocks;
+
+  RCC_GetClocksFreq(&clocks);
+  // The probe may enable the ports later, the pin and the TPIU are ours
+  vCyclesInit();
+  CYCLES_DBGMCU_CR |= ITM_DBG_TRACE_IOEN;
+  ITM_TPIU_CSPSR = 1;
+  ITM_TPIU_ACPR = clocks.HCLK_Frequency / ITM_SWO_BAUDS - 1;
+  ITM_TPIU_SPPR = ITM_TPIU_SPPR_NRZ;
+  ITM_TPIU_FFCR = ITM_TPIU_FFCR_TRIGIN;
+
+  ITM->LAR = ITM_LAR_KEY;
+  ITM->TCR = ITM_TCR_ITMENA | ITM_TCR_SYNCENA | ITM_TCR_DWTENA |
+    ITM_TCR_TRACEBUSID;
+  ITM->TPR = 0;
+  ITM->TER = (1 << ITM_PORTS_NB) - 1;
+}
+
+// A stimulus port reads 1 when its FIFO takes a write
+RAMFUNC void vItmWrite32(int port_, uint32_t word_)
+{
+  if (!(ITM->TER & (1 << port_)))
+    return;
+  if (ITM->PORT[port_].u32)
+    ITM->PORT[port_].u32 = word_;
+  else
+    dropped[port_]++;
+}
+
+static void prvItmWrite8(int port_, uint8_t byte_)
+{
+  if (!(ITM->TER & (1 << port_)))
+    return;
+  if (ITM->PORT[port_].u32)
+    ITM->PORT[port_].u8 = byte_;
+  else
+    dropped[port_]++;
+}
+
+void vItmWrite(int port_, const char* s_, int size_)
+{
+  for (; size_ >= 4; s_ += 4, size_ -= 4)
+    vItmWrite32(port_, (uint8_t)s_[0] | (uint8_t)s_[1] << 8 |
+                (uint8_t)s_[2] << 16 | (uint32_t)(uint8_t)s_[3] << 24);
+  while (size_--)
+    prvItmWrite8(port_, *s_++);
+}
+
+static void prvItmLinePutc(void* ctx_, char c_)
+{
+  itm_line_t* line = ctx_;
+
+  line->word |= (uint32_t)(uint8_t)c_ << (8 * line->n);
+  if (++line->n == 4)
+  {
+    vItmWrite32(ITM_PORT_LOG, line->word);
+    line->word = 0;
+    line->n = 0;
+  }
+}
+
+void vItmLogf(const char* fmt_, ...)
+{
+  itm_line_t line = { 0, 0 };
+  va_list args;
+
+  va_start(args, fmt_);
+  iFormat(&prvItmLinePutc, &line, fmt_, args);
+  va_end(args);
+  prvItmLinePutc(&line, '\n');
+  for (int i = 0; i < line.n; i++)
+    prvItmWrite8(ITM_PORT_LOG, line.word >> (8 * i));
+}
+
+RAMFUNC void vItmTaskSwitchedIn(void* tag_)
+{
+  vItmWrite32(ITM_PORT_TASKS,
+              (uint32_t)(uintptr_t)tag_ << 24 | (uCyclesNow() & 0xffffff));
+}
+
+void vItmPcSampling(int period_)
+{
+  uint32_t ctrl = CYCLES_DWT_CTRL & ~(ITM_DWT_PCSAMPLENA | ITM_DWT_CYCTAP |
+                                      ITM_DWT_POSTPRESET_MASK);
+
+  // The settings only change with sampling off
+  CYCLES_DWT_CTRL = ctrl;
+  if (period_ <= 0)
+    return;
+  if (period_ > ITM_PC_PERIOD_MAX)
+    period_ = ITM_PC_PERIOD_MAX;
+  ctrl |= ITM_DWT_CYCTAP | (period_ - 1) << ITM_DWT_POSTPRESET_SHIFT;
+  CYCLES_DWT_CTRL = ctrl;
+  CYCLES_DWT_CTRL = ctrl | ITM_DWT_PCSAMPLENA;
+}
+
+uint32_t uItmEnabledPorts()
+{
+  return ITM->TER & ((1 << ITM_PORTS_NB) - 1);
+}
+
+uint32_t uItmDropped(int port_)
+{
+  return dropped[port_];
+}
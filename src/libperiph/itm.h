@@ -0,0 +1,51 @@
+#ifndef LIBPERIPH_ITM_H
+# define LIBPERIPH_ITM_H
+
+#include <stdint.h>
+
+// Instrumentation trace over SWO, with --itm: the ITM stimulus ports,
+// serialized by the TPIU in NRZ at ITM_SWO_BAUDS on PB3 (TRACESWO) and
+// captured by the probe (flash/openocd.cfg), so the diagnostics never
+// share the host link. PB3 is JTDO: the probe must talk SWD, and --spi-link
+// (SCK on PB3) is out.
+#define ITM_SWO_BAUDS 2000000
+
+// One stimulus port per kind of data
+enum eItmPort {
+  ITM_PORT_LOG     = 0, // Text, lines ended by '\n'
+  ITM_PORT_PROFILE = 1, // probe << 24 | cycles, saturated to 24 bits
+  ITM_PORT_TASKS   = 2, // sysmon slot switched in << 24 | cycle counter
+  ITM_PORTS_NB
+};
+
+// Once at boot, before the first write
+void vItmInit();
+
+// Never wait: a port disabled by the probe skips the write, a full FIFO
+// drops it and counts it. A dozen cycles per word, from the tasks and the
+// interrupts alike; the words of a port keep their order per writer only.
+void vItmWrite32(int port_, uint32_t word_);
+// Bytes packed by 4 into words, the tail by 1
+void vItmWrite(int port_, const char* s_, int size_);
+// Text line to ITM_PORT_LOG, iFormat syntax (libglobal/format.h). A
+// line interrupted by a writer of higher priority gets mixed with its own.
+void vItmLogf(const char* fmt_, ...);
+
+// Context switch hook (traceTASK_SWITCHED_IN), tag_ is the sysmon slot
+void vItmTaskSwitchedIn(void* tag_);
+
+// DWT PC sampling: the core PC every period_ x 1024 cycles (1 to 16, 0
+// stops), as hardware packets in the same stream, a zero byte for a core
+// asleep. No code of ours runs for it, the masked sections and the
+// handlers of all priorities get sampled as the rest. At 16 (4.4 kHz),
+// 22 KB/s of the link. "waf pcprofile" symbolizes them against the ELF,
+// the task switches of ITM_PORT_TASKS give the task.
+#define ITM_PC_PERIOD_MAX 16
+void vItmPcSampling(int period_);
+
+// Ports enabled by the probe, as a mask
+uint32_t uItmEnabledPorts();
+// Words dropped on a full FIFO so far
+uint32_t uItmDropped(int port_);
+
+#endif /* LIBPERIPH_ITM_H */
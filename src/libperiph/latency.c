@@ -0,0 +1,249 @@
+#include <string.h>
+
+#include "stm32f10x_exti.h"
+#include "stm32f10x_gpio.h"
+#include "stm32f10x.h"
+#include "misc.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/fault.h"
+#include "libglobal/flags.h"
+#include "libglobal/sysmon.h"
+
+#include "libperiph/adc.h"
+#include "libperiph/cycles.h"
+#include "libperiph/hardware.h"
+#include "libperiph/i2cmaster.h"
+#include "libperiph/imu.h"
+#include "libperiph/latency.h"
+#include "libperiph/link.h"
+#include "libperiph/priorities.h"
+
+#define LATENCY_GPIOx   GPIOC
+#define LATENCY_OUT_Pin GPIO_Pin_10
+#define LATENCY_IN_Pin  GPIO_Pin_9
+
+// Ticks between two edges, 1 to LATENCY_SPREAD
+#define LATENCY_SPREAD  4
+// Without an edge back after it, the sample is missed
+#define LATENCY_TIMEOUT_MS (2 * LATENCY_SPREAD)
+
+// WHO_AM_I of the MPU-6050, harmless to read again and again
+#define LATENCY_I2C_REG 0x75
+
+#define LATENCY_WAKEUP 0x01
+
+#ifndef LATENCY_STACK_SIZE
+# define LATENCY_STACK_SIZE configMINIMAL_STACK_SIZE
+#endif
+
+static const char* const loadNames[LATENCY_LOADS_NB] =
+  { "idle", "uart", "i2c", "adc" };
+
+static flags_t edges;
+static flags_t start;
+static flags_t done;
+static flags_t loadStart;
+
+// Armed by the task, counted down and fired by the tick
+static volatile int countdown;
+static volatile uint32_t edgeCycles;
+static volatile uint32_t isrCycles;
+
+static volatile int load;
+static int samples;
+static latency_result_t* result;
+
+static void vLatencyTask(void* pvParameters_);
+static void vLatencyLoadTask(void* pvParameters_);
+
+void vLatencyInit(unsigned portBASE_TYPE latencyDaemonPriority_)
+{
+  vFlagsInit(&edges);
+  vFlagsInit(&start);
+  vFlagsInit(&done);
+  vFlagsInit(&loadStart);
+
+  vGpioClockInit(LATENCY_GPIOx);
+  RCC_APB2PeriphClockCmd(RCC_APB2Periph_AFIO, ENABLE);
+
+  GPIO_InitTypeDef GPIO_InitStructure =
+    {
+      .GPIO_Pin   = LATENCY_OUT_Pin,
+      .GPIO_Mode  = GPIO_Mode_Out_PP,
+      .GPIO_Speed = GPIO_Speed_50MHz
+    };
+  LATENCY_GPIOx->BRR = LATENCY_OUT_Pin;
+  GPIO_Init(LATENCY_GPIOx, &GPIO_InitStructure);
+
+  // Held low when left unwired
+  GPIO_InitStructure.GPIO_Pin = LATENCY_IN_Pin;
+  GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IPD;
+  GPIO_Init(LATENCY_GPIOx, &GPIO_InitStructure);
+
+  GPIO_EXTILineConfig(GPIO_PortSourceGPIOC, GPIO_PinSource9);
+  EXTI_InitTypeDef EXTI_InitStructure =
+    {
+      .EXTI_Line    = GPIO_TO_EXTI_LINE(LATENCY_IN_Pin),
+      .EXTI_Mode    = EXTI_Mode_Interrupt,
+      .EXTI_Trigger = EXTI_Trigger_Rising,
+      .EXTI_LineCmd = ENABLE
+    };
+  EXTI_Init(&EXTI_InitStructure);
+
+  NVIC_InitTypeDef NVIC_InitStructure =
+    {
+      .NVIC_IRQChannel = EXTI9_5_IRQn,
+      .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_LATENCY,
+      .NVIC_IRQChannelSubPriority = 0,
+      .NVIC_IRQChannelCmd = ENABLE,
+    };
+  NVIC_Init(&NVIC_InitStructure);
+
+  if (xTaskCreate(vLatencyTask, (const signed char * const)"latd",
+                  LATENCY_STACK_SIZE, NULL, latencyDaemonPriority_,
+                  NULL) != pdPASS ||
+      xTaskCreate(vLatencyLoadTask, (const signed char * const)"latload",
+                  LATENCY_STACK_SIZE, NULL, PRIORITY_INTERPRETER,
+                  NULL) != pdPASS)
+    vFaultAllocation("latd");
+}
+
+const char* pcLatencyLoadName(int load_)
+{
+  return loadNames[load_];
+}
+
+void vLatencyTick()
+{
+  if (!countdown || --countdown)
+    return;
+
+  edgeCycles = uCyclesNow();
+  LATENCY_GPIOx->BSRR = LATENCY_OUT_Pin;
+}
+
+void EXTI9_5_IRQHandler()
+{
+  const uint32_t now = uCyclesNow();
+  portBASE_TYPE reschedNeeded = pdFALSE;
+
+  EXTI->PR = GPIO_TO_EXTI_LINE(LATENCY_IN_Pin);
+  isrCycles = now;
+  vFlagsSetFromISR(&edges, LATENCY_WAKEUP, &reschedNeeded);
+  portEND_SWITCHING_ISR(reschedNeeded);
+}
+
+static void prvLatencyAdd(latency_stats_t* stats_, uint32_t cycles_,
+                          uint64_t* total_)
+{
+  const int bin = 31 - __builtin_clz(cycles_ | 1);
+
+  if (cycles_ < stats_->min)
+    stats_->min = cycles_;
+  if (cycles_ > stats_->max)
+    stats_->max = cycles_;
+  *total_ += cycles_;
+  stats_->bins[bin < LATENCY_BINS ? bin : LATENCY_BINS - 1]++;
+}
+
+static void vLatencyTask(void* pvParameters_)
+{
+  uint64_t isrTotal, wakeTotal;
+  uint32_t random, woken;
+  int n;
+
+  vSysmonRegisterTask("latd");
+  random = uCyclesNow() | 1;
+
+  for (;;)
+  {
+    uFlagsWait(&start, LATENCY_WAKEUP, FLAGS_ANY, portMAX_DELAY);
+
+    isrTotal = wakeTotal = 0;
+    result->isr.min = result->wake.min = ~0u;
+    for (int i = 0; i < samples; i++)
+    {
+      // xorshift32, for the ticks to the next edge
+      random ^= random << 13;
+      random ^= random >> 17;
+      random ^= random << 5;
+
+      vFlagsClear(&edges, LATENCY_WAKEUP);
+      countdown = 1 + random % LATENCY_SPREAD;
+      // Blocked before the edge: the handler wakes it for real
+      if (uFlagsWait(&edges, LATENCY_WAKEUP, FLAGS_ANY,
+                     MS_TO_TICKS(LATENCY_TIMEOUT_MS)))
+      {
+        woken = uCyclesNow();
+        prvLatencyAdd(&result->isr, isrCycles - edgeCycles, &isrTotal);
+        prvLatencyAdd(&result->wake, woken - edgeCycles, &wakeTotal);
+        result->samples++;
+      }
+      else
+        result->missed++;
+      countdown = 0;
+      LATENCY_GPIOx->BRR = LATENCY_OUT_Pin;
+    }
+
+    n = result->samples;
+    result->isr.mean = n ? isrTotal / n : 0;
+    result->wake.mean = n ? wakeTotal / n : 0;
+    if (!n)
+      result->isr.min = result->wake.min = 0;
+    vFlagsSet(&done, LATENCY_WAKEUP);
+  }
+}
+
+static void vLatencyLoadTask(void* pvParameters_)
+{
+  static const char flood[] =
+    "UUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUUU";
+  uint8_t reg;
+
+  vSysmonRegisterTask("latload");
+
+  for (;;)
+  {
+    uFlagsWait(&loadStart, LATENCY_WAKEUP, FLAGS_ANY, portMAX_DELAY);
+
+    while (load == LATENCY_UART)
+      vLinkSendMessage(flood, sizeof (flood) - 1);
+    while (load == LATENCY_I2C)
+      iI2CMasterReadRegs(IMU_ADDRESS, LATENCY_I2C_REG, &reg, 1,
+                         MS_TO_TICKS(2) + 1);
+  }
+}
+
+int xLatencyRun(int load_, int samples_, latency_result_t* result_)
+{
+  int rate = 0;
+
+  if (load_ < 0 || load_ >= LATENCY_LOADS_NB)
+    return 0;
+
+  memset(result_, 0, sizeof (*result_));
+  result = result_;
+  samples = samples_;
+
+  if (load_ == LATENCY_ADC)
+  {
+    rate = iAdcGetSampleRate();
+    vAdcSetSampleRate(ADC_MAX_RATE_HZ);
+  }
+  else if (load_ != LATENCY_IDLE)
+  {
+    load = load_;
+    vFlagsSet(&loadStart, LATENCY_WAKEUP);
+  }
+
+  vFlagsSet(&start, LATENCY_WAKEUP);
+  uFlagsWait(&done, LATENCY_WAKEUP, FLAGS_ANY, portMAX_DELAY);
+
+  load = LATENCY_IDLE;
+  if (load_ == LATENCY_ADC)
+    vAdcSetSampleRate(rate);
+  return 1;
+}
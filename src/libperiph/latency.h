@@ -0,0 +1,53 @@
+#ifndef LIBPERIPH_LATENCY_H
+# define LIBPERIPH_LATENCY_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+// Interrupt latency benchmark, with --latency: PC10 wired to PC9. The
+// kernel tick drives an edge on PC10 every 1 to 4 ticks at random, at a
+// known cycle count; it comes back on EXTI9, at IRQ_PRIORITY_LATENCY,
+// whose handler wakes the "latd" task through flags, as the drivers do.
+// The DWT counter times both. The wake up includes the end of the tick
+// interrupt, as for any wake up by a handler it preempts.
+
+// Log2 histogram: bin i for [2^i, 2^(i + 1)) cycles, the last one above
+#define LATENCY_BINS 16
+
+// Load run meanwhile by a task at the interpreter priority
+enum eLatencyLoad {
+  LATENCY_IDLE,
+  LATENCY_UART,  // Link flood: the TX ring kept full, the DMA busy
+  LATENCY_I2C,   // Back to back reads of the gyro on the I2C2 master
+  LATENCY_ADC,   // Sharps sampled at ADC_MAX_RATE_HZ, DMA interrupts
+  LATENCY_LOADS_NB
+};
+
+typedef struct
+{
+  uint32_t min;                  // Cycles
+  uint32_t mean;
+  uint32_t max;
+  uint16_t bins[LATENCY_BINS];
+} latency_stats_t;
+
+typedef struct
+{
+  latency_stats_t isr;           // Edge to the first handler instruction
+  latency_stats_t wake;          // Edge to the task running again
+  uint32_t samples;
+  uint32_t missed;               // No edge back: PC10 not wired to PC9
+} latency_result_t;
+
+void vLatencyInit(unsigned portBASE_TYPE latencyDaemonPriority_);
+// From the kernel tick hook
+void vLatencyTick();
+
+// From a task under latencyDaemonPriority_, blocks for the run: 2.5
+// ticks per sample on average. Returns 0 on a bad load.
+int xLatencyRun(int load_, int samples_, latency_result_t* result_);
+
+const char* pcLatencyLoadName(int load_);
+
+#endif /* LIBPERIPH_LATENCY_H */
@@ -2,23 +2,32 @@
 
 #include "stm32f10x_gpio.h"
 #include "stm32f10x_rcc.h"
-#include "stm32f10x_tim.h"
-#include "task.h"
+#include "libperiph/atomic.h"
 #include "libperiph/hardware.h"
+#include "libperiph/power.h"
 
 # define LEDS_CNT 1
 
+#define LEDS_STEP_TICKS    (LEDS_STEP_MS / portTICK_RATE_MS)
+#define LEDS_FAULT_CODE_MAX 6 // Two steps per blink, a pause left
+
 typedef struct
 {
   GPIO_TypeDef* GPIOx;
   uint16_t GPIO_Pin_x;
 } led_t;
 
-static void prvFlashLEDTask(void* pvParameters_);
-
 static led_t leds[LEDS_CNT] = {{.GPIOx = GPIOA, .GPIO_Pin_x = GPIO_Pin_5}}; // LED_GREEN
 
-void vLedsInit(unsigned portBASE_TYPE ledDaemonPriority_)
+// Written by the tasks and interrupts, read by the tick hook
+static volatile uint16_t faultPattern;
+static volatile uint16_t linkTicks;
+
+static uint16_t bootTicks = LEDS_BOOT_MS / portTICK_RATE_MS;
+static uint16_t stepTicks;
+static uint8_t step;
+
+void vLedsInit()
 {
   for (int i = 0; i < LEDS_CNT; i++) {
     vGpioClockInit(leds[i].GPIOx);
@@ -31,39 +40,57 @@ void vLedsInit(unsigned portBASE_TYPE ledDaemonPriority_)
       };
 
     GPIO_Init(leds[i].GPIOx, &init);
-    GPIO_ResetBits(leds[i].GPIOx, leds[i].GPIO_Pin_x);
   }
 
-  // Create the Led daemon
-  xTaskCreate(prvFlashLEDTask,
-              (signed portCHAR*)"ledsd",
-              configMINIMAL_STACK_SIZE, NULL,
-              ledDaemonPriority_, NULL);
-
+  // On until the scheduler starts
+  vAtomicPinWrite(leds[LED_GREEN].GPIOx, leds[LED_GREEN].GPIO_Pin_x, 1);
 }
 
-static void prvFlashLEDTask(void* pvParameters_)
+static uint16_t prvLedsPattern()
 {
-  for (;;) {
-    vLedToggle(LED_GREEN);
-    vTaskDelay(500 / portTICK_RATE_MS);
-  }
+  if (faultPattern)
+    return faultPattern;
+  if (bootTicks)
+    return LEDS_PATTERN_BOOTING;
+  if (iPowerIsBatteryLow())
+    return LEDS_PATTERN_LOW_BATTERY;
+  if (linkTicks)
+    return LEDS_PATTERN_LINK_UP;
+  return LEDS_PATTERN_IDLE;
 }
 
-void vLedOff(enum eLED led_)
+void vLedsTick()
 {
-  GPIO_ResetBits(leds[led_].GPIOx, leds[led_].GPIO_Pin_x);
+  if (bootTicks)
+    bootTicks--;
+  if (linkTicks)
+    linkTicks--;
+
+  if (++stepTicks < LEDS_STEP_TICKS)
+    return;
+  stepTicks = 0;
+
+  // A BSRR write, no read-modify-write of the port
+  const led_t* led = &leds[LED_GREEN];
+  vAtomicPinWrite(led->GPIOx, led->GPIO_Pin_x,
+                  prvLedsPattern() & (1 << step));
+
+  step = (step + 1) % LEDS_PATTERN_STEPS;
 }
 
-void vLedOn(enum eLED led_)
+void vLedsSetFaultCode(int code_)
 {
-  GPIO_SetBits(leds[led_].GPIOx, leds[led_].GPIO_Pin_x);
+  uint16_t pattern = 0;
+
+  if (code_ > LEDS_FAULT_CODE_MAX)
+    code_ = LEDS_FAULT_CODE_MAX;
+  for (int i = 0; i < code_; i++)
+    pattern |= 1 << (2 * i);
+
+  faultPattern = pattern;
 }
 
-void vLedToggle(enum eLED led_)
+void vLedsLinkActivity()
 {
-  if (GPIO_ReadOutputDataBit(leds[led_].GPIOx, leds[led_].GPIO_Pin_x))
-    vLedOff(led_);
-  else
-    vLedOn(led_);
+  linkTicks = LEDS_LINK_TIMEOUT_MS / portTICK_RATE_MS;
 }
@@ -1,6 +1,8 @@
 #ifndef LIBPERIPH_LEDS_H
 # define LIBPERIPH_LEDS_H
 
+#include <stdint.h>
+
 #include "FreeRTOS.h"
 
 enum eLED {
@@ -8,9 +10,31 @@ enum eLED {
   LED_YELLOW = 1
 };
 
-void vLedsInit(unsigned portBASE_TYPE ledDaemonPriority_);
-void vLedOn(enum eLED led_);
-void vLedOff(enum eLED led_);
-void vLedToggle(enum eLED led_);
+// Status patterns played on the green LED from the kernel tick hook, no
+// task involved. A pattern is one bit per step, LSB first, replayed
+// every LEDS_PATTERN_STEPS steps.
+#define LEDS_STEP_MS       125
+#define LEDS_PATTERN_STEPS 16 // 2 s
+
+#define LEDS_PATTERN_BOOTING     0x5555 // Fast blink
+#define LEDS_PATTERN_IDLE        0x0001 // Heartbeat
+#define LEDS_PATTERN_LINK_UP     0x0F0F // 500 ms blink
+#define LEDS_PATTERN_LOW_BATTERY 0x3333 // Double blink
+
+// Shown after each reset: a reset loop keeps blinking fast
+#define LEDS_BOOT_MS 2000
+// The host link is up while commands come in this often
+#define LEDS_LINK_TIMEOUT_MS 1000
+
+// From highest priority: fault code (see vLedsSetFaultCode), booting,
+// low battery, link up, idle.
+void vLedsInit();
+// From the kernel tick hook
+void vLedsTick();
+
+// Blink the code, 1 to 6, then pause. 0 clears.
+void vLedsSetFaultCode(int code_);
+// From any task or interrupt that gets a command from the host
+void vLedsLinkActivity();
 
 #endif
@@ -0,0 +1,157 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libperiph/link.h"
+
+static const link_t* link;
+static const link_t* stream;
+// Messages given up by xLinkTrySendMessage, from any task: an increment
+// may be lost to a race, it is only a count
+static uint32_t dropped;
+// Task counted by vLinkCountStart, NULL for none
+static volatile xTaskHandle counted;
+static uint32_t countedBytes;
+// Transport of the reserved stream slot, NULL for the buffer
+static const link_t* reserved;
+static uint8_t slotBuffer[LINK_SLOT_SIZE];
+static int slotTimeout;
+
+void vLinkInit(const link_t* link_)
+{
+  link = link_;
+  link->init();
+}
+
+const char* pcLinkName()
+{
+  return link->name;
+}
+
+int xLinkReadAvailable(char* buf_, int size_)
+{
+  return link->read_available(buf_, size_);
+}
+
+static void prvLinkCount(const link_t* link_, int size_)
+{
+  if (counted && link_ == link && counted == xTaskGetCurrentTaskHandle())
+    countedBytes += size_;
+}
+
+void vLinkSendMessage(const char* s_, int size_)
+{
+  link->write(s_, size_);
+  prvLinkCount(link, size_);
+}
+
+static int prvLinkTrySend(const link_t* link_,
+                          int (*try_write_)(const char*, int, int),
+                          const char* s_, int size_, int timeout_ms_)
+{
+  if (timeout_ms_ == LINK_BLOCK || !try_write_)
+  {
+    link_->write(s_, size_);
+    prvLinkCount(link_, size_);
+    return 1;
+  }
+
+  if (try_write_(s_, size_, timeout_ms_))
+  {
+    prvLinkCount(link_, size_);
+    return 1;
+  }
+  dropped++;
+  return 0;
+}
+
+int xLinkTrySendMessage(const char* s_, int size_, int timeout_ms_)
+{
+  return prvLinkTrySend(link, link->try_write, s_, size_, timeout_ms_);
+}
+
+void vLinkSetStream(const link_t* link_)
+{
+  stream = link_;
+  stream->init();
+}
+
+int xLinkTrySendStream(const char* s_, int size_, int timeout_ms_)
+{
+  if (stream)
+    return prvLinkTrySend(stream, stream->try_write, s_, size_, timeout_ms_);
+  // The bulk lane only tries: LINK_BLOCK waits on the main one
+  if (timeout_ms_ == LINK_BLOCK || !link->try_write_bulk)
+    return xLinkTrySendMessage(s_, size_, timeout_ms_);
+  return prvLinkTrySend(link, link->try_write_bulk, s_, size_, timeout_ms_);
+}
+
+int xLinkReserveStream(ring_slot_t* slot_, int size_, int timeout_ms_)
+{
+  const link_t* target = stream ? stream : link;
+
+  if (timeout_ms_ != LINK_BLOCK && target->reserve_stream)
+  {
+    reserved = target;
+    if (target->reserve_stream(slot_, size_, timeout_ms_))
+      return 1;
+    dropped++;
+    return 0;
+  }
+
+  if (size_ > LINK_SLOT_SIZE)
+  {
+    dropped++;
+    return 0;
+  }
+  reserved = NULL;
+  slotTimeout = timeout_ms_;
+  slot_->span[0] = slotBuffer;
+  slot_->size[0] = size_;
+  slot_->size[1] = 0;
+  return 1;
+}
+
+void vLinkCommitStream(int size_)
+{
+  if (!reserved)
+  {
+    xLinkTrySendStream((const char*)slotBuffer, size_, slotTimeout);
+    return;
+  }
+  reserved->commit_stream(size_);
+  prvLinkCount(reserved, size_);
+}
+
+int iLinkStreamBacklog()
+{
+  const link_t* target = stream ? stream : link;
+
+  return target->stream_backlog ? target->stream_backlog() : 0;
+}
+
+uint32_t uLinkDropped()
+{
+  return dropped;
+}
+
+void vLinkFlush()
+{
+  link->flush();
+}
+
+uint32_t uLinkErrors()
+{
+  return link->errors ? link->errors() : 0;
+}
+
+void vLinkCountStart()
+{
+  countedBytes = 0;
+  counted = xTaskGetCurrentTaskHandle();
+}
+
+uint32_t uLinkCountStop()
+{
+  counted = NULL;
+  return countedBytes;
+}
@@ -0,0 +1,100 @@
+#ifndef LIBPERIPH_LINK_H
+# define LIBPERIPH_LINK_H
+
+#include <stdint.h>
+
+#include "libglobal/ring.h"
+
+// Host link: the byte stream under the interpreter, the binary protocol
+// and the telemetry, whatever the transport. The UART is the default,
+// the USB virtual COM port needs --usb-link, the debugger channels
+// --rtt-link.
+typedef struct
+{
+  const char* name;
+  void (*init)();
+  // Block until bytes come in, copy up to size_ of them, return the count
+  int (*read_available)(char* buf_, int size_);
+  // Whole batch under the transport lock, from tasks only
+  void (*write)(const char* s_, int size_);
+  // Whole batch or nothing, within timeout_ms_ (LINK_DROP or more): 1 if
+  // sent. NULL if the transport always blocks.
+  int (*try_write)(const char* s_, int size_, int timeout_ms_);
+  // The same on a lane that gives way to the other writes at each of its
+  // messages, for the streams. NULL if the transport has a single lane.
+  int (*try_write_bulk)(const char* s_, int size_, int timeout_ms_);
+  // In place on the lane of try_write_bulk, or of try_write for a stream
+  // transport: room for a message of size_ bytes within timeout_ms_, 1
+  // if reserved, then published whole by commit_stream. One at a time.
+  // NULL if the transport only copies.
+  int (*reserve_stream)(ring_slot_t* slot_, int size_, int timeout_ms_);
+  void (*commit_stream)(int size_);
+  // Fill of the lane of the stream, in permille of its buffer: the
+  // frames waiting behind the host. NULL if the transport cannot tell.
+  int (*stream_backlog)();
+  // Block until the bytes written went out
+  void (*flush)();
+  // Bytes lost or damaged on the way in so far, NULL if the transport
+  // cannot tell
+  uint32_t (*errors)();
+} link_t;
+
+// Policies of xLinkTrySendMessage, other than a timeout in ms
+#define LINK_BLOCK -1   // Wait for room as long as it takes, as vLinkSendMessage
+#define LINK_DROP   0   // Room right now, or the message is dropped
+
+extern const link_t xUartLink;
+#ifdef USB_LINK
+extern const link_t xUsbCdcLink;
+#endif
+#ifdef RTT_LINK
+extern const link_t xRttLink;
+#endif
+#ifdef TELEMETRY_UART
+extern const link_t xUartTelemetryLink;
+#endif
+#ifdef SDCARD
+// The stream to the card ring, dropped while the card does not log
+extern const link_t xSdLogLink;
+#endif
+
+// Select and initialize the transport, once before the scheduler starts
+void vLinkInit(const link_t* link_);
+const char* pcLinkName();
+
+int xLinkReadAvailable(char* buf_, int size_);
+void vLinkSendMessage(const char* s_, int size_);
+// For the producers that must not wait on the host: the message goes
+// whole or not at all, so the frames stay intact. Returns 1 if sent, else
+// counts it dropped.
+int xLinkTrySendMessage(const char* s_, int size_, int timeout_ms_);
+uint32_t uLinkDropped();
+// The telemetry stream on a transport of its own, one way (write,
+// try_write and flush only), so that it does not delay the replies of
+// the host link: initialized here, once before the scheduler starts.
+// Without it, the stream goes on the host link.
+void vLinkSetStream(const link_t* link_);
+// As xLinkTrySendMessage, on the stream transport, or on the bulk lane of
+// the host link: the replies and the events do not queue behind it
+int xLinkTrySendStream(const char* s_, int size_, int timeout_ms_);
+// The stream written in place, each byte once, in the buffer the
+// transport sends from: room for size_ bytes on the lane of
+// xLinkTrySendStream within timeout_ms_, 1 if reserved, else counted
+// dropped. Filled, then committed whole, one at a time. Without a lane in
+// place (or with LINK_BLOCK), the slot is a buffer of LINK_SLOT_SIZE
+// bytes, sent by the commit.
+#define LINK_SLOT_SIZE 64
+int xLinkReserveStream(ring_slot_t* slot_, int size_, int timeout_ms_);
+void vLinkCommitStream(int size_);
+// Fill of the lane of xLinkTrySendStream, in permille, 0 if the transport
+// cannot tell
+int iLinkStreamBacklog();
+void vLinkFlush();
+uint32_t uLinkErrors();
+// Bytes the calling task sends on the host link from now on, frames and
+// messages, until uLinkCountStop: one task at a time (the interpreter
+// command timing)
+void vLinkCountStart();
+uint32_t uLinkCountStop();
+
+#endif /* LIBPERIPH_LINK_H */
@@ -0,0 +1,33 @@
+#ifndef LIBPERIPH_MCU_H
+# define LIBPERIPH_MCU_H
+
+// Memory of the part, by the StdPeriph device define of "waf configure
+// --mcu" (MCUS in wscript), kept in step with its linker scripts in
+// stm32/. The same package, so the same pins, timers and DMA channels:
+// only the sizes change.
+#define MCU_FLASH_BASE 0x08000000
+#define MCU_RAM_BASE   0x20000000
+
+#if defined(STM32F10X_HD)
+// STM32F103RE
+# define MCU_FLASH_SIZE (512 * 1024)
+# define MCU_PAGE_SIZE  2048
+# define MCU_RAM_SIZE   (64 * 1024)
+#elif defined(STM32F10X_MD)
+// STM32F103R8 of the Olimexino, 128 KB of flash in practice
+# define MCU_FLASH_SIZE (128 * 1024)
+# define MCU_PAGE_SIZE  1024
+# define MCU_RAM_SIZE   (20 * 1024)
+#else
+# error "No memory map for this part, see wscript MCUS"
+#endif
+
+// Past the application, at the end of the flash: the parameters journal
+// (libglobal/params.c), then the black box (libglobal/blackbox.c)
+#define MCU_PARAMS_PAGES   2
+#define MCU_BLACKBOX_PAGES 8
+#define MCU_PARAMS_BASE \
+  (MCU_FLASH_BASE + MCU_FLASH_SIZE - \
+   (MCU_PARAMS_PAGES + MCU_BLACKBOX_PAGES) * MCU_PAGE_SIZE)
+
+#endif /* LIBPERIPH_MCU_H */
@@ -1,25 +1,86 @@
+#include <stdlib.h>
+
 #include "stm32f10x_gpio.h"
 #include "stm32f10x_rcc.h"
 #include "stm32f10x_tim.h"
 #include "stm32f10x.h"
+#include "misc.h"
 
 #include "FreeRTOS.h"
 #include "task.h"
+#include "queue.h"
 #include "semphr.h"
 
+#include "libglobal/actuation.h"
+#include "libglobal/blackbox.h"
+#include "libglobal/fault.h"
+#include "libglobal/fixed.h"
+#include "libglobal/flags.h"
+#include "libglobal/odometry.h"
+#include "libglobal/profile.h"
+#include "libglobal/queues.h"
+#include "libglobal/sysmon.h"
+#include "libglobal/timeline.h"
+#include "libglobal/topics.h"
+#include "libglobal/trig.h"
+
+#if defined(BEMF) || defined(ADC_PWM_SYNC)
+# include "libperiph/adc.h"
+#endif
+#include "libperiph/atomic.h"
+#include "libperiph/cycles.h"
+#include "libperiph/encoders.h"
 #include "libperiph/hardware.h"
+#include "libperiph/imu.h"
 #include "libperiph/motors.h"
+#include "libperiph/power.h"
+#include "libperiph/priorities.h"
+#include "libperiph/resources.h"
+#include "libperiph/timebase.h"
 
-// f = 72MHz / 4 / 1000 = 18 kHz
-#define PERIOD          999  // (-> count from 0 to 999)
-#define DEFAULT_PSC     3    // (-> div clk by 4)
+// Center aligned: f = 72MHz / (2 * 4000) = 9 kHz, 2 counts per command unit
+#define TIMER_HZ        72000000
+#define PWM_PERIOD(HZ)  (TIMER_HZ / (2 * (HZ)) - 1)
+#define PERIOD          PWM_PERIOD(MOTORS_DEFAULT_PWM_HZ) // (-> 0 to 3999)
+#define DEFAULT_PSC     0    // (-> do not div clk)
 #define BEEP_PSC        71   // (-> div clk by 72)
 
-#define OFFSET          (PERIOD / 2)
-#define LIMIT_VAL       100
-#define MAX_DIFF        50
+#define LIMIT_VAL       MOTORS_COMMAND_MAX
+
+// Control loop: one period every so many TIM2 update events, two per PWM
+// period (at the top and the bottom of the count). The speeds, the ramp
+// and the gains keep the units of the nominal period, scaled to the one
+// run.
+#define NOMINAL_US      (MOTORS_PERIOD_MS * 1000)
+#define LOOP_TICK       0x01
+// A setpoint from an interrupt or vSetMotorsCommandNow, run between two
+// periods
+#define LOOP_COMMAND    0x02
+// Without update events (timer stopped), the loop goes on at this rate
+#define LOOP_TIMEOUT    MS_TO_TICKS(2 * MOTORS_PERIOD_MS)
+
+#define MOTORS_EN_PINS  (GPIO_Pin_0 | GPIO_Pin_1)
+#define MOTORS_CC_EN    (TIM_CCER_CC1E | TIM_CCER_CC2E | \
+                         TIM_CCER_CC3E | TIM_CCER_CC4E)
 
-#define COMMAND_TO_PWM(C) ((((C) * OFFSET) / LIMIT_VAL) + OFFSET)
+// PID state fixed point: errors in 1/256 count per period
+#define PID_FRAC        8
+#define PID_SHIFT       (PID_FRAC + 8) // error Q8 times gain Q8
+#define INTEGRAL_MAX    (MOTORS_MAX_SPEED << (PID_FRAC + 4))
+
+// The period and compare values go to the timer by a DMA burst on its
+// update event, ARR to CCR4 through DMAR (RCR between them is reserved on
+// TIM2): the four channels change together at the period boundary. TIM2_UP
+// shares its channel with the SPI1 reception and the USART3 transmission:
+// with the SPI link or the telemetry UART, the CPU writes them while the
+// update event is held.
+#if !defined(SPI_LINK) && !defined(TELEMETRY_UART)
+# define MOTORS_PWM_DMA
+#endif
+
+#define PWM_DMA_CHANNEL DMA1_Channel2
+#define PWM_BURST_NB    6
+#define PWM_BURST_CCR1  2
 
 typedef union{
   struct {
@@ -29,24 +90,693 @@ typedef union{
   uint32_t motors;
 } motors_command_t;
 
+// Published with one aligned 32-bit store (or a 16-bit store of a single
+// wheel) and read with one load, so the task never sees a torn pair
 static volatile motors_command_t targetCommand;
+// Bumped after each publication, tells the task a fresh command arrived
+static volatile uint32_t targetSeq;
+// vMotorsStopNow: the next setpoint taken skips the ramp
+static volatile int stopNow;
+
+// Deadman: ramp to zero without fresh command for this long, 0 disables
+static volatile portTickType commandTimeout;
+
+// Supply feedforward, 0 disables. The gain in SUPPLY_FRAC bits.
+#define SUPPLY_FRAC 12
+#define SUPPLY_ONE  (1 << SUPPLY_FRAC)
+static volatile int nominalMv;
+static int32_t batteryQ;        // MOTORS_SUPPLY_FILTER_SHIFT bits
+static volatile int32_t supplyGain = SUPPLY_ONE;
+
+static pfunMotorsLimit forwardLimit;
 static motors_command_t previousCommand;
 static motors_command_t currentCommand;
+static uint16_t pwmLeft;
+static uint16_t pwmRight;
+static volatile int enabled;
+
+static volatile int drive = MOTORS_DRIVE_ANTIPHASE;
+// Bridges on while enabled, both but in coast mode
+static volatile uint16_t bridges = MOTORS_EN_PINS;
+static volatile uint16_t period = PERIOD;
+
+static flags_t loopFlags;
+static volatile int loopHz = MOTORS_DEFAULT_LOOP_HZ;
+static volatile uint16_t loopDivider;
+static volatile uint32_t loopPeriodUs;
+// Since the previous period, as run by the daemon: the encoders are read
+// at its start
+static uint32_t stepUs = NOMINAL_US;
+// Since the ramp last moved, by a period or a setpoint between two
+static uint32_t slewUs = NOMINAL_US;
+static uint32_t slewLastUs;
+
+#ifdef MOTORS_PWM_DMA
+// Timer blocks, filled in turn: the DMA reads the other one
+static uint16_t pwmBlocks[2][PWM_BURST_NB];
+static int pwmBlock;
+#endif
+
+// Daemon state, published as TOPIC_MOTORS at the end of each period
+static motors_state_t stateSlots[2];
+
+static volatile int cutOff;
+
+static xQueueHandle xMotorsSegmentQueue;
+static queue_stats_t segmentsQueue;
+static volatile int segmentsAbort;
+static int segmentActive;
+static portTickType segmentStart;
+static portTickType segmentTicks;
+
+static void vMotorsRunSegments(portTickType time_);
+
+#ifdef BEMF
+static const adc_channel_t bemfChannels[ENCODERS_NB] =
+  {
+    { .GPIOx = GPIOA, .GPIO_Pin_x = GPIO_Pin_7,
+      .ADC_Channel_x = ADC_Channel_7,
+      .ADC_SampleTime_x = ADC_SampleTime_28Cycles5 },
+    { .GPIOx = GPIOC, .GPIO_Pin_x = GPIO_Pin_5,
+      .ADC_Channel_x = ADC_Channel_15,
+      .ADC_SampleTime_x = ADC_SampleTime_28Cycles5 },
+  };
+
+// Zero tracking while disabled: 1 / 2^BEMF_ZERO_SHIFT of each sample
+#define BEMF_ZERO_SHIFT 3
+
+static volatile int speedSource = MOTORS_SPEED_ENCODERS;
+static volatile int16_t bemfGain = MOTORS_BEMF_DEFAULT_GAIN;
+// Update events from the float to the conversion, for the PWM frequency
+static volatile uint16_t bemfSettleEvents;
+// Events since the float, 0 out of a window. Only the interrupt.
+static uint16_t bemfEvent;
+// Written by the interrupt at the end of each window
+static volatile uint16_t bemfCodes[ENCODERS_NB];
+static volatile uint32_t bemfSeq;
+
+// Daemon state, copied in critical sections
+static motors_bemf_t bemf;
+static uint32_t bemfLastSeq;
+static int32_t bemfZero[ENCODERS_NB];     // Q4 codes
+static int32_t bemfFraction[ENCODERS_NB]; // Odometry counts, Q8
+static uint32_t bemfStallUs[ENCODERS_NB];
+#endif
+
+#ifdef PROFILE
+// Written by the daemon, read in critical sections
+static motors_jitter_t jitter;
+static uint64_t jitterSumUs;
+static volatile int jitterReset = 1;
+
+static void vMotorsRecordPeriod()
+{
+  static uint32_t lastStartUs;
+  const uint32_t now = xTimeNowUs();
+  const uint32_t period_us = now - lastStartUs;
+
+  lastStartUs = now;
+  if (jitterReset)
+  {
+    // No period yet: starts from this loop
+    taskENTER_CRITICAL();
+    jitter.count = 0;
+    jitter.min_us = UINT32_MAX;
+    jitter.mean_us = 0;
+    jitter.max_us = 0;
+    jitterSumUs = 0;
+    jitterReset = 0;
+    taskEXIT_CRITICAL();
+    return;
+  }
+
+  taskENTER_CRITICAL();
+  jitter.count++;
+  if (period_us < jitter.min_us)
+    jitter.min_us = period_us;
+  if (period_us > jitter.max_us)
+    jitter.max_us = period_us;
+  jitterSumUs += period_us;
+  taskEXIT_CRITICAL();
+}
+
+void vMotorsGetJitter(motors_jitter_t* jitter_)
+{
+  taskENTER_CRITICAL();
+  *jitter_ = jitter;
+  if (jitter.count)
+    jitter_->mean_us = jitterSumUs / jitter.count;
+  else
+    jitter_->min_us = 0;
+  taskEXIT_CRITICAL();
+}
+
+void vMotorsResetJitter()
+{
+  jitterReset = 1;
+}
+#endif
+
+typedef struct
+{
+  int32_t integral;
+  int32_t previousError;
+  uint16_t previousCount;
+  int16_t counts;          // Over the period run
+  int32_t speed_q8;        // Per nominal period, PID_FRAC bits
+  int16_t speed;
+  // Last edge taken for the speed, none after a stop or a miss
+  uint32_t edgeCycles;
+  uint16_t edgeCount;
+  uint8_t edgeValid;
+  int32_t edgeSpeed_q8;
+  // Traction control: the output bound, LIMIT_VAL but past a slip
+  int32_t limit;
+  int32_t slipCounts;      // Over the window
+  int32_t slipLast_q8;     // Speed of the window before
+  uint8_t slipRun;
+  uint8_t slipping;
+  uint32_t slipHoldUs;
+  uint32_t slips;
+  // Thermal model: the heat, in command units squared, and the bound it
+  // leaves to the output
+  int32_t heat;
+  int32_t thermal;
+} motor_pid_t;
+
+static volatile int16_t maxDiff = MOTORS_DEFAULT_SLEW;
+
+static volatile int closedLoop;
+static volatile int16_t kp = MOTORS_DEFAULT_KP;
+static volatile int16_t ki = MOTORS_DEFAULT_KI;
+static volatile int16_t kd = MOTORS_DEFAULT_KD;
+static motor_pid_t pid[ENCODERS_NB];
+static int edgesArmed;
+
+// Cross coupling: the error in PID_FRAC bits of counts, the target it
+// integrates against
+static volatile int16_t kc = MOTORS_DEFAULT_KC;
+static int32_t syncQ8;
+static volatile int32_t syncError;
+static uint32_t syncTarget;
+
+static volatile int slipMrad = MOTORS_DEFAULT_SLIP_MRAD;
+static uint32_t slipUs;
+
+static volatile int continuous = MOTORS_DEFAULT_CONTINUOUS;
+static int32_t bridgeHeat;
+// As applied last, through any path, before the linearization
+static motors_command_t appliedCommand;
+
+static volatile motors_linear_t linear[ENCODERS_NB];
+
+static void vMotorsMeasureSpeed(motor_pid_t* pid_, int encoder_);
+static int16_t iMotorsPid(motor_pid_t* pid_, int16_t setpoint_);
 
 static void vMotorsApplyCommands(motors_command_t cmd_);
+static void prvMotorsApplyDuty(motors_command_t cmd_);
 static motors_command_t iMotorsLimitCommands(motors_command_t targ_,
                                              motors_command_t prev_);
+static int16_t iMotorsSlew(int16_t targ_, int16_t prev_);
+static motors_command_t iMotorsLimitForward(motors_command_t cmd_,
+                                            int16_t limit_);
 
-static void vMotorsTask(void* pvParameters_);
+RAMFUNC static void vMotorsTask(void* pvParameters_);
 static void vMotorsReset();
+static void vMotorsUpdateLoop();
+static void vMotorsCommandNow(uint32_t* seq_, portTickType* lastCommand_);
+static int prvMotorsTakeStop();
+static void prvMotorsSlipStep(motors_command_t cmd_, motors_command_t out_);
+static motors_command_t prvMotorsTraction(motors_command_t cmd_);
+static void prvMotorsThermalStep();
+static int32_t prvMotorsOutputBound(const motor_pid_t* pid_);
+
+#ifdef SYSID
+#define SYSID_PRBS_SEED 0x1ff
+
+static motors_sysid_sample_t sysid[MOTORS_SYSID_NB];
+// Set by the interpreter before the length, then owned by the daemon
+// until it clears the length
+static int sysidKind;
+static int16_t sysidAmplitude;
+static int sysidArg;
+static volatile int sysidLength;
+static volatile int sysidCount;
+static volatile int sysidAbort;
+static uint32_t sysidPhase;
+static uint32_t sysidPhaseHz;   // Per Hz and period
+static uint16_t sysidLfsr;
+
+int xMotorsSysidStart(int kind_, int16_t amplitude_, int n_, int arg_)
+{
+  const uint32_t period_us = loopPeriodUs;
+
+#ifdef AUTOTUNE
+  if (iMotorsTuneIsRunning() || iMotorsSweepIsRunning())
+    return 0;
+#endif
+  if (sysidLength || kind_ < MOTORS_SYSID_STEP || kind_ > MOTORS_SYSID_PRBS ||
+      amplitude_ < -LIMIT_VAL || amplitude_ > LIMIT_VAL ||
+      n_ <= 0 || n_ > MOTORS_SYSID_NB || arg_ < 0 ||
+      (kind_ == MOTORS_SYSID_CHIRP && arg_ > 500000 / period_us))
+    return 0;
+
+  sysidKind = kind_;
+  sysidAmplitude = amplitude_;
+  if (!arg_)
+    arg_ = kind_ == MOTORS_SYSID_CHIRP ? MOTORS_SYSID_CHIRP_TO_HZ :
+      MOTORS_SYSID_PRBS_HOLD;
+  sysidArg = arg_;
+  sysidPhase = 0;
+  sysidPhaseHz = ((uint64_t)period_us << 32) / 1000000;
+  sysidLfsr = SYSID_PRBS_SEED;
+  sysidCount = 0;
+  sysidAbort = 0;
+  sysidLength = n_;
+  return 1;
+}
+
+void vMotorsSysidStop()
+{
+  sysidAbort = 1;
+}
+
+int iMotorsSysidIsRunning()
+{
+  return sysidLength != 0;
+}
+
+int iMotorsSysidRead(motors_sysid_sample_t* out_, int first_, int n_)
+{
+  const int count = sysidLength ? 0 : sysidCount;
+  int i;
+
+  for (i = 0; i < n_ && first_ + i < count; i++)
+    out_[i] = sysid[first_ + i];
+  return i;
+}
+
+static int16_t iMotorsSysidCommand(int index_)
+{
+  switch (sysidKind)
+  {
+  case MOTORS_SYSID_CHIRP:
+  {
+    // Linear sweep, the phase advanced by the frequency of this period
+    const uint32_t mhz = MOTORS_SYSID_CHIRP_FROM_HZ * 1000 +
+      (sysidArg - MOTORS_SYSID_CHIRP_FROM_HZ) * 1000 * index_ / sysidLength;
+    const int16_t command = (sysidAmplitude * iTrigSin(sysidPhase)) >> 15;
+
+    sysidPhase += (uint64_t)mhz * sysidPhaseHz / 1000;
+    return command;
+  }
+  case MOTORS_SYSID_PRBS:
+    // x^9 + x^5 + 1, maximal: 511 bits before it repeats
+    if (index_ && !(index_ % sysidArg))
+      sysidLfsr = ((sysidLfsr << 1) |
+                   (((sysidLfsr >> 8) ^ (sysidLfsr >> 4)) & 1)) & 0x1ff;
+    return (sysidLfsr & 1) ? sysidAmplitude : -sysidAmplitude;
+  default:
+    return sysidAmplitude;
+  }
+}
+
+// One period of the run in place of the commands, the ramp starts again
+// from its last one
+static void vMotorsSysidStep()
+{
+  const int index = sysidCount;
+  motors_command_t cmd;
+  motors_sysid_sample_t* sample = &sysid[index];
+
+  // Aborted: stopped at once
+  cmd.motors = 0;
+  if (!sysidAbort)
+    cmd.motor.left = cmd.motor.right = iMotorsSysidCommand(index);
+  vMotorsApplyCommands(cmd);
+  previousCommand = cmd;
+  currentCommand = cmd;
+  if (sysidAbort)
+  {
+    sysidLength = 0;
+    return;
+  }
+
+  sample->command = cmd.motor.left;
+  sample->pwm_left = pwmLeft;
+  sample->speed_left = pid[ENCODER_LEFT].speed;
+  sample->speed_right = pid[ENCODER_RIGHT].speed;
+  sample->current_ma = iPowerGetCurrentMa();
+  sysidCount = index + 1;
+  if (sysidCount == sysidLength)
+    sysidLength = 0;
+}
+#endif
+
+#ifdef AUTOTUNE
+typedef struct
+{
+  uint8_t high;          // Relay output: bias + relay
+  int cycles;            // Rising switches so far
+  uint32_t riseUs;       // Time of the last one
+  int32_t max, min;      // Speed over the current cycle, PID_FRAC bits
+  uint32_t periodUs;     // Sums over the measured cycles
+  int32_t swing;
+} motors_tune_state_t;
+
+// Rules: Kp / Ku, Ti / Tu and Td / Tu, in permille
+static const uint16_t tuneRules[MOTORS_TUNE_RULES_NB][3] =
+  {
+    [MOTORS_TUNE_ZN_PID]       = { 600, 500, 125 },
+    [MOTORS_TUNE_ZN_PI]        = { 450, 833, 0 },
+    [MOTORS_TUNE_TL_PI]        = { 313, 2200, 0 },
+    [MOTORS_TUNE_NO_OVERSHOOT] = { 200, 500, 333 },
+  };
+
+static motors_tune_state_t tune[ENCODERS_NB];
+static motors_tune_wheel_t tuneResult[ENCODERS_NB];
+static int16_t tuneBias;
+static int16_t tuneRelay;
+static uint32_t tuneElapsedUs;
+static volatile int tuneRunning;
+static volatile int tuneAbort;
+static volatile int tuneDone;
+
+int xMotorsTuneStart(int16_t bias_, int16_t relay_)
+{
+  if (tuneRunning || iMotorsSweepIsRunning() || relay_ <= 0 ||
+      bias_ - relay_ < -LIMIT_VAL ||
+      bias_ + relay_ > LIMIT_VAL)
+    return 0;
+#ifdef SYSID
+  if (iMotorsSysidIsRunning())
+    return 0;
+#endif
+  for (int i = 0; i < ENCODERS_NB; i++)
+  {
+    tune[i].high = 1;
+    tune[i].cycles = 0;
+    tune[i].periodUs = 0;
+    tune[i].swing = 0;
+  }
+  tuneBias = bias_;
+  tuneRelay = relay_;
+  tuneElapsedUs = 0;
+  tuneDone = 0;
+  tuneAbort = 0;
+  tuneRunning = 1;
+  return 1;
+}
+
+void vMotorsTuneStop()
+{
+  tuneAbort = 1;
+}
+
+int iMotorsTuneIsRunning()
+{
+  return tuneRunning;
+}
+
+int iMotorsTuneResult(motors_tune_wheel_t* wheels_)
+{
+  if (tuneRunning || !tuneDone)
+    return 0;
+  for (int i = 0; i < ENCODERS_NB; i++)
+    wheels_[i] = tuneResult[i];
+  return 1;
+}
+
+int iMotorsTuneGains(int rule_, int32_t ku_, uint32_t tu_us_,
+                     int16_t* kp_, int16_t* ki_, int16_t* kd_)
+{
+  if (rule_ < 0 || rule_ >= MOTORS_TUNE_RULES_NB || ku_ <= 0 || !tu_us_)
+    return 0;
+
+  const uint16_t* rule = tuneRules[rule_];
+  // Integral and derivative per nominal period, as iMotorsPid() runs them
+  const int64_t kp = (int64_t)ku_ * rule[0] / 1000;
+  const int64_t ki = kp * NOMINAL_US * 1000 / ((int64_t)rule[1] * tu_us_);
+  const int64_t kd = kp * rule[2] * tu_us_ / (1000 * (int64_t)NOMINAL_US);
+
+  if (kp > INT16_MAX || ki > INT16_MAX || kd > INT16_MAX)
+    return 0;
+  *kp_ = kp;
+  *ki_ = ki;
+  *kd_ = kd;
+  return 1;
+}
+
+// Relay of a wheel for this period: true once it measured its cycles
+static int prvMotorsTuneWheel(motors_tune_state_t* tune_, int32_t speed_,
+                              uint32_t now_us_)
+{
+  const int32_t error =
+    ((tuneBias * MOTORS_MAX_SPEED) << PID_FRAC) / LIMIT_VAL - speed_;
+
+  if (speed_ > tune_->max)
+    tune_->max = speed_;
+  if (speed_ < tune_->min)
+    tune_->min = speed_;
+  if (tune_->high && error < -MOTORS_TUNE_HYSTERESIS)
+    tune_->high = 0;
+  else if (!tune_->high && error > MOTORS_TUNE_HYSTERESIS)
+  {
+    // A cycle ends at each rising switch
+    tune_->high = 1;
+    if (tune_->cycles > MOTORS_TUNE_SETTLE_CYCLES &&
+        tune_->cycles <= MOTORS_TUNE_SETTLE_CYCLES + MOTORS_TUNE_CYCLES)
+    {
+      tune_->periodUs += now_us_ - tune_->riseUs;
+      tune_->swing += tune_->max - tune_->min;
+    }
+    tune_->cycles++;
+    tune_->riseUs = now_us_;
+    tune_->max = tune_->min = speed_;
+  }
+  return tune_->cycles > MOTORS_TUNE_SETTLE_CYCLES + MOTORS_TUNE_CYCLES;
+}
+
+static void prvMotorsTuneEnd(int done_)
+{
+  for (int i = 0; done_ && i < ENCODERS_NB; i++)
+  {
+    const motors_tune_state_t* t = &tune[i];
+    const uint32_t amplitude = t->swing / (2 * MOTORS_TUNE_CYCLES);
+    const uint32_t hysteresis = MOTORS_TUNE_HYSTERESIS;
+    // Effective amplitude, from the hysteresis
+    const uint32_t effective = amplitude > hysteresis ?
+      uFixedSqrt(amplitude * amplitude - hysteresis * hysteresis) : 0;
+
+    if (!effective)
+    {
+      done_ = 0;
+      break;
+    }
+    // 4 / pi = 1.2732, the relay in command units, Ku in 1/256
+    tuneResult[i].ku = ((int64_t)tuneRelay * 12732 << (2 * PID_FRAC)) /
+      (10000 * (int64_t)effective);
+    tuneResult[i].tu_us = t->periodUs / MOTORS_TUNE_CYCLES;
+    tuneResult[i].amplitude = amplitude;
+  }
+  tuneDone = done_;
+  tuneRunning = 0;
+}
+
+// One period of the run in place of the commands, the ramp starts again
+// from its last one
+static void vMotorsTuneStep(uint32_t now_us_)
+{
+  motors_command_t cmd;
+  int done = 1;
+
+  cmd.motors = 0;
+  tuneElapsedUs += stepUs;
+  if (tuneAbort || tuneElapsedUs >= MOTORS_TUNE_MAX_MS * 1000)
+    done = -1;
+  else
+  {
+    for (int i = 0; i < ENCODERS_NB; i++)
+      done = prvMotorsTuneWheel(&tune[i], pid[i].speed_q8, now_us_) && done;
+    // The wheel done goes on until the other one is, the robot straight
+    if (!done)
+    {
+      cmd.motor.left = tuneBias + (tune[ENCODER_LEFT].high ? tuneRelay :
+                                   -tuneRelay);
+      cmd.motor.right = tuneBias + (tune[ENCODER_RIGHT].high ? tuneRelay :
+                                    -tuneRelay);
+    }
+  }
+  vMotorsApplyCommands(cmd);
+  previousCommand = cmd;
+  currentCommand = cmd;
+  if (done)
+    prvMotorsTuneEnd(done > 0);
+}
+
+static int sweepLevel;           // Index of the command held
+static uint32_t sweepLevelUs;
+static uint32_t sweepMeasureUs;
+static int32_t sweepCounts[ENCODERS_NB];
+// Per level, PID_FRAC bits of counts per nominal period
+static int32_t sweepSpeeds[ENCODERS_NB][MOTORS_SWEEP_LEVELS];
+static motors_linear_t sweepResult[ENCODERS_NB];
+static volatile int sweepRunning;
+static volatile int sweepAbort;
+static volatile int sweepDone;
+
+int xMotorsSweepStart()
+{
+  if (sweepRunning || tuneRunning)
+    return 0;
+#ifdef SYSID
+  if (iMotorsSysidIsRunning())
+    return 0;
+#endif
+  for (int i = 0; i < ENCODERS_NB; i++)
+    sweepCounts[i] = 0;
+  sweepLevel = 0;
+  sweepLevelUs = 0;
+  sweepMeasureUs = 0;
+  sweepDone = 0;
+  sweepAbort = 0;
+  sweepRunning = 1;
+  return 1;
+}
+
+void vMotorsSweepStop()
+{
+  sweepAbort = 1;
+}
+
+int iMotorsSweepIsRunning()
+{
+  return sweepRunning;
+}
+
+int iMotorsSweepResult(motors_linear_t* linear_)
+{
+  if (sweepRunning || !sweepDone)
+    return 0;
+  for (int i = 0; i < ENCODERS_NB; i++)
+    linear_[i] = sweepResult[i];
+  return 1;
+}
+
+static int32_t prvMotorsSweepCommand(int level_)
+{
+  return (level_ + 1) * LIMIT_VAL / MOTORS_SWEEP_LEVELS;
+}
+
+// Command of the first level at speed_, from the one below
+static int32_t prvMotorsSweepCross(const int32_t* speeds_, int32_t speed_)
+{
+  for (int j = 0; j < MOTORS_SWEEP_LEVELS; j++)
+    if (speeds_[j] >= speed_)
+    {
+      const int32_t v0 = j ? speeds_[j - 1] : 0;
+      const int32_t c0 = j ? prvMotorsSweepCommand(j - 1) : 0;
+      const int32_t c1 = prvMotorsSweepCommand(j);
+
+      if (speeds_[j] <= v0)
+        return c1;
+      return c0 + (c1 - c0) * (speed_ - v0) / (speeds_[j] - v0);
+    }
+  return LIMIT_VAL;
+}
+
+static void prvMotorsSweepEnd(int done_)
+{
+  int32_t top = INT32_MAX;
+
+  for (int i = 0; done_ && i < ENCODERS_NB; i++)
+  {
+    const int32_t full = sweepSpeeds[i][MOTORS_SWEEP_LEVELS - 1];
+
+    if (full < (MOTORS_SWEEP_MIN_SPEED << PID_FRAC))
+      done_ = 0;
+    else if (full < top)
+      top = full;
+  }
+  for (int i = 0; done_ && i < ENCODERS_NB; i++)
+  {
+    const int32_t* speeds = sweepSpeeds[i];
+    motors_linear_t* result = &sweepResult[i];
+    const int32_t moving = speeds[MOTORS_SWEEP_LEVELS - 1] / MOTORS_SWEEP_MOVING;
+    int32_t last = prvMotorsSweepCross(speeds, moving);
+
+    result->deadband = last;
+    for (int k = 1; k < MOTORS_LINEAR_NB; k++)
+    {
+      const int32_t point =
+        prvMotorsSweepCross(speeds, top * k / MOTORS_LINEAR_NB);
+
+      // Never back down, on a noisy level
+      last = point > last ? point : last;
+      result->points[k - 1] = last;
+    }
+  }
+  sweepDone = done_;
+  sweepRunning = 0;
+}
+
+// One period of the run in place of the commands, the ramp starts again
+// from its last one
+static void vMotorsSweepStep()
+{
+  motors_command_t cmd;
+
+  cmd.motors = 0;
+  sweepLevelUs += stepUs;
+  if (sweepLevelUs > MOTORS_SWEEP_SETTLE_MS * 1000)
+  {
+    for (int i = 0; i < ENCODERS_NB; i++)
+      sweepCounts[i] += pid[i].counts;
+    sweepMeasureUs += stepUs;
+  }
+  if (sweepLevelUs >=
+      (MOTORS_SWEEP_SETTLE_MS + MOTORS_SWEEP_MEASURE_MS) * 1000)
+  {
+    for (int i = 0; i < ENCODERS_NB; i++)
+    {
+      sweepSpeeds[i][sweepLevel] =
+        ((int64_t)sweepCounts[i] << PID_FRAC) * NOMINAL_US / sweepMeasureUs;
+      sweepCounts[i] = 0;
+    }
+    sweepLevelUs = 0;
+    sweepMeasureUs = 0;
+    sweepLevel++;
+  }
+
+  if (sweepAbort)
+    prvMotorsSweepEnd(0);
+  else if (sweepLevel == MOTORS_SWEEP_LEVELS)
+    prvMotorsSweepEnd(1);
+  else
+    cmd.motor.left = cmd.motor.right = prvMotorsSweepCommand(sweepLevel);
+  // The thermal model sees it, the bounds do not hold it
+  appliedCommand = cmd;
+  prvMotorsApplyDuty(cmd);
+  previousCommand = cmd;
+  currentCommand = cmd;
+}
+#endif
 
 void vMotorsInit(unsigned portBASE_TYPE motorsDaemonPriority_)
 {
+  // The identity until the parameters come
+  for (int i = 0; i < ENCODERS_NB; i++)
+    for (int k = 1; k < MOTORS_LINEAR_NB; k++)
+      linear[i].points[k - 1] = k * LIMIT_VAL / MOTORS_LINEAR_NB;
+
+  vTopicsInit(TOPIC_MOTORS, "motors", stateSlots, sizeof (motors_state_t));
+
   // Enable GPIOA &  GPIOC clock
   vGpioClockInit(GPIOA);
   vGpioClockInit(GPIOC);
 
   // Enable TIM2 clock
+  xResourceClaim(RESOURCE_TIM2, "motors");
   vTimerClockInit(TIM2);
 
   // Motors PWM: MOTOR1=left, MOTOR2=right ; A and B have opposed polarity
@@ -115,12 +845,51 @@ void vMotorsInit(unsigned portBASE_TYPE motorsDaemonPriority_)
 
   // Enables TIM peripheral Preload register on ARR
   TIM_ARRPreloadConfig(TIM2, ENABLE);
+#ifdef ADC_PWM_SYNC
+  // The update events clock the ADC trigger timer
+  TIM_SelectOutputTrigger(TIM2, TIM_TRGOSource_Update);
+#endif
+
+  // Control loop trigger
+  vFlagsInit(&loopFlags);
+  vMotorsUpdateLoop();
+  TIM_ITConfig(TIM2, TIM_IT_Update, ENABLE);
+  NVIC_InitTypeDef NVIC_InitStructure =
+    {
+      .NVIC_IRQChannel = TIM2_IRQn,
+      .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_MOTORS,
+      .NVIC_IRQChannelSubPriority = 0,
+      .NVIC_IRQChannelCmd = ENABLE,
+    };
+  NVIC_Init(&NVIC_InitStructure);
+
+#ifdef MOTORS_PWM_DMA
+  // One request per register at each update event, half words to DMAR,
+  // the memory side incremented
+  xResourceClaim(RESOURCE_DMA1_CH2, "motors");
+  vDmaClockInit(DMA1);
+  PWM_DMA_CHANNEL->CCR = 0;
+  PWM_DMA_CHANNEL->CPAR = (uint32_t)&TIM2->DMAR;
+  TIM_DMAConfig(TIM2, TIM_DMABase_ARR, TIM_DMABurstLength_6Bytes);
+  TIM_DMACmd(TIM2, TIM_DMA_Update, ENABLE);
+#endif
 
   TIM_Cmd(TIM2, ENABLE); // enable timer
 
+  // Speed feedback
+  vEncodersInit();
+
+  xMotorsSegmentQueue = xQueueCreate(MOTORS_SEGMENTS_NB,
+                                     sizeof (motors_segment_t));
+  if (!xMotorsSegmentQueue)
+    vFaultAllocation("motors");
+  vQueuesRegister(&segmentsQueue, "segments", MOTORS_SEGMENTS_NB);
+
   // Create the daemon
-  xTaskCreate(vMotorsTask, (const signed char * const)"motorsd",
-              configMINIMAL_STACK_SIZE, NULL, motorsDaemonPriority_, NULL);
+  if (xTaskCreate(vMotorsTask, (const signed char * const)"motorsd",
+                  MOTORS_STACK_SIZE, NULL, motorsDaemonPriority_,
+                  NULL) != pdPASS)
+    vFaultAllocation("motorsd");
 }
 
 static void vMotorsReset()
@@ -129,93 +898,1296 @@ static void vMotorsReset()
   vMotorsApplyCommands(previousCommand);
 }
 
+// MOTORS_CC_EN a bit at a time, no read-modify-write of CCER: the ADC
+// watchdog cuts the outputs off at a priority never masked
+static void prvMotorsOutputs(int on_)
+{
+  for (int i = 0; i < 4; i++)
+    vAtomicBitWrite(&TIM2->CCER, ATOMIC_BIT(TIM_CCER_CC1E) + 4 * i, on_);
+}
+
 void vMotorsEnable()
 {
   // We first stop the motors
   vMotorsReset();
-  GPIO_SetBits(GPIOC, GPIO_Pin_0);
-  GPIO_SetBits(GPIOC, GPIO_Pin_1);
+
+  // Restore the PWM outputs after a cut off
+  cutOff = 0;
+  prvMotorsOutputs(1);
+  bridges = MOTORS_EN_PINS;
+  vAtomicPinWrite(GPIOC, MOTORS_EN_PINS, 1);
+  enabled = 1;
+
+  // One meanwhile, then undone by the writes above: again
+  if (cutOff)
+    vMotorsCutOff();
 }
 
 void vMotorsDisable()
 {
-  GPIO_ResetBits(GPIOC, GPIO_Pin_0);
-  GPIO_ResetBits(GPIOC, GPIO_Pin_1);
+  // Cleared first: the daemon, coasting, sets the pins only while enabled
+  enabled = 0;
+  vAtomicPinWrite(GPIOC, MOTORS_EN_PINS, 0);
 }
 
-static void vMotorsApplyCommands(motors_command_t cmd_)
+void vMotorsCutOff()
 {
-  const int PWML = COMMAND_TO_PWM(cmd_.motor.left);
-  const int PWMR = COMMAND_TO_PWM(cmd_.motor.right);
+  // Bridges disabled and both inputs low: the motors freewheel
+  GPIOC->BRR = MOTORS_EN_PINS;
+  prvMotorsOutputs(0);
+  cutOff = 1;
+}
 
-  // Here we disable interrupts to ensure that the same command will
-  // be applied to the two motors at the same time. Moreover for a
-  // single motor we want the PWMs to be fully synchronized.
-  portDISABLE_INTERRUPTS();
-  TIM_SetCompare1(TIM2, PWML);
-  TIM_SetCompare2(TIM2, PWML);
-  TIM_SetCompare3(TIM2, PWMR);
-  TIM_SetCompare4(TIM2, PWMR);
-  portENABLE_INTERRUPTS();
+int iMotorsIsCutOff()
+{
+  return cutOff;
 }
 
-uint16_t uGetMotorLeftCommand()
+// Compare values of legs A and B for a command. B has the opposed
+// polarity: its output is high from the compare value up, never above
+// the period.
+static void vMotorsCompare(int16_t command_, int drive_, uint16_t period_,
+                           uint16_t* ccr_)
 {
-  return currentCommand.motor.left;
+  const int32_t duty = (abs(command_) * period_) / LIMIT_VAL;
+
+  if (drive_ == MOTORS_DRIVE_ANTIPHASE)
+  {
+    ccr_[0] = ((command_ * (period_ / 2)) / LIMIT_VAL) + period_ / 2;
+    ccr_[1] = ccr_[0];
+    return;
+  }
+  ccr_[0] = command_ > 0 ? duty : 0;
+  ccr_[1] = command_ < 0 ? period_ - duty : period_ + 1;
 }
 
-uint16_t uGetMotorRightCommand()
+// Bridges of on_ enabled, the others off. A cut off or a disable in
+// between wins: the pins are cleared again after them. During a back-EMF
+// window, the end of the window sets them.
+static void vMotorsBridges(uint16_t on_)
 {
-  return currentCommand.motor.right;
+#ifdef BEMF
+  taskENTER_CRITICAL();
+#endif
+  bridges = on_;
+  GPIOC->BRR = MOTORS_EN_PINS & ~on_;
+#ifdef BEMF
+  if (bemfEvent)
+    on_ = 0;
+#endif
+  if (enabled && !cutOff && on_)
+  {
+    GPIOC->BSRR = on_;
+    if (!enabled || cutOff)
+      GPIOC->BRR = MOTORS_EN_PINS;
+  }
+#ifdef BEMF
+  taskEXIT_CRITICAL();
+#endif
 }
 
-void vSetMotorsCommand(int16_t left_, int16_t right_)
+void vMotorsSetLinear(int encoder_, const motors_linear_t* linear_)
 {
-  targetCommand.motor.left = left_;
-  targetCommand.motor.right = right_;
+  linear[encoder_] = *linear_;
 }
 
-void vSetMotorLeftCommand(int16_t left_)
+void vMotorsGetLinear(int encoder_, motors_linear_t* linear_)
 {
-  targetCommand.motor.left = left_;
+  *linear_ = linear[encoder_];
 }
 
-void vSetMotorRightCommand(int16_t right_)
+// The command asked to the one of the bridge, on the line of its step
+static int16_t prvMotorsLinearize(int encoder_, int16_t command_)
 {
-  targetCommand.motor.right = right_;
+  const volatile motors_linear_t* lin = &linear[encoder_];
+  const int32_t step = LIMIT_VAL / MOTORS_LINEAR_NB;
+  const int32_t x = abs(command_);
+  const int k = x / step;
+  int32_t y0, y1, y;
+
+  if (!x || k >= MOTORS_LINEAR_NB)
+    return command_;
+  y0 = k ? lin->points[k - 1] : lin->deadband;
+  y1 = k < MOTORS_LINEAR_NB - 1 ? lin->points[k] : LIMIT_VAL;
+  y = y0 + (y1 - y0) * (x - k * step) / step;
+  return command_ < 0 ? -y : y;
 }
 
-static motors_command_t iMotorsLimitCommands(motors_command_t targ_,
-                                             motors_command_t prev_)
+// Command to duty, through the supply gain
+static int16_t prvMotorsSupply(int16_t command_, int32_t gain_)
 {
-  motors_command_t cmd;
+  const int32_t scaled = (command_ * gain_) >> SUPPLY_FRAC;
 
-  // Limit left motor command
-  if (targ_.motor.left < -LIMIT_VAL || targ_.motor.left > LIMIT_VAL)
-    cmd.motor.left = prev_.motor.left;
-  else
-    cmd.motor.left = targ_.motor.left;
+  if (scaled > LIMIT_VAL)
+    return LIMIT_VAL;
+  if (scaled < -LIMIT_VAL)
+    return -LIMIT_VAL;
+  return scaled;
+}
 
-  // Limit right motor command
-  if (targ_.motor.right < -LIMIT_VAL || targ_.motor.right > LIMIT_VAL)
-    cmd.motor.right = prev_.motor.right;
-  else
-    cmd.motor.right = targ_.motor.right;
+// Through the linearization
+static void vMotorsApplyCommands(motors_command_t cmd_)
+{
+  appliedCommand = cmd_;
+  cmd_.motor.left = prvMotorsLinearize(ENCODER_LEFT, cmd_.motor.left);
+  cmd_.motor.right = prvMotorsLinearize(ENCODER_RIGHT, cmd_.motor.right);
+  prvMotorsApplyDuty(cmd_);
+}
 
-  return cmd;
+static void prvMotorsApplyDuty(motors_command_t cmd_)
+{
+  const int mode = drive;
+  const uint16_t arr = period;
+  const int32_t gain = supplyGain;
+  uint16_t ccr[4];
+
+  vMotorsCompare(prvMotorsSupply(cmd_.motor.left, gain), mode, arr, &ccr[0]);
+  vMotorsCompare(prvMotorsSupply(cmd_.motor.right, gain), mode, arr, &ccr[2]);
+
+  // The same command must reach the two motors at the same time, and for
+  // a single motor both PWMs must stay synchronized: the period and the
+  // four compare values are loaded at one update event, without masking
+  // interrupts.
+#ifdef MOTORS_PWM_DMA
+  uint16_t* block = pwmBlocks[pwmBlock];
+
+  pwmBlock ^= 1;
+  block[0] = arr;
+  block[1] = 0;
+  for (int i = 0; i < 4; i++)
+    block[PWM_BURST_CCR1 + i] = ccr[i];
+
+  // A burst under way lasts a few bus cycles, let it end. One still
+  // waiting for its update event is replaced.
+  while (PWM_DMA_CHANNEL->CNDTR &&
+         PWM_DMA_CHANNEL->CNDTR < PWM_BURST_NB);
+  PWM_DMA_CHANNEL->CCR = 0;
+  PWM_DMA_CHANNEL->CMAR = (uint32_t)block;
+  PWM_DMA_CHANNEL->CNDTR = PWM_BURST_NB;
+  PWM_DMA_CHANNEL->CCR = DMA_CCR2_MSIZE_0 | DMA_CCR2_PSIZE_0 |
+    DMA_CCR2_MINC | DMA_CCR2_DIR | DMA_CCR2_PL_1 | DMA_CCR2_EN;
+#else
+  // The preload registers only reach the timer at an update event: none
+  // until the five are written
+  vAtomicBitWrite(&TIM2->CR1, ATOMIC_BIT(TIM_CR1_UDIS), 1);
+  TIM_SetAutoreload(TIM2, arr);
+  TIM_SetCompare1(TIM2, ccr[0]);
+  TIM_SetCompare2(TIM2, ccr[1]);
+  TIM_SetCompare3(TIM2, ccr[2]);
+  TIM_SetCompare4(TIM2, ccr[3]);
+  vAtomicBitWrite(&TIM2->CR1, ATOMIC_BIT(TIM_CR1_UDIS), 0);
+#endif
+
+  // Coasting: the bridge of a motor at zero is off
+  if (mode == MOTORS_DRIVE_COAST)
+    vMotorsBridges((cmd_.motor.left ? GPIO_Pin_0 : 0) |
+                   (cmd_.motor.right ? GPIO_Pin_1 : 0));
+
+  pwmLeft = ccr[0];
+  pwmRight = ccr[2];
 }
 
-static void vMotorsTask(void* pvParameters_)
+void vMotorsSetDrive(int drive_)
 {
-  portTickType time = xTaskGetTickCount();
+  const int was = drive;
 
-  for (;;)
+  drive = drive_;
+  // Both bridges back on, the daemon applies the new drive
+  if (was == MOTORS_DRIVE_COAST && drive_ != MOTORS_DRIVE_COAST)
+    vMotorsBridges(MOTORS_EN_PINS);
+}
+
+void vMotorsSetPwmFrequency(int hz_)
+{
+  if (hz_ < MOTORS_MIN_PWM_HZ)
+    hz_ = MOTORS_MIN_PWM_HZ;
+  else if (hz_ > MOTORS_MAX_PWM_HZ)
+    hz_ = MOTORS_MAX_PWM_HZ;
+  period = PWM_PERIOD(hz_);
+  vMotorsUpdateLoop();
+}
+
+// Update events per loop period, the nearest to the rate asked
+static void vMotorsUpdateLoop()
+{
+  const uint32_t events_hz = TIMER_HZ / (period + 1);
+  const int hz = loopHz;
+  uint32_t divider = (events_hz + hz / 2) / hz;
+
+  if (!divider)
+    divider = 1;
+  loopDivider = divider;
+  loopPeriodUs = divider * (period + 1) / (TIMER_HZ / 1000000);
+#ifdef ADC_PWM_SYNC
+  vAdcSetPwmEvents(events_hz);
+#endif
+#ifdef BEMF
+  bemfSettleEvents = (MOTORS_BEMF_SETTLE_US * (events_hz / 1000) + 999) / 1000;
+  if (!bemfSettleEvents)
+    bemfSettleEvents = 1;
+#endif
+}
+
+void vMotorsSetLoopRate(int hz_)
+{
+  if (hz_ < MOTORS_MIN_LOOP_HZ)
+    hz_ = MOTORS_MIN_LOOP_HZ;
+  else if (hz_ > MOTORS_MAX_LOOP_HZ)
+    hz_ = MOTORS_MAX_LOOP_HZ;
+  loopHz = hz_;
+  vMotorsUpdateLoop();
+}
+
+int iMotorsGetLoopPeriodUs()
+{
+  return loopPeriodUs;
+}
+
+#ifdef BEMF
+// Window step, at each update event from the float: the conversion once
+// settled, then at the next one the codes and the bridges back
+RAMFUNC static void prvMotorsBemfStep()
+{
+  const uint16_t k = bemfEvent++;
+  uint16_t left, right;
+
+  if (k == bemfSettleEvents)
   {
-    // Sample the value at this moment:
-    currentCommand = iMotorsLimitCommands(targetCommand, previousCommand);
-    vMotorsApplyCommands(currentCommand);
+    vAdcInjectedStart();
+    return;
+  }
+  if (k < bemfSettleEvents)
+    return;
+
+  vAdcInjectedRead(&left, &right);
+  bemfCodes[ENCODER_LEFT] = left;
+  bemfCodes[ENCODER_RIGHT] = right;
+  bemfSeq++;
+  bemfEvent = 0;
+  if (enabled && !cutOff)
+  {
+    GPIOC->BSRR = bridges;
+    if (!enabled || cutOff)
+      GPIOC->BRR = MOTORS_EN_PINS;
+  }
+}
+#endif
+
+// At each update event: the daemon runs a period every loopDivider
+RAMFUNC void TIM2_IRQHandler()
+{
+  static uint16_t events;
+  portBASE_TYPE reschedNeeded = pdFALSE;
+  PROFILE_BEGIN(PROFILE_TIM2_IRQ);
 
-    vTaskDelayUntil(&time, 5 / portTICK_RATE_MS);
+  TIM2->SR = (uint16_t)~TIM_SR_UIF;
+  ACTUATION_UPDATE();
+  ++events;
+#ifdef BEMF
+  // The window ends on the update event of the loop period
+  if (bemfEvent)
+    prvMotorsBemfStep();
+  else if (speedSource == MOTORS_SPEED_BEMF &&
+           events + bemfSettleEvents + 1 == loopDivider)
+  {
+    GPIOC->BRR = MOTORS_EN_PINS;
+    bemfEvent = 1;
+  }
+#endif
+  if (events < loopDivider)
+  {
+    PROFILE_END(PROFILE_TIM2_IRQ);
+    return;
   }
+  TIMELINE_ISR_ENTER(TIM2_IRQn);
+  events = 0;
+  vFlagsSetFromISR(&loopFlags, LOOP_TICK, &reschedNeeded);
+  TIMELINE_ISR_EXIT(TIM2_IRQn);
+  PROFILE_END(PROFILE_TIM2_IRQ);
+  portEND_SWITCHING_ISR(reschedNeeded);
+}
+
+void vMotorsGetState(motors_state_t* state_)
+{
+  uTopicsRead(TOPIC_MOTORS, state_);
+}
+
+void vSetMotorsCommand(int16_t left_, int16_t right_)
+{
+  motors_command_t cmd;
+
+  cmd.motor.left = left_;
+  cmd.motor.right = right_;
+  targetCommand.motors = cmd.motors;
+  targetSeq++;
+}
+
+void vMotorsCommandFromISR(portBASE_TYPE* woken_)
+{
+  vFlagsSetFromISR(&loopFlags, LOOP_COMMAND, woken_);
+}
+
+void vSetMotorsCommandNow(int16_t left_, int16_t right_)
+{
+  vSetMotorsCommand(left_, right_);
+  vFlagsSet(&loopFlags, LOOP_COMMAND);
+}
+
+void vMotorsStopNow()
+{
+  vMotorsClearSegments();
+#ifdef SYSID
+  vMotorsSysidStop();
+#endif
+#ifdef AUTOTUNE
+  vMotorsTuneStop();
+  vMotorsSweepStop();
+#endif
+  targetCommand.motors = 0;
+  stopNow = 1;
+  targetSeq++;
+  vFlagsSet(&loopFlags, LOOP_COMMAND);
+}
+
+void vSetMotorsVelocity(int16_t v_mm_s_, int16_t omega_mrad_s_)
+{
+  const int32_t turn = (int32_t)omega_mrad_s_ * ODOMETRY_TRACK_MM / 2000;
+  int32_t left = v_mm_s_ - turn;
+  int32_t right = v_mm_s_ + turn;
+  const int32_t fastest = abs(left) > abs(right) ? abs(left) : abs(right);
+
+  if (fastest > MOTORS_MAX_SPEED_MM_S)
+  {
+    left = left * MOTORS_MAX_SPEED_MM_S / fastest;
+    right = right * MOTORS_MAX_SPEED_MM_S / fastest;
+  }
+  vSetMotorsCommand(left * LIMIT_VAL / MOTORS_MAX_SPEED_MM_S,
+                    right * LIMIT_VAL / MOTORS_MAX_SPEED_MM_S);
+}
+
+void vSetMotorLeftCommand(int16_t left_)
+{
+  targetCommand.motor.left = left_;
+  targetSeq++;
+}
+
+void vSetMotorRightCommand(int16_t right_)
+{
+  targetCommand.motor.right = right_;
+  targetSeq++;
+}
+
+static motors_command_t iMotorsLimitCommands(motors_command_t targ_,
+                                             motors_command_t prev_)
+{
+  motors_command_t cmd;
+
+  // Limit left motor command
+  if (targ_.motor.left < -LIMIT_VAL || targ_.motor.left > LIMIT_VAL)
+    cmd.motor.left = prev_.motor.left;
+  else
+    cmd.motor.left = targ_.motor.left;
+
+  // Limit right motor command
+  if (targ_.motor.right < -LIMIT_VAL || targ_.motor.right > LIMIT_VAL)
+    cmd.motor.right = prev_.motor.right;
+  else
+    cmd.motor.right = targ_.motor.right;
+
+  // Ramp toward the target
+  cmd.motor.left = iMotorsSlew(cmd.motor.left, prev_.motor.left);
+  cmd.motor.right = iMotorsSlew(cmd.motor.right, prev_.motor.right);
+
+  return cmd;
+}
+
+static void vMotorsSlewStep()
+{
+  const uint32_t now_us = xTimeNowUs();
+
+  slewUs = now_us != slewLastUs ? now_us - slewLastUs : 1;
+  slewLastUs = now_us;
+}
+
+static int16_t iMotorsSlew(int16_t targ_, int16_t prev_)
+{
+  int32_t diff = maxDiff;
+
+  if (!diff)
+    return targ_;
+  diff = diff * slewUs / NOMINAL_US;
+  if (!diff)
+    diff = 1;
+  if (targ_ > prev_ + diff)
+    return prev_ + diff;
+  if (targ_ < prev_ - diff)
+    return prev_ - diff;
+  return targ_;
+}
+
+void vMotorsSetCommandTimeout(int timeout_ms_)
+{
+  commandTimeout = MS_TO_TICKS(timeout_ms_);
+}
+
+int iMotorsQueueSegments(const motors_segment_t* segments_, int n_)
+{
+  int i;
+
+  for (i = 0; i < n_; i++)
+    if (xQueueSend(xMotorsSegmentQueue, &segments_[i], 0) != pdTRUE)
+      break;
+  // Refused, left to the caller to send again
+  vQueuesDrop(&segmentsQueue, n_ - i);
+  vQueuesLevel(&segmentsQueue, uxQueueMessagesWaiting(xMotorsSegmentQueue));
+  return i;
+}
+
+void vMotorsClearSegments()
+{
+  motors_segment_t segment;
+
+  while (xQueueReceive(xMotorsSegmentQueue, &segment, 0) == pdTRUE);
+  segmentsAbort = 1;
+}
+
+static void vMotorsRunSegments(portTickType time_)
+{
+  motors_segment_t segment;
+
+  if (segmentsAbort)
+  {
+    segmentsAbort = 0;
+    if (segmentActive)
+    {
+      segmentActive = 0;
+      vSetMotorsCommand(0, 0);
+    }
+  }
+
+  if (segmentActive)
+  {
+    if (time_ - segmentStart < segmentTicks)
+      return;
+    // Chain from the planned end, not from now, to keep the timing
+    segmentStart += segmentTicks;
+  }
+  else
+    segmentStart = time_;
+
+  if (xQueueReceive(xMotorsSegmentQueue, &segment, 0) == pdTRUE)
+  {
+    segmentActive = 1;
+    segmentTicks = MS_TO_TICKS(segment.duration_ms);
+    vSetMotorsCommand(segment.left, segment.right);
+  }
+  else if (segmentActive)
+  {
+    segmentActive = 0;
+    vSetMotorsCommand(0, 0);
+  }
+}
+
+void vMotorsSetForwardLimit(pfunMotorsLimit limit_)
+{
+  forwardLimit = limit_;
+}
+
+// Clamp the mean of both wheels, keep their difference (the turn)
+static motors_command_t iMotorsLimitForward(motors_command_t cmd_,
+                                            int16_t limit_)
+{
+  const int forward = (cmd_.motor.left + cmd_.motor.right) / 2;
+  const int turn = (cmd_.motor.right - cmd_.motor.left) / 2;
+
+  if (forward > limit_)
+  {
+    cmd_.motor.left = limit_ - turn;
+    cmd_.motor.right = limit_ + turn;
+  }
+  return cmd_;
+}
+
+void vMotorsSetSlewRate(int16_t max_diff_)
+{
+  maxDiff = max_diff_ < 0 ? 0 : max_diff_;
+}
+
+void vMotorsSetClosedLoop(int enable_)
+{
+  closedLoop = enable_;
+}
+
+void vMotorsSetNominalMv(int nominal_mv_)
+{
+  nominalMv = nominal_mv_ < 0 ? 0 : nominal_mv_;
+}
+
+int iMotorsGetNominalMv()
+{
+  return nominalMv;
+}
+
+int iMotorsGetSupplyGain()
+{
+  return (supplyGain * 1000 + SUPPLY_ONE / 2) >> SUPPLY_FRAC;
+}
+
+// Gain of the next commands, from the filtered battery voltage
+static void prvMotorsSupplyStep()
+{
+  const int nominal = nominalMv;
+  const int battery_mv = iPowerGetBatteryMv();
+  int32_t gain = SUPPLY_ONE;
+  int filtered_mv;
+
+  if (!batteryQ)
+    batteryQ = battery_mv << MOTORS_SUPPLY_FILTER_SHIFT;
+  else
+    batteryQ += battery_mv - (batteryQ >> MOTORS_SUPPLY_FILTER_SHIFT);
+  filtered_mv = batteryQ >> MOTORS_SUPPLY_FILTER_SHIFT;
+
+  if (nominal && filtered_mv > POWER_NO_BATTERY_MV)
+  {
+    gain = (nominal << SUPPLY_FRAC) / filtered_mv;
+    if (gain < MOTORS_SUPPLY_GAIN_MIN * SUPPLY_ONE / 1000)
+      gain = MOTORS_SUPPLY_GAIN_MIN * SUPPLY_ONE / 1000;
+    else if (gain > MOTORS_SUPPLY_GAIN_MAX * SUPPLY_ONE / 1000)
+      gain = MOTORS_SUPPLY_GAIN_MAX * SUPPLY_ONE / 1000;
+  }
+  supplyGain = gain;
+}
+
+void vMotorsSetPid(int16_t kp_, int16_t ki_, int16_t kd_)
+{
+  kp = kp_;
+  ki = ki_;
+  kd = kd_;
+}
+
+void vMotorsSetCrossCoupling(int16_t kc_)
+{
+  kc = kc_ < 0 ? 0 : kc_;
+}
+
+int16_t iMotorsGetCrossCoupling()
+{
+  return kc;
+}
+
+int iMotorsGetSyncError()
+{
+  return (syncError + (1 << (PID_FRAC - 1))) >> PID_FRAC;
+}
+
+#define NOMINAL_CYCLES  (NOMINAL_US * CYCLES_PER_US)
+#define EDGE_TIMEOUT    (MOTORS_EDGE_TIMEOUT_MS * 1000 * CYCLES_PER_US)
+
+// Speed from the edges: the counts from the last edge of a former period
+// to the last one of this, over their time. Without an edge, no faster
+// than one more edge now. The counts speed while there is no edge to
+// start from.
+static int32_t prvMotorsEdgeSpeed(motor_pid_t* pid_, int encoder_,
+                                  uint16_t count_, int32_t counts_q8_)
+{
+  const int step = encoder_ == ENCODER_LEFT ? ENCODERS_LEFT_EDGE_COUNTS
+                                            : ENCODERS_RIGHT_EDGE_COUNTS;
+  const uint32_t now = uCyclesNow();
+  encoder_edge_t edge;
+  uint32_t elapsed;
+
+  vEncodersGetEdge(encoder_, &edge);
+  // Moved past the last edge by more than a line: edges were missed
+  // (armed late, or no capture), start again from the next one
+  if (abs((int16_t)(count_ - edge.count)) >= 2 * step)
+  {
+    pid_->edgeValid = 0;
+    return counts_q8_;
+  }
+
+  if (edge.cycles != pid_->edgeCycles)
+  {
+    elapsed = edge.cycles - pid_->edgeCycles;
+    if (pid_->edgeValid && elapsed < EDGE_TIMEOUT)
+      pid_->edgeSpeed_q8 = (((int64_t)(int16_t)(edge.count - pid_->edgeCount)
+                             << PID_FRAC) * NOMINAL_CYCLES) / elapsed;
+    else
+      pid_->edgeSpeed_q8 = counts_q8_;
+    pid_->edgeCycles = edge.cycles;
+    pid_->edgeCount = edge.count;
+    pid_->edgeValid = 1;
+    return pid_->edgeSpeed_q8;
+  }
+
+  if (!pid_->edgeValid)
+    return counts_q8_;
+  elapsed = now - edge.cycles;
+  if (!elapsed)
+    return pid_->edgeSpeed_q8;
+  if (elapsed >= EDGE_TIMEOUT)
+  {
+    pid_->edgeValid = 0;
+    pid_->edgeSpeed_q8 = 0;
+    return 0;
+  }
+  const int32_t bound = (((int64_t)step << PID_FRAC) * NOMINAL_CYCLES) /
+    elapsed;
+  if (pid_->edgeSpeed_q8 > bound)
+    pid_->edgeSpeed_q8 = bound;
+  else if (pid_->edgeSpeed_q8 < -bound)
+    pid_->edgeSpeed_q8 = -bound;
+  return pid_->edgeSpeed_q8;
+}
+
+static void vMotorsMeasureSpeed(motor_pid_t* pid_, int encoder_)
+{
+  const uint16_t count = uEncodersGetCount(encoder_);
+  int32_t counts_q8, edge_q8, weight;
+
+  // Counter wraps around, the difference is the signed distance
+  pid_->counts = (int16_t)(count - pid_->previousCount);
+  pid_->previousCount = count;
+  counts_q8 = ((int32_t)pid_->counts << PID_FRAC) * NOMINAL_US /
+    (int32_t)stepUs;
+
+  if (encoder_ == ENCODER_LEFT)
+  {
+    const int32_t speed = abs(counts_q8) >> PID_FRAC;
+
+    if (!edgesArmed && speed < MOTORS_EDGE_SPEED_HI)
+      vEncodersArmEdges(edgesArmed = 1);
+    else if (edgesArmed && speed > MOTORS_EDGE_SPEED_ARM)
+      vEncodersArmEdges(edgesArmed = 0);
+  }
+
+  if (abs(counts_q8) >= (MOTORS_EDGE_SPEED_HI << PID_FRAC))
+  {
+    pid_->edgeValid = 0;
+    pid_->speed_q8 = counts_q8;
+  }
+  else
+  {
+    edge_q8 = prvMotorsEdgeSpeed(pid_, encoder_, count, counts_q8);
+    // From the edges alone at LO to the counts alone at HI
+    weight = (abs(edge_q8) - (MOTORS_EDGE_SPEED_LO << PID_FRAC)) /
+      (MOTORS_EDGE_SPEED_HI - MOTORS_EDGE_SPEED_LO);
+    if (weight <= 0)
+      pid_->speed_q8 = edge_q8;
+    else if (weight >= (1 << PID_FRAC))
+      pid_->speed_q8 = counts_q8;
+    else
+      pid_->speed_q8 = edge_q8 +
+        (((counts_q8 - edge_q8) * weight) >> PID_FRAC);
+  }
+  pid_->speed = (pid_->speed_q8 + (1 << (PID_FRAC - 1))) >> PID_FRAC;
+}
+
+#ifdef BEMF
+void vMotorsBemfInit()
+{
+  vAdcSetInjected(&bemfChannels[ENCODER_LEFT], &bemfChannels[ENCODER_RIGHT]);
+  for (int i = 0; i < ENCODERS_NB; i++)
+    bemfZero[i] = (ADC_MAX_VALUE / 2) << 4;
+}
+
+void vMotorsSetSpeedSource(int source_)
+{
+  speedSource = source_ == MOTORS_SPEED_BEMF ? MOTORS_SPEED_BEMF :
+    MOTORS_SPEED_ENCODERS;
+}
+
+int iMotorsGetSpeedSource()
+{
+  return speedSource;
+}
+
+void vMotorsSetBemfGain(int16_t gain_)
+{
+  bemfGain = gain_;
+}
+
+int16_t iMotorsGetBemfGain()
+{
+  return bemfGain;
+}
+
+void vMotorsGetBemf(motors_bemf_t* bemf_)
+{
+  taskENTER_CRITICAL();
+  *bemf_ = bemf;
+  taskEXIT_CRITICAL();
+}
+
+// After the encoders: the speeds of the last window, the encoder ones
+// replaced when it is the source, the counts of the odometry integrated
+// from them. Without a new window, the previous speeds hold.
+static void prvMotorsBemfSpeeds(motors_command_t setpoint_)
+{
+  const int16_t setpoints[ENCODERS_NB] =
+    { setpoint_.motor.left, setpoint_.motor.right };
+  const uint32_t seq = bemfSeq;
+  int32_t codes[ENCODERS_NB], speeds_q8[ENCODERS_NB];
+  uint8_t stalled = 0;
+
+  if (seq != bemfLastSeq)
+  {
+    bemfLastSeq = seq;
+    for (int i = 0; i < ENCODERS_NB; i++)
+    {
+      const int32_t code = bemfCodes[i];
+
+      if (!enabled)
+        bemfZero[i] += ((code << 4) - bemfZero[i]) >> BEMF_ZERO_SHIFT;
+      codes[i] = code - (bemfZero[i] >> 4);
+    }
+  }
+  else
+  {
+    codes[ENCODER_LEFT] = bemf.code_left;
+    codes[ENCODER_RIGHT] = bemf.code_right;
+  }
+
+  for (int i = 0; i < ENCODERS_NB; i++)
+  {
+    motor_pid_t* const p = &pid[i];
+
+    speeds_q8[i] = (codes[i] * bemfGain) >> 8;
+    if (speedSource == MOTORS_SPEED_BEMF &&
+        abs(setpoints[i]) >= MOTORS_BEMF_STALL_COMMAND &&
+        abs(speeds_q8[i]) < (MOTORS_BEMF_STALL_SPEED << PID_FRAC))
+    {
+      bemfStallUs[i] += stepUs;
+      if (bemfStallUs[i] >= MOTORS_BEMF_STALL_MS * 1000)
+      {
+        bemfStallUs[i] = MOTORS_BEMF_STALL_MS * 1000;
+        stalled |= 1 << i;
+      }
+    }
+    else
+      bemfStallUs[i] = 0;
+
+    if (speedSource != MOTORS_SPEED_BEMF)
+    {
+      bemfFraction[i] = 0;
+      continue;
+    }
+    // Distance over the period run, the fraction carried over
+    const int32_t q8 = bemfFraction[i] +
+      (int32_t)((int64_t)speeds_q8[i] * stepUs / NOMINAL_US);
+    p->counts = q8 >> PID_FRAC;
+    bemfFraction[i] = q8 - ((int32_t)p->counts << PID_FRAC);
+    p->speed_q8 = speeds_q8[i];
+    p->speed = (speeds_q8[i] + (1 << (PID_FRAC - 1))) >> PID_FRAC;
+  }
+
+  taskENTER_CRITICAL();
+  bemf.windows = seq;
+  bemf.code_left = codes[ENCODER_LEFT];
+  bemf.code_right = codes[ENCODER_RIGHT];
+  bemf.speed_left = (speeds_q8[ENCODER_LEFT] + (1 << (PID_FRAC - 1))) >>
+    PID_FRAC;
+  bemf.speed_right = (speeds_q8[ENCODER_RIGHT] + (1 << (PID_FRAC - 1))) >>
+    PID_FRAC;
+  bemf.zero_left = bemfZero[ENCODER_LEFT] >> 4;
+  bemf.zero_right = bemfZero[ENCODER_RIGHT] >> 4;
+  bemf.stalled = stalled;
+  taskEXIT_CRITICAL();
+}
+#endif
+
+static int16_t iMotorsPid(motor_pid_t* pid_, int16_t setpoint_)
+{
+  int32_t error, integral;
+  int64_t output;
+
+  error = ((setpoint_ * MOTORS_MAX_SPEED) << PID_FRAC) / LIMIT_VAL -
+          pid_->speed_q8;
+
+  // Integral over time, derivative per time: as at the nominal period
+  integral = pid_->integral + (int32_t)((int64_t)error * stepUs / NOMINAL_US);
+  if (integral > INTEGRAL_MAX)
+    integral = INTEGRAL_MAX;
+  else if (integral < -INTEGRAL_MAX)
+    integral = -INTEGRAL_MAX;
+
+  output = ((int64_t)kp * error +
+            (int64_t)ki * integral +
+            (int64_t)kd * (error - pid_->previousError) * NOMINAL_US /
+            (int32_t)stepUs) >> PID_SHIFT;
+  pid_->previousError = error;
+
+  // Anti windup: only integrate while the output is not saturated, or
+  // held by the traction control or the thermal model
+  const int32_t bound = prvMotorsOutputBound(pid_);
+  if (output > bound)
+    return bound;
+  if (output < -bound)
+    return -bound;
+
+  pid_->integral = integral;
+  return output;
+}
+
+static int16_t prvMotorsBound(int32_t command_)
+{
+  if (command_ > LIMIT_VAL)
+    return LIMIT_VAL;
+  if (command_ < -LIMIT_VAL)
+    return -LIMIT_VAL;
+  return command_;
+}
+
+static void prvMotorsSyncReset()
+{
+  syncQ8 = 0;
+  syncError = 0;
+}
+
+// Setpoints of the PIDs, corrected by the cross coupling. The speeds of
+// the period answer the setpoints of the one before: close enough at the
+// rate the error builds.
+RAMFUNC static motors_command_t prvMotorsCrossCouple(motors_command_t cmd_)
+{
+  const int32_t left = cmd_.motor.left;
+  const int32_t right = cmd_.motor.right;
+  const int32_t norm = (abs(left) + abs(right)) / 2;
+  const int16_t gain = kc;
+  int32_t corr;
+
+  if (!gain || !norm)
+  {
+    prvMotorsSyncReset();
+    return cmd_;
+  }
+
+  syncQ8 += ((int64_t)pid[ENCODER_LEFT].speed_q8 * right -
+             (int64_t)pid[ENCODER_RIGHT].speed_q8 * left) *
+    (int32_t)stepUs / ((int64_t)norm * NOMINAL_US);
+  if (syncQ8 > (MOTORS_SYNC_MAX << PID_FRAC))
+    syncQ8 = MOTORS_SYNC_MAX << PID_FRAC;
+  else if (syncQ8 < -(MOTORS_SYNC_MAX << PID_FRAC))
+    syncQ8 = -(MOTORS_SYNC_MAX << PID_FRAC);
+  syncError = syncQ8;
+
+  corr = ((int32_t)gain * syncQ8) >> PID_SHIFT;
+  if (corr > MOTORS_SYNC_CORR_MAX)
+    corr = MOTORS_SYNC_CORR_MAX;
+  else if (corr < -MOTORS_SYNC_CORR_MAX)
+    corr = -MOTORS_SYNC_CORR_MAX;
+
+  // Along the gradient of the error: straight ahead, the left wheel
+  // slowed and the right one sped up by corr
+  cmd_.motor.left = prvMotorsBound(left - corr * right / norm);
+  cmd_.motor.right = prvMotorsBound(right + corr * left / norm);
+  return cmd_;
+}
+
+void vMotorsSetSlipThreshold(int mrad_s_)
+{
+  slipMrad = mrad_s_ < 0 ? 0 : mrad_s_;
+}
+
+int iMotorsGetSlipThreshold()
+{
+  return slipMrad;
+}
+
+uint32_t uMotorsGetSlips(int encoder_)
+{
+  return pid[encoder_].slips;
+}
+
+// The wheels against the gyro and against what the motors can do: which
+// of them slip, the bound of their output. Over windows of a nominal
+// period at least, whatever the loop rate, the speeds from the counts of
+// the window. In the units of the odometry, mrad/s of the wheels: speed
+// difference (counts per period) times um per count, per second, over the
+// track in mm. The outputs are the ones applied the period before.
+static void prvMotorsSlipStep(motors_command_t cmd_, motors_command_t out_)
+{
+  const int threshold = slipMrad;
+  const int16_t command[ENCODERS_NB] = { cmd_.motor.left, cmd_.motor.right };
+  const int16_t output[ENCODERS_NB] = { out_.motor.left, out_.motor.right };
+  int32_t speed[ENCODERS_NB];
+  int suspect[ENCODERS_NB] = { 0, 0 };
+
+  for (int i = 0; i < ENCODERS_NB; i++)
+    pid[i].slipCounts += pid[i].counts;
+  slipUs += stepUs;
+  if (slipUs < NOMINAL_US)
+    return;
+  for (int i = 0; i < ENCODERS_NB; i++)
+  {
+    speed[i] = ((int64_t)pid[i].slipCounts << PID_FRAC) * NOMINAL_US /
+      (int32_t)slipUs;
+    pid[i].slipCounts = 0;
+  }
+
+  if (threshold && iImuIsReady())
+  {
+    const int32_t left = speed[ENCODER_LEFT];
+    const int32_t right = speed[ENCODER_RIGHT];
+    const int32_t wheels = ((int64_t)(right - left) * ODOMETRY_UM_PER_COUNT *
+                            (1000 / MOTORS_PERIOD_MS) / ODOMETRY_TRACK_MM) >>
+      PID_FRAC;
+    const int32_t excess = wheels - iImuGetRateMrad();
+
+    if (excess > threshold)
+      suspect[right > -left ? ENCODER_RIGHT : ENCODER_LEFT] = 1;
+    else if (excess < -threshold)
+      suspect[left > -right ? ENCODER_LEFT : ENCODER_RIGHT] = 1;
+  }
+
+  for (int i = 0; i < ENCODERS_NB; i++)
+  {
+    motor_pid_t* const p = &pid[i];
+    const int dir = command[i] > 0 ? 1 : command[i] < 0 ? -1 : 0;
+    const int32_t accel = (int64_t)(speed[i] - p->slipLast_q8) * dir *
+      NOMINAL_US / (int32_t)slipUs;
+
+    p->slipLast_q8 = speed[i];
+    if (!threshold)
+    {
+      p->slipRun = 0;
+      p->slipping = 0;
+      p->limit = LIMIT_VAL;
+      continue;
+    }
+    if (accel > (MOTORS_SLIP_ACCEL << PID_FRAC))
+      suspect[i] = 1;
+
+    if (!suspect[i])
+    {
+      p->slipRun = 0;
+      p->slipHoldUs += slipUs;
+    }
+    else if (++p->slipRun >= MOTORS_SLIP_PERIODS)
+    {
+      p->slipRun = MOTORS_SLIP_PERIODS;
+      p->slipHoldUs = 0;
+      if (!p->slipping)
+      {
+        p->slipping = 1;
+        p->slips++;
+        p->limit = abs(output[i]) * MOTORS_SLIP_TORQUE >> 8;
+        vBlackboxLog(BLACKBOX_SLIP, i, 1);
+      }
+    }
+
+    if (p->slipping && p->slipHoldUs >= MOTORS_SLIP_HOLD_MS * 1000)
+    {
+      p->slipping = 0;
+      vBlackboxLog(BLACKBOX_SLIP, i, 0);
+    }
+    // Back to full torque along the ramp once the grip is back
+    if (!p->slipping && p->limit < LIMIT_VAL)
+    {
+      const int32_t step = maxDiff ?
+        (int32_t)maxDiff * (int32_t)slipUs / NOMINAL_US : LIMIT_VAL;
+
+      p->limit += step ? step : 1;
+      if (p->limit > LIMIT_VAL)
+        p->limit = LIMIT_VAL;
+    }
+  }
+  slipUs = 0;
+}
+
+void vMotorsSetContinuous(int command_)
+{
+  if (command_ < 0)
+    command_ = 0;
+  continuous = command_ > LIMIT_VAL ? LIMIT_VAL : command_;
+}
+
+int iMotorsGetContinuous()
+{
+  return continuous;
+}
+
+static int prvMotorsHeatPercent(int32_t heat_, int cont_)
+{
+  const int32_t full = cont_ * cont_;
+
+  return full ? (int64_t)heat_ * 100 / full : 0;
+}
+
+void vMotorsGetThermal(int heat_[3])
+{
+  const int cont = continuous;
+
+  heat_[0] = prvMotorsHeatPercent(pid[ENCODER_LEFT].heat, cont);
+  heat_[1] = prvMotorsHeatPercent(pid[ENCODER_RIGHT].heat, cont);
+  heat_[2] = prvMotorsHeatPercent(bridgeHeat, cont);
+}
+
+static int32_t prvMotorsOutputBound(const motor_pid_t* pid_)
+{
+  return pid_->limit < pid_->thermal ? pid_->limit : pid_->thermal;
+}
+
+// First order toward the power, over its time constant
+static int32_t prvMotorsHeat(int32_t heat_, int32_t power_, uint32_t tau_ms_)
+{
+  return heat_ +
+    (int32_t)((int64_t)(power_ - heat_) * (int32_t)stepUs /
+              ((int32_t)tau_ms_ * 1000));
+}
+
+// The full range while cool, derated down to the continuous limit as the
+// heat rises to the continuous heat
+static int32_t prvMotorsDerate(int32_t heat_, int cont_)
+{
+  const int32_t full = cont_ * cont_;
+  const int32_t warm = full / 100 * MOTORS_THERMAL_WARM;
+
+  if (heat_ <= warm)
+    return LIMIT_VAL;
+  if (heat_ >= full)
+    return cont_;
+  return LIMIT_VAL -
+    (int32_t)((int64_t)(LIMIT_VAL - cont_) * (heat_ - warm) / (full - warm));
+}
+
+// After the period, from the commands applied
+static void prvMotorsThermalStep()
+{
+  const int cont = continuous;
+  const int32_t left = appliedCommand.motor.left;
+  const int32_t right = appliedCommand.motor.right;
+  int32_t bridge;
+
+  pid[ENCODER_LEFT].heat = prvMotorsHeat(pid[ENCODER_LEFT].heat, left * left,
+                                         MOTORS_THERMAL_MOTOR_MS);
+  pid[ENCODER_RIGHT].heat = prvMotorsHeat(pid[ENCODER_RIGHT].heat,
+                                          right * right,
+                                          MOTORS_THERMAL_MOTOR_MS);
+  bridgeHeat = prvMotorsHeat(bridgeHeat, (left * left + right * right) / 2,
+                             MOTORS_THERMAL_BRIDGE_MS);
+
+  if (cont >= LIMIT_VAL)
+  {
+    for (int i = 0; i < ENCODERS_NB; i++)
+      pid[i].thermal = LIMIT_VAL;
+    return;
+  }
+  bridge = prvMotorsDerate(bridgeHeat, cont);
+  for (int i = 0; i < ENCODERS_NB; i++)
+  {
+    const int32_t motor = prvMotorsDerate(pid[i].heat, cont);
+
+    pid[i].thermal = motor < bridge ? motor : bridge;
+  }
+}
+
+// Open loop: the commands within the bounds of the traction control and
+// the thermal model, as the PIDs keep theirs
+static motors_command_t prvMotorsTraction(motors_command_t cmd_)
+{
+  const int32_t left = prvMotorsOutputBound(&pid[ENCODER_LEFT]);
+  const int32_t right = prvMotorsOutputBound(&pid[ENCODER_RIGHT]);
+
+  if (cmd_.motor.left > left)
+    cmd_.motor.left = left;
+  else if (cmd_.motor.left < -left)
+    cmd_.motor.left = -left;
+  if (cmd_.motor.right > right)
+    cmd_.motor.right = right;
+  else if (cmd_.motor.right < -right)
+    cmd_.motor.right = -right;
+  return cmd_;
+}
+
+RAMFUNC static void vMotorsTask(void* pvParameters_)
+{
+  portTickType time = xTaskGetTickCount();
+  motors_command_t target, output;
+  motors_state_t snapshot;
+  pose_t pose;
+  uint32_t seq = targetSeq;
+  portTickType lastCommand = time;
+  uint32_t lastUs = xTimeNowUs();
+
+  output.motors = 0;
+  slewLastUs = lastUs;
+  vSysmonRegisterTask("motorsd");
+
+  for (int i = 0; i < ENCODERS_NB; i++)
+  {
+    pid[i].previousCount = uEncodersGetCount(i);
+    pid[i].limit = LIMIT_VAL;
+    pid[i].thermal = LIMIT_VAL;
+  }
+
+  for (;;)
+  {
+    const uint32_t now_us = xTimeNowUs();
+
+    time = xTaskGetTickCount();
+    stepUs = now_us != lastUs ? now_us - lastUs : 1;
+    lastUs = now_us;
+    PROFILE_BEGIN(PROFILE_MOTORS_LOOP);
+#ifdef PROFILE
+    vMotorsRecordPeriod();
+#endif
+
+    vMotorsRunSegments(time);
+    prvMotorsSupplyStep();
+
+    // Sample the value at this moment, in a single load:
+    target.motors = targetCommand.motors;
+
+    // Deadman: no fresh command from the host, stop (with the ramp)
+    if (targetSeq != seq)
+    {
+      seq = targetSeq;
+      lastCommand = time;
+    }
+    else if (commandTimeout && !segmentActive &&
+             time - lastCommand >= commandTimeout)
+      target.motors = 0;
+
+    // A new target: the path changes, its error starts over
+    if (target.motors != syncTarget)
+    {
+      syncTarget = target.motors;
+      prvMotorsSyncReset();
+    }
+
+    vMotorsSlewStep();
+    prvMotorsTakeStop();
+    currentCommand = iMotorsLimitCommands(target, previousCommand);
+    if (forwardLimit)
+      currentCommand = iMotorsLimitForward(currentCommand, forwardLimit());
+    previousCommand = currentCommand;
+
+    // Speeds are measured even in open loop, for the getters
+    for (int i = 0; i < ENCODERS_NB; i++)
+      vMotorsMeasureSpeed(&pid[i], i);
+#ifdef BEMF
+    prvMotorsBemfSpeeds(currentCommand);
+#endif
+    prvMotorsSlipStep(currentCommand, output);
+    vOdometryUpdate(pid[ENCODER_LEFT].counts, pid[ENCODER_RIGHT].counts);
+    vOdometryGetPose(&pose);
+
+#ifdef SYSID
+    if (sysidLength)
+      vMotorsSysidStep();
+    else
+#endif
+#ifdef AUTOTUNE
+    if (tuneRunning)
+      vMotorsTuneStep(now_us);
+    else if (sweepRunning)
+      vMotorsSweepStep();
+    else
+#endif
+    if (closedLoop)
+    {
+      const motors_command_t setpoints = prvMotorsCrossCouple(currentCommand);
+
+      output.motor.left = iMotorsPid(&pid[ENCODER_LEFT],
+                                     setpoints.motor.left);
+      output.motor.right = iMotorsPid(&pid[ENCODER_RIGHT],
+                                      setpoints.motor.right);
+      vMotorsApplyCommands(output);
+    }
+    else
+    {
+      prvMotorsSyncReset();
+      // Restart the loop from a clean state
+      for (int i = 0; i < ENCODERS_NB; i++)
+      {
+        pid[i].integral = 0;
+        pid[i].previousError = 0;
+      }
+      output = prvMotorsTraction(currentCommand);
+      vMotorsApplyCommands(output);
+      ACTUATION_STAMP(ACTUATION_LOOP, target.motors);
+    }
+
+    prvMotorsThermalStep();
+
+    // Publish a coherent snapshot
+    snapshot.target_left   = target.motor.left;
+    snapshot.target_right  = target.motor.right;
+    snapshot.command_left  = currentCommand.motor.left;
+    snapshot.command_right = currentCommand.motor.right;
+    snapshot.pwm_left      = pwmLeft;
+    snapshot.pwm_right     = pwmRight;
+    snapshot.speed_left    = pid[ENCODER_LEFT].speed;
+    snapshot.speed_right   = pid[ENCODER_RIGHT].speed;
+    snapshot.heading_mrad  = pose.theta_mrad;
+    snapshot.enabled       = enabled;
+    snapshot.cut_off       = cutOff;
+    snapshot.closed_loop   = closedLoop;
+    snapshot.slipping      = pid[ENCODER_LEFT].slipping << ENCODER_LEFT |
+                             pid[ENCODER_RIGHT].slipping << ENCODER_RIGHT;
+    vTopicsPublish(TOPIC_MOTORS, &snapshot);
+
+    PROFILE_END(PROFILE_MOTORS_LOOP);
+    while (uFlagsWait(&loopFlags, LOOP_TICK | LOOP_COMMAND, FLAGS_ANY,
+                      LOOP_TIMEOUT) == LOOP_COMMAND)
+      vMotorsCommandNow(&seq, &lastCommand);
+  }
+}
+
+// A stop asked: the ramp starts again from zero, and so does the PID, as
+// the output is cut at once
+static int prvMotorsTakeStop()
+{
+  if (!stopNow)
+    return 0;
+  stopNow = 0;
+  previousCommand.motors = 0;
+  for (int i = 0; i < ENCODERS_NB; i++)
+  {
+    pid[i].integral = 0;
+    pid[i].previousError = 0;
+  }
+  prvMotorsSyncReset();
+  return 1;
+}
+
+// Open loop, a setpoint between two periods: through the range check,
+// the ramp and the forward limit, out at the next update event. The
+// speeds, the odometry and the snapshot wait for the period. A stop in
+// any mode, the period then carries on from it.
+RAMFUNC static void vMotorsCommandNow(uint32_t* seq_,
+                                      portTickType* lastCommand_)
+{
+  motors_command_t target;
+
+  if (prvMotorsTakeStop())
+  {
+    *seq_ = targetSeq;
+    *lastCommand_ = xTaskGetTickCount();
+    currentCommand.motors = 0;
+    vMotorsApplyCommands(currentCommand);
+    ACTUATION_STAMP(ACTUATION_LOOP, 0);
+    return;
+  }
+#ifdef SYSID
+  if (sysidLength)
+    return;
+#endif
+#ifdef AUTOTUNE
+  if (tuneRunning || sweepRunning)
+    return;
+#endif
+  if (closedLoop || segmentActive)
+    return;
+
+  target.motors = targetCommand.motors;
+  *seq_ = targetSeq;
+  *lastCommand_ = xTaskGetTickCount();
 
+  vMotorsSlewStep();
+  currentCommand = iMotorsLimitCommands(target, previousCommand);
+  if (forwardLimit)
+    currentCommand = iMotorsLimitForward(currentCommand, forwardLimit());
+  previousCommand = currentCommand;
+  vMotorsApplyCommands(prvMotorsTraction(currentCommand));
+  ACTUATION_STAMP(ACTUATION_LOOP, target.motors);
 }
@@ -5,16 +5,415 @@
 
 #include "FreeRTOS.h"
 
+#include "libglobal/odometry.h"
+
+// Commands range from -MOTORS_COMMAND_MAX (full reverse) to
+// MOTORS_COMMAND_MAX (full forward)
+#define MOTORS_COMMAND_MAX 1000
+
+// Daemon stack, in words
+#ifndef MOTORS_STACK_SIZE
+# define MOTORS_STACK_SIZE configMINIMAL_STACK_SIZE
+#endif
+
 void vMotorsInit(unsigned portBASE_TYPE motorsDaemonPriority_);
 
 void vMotorsEnable();
 void vMotorsDisable();
+// Immediately float both motors, callable from any interrupt. Cleared by
+// vMotorsEnable().
+void vMotorsCutOff();
+int iMotorsIsCutOff();
+
+// Bridge drive. Locked antiphase: both legs switched in opposition, 50%
+// duty at rest. Sign-magnitude: one leg switched, the other held low,
+// with the motor braked (both legs low) or coasting (its bridge off) at
+// zero. Applied at the next period.
+#define MOTORS_DRIVE_ANTIPHASE 0
+#define MOTORS_DRIVE_BRAKE     1
+#define MOTORS_DRIVE_COAST     2
+void vMotorsSetDrive(int drive_);
+
+// PWM frequency, applied at the next period with the compare values
+#define MOTORS_DEFAULT_PWM_HZ 9000
+#define MOTORS_MIN_PWM_HZ     1000
+#define MOTORS_MAX_PWM_HZ     20000
+void vMotorsSetPwmFrequency(int hz_);
 
 void vSetMotorsCommand(int16_t left_, int16_t right_);
 void vSetMotorLeftCommand(int16_t left_);
 void vSetMotorRightCommand(int16_t right_);
+// After a setpoint from an interrupt (the binary frames of the UART),
+// ends with portEND_SWITCHING_ISR(*woken_): in open loop, the daemon
+// applies it at once, for the next update event, not at its next period
+void vMotorsCommandFromISR(portBASE_TYPE* woken_);
+// The same from a task: the setpoint published, then the daemon woken to
+// apply it before the caller goes on (it has the higher priority)
+void vSetMotorsCommandNow(int16_t left_, int16_t right_);
+// Emergency stop from a task: both commands to zero at the next update
+// event, within one PWM period, past the ramp and in either loop (the
+// PID restarts from there), the segments and a sysid run dropped
+void vMotorsStopNow();
+// Forward speed and rotation rate, to wheel setpoints by the odometry
+// geometry: exact in closed loop (the commands are speeds there), near
+// in open loop. The faster wheel saturates at MOTORS_MAX_SPEED_MM_S and
+// the other one is scaled with it, the curvature kept.
+void vSetMotorsVelocity(int16_t v_mm_s_, int16_t omega_mrad_s_);
+// Maximum command change per period, 0 applies targets at once
+#define MOTORS_DEFAULT_SLEW 40
+void vMotorsSetSlewRate(int16_t max_diff_);
+// Ramp to zero when no command arrived for timeout_ms_, 0 disables (default)
+void vMotorsSetCommandTimeout(int timeout_ms_);
+
+// Supply feedforward: each period the daemon scales the commands on
+// their way to the duties by the nominal voltage over the battery one,
+// filtered over 2^MOTORS_SUPPLY_FILTER_SHIFT periods, within the gain
+// bounds (in permille). A command then gives the same speed over the
+// discharge. Not on USB power (POWER_NO_BATTERY_MV); 0 disables
+// (default).
+#define MOTORS_SUPPLY_FILTER_SHIFT 5
+#define MOTORS_SUPPLY_GAIN_MIN     700
+#define MOTORS_SUPPLY_GAIN_MAX     1500
+void vMotorsSetNominalMv(int nominal_mv_);
+int iMotorsGetNominalMv();
+// As applied, 1000 without compensation
+int iMotorsGetSupplyGain();
+
+// Called by the daemon at each period, returns the maximum forward
+// command (0 to MOTORS_COMMAND_MAX). Applied without ramp, turning and
+// backing up stay allowed.
+typedef int16_t (*pfunMotorsLimit) (void);
+void vMotorsSetForwardLimit(pfunMotorsLimit limit_);
+
+// Motion segments, run back to back by the daemon. Transitions happen on
+// the MOTORS_PERIOD_MS period; the motors stop after the last one.
+#define MOTORS_SEGMENTS_NB 16
+
+typedef struct
+{
+  uint16_t duration_ms;
+  int16_t left;
+  int16_t right;
+} __attribute__((packed)) motors_segment_t;
+
+// Append up to n_ segments without blocking, returns the number queued
+int iMotorsQueueSegments(const motors_segment_t* segments_, int n_);
+// Drop the queued segments and stop the running one
+void vMotorsClearSegments();
+
+// Closed loop: commands are speed setpoints, MOTORS_MAX_SPEED encoder
+// counts per period at full command, tracked by a PID per wheel.
+#define MOTORS_PERIOD_MS 5
+#define MOTORS_MAX_SPEED 40
+// Its wheel speed: 1200 mm/s
+#define MOTORS_MAX_SPEED_MM_S \
+  (MOTORS_MAX_SPEED * ODOMETRY_UM_PER_COUNT / MOTORS_PERIOD_MS)
+
+// The loop runs on the TIM2 update events, phase locked to the PWM, at
+// the rate nearest to the one set that the PWM frequency allows. Speeds,
+// slew rate and gains stay in the units of MOTORS_PERIOD_MS, the nominal
+// period, at any rate.
+#define MOTORS_DEFAULT_LOOP_HZ (1000 / MOTORS_PERIOD_MS)
+#define MOTORS_MIN_LOOP_HZ     200
+#define MOTORS_MAX_LOOP_HZ     1000
+void vMotorsSetLoopRate(int hz_);
+// As run
+int iMotorsGetLoopPeriodUs();
+
+// Gains in 1/256 (MOTORS_PID_ONE), output in command units per count of
+// error per period
+#define MOTORS_PID_ONE   256
+#define MOTORS_DEFAULT_KP (20 * MOTORS_PID_ONE)
+#define MOTORS_DEFAULT_KI (5 * MOTORS_PID_ONE / 2)
+#define MOTORS_DEFAULT_KD 0
+
+// Low speeds: a count per period is a quarter of the speed at 4, the
+// speed comes from the time between the encoder edges there instead.
+// The edges alone up to MOTORS_EDGE_SPEED_LO counts per
+// MOTORS_PERIOD_MS, blended into the counts alone at MOTORS_EDGE_SPEED_HI.
+// The left capture interrupt is armed below MOTORS_EDGE_SPEED_HI and
+// disarmed above MOTORS_EDGE_SPEED_ARM. The counts of the odometry stay
+// the raw ones.
+#define MOTORS_EDGE_SPEED_LO   4
+#define MOTORS_EDGE_SPEED_HI   12
+#define MOTORS_EDGE_SPEED_ARM  16
+// No edge for that long: stopped
+#define MOTORS_EDGE_TIMEOUT_MS 100
+
+void vMotorsSetClosedLoop(int enable_);
+void vMotorsSetPid(int16_t kp_, int16_t ki_, int16_t kd_);
+
+// Cross coupling, closed loop: the daemon integrates the distance of
+// each wheel against the setpoint of the other one (left * sp_right -
+// right * sp_left, over the mean setpoint), the counts the left wheel
+// got ahead on the path asked, straight or curved. The gain turns it
+// into a setpoint correction, taken from one wheel and given to the
+// other: a long straight pass stays straight without the host. The
+// error restarts from 0 on a new target, a stop or in open loop.
+// Gain in 1/256 command unit per count, 0 disables.
+#define MOTORS_DEFAULT_KC    (2 * MOTORS_PID_ONE)
+// Bounds of the error (counts) and of the correction (command units)
+#define MOTORS_SYNC_MAX       MOTORS_MAX_SPEED
+#define MOTORS_SYNC_CORR_MAX  (MOTORS_COMMAND_MAX / 10)
+void vMotorsSetCrossCoupling(int16_t kc_);
+int16_t iMotorsGetCrossCoupling();
+// As integrated at the last period, in counts, left ahead positive
+int iMotorsGetSyncError();
+
+// Slip, in both modes: a wheel spinning without grip. With the gyro, the
+// yaw rate the wheels claim (their speed difference over the track) off
+// the gyro one beyond the threshold, the faster wheel in the sense of the
+// difference taken; with or without it, a wheel speeding up more than
+// MOTORS_SLIP_ACCEL counts per period per period along its command, as the
+// motor cannot with the robot to push. Either for MOTORS_SLIP_PERIODS
+// nominal periods in a row, at any loop rate. Traction control then caps
+// the output of that wheel at MOTORS_SLIP_TORQUE/256 of its output at the
+// onset, the integral of its PID held, until MOTORS_SLIP_HOLD_MS past the
+// last slipping period; the cap lifts at the slew rate. Threshold in
+// mrad/s, 0 disables both.
+#define MOTORS_DEFAULT_SLIP_MRAD 500
+#define MOTORS_SLIP_ACCEL        3
+#define MOTORS_SLIP_PERIODS      3
+#define MOTORS_SLIP_TORQUE       160
+#define MOTORS_SLIP_HOLD_MS      200
+void vMotorsSetSlipThreshold(int mrad_s_);
+int iMotorsGetSlipThreshold();
+// Slips of a wheel since the boot
+uint32_t uMotorsGetSlips(int encoder_);
+
+// Thermal model, both modes: a first order model per motor and one for
+// the L298, heated by the square of the command applied (the current of
+// a loaded motor follows it, the supply feedforward holding the volts)
+// and cooling with their time constants. The state is the square of the
+// command that would keep it there: held at the continuous limit, it
+// stays at the continuous heat. Below MOTORS_THERMAL_WARM percent of it
+// the full range is allowed, a burst beyond the continuous limit; from
+// there to the continuous heat the bound of the output derates down to
+// the continuous limit. The bridge heats with the mean of both motors.
+// Continuous limit in command units, MOTORS_COMMAND_MAX disables.
+#define MOTORS_DEFAULT_CONTINUOUS 700
+#define MOTORS_THERMAL_MOTOR_MS   4000
+#define MOTORS_THERMAL_BRIDGE_MS  10000
+#define MOTORS_THERMAL_WARM       50
+void vMotorsSetContinuous(int command_);
+int iMotorsGetContinuous();
+// Percent of the continuous heat: left, right, bridge
+void vMotorsGetThermal(int heat_[3]);
+
+// Linearization, every output whatever the mode: from the command asked,
+// in proportion of the speed, to the one the bridge gets, per motor and
+// the same both ways. Any command off 0 starts at the deadband, then
+// follows the straight lines through the points, at even steps of
+// MOTORS_COMMAND_MAX / MOTORS_LINEAR_NB, up to full at full. A 0 deadband
+// and the points on the diagonal leave the commands as they are. The
+// thermal and traction bounds stay in the units of the commands asked.
+#define MOTORS_LINEAR_NB 4
+
+typedef struct
+{
+  int16_t deadband;
+  int16_t points[MOTORS_LINEAR_NB - 1];
+} motors_linear_t;
+
+void vMotorsSetLinear(int encoder_, const motors_linear_t* linear_);
+void vMotorsGetLinear(int encoder_, motors_linear_t* linear_);
 
-uint16_t uGetMotorLeftCommand();
-uint16_t uGetMotorRightCommand();
+typedef struct
+{
+  int16_t target_left;   // Last published setpoints
+  int16_t target_right;
+  int16_t command_left;  // Setpoints after range check, ramp and deadman
+  int16_t command_right;
+  uint16_t pwm_left;     // Compare values of the A legs on TIM2
+  uint16_t pwm_right;
+  int16_t speed_left;    // Measured over the last period, encoder counts
+                         // per MOTORS_PERIOD_MS
+  int16_t speed_right;
+  int16_t heading_mrad;  // Odometry heading after this period, gyro aided
+  uint8_t enabled;
+  uint8_t cut_off;
+  uint8_t closed_loop;
+  uint8_t slipping;      // 1 << encoder, under traction control
+} motors_state_t;
+
+// Copy of the state published by the daemon at the end of its last period
+void vMotorsGetState(motors_state_t* state_);
+
+#ifdef PROFILE
+// Loop period as run, start to start, against iMotorsGetLoopPeriodUs()
+// (configure with --profile)
+typedef struct
+{
+  uint32_t count;
+  uint32_t min_us;
+  uint32_t mean_us;
+  uint32_t max_us;
+} motors_jitter_t;
+
+void vMotorsGetJitter(motors_jitter_t* jitter_);
+// Applied by the daemon at its next period
+void vMotorsResetJitter();
+#endif
+
+#ifdef SYSID
+// System identification (configure with --sysid): the daemon drives both
+// motors with an excitation, open loop, past the ramp, the PID and the
+// forward limit, and records each period. The speeds answer the command
+// of the period before.
+#define MOTORS_SYSID_NB 200
+
+enum eMotorsSysid {
+  MOTORS_SYSID_STEP  = 0, // amplitude all along
+  MOTORS_SYSID_CHIRP = 1, // sine swept from 1 Hz to arg Hz (default 20)
+  MOTORS_SYSID_PRBS  = 2, // +/- amplitude by a 9 bit LFSR, arg periods
+                          // per bit (default 2)
+};
+
+#define MOTORS_SYSID_CHIRP_FROM_HZ 1
+#define MOTORS_SYSID_CHIRP_TO_HZ   20
+#define MOTORS_SYSID_PRBS_HOLD     2
+
+typedef struct
+{
+  int16_t command;       // Applied to both motors
+  uint16_t pwm_left;     // Compare value of the left A leg
+  int8_t speed_left;     // Encoder counts per MOTORS_PERIOD_MS
+  int8_t speed_right;
+  uint16_t current_ma;
+} __attribute__((packed)) motors_sysid_sample_t;
+
+// A run of n_ periods, up to MOTORS_SYSID_NB: 0 when one is running or
+// the arguments are out of range, arg_ 0 for the default
+int xMotorsSysidStart(int kind_, int16_t amplitude_, int n_, int arg_);
+// At the next period, the samples so far are kept
+void vMotorsSysidStop();
+int iMotorsSysidIsRunning();
+// Copy up to n_ samples of the last run from first_, returns the count
+int iMotorsSysidRead(motors_sysid_sample_t* out_, int first_, int n_);
+#endif
+
+#ifdef AUTOTUNE
+// Relay feedback auto-tuning (configure with --autotune), after Astrom
+// and Hagglund: the daemon drives each wheel open loop, past the ramp and
+// the forward limit, at bias + relay while its speed is below the one of
+// the bias command, bias - relay once above, with a hysteresis. Both
+// wheels settle in a limit cycle of amplitude a and period Tu, and the
+// ultimate gain is Ku = 4 d / (pi sqrt(a^2 - h^2)), d the relay and h the
+// hysteresis. The robot moves forward meanwhile, about the bias speed.
+#define MOTORS_TUNE_DEFAULT_BIAS  (MOTORS_COMMAND_MAX * 3 / 10)
+#define MOTORS_TUNE_DEFAULT_RELAY (MOTORS_COMMAND_MAX / 10)
+// Switches of each wheel, the first ones let the cycle settle
+#define MOTORS_TUNE_SETTLE_CYCLES 2
+#define MOTORS_TUNE_CYCLES        6
+#define MOTORS_TUNE_MAX_MS        4000
+// In 1/256 count per MOTORS_PERIOD_MS, against the encoder quantization
+#define MOTORS_TUNE_HYSTERESIS    (MOTORS_PID_ONE / 2)
+
+// Tuning rules, from Ku and Tu
+enum eMotorsTuneRule {
+  MOTORS_TUNE_ZN_PID       = 0, // Ziegler-Nichols
+  MOTORS_TUNE_ZN_PI        = 1,
+  MOTORS_TUNE_TL_PI        = 2, // Tyreus-Luyben, damped
+  MOTORS_TUNE_NO_OVERSHOOT = 3,
+  MOTORS_TUNE_RULES_NB
+};
+
+typedef struct
+{
+  int32_t ku;            // Ultimate gain, in 1/256 (as the PID gains)
+  uint32_t tu_us;        // Period of the limit cycle
+  uint16_t amplitude;    // Speed amplitude, in 1/256 count per period
+} motors_tune_wheel_t;
+
+// 0 when a run (or a sysid one) is running or the arguments are out of
+// range. bias_ +/- relay_ must stay within the commands range.
+int xMotorsTuneStart(int16_t bias_, int16_t relay_);
+// At the next period, the run failed
+void vMotorsTuneStop();
+int iMotorsTuneIsRunning();
+// Of the last run, by ENCODER_x: 0 unless both wheels completed their
+// cycles
+int iMotorsTuneResult(motors_tune_wheel_t* wheels_);
+// Gains of a rule from Ku and Tu: 0 for an unknown rule or gains beyond
+// the PID range
+int iMotorsTuneGains(int rule_, int32_t ku_, uint32_t tu_us_,
+                     int16_t* kp_, int16_t* ki_, int16_t* kd_);
+
+// Linearization sweep: both motors driven past the linearization, the
+// ramp and the bounds at MOTORS_SWEEP_LEVELS commands up to full, each
+// held MOTORS_SWEEP_SETTLE_MS then measured over MOTORS_SWEEP_MEASURE_MS
+// of counts. The deadband is where a wheel starts, the speed of
+// MOTORS_SWEEP_MOVING of its top one; the points where both wheels reach
+// the even steps of the top speed of the slower one, for the two to
+// match. Up to full speed: the robot on a stand, its wheels free.
+#define MOTORS_SWEEP_LEVELS     25
+#define MOTORS_SWEEP_SETTLE_MS  250
+#define MOTORS_SWEEP_MEASURE_MS 250
+#define MOTORS_SWEEP_MS         (MOTORS_SWEEP_LEVELS * \
+                                 (MOTORS_SWEEP_SETTLE_MS + \
+                                  MOTORS_SWEEP_MEASURE_MS))
+#define MOTORS_SWEEP_MOVING     32 // 1/32 of the top speed
+// Below, in counts per MOTORS_PERIOD_MS at full: no table
+#define MOTORS_SWEEP_MIN_SPEED  (MOTORS_MAX_SPEED / 4)
+
+// 0 when a run, a sysid or a tune one, is running
+int xMotorsSweepStart();
+// At the next period, the run failed
+void vMotorsSweepStop();
+int iMotorsSweepIsRunning();
+// Of the last run, by ENCODER_x: 0 unless both wheels reached their top
+// speed
+int iMotorsSweepResult(motors_linear_t* linear_);
+#endif
+
+#ifdef BEMF
+// Sensorless speed (configure with --bemf). Near the end of each loop
+// period both bridges float, the winding current dies out in the flyback
+// diodes, then the A terminal of each motor is converted by the injected
+// pair of the ADC, both at once, and the bridges come back at the period
+// start: the daemon gets a fresh sample. The terminals go through
+// dividers biased at mid-supply (left PA7, right PC5), B pulled down.
+// The back-EMF is proportional to the speed: the code off its zero times
+// the gain, in encoder counts per MOTORS_PERIOD_MS, stands for the
+// encoders in the PID and the odometry when it is the speed source. The
+// zero follows the samples while the motors are disabled.
+#define MOTORS_SPEED_ENCODERS 0
+#define MOTORS_SPEED_BEMF     1
+
+// Float time before the sample, at least one update event. No window
+// when the loop period is too short for it.
+#define MOTORS_BEMF_SETTLE_US 200
+// Codes off the zero at MOTORS_MAX_SPEED, from the divider
+#define MOTORS_BEMF_FULL_CODES 1500
+// Speed (1/256 count per period) per code, in 1/256
+#define MOTORS_BEMF_DEFAULT_GAIN \
+  ((MOTORS_MAX_SPEED << 16) / MOTORS_BEMF_FULL_CODES)
+// Stalled: a setpoint of MOTORS_BEMF_STALL_COMMAND at least and a speed
+// under MOTORS_BEMF_STALL_SPEED for MOTORS_BEMF_STALL_MS
+#define MOTORS_BEMF_STALL_COMMAND 300
+#define MOTORS_BEMF_STALL_SPEED   1
+#define MOTORS_BEMF_STALL_MS      300
+
+typedef struct
+{
+  uint32_t windows;      // Samples taken
+  int16_t code_left;     // Last sample off the zero
+  int16_t code_right;
+  int16_t speed_left;    // Encoder counts per MOTORS_PERIOD_MS
+  int16_t speed_right;
+  uint16_t zero_left;    // Code at rest
+  uint16_t zero_right;
+  uint8_t stalled;       // Bit per wheel, by ENCODER_x
+} motors_bemf_t;
+
+// Before vAdcStart(): the sense pins on the injected pair
+void vMotorsBemfInit();
+// MOTORS_SPEED_x, the windows run with MOTORS_SPEED_BEMF only
+void vMotorsSetSpeedSource(int source_);
+int iMotorsGetSpeedSource();
+void vMotorsSetBemfGain(int16_t gain_);
+int16_t iMotorsGetBemfGain();
+void vMotorsGetBemf(motors_bemf_t* bemf_);
+#endif
 
 #endif
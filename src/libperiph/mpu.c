@@ -0,0 +1,66 @@
+#include "stm32f10x.h"
+
+#include "libglobal/fault.h"
+
+#include "libperiph/mpu.h"
+
+// MPU, not in the CMSIS version shipped here (__MPU_PRESENT 0)
+#define MPU_TYPE            (*(volatile uint32_t*)0xE000ED90)
+#define MPU_CTRL            (*(volatile uint32_t*)0xE000ED94)
+#define MPU_RNR             (*(volatile uint32_t*)0xE000ED98)
+#define MPU_RBAR            (*(volatile uint32_t*)0xE000ED9C)
+#define MPU_RASR            (*(volatile uint32_t*)0xE000EDA0)
+#define MPU_TYPE_DREGION    (0xff << 8)
+#define MPU_CTRL_ENABLE     (1 << 0)
+#define MPU_CTRL_PRIVDEFENA (1 << 2)
+#define MPU_RBAR_VALID      (1 << 4)
+#define MPU_RASR_ENABLE     (1 << 0)
+#define MPU_RASR_SIZE(log2_) (((log2_) - 1) << 1)
+#define MPU_RASR_XN         (1 << 28)
+// AP 000: no access, privileged or not
+
+#define GUARD_REGION 0
+#define GUARD_LOG2   5
+#define GUARD_RASR   (MPU_RASR_ENABLE | MPU_RASR_SIZE(GUARD_LOG2) | \
+                      MPU_RASR_XN)
+
+static uint32_t guard;
+
+int xMpuInit()
+{
+  if (!(MPU_TYPE & MPU_TYPE_DREGION))
+  {
+    vFaultResource("mpu");
+    return 0;
+  }
+
+  MPU_RNR = GUARD_REGION;
+  MPU_RASR = 0;
+  MPU_CTRL = MPU_CTRL_ENABLE | MPU_CTRL_PRIVDEFENA;
+  // Its own handler, not escalated: the overflows tell from the crashes
+  SCB->SHCSR |= SCB_SHCSR_MEMFAULTENA;
+  __DSB();
+  __ISB();
+  return 1;
+}
+
+void vMpuSwitchedIn(void* stack_)
+{
+  // Region number in RBAR, both writes take effect at the exception
+  // return
+  guard = ((uint32_t)stack_ + MPU_GUARD_SIZE - 1) & ~(MPU_GUARD_SIZE - 1);
+  MPU_RBAR = guard | MPU_RBAR_VALID | GUARD_REGION;
+  MPU_RASR = GUARD_RASR;
+}
+
+void vMpuDisable()
+{
+  MPU_CTRL = 0;
+  __DSB();
+  __ISB();
+}
+
+int iMpuIsGuard(uint32_t address_)
+{
+  return guard && address_ - guard < MPU_GUARD_SIZE;
+}
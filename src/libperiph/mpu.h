@@ -0,0 +1,31 @@
+#ifndef LIBPERIPH_MPU_H
+# define LIBPERIPH_MPU_H
+
+#include <stdint.h>
+
+// Stack guard (--stack-guard): a no access MPU region over the bottom of
+// the stack of the running task, moved at each switch instead of the
+// kernel checking the stacks (configCHECK_FOR_STACK_OVERFLOW). A push
+// into it is a MemManage fault, recorded as a stack overflow of the task
+// with the crash dump. The background map stays the default one for the
+// rest (PRIVDEFENA), the tasks run privileged.
+//
+// The region is the first MPU_GUARD_SIZE aligned block of the stack: up
+// to 2 * MPU_GUARD_SIZE - 8 bytes taken from each one. The first task
+// runs unguarded until its first switch, the interrupt stack always.
+//
+// The STM32F103 up to the high density parts has no MPU: configure
+// refuses the option for them (MPU_MCUS of the wscript). Should the init
+// find none anyway, it records a FAULT_RESOURCE.
+#define MPU_GUARD_SIZE 32
+
+// Before the scheduler: 0 without an MPU
+int xMpuInit();
+// From the traceTASK_SWITCHED_IN hook, the kernel stack of the task
+void vMpuSwitchedIn(void* stack_);
+// From the fault handlers, before they read the faulting stack
+void vMpuDisable();
+// The address in the guard of the running task
+int iMpuIsGuard(uint32_t address_);
+
+#endif /* LIBPERIPH_MPU_H */
@@ -0,0 +1,119 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libperiph/adc.h"
+#include "libperiph/hardware.h"
+#include "libperiph/motors.h"
+#include "libperiph/park.h"
+#include "libperiph/periodic.h"
+#include "libperiph/sharps.h"
+#include "libperiph/sonar.h"
+#ifdef CLEANING
+# include "libperiph/cleaning.h"
+#endif
+
+static periodic_t job;
+
+static volatile int delayMs;
+static volatile int requested;
+static volatile int restart;
+
+// Job state
+static int idleMs;
+static int parked;
+
+// Written by the job, read in critical sections
+static park_state_t state;
+
+static void vParkStep();
+
+void vParkInit()
+{
+  vPeriodicInit(&job, "park", &vParkStep);
+  vPeriodicSetPeriod(&job, PARK_PERIOD_MS);
+}
+
+void vParkSetDelay(int delay_ms_)
+{
+  if (delay_ms_ < 0)
+    delay_ms_ = 0;
+  else if (delay_ms_ > PARK_MAX_DELAY_MS)
+    delay_ms_ = PARK_MAX_DELAY_MS;
+  delayMs = delay_ms_;
+}
+
+void vParkRequest(int park_)
+{
+  requested = park_;
+  if (!park_)
+    restart = 1;
+}
+
+int iParkIsParked()
+{
+  return state.parked;
+}
+
+void vParkGetState(park_state_t* state_)
+{
+  taskENTER_CRITICAL();
+  *state_ = state;
+  taskEXIT_CRITICAL();
+}
+
+static void prvParkApply(int park_)
+{
+  vSonarSetParkedInterval(park_ ? SONAR_PARKED_INTERVAL_MS : 0);
+  vAdcSetParked(park_);
+  vSharpsSetPower(!park_);
+}
+
+static void vParkStep()
+{
+  const int delay = delayMs;
+  const int was = parked;
+  motors_state_t motors;
+  int active;
+
+  vMotorsGetState(&motors);
+  active = motors.target_left || motors.target_right ||
+    motors.command_left || motors.command_right;
+#ifdef CLEANING
+  cleaning_state_t cleaning;
+
+  vCleaningGetState(&cleaning);
+  active = active || cleaning.duty[CLEANING_BRUSH] ||
+    cleaning.duty[CLEANING_FAN];
+#endif
+
+  if (restart)
+  {
+    restart = 0;
+    idleMs = 0;
+  }
+  if (active)
+  {
+    idleMs = 0;
+    requested = 0;
+  }
+  else if (idleMs < PARK_MAX_DELAY_MS)
+    idleMs += PARK_PERIOD_MS;
+
+  parked = !active &&
+    (requested || iHardwareGetProfile() == HARDWARE_DOCKED ||
+     (delay && idleMs >= delay));
+  if (parked != was)
+    prvParkApply(parked);
+
+  taskENTER_CRITICAL();
+  state.parked = parked;
+  state.delay_ms = delay;
+  state.idle_ms = idleMs;
+  if (parked)
+  {
+    if (!was)
+      state.parks++;
+    state.parked_ms += PARK_PERIOD_MS;
+  }
+  taskEXIT_CRITICAL();
+}
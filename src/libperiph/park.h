@@ -0,0 +1,33 @@
+#ifndef LIBPERIPH_PARK_H
+# define LIBPERIPH_PARK_H
+
+#include <stdint.h>
+
+// Parked mode, against the idle drain: the sonars ping at
+// SONAR_PARKED_INTERVAL_MS, the ADC scans at ADC_PARKED_RATE_HZ and the
+// sharps are off (with --sharps-switch). Entered once the motors (and
+// the cleaning channels) have been idle for the delay set, at once in
+// the docked profile or on request. Left as soon as a job run sees a
+// setpoint, within PARK_PERIOD_MS: the sharps then warm up and the sonar
+// medians fill again, the first measures within a parked interval.
+#define PARK_PERIOD_MS    20
+// 0 never parks on idle (default)
+#define PARK_MAX_DELAY_MS 600000
+
+typedef struct
+{
+  uint8_t parked;
+  uint32_t delay_ms;
+  uint32_t idle_ms;     // Since the last setpoint, up to the maximum
+  uint32_t parks;       // Times parked
+  uint32_t parked_ms;   // Time spent parked
+} park_state_t;
+
+void vParkInit();
+void vParkSetDelay(int delay_ms_);
+// Park now, until the next setpoint, or leave: the idle time restarts
+void vParkRequest(int park_);
+int iParkIsParked();
+void vParkGetState(park_state_t* state_);
+
+#endif /* LIBPERIPH_PARK_H */
@@ -0,0 +1,210 @@
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+
+#include "libglobal/fault.h"
+#include "libglobal/sysmon.h"
+
+#include "libperiph/cycles.h"
+#include "libperiph/hardware.h"
+#include "libperiph/periodic.h"
+
+#ifdef RATE_GROUPS
+typedef struct
+{
+  const char* name;
+  uint16_t period_ms;
+  uint32_t runs;
+  uint32_t max_cycles;
+  uint32_t overruns;
+} rate_group_t;
+
+// Periods in frames, a tick each: 1 ms at configTICK_RATE_HZ
+static rate_group_t groups[RATE_GROUPS_NB] =
+{
+  [RATE_1KHZ]  = { "1kHz", 1 },
+  [RATE_200HZ] = { "200Hz", 5 },
+  [RATE_50HZ]  = { "50Hz", 20 },
+  [RATE_10HZ]  = { "10Hz", 100 },
+};
+
+// In the order of their vPeriodicInit, the order of the runs
+static periodic_t* jobs[RATE_JOBS_MAX];
+static int jobsNb;
+
+static void prvPeriodicRunGroup(int group_)
+{
+  rate_group_t* group = &groups[group_];
+  const uint32_t start = uCyclesNow();
+  uint32_t cycles;
+
+  for (int i = 0; i < jobsNb; i++)
+  {
+    periodic_t* periodic = jobs[i];
+    const uint16_t divider = periodic->divider;
+
+    if (!divider || periodic->group != group_ ||
+        ++periodic->count < divider)
+      continue;
+    periodic->count = 0;
+
+    const uint32_t jobStart = uCyclesNow();
+    (*periodic->job)();
+    cycles = uCyclesNow() - jobStart;
+    periodic->runs++;
+    if (cycles > periodic->max_cycles)
+      periodic->max_cycles = cycles;
+  }
+
+  cycles = uCyclesNow() - start;
+  group->runs++;
+  if (cycles > group->max_cycles)
+    group->max_cycles = cycles;
+  if (cycles > RATE_BUDGET_US * CYCLES_PER_US)
+    group->overruns++;
+}
+
+// Minor frames on the kernel tick: late by a whole frame, the missed
+// ones are run back to back, the phases stay
+static void prvPeriodicTask(void* pvParameters_)
+{
+  portTickType wake = xTaskGetTickCount();
+  uint32_t frame = 0;
+
+  vSysmonRegisterTask("rgd");
+
+  for (;;)
+  {
+    vTaskDelayUntil(&wake, 1);
+    frame++;
+    // Group g in the frames g modulo its period
+    for (int g = 0; g < RATE_GROUPS_NB; g++)
+      if (frame % groups[g].period_ms == (uint32_t)g % groups[g].period_ms)
+        prvPeriodicRunGroup(g);
+  }
+}
+
+void vPeriodicInit(periodic_t* periodic_, const char* name_,
+                   pfunPeriodic job_)
+{
+  // The first job starts the executive, at the priority of the timer
+  // service task it stands in for
+  if (!jobsNb &&
+      xTaskCreate(prvPeriodicTask, (const signed char * const)"rgd",
+                  RATE_STACK_SIZE, NULL, configTIMER_TASK_PRIORITY,
+                  NULL) != pdPASS)
+    vFaultAllocation("rgd");
+  if (jobsNb == RATE_JOBS_MAX)
+    vFaultAllocation(name_);
+
+  periodic_->name = name_;
+  periodic_->job = job_;
+  periodic_->divider = 0;
+  periodic_->runs = 0;
+  periodic_->max_cycles = 0;
+  taskENTER_CRITICAL();
+  jobs[jobsNb++] = periodic_;
+  taskEXIT_CRITICAL();
+}
+
+void vPeriodicSetPeriod(periodic_t* periodic_, int period_ms_)
+{
+  int group = RATE_GROUPS_NB - 1;
+
+  if (period_ms_ <= 0)
+  {
+    periodic_->divider = 0;
+    return;
+  }
+  // The slowest group the period is a multiple of, 1 kHz at least
+  while (group && period_ms_ % groups[group].period_ms)
+    group--;
+
+  taskENTER_CRITICAL();
+  periodic_->group = group;
+  periodic_->count = 0;
+  periodic_->divider = period_ms_ / groups[group].period_ms;
+  taskEXIT_CRITICAL();
+}
+
+int iPeriodicGetStats(periodic_group_stats_t* groups_,
+                      periodic_job_stats_t* jobs_, int n_)
+{
+  int i;
+
+  taskENTER_CRITICAL();
+  for (i = 0; i < RATE_GROUPS_NB; i++)
+  {
+    groups_[i].name = groups[i].name;
+    groups_[i].runs = groups[i].runs;
+    groups_[i].max_us = groups[i].max_cycles / CYCLES_PER_US;
+    groups_[i].overruns = groups[i].overruns;
+  }
+  for (i = 0; i < jobsNb && i < n_; i++)
+  {
+    const periodic_t* periodic = jobs[i];
+
+    jobs_[i].name = periodic->name;
+    jobs_[i].group = periodic->group;
+    jobs_[i].period_ms =
+      periodic->divider * groups[periodic->group].period_ms;
+    jobs_[i].runs = periodic->runs;
+    jobs_[i].max_us = periodic->max_cycles / CYCLES_PER_US;
+  }
+  taskEXIT_CRITICAL();
+  return i;
+}
+
+void vPeriodicResetStats()
+{
+  taskENTER_CRITICAL();
+  for (int i = 0; i < RATE_GROUPS_NB; i++)
+  {
+    groups[i].runs = 0;
+    groups[i].max_cycles = 0;
+    groups[i].overruns = 0;
+  }
+  for (int i = 0; i < jobsNb; i++)
+  {
+    jobs[i]->runs = 0;
+    jobs[i]->max_cycles = 0;
+  }
+  taskEXIT_CRITICAL();
+}
+#else
+static void prvPeriodicRun(xTimerHandle timer_)
+{
+  static int registered;
+  periodic_t* periodic = pvTimerGetTimerID(timer_);
+
+  // The service task is the kernel's, its first job names it
+  if (!registered)
+  {
+    vSysmonRegisterTask("timerd");
+    registered = 1;
+  }
+
+  (*periodic->job)();
+}
+
+void vPeriodicInit(periodic_t* periodic_, const char* name_,
+                   pfunPeriodic job_)
+{
+  periodic_->job = job_;
+  periodic_->timer = xTimerCreate((const signed char*)name_, 1, pdTRUE,
+                                  periodic_, &prvPeriodicRun);
+  if (!periodic_->timer)
+    vFaultAllocation(name_);
+}
+
+void vPeriodicSetPeriod(periodic_t* periodic_, int period_ms_)
+{
+  // Queued to the service task (configTIMER_QUEUE_LENGTH), no wait
+  if (period_ms_ <= 0)
+    xTimerStop(periodic_->timer, 0);
+  else
+    xTimerChangePeriod(periodic_->timer,
+                       MS_TO_TICKS(period_ms_) ? MS_TO_TICKS(period_ms_) : 1,
+                       0);
+}
+#endif
@@ -0,0 +1,87 @@
+#ifndef LIBPERIPH_PERIODIC_H
+# define LIBPERIPH_PERIODIC_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "timers.h"
+
+// Light periodic jobs, run one after the other by the kernel timer
+// service task ("timerd") instead of a task and a stack each. A job must
+// not block for long: the next ones would run late.
+//
+// With --rate-groups, a cyclic executive instead: the "rgd" task runs a
+// minor frame each kernel tick, the groups due in it fastest first, the
+// jobs of a group in the order of their vPeriodicInit. A period goes to
+// the slowest group it is a multiple of, every so many runs of the
+// group: the phase of a job to the others stays fixed. The slower groups
+// start one tick apart: no two of them share a frame, the 1 kHz one
+// aside.
+typedef void (*pfunPeriodic)();
+
+#ifdef RATE_GROUPS
+enum eRateGroup {
+  RATE_1KHZ,
+  RATE_200HZ,
+  RATE_50HZ,
+  RATE_10HZ,
+  RATE_GROUPS_NB
+};
+
+// Executive stack, in words: the jobs of the timer service task
+#ifndef RATE_STACK_SIZE
+# define RATE_STACK_SIZE configTIMER_TASK_STACK_DEPTH
+#endif
+
+// Longest run of a group in a frame, beyond it is an overrun
+#define RATE_BUDGET_US 500
+#define RATE_JOBS_MAX  12
+
+typedef struct
+{
+  const char* name;
+  pfunPeriodic job;
+  volatile uint8_t group;
+  volatile uint16_t divider;     // Runs of the group per run, 0 stopped
+  uint16_t count;
+  uint32_t runs;
+  uint32_t max_cycles;
+} periodic_t;
+
+typedef struct
+{
+  const char* name;
+  uint32_t runs;
+  uint32_t max_us;               // Of a run, all its jobs
+  uint32_t overruns;             // Runs over RATE_BUDGET_US
+} periodic_group_stats_t;
+
+typedef struct
+{
+  const char* name;
+  uint8_t group;                 // eRateGroup
+  uint16_t period_ms;            // 0 stopped
+  uint32_t runs;
+  uint32_t max_us;
+} periodic_job_stats_t;
+
+// Copy the RATE_GROUPS_NB groups, then up to n_ jobs in their order.
+// Returns the count of jobs.
+int iPeriodicGetStats(periodic_group_stats_t* groups_,
+                      periodic_job_stats_t* jobs_, int n_);
+void vPeriodicResetStats();
+#else
+typedef struct
+{
+  xTimerHandle timer;
+  pfunPeriodic job;
+} periodic_t;
+#endif
+
+// Stopped until a period is set, before or after the scheduler start
+void vPeriodicInit(periodic_t* periodic_, const char* name_,
+                   pfunPeriodic job_);
+// 0 stops, otherwise (re)starts: the first run is a period away
+void vPeriodicSetPeriod(periodic_t* periodic_, int period_ms_);
+
+#endif
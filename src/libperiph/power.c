@@ -0,0 +1,93 @@
+#include "stm32f10x_adc.h"
+#include "stm32f10x_gpio.h"
+
+#include "FreeRTOS.h"
+
+#include "libperiph/adc.h"
+#include "libperiph/motors.h"
+#include "libperiph/power.h"
+
+// Watchdog thresholds are conversions, the values filtered codes
+#define MV_TO_CODE(mv) (((mv) * ADC_MAX_VALUE) / POWER_VREF_MV)
+#define CODE_TO_MV(c)  (((c) * POWER_VREF_MV) / ADC_CODE_MAX)
+
+static int iPowerBatteryToMv(uint16_t code_);
+static int iPowerCurrentToMa(uint16_t code_);
+static void vPowerOvercurrent(int channel_);
+
+static const adc_channel_t battery =
+  {.GPIOx = GPIOC, .GPIO_Pin_x = GPIO_Pin_4, .ADC_Channel_x = ADC_Channel_14,
+   .ADC_SampleTime_x = ADC_SampleTime_71Cycles5, .convert = &iPowerBatteryToMv};
+
+// Short sample time: the sense voltage follows the PWM
+static const adc_channel_t current =
+  {.GPIOx = GPIOC, .GPIO_Pin_x = GPIO_Pin_2, .ADC_Channel_x = ADC_Channel_12,
+   .ADC_SampleTime_x = ADC_SampleTime_28Cycles5, .convert = &iPowerCurrentToMa};
+
+static int batteryChannel;
+static int currentChannel;
+static uint16_t currentLimit = MV_TO_CODE(POWER_DEFAULT_CURRENT_LIMIT_MA *
+                                          POWER_SENSE_MOHM / 1000);
+
+void vPowerInit()
+{
+  batteryChannel = iAdcRegisterChannel(&battery);
+  currentChannel = iAdcRegisterChannel(&current);
+}
+
+void vPowerStart()
+{
+  vAdcSetWatchdog(currentChannel, 0, currentLimit, &vPowerOvercurrent);
+}
+
+static int iPowerBatteryToMv(uint16_t code_)
+{
+  return CODE_TO_MV(code_) * POWER_BATTERY_DIVIDER;
+}
+
+static int iPowerCurrentToMa(uint16_t code_)
+{
+  return (CODE_TO_MV(code_) * 1000) / POWER_SENSE_MOHM;
+}
+
+int iPowerGetBatteryMv()
+{
+  return iAdcGetValue(batteryChannel);
+}
+
+int iPowerGetCurrentMa()
+{
+  return iAdcGetValue(currentChannel);
+}
+
+int iPowerIsBatteryLow()
+{
+  const int battery_mv = iPowerGetBatteryMv();
+
+  return battery_mv > POWER_NO_BATTERY_MV && battery_mv < POWER_LOW_BATTERY_MV;
+}
+
+void vPowerSetCurrentLimit(int limit_ma_)
+{
+  int code = MV_TO_CODE(limit_ma_ * POWER_SENSE_MOHM / 1000);
+
+  if (code >= ADC_MAX_VALUE)
+    code = ADC_MAX_VALUE - 1;
+  else if (code < 0)
+    code = 0;
+
+  currentLimit = code;
+  vAdcSetWatchdog(currentChannel, 0, currentLimit, &vPowerOvercurrent);
+}
+
+void vPowerResetFault()
+{
+  vAdcRearmWatchdog();
+  vMotorsEnable();
+}
+
+// Analog watchdog interrupt
+static void vPowerOvercurrent(int channel_)
+{
+  vMotorsCutOff();
+}
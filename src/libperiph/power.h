@@ -0,0 +1,38 @@
+#ifndef LIBPERIPH_POWER_H
+# define LIBPERIPH_POWER_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+// ADC full scale
+#define POWER_VREF_MV 3300
+// Battery divider ratio (R1 + R2) / R2
+#define POWER_BATTERY_DIVIDER 4
+// L298 sense resistor shared by both bridges
+#define POWER_SENSE_MOHM 500
+
+#define POWER_DEFAULT_CURRENT_LIMIT_MA 2000
+
+// Battery low below this, two Li-ion cells by default. Under
+// POWER_NO_BATTERY_MV the board runs from USB: not low.
+#ifndef POWER_LOW_BATTERY_MV
+# define POWER_LOW_BATTERY_MV 6800
+#endif
+#define POWER_NO_BATTERY_MV 3000
+
+// Register the battery and current channels, before vAdcStart()
+void vPowerInit();
+// Arm the overcurrent cut off, after vAdcStart()
+void vPowerStart();
+
+int iPowerGetBatteryMv();
+int iPowerGetCurrentMa();
+int iPowerIsBatteryLow();
+
+// Motors are cut off as soon as a single conversion exceeds the limit
+void vPowerSetCurrentLimit(int limit_ma_);
+// Re-arm the cut off and restart the motors after an overcurrent
+void vPowerResetFault();
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef LIBPERIPH_PRIORITIES_H
+# define LIBPERIPH_PRIORITIES_H
+
+// All the task and interrupt priorities, in one place. Plain numbers,
+// FreeRTOSConfig.h includes this file.
+
+// Tasks, 0 (idle) to configMAX_PRIORITIES - 1: the control loop
+// preempts everything, then the sensors, the host links, and the shell
+// last.
+#define PRIORITY_MOTORS      4 // 1 to 5 ms loop, see "mj" with --profile
+#define PRIORITY_SENSORS     3 // imud, sonard
+#define PRIORITY_COMMS       2 // eventd, timerd (telemetry, register file)
+#define PRIORITY_INTERPRETER 1 // Console and binary protocol frames
+#define PRIORITY_BLACKBOX    1 // blackboxd, flash writes in the slack
+#define PRIORITY_SDCARD      1 // sdlogd, card writes (--sdcard)
+
+// Co-routines (--coroutines), 0 to configMAX_CO_ROUTINE_PRIORITIES - 1:
+// the low rate daemons in the idle task, on its stack, instead of their
+// tasks. The daemon priorities above are then unused.
+#define CO_PRIORITY_SONAR    1 // Pings timed, the echoes by the capture
+#define CO_PRIORITY_EVENTS   1 // Bumper edges to the host
+#define CO_PRIORITY_BLACKBOX 0 // Flash writes
+#define CO_ROUTINES_NB       3
+
+// Interrupts, NVIC preemption priorities with NVIC_PriorityGroup_3: 0
+// highest to 7. From IRQ_PRIORITY_KERNEL_MAX down, the handlers may use
+// the FromISR API and are masked by the kernel critical sections.
+#define IRQ_PRIORITY_KERNEL_MAX  5 // configMAX_SYSCALL_INTERRUPT_PRIORITY
+#define IRQ_PRIORITY_OVERCURRENT 2 // ADC watchdog, never masked
+#define IRQ_PRIORITY_MOTORS      5 // TIM2 update, control loop trigger
+#define IRQ_PRIORITY_ENCODERS    5
+#define IRQ_PRIORITY_BUMPERS     5 // Cut the motors off on contact
+#define IRQ_PRIORITY_SONAR       6 // Echo timing
+#define IRQ_PRIORITY_ADC         6 // Filtering DMA
+#define IRQ_PRIORITY_I2C_MASTER  6 // On-board sensors bus
+#define IRQ_PRIORITY_SPI         6 // Pi frames, checked before the next one
+#define IRQ_PRIORITY_CAN         6 // Boards network, 3 frames FIFO
+#define IRQ_PRIORITY_LATENCY     6 // Loopback edge (--latency), as the sonar
+#define IRQ_PRIORITY_I2C_SLAVE   7 // Register file, the host link
+#define IRQ_PRIORITY_UART        7 // Console, the host link
+#define IRQ_PRIORITY_USB         7 // Virtual COM port, the host link
+#define IRQ_PRIORITY_CRC         7 // Memory to memory DMA, a task waits
+#define IRQ_PRIORITY_SDCARD      7 // Card block DMA (--sdcard), sdlogd waits
+// The kernel tick and context switch are the lowest, 7
+
+#endif /* LIBPERIPH_PRIORITIES_H */
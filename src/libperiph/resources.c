@@ -0,0 +1,57 @@
+#include <string.h>
+
+#include "libglobal/fault.h"
+
+#include "libperiph/resources.h"
+
+static const char* const names[RESOURCES_NB] =
+{
+  [RESOURCE_DMA1_CH1]     = "dma1.1",
+  [RESOURCE_DMA1_CH2]     = "dma1.2",
+  [RESOURCE_DMA1_CH3]     = "dma1.3",
+  [RESOURCE_DMA1_CH4]     = "dma1.4",
+  [RESOURCE_DMA1_CH5]     = "dma1.5",
+  [RESOURCE_DMA1_CH6]     = "dma1.6",
+  [RESOURCE_DMA1_CH7]     = "dma1.7",
+  [RESOURCE_TIM1]         = "tim1",
+  [RESOURCE_TIM2]         = "tim2",
+  [RESOURCE_TIM3]         = "tim3",
+  [RESOURCE_TIM4]         = "tim4",
+  [RESOURCE_REMAP_I2C1]   = "remap.i2c1",
+  [RESOURCE_REMAP_USART3] = "remap.uart3",
+  [RESOURCE_REMAP_TIM3]   = "remap.tim3",
+  [RESOURCE_REMAP_SPI1]   = "remap.spi1",
+  [RESOURCE_REMAP_SWJ]    = "remap.swj",
+};
+
+static const char* owners[RESOURCES_NB];
+static const char* conflicts[RESOURCES_NB];
+
+int xResourceClaim(int resource_, const char* owner_)
+{
+  if (!owners[resource_])
+    owners[resource_] = owner_;
+  else if (strcmp(owners[resource_], owner_))
+  {
+    if (!conflicts[resource_])
+      conflicts[resource_] = owner_;
+    vFaultResource(names[resource_]);
+    return 0;
+  }
+  return 1;
+}
+
+const char* pcResourceName(int resource_)
+{
+  return names[resource_];
+}
+
+const char* pcResourceOwner(int resource_)
+{
+  return owners[resource_];
+}
+
+const char* pcResourceConflict(int resource_)
+{
+  return conflicts[resource_];
+}
@@ -0,0 +1,39 @@
+#ifndef LIBPERIPH_RESOURCES_H
+# define LIBPERIPH_RESOURCES_H
+
+// Hardware shared between the drivers, claimed by each one at its init:
+// the DMA1 channels, the timers and the AFIO remaps. The build options
+// keep the known pairs apart (MOTORS_PWM_DMA, CRC_DMA, SDCARD); the
+// registry catches the others at boot. A claim on a resource held by
+// another driver is refused and recorded as a FAULT_RESOURCE fault: the
+// board still boots, blinks it and "res" shows both owners.
+enum eResource {
+  RESOURCE_DMA1_CH1,
+  RESOURCE_DMA1_CH2,
+  RESOURCE_DMA1_CH3,
+  RESOURCE_DMA1_CH4,
+  RESOURCE_DMA1_CH5,
+  RESOURCE_DMA1_CH6,
+  RESOURCE_DMA1_CH7,
+  RESOURCE_TIM1,
+  RESOURCE_TIM2,
+  RESOURCE_TIM3,
+  RESOURCE_TIM4,
+  RESOURCE_REMAP_I2C1,
+  RESOURCE_REMAP_USART3,
+  RESOURCE_REMAP_TIM3,
+  RESOURCE_REMAP_SPI1,
+  RESOURCE_REMAP_SWJ,    // JTAG off, its pins to the peripherals
+  RESOURCES_NB
+};
+
+// From the inits, before the scheduler. owner_ is kept, a literal. 1 if
+// free or already held by owner_, else 0 and the conflict recorded.
+int xResourceClaim(int resource_, const char* owner_);
+const char* pcResourceName(int resource_);
+// NULL when free
+const char* pcResourceOwner(int resource_);
+// First owner refused, NULL without a conflict
+const char* pcResourceConflict(int resource_);
+
+#endif /* LIBPERIPH_RESOURCES_H */
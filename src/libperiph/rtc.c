@@ -0,0 +1,278 @@
+#include "stm32f10x.h"
+#include "stm32f10x_bkp.h"
+#include "stm32f10x_pwr.h"
+#include "stm32f10x_rcc.h"
+#include "stm32f10x_rtc.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libglobal/blackbox.h"
+
+#include "libperiph/periodic.h"
+#include "libperiph/rtc.h"
+#include "libperiph/timebase.h"
+
+// In BKP_DR1 once the clock runs: the other registers hold a schedule
+#define RTC_MAGIC 0x5257
+
+// 1 Hz counter from the 32768 Hz crystal
+#define RTC_PRESCALER 32767
+
+#define RTC_PERIOD_MS 250
+
+static periodic_t job;
+static pfunRtcStandby standbyHook;
+
+static int running;
+static int wake;
+static rtc_schedule_t schedule;
+
+// Job state: the end of the run of an alarm wake, the standby requested
+static volatile int runPending;
+static volatile portTickType runEnd;
+static volatile int standbyPending;
+static volatile portTickType standbyTick;
+
+static void vRtcStep();
+
+static void prvRtcSave()
+{
+  BKP_WriteBackupRegister(BKP_DR2, schedule.alarm & 0xffff);
+  BKP_WriteBackupRegister(BKP_DR3, schedule.alarm >> 16);
+  BKP_WriteBackupRegister(BKP_DR4, schedule.period_s & 0xffff);
+  BKP_WriteBackupRegister(BKP_DR5, schedule.period_s >> 16);
+  BKP_WriteBackupRegister(BKP_DR6, schedule.run_s);
+  BKP_WriteBackupRegister(BKP_DR7, (uint8_t)schedule.state);
+  BKP_WriteBackupRegister(BKP_DR8, schedule.wakes);
+  BKP_WriteBackupRegister(BKP_DR1, RTC_MAGIC);
+}
+
+static void prvRtcLoad()
+{
+  schedule.alarm = BKP_ReadBackupRegister(BKP_DR2) |
+    (uint32_t)BKP_ReadBackupRegister(BKP_DR3) << 16;
+  schedule.period_s = BKP_ReadBackupRegister(BKP_DR4) |
+    (uint32_t)BKP_ReadBackupRegister(BKP_DR5) << 16;
+  schedule.run_s = BKP_ReadBackupRegister(BKP_DR6);
+  schedule.state = (int8_t)BKP_ReadBackupRegister(BKP_DR7);
+  schedule.wakes = BKP_ReadBackupRegister(BKP_DR8);
+}
+
+// First power up: the backup domain from scratch, 0 without the crystal
+static int prvRtcStart()
+{
+  RCC_BackupResetCmd(ENABLE);
+  RCC_BackupResetCmd(DISABLE);
+
+  RCC_LSEConfig(RCC_LSE_ON);
+  for (int ms = 0; RCC_GetFlagStatus(RCC_FLAG_LSERDY) == RESET; ms++)
+  {
+    if (ms == RTC_LSE_TIMEOUT_MS)
+    {
+      RCC_LSEConfig(RCC_LSE_OFF);
+      return 0;
+    }
+    vTimeDelayUs(1000);
+  }
+  RCC_RTCCLKConfig(RCC_RTCCLKSource_LSE);
+  RCC_RTCCLKCmd(ENABLE);
+
+  RTC_WaitForSynchro();
+  RTC_WaitForLastTask();
+  RTC_SetPrescaler(RTC_PRESCALER);
+  RTC_WaitForLastTask();
+  return 1;
+}
+
+void vRtcInit()
+{
+  RCC_APB1PeriphClockCmd(RCC_APB1Periph_PWR | RCC_APB1Periph_BKP, ENABLE);
+  PWR_BackupAccessCmd(ENABLE);
+
+  const int standby = PWR_GetFlagStatus(PWR_FLAG_SB) == SET;
+  PWR_ClearFlag(PWR_FLAG_SB);
+  PWR_ClearFlag(PWR_FLAG_WU);
+  // PA0 a plain pin again
+  PWR_WakeUpPinCmd(DISABLE);
+
+  vPeriodicInit(&job, "rtc", &vRtcStep);
+
+  if (BKP_ReadBackupRegister(BKP_DR1) == RTC_MAGIC &&
+      RCC_GetFlagStatus(RCC_FLAG_LSERDY) == SET)
+  {
+    // The counter readable again after the reset
+    RTC_WaitForSynchro();
+    running = 1;
+    prvRtcLoad();
+    if (!standby)
+      wake = RTC_WAKE_RESET;
+    else if (RTC_GetFlagStatus(RTC_FLAG_ALR) == SET)
+      wake = RTC_WAKE_ALARM;
+    else
+      wake = RTC_WAKE_PIN;
+    RTC_ClearFlag(RTC_FLAG_ALR);
+  }
+  else
+  {
+    wake = RTC_WAKE_POWER_ON;
+    running = prvRtcStart();
+    schedule.state = -1;
+  }
+  if (!running)
+    return;
+
+  if (wake == RTC_WAKE_ALARM || wake == RTC_WAKE_PIN)
+    schedule.wakes++;
+  if (wake == RTC_WAKE_ALARM)
+  {
+    const uint32_t now = uRtcGetTime();
+
+    // The next alarm of the period, the missed ones skipped
+    if (schedule.period_s)
+      while (schedule.alarm <= now)
+        schedule.alarm += schedule.period_s;
+    else
+      schedule.alarm = 0;
+    if (schedule.run_s)
+    {
+      runEnd = xTaskGetTickCount() +
+        schedule.run_s * (1000 / portTICK_RATE_MS);
+      runPending = 1;
+      vPeriodicSetPeriod(&job, RTC_PERIOD_MS);
+    }
+  }
+  prvRtcSave();
+}
+
+int iRtcIsRunning()
+{
+  return running;
+}
+
+int iRtcGetWake()
+{
+  return wake;
+}
+
+uint32_t uRtcGetTime()
+{
+  uint32_t a, b;
+
+  if (!running)
+    return 0;
+  // The two halves agree across a carry on the second read
+  do
+  {
+    a = RTC_GetCounter();
+    b = RTC_GetCounter();
+  }
+  while (a != b);
+  return a;
+}
+
+void vRtcSetTime(uint32_t seconds_)
+{
+  if (!running)
+    return;
+  RTC_WaitForLastTask();
+  RTC_SetCounter(seconds_);
+  RTC_WaitForLastTask();
+}
+
+void vRtcGetSchedule(rtc_schedule_t* schedule_)
+{
+  taskENTER_CRITICAL();
+  *schedule_ = schedule;
+  taskEXIT_CRITICAL();
+}
+
+int xRtcSetSchedule(const rtc_schedule_t* schedule_)
+{
+  if (!running || (schedule_->alarm && schedule_->alarm <= uRtcGetTime()))
+    return 0;
+  taskENTER_CRITICAL();
+  const uint16_t wakes = schedule.wakes;
+  schedule = *schedule_;
+  schedule.wakes = wakes;
+  prvRtcSave();
+  taskEXIT_CRITICAL();
+  return 1;
+}
+
+void vRtcClearSchedule()
+{
+  taskENTER_CRITICAL();
+  schedule.alarm = 0;
+  schedule.period_s = 0;
+  schedule.run_s = 0;
+  schedule.state = -1;
+  if (running)
+    prvRtcSave();
+  runPending = 0;
+  taskEXIT_CRITICAL();
+}
+
+void vRtcOnStandby(pfunRtcStandby hook_)
+{
+  standbyHook = hook_;
+}
+
+static void prvRtcRequestStandby()
+{
+  const uint32_t alarm = schedule.alarm;
+  const uint32_t now = uRtcGetTime();
+
+  if (standbyHook)
+    standbyHook();
+  vBlackboxLog(BLACKBOX_STANDBY, 0,
+               !alarm ? -1 :
+               (alarm - now) / 60 > 32767 ? 32767 : (alarm - now) / 60);
+  standbyTick = xTaskGetTickCount();
+  standbyPending = 1;
+  vPeriodicSetPeriod(&job, RTC_PERIOD_MS);
+}
+
+int xRtcStandby()
+{
+  if (!running || (schedule.alarm && schedule.alarm <= uRtcGetTime()))
+    return 0;
+  prvRtcRequestStandby();
+  return 1;
+}
+
+static void prvRtcEnterStandby()
+{
+  uint32_t alarm = schedule.alarm;
+
+  taskDISABLE_INTERRUPTS();
+  SysTick->CTRL = 0;
+
+  // Past while the black box flushed: soon instead of never
+  if (alarm && alarm <= uRtcGetTime() + 1)
+    alarm = uRtcGetTime() + 2;
+  RTC_WaitForLastTask();
+  RTC_SetAlarm(alarm ? alarm : 0xffffffff);
+  RTC_WaitForLastTask();
+  RTC_ClearFlag(RTC_FLAG_ALR);
+
+  PWR_WakeUpPinCmd(ENABLE);
+  PWR_ClearFlag(PWR_FLAG_WU);
+  // A pending interrupt lets the WFI through once
+  for (;;)
+    PWR_EnterSTANDBYMode();
+}
+
+static void vRtcStep()
+{
+  const portTickType now = xTaskGetTickCount();
+
+  if (runPending && (int32_t)(now - runEnd) >= 0)
+  {
+    runPending = 0;
+    prvRtcRequestStandby();
+  }
+  if (standbyPending &&
+      now - standbyTick >= RTC_STANDBY_DELAY_MS / portTICK_RATE_MS)
+    prvRtcEnterStandby();
+}
@@ -0,0 +1,66 @@
+#ifndef LIBPERIPH_RTC_H
+# define LIBPERIPH_RTC_H
+
+#include <stdint.h>
+
+// Real time clock (--rtc) on the 32.768 kHz crystal of PC14/PC15, in the
+// backup domain: the seconds go on through the resets and the standby,
+// as long as the board has power. The host sets the time, Unix seconds.
+//
+// Standby between scheduled runs: everything off but the RTC and the
+// backup registers, woken by the alarm or a rising edge on the WKUP pin
+// (PA0). The wake is a reset: the RAM is lost, the schedule comes back
+// from the backup registers. An alarm wake arms the next alarm of the
+// period, and goes back to standby run_s later. The LSE is already up
+// then: no wait for the crystal, only on the first power up.
+
+// The crystal starts within a second or two, give up beyond
+#define RTC_LSE_TIMEOUT_MS 3000
+// From the request to the standby: the black box flushes meanwhile, the
+// last replies go out
+#define RTC_STANDBY_DELAY_MS 1000
+
+enum eRtcWake {
+  RTC_WAKE_POWER_ON = 0, // Backup domain lost: the clock starts again at 0
+  RTC_WAKE_RESET    = 1, // Any other reset, the clock kept
+  RTC_WAKE_ALARM    = 2,
+  RTC_WAKE_PIN      = 3,
+};
+
+// In the backup registers
+typedef struct
+{
+  uint32_t alarm;     // RTC time of the next wake, 0 on the wake pin only
+  uint32_t period_s;  // Between the alarms, 0 for once
+  uint16_t run_s;     // Back to standby this long after an alarm wake, 0
+                      // stays up
+  int8_t state;       // Behaviour state entered on an alarm wake, -1 none
+  uint16_t wakes;     // From the standby so far
+} rtc_schedule_t;
+
+// Called before the standby, to stop what moves, from the task asking it
+// or the timer service task: must not block
+typedef void (*pfunRtcStandby)();
+
+// Early in the init, before the scheduler: waits for the crystal on the
+// first power up only
+void vRtcInit();
+// 0 when the crystal never started: no time, no standby
+int iRtcIsRunning();
+int iRtcGetWake();
+
+uint32_t uRtcGetTime();
+void vRtcSetTime(uint32_t seconds_);
+
+void vRtcGetSchedule(rtc_schedule_t* schedule_);
+// The wakes count is kept. 0 on an alarm already past.
+int xRtcSetSchedule(const rtc_schedule_t* schedule_);
+// No alarm, no run: stays up
+void vRtcClearSchedule();
+
+void vRtcOnStandby(pfunRtcStandby hook_);
+// Standby in RTC_STANDBY_DELAY_MS, until the alarm of the schedule or
+// the wake pin. 0 without the clock or on an alarm already past.
+int xRtcStandby();
+
+#endif /* LIBPERIPH_RTC_H */
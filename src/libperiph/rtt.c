@@ -0,0 +1,242 @@
+#include <stdarg.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+
+#include "libglobal/fault.h"
+#include "libglobal/format.h"
+
+#include "libperiph/link.h"
+#include "libperiph/rtt.h"
+
+// The probe reads the bytes once the index says so
+#define RTT_MEMORY_BARRIER() __asm volatile ("dmb" ::: "memory")
+
+#define RTT_POLL_TICKS    (RTT_POLL_MS / portTICK_RATE_MS ? \
+                           RTT_POLL_MS / portTICK_RATE_MS : 1)
+#define RTT_TIMEOUT_TICKS (RTT_TX_TIMEOUT_MS / portTICK_RATE_MS)
+
+// SEGGER RTT layout, read by the host: the producer moves wr, the
+// consumer rd, both empty when equal
+typedef struct
+{
+  const char* name;
+  char* buffer;
+  uint32_t size;
+  volatile uint32_t wr;
+  volatile uint32_t rd;
+  uint32_t flags;                // Mode when full, 0 skips
+} rtt_buffer_t;
+
+typedef struct
+{
+  char id[16];
+  int32_t up_nb;
+  int32_t down_nb;
+  rtt_buffer_t up[RTT_UP_NB];
+  rtt_buffer_t down[RTT_DOWN_NB];
+} rtt_control_t;
+
+typedef struct
+{
+  char s[RTT_LOG_LINE_MAX];
+  int n;
+} rtt_line_t;
+
+static rtt_control_t control;
+static char terminalBuffer[RTT_TERMINAL_SIZE];
+static char logBuffer[RTT_LOG_SIZE];
+static char downBuffer[RTT_DOWN_SIZE];
+
+static xSemaphoreHandle xRttTxMutex;
+static uint32_t logDropped;
+
+static void prvRttBuffer(rtt_buffer_t* buffer_, const char* name_,
+                         char* data_, uint32_t size_)
+{
+  buffer_->name = name_;
+  buffer_->buffer = data_;
+  buffer_->size = size_;
+  buffer_->wr = 0;
+  buffer_->rd = 0;
+  buffer_->flags = 0;
+}
+
+void vRttInit()
+{
+  xRttTxMutex = xSemaphoreCreateMutex();
+  if (!xRttTxMutex)
+    vFaultAllocation("rtt");
+
+  control.up_nb = RTT_UP_NB;
+  control.down_nb = RTT_DOWN_NB;
+  prvRttBuffer(&control.up[RTT_UP_TERMINAL], "Terminal", terminalBuffer,
+               RTT_TERMINAL_SIZE);
+  prvRttBuffer(&control.up[RTT_UP_LOG], "Log", logBuffer, RTT_LOG_SIZE);
+  prvRttBuffer(&control.down[0], "Terminal", downBuffer, RTT_DOWN_SIZE);
+  // The ID last: the host takes the block as soon as it finds it
+  RTT_MEMORY_BARRIER();
+  memcpy(control.id, RTT_ID, sizeof (RTT_ID));
+}
+
+static uint32_t prvRttRoom(const rtt_buffer_t* buffer_)
+{
+  const uint32_t rd = buffer_->rd;
+  const uint32_t wr = buffer_->wr;
+
+  return rd > wr ? rd - wr - 1 : buffer_->size - wr + rd - 1;
+}
+
+// The room checked: in two spans across the end
+static void prvRttPut(rtt_buffer_t* buffer_, const char* s_, uint32_t size_)
+{
+  uint32_t wr = buffer_->wr;
+  const uint32_t first = buffer_->size - wr < size_ ?
+    buffer_->size - wr : size_;
+
+  memcpy(buffer_->buffer + wr, s_, first);
+  memcpy(buffer_->buffer, s_ + first, size_ - first);
+  wr += size_;
+  if (wr >= buffer_->size)
+    wr -= buffer_->size;
+  RTT_MEMORY_BARRIER();
+  buffer_->wr = wr;
+}
+
+// Under the lock: waits for room by pieces, until the deadline
+static int prvRttWrite(const char* s_, int size_, portTickType ticks_)
+{
+  rtt_buffer_t* buffer = &control.up[RTT_UP_TERMINAL];
+  const portTickType start = xTaskGetTickCount();
+
+  while (size_ > 0)
+  {
+    uint32_t n = prvRttRoom(buffer);
+
+    if (!n)
+    {
+      if (xTaskGetTickCount() - start >= ticks_)
+        return 0;
+      vTaskDelay(RTT_POLL_TICKS);
+      continue;
+    }
+    if (n > (uint32_t)size_)
+      n = size_;
+    prvRttPut(buffer, s_, n);
+    s_ += n;
+    size_ -= n;
+  }
+  return 1;
+}
+
+void vRttSendMessage(const char* s_, int size_)
+{
+  xSemaphoreTake(xRttTxMutex, portMAX_DELAY);
+  prvRttWrite(s_, size_, RTT_TIMEOUT_TICKS);
+  xSemaphoreGive(xRttTxMutex);
+}
+
+static int prvRttTrySendMessage(const char* s_, int size_, int timeout_ms_)
+{
+  const portTickType start = xTaskGetTickCount();
+  const portTickType ticks = timeout_ms_ / portTICK_RATE_MS;
+  rtt_buffer_t* buffer = &control.up[RTT_UP_TERMINAL];
+  int sent = 0;
+
+  if (size_ >= RTT_TERMINAL_SIZE ||
+      xSemaphoreTake(xRttTxMutex, ticks) != pdTRUE)
+    return 0;
+  // Whole or nothing: the room for all of it first
+  for (;;)
+  {
+    if (prvRttRoom(buffer) >= (uint32_t)size_)
+    {
+      prvRttPut(buffer, s_, size_);
+      sent = 1;
+      break;
+    }
+    if (xTaskGetTickCount() - start >= ticks)
+      break;
+    vTaskDelay(RTT_POLL_TICKS);
+  }
+  xSemaphoreGive(xRttTxMutex);
+  return sent;
+}
+
+int xRttReadAvailable(char* buf_, int size_)
+{
+  rtt_buffer_t* buffer = &control.down[0];
+  uint32_t rd, wr;
+  int n = 0;
+
+  while ((wr = buffer->wr) == (rd = buffer->rd))
+    vTaskDelay(RTT_POLL_TICKS);
+
+  while (rd != wr && n < size_)
+  {
+    buf_[n++] = buffer->buffer[rd];
+    if (++rd == buffer->size)
+      rd = 0;
+  }
+  RTT_MEMORY_BARRIER();
+  buffer->rd = rd;
+  return n;
+}
+
+void vRttFlush()
+{
+  const rtt_buffer_t* buffer = &control.up[RTT_UP_TERMINAL];
+  const portTickType start = xTaskGetTickCount();
+
+  while (buffer->rd != buffer->wr &&
+         xTaskGetTickCount() - start < RTT_TIMEOUT_TICKS)
+    vTaskDelay(RTT_POLL_TICKS);
+}
+
+static void prvRttLinePutc(void* ctx_, char c_)
+{
+  rtt_line_t* line = ctx_;
+
+  if (line->n < RTT_LOG_LINE_MAX - 1)
+    line->s[line->n++] = c_;
+}
+
+void vRttLogf(const char* fmt_, ...)
+{
+  rtt_buffer_t* buffer = &control.up[RTT_UP_LOG];
+  rtt_line_t line = { .n = 0 };
+  unsigned portBASE_TYPE mask;
+  va_list args;
+
+  if (!buffer->size)
+    return;
+  // Formatted aside, only the copy under the mask
+  va_start(args, fmt_);
+  iFormat(&prvRttLinePutc, &line, fmt_, args);
+  va_end(args);
+  line.s[line.n++] = '\n';
+
+  mask = portSET_INTERRUPT_MASK_FROM_ISR();
+  if (prvRttRoom(buffer) >= (uint32_t)line.n)
+    prvRttPut(buffer, line.s, line.n);
+  else
+    logDropped++;
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+uint32_t uRttLogDropped()
+{
+  return logDropped;
+}
+
+const link_t xRttLink =
+  {
+    .name = "rtt",
+    .init = vRttInit,
+    .read_available = xRttReadAvailable,
+    .write = vRttSendMessage,
+    .try_write = prvRttTrySendMessage,
+    .flush = vRttFlush,
+  };
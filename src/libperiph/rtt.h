@@ -0,0 +1,51 @@
+#ifndef LIBPERIPH_RTT_H
+# define LIBPERIPH_RTT_H
+
+#include <stdint.h>
+
+// Debugger channels, with --rtt-link: rings in RAM that the probe reads
+// and writes while the core runs, at no cost to the target but the copy.
+// The control block has the layout of SEGGER RTT, so OpenOCD finds it by
+// its ID in the RAM and serves each channel on a TCP port (rtt_serve in
+// flash/openocd.cfg). The terminal is the host link ("waf monitor
+// --rtt"), the log one way.
+#define RTT_ID "SEGGER RTT"
+
+// Up (target to host) channels
+enum eRttUp {
+  RTT_UP_TERMINAL,
+  RTT_UP_LOG,
+  RTT_UP_NB
+};
+
+// Down channel, the terminal input
+#define RTT_DOWN_NB 1
+
+// Rings, one byte kept free
+#define RTT_TERMINAL_SIZE 512
+#define RTT_LOG_SIZE      256
+#define RTT_DOWN_SIZE     64
+
+// Nobody reads without a probe: the terminal writes that still find no
+// room after this long are dropped, as on a closed USB port
+#define RTT_TX_TIMEOUT_MS 50
+// The probe polls: so do we, for its writes and the room it makes
+#define RTT_POLL_MS 2
+
+// Log lines longer than this are cut
+#define RTT_LOG_LINE_MAX 96
+
+void vRttInit();
+// Whole message under the terminal lock, from tasks only
+void vRttSendMessage(const char* s_, int size_);
+int xRttReadAvailable(char* buf_, int size_);
+// Wait for the probe to read the terminal, RTT_TX_TIMEOUT_MS at most
+void vRttFlush();
+// Line to RTT_UP_LOG, iFormat syntax (libglobal/format.h), from the
+// tasks and the interrupts under IRQ_PRIORITY_KERNEL_MAX: whole or
+// dropped, never waits. Nothing before vRttInit.
+void vRttLogf(const char* fmt_, ...);
+// Log lines dropped on a full ring so far
+uint32_t uRttLogDropped();
+
+#endif /* LIBPERIPH_RTT_H */
@@ -0,0 +1,714 @@
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+
+#include "misc.h"
+#include "stm32f10x.h"
+#include "stm32f10x_gpio.h"
+#include "stm32f10x_spi.h"
+
+#include "libglobal/fault.h"
+#include "libglobal/flags.h"
+#include "libglobal/ring.h"
+
+#include "libperiph/hardware.h"
+#include "libperiph/link.h"
+#include "libperiph/priorities.h"
+#include "libperiph/resources.h"
+#include "libperiph/sdcard.h"
+
+#define SDCARD_SPIx       SPI2
+#define SDCARD_GPIOx      GPIOB
+#define SDCARD_SCK_Pin    GPIO_Pin_13
+#define SDCARD_MISO_Pin   GPIO_Pin_14
+#define SDCARD_MOSI_Pin   GPIO_Pin_15
+#define SDCARD_CS_GPIOx   GPIOD
+#define SDCARD_CS_Pin     GPIO_Pin_2
+
+// SPI2_RX and SPI2_TX DMA requests, those of USART1 TX and RX
+#define SDCARD_RX_DMA_CHANNEL DMA1_Channel4
+#define SDCARD_TX_DMA_CHANNEL DMA1_Channel5
+
+// APB1 at 36 MHz: 281 kHz for the identification (400 kHz at most), 18 MHz
+#define SDCARD_SLOW SPI_BaudRatePrescaler_128
+#define SDCARD_FAST SPI_BaudRatePrescaler_2
+
+#define SDCARD_DONE 0x01
+
+// Commands, the application ones after CMD55
+#define SD_ACMD             0x80
+#define SD_GO_IDLE_STATE    0
+#define SD_SEND_IF_COND     8
+#define SD_SEND_CSD         9
+#define SD_SET_BLOCKLEN     16
+#define SD_READ_BLOCK       17
+#define SD_WRITE_BLOCK      24
+#define SD_WRITE_MULTIPLE   25
+#define SD_APP_CMD          55
+#define SD_READ_OCR         58
+#define SD_SET_WR_ERASE     (SD_ACMD | 23)
+#define SD_SEND_OP_COND     (SD_ACMD | 41)
+
+#define SD_R1_IDLE          0x01
+#define SD_TOKEN_DATA       0xFE // Read, single write
+#define SD_TOKEN_MULTIPLE   0xFC
+#define SD_TOKEN_STOP       0xFD
+#define SD_DATA_ACCEPTED    0x05
+
+// Bytes polled before the daemon sleeps a tick, about 30 us at 18 MHz
+#define SDCARD_READY_SPINS  64
+#define SDCARD_INIT_MS      1000
+#define SDCARD_DMA_MS       100
+
+#define SDCARD_TICKS(ms_) ((ms_) / portTICK_RATE_MS ? (ms_) / portTICK_RATE_MS : 1)
+
+// Stream to the daemon; while not logging, the mount block buffer
+static uint8_t storage[SDCARD_RING_SIZE] __attribute__((aligned(4)));
+static ring_t ring;
+// Producers, and the state changes that reset the ring
+static xSemaphoreHandle xSdMutex;
+static flags_t done;
+
+static volatile uint8_t state;
+static volatile uint8_t formatPending;
+static volatile uint8_t servicePending;
+static volatile uint8_t flushPending;
+static uint8_t highCapacity;
+static uint16_t session;
+static uint32_t epoch;
+static uint32_t blocks;
+static uint32_t next;
+static uint32_t written;
+static uint32_t errors;
+
+static void vSdTask(void* pvParameters_);
+
+static void prvSdSpeed(uint16_t prescaler_)
+{
+  SPI_InitTypeDef SPI_InitStruct =
+    {
+      .SPI_Direction         = SPI_Direction_2Lines_FullDuplex,
+      .SPI_Mode              = SPI_Mode_Master,
+      .SPI_DataSize          = SPI_DataSize_8b,
+      .SPI_CPOL              = SPI_CPOL_Low,
+      .SPI_CPHA              = SPI_CPHA_1Edge,
+      .SPI_NSS               = SPI_NSS_Soft,
+      .SPI_BaudRatePrescaler = prescaler_,
+      .SPI_FirstBit          = SPI_FirstBit_MSB,
+      .SPI_CRCPolynomial     = 7,
+    };
+
+  SPI_Cmd(SDCARD_SPIx, DISABLE);
+  SPI_Init(SDCARD_SPIx, &SPI_InitStruct);
+  SPI_Cmd(SDCARD_SPIx, ENABLE);
+}
+
+void vSdInit()
+{
+  vRingInit(&ring, storage, SDCARD_RING_SIZE);
+  vFlagsInit(&done);
+  xSdMutex = xSemaphoreCreateMutex();
+  if (!xSdMutex)
+    vFaultAllocation("sdcard");
+
+  vSpiClockInit(SDCARD_SPIx);
+  vGpioClockInit(SDCARD_GPIOx);
+  vGpioClockInit(SDCARD_CS_GPIOx);
+  xResourceClaim(RESOURCE_DMA1_CH4, "sdcard");
+  xResourceClaim(RESOURCE_DMA1_CH5, "sdcard");
+  vDmaClockInit(DMA1);
+
+  GPIO_InitTypeDef GPIO_InitStruct =
+    {
+      .GPIO_Pin   = SDCARD_CS_Pin,
+      .GPIO_Speed = GPIO_Speed_50MHz,
+      .GPIO_Mode  = GPIO_Mode_Out_PP,
+    };
+  GPIO_SetBits(SDCARD_CS_GPIOx, SDCARD_CS_Pin);
+  GPIO_Init(SDCARD_CS_GPIOx, &GPIO_InitStruct);
+  GPIO_InitStruct.GPIO_Pin  = SDCARD_SCK_Pin | SDCARD_MOSI_Pin;
+  GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF_PP;
+  GPIO_Init(SDCARD_GPIOx, &GPIO_InitStruct);
+  // Floating while no card is selected
+  GPIO_InitStruct.GPIO_Pin  = SDCARD_MISO_Pin;
+  GPIO_InitStruct.GPIO_Mode = GPIO_Mode_IPU;
+  GPIO_Init(SDCARD_GPIOx, &GPIO_InitStruct);
+
+  SDCARD_RX_DMA_CHANNEL->CCR = 0;
+  SDCARD_RX_DMA_CHANNEL->CPAR = (uint32_t)&SDCARD_SPIx->DR;
+  SDCARD_TX_DMA_CHANNEL->CCR = 0;
+  SDCARD_TX_DMA_CHANNEL->CPAR = (uint32_t)&SDCARD_SPIx->DR;
+
+  // The end of the reception, the last byte clocked
+  NVIC_InitTypeDef NVIC_InitStructure =
+    {
+      .NVIC_IRQChannel = DMA1_Channel4_IRQn,
+      .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_SDCARD,
+      .NVIC_IRQChannelSubPriority = 0,
+      .NVIC_IRQChannelCmd = ENABLE,
+    };
+  NVIC_Init(&NVIC_InitStructure);
+
+  prvSdSpeed(SDCARD_SLOW);
+
+  state = SDCARD_MOUNTING;
+  if (xTaskCreate(vSdTask, (const signed char * const)"sdlogd",
+                  SDCARD_STACK_SIZE, NULL, PRIORITY_SDCARD,
+                  NULL) != pdPASS)
+    vFaultAllocation("sdlogd");
+}
+
+// SPI
+// ---
+
+static uint8_t prvSdByte(uint8_t out_)
+{
+  while (!(SDCARD_SPIx->SR & SPI_SR_TXE));
+  SDCARD_SPIx->DR = out_;
+  while (!(SDCARD_SPIx->SR & SPI_SR_RXNE));
+  return SDCARD_SPIx->DR;
+}
+
+// Both ways at once, so the reception tells when the last byte is out. A
+// NULL side sends 0xFF, or drops what comes in. 0 on timeout.
+static int prvSdDma(const uint8_t* tx_, uint8_t* rx_, uint16_t n_)
+{
+  static const uint8_t ones = 0xFF;
+  static uint8_t sink;
+
+  if (!n_)
+    return 1;
+  // Late completion of a transfer timed out
+  vFlagsClear(&done, SDCARD_DONE);
+  DMA1->IFCR = DMA_IFCR_CGIF4 | DMA_IFCR_CGIF5;
+  SDCARD_RX_DMA_CHANNEL->CMAR = (uint32_t)(rx_ ? rx_ : &sink);
+  SDCARD_RX_DMA_CHANNEL->CNDTR = n_;
+  SDCARD_RX_DMA_CHANNEL->CCR = (rx_ ? DMA_CCR4_MINC : 0) | DMA_CCR4_PL_1 |
+    DMA_CCR4_TCIE | DMA_CCR4_EN;
+  SDCARD_TX_DMA_CHANNEL->CMAR = (uint32_t)(tx_ ? tx_ : &ones);
+  SDCARD_TX_DMA_CHANNEL->CNDTR = n_;
+  SDCARD_TX_DMA_CHANNEL->CCR = (tx_ ? DMA_CCR5_MINC : 0) | DMA_CCR5_DIR |
+    DMA_CCR5_EN;
+  SDCARD_SPIx->CR2 = SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN;
+
+  const uint32_t bits =
+    uFlagsWait(&done, SDCARD_DONE, FLAGS_ANY, SDCARD_TICKS(SDCARD_DMA_MS));
+  SDCARD_SPIx->CR2 = 0;
+  SDCARD_RX_DMA_CHANNEL->CCR = 0;
+  SDCARD_TX_DMA_CHANNEL->CCR = 0;
+  return bits != 0;
+}
+
+// Zeroes out, by DMA pieces of a small constant
+static int prvSdZeroes(uint16_t n_)
+{
+  static const uint8_t zeroes[32];
+
+  while (n_)
+  {
+    const uint16_t count = n_ < sizeof (zeroes) ? n_ : sizeof (zeroes);
+
+    if (!prvSdDma(zeroes, NULL, count))
+      return 0;
+    n_ -= count;
+  }
+  return 1;
+}
+
+static void prvSdSelect()
+{
+  GPIO_ResetBits(SDCARD_CS_GPIOx, SDCARD_CS_Pin);
+}
+
+// A byte more: the card lets MISO go on the next clock only
+static void prvSdDeselect()
+{
+  GPIO_SetBits(SDCARD_CS_GPIOx, SDCARD_CS_Pin);
+  prvSdByte(0xFF);
+}
+
+// MISO high once the card is done programming. Polled by bytes for a
+// while, then by ticks.
+static int prvSdWaitReady(uint32_t ms_)
+{
+  const portTickType start = xTaskGetTickCount();
+
+  for (;;)
+  {
+    for (int i = 0; i < SDCARD_READY_SPINS; i++)
+      if (prvSdByte(0xFF) == 0xFF)
+        return 1;
+    if (xTaskGetTickCount() - start >= SDCARD_TICKS(ms_))
+      return 0;
+    vTaskDelay(1);
+  }
+}
+
+// Card protocol
+// -------------
+
+// The card left selected, for the rest of the answer. R1, 0xFF if none.
+static uint8_t prvSdCommand(uint8_t cmd_, uint32_t arg_)
+{
+  uint8_t r1;
+
+  if (cmd_ & SD_ACMD)
+  {
+    r1 = prvSdCommand(SD_APP_CMD, 0);
+    if (r1 > SD_R1_IDLE)
+      return r1;
+    cmd_ &= ~SD_ACMD;
+  }
+
+  prvSdDeselect();
+  prvSdSelect();
+  if (cmd_ != SD_GO_IDLE_STATE && !prvSdWaitReady(SDCARD_BUSY_MS))
+    return 0xFF;
+
+  prvSdByte(0x40 | cmd_);
+  prvSdByte(arg_ >> 24);
+  prvSdByte(arg_ >> 16);
+  prvSdByte(arg_ >> 8);
+  prvSdByte(arg_);
+  // The CRC only counts before the SPI mode is on, CMD8 included
+  prvSdByte(cmd_ == SD_GO_IDLE_STATE ? 0x95 :
+            cmd_ == SD_SEND_IF_COND ? 0x87 : 0x01);
+
+  for (int i = 0; i < 10; i++)
+    if (!((r1 = prvSdByte(0xFF)) & 0x80))
+      break;
+  return r1;
+}
+
+static uint32_t prvSdAddress(uint32_t block_)
+{
+  return highCapacity ? block_ : block_ * SDCARD_BLOCK_SIZE;
+}
+
+// Data block of a read: the token, then size_ bytes and the CRC
+static int prvSdReceive(uint8_t* data_, uint16_t size_)
+{
+  const portTickType start = xTaskGetTickCount();
+  uint8_t token;
+
+  while ((token = prvSdByte(0xFF)) == 0xFF)
+    if (xTaskGetTickCount() - start >= SDCARD_TICKS(SDCARD_DMA_MS))
+      return 0;
+  if (token != SD_TOKEN_DATA || !prvSdDma(NULL, data_, size_))
+    return 0;
+  prvSdByte(0xFF);
+  prvSdByte(0xFF);
+  return 1;
+}
+
+static int prvSdReadBlock(uint32_t block_, uint8_t* data_)
+{
+  const int ok = !prvSdCommand(SD_READ_BLOCK, prvSdAddress(block_)) &&
+    prvSdReceive(data_, SDCARD_BLOCK_SIZE);
+
+  prvSdDeselect();
+  return ok;
+}
+
+// Data block of a write: the token, head_, used_ bytes of the ring
+// (released), zeroes up to the block size, the CRC. 1 if accepted.
+static int prvSdSendBlock(uint8_t token_, const void* head_,
+                          uint16_t headSize_, uint16_t used_)
+{
+  uint16_t left = used_;
+
+  prvSdByte(token_);
+  if (!prvSdDma(head_, NULL, headSize_))
+    return 0;
+  while (left)
+  {
+    const uint8_t* span;
+    uint16_t n = uRingReadSpan(&ring, &span);
+
+    if (n > left)
+      n = left;
+    if (!prvSdDma(span, NULL, n))
+      return 0;
+    vRingRelease(&ring, n);
+    left -= n;
+  }
+  if (!prvSdZeroes(SDCARD_BLOCK_SIZE - headSize_ - used_))
+    return 0;
+  prvSdByte(0xFF);
+  prvSdByte(0xFF);
+  return (prvSdByte(0xFF) & 0x1F) == SD_DATA_ACCEPTED;
+}
+
+// Capacity in blocks from the CSD, version 1 or 2
+static uint32_t prvSdCapacity(const uint8_t* csd_)
+{
+  if (csd_[0] >> 6 == 1)
+    return (((uint32_t)(csd_[7] & 0x3F) << 16 | csd_[8] << 8 | csd_[9]) + 1)
+      << 10;
+
+  const uint32_t size = ((uint32_t)(csd_[6] & 0x03) << 10 | csd_[7] << 2 |
+                         csd_[8] >> 6) + 1;
+  const int mult = ((csd_[9] & 0x03) << 1 | csd_[10] >> 7) + 2;
+  const int length = csd_[5] & 0x0F;
+  return (size << mult) << (length - 9);
+}
+
+// Identification at the slow clock, then the fast one. 0 if no card.
+static int prvSdStart()
+{
+  const portTickType start = xTaskGetTickCount();
+  int version2 = 0;
+  uint8_t r[16];
+  uint8_t r1;
+
+  prvSdSpeed(SDCARD_SLOW);
+  GPIO_SetBits(SDCARD_CS_GPIOx, SDCARD_CS_Pin);
+  // 74 clocks at least, deselected, to wake it up
+  for (int i = 0; i < 10; i++)
+    prvSdByte(0xFF);
+
+  if (prvSdCommand(SD_GO_IDLE_STATE, 0) != SD_R1_IDLE)
+    goto failed;
+
+  // Version 2 echoes the check pattern; version 1 does not know CMD8
+  if (prvSdCommand(SD_SEND_IF_COND, 0x1AA) == SD_R1_IDLE)
+  {
+    for (int i = 0; i < 4; i++)
+      r[i] = prvSdByte(0xFF);
+    if (r[2] != 0x01 || r[3] != 0xAA)
+      goto failed;
+    version2 = 1;
+  }
+
+  while ((r1 = prvSdCommand(SD_SEND_OP_COND, version2 ? 1 << 30 : 0)))
+  {
+    if (r1 != SD_R1_IDLE || xTaskGetTickCount() - start >=
+        SDCARD_TICKS(SDCARD_INIT_MS))
+      goto failed;
+    vTaskDelay(SDCARD_TICKS(10));
+  }
+
+  highCapacity = 0;
+  if (version2)
+  {
+    if (prvSdCommand(SD_READ_OCR, 0))
+      goto failed;
+    for (int i = 0; i < 4; i++)
+      r[i] = prvSdByte(0xFF);
+    highCapacity = (r[0] & 0x40) != 0;
+  }
+  if (!highCapacity && prvSdCommand(SD_SET_BLOCKLEN, SDCARD_BLOCK_SIZE))
+    goto failed;
+
+  if (prvSdCommand(SD_SEND_CSD, 0) || !prvSdReceive(r, sizeof (r)))
+    goto failed;
+  blocks = prvSdCapacity(r);
+
+  prvSdDeselect();
+  prvSdSpeed(SDCARD_FAST);
+  return 1;
+
+failed:
+  prvSdDeselect();
+  return 0;
+}
+
+// Log
+// ---
+
+static int prvSdValid(const sdcard_block_t* block_)
+{
+  return block_->magic == SDCARD_MAGIC && block_->epoch == epoch;
+}
+
+// The end of the log, by its first invalid block, the log blocks all
+// valid before it. Reads into the storage, the ring not in use yet.
+static int prvSdFindEnd()
+{
+  const sdcard_block_t* block = (const sdcard_block_t*)storage;
+  uint32_t low = SDCARD_LOG_FIRST_BLOCK;
+  uint32_t high = blocks;
+
+  while (low < high)
+  {
+    const uint32_t middle = low + (high - low) / 2;
+
+    if (!prvSdReadBlock(middle, storage))
+      return 0;
+    if (prvSdValid(block))
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  next = low;
+
+  session = 1;
+  if (next > SDCARD_LOG_FIRST_BLOCK)
+  {
+    if (!prvSdReadBlock(next - 1, storage))
+      return 0;
+    session = block->session + 1;
+  }
+  return 1;
+}
+
+static int prvSdMount()
+{
+  const sdcard_format_t* format = (const sdcard_format_t*)storage;
+
+  if (!prvSdStart() || !prvSdReadBlock(0, storage))
+    return SDCARD_FAILED;
+  if (format->magic != SDCARD_FORMAT_MAGIC)
+    return SDCARD_UNFORMATTED;
+  epoch = format->epoch;
+  if (!prvSdFindEnd())
+    return SDCARD_FAILED;
+  written = 0;
+  return next < blocks ? SDCARD_LOGGING : SDCARD_FULL;
+}
+
+static int prvSdFormat()
+{
+  const sdcard_format_t format =
+    { .magic = SDCARD_FORMAT_MAGIC, .epoch = epoch + 1, .blocks = blocks };
+  int ok;
+
+  ok = !prvSdCommand(SD_WRITE_BLOCK, prvSdAddress(0)) &&
+    prvSdSendBlock(SD_TOKEN_DATA, &format, sizeof (format), 0) &&
+    prvSdWaitReady(SDCARD_BUSY_MS);
+  prvSdDeselect();
+  if (!ok)
+    return SDCARD_FAILED;
+  epoch = format.epoch;
+  next = SDCARD_LOG_FIRST_BLOCK;
+  session = 1;
+  written = 0;
+  return SDCARD_LOGGING;
+}
+
+// n_ blocks of the ring in one command, the card told to erase them
+// first. The last one partial if used_ is short of them.
+static int prvSdWriteLog(uint32_t n_, uint32_t used_)
+{
+  sdcard_block_t header =
+    { .magic = SDCARD_MAGIC, .epoch = epoch, .session = session };
+  uint32_t i;
+
+  if (prvSdCommand(SD_SET_WR_ERASE, n_) ||
+      prvSdCommand(SD_WRITE_MULTIPLE, prvSdAddress(next)))
+  {
+    prvSdDeselect();
+    return 0;
+  }
+  for (i = 0; i < n_; i++)
+  {
+    header.tick = xTaskGetTickCount();
+    header.used = used_ < SDCARD_PAYLOAD_SIZE ? used_ : SDCARD_PAYLOAD_SIZE;
+    if ((i && !prvSdWaitReady(SDCARD_BUSY_MS)) ||
+        !prvSdSendBlock(SD_TOKEN_MULTIPLE, &header, sizeof (header),
+                        header.used))
+      break;
+    used_ -= header.used;
+  }
+  // The blocks accepted are written even when the last one failed
+  next += i;
+  written += i;
+  const int ok = i == n_ && prvSdWaitReady(SDCARD_BUSY_MS);
+  prvSdByte(SD_TOKEN_STOP);
+  prvSdByte(0xFF);
+  prvSdWaitReady(SDCARD_BUSY_MS);
+  prvSdDeselect();
+  return ok;
+}
+
+// From the daemon, under the lock: the ring empty for the next logging
+static void prvSdSetState(int state_)
+{
+  xSemaphoreTake(xSdMutex, portMAX_DELAY);
+  state = state_;
+  vRingInit(&ring, storage, SDCARD_RING_SIZE);
+  xSemaphoreGive(xSdMutex);
+}
+
+// Whole blocks by bursts, a partial one once in a while or when all_
+static void prvSdLog(portTickType* flushed_, int all_)
+{
+  const uint32_t used = uRingUsed(&ring);
+  uint32_t n = used / SDCARD_PAYLOAD_SIZE;
+
+  if (!n && used && (all_ || flushPending ||
+                     xTaskGetTickCount() - *flushed_ >=
+                     SDCARD_TICKS(SDCARD_FLUSH_MS)))
+    n = 1;
+  if (n > SDCARD_BURST_BLOCKS)
+    n = SDCARD_BURST_BLOCKS;
+  if (n > blocks - next)
+    n = blocks - next;
+  if (!n)
+  {
+    flushPending = 0;
+    return;
+  }
+  *flushed_ = xTaskGetTickCount();
+  if (!prvSdWriteLog(n, used))
+  {
+    errors++;
+    prvSdSetState(SDCARD_FAILED);
+  }
+  else if (next >= blocks)
+    prvSdSetState(SDCARD_FULL);
+}
+
+static void vSdTask(void* pvParameters_)
+{
+  portTickType flushed = xTaskGetTickCount();
+
+  for (;;)
+  {
+    if (state == SDCARD_MOUNTING)
+      prvSdSetState(prvSdMount());
+    if (formatPending)
+    {
+      if (state != SDCARD_FAILED && state != SDCARD_SERVICE)
+      {
+        prvSdSetState(SDCARD_MOUNTING);
+        prvSdSetState(prvSdFormat());
+      }
+      formatPending = 0;
+    }
+    if (servicePending && state != SDCARD_SERVICE && state != SDCARD_FAILED)
+    {
+      // The log on the card up to now, then the card to xSdRead
+      while (state == SDCARD_LOGGING && uRingUsed(&ring))
+        prvSdLog(&flushed, 1);
+      if (state != SDCARD_FAILED)
+        prvSdSetState(SDCARD_SERVICE);
+    }
+    else if (!servicePending && state == SDCARD_SERVICE)
+    {
+      // A new session
+      prvSdSetState(SDCARD_MOUNTING);
+      continue;
+    }
+    if (state == SDCARD_FAILED)
+    {
+      vTaskDelay(SDCARD_TICKS(SDCARD_RETRY_MS));
+      prvSdSetState(SDCARD_MOUNTING);
+      continue;
+    }
+    vTaskDelay(SDCARD_TICKS(SDCARD_POLL_MS));
+    if (state == SDCARD_LOGGING)
+      prvSdLog(&flushed, 0);
+  }
+}
+
+void vSdGetStats(sdcard_stats_t* stats_)
+{
+  stats_->state = state;
+  stats_->high_capacity = highCapacity;
+  stats_->session = session;
+  stats_->blocks = blocks;
+  stats_->next = next;
+  stats_->written = written;
+  stats_->errors = errors;
+}
+
+int xSdFormat()
+{
+  if (state == SDCARD_MOUNTING || state == SDCARD_FAILED ||
+      state == SDCARD_SERVICE)
+    return 0;
+  formatPending = 1;
+  return 1;
+}
+
+int xSdService(int on_)
+{
+  const portTickType start = xTaskGetTickCount();
+
+  servicePending = on_;
+  while ((state == SDCARD_SERVICE) != on_)
+  {
+    if (xTaskGetTickCount() - start >= SDCARD_TICKS(SDCARD_INIT_MS))
+    {
+      servicePending = 0;
+      return 0;
+    }
+    vTaskDelay(SDCARD_TICKS(SDCARD_POLL_MS));
+  }
+  return 1;
+}
+
+int xSdRead(uint32_t block_, uint8_t* data_)
+{
+  if (state != SDCARD_SERVICE || block_ >= blocks)
+    return 0;
+  if (prvSdReadBlock(block_, data_))
+    return 1;
+  errors++;
+  return 0;
+}
+
+// Link
+// ----
+
+static int prvSdTryWrite(const char* s_, int size_, int timeout_ms_)
+{
+  const portTickType start = xTaskGetTickCount();
+  const portTickType ticks = timeout_ms_ / portTICK_RATE_MS;
+  int sent = 0;
+
+  if (size_ >= SDCARD_RING_SIZE ||
+      xSemaphoreTake(xSdMutex, ticks) != pdTRUE)
+    return 0;
+  // Whole or nothing: the room for all of it first
+  while (state == SDCARD_LOGGING)
+  {
+    if (uRingRoom(&ring) >= size_)
+    {
+      uRingWrite(&ring, s_, size_);
+      sent = 1;
+      break;
+    }
+    if (xTaskGetTickCount() - start >= ticks)
+      break;
+    vTaskDelay(1);
+  }
+  xSemaphoreGive(xSdMutex);
+  return sent;
+}
+
+static void prvSdWrite(const char* s_, int size_)
+{
+  prvSdTryWrite(s_, size_, SDCARD_BUSY_MS);
+}
+
+// Until the ring is on the card, the partial block included
+static void prvSdFlush()
+{
+  const portTickType start = xTaskGetTickCount();
+
+  flushPending = 1;
+  while (state == SDCARD_LOGGING && uRingUsed(&ring) &&
+         xTaskGetTickCount() - start < SDCARD_TICKS(SDCARD_BUSY_MS))
+    vTaskDelay(SDCARD_TICKS(SDCARD_POLL_MS));
+}
+
+const link_t xSdLogLink =
+  {
+    .name = "sdcard",
+    .init = vSdInit,
+    .write = prvSdWrite,
+    .try_write = prvSdTryWrite,
+    .flush = prvSdFlush,
+  };
+
+void DMA1_Channel4_IRQHandler()
+{
+  portBASE_TYPE reschedNeeded = pdFALSE;
+
+  DMA1->IFCR = DMA_IFCR_CGIF4;
+  SDCARD_RX_DMA_CHANNEL->CCR = 0;
+  vFlagsSetFromISR(&done, SDCARD_DONE, &reschedNeeded);
+  portEND_SWITCHING_ISR(reschedNeeded);
+}
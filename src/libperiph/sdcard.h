@@ -0,0 +1,102 @@
+#ifndef LIBPERIPH_SDCARD_H
+# define LIBPERIPH_SDCARD_H
+
+#include <stdint.h>
+
+// Telemetry log on the microSD card of the Olimexino (--sdcard), the
+// stream transport of the link (vLinkSetStream): the frames go to a RAM
+// ring, and the sdlogd daemon writes it out by whole blocks, several per
+// command, straight from the ring by DMA. SPI2 on PB13 (SCK), PB14
+// (MISO), PB15 (MOSI), PD2 (CS), 18 MHz once the card is up. Its DMA
+// channels are those of USART1: the host link is USB or RTT.
+//
+// No file system: the card is raw, a header block then the log blocks
+// one after the other from block 1, never overwritten. Each log block is
+// a header then up to SDCARD_PAYLOAD_SIZE bytes of the stream, the
+// frames as on the host link ("waf sdlog" reads them back). The blocks
+// of a format all carry its epoch: a new one ("sd 1") invalidates the
+// whole card at once. At mount, the end of the log is found by a binary
+// search on the valid blocks, and a new session starts there. Logging
+// stops when the card is full. A card without the format header is left
+// alone (it may hold a file system) until "sd 1".
+#define SDCARD_BLOCK_SIZE   512
+#define SDCARD_MAGIC        0x474C5753 // "SWLG"
+#define SDCARD_FORMAT_MAGIC 0x44535753 // "SWSD"
+
+// Log blocks from there on, block 0 the format header
+#define SDCARD_LOG_FIRST_BLOCK 1
+
+typedef struct
+{
+  uint32_t magic;       // SDCARD_FORMAT_MAGIC
+  uint32_t epoch;
+  uint32_t blocks;      // Of the card at the format
+} __attribute__((packed)) sdcard_format_t;
+
+typedef struct
+{
+  uint32_t magic;       // SDCARD_MAGIC
+  uint32_t epoch;       // Of the format: older blocks are stale
+  uint32_t tick;        // When written
+  uint16_t session;     // Boot count on this format, from 1
+  uint16_t used;        // Payload bytes, the rest zeroes
+} __attribute__((packed)) sdcard_block_t;
+
+#define SDCARD_PAYLOAD_SIZE (SDCARD_BLOCK_SIZE - sizeof (sdcard_block_t))
+
+// RAM ring of the stream, a power of 2: it holds the frames while the
+// card programs the previous burst, a few ms and up to a few hundred.
+// Also the block buffer of the mount.
+#ifndef SDCARD_RING_SIZE
+# define SDCARD_RING_SIZE 2048
+#endif
+// Blocks per multi-block write at most
+#define SDCARD_BURST_BLOCKS 8
+// The daemon looks at the ring this often
+#define SDCARD_POLL_MS      20
+// A partial block goes out after this long, the loss on a power cut
+#define SDCARD_FLUSH_MS     1000
+// Card busy (programming) for this long at most, else it is failed
+#define SDCARD_BUSY_MS      500
+// Mount tried again after a failure this long, for a card put in late
+#define SDCARD_RETRY_MS     2000
+
+// Daemon stack, in words
+#ifndef SDCARD_STACK_SIZE
+# define SDCARD_STACK_SIZE configMINIMAL_STACK_SIZE
+#endif
+
+enum eSdState {
+  SDCARD_MOUNTING,
+  SDCARD_LOGGING,
+  SDCARD_UNFORMATTED,   // No format header, see xSdFormat
+  SDCARD_FULL,
+  SDCARD_FAILED,        // No card, or it stopped answering
+  SDCARD_SERVICE,       // Not logging, read by xSdRead
+};
+
+typedef struct
+{
+  uint8_t state;        // eSdState
+  uint8_t high_capacity;
+  uint16_t session;
+  uint32_t blocks;      // Of the card
+  uint32_t next;        // Next log block
+  uint32_t written;     // Blocks this session
+  uint32_t errors;      // Commands and writes refused by the card
+} sdcard_stats_t;
+
+void vSdInit();
+void vSdGetStats(sdcard_stats_t* stats_);
+// New epoch on the card, by the daemon at its next poll: the log
+// restarts at its first block, and a card without the header gets it.
+// 0 if there is no card up.
+int xSdFormat();
+// Service mode on: the ring written out, the logging stopped and the
+// card left to xSdRead, raw (the format header included). Off: mounted
+// again, a new session. Waits for the daemon, 0 if there is no card up.
+int xSdService(int on_);
+// A block of the card in service mode, from one task: 0 on error
+int xSdRead(uint32_t block_, uint8_t* data_);
+
+#endif /* LIBPERIPH_SDCARD_H */
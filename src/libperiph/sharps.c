@@ -1,171 +1,219 @@
 #include "stm32f10x_adc.h"
-#include "stm32f10x_dma.h"
 #include "stm32f10x_gpio.h"
-#include "stm32f10x_rcc.h"
 
 #include "FreeRTOS.h"
 #include "task.h"
-#include "misc.h"
-#include "semphr.h"
 
+#include "libglobal/trig.h"
+
+#include "libperiph/adc.h"
 #include "libperiph/hardware.h"
 #include "libperiph/sharps.h"
 
-#define MAX_VOLT_MILI     3300
-#define ADC_MAX_VALUE     4096
-#define GET_VOLTAGE_MILI(V)  ((float)V * MAX_VOLT_MILI / (ADC_MAX_VALUE * 1000))
-
-#define AVERAGE_NB 10
-#define DMA_BUFFER_SIZE (AVERAGE_NB * SHARPS_NB)
+#ifdef SHARPS_SWITCH
+// High side switch of both supplies, on while high
+# define SHARPS_SUPPLY_GPIOx GPIOC
+# define SHARPS_SUPPLY_Pin   GPIO_Pin_11
+#endif
 
-static volatile uint16_t ADC_DMA_Buffer[DMA_BUFFER_SIZE] = {0};
+// Distance (mm) versus 12 bit conversion, one entry every 32 (~26 mV),
+// generated from the datasheet curve of calib/sharps.csv (CALIB_TABLES of
+// the wscript). -1 when out of range.
+#define TABLE_SHIFT 5
+#define TABLE_SIZE  ((ADC_MAX_VALUE >> TABLE_SHIFT) + 1)
+// Filtered codes, with the bits of the oversampling in the fraction
+#define CODE_SHIFT  (TABLE_SHIFT + ADC_OVERSAMPLE_BITS)
+#define CODE_STEP   (1 << CODE_SHIFT)
 
-static sharps_t sharps = { .ADCx = ADC1,
-                           .ADCs = {{.GPIOx = GPIOA, .GPIO_Pin_x = GPIO_Pin_6, .ADC_Channel_x = ADC_Channel_6},
-                                    {.GPIOx = GPIOC, .GPIO_Pin_x = GPIO_Pin_3, .ADC_Channel_x = ADC_Channel_13}},
-                           .DMAx = DMA1,
-                           .DMA_Channelx = DMA1_Channel1 };
+#include "calib/sharps_table.h"
 
-#define TABLE_SIZE 40
+// Fails to compile when the wscript and TABLE_SIZE disagree
+typedef char table_size_check_t[sizeof (table_dist_mm) ==
+                                TABLE_SIZE * sizeof (int16_t) ? 1 : -1];
 
-static float table_volt[TABLE_SIZE] = { 0.0, 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9,
-                                        1.0, 1.1, 1.2, 1.3, 1.4, 1.5, 1.6, 1.7, 1.8, 1.9,
-                                        2.0, 2.1, 2.2, 2.3, 2.4, 2.5, 2.6, 2.7, 2.8, 2.9,
-                                        3.0, 3.1, 3.2, 3.3, 3.4, 3.5, 3.6, 3.7, 3.8, 3.9 };
+static int prvSharpLeftToMm(uint16_t code_);
+static int prvSharpRightToMm(uint16_t code_);
 
-static float table_length[TABLE_SIZE] = { -1, -1, -1, 42.0, 32.5, 27.0, 22.0, 18.5, 16.0, 14.5,
-                                            12.5, 11.5, 10.5, 9.5, 8.4, 8.2, 7.9, 7.2, 6.7, 6.2,
-                                            6.0, 5.8, 5.6, 5.4, 5.1, 4.7, 4.3, 4, 3.9, 3.7,
-                                            3.6, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
+static const adc_channel_t sharps[SHARPS_NB] =
+  {
+    {.GPIOx = GPIOA, .GPIO_Pin_x = GPIO_Pin_6, .ADC_Channel_x = ADC_Channel_6,
+     .ADC_SampleTime_x = ADC_SampleTime_239Cycles5, .convert = &prvSharpLeftToMm},
+    {.GPIOx = GPIOC, .GPIO_Pin_x = GPIO_Pin_3, .ADC_Channel_x = ADC_Channel_13,
+     .ADC_SampleTime_x = ADC_SampleTime_239Cycles5, .convert = &prvSharpRightToMm}
+  };
+
+// Scan sequence index of each sharp
+static int sharpChannel[SHARPS_NB];
+
+// Supply, and since when
+static volatile int powered = 1;
+static volatile portTickType poweredAt;
+
+// Calibration of each sharp, both halves in one word so that a reader
+// never mixes two calibrations
+typedef union
+{
+  struct
+  {
+    int16_t gain;
+    int16_t offset_mm;
+  };
+  uint32_t word;
+} sharps_calibration_t;
 
-static float iSharpsGetValue(int sharp_);
+static volatile uint32_t calibration[SHARPS_NB] =
+  {
+    [SHARP_LEFT]  = (uint16_t)SHARPS_GAIN_ONE,
+    [SHARP_RIGHT] = (uint16_t)SHARPS_GAIN_ONE,
+  };
 
 void vSharpsInit()
 {
-  // Configure DMA clock
-  vDmaClockInit(sharps.DMAx);
-  // Configure ADC clock
-  vAdcClockInit(sharps.ADCx);
+  for (int i = 0; i < SHARPS_NB; i++)
+    sharpChannel[i] = iAdcRegisterChannel(&sharps[i]);
 
-  // Default GPIO config
+#ifdef SHARPS_SWITCH
+  vGpioClockInit(SHARPS_SUPPLY_GPIOx);
+  GPIO_SetBits(SHARPS_SUPPLY_GPIOx, SHARPS_SUPPLY_Pin);
   GPIO_InitTypeDef GPIO_InitStructure =
     {
-      .GPIO_Pin   = 0,
-      .GPIO_Mode  = GPIO_Mode_IN_FLOATING,
-      .GPIO_Speed = GPIO_Speed_2MHz
+      .GPIO_Pin   = SHARPS_SUPPLY_Pin,
+      .GPIO_Speed = GPIO_Speed_2MHz,
+      .GPIO_Mode  = GPIO_Mode_Out_PP,
     };
+  GPIO_Init(SHARPS_SUPPLY_GPIOx, &GPIO_InitStructure);
+#endif
+}
 
-  // GPIO config
-  for (int i = 0; i < SHARPS_NB; i++)
+void vSharpsSetPower(int on_)
+{
+#ifdef SHARPS_SWITCH
+  if (on_ == powered)
+    return;
+  if (on_)
   {
-    vGpioClockInit(sharps.ADCs[i].GPIOx);
-    GPIO_InitStructure.GPIO_Pin = sharps.ADCs[i].GPIO_Pin_x;
-    GPIO_Init(sharps.ADCs[i].GPIOx, &GPIO_InitStructure);
+    poweredAt = xTaskGetTickCount();
+    GPIO_SetBits(SHARPS_SUPPLY_GPIOx, SHARPS_SUPPLY_Pin);
   }
+  else
+    GPIO_ResetBits(SHARPS_SUPPLY_GPIOx, SHARPS_SUPPLY_Pin);
+  powered = on_;
+#endif
+}
 
-  // Reset ADC
-  ADC_DeInit(sharps.ADCx);
-  // Wake up ADC from Power Down mode
-  ADC_Cmd(sharps.ADCx, ENABLE);
-  // Wait until it stabilizes (tSTAB)
-  vWaitUs(1000);
-
-  // Configure ADC
-  ADC_InitTypeDef ADC_InitStructure;
-  ADC_StructInit(&ADC_InitStructure);
-  /* Independent mode (not dual mode) */
-  ADC_InitStructure.ADC_Mode = ADC_Mode_Independent;
-  /* Scan mode -> multichannels conversion */
-  ADC_InitStructure.ADC_ScanConvMode = ENABLE;
-  /* Continuous mode (start a new conversion as soon as the previous finished */
-  ADC_InitStructure.ADC_ContinuousConvMode = ENABLE;
-  /* No external trigger to start conversion */
-  ADC_InitStructure.ADC_ExternalTrigConv = ADC_ExternalTrigConv_None;
-  /* Number of channels to be converted */
-  ADC_InitStructure.ADC_NbrOfChannel = SHARPS_NB;
-  /* Converted data are aligned to the right (0 0 0 0 D11 D10 ... D0) */
-  ADC_InitStructure.ADC_DataAlign = ADC_DataAlign_Right;
-  ADC_Init(sharps.ADCx, &ADC_InitStructure);
-
-  // Calibrate ADC
-  /* Reset ADC calibration */
-  ADC_ResetCalibration(sharps.ADCx);
-  /* Wait for the end of the reset calibration */
-  while (ADC_GetResetCalibrationStatus(sharps.ADCx));
-  /* Start ADC calibration */
-  ADC_StartCalibration(sharps.ADCx);
-  /* Wait for the end of the calibration */
-  while (ADC_GetCalibrationStatus(sharps.ADCx));
-
-  // Enable ADC DMA request
-  ADC_DMACmd(sharps.ADCx, ENABLE);
-
-  // Configure ADC channels
-  /* Set the order and the sample time of each channel */
-  for (int i = 0; i < SHARPS_NB; i++)
-    ADC_RegularChannelConfig(sharps.ADCx, sharps.ADCs[i].ADC_Channel_x,
-                             i + 1, ADC_SampleTime_239Cycles5);
-
-
-  // Start ADC conversions
-  ADC_Cmd(sharps.ADCx, ENABLE);
-
-  // Initialize DMA
-  /* Reset DMA */
-  DMA_DeInit(sharps.DMA_Channelx);
-
-  DMA_InitTypeDef DMA_InitStructure;
-  DMA_StructInit(&DMA_InitStructure);
-  /* Set DMA peripheral base addr to ADC buffer */
-  DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)(&sharps.ADCx->DR);
-  /* Disable the increment of the periphal addr (always ADC buffer DR reg) */
-  DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
-  /* Set DMA memory base addr to DMA buffer */
-  DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)ADC_DMA_Buffer;
-  /* Enable the increment of the mem addr */
-  DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
-  /* Set the peripheral as the src of the DMA */
-  DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
-  /* Set the number of data to transfer */
-  DMA_InitStructure.DMA_BufferSize = DMA_BUFFER_SIZE;
-  /* Set the DMA as a circular DMA (so that the DMA transfer never stop) */
-  DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
-  /* ADC buffer register is 16bit wide -> halfword */
-  DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
-  /* DMA buffer is 16bit wide too -> halfword */
-  DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
-  /* Set the DMA priority (not important as only ADC1 use DMA1) */
-  DMA_InitStructure.DMA_Priority = DMA_Priority_High;
-  /* Disable Mem to Mem (here it's peripheral to mem) */
-  DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
-
-  DMA_Init(sharps.DMA_Channelx, &DMA_InitStructure);
-
-  /* Disable DMA IT (not needed) */
-  DMA_ITConfig(sharps.DMA_Channelx, DMA_IT_TC | DMA_IT_HT | DMA_IT_TE, DISABLE);
-
-  // Start DMA
-  DMA_Cmd(sharps.DMA_Channelx, ENABLE);
+int iSharpsIsReady()
+{
+  return powered &&
+    xTaskGetTickCount() - poweredAt >= MS_TO_TICKS(SHARPS_WARMUP_MS);
+}
+
+int iSharpsCodeToMm(uint16_t code_)
+{
+  int index = code_ >> CODE_SHIFT;
+  int frac = code_ & (CODE_STEP - 1);
+  int low = table_dist_mm[index];
+  int high = table_dist_mm[index + 1];
+
+  if (low < 0 || high < 0)
+    return SHARPS_BAD_VALUE;
+
+  // Linear interpolation between the two surrounding entries
+  return low + (((high - low) * frac) >> CODE_SHIFT);
+}
+
+static int prvSharpToMm(int sharp_, uint16_t code_)
+{
+  const sharps_calibration_t c = { .word = calibration[sharp_] };
+  int mm = iSharpsCodeToMm(code_);
+
+  if (mm == SHARPS_BAD_VALUE)
+    return SHARPS_BAD_VALUE;
+  mm = mm * c.gain / SHARPS_GAIN_ONE + c.offset_mm;
+  return mm < 0 ? 0 : mm;
+}
+
+static int prvSharpLeftToMm(uint16_t code_)
+{
+  return prvSharpToMm(SHARP_LEFT, code_);
+}
+
+static int prvSharpRightToMm(uint16_t code_)
+{
+  return prvSharpToMm(SHARP_RIGHT, code_);
+}
+
+int iSharpsMeasureDistMm(int sharp_)
+{
+  if (!iSharpsIsReady())
+    return SHARPS_BAD_VALUE;
+  return iAdcGetValue(sharpChannel[sharp_]);
 }
 
-static float iSharpsGetValue(int sharp_)
+int iSharpsMeasureCurveMm(int sharp_)
 {
-  uint16_t smoothedValue = 0;
-  for (int i = sharp_; i < DMA_BUFFER_SIZE; i += SHARPS_NB)
-    smoothedValue += ADC_DMA_Buffer[i];
-  return GET_VOLTAGE_MILI(smoothedValue / AVERAGE_NB);
+  if (!iSharpsIsReady())
+    return SHARPS_BAD_VALUE;
+  return iSharpsCodeToMm(uAdcGetRaw(sharpChannel[sharp_]));
 }
 
-float iSharpsMeasureDistCm(int sharp_)
+void vSharpsSetCalibration(int sharp_, int gain_, int offset_mm_)
 {
-  float value = iSharpsGetValue(sharp_);
+  const sharps_calibration_t c = { { .gain = gain_, .offset_mm = offset_mm_ } };
+
+  calibration[sharp_] = c.word;
+}
 
-  int index = -1;
-  for (int i = 0; i < TABLE_SIZE; i++)
-    if (table_volt[i] > value) {
-      index = i;
-      break;
-    }
+int iSharpsWallMm(int sonar_mm_)
+{
+  // Along the axis of the sharp, from the robot centre: (d + r) / cos(a)
+  static const uint32_t angle =
+    (uint32_t)(((uint64_t)SHARPS_MOUNT_ANGLE_DEG << 32) / 360);
+  const int32_t cosine = iTrigCos(angle);
 
-  return (table_length[index] + table_length[index-1]) / 2;
+  return (int)(((int64_t)(sonar_mm_ + SHARPS_MOUNT_RADIUS_MM) << 15) / cosine) -
+    SHARPS_MOUNT_RADIUS_MM;
+}
+
+void vSharpsFitReset(sharps_fit_t* fit_)
+{
+  fit_->n = 0;
+  fit_->sx = fit_->sy = fit_->sxx = fit_->sxy = 0;
+}
+
+void vSharpsFitAdd(sharps_fit_t* fit_, int curve_mm_, int reference_mm_)
+{
+  fit_->n++;
+  fit_->sx += curve_mm_;
+  fit_->sy += reference_mm_;
+  fit_->sxx += (int64_t)curve_mm_ * curve_mm_;
+  fit_->sxy += (int64_t)curve_mm_ * reference_mm_;
+}
+
+static int64_t prvDivRound(int64_t num_, int64_t den_)
+{
+  return (num_ + (num_ < 0 ? -den_ : den_) / 2) / den_;
+}
+
+int iSharpsFitSolve(const sharps_fit_t* fit_, int* gain_, int* offset_mm_)
+{
+  const int64_t n = fit_->n;
+  // n^2 times the variance of the curve distances
+  const int64_t spread = n * fit_->sxx - fit_->sx * fit_->sx;
+
+  if (n < SHARPS_FIT_MIN_POINTS ||
+      spread < n * n * SHARPS_FIT_MIN_SPREAD_MM * SHARPS_FIT_MIN_SPREAD_MM)
+    return 0;
+
+  const int64_t gain =
+    prvDivRound((n * fit_->sxy - fit_->sx * fit_->sy) * SHARPS_GAIN_ONE, spread);
+  const int64_t offset =
+    prvDivRound(fit_->sy * SHARPS_GAIN_ONE - gain * fit_->sx,
+                n * SHARPS_GAIN_ONE);
+
+  if (gain < SHARPS_GAIN_MIN || gain > SHARPS_GAIN_MAX ||
+      offset < -SHARPS_OFFSET_MAX || offset > SHARPS_OFFSET_MAX)
+    return 0;
+  *gain_ = gain;
+  *offset_mm_ = offset;
+  return 1;
 }
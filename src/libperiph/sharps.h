@@ -1,6 +1,8 @@
 #ifndef SHARPS_H
 # define SHARPS_H
 
+#include <stdint.h>
+
 #include "FreeRTOS.h"
 
 #define SHARPS_NB 2
@@ -8,22 +10,60 @@
 #define SHARP_LEFT  0
 #define SHARP_RIGHT 1
 
-typedef struct
-{
-  GPIO_TypeDef* GPIOx;
-  uint16_t GPIO_Pin_x;
-  uint8_t ADC_Channel_x;
-} sharp_t;
+// Returned when the distance is out of the sensor range
+#define SHARPS_BAD_VALUE (-1)
+
+// Register the sharps channels, before vAdcStart()
+void vSharpsInit();
+// Generic datasheet curve, shared by both sensors
+int iSharpsCodeToMm(uint16_t code_);
+// Distance from the curve corrected by the calibration of the sensor
+int iSharpsMeasureDistMm(int sharp_);
+// Distance from the generic curve alone, the input of a calibration
+int iSharpsMeasureCurveMm(int sharp_);
+
+// Supplies of both sensors through a high side switch on PC11
+// (--sharps-switch), off while parked: SHARPS_BAD_VALUE off, and for the
+// first output cycle, 38 ms, and the filter of the ADC after power on.
+// Without the switch the sensors stay on.
+#define SHARPS_WARMUP_MS 60
+void vSharpsSetPower(int on_);
+int iSharpsIsReady();
 
+// Calibration of a sensor: mm = curve * gain / SHARPS_GAIN_ONE + offset,
+// the identity by default
+#define SHARPS_GAIN_ONE    1000
+#define SHARPS_GAIN_MIN    500
+#define SHARPS_GAIN_MAX    2000
+#define SHARPS_OFFSET_MAX  200
+
+void vSharpsSetCalibration(int sharp_, int gain_, int offset_mm_);
+
+// Mounting, from the robot centre: at SHARPS_MOUNT_RADIUS_MM, as the
+// central sonar, turned by SHARPS_MOUNT_ANGLE_DEG from the heading
+#define SHARPS_MOUNT_RADIUS_MM 120
+#define SHARPS_MOUNT_ANGLE_DEG 60
+
+// Distance a sharp sees to a flat wall squarely in front of the robot,
+// from the central sonar distance to it
+int iSharpsWallMm(int sonar_mm_);
+
+// Least squares fit of a calibration, over (curve, reference) pairs
 typedef struct
 {
-  ADC_TypeDef* ADCx;
-  sharp_t ADCs[SHARPS_NB];
-  DMA_TypeDef* DMAx;
-  DMA_Channel_TypeDef* DMA_Channelx;
-} sharps_t;
+  int32_t n;
+  int64_t sx, sy, sxx, sxy;
+} sharps_fit_t;
 
-void vSharpsInit();
-float iSharpsMeasureDistCm(int sharp_);
+// The pairs must spread over SHARPS_FIT_MIN_SPREAD_MM (standard
+// deviation of the curve distances)
+#define SHARPS_FIT_MIN_POINTS    2
+#define SHARPS_FIT_MIN_SPREAD_MM 10
+
+void vSharpsFitReset(sharps_fit_t* fit_);
+void vSharpsFitAdd(sharps_fit_t* fit_, int curve_mm_, int reference_mm_);
+// Returns 0 with too few or too close pairs, or a calibration out of
+// bounds
+int iSharpsFitSolve(const sharps_fit_t* fit_, int* gain_, int* offset_mm_);
 
 #endif
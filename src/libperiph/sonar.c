@@ -8,271 +8,535 @@
 #include "misc.h"
 
 #include "FreeRTOS.h"
-#include "semphr.h"
 #include "task.h"
-
+#ifdef CO_ROUTINES
+# include "croutine.h"
+#endif
+
+#include "libglobal/fault.h"
+#include "libglobal/flags.h"
+#include "libglobal/profile.h"
+#include "libglobal/samples.h"
+#include "libglobal/startup.h"
+#include "libglobal/sysmon.h"
+#include "libglobal/timeline.h"
 #include "libglobal/strutils.h"
+#include "libglobal/topics.h"
 
-#include "libperiph/uart.h"
+#include "libperiph/adc.h"
+#include "libperiph/atomic.h"
 #include "libperiph/hardware.h"
+#include "libperiph/priorities.h"
+#include "libperiph/resources.h"
+#include "libperiph/sharps.h"
+#include "libperiph/timebase.h"
 
-/// Sonar bad value
-#define SONAR_BAD_VALUE (-1)
-
-// No obstacle = 38ms returned
-#define SONAR_TIMEOUT_MS 38
-#define DEFAULT_TIMEOUT_MS 1
-
-// Trigger pulse timer
+// Sonar timer, configured once
 // Base clock = 72 Mhz
-// Base clock / Prescaler = 72 / 1 = 72Mhz -> Tc = 0.014 us
-// Period = 2 * Trig_pulse / Tc = 20 / 0.014 = 1452
-#define TIM_TRIG_PSC        0                          // -> div clk by 1
-#define TIM_TRIG_PERIOD     1451                       // -> count from 0 to 1451
-#define TIM_TRIG_PULSE      (TIM_TRIG_PERIOD / 2)      // -> get a pulse of ~ 10us
-#define TIM_TRIG_TC_US      (0.014)                    // -> counter period (us)
-
-// Echo pulse timer
-// Base clock = 72 Mhz
-// Base clock / Prescaler = 72 / 180 = 400 kHz -> Tc = 2.5 us
+// Base clock / Prescaler = 72 / 72 = 1 MHz -> Tc = 1 us
 // Period = 0x10000 -> we can measure time interval
-// up to: Tmax = Tc * 0x10000 ~= 163.84ms
+// up to: Tmax = Tc * 0x10000 ~= 65.5ms
 // Seems enough as timeout value is 38ms
-#define TIM_ECHO_PSC        179       // -> div clk by 45
-#define TIM_ECHO_PERIOD     0xffff    // -> count from 0 to 0xffff
-#define TIM_ECHO_TC_US      (2.5)       // -> counter period
-
-// Conversion constant from echo pulse length to distance in cm
-#define CONV_CONST_US_CM   58
-
-// Register if triggering or receiving pulse
-#define TRIGGER 0
-#define ECHO    1
-static bool mode;
-// Register if beginning or ending an echo pulse
-#define BEGIN 0
-#define END   1
-static bool capture;
-// Store the echo pulse duration
-static int value;
-static int value_cm;
-// Store the timer values
-static uint16_t IC3Value1;
-static uint16_t IC3Value2;
-
-// Semphr for communication between IRQ and main
-static xSemaphoreHandle xResponseSemphr;
-
-// Private reusable structures
-static TIM_TimeBaseInitTypeDef Timer_InitStructure;
-static TIM_ICInitTypeDef TIM_ICInitStructure;
-static GPIO_InitTypeDef GPIO_InitStructure;
+#define TIM_PSC             71        // -> div clk by 72
+#define TIM_PERIOD          0xffff    // -> count from 0 to 0xffff
+#define TIM_TRIG_PULSE_US   10        // -> trigger pulse duration
+
+// Echo pulse length (us) to distance (mm), sound going there and back:
+// mm = us * c / 2000 with c in m/s, (us * mul) >> 16 with mul = c (mm/s)
+// * 4096 / 125000, 11239 at 343 m/s. c = 331.3 m/s + 0.606 per degree,
+// at the die temperature of the ADC: a few degrees above the air, some
+// 0.2% per degree of error, against 3% from 0 to 30 C left alone.
+#define US_TO_MM_SHIFT     16
+#define SOUND_MM_S_AT_0C   331300
+#define SOUND_MM_S_PER_C   606
+#define SOUND_MIN_DC       (-200)
+#define SOUND_MAX_DC       800
+
+// Pin configuration nibbles (CRL / CRH)
+#define PIN_OUTPUT  0x3 // output push pull 50 MHz
+#define PIN_INPUT   0x4 // input floating
+
+// Channel configuration bytes (CCMR1 / CCMR2)
+#define CHANNEL_COMPARE 0x00 // frozen output compare, no pin
+#define CHANNEL_CAPTURE 0x01 // input capture on its own TI
+
+// Each channel is used in turn as a compare ending the trigger pulse,
+// then as a capture of both echo edges (polarity flipped in between)
+enum eSonarState {
+  SONAR_IDLE = 0,
+  SONAR_TRIGGER,
+  SONAR_RISING,
+  SONAR_FALLING
+};
+
+// Board: TIM3 fully remapped, channel n (0 for CH1) on PC6 + n. All
+// constants: the interrupt compiles to plain loads and stores.
+#define SONAR_TIMx       TIM3
+#define SONAR_GPIOx      GPIOC
+#define SONAR_FIRST_PIN  6
+// Left and right are not adjacent and fire together, the centre one is
+// serialized with both against crosstalk
+#define SONAR_CHANNEL(SONAR) \
+  ((SONAR) == SONAR_LEFT ? 0 : (SONAR) == SONAR_CENTER ? 2 : 1)
+#define SONAR_SLOT(SONAR)    ((SONAR) == SONAR_CENTER)
+#define SONAR_PIN(SONAR)     (SONAR_FIRST_PIN + SONAR_CHANNEL(SONAR))
+
+static sonar_t sonars[SONARS_NB];
+
+static const uint8_t sampleSensor[SONARS_NB] =
+  { SAMPLE_SONAR_LEFT, SAMPLE_SONAR, SAMPLE_SONAR_RIGHT };
+
+#define SONARS_SLOTS_NB 2
+
+// Quiet time after each echo, for the reverberations to fade out
+static volatile int minIntervalMs = SONAR_DEFAULT_INTERVAL_MS;
+// 0 unless parked
+static volatile int parkedMs;
+// Time slots, no robots while off
+static sonar_fleet_t fleet;
+
+// End of the echo of each sonar, by index
+static flags_t echoes;
+
+// Latest measures, written by the daemon and published at each slot
+static sonar_measures_t measures;
+// Of the slot being measured
+static portTickType ping;
+static uint32_t pingUs;
 
 // Sonar task in charge of measures
+#ifndef CO_ROUTINES
 static void vSonarTask(void* pvParameters_);
+#else
+static void vSonarCoRoutine(xCoRoutineHandle xHandle_,
+                            unsigned portBASE_TYPE index_);
+#endif
+static int iSonarFilter(sonar_t* sonar_, int raw_mm_, uint8_t* confidence_);
 
-// Set sonar pin and TIM
-static sonar_t sonarPin =
+static ALWAYS_INLINE void vSonarPinMode(int sonar_, uint32_t mode_)
 {
-  .GPIOx = GPIOC,
-  .GPIO_Pin_x = GPIO_Pin_8,
-  .TIMx = TIM3,
-};
+  volatile uint32_t* cr = SONAR_PIN(sonar_) < 8 ? &SONAR_GPIOx->CRL
+                                                : &SONAR_GPIOx->CRH;
+  const int shift = (SONAR_PIN(sonar_) & 7) * 4;
+
+  *cr = (*cr & ~(0xf << shift)) | (mode_ << shift);
+}
+
+// CCMR1 holds channels 0-1, CCMR2 channels 2-3, one byte each
+static ALWAYS_INLINE void vSonarChannelMode(int sonar_, uint16_t mode_)
+{
+  volatile uint16_t* ccmr = SONAR_CHANNEL(sonar_) < 2 ? &SONAR_TIMx->CCMR1
+                                                      : &SONAR_TIMx->CCMR2;
+  const int shift = (SONAR_CHANNEL(sonar_) & 1) * 8;
+
+  *ccmr = (*ccmr & ~(0xff << shift)) | (mode_ << shift);
+}
+
+// CCR1..4 are 32 bits apart
+static ALWAYS_INLINE volatile uint16_t* pSonarCCR(int sonar_)
+{
+  return &SONAR_TIMx->CCR1 + 2 * SONAR_CHANNEL(sonar_);
+}
 
 void vSonarInit(unsigned portBASE_TYPE sonarDaemonPriority_)
 {
-  // Enable sonar pin clock
-  vGpioClockInit(sonarPin.GPIOx);
-  // Enable sonar pin TIM
-  vTimerClockInit(sonarPin.TIMx);
+  static sonar_measures_t slots[2];
+
+  // Enable sonars timer
+  xResourceClaim(RESOURCE_TIM3, "sonar");
+  vTimerClockInit(SONAR_TIMx);
 
-  // Remap sonar pin TIM on PC8
+  // Remap sonars timer on PC6..PC9
+  xResourceClaim(RESOURCE_REMAP_TIM3, "sonar");
   GPIO_PinRemapConfig(GPIO_FullRemap_TIM3, ENABLE);
 
+  // Sonar pins, switched between output (trigger) and input (echo)
+  vGpioClockInit(SONAR_GPIOx);
+  for (int i = 0; i < SONARS_NB; i++)
+  {
+    sonar_t* sonar = &sonars[i];
+
+    SONAR_GPIOx->BRR = 1 << SONAR_PIN(i);
+    vSonarPinMode(i, PIN_INPUT);
+    sonar->dist_mm = SONAR_BAD_VALUE;
+    measures.sonar[i].dist_mm = SONAR_BAD_VALUE;
+    for (int j = 0; j < SONAR_MEDIAN_NB; j++)
+      sonar->history[j] = SONAR_BAD_VALUE;
+  }
+  vTopicsInit(TOPIC_SONAR, "sonar", slots, sizeof (sonar_measures_t));
+  vTopicsPublish(TOPIC_SONAR, &measures);
+
+  // Free running 1 MHz counter
+  TIM_TimeBaseInitTypeDef Timer_InitStructure =
+  {
+    .TIM_ClockDivision      = TIM_CKD_DIV1,
+    .TIM_Prescaler          = TIM_PSC,
+    .TIM_Period             = TIM_PERIOD,
+    .TIM_CounterMode        = TIM_CounterMode_Up
+  };
+  TIM_TimeBaseInit(SONAR_TIMx, &Timer_InitStructure);
+  TIM_Cmd(SONAR_TIMx, ENABLE);
+
   // Register sonar timer interrupt
   NVIC_InitTypeDef NVIC_InitStructure =
     {
       .NVIC_IRQChannel = TIM3_IRQn,
-      .NVIC_IRQChannelPreemptionPriority = 7,
+      .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_SONAR,
       .NVIC_IRQChannelSubPriority = 0,
       .NVIC_IRQChannelCmd = ENABLE,
     };
   NVIC_Init(&NVIC_InitStructure);
 
+  vFlagsInit(&echoes);
+
   // Create the daemon
-  xTaskCreate(vSonarTask, (const signed char * const)"sonard",
-              configMINIMAL_STACK_SIZE, NULL, sonarDaemonPriority_, NULL);
-
-  // Create semaphore
-  vSemaphoreCreateBinary(xResponseSemphr);
-  // And take it right now
-  xSemaphoreTake(xResponseSemphr,
-                 (DEFAULT_TIMEOUT_MS) / portTICK_RATE_MS);
+#ifndef CO_ROUTINES
+  if (xTaskCreate(vSonarTask, (const signed char * const)"sonard",
+                  SONAR_STACK_SIZE, NULL, sonarDaemonPriority_,
+                  NULL) != pdPASS)
+#else
+  if (xCoRoutineCreate(vSonarCoRoutine, CO_PRIORITY_SONAR, 0) != pdPASS)
+#endif
+    vFaultAllocation("sonard");
 }
 
-static void vSendTriggerPulse()
+// Called with the sonar interrupt masked
+static void vSendTriggerPulse(int sonar_)
 {
-  // Disable sonar timer during configuration
-  TIM_Cmd(sonarPin.TIMx, DISABLE);
-
-  // Configure sonar pin
-  GPIO_InitStructure.GPIO_Pin   = sonarPin.GPIO_Pin_x;
-  GPIO_InitStructure.GPIO_Mode  = GPIO_Mode_AF_PP;     // alternate function push pull
-  GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;    // we want to detect fast transitions
-  GPIO_Init(sonarPin.GPIOx, &GPIO_InitStructure);
-
-  // Reset sonar timer
-  TIM_DeInit(sonarPin.TIMx);
-
-  // Configure sonar timer
-  Timer_InitStructure.TIM_ClockDivision      = TIM_CKD_DIV1;       // Keep default clk (72Mhz)
-  Timer_InitStructure.TIM_Prescaler          = TIM_TRIG_PSC;       // Set to trigger prescaler
-  Timer_InitStructure.TIM_Period             = TIM_TRIG_PERIOD;    // Set to trigger period
-  Timer_InitStructure.TIM_CounterMode        = TIM_CounterMode_Up;  // Counter goes upward
-  TIM_TimeBaseInit(sonarPin.TIMx, &Timer_InitStructure);
-
-  // Clear Update flag
-  TIM_ClearFlag(sonarPin.TIMx, TIM_FLAG_Update);
-
-  // Configure output channel 3
-  TIM_OCInitTypeDef TIM_OCInitStructure =
-    {
-      .TIM_OCMode           = TIM_OCMode_PWM2,        // PWM1 mode
-      .TIM_OutputState      = TIM_OutputState_Enable, // Output compare state enable
-      .TIM_Pulse            = TIM_TRIG_PULSE,         // pulse duration (capture compare register value)
-      .TIM_OCPolarity       = TIM_OCPolarity_High     // Generate a 0->1 transition when triggering
-    };
-  TIM_OC3Init(sonarPin.TIMx, &TIM_OCInitStructure);
+  TIM_TypeDef* const TIMx = SONAR_TIMx;
+  const uint16_t flag = TIM_SR_CC1IF << SONAR_CHANNEL(sonar_);
+
+  // Channel as a compare, CCxS is only writable with the channel off
+  TIMx->CCER &= ~(TIM_CCER_CC1E << (4 * SONAR_CHANNEL(sonar_)));
+  vSonarChannelMode(sonar_, CHANNEL_COMPARE);
+
+  // Raise the pin, the compare lowers it
+  SONAR_GPIOx->BSRR = 1 << SONAR_PIN(sonar_);
+  vSonarPinMode(sonar_, PIN_OUTPUT);
+  *pSonarCCR(sonar_) = TIMx->CNT + TIM_TRIG_PULSE_US;
+  sonars[sonar_].state = SONAR_TRIGGER;
+  TIMx->SR = ~flag;
+  vAtomicBitWrite(&TIMx->DIER, ATOMIC_BIT(flag), 1);
+}
 
-  // Disable output compare register preload
-  TIM_OC3PreloadConfig(sonarPin.TIMx, TIM_OCPreload_Disable);
-  // Disable autoreload register preload
-  TIM_ARRPreloadConfig(sonarPin.TIMx, DISABLE);
+// Inlined by sonar, its channel and pin constants
+static ALWAYS_INLINE int iSonarEvent(int sonar_)
+{
+  TIM_TypeDef* const TIMx = SONAR_TIMx;
+  sonar_t* const sonar = &sonars[sonar_];
+  const int ccer = 4 * SONAR_CHANNEL(sonar_);
+  const uint16_t flag = TIM_SR_CC1IF << SONAR_CHANNEL(sonar_);
+  const uint16_t ccr = *pSonarCCR(sonar_);
+
+  TIMx->SR = ~flag;
+
+  switch (sonar->state)
+  {
+  case SONAR_TRIGGER:
+    // Trigger pulse end: release the pin, capture the echo rising edge
+    SONAR_GPIOx->BRR = 1 << SONAR_PIN(sonar_);
+    vSonarPinMode(sonar_, PIN_INPUT);
+    vSonarChannelMode(sonar_, CHANNEL_CAPTURE);
+    TIMx->CCER = (TIMx->CCER & ~(TIM_CCER_CC1P << ccer)) |
+                 (TIM_CCER_CC1E << ccer);
+    TIMx->SR = ~flag;
+    sonar->state = SONAR_RISING;
+    break;
+  case SONAR_RISING:
+    sonar->start = ccr;
+    vAtomicBitWrite(&TIMx->CCER, ATOMIC_BIT(TIM_CCER_CC1P) + ccer, 1);
+    sonar->state = SONAR_FALLING;
+    break;
+  case SONAR_FALLING:
+    sonar->width_us = (uint16_t)(ccr - sonar->start);
+    vAtomicBitWrite(&TIMx->DIER, ATOMIC_BIT(flag), 0);
+    sonar->state = SONAR_IDLE;
+    return 1;
+  }
+  return 0;
+}
 
-  // Send only one pulse on the sonar pin
-  TIM_SelectOnePulseMode(sonarPin.TIMx, TIM_OPMode_Single);
+// The daemon wakes up on the last echo of the slot
+static ALWAYS_INLINE void prvSonarIsr(int sonar_, uint16_t status_,
+                                      portBASE_TYPE* resched_)
+{
+  if (status_ & (TIM_SR_CC1IF << SONAR_CHANNEL(sonar_)) &&
+      iSonarEvent(sonar_))
+    vFlagsSetFromISR(&echoes, 1 << sonar_, resched_);
+}
 
-  // Enable capture compare and update event interrupt
-  TIM_ITConfig(sonarPin.TIMx, TIM_IT_CC3 | TIM_IT_Update, ENABLE);
+RAMFUNC void TIM3_IRQHandler()
+{
+  portBASE_TYPE reschedNeeded = pdFALSE;
+  const uint16_t status = SONAR_TIMx->SR & SONAR_TIMx->DIER;
+  PROFILE_BEGIN(PROFILE_TIM3_IRQ);
+  TIMELINE_ISR_ENTER(TIM3_IRQn);
+
+  prvSonarIsr(SONAR_LEFT, status, &reschedNeeded);
+  prvSonarIsr(SONAR_CENTER, status, &reschedNeeded);
+  prvSonarIsr(SONAR_RIGHT, status, &reschedNeeded);
 
-  // Enable sonar timer
-  TIM_Cmd(sonarPin.TIMx, ENABLE);
+  PROFILE_END(PROFILE_TIM3_IRQ);
+  TIMELINE_ISR_EXIT(TIM3_IRQn);
+  portEND_SWITCHING_ISR(reschedNeeded);
 }
 
-void vSetEchoMode()
+int iSonarMeasureDistMm(int sonar_)
 {
-  // Disable sonar timer during configuration
-  TIM_Cmd(sonarPin.TIMx, DISABLE);
-
-  // Configure sonar pin
-  GPIO_InitStructure.GPIO_Mode  = GPIO_Mode_IN_FLOATING;     // alternate function input floating
-  GPIO_Init(sonarPin.GPIOx, &GPIO_InitStructure);
-
-  // Configure sonar timer
-  Timer_InitStructure.TIM_Prescaler          = TIM_ECHO_PSC;       // Set to echo prescaler
-  Timer_InitStructure.TIM_Period             = TIM_ECHO_PERIOD;    // Set to echo period
-  TIM_TimeBaseInit(sonarPin.TIMx, &Timer_InitStructure);
-
-  // Clear Update flag
-  TIM_ClearFlag(sonarPin.TIMx, TIM_FLAG_Update);
-
-  // Configure Input channel 3
-  TIM_ICInitStructure.TIM_Channel          = TIM_Channel_3;
-  TIM_ICInitStructure.TIM_ICPolarity       = TIM_ICPolarity_Rising;
-  TIM_ICInitStructure.TIM_ICSelection      = TIM_ICSelection_DirectTI;
-  TIM_ICInitStructure.TIM_ICPrescaler      = TIM_ICPSC_DIV1;
-  TIM_ICInitStructure.TIM_ICFilter         = 0x0;
-  TIM_ICInit(sonarPin.TIMx, &TIM_ICInitStructure);
-
-  // Enable sonar timer
-  TIM_Cmd(sonarPin.TIMx, ENABLE);
-
-  /* Reset the flags */
-  sonarPin.TIMx->SR = 0;
+  return sonars[sonar_].dist_mm;
 }
 
-void TIM3_IRQHandler()
+// Only this sonar out of the latest sample, where it lies
+void vSonarGetMeasure(int sonar_, sonar_measure_t* measure_)
 {
-  portBASE_TYPE reschedNeeded = pdFALSE;
+  const sonar_measures_t* latest;
+  uint32_t seq;
 
-  if (TIM_GetITStatus(sonarPin.TIMx, TIM_IT_Update)) {
-    // Trigger mode
-    if (mode == TRIGGER) {
-      // Switch to echo mode
-      mode = ECHO;
-      // Trigger pulse end: release semphr
-      xSemaphoreGiveFromISR(xResponseSemphr, &reschedNeeded);
-    }
-    // Clear flag
-    TIM_ClearITPendingBit(sonarPin.TIMx, TIM_IT_Update);
+  do
+  {
+    latest = pvTopicsPeek(TOPIC_SONAR, &seq);
+    *measure_ = latest->sonar[sonar_];
   }
+  while (!xTopicsIsValid(TOPIC_SONAR, seq));
+}
 
-  else if (TIM_GetITStatus(sonarPin.TIMx, TIM_IT_CC3)) {
-    // Echo mode
-    if (mode == ECHO) {
-      // Start capture
-      if (capture == BEGIN) {
-        IC3Value1 = TIM_GetCapture3(sonarPin.TIMx);
-        // Toggle timer Input channel polarity
-        TIM_ICInitStructure.TIM_ICPolarity = TIM_ICPolarity_Falling;
-        TIM_ICInit(sonarPin.TIMx, &TIM_ICInitStructure);
-        capture = END;
-      }
-      // End capture
-      else if (capture == END) {
-        IC3Value2 = TIM_GetCapture3(sonarPin.TIMx);
-
-        if (IC3Value2 > IC3Value1) {
-          value = (IC3Value2 - IC3Value1) - 1;
-        }
-        else {
-          value = ((0xFFFF - IC3Value1) + IC3Value2) - 1;
-        }
-        // Echo pulse end: release semphr
-        xSemaphoreGiveFromISR(xResponseSemphr, &reschedNeeded);
-      }
-    }
-    // Clear flag
-    TIM_ClearITPendingBit(sonarPin.TIMx, TIM_IT_CC3);
+void vSonarSetMinInterval(int interval_ms_)
+{
+  if (interval_ms_ < SONAR_MIN_INTERVAL_MS)
+    interval_ms_ = SONAR_MIN_INTERVAL_MS;
+  minIntervalMs = interval_ms_;
+}
+
+void vSonarSetParkedInterval(int interval_ms_)
+{
+  parkedMs = interval_ms_ < 0 ? 0 : interval_ms_;
+}
+
+int xSonarSetFleet(const sonar_fleet_t* fleet_)
+{
+  if (fleet_->robots > SONAR_FLEET_MAX ||
+      (fleet_->robots && (fleet_->index >= fleet_->robots ||
+                          fleet_->window_ms < SONAR_FLEET_MIN_WINDOW_MS)))
+    return 0;
+  taskENTER_CRITICAL();
+  fleet = *fleet_;
+  taskEXIT_CRITICAL();
+  return 1;
+}
+
+void vSonarGetFleet(sonar_fleet_t* fleet_)
+{
+  taskENTER_CRITICAL();
+  *fleet_ = fleet;
+  taskEXIT_CRITICAL();
+}
+
+// Ticks to the firing time of the next window of this robot, and in
+// *listen_ the time its echoes have then. None off the fleet, the whole
+// timeout.
+static portTickType prvSonarFleetWait(portTickType* listen_)
+{
+  sonar_fleet_t f;
+
+  vSonarGetFleet(&f);
+  *listen_ = MS_TO_TICKS(SONAR_TIMEOUT_MS);
+  if (!f.robots)
+    return 0;
+
+  const uint32_t window_us = f.window_ms * 1000;
+  const uint32_t frame_us = f.robots * window_us;
+  const uint32_t pos = (xTimeNowUs() - f.phase_us) % frame_us;
+  const uint32_t fire = f.index * window_us + SONAR_FLEET_GUARD_MS * 1000;
+  const int listen_ms = f.window_ms - 2 * SONAR_FLEET_GUARD_MS;
+
+  if (listen_ms < SONAR_TIMEOUT_MS)
+    *listen_ = MS_TO_TICKS(listen_ms);
+  // Rounded down: early by less than a tick, within the guard
+  return MS_TO_TICKS(((fire - pos + frame_us) % frame_us) / 1000);
+}
+
+// Median of the good measures of the window, insertion sorted
+static int iSonarFilter(sonar_t* sonar_, int raw_mm_, uint8_t* confidence_)
+{
+  int16_t sorted[SONAR_MEDIAN_NB];
+  int n = 0, i;
+
+  sonar_->history[sonar_->historyIndex] = raw_mm_;
+  sonar_->historyIndex = (sonar_->historyIndex + 1) % SONAR_MEDIAN_NB;
+
+  for (int j = 0; j < SONAR_MEDIAN_NB; j++)
+  {
+    const int16_t v = sonar_->history[j];
+
+    if (v == SONAR_BAD_VALUE)
+      continue;
+    for (i = n++; i > 0 && sorted[i - 1] > v; i--)
+      sorted[i] = sorted[i - 1];
+    sorted[i] = v;
   }
-  portEND_SWITCHING_ISR(reschedNeeded);
+
+  *confidence_ = n;
+  if (n <= SONAR_MEDIAN_NB / 2)
+    return SONAR_BAD_VALUE;
+  return sorted[n / 2];
 }
 
-int iSonarMeasureDistCm()
+// Fire every sonar of the slot at once, the ones fired returned
+static uint32_t prvSonarFire(int slot_)
 {
-  return value_cm;
+  uint32_t fired = 0;
+
+  ping = xTaskGetTickCount();
+  pingUs = xTimeNowUs();
+  taskENTER_CRITICAL();
+  for (int i = 0; i < SONARS_NB; i++)
+    if (SONAR_SLOT(i) == slot_)
+    {
+      fired |= 1 << i;
+      vSendTriggerPulse(i);
+    }
+  taskEXIT_CRITICAL();
+  return fired;
 }
 
-static void vSonarTask(void* pvParameters_)
+// Echo time to distance factor at the temperature of now
+static uint32_t prvSonarUsToMmMul()
 {
-  // Initialize
-  value_cm = SONAR_BAD_VALUE;
+  int dc = iAdcGetTemperatureDc();
+
+  if (dc < SOUND_MIN_DC)
+    dc = SOUND_MIN_DC;
+  else if (dc > SOUND_MAX_DC)
+    dc = SOUND_MAX_DC;
+  return (uint32_t)(SOUND_MM_S_AT_0C + dc * SOUND_MM_S_PER_C / 10) *
+    4096 / 125000;
+}
+
+// The measures of the slot, once its echoes are in or late. Returns the
+// quiet time before the next one.
+static int prvSonarMeasure(int slot_, uint32_t late_)
+{
+  const uint32_t usToMm = prvSonarUsToMmMul();
+  int dist_mm, longest_us;
+  uint8_t confidence;
+
+  PROFILE_BEGIN(PROFILE_SONAR_SLOT);
 
-  for (;;)
+  // Nothing in range for the late ones: stop listening
+  taskENTER_CRITICAL();
+  for (int i = 0; i < SONARS_NB; i++)
+    if (late_ & (1 << i))
     {
-      // Send sonar trigger pulse
-      mode = TRIGGER;
-      vSendTriggerPulse();
+      vAtomicBitWrite(&SONAR_TIMx->DIER,
+                      ATOMIC_BIT(TIM_SR_CC1IF) + SONAR_CHANNEL(i), 0);
+      sonars[i].state = SONAR_IDLE;
+    }
+  taskEXIT_CRITICAL();
+  // Nor an echo that ended meanwhile, left for the next slot
+  vFlagsClear(&echoes, late_);
+
+  longest_us = 0;
+  for (int i = 0; i < SONARS_NB; i++)
+  {
+    if (SONAR_SLOT(i) != slot_)
+      continue;
+
+    if (late_ & (1 << i))
+      dist_mm = SONAR_BAD_VALUE;
+    else
+    {
+      dist_mm = ((uint32_t)sonars[i].width_us * usToMm) >> US_TO_MM_SHIFT;
+      if (sonars[i].width_us > longest_us)
+        longest_us = sonars[i].width_us;
+    }
 
-      if (!xSemaphoreTake(xResponseSemphr,
-                          (SONAR_TIMEOUT_MS) / portTICK_RATE_MS))
-        value_cm = SONAR_BAD_VALUE;
+    dist_mm = iSonarFilter(&sonars[i], dist_mm, &confidence);
 
-      // Reset capture value
-      capture = BEGIN;
+    sonars[i].dist_mm = dist_mm;
+    measures.sonar[i].dist_mm = dist_mm;
+    measures.sonar[i].tick = ping;
+    measures.sonar[i].time_us = pingUs;
+    measures.sonar[i].valid = dist_mm != SONAR_BAD_VALUE;
+    measures.sonar[i].confidence = confidence;
 
-      // Set timer in echo mode
-      vSetEchoMode();
+    // Record this measure in the samples ring
+    vSamplesPush(sampleSensor[i], dist_mm);
+  }
+
+  // The sonars of the slot at once, for the consumers of the topic
+  vTopicsPublish(TOPIC_SONAR, &measures);
 
-      // Wait for the echo pulse end
-      if (!xSemaphoreTake(xResponseSemphr,
-                          (SONAR_TIMEOUT_MS) / portTICK_RATE_MS))
-        value_cm = SONAR_BAD_VALUE;
+  // Once per cycle, with the sharps
+  if (slot_ == SONARS_SLOTS_NB - 1)
+  {
+    vStartupMark(STARTUP_SONAR);
+    vSamplesPush(SAMPLE_SHARP_LEFT, iSharpsMeasureDistMm(SHARP_LEFT));
+    vSamplesPush(SAMPLE_SHARP_RIGHT, iSharpsMeasureDistMm(SHARP_RIGHT));
+  }
 
-      value_cm = value * TIM_ECHO_TC_US / CONV_CONST_US_CM;
+  PROFILE_END(PROFILE_SONAR_SLOT);
+  // Echoes of far obstacles ring longer: wait as long as the longest
+  // echo. After a timeout the air is already quiet.
+  const int interval = minIntervalMs;
+  const int parked = parkedMs;
+
+  return (parked > interval ? parked : interval) + longest_us / 1000;
+}
+
+#ifndef CO_ROUTINES
+static void vSonarTask(void* pvParameters_)
+{
+  uint32_t fired, late;
+  portTickType timeout, wait;
 
-      // Wait 100ms between each call
-      vTaskDelay(100 / portTICK_RATE_MS);
+  vSysmonRegisterTask("sonard");
+
+  for (int slot = 0; ; slot = (slot + 1) % SONARS_SLOTS_NB)
+    {
+      // Time slotted: in the window of this robot only
+      wait = prvSonarFleetWait(&timeout);
+      if (wait)
+        vTaskDelay(wait);
+      fired = prvSonarFire(slot);
+
+      // Wait for all the echoes of the slot, the ones past it rejected
+      late = fired & ~uFlagsWait(&echoes, fired, FLAGS_ALL, timeout);
+
+      vTaskDelay(MS_TO_TICKS(prvSonarMeasure(slot, late)));
     }
 }
+#else
+// Same, polling the echoes tick by tick: the idle task never blocks.
+// Nothing on the stack across a delay.
+static void vSonarCoRoutine(xCoRoutineHandle xHandle_,
+                            unsigned portBASE_TYPE index_)
+{
+  static int slot;
+  static uint32_t fired, got;
+  static portTickType timeout, wait;
+
+  crSTART(xHandle_);
+
+  for (;; slot = (slot + 1) % SONARS_SLOTS_NB)
+  {
+    wait = prvSonarFleetWait(&timeout);
+    if (wait)
+      crDELAY(xHandle_, wait);
+    fired = prvSonarFire(slot);
+
+    // Wait for all the echoes of the slot
+    got = 0;
+    for (;;)
+    {
+      got |= uFlagsWait(&echoes, fired & ~got, FLAGS_ALL, 0);
+      if (got == fired || xTaskGetTickCount() - ping >= timeout)
+        break;
+      crDELAY(xHandle_, 1);
+    }
 
+    crDELAY(xHandle_, MS_TO_TICKS(prvSonarMeasure(slot, fired & ~got)));
+  }
+
+  crEND();
+}
+#endif
@@ -11,15 +11,137 @@
 
 #include "FreeRTOS.h"
 
+#define SONARS_NB 3
+
+#define SONAR_LEFT   0
+#define SONAR_CENTER 1
+#define SONAR_RIGHT  2
+
+// Mounting: the side sonars turned by SONAR_SIDE_ANGLE_DEG from the
+// heading, left counterclockwise
+#define SONAR_SIDE_ANGLE_DEG 30
+
+// Returned when no echo came back in time
+#define SONAR_BAD_VALUE (-1)
+// No obstacle = 38ms returned
+#define SONAR_TIMEOUT_MS 38
+
+// Quiet time between an echo end and the next ping, the longest echo of
+// the slot is added to it
+#define SONAR_DEFAULT_INTERVAL_MS 10
+#define SONAR_MIN_INTERVAL_MS     5
+
+// Published distances are the median of the last raw measures, and bad
+// when most of them are
+#define SONAR_MEDIAN_NB 3
+
+// Driver state, the pins and channels are constants of sonar.c
 typedef struct
 {
-  GPIO_TypeDef* GPIOx;
-  uint16_t GPIO_Pin_x;
-  TIM_TypeDef* TIMx;
+  volatile uint8_t state;
+  uint16_t start;
+  volatile int width_us;
+  int16_t history[SONAR_MEDIAN_NB]; // Raw measures, SONAR_BAD_VALUE too
+  uint8_t historyIndex;
+  int dist_mm;
 } sonar_t;
 
+typedef struct
+{
+  int dist_mm;
+  portTickType tick;  // Ping time of the measure
+  uint32_t time_us;   // Same, on the microseconds timebase
+  uint8_t valid;
+  uint8_t confidence; // Good raw measures in the median window
+} sonar_measure_t;
+
+// TOPIC_SONAR sample, by SONAR_x
+typedef struct
+{
+  sonar_measure_t sonar[SONARS_NB];
+} sonar_measures_t;
+
+// Daemon stack, in words
+#ifndef SONAR_STACK_SIZE
+# define SONAR_STACK_SIZE configMINIMAL_STACK_SIZE
+#endif
+
+// Parked: at least interval_ms_ between the slots, whatever the minimum
+// interval set, 0 back to it. A slot already waiting ends its wait first.
+#define SONAR_PARKED_INTERVAL_MS 250
+
+// Robots sharing a room, time slotted: the air split in frames of
+// robots_ windows of window_ms_, this robot firing in window index_ only,
+// one slot of its sonars per window, SONAR_FLEET_GUARD_MS after the start.
+// The echoes must end SONAR_FLEET_GUARD_MS before the window does, the
+// later ones are bad: the range shrinks with windows under
+// SONAR_FLEET_FULL_WINDOW_MS. The windows are placed on the microseconds
+// timebase: window 0 starts when xTimeNowUs() modulo the frame is
+// phase_us_. The host maps its fleet time to each board by the PROTO_TIME
+// pings, and sends the phase again often enough for the crystals not to
+// drift apart by the guard (50 ppm: 3 ms a minute), and past the wrap of
+// the timebase. 0 robots: off, back to the quiet interval alone.
+#define SONAR_FLEET_MAX            16
+#define SONAR_FLEET_GUARD_MS       2
+#define SONAR_FLEET_MIN_WINDOW_MS  20
+#define SONAR_FLEET_FULL_WINDOW_MS \
+  (SONAR_TIMEOUT_MS + 2 * SONAR_FLEET_GUARD_MS)
+
+typedef struct
+{
+  uint8_t robots;
+  uint8_t index;
+  uint16_t window_ms;
+  uint32_t phase_us;
+} sonar_fleet_t;
+
+// No echo from any of them: what the readers of TOPIC_SONAR take while
+// nothing was published
+static inline void vSonarClearMeasures(sonar_measures_t* measures_)
+{
+  for (int i = 0; i < SONARS_NB; i++)
+  {
+    measures_->sonar[i].dist_mm = SONAR_BAD_VALUE;
+    measures_->sonar[i].tick = 0;
+    measures_->sonar[i].time_us = 0;
+    measures_->sonar[i].valid = 0;
+    measures_->sonar[i].confidence = 0;
+  }
+}
+
+#ifndef NO_SONAR
 void vSonarInit(unsigned portBASE_TYPE sonarDaemonPriority_);
-int iSonarMeasureDistCm();
-// Should not be called more than each 50ms.
+int iSonarMeasureDistMm(int sonar_);
+void vSonarGetMeasure(int sonar_, sonar_measure_t* measure_);
+void vSonarSetMinInterval(int interval_ms_);
+void vSonarSetParkedInterval(int interval_ms_);
+// 0 for a schedule out of range, the one running kept
+int xSonarSetFleet(const sonar_fleet_t* fleet_);
+void vSonarGetFleet(sonar_fleet_t* fleet_);
+#else
+// Built without (--without sonar): never an echo, TOPIC_SONAR never
+// published
+static inline int iSonarMeasureDistMm(int sonar_)
+{
+  return SONAR_BAD_VALUE;
+}
+static inline void vSonarGetMeasure(int sonar_, sonar_measure_t* measure_)
+{
+  sonar_measures_t none;
+
+  vSonarClearMeasures(&none);
+  *measure_ = none.sonar[sonar_];
+}
+static inline void vSonarSetMinInterval(int interval_ms_) {}
+static inline void vSonarSetParkedInterval(int interval_ms_) {}
+static inline int xSonarSetFleet(const sonar_fleet_t* fleet_) { return 0; }
+static inline void vSonarGetFleet(sonar_fleet_t* fleet_)
+{
+  fleet_->robots = 0;
+  fleet_->index = 0;
+  fleet_->window_ms = 0;
+  fleet_->phase_us = 0;
+}
+#endif
 
 #endif
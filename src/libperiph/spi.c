@@ -0,0 +1,243 @@
+#include <string.h>
+
+#include "FreeRTOS.h"
+
+#include "misc.h"
+#include "task.h"
+
+#include "stm32f10x_dma.h"
+#include "stm32f10x_gpio.h"
+#include "stm32f10x_rcc.h"
+#include "stm32f10x_spi.h"
+
+#include "libglobal/protocol.h"
+#include "libperiph/hardware.h"
+#include "libperiph/priorities.h"
+#include "libperiph/resources.h"
+#include "libperiph/spi.h"
+
+// Remapped: PA4 to PA7 are the cliff bumper, the LED and a sharp
+#define SPI_NSS_GPIOx GPIOA
+#define SPI_NSS_Pin   GPIO_Pin_15
+#define SPI_GPIOx     GPIOB
+#define SPI_SCK_Pin   GPIO_Pin_3
+#define SPI_MISO_Pin  GPIO_Pin_4
+#define SPI_MOSI_Pin  GPIO_Pin_5
+
+// SPI1_RX and SPI1_TX DMA requests
+#define SPI_RX_DMA_CHANNEL DMA1_Channel2
+#define SPI_TX_DMA_CHANNEL DMA1_Channel3
+
+// Double buffered state: the DMA reads the front frame, publications go
+// to the back one, swapped between two transactions
+static uint8_t txFrames[2][SPI_FRAME_SIZE];
+static volatile uint8_t txFront;
+static volatile uint8_t swapPending;
+static uint8_t sequence;
+
+// The DMA fills one frame while the other is checked
+static uint8_t rxFrames[2][SPI_FRAME_SIZE];
+static uint8_t rxFront;
+
+static pfunSpiFrame frameHandler;
+
+static spi_stats_t stats;
+
+static void prvSpiConfigure();
+static void prvSpiDmaInit();
+static void prvSpiArm();
+
+void vSpiInit()
+{
+  vSpiClockInit(SPI1);
+  vGpioClockInit(SPI_NSS_GPIOx);
+  vGpioClockInit(SPI_GPIOx);
+  RCC_APB2PeriphClockCmd(RCC_APB2Periph_AFIO, ENABLE);
+
+  prvSpiDmaInit();
+
+  // Publications are swapped in by this interrupt: it must stay in the
+  // range masked by the kernel.
+  NVIC_InitTypeDef NVIC_InitStruct =
+    {
+      .NVIC_IRQChannel                   = DMA1_Channel2_IRQn,
+      .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_SPI,
+      .NVIC_IRQChannelSubPriority        = 0,
+      .NVIC_IRQChannelCmd                = ENABLE,
+    };
+  NVIC_Init(&NVIC_InitStruct);
+
+  // PA15, PB3 and PB4 are JTAG pins out of reset, SWD stays
+  xResourceClaim(RESOURCE_REMAP_SWJ, "spi");
+  xResourceClaim(RESOURCE_REMAP_SPI1, "spi");
+  GPIO_PinRemapConfig(GPIO_Remap_SWJ_JTAGDisable, ENABLE);
+  GPIO_PinRemapConfig(GPIO_Remap_SPI1, ENABLE);
+
+  GPIO_InitTypeDef GPIO_InitStruct =
+    {
+      .GPIO_Pin   = SPI_NSS_Pin,
+      .GPIO_Speed = GPIO_Speed_50MHz,
+      .GPIO_Mode  = GPIO_Mode_IPU, // Deselected while the Pi is off
+    };
+  GPIO_Init(SPI_NSS_GPIOx, &GPIO_InitStruct);
+  GPIO_InitStruct.GPIO_Pin  = SPI_SCK_Pin | SPI_MOSI_Pin;
+  GPIO_InitStruct.GPIO_Mode = GPIO_Mode_IN_FLOATING;
+  GPIO_Init(SPI_GPIOx, &GPIO_InitStruct);
+  GPIO_InitStruct.GPIO_Pin  = SPI_MISO_Pin;
+  GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF_PP;
+  GPIO_Init(SPI_GPIOx, &GPIO_InitStruct);
+
+  prvSpiConfigure();
+}
+
+// Also used to restore the peripheral after a resync
+static void prvSpiConfigure()
+{
+  SPI_InitTypeDef SPI_InitStruct =
+    {
+      .SPI_Direction         = SPI_Direction_2Lines_FullDuplex,
+      .SPI_Mode              = SPI_Mode_Slave,
+      .SPI_DataSize          = SPI_DataSize_8b,
+      .SPI_CPOL              = SPI_CPOL_Low,
+      .SPI_CPHA              = SPI_CPHA_1Edge,
+      .SPI_NSS               = SPI_NSS_Hard,
+      .SPI_BaudRatePrescaler = SPI_BaudRatePrescaler_2, // Clocked by the master
+      .SPI_FirstBit          = SPI_FirstBit_MSB,
+      .SPI_CRCPolynomial     = 7,
+    };
+  SPI_Init(SPI1, &SPI_InitStruct);
+  SPI_I2S_DMACmd(SPI1, SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx, ENABLE);
+
+  prvSpiArm();
+  SPI_Cmd(SPI1, ENABLE);
+}
+
+static void prvSpiDmaInit()
+{
+  xResourceClaim(RESOURCE_DMA1_CH2, "spi");
+  xResourceClaim(RESOURCE_DMA1_CH3, "spi");
+  vDmaClockInit(DMA1);
+
+  // RX: SPI data register to the back frame, a frame at a time
+  DMA_DeInit(SPI_RX_DMA_CHANNEL);
+  DMA_InitTypeDef DMA_InitStructure;
+  DMA_StructInit(&DMA_InitStructure);
+  DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)(&SPI1->DR);
+  DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)rxFrames[0];
+  DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
+  DMA_InitStructure.DMA_BufferSize = SPI_FRAME_SIZE;
+  DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+  DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+  DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+  DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+  DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+  DMA_InitStructure.DMA_Priority = DMA_Priority_VeryHigh;
+  DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+  DMA_Init(SPI_RX_DMA_CHANNEL, &DMA_InitStructure);
+  // The end of a frame, the next one is armed from the interrupt
+  DMA_ITConfig(SPI_RX_DMA_CHANNEL, DMA_IT_TC, ENABLE);
+
+  // TX: front frame to the SPI data register
+  DMA_DeInit(SPI_TX_DMA_CHANNEL);
+  DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)txFrames[0];
+  DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralDST;
+  DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+  DMA_Init(SPI_TX_DMA_CHANNEL, &DMA_InitStructure);
+}
+
+// Start both channels for the next frame, between two transactions. The
+// TX channel loads the first byte in the data register right away.
+static void prvSpiArm()
+{
+  SPI_RX_DMA_CHANNEL->CCR &= ~DMA_CCR2_EN;
+  SPI_TX_DMA_CHANNEL->CCR &= ~DMA_CCR3_EN;
+
+  if (swapPending)
+  {
+    txFront = !txFront;
+    swapPending = 0;
+  }
+
+  SPI_RX_DMA_CHANNEL->CMAR = (uint32_t)rxFrames[rxFront];
+  SPI_RX_DMA_CHANNEL->CNDTR = SPI_FRAME_SIZE;
+  SPI_TX_DMA_CHANNEL->CMAR = (uint32_t)txFrames[txFront];
+  SPI_TX_DMA_CHANNEL->CNDTR = SPI_FRAME_SIZE;
+
+  SPI_RX_DMA_CHANNEL->CCR |= DMA_CCR2_EN;
+  SPI_TX_DMA_CHANNEL->CCR |= DMA_CCR3_EN;
+}
+
+void vSpiSetFrameHandler(pfunSpiFrame handler_)
+{
+  frameHandler = handler_;
+}
+
+void vSpiGetStats(spi_stats_t* stats_)
+{
+  taskENTER_CRITICAL();
+  *stats_ = stats;
+  taskEXIT_CRITICAL();
+}
+
+void vSpiPublish(const void* payload_, int size_)
+{
+  if (size_ > SPI_PAYLOAD_SIZE)
+    size_ = SPI_PAYLOAD_SIZE;
+
+  // Once no swap is pending, the interrupt leaves the back frame alone
+  swapPending = 0;
+
+  uint8_t* frame = txFrames[!txFront];
+  frame[0] = SPI_SYNC;
+  frame[1] = ++sequence;
+  memcpy(&frame[2], payload_, size_);
+  memset(&frame[2 + size_], 0, SPI_PAYLOAD_SIZE - size_);
+  frame[SPI_FRAME_SIZE - 1] = uProtoCrc8(0, &frame[1], SPI_FRAME_SIZE - 2);
+
+  swapPending = 1;
+}
+
+int iSpiCheckSync()
+{
+  int partial;
+
+  // A partial frame with the master gone. A complete one (nothing left
+  // to transfer) waits for the interrupt.
+  taskENTER_CRITICAL();
+  const uint16_t left = SPI_RX_DMA_CHANNEL->CNDTR;
+  partial = left != SPI_FRAME_SIZE && left != 0 &&
+    GPIO_ReadInputDataBit(SPI_NSS_GPIOx, SPI_NSS_Pin);
+  if (partial)
+  {
+    // Also flushes the byte preloaded in the data register
+    RCC_APB2PeriphResetCmd(RCC_APB2Periph_SPI1, ENABLE);
+    RCC_APB2PeriphResetCmd(RCC_APB2Periph_SPI1, DISABLE);
+    prvSpiConfigure();
+    stats.resyncs++;
+  }
+  taskEXIT_CRITICAL();
+
+  return partial;
+}
+
+void DMA1_Channel2_IRQHandler()
+{
+  const uint8_t* frame = rxFrames[rxFront];
+
+  DMA1->IFCR = DMA_IFCR_CGIF2;
+
+  // Arm first, the master may start the next frame right away
+  rxFront = !rxFront;
+  prvSpiArm();
+
+  if (frame[0] != SPI_SYNC ||
+      uProtoCrc8(0, &frame[1], SPI_FRAME_SIZE - 2) != frame[SPI_FRAME_SIZE - 1])
+  {
+    stats.errors++;
+    return;
+  }
+
+  stats.frames++;
+  if (frameHandler)
+    frameHandler(&frame[2]);
+}
@@ -0,0 +1,42 @@
+#ifndef LIBPERIPH_SPI_H
+# define LIBPERIPH_SPI_H
+
+#include <stdint.h>
+
+// SPI1 slave link to the Raspberry Pi (configure with --spi-link), mode 0,
+// MSB first, hardware NSS. Each transaction exchanges one fixed size frame
+// each way, with no CPU work per byte:
+//   SPI_SYNC | sequence | payload[SPI_PAYLOAD_SIZE] | crc8(sequence, payload)
+// The master clocks out its command and gets the last published state, up
+// to 4 MHz (the frame check must end before the next frame is complete).
+// Remapped to PA15 (NSS), PB3 (SCK), PB4 (MISO), PB5 (MOSI): the JTAG port
+// is disabled, flash and debug over SWD.
+#define SPI_FRAME_SIZE   64
+#define SPI_SYNC         0xA5
+#define SPI_PAYLOAD_SIZE (SPI_FRAME_SIZE - 3)
+
+// Called from the DMA interrupt with the payload of each valid frame
+// received. Must not block.
+typedef void (*pfunSpiFrame)(const uint8_t* payload_);
+
+typedef struct
+{
+  uint32_t frames;  // Valid frames received
+  uint16_t errors;  // Bad sync or CRC
+  uint16_t resyncs; // Partial frames dropped, see iSpiCheckSync
+} spi_stats_t;
+
+void vSpiInit();
+void vSpiSetFrameHandler(pfunSpiFrame handler_);
+void vSpiGetStats(spi_stats_t* stats_);
+
+// Payload sent from the next transaction on, padded with zeroes. Each
+// publication increments the sequence.
+void vSpiPublish(const void* payload_, int size_);
+
+// Drop a partial frame left by a transaction cut short, from a task:
+// otherwise all the following frames would be shifted. Returns 1 after a
+// resync.
+int iSpiCheckSync();
+
+#endif /* LIBPERIPH_SPI_H */
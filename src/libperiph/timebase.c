@@ -0,0 +1,57 @@
+#include "libperiph/timebase.h"
+#include "libperiph/cycles.h"
+
+typedef struct
+{
+  uint32_t cycles; // Counter value at time_us, whole microseconds
+  uint32_t time_us;
+} timebase_t;
+
+// Written by the tick hook only, in the slot not pointed at by the
+// generation, which is bumped once the slot is complete. A reader
+// preempting the writer reads the other slot, a preempted reader
+// retries on a generation change.
+static volatile timebase_t bases[2];
+static volatile uint32_t generation;
+
+void vTimebaseInit()
+{
+  vCyclesInit();
+  bases[0].cycles = uCyclesNow();
+  bases[0].time_us = 0;
+  generation = 0;
+}
+
+void vTimebaseTick()
+{
+  volatile const timebase_t* base = &bases[generation & 1];
+  volatile timebase_t* next = &bases[(generation + 1) & 1];
+  const uint32_t elapsed_us = (uCyclesNow() - base->cycles) / CYCLES_PER_US;
+
+  // The remainder cycles are carried over to the next update
+  next->cycles = base->cycles + elapsed_us * CYCLES_PER_US;
+  next->time_us = base->time_us + elapsed_us;
+  generation++;
+}
+
+uint32_t xTimeNowUs()
+{
+  uint32_t seen, cycles, time_us;
+
+  do
+  {
+    seen = generation;
+    cycles = bases[seen & 1].cycles;
+    time_us = bases[seen & 1].time_us;
+  } while (seen != generation);
+
+  return time_us + (uCyclesNow() - cycles) / CYCLES_PER_US;
+}
+
+void vTimeDelayUs(uint32_t us_)
+{
+  const uint32_t start = uCyclesNow();
+  const uint32_t cycles = us_ * CYCLES_PER_US;
+
+  while (uCyclesNow() - start < cycles);
+}
@@ -0,0 +1,20 @@
+#ifndef LIBPERIPH_TIMEBASE_H
+# define LIBPERIPH_TIMEBASE_H
+
+#include <stdint.h>
+
+// Microseconds since boot, shared by all the drivers. Built on the DWT
+// cycle counter, extended past its 59 s wrap by the tick hook. The 32
+// bits count wraps around after 71 minutes, differences stay right.
+// Lock free: callable from any task or interrupt.
+uint32_t xTimeNowUs();
+
+// Busy wait, exact to the cycle but lengthened by the interrupts
+void vTimeDelayUs(uint32_t us_);
+
+// From vHardwareInit, before any other call
+void vTimebaseInit();
+// From the kernel tick hook, at least once per 59 s
+void vTimebaseTick();
+
+#endif /* LIBPERIPH_TIMEBASE_H */
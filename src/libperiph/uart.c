@@ -1,35 +1,219 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "libperiph/uart.h"
 
 #include "FreeRTOS.h"
 #include "queue.h"
 #include "semphr.h"
 #include "stm32f10x.h"
+#include "stm32f10x_dma.h"
 #include "stm32f10x_gpio.h"
 #include "stm32f10x_usart.h"
 #include "stm32f10x_rcc.h"
 #include "misc.h"
 #include "task.h"
 
-static xQueueHandle xUartRxQueue;
-static xQueueHandle xUartTxQueue;
-static xSemaphoreHandle xUartTxMutex;
+#include "libglobal/actuation.h"
+#include "libglobal/fault.h"
+#include "libglobal/flags.h"
+#include "libglobal/profile.h"
+#include "libglobal/protocol.h"
+#include "libglobal/queues.h"
+#include "libglobal/ring.h"
+#include "libglobal/timeline.h"
+
+#include "libperiph/hardware.h"
+#include "libperiph/link.h"
+#include "libperiph/motors.h"
+#include "libperiph/periodic.h"
+#include "libperiph/priorities.h"
+#include "libperiph/resources.h"
+
+// TX ring buffer drained by DMA1 channel 4 (USART1_TX). Must be a power of 2.
+#define UART_TX_BUFFER_SIZE 256
+#define UART_TX_DMA_CHANNEL DMA1_Channel4
+
+// Bulk lane of USART1, for the telemetry stream when it has no UART of its
+// own: a few frames, a message size each
+#define UART_TX_BULK_BUFFER_SIZE  128
+#define UART_TX_BULK_MESSAGES_NB  8
+
+// RX circular buffer filled by DMA1 channel 5 (USART1_RX). Must be a power of 2.
+#define UART_RX_BUFFER_SIZE 256
+#define UART_RX_BUFFER_MASK (UART_RX_BUFFER_SIZE - 1)
+#define UART_RX_DMA_CHANNEL DMA1_Channel5
+
+#define UART_RX_HALF        (UART_RX_BUFFER_SIZE / 2)
+
+// With flow control, the RX DMA stops at its half and full marks when
+// that much is unread, before it can lap the reader until the next mark,
+// and the byte left in DR holds RTS deasserted. It goes on once the
+// reader is down to the resume level.
+#define UART_RX_PAUSE_LEVEL  (UART_RX_HALF - 16)
+#define UART_RX_RESUME_LEVEL (UART_RX_BUFFER_SIZE / 4)
+
+// Flow control pins, free unless CAN_BUS (or USB_LINK, without the UART)
+#define UART_GPIOx   GPIOA
+#define UART_CTS_Pin GPIO_Pin_11
+#define UART_RTS_Pin GPIO_Pin_12
+
+#ifdef TELEMETRY_UART
+// USART3 TX on PC10 (partial remap), drained by DMA1 channel 2
+// (USART3_TX, shared with the TIM2 update: no PWM burst then)
+# define UART_TELEMETRY_TX_BUFFER_SIZE 512
+# define UART_TELEMETRY_DMA_CHANNEL    DMA1_Channel2
+# define UART_TELEMETRY_GPIOx          GPIOC
+# define UART_TELEMETRY_TX_Pin         GPIO_Pin_10
+#endif
+
+// Wakeups, UART_WAKEUP only: on idle line and DMA half/full transfer, new
+// bytes are available; by the TX DMA interrupt, room was made in the ring
+#define UART_WAKEUP 0x01
+static flags_t rxWakeup;
+
+// Lane of the messages that give way to the others, whole messages only:
+// the DMA takes one when the main ring is empty and no writer is in the
+// middle of a message, and sends it to its end before the main ring again.
+// A reply waits for one bulk message at most.
+typedef struct
+{
+  ring_t ring;
+  uint16_t size;
+  uint16_t messages[UART_TX_BULK_MESSAGES_NB]; // Sizes, from the oldest
+  uint8_t first;
+  uint8_t count;
+  uint16_t sent;                     // Of the oldest message, by the DMA
+  uint8_t reserved;                  // A message written in place
+  queue_stats_t queue;
+} uart_bulk_t;
+
+// Transmitter of a USART, the same for the shell and the telemetry: a
+// ring produced by the tasks, under the interrupt mask, and consumed by a
+// DMA channel one span at a time
+typedef struct
+{
+  USART_TypeDef* USARTx;
+  DMA_Channel_TypeDef* dma;
+  int dmaShift;                      // Of the channel flags in ISR and IFCR
+  xSemaphoreHandle mutex;
+  flags_t wakeup;
+  ring_t ring;
+  uint16_t size;
+  // Size of the span being sent by the DMA (0 when idle), and how much of
+  // it was already released
+  volatile uint16_t dmaCount;
+  uint16_t dmaReleased;
+  uint8_t dmaBulk;                   // The span is from the bulk lane
+  // Writers in the middle of a message, the bulk lane waits for them
+  volatile uint8_t writers;
+  uart_bulk_t* bulk;                 // NULL without a bulk lane
+  queue_stats_t queue;
+} uart_tx_t;
+
+static uint8_t txBuffer[UART_TX_BUFFER_SIZE];
+static uint8_t txBulkBuffer[UART_TX_BULK_BUFFER_SIZE];
+static uart_bulk_t txBulk;
+static uart_tx_t tx;
+#ifdef TELEMETRY_UART
+static uint8_t telemetryBuffer[UART_TELEMETRY_TX_BUFFER_SIZE];
+static uart_tx_t telemetry;
+#endif
+
+static volatile char rxBuffer[UART_RX_BUFFER_SIZE];
+// Free running counts: halves of the ring filled, by the DMA interrupt,
+// bytes read, by the reader task. The difference tells a lapped reader.
+static volatile uint32_t rxHalves;
+static volatile uint32_t rxRead;
+static volatile int rxPaused;
+// The motor frames, decoded by the interrupts as the bytes come: free
+// running count of the bytes seen
+static proto_decoder_t rxFrames;
+static uint32_t rxScanned;
+
+// Written by the interrupts, read as is
+static uart_stats_t stats;
+static queue_stats_t rxQueue;
+
+// Line setting, and the one to come back to until confirmed
+static uart_line_t line = { UART_DEFAULT_BAUDS, 0 };
+static uart_line_t previous;
+static volatile int confirming;
+static periodic_t confirmTimeout;
+
+RAMFUNC static void prvUartTxKick(uart_tx_t* tx_);
+static void prvUartConfirmTimeout();
+static int prvUartClocks(int phase_, const RCC_ClocksTypeDef* clocks_);
+
+// The USART and its DMA request are set up by the caller
+static void prvUartTxInit(uart_tx_t* tx_, const char* name_,
+                          USART_TypeDef* USARTx_, DMA_Channel_TypeDef* dma_,
+                          int channel_, uint8_t* buffer_, uint16_t size_)
+{
+  tx_->USARTx = USARTx_;
+  tx_->dma = dma_;
+  tx_->dmaShift = 4 * (channel_ - 1);
+  tx_->mutex = xSemaphoreCreateMutex();
+  if (!tx_->mutex)
+    vFaultAllocation(name_);
+  vFlagsInit(&tx_->wakeup);
+  vRingInit(&tx_->ring, buffer_, size_);
+  tx_->size = size_;
+  vQueuesRegister(&tx_->queue, name_, size_);
+  xResourceClaim(RESOURCE_DMA1_CH1 + channel_ - 1, name_);
+  vDmaClockInit(DMA1);
+
+  // Memory (TX ring) to USART data register, one span at a time
+  DMA_DeInit(dma_);
+  DMA_InitTypeDef DMA_InitStructure;
+  DMA_StructInit(&DMA_InitStructure);
+  DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)(&USARTx_->DR);
+  DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)buffer_;
+  DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralDST;
+  DMA_InitStructure.DMA_BufferSize = 1;    // Set per chunk, 0 fails the check
+  DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+  DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+  DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+  DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+  DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+  DMA_InitStructure.DMA_Priority = DMA_Priority_Medium;
+  DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+  DMA_Init(dma_, &DMA_InitStructure);
+  // Half transfer releases room early, transfer complete ends the chunk
+  DMA_ITConfig(dma_, DMA_IT_HT | DMA_IT_TC, ENABLE);
+}
 
 void vUartInit()
 {
-  xUartTxMutex = xSemaphoreCreateMutex();
-  xUartRxQueue = xQueueCreate(16, sizeof(char));
-  xUartTxQueue = xQueueCreate(16, sizeof(char));
+  vFlagsInit(&rxWakeup);
+  prvUartTxInit(&tx, "uart tx", USART1, UART_TX_DMA_CHANNEL, 4, txBuffer,
+                UART_TX_BUFFER_SIZE);
+  vRingInit(&txBulk.ring, txBulkBuffer, UART_TX_BULK_BUFFER_SIZE);
+  txBulk.size = UART_TX_BULK_BUFFER_SIZE;
+  vQueuesRegister(&txBulk.queue, "uart bulk", UART_TX_BULK_BUFFER_SIZE);
+  tx.bulk = &txBulk;
+  vQueuesRegister(&rxQueue, "uart rx", UART_RX_BUFFER_SIZE);
+  vPeriodicInit(&confirmTimeout, "uart", &prvUartConfirmTimeout);
+  vHardwareOnClocks(&prvUartClocks);
 
   // Enable interrupt UART:
   NVIC_InitTypeDef NVIC_InitStructure =
   {
     .NVIC_IRQChannel = USART1_IRQn,
-    .NVIC_IRQChannelPreemptionPriority = 7,
+    .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_UART,
     .NVIC_IRQChannelSubPriority = 0,
     .NVIC_IRQChannelCmd = ENABLE,
   };
   NVIC_Init(&NVIC_InitStructure);
 
+  // Enable interrupt of the TX DMA channel:
+  NVIC_InitStructure.NVIC_IRQChannel = DMA1_Channel4_IRQn;
+  NVIC_Init(&NVIC_InitStructure);
+
+  // Enable interrupt of the RX DMA channel:
+  NVIC_InitStructure.NVIC_IRQChannel = DMA1_Channel5_IRQn;
+  NVIC_Init(&NVIC_InitStructure);
+
   // Enable clock for PC:
   RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOA, ENABLE);
   // Enable clock for UART:
@@ -46,24 +230,156 @@ void vUartInit()
     };
   GPIO_Init(GPIOA, &GPIO_InitStruct);
 
+  // Tx pin, fast enough edges for 4.5 Mbauds:
+  GPIO_InitStruct.GPIO_Pin = GPIO_Pin_9;
+  GPIO_InitStruct.GPIO_Speed = GPIO_Speed_50MHz;
+  GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF_PP;
+  GPIO_Init(GPIOA, &GPIO_InitStruct);
+
   USART_InitTypeDef UART_InitStructure;
   USART_StructInit(&UART_InitStructure);
-  UART_InitStructure.USART_BaudRate = 115200,
+  UART_InitStructure.USART_BaudRate = UART_DEFAULT_BAUDS,
   UART_InitStructure.USART_WordLength = USART_WordLength_8b,
   UART_InitStructure.USART_StopBits = USART_StopBits_1,
   UART_InitStructure.USART_Parity = USART_Parity_No,
   UART_InitStructure.USART_HardwareFlowControl = USART_HardwareFlowControl_None,
   UART_InitStructure.USART_Mode = USART_Mode_Rx | USART_Mode_Tx,
   USART_Init(USART1, &UART_InitStructure);
+
+  // RX DMA: USART data register to the RX buffer, never stops
+  xResourceClaim(RESOURCE_DMA1_CH5, "uart rx");
+  DMA_DeInit(UART_RX_DMA_CHANNEL);
+  DMA_InitTypeDef DMA_InitStructure;
+  DMA_StructInit(&DMA_InitStructure);
+  DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)(&USART1->DR);
+  DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)rxBuffer;
+  DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
+  DMA_InitStructure.DMA_BufferSize = UART_RX_BUFFER_SIZE;
+  DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+  DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+  DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+  DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+  DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
+  DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+  DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+  DMA_Init(UART_RX_DMA_CHANNEL, &DMA_InitStructure);
+  // Wake up the reader before the DMA laps it on long bursts
+  DMA_ITConfig(UART_RX_DMA_CHANNEL, DMA_IT_HT | DMA_IT_TC, ENABLE);
+  DMA_Cmd(UART_RX_DMA_CHANNEL, ENABLE);
+
+  USART_DMACmd(USART1, USART_DMAReq_Tx | USART_DMAReq_Rx, ENABLE);
+  // Overrun, framing and noise errors of the DMA receptions
+  USART1->CR3 |= USART_CR3_EIE;
+
   USART_Cmd(USART1, ENABLE);
 
-  USART1->CR1 |= USART_CR1_RXNEIE;
+  // The end of a burst is signaled by the idle line interrupt
+  USART1->CR1 |= USART_CR1_IDLEIE;
+}
+
+// Free running count of the bytes received: the last mark passed, then
+// the DMA position from it. The interrupt counts the mark soon enough for
+// the DMA to be less than a lap ahead.
+RAMFUNC static uint32_t prvUartRxHead()
+{
+  const uint32_t marks = rxHalves * UART_RX_HALF;
+  const uint16_t position = (UART_RX_BUFFER_SIZE - UART_RX_DMA_CHANNEL->CNDTR)
+    & UART_RX_BUFFER_MASK;
+
+  return marks + ((position - marks) & UART_RX_BUFFER_MASK);
+}
+
+#ifdef ACTUATION_TRACE
+// Cycle count at the start bit of the byte chars_ characters back, on a
+// line kept busy since: 10 bits per character
+static uint32_t prvUartCharsAgo(uint32_t chars_)
+{
+  return uCyclesNow() -
+    chars_ * (10 * CYCLES_PER_US * 1000000u / line.bauds);
+}
+#endif
+
+// Motor frames straight to the setpoint, at the idle line or the DMA mark
+// that ends them, not after the reader task. The shell still gets them,
+// answers them and sets the same setpoint again. idle_ when the line has
+// been idle for a character, for the tracing.
+RAMFUNC static void prvUartRxMotors(int idle_, portBASE_TYPE* woken_)
+{
+  const uint32_t head = prvUartRxHead();
+  proto_motors_t cmd;
+
+  // Lapped, the frame under way is lost
+  if (head - rxScanned > UART_RX_BUFFER_SIZE)
+  {
+    vProtoDecoderReset(&rxFrames);
+    rxScanned = head - UART_RX_HALF;
+  }
+  while (rxScanned != head)
+  {
+    if (iProtoDecode(&rxFrames,
+                     rxBuffer[rxScanned++ & UART_RX_BUFFER_MASK]) != 1 ||
+        rxFrames.type != PROTO_MOTORS_CMD ||
+        rxFrames.size != sizeof (cmd) || !iProtoIsForUs(&rxFrames))
+      continue;
+    memcpy(&cmd, rxFrames.payload, sizeof (cmd));
+    if (abs(cmd.left) > MOTORS_COMMAND_MAX ||
+        abs(cmd.right) > MOTORS_COMMAND_MAX)
+      continue;
+    vSetMotorsCommand(cmd.left, cmd.right);
+    ACTUATION_START(prvUartCharsAgo(head - rxScanned + idle_ + sizeof (cmd) +
+                                    (rxFrames.addressed ?
+                                     PROTO_OVERHEAD_ADDR : PROTO_OVERHEAD)),
+                    ACTUATION_SETPOINT(cmd.left, cmd.right));
+    vMotorsCommandFromISR(woken_);
+  }
+}
+
+int xUartReadAvailable(char* buf_, int size_)
+{
+  uint32_t rxHead;
+  int n = 0;
+
+  for (;;)
+  {
+    rxHead = prvUartRxHead();
+
+    // Lapped: the oldest half is being written over, skip to the newest
+    if (rxHead - rxRead > UART_RX_BUFFER_SIZE)
+    {
+      stats.dropped += rxHead - UART_RX_HALF - rxRead;
+      vQueuesDrop(&rxQueue, rxHead - UART_RX_HALF - rxRead);
+      rxRead = rxHead - UART_RX_HALF;
+    }
+    vQueuesLevel(&rxQueue, rxHead - rxRead);
+
+    while (rxRead != rxHead && n < size_)
+    {
+      buf_[n++] = rxBuffer[rxRead & UART_RX_BUFFER_MASK];
+      rxRead++;
+    }
+
+    // Caught up: the DMA takes the byte held in DR, then the idle line
+    // and error handler may read DR again
+    if (rxPaused && rxHead - rxRead < UART_RX_RESUME_LEVEL)
+    {
+      taskENTER_CRITICAL();
+      rxPaused = 0;
+      USART1->CR3 |= USART_CR3_DMAR | USART_CR3_EIE;
+      USART1->CR1 |= USART_CR1_IDLEIE;
+      taskEXIT_CRITICAL();
+    }
+
+    if (n)
+      return n;
+
+    uFlagsWait(&rxWakeup, UART_WAKEUP, FLAGS_ANY, portMAX_DELAY);
+  }
 }
 
 char cUartGetc()
 {
   char c;
-  xQueueReceive(xUartRxQueue, &c, portMAX_DELAY);
+  xUartReadAvailable(&c, 1);
   return c;
 }
 
@@ -91,53 +407,699 @@ void vUartGets(char* s_, int size_)
   }
 }
 
+// Start a DMA transfer of the pending bytes if the channel is idle. Must be
+// called with interrupts masked (critical section or DMA interrupt).
+RAMFUNC static void prvUartTxKick(uart_tx_t* tx_)
+{
+  uart_bulk_t* bulk = tx_->bulk;
+  const uint8_t* span;
+  uint16_t count = 0;
+
+  if (tx_->dmaCount)
+    return;
+
+  // Send up to the end of the ring, the rest will follow on completion.
+  // A bulk message is finished first, then the main ring has priority.
+  if (!bulk || !bulk->sent)
+    count = uRingReadSpan(&tx_->ring, &span);
+  tx_->dmaBulk = !count && bulk && bulk->count &&
+    (bulk->sent || !tx_->writers);
+  if (tx_->dmaBulk)
+  {
+    const uint16_t left = bulk->messages[bulk->first] - bulk->sent;
+
+    count = uRingReadSpan(&bulk->ring, &span);
+    if (count > left)
+      count = left;
+  }
+  if (!count)
+    return;
+
+  tx_->dmaCount = count;
+  tx_->dmaReleased = 0;
+  tx_->dma->CMAR = (uint32_t)span;
+  tx_->dma->CNDTR = count;
+  tx_->dma->CCR |= DMA_CCR1_EN;
+}
+
+static void prvUartTxWrite(uart_tx_t* tx_, const char* s_, int size_)
+{
+  uint16_t count;
+  uint32_t start;
+
+  taskENTER_CRITICAL();
+  tx_->writers++;
+  taskEXIT_CRITICAL();
+
+  while (size_ > 0)
+  {
+    // The mask serializes the writers, the producers of the ring
+    taskENTER_CRITICAL();
+    count = uRingWrite(&tx_->ring, s_, size_);
+    if (count)
+    {
+      vQueuesLevel(&tx_->queue, uRingUsed(&tx_->ring));
+      prvUartTxKick(tx_);
+    }
+    taskEXIT_CRITICAL();
+
+    s_ += count;
+    size_ -= count;
+
+    // Ring full: wait for the DMA to free some room
+    if (size_ > 0)
+    {
+      start = uQueuesBlockStart();
+      uFlagsWait(&tx_->wakeup, UART_WAKEUP, FLAGS_ANY, portMAX_DELAY);
+      vQueuesBlockEnd(&tx_->queue, start);
+    }
+  }
+
+  // Message done: the bulk lane may go on if the ring is empty
+  taskENTER_CRITICAL();
+  tx_->writers--;
+  prvUartTxKick(tx_);
+  taskEXIT_CRITICAL();
+}
+
+static void prvUartTxSendMessage(uart_tx_t* tx_, const char* s_, int size_)
+{
+  // A write alone may be split by another writer while the ring is full
+  xSemaphoreTake(tx_->mutex, portMAX_DELAY);
+  prvUartTxWrite(tx_, s_, size_);
+  xSemaphoreGive(tx_->mutex);
+}
+
+static int prvUartTxTrySendMessage(uart_tx_t* tx_, const char* s_, int size_,
+                                   int timeout_ms_)
+{
+  const portTickType start = xTaskGetTickCount();
+  const portTickType timeout = MS_TO_TICKS(timeout_ms_);
+  portTickType elapsed;
+  int sent = 0;
+
+  // Larger than the ring, it would never fit at once
+  if (size_ <= tx_->size &&
+      xSemaphoreTake(tx_->mutex, timeout) == pdTRUE)
+  {
+    for (;;)
+    {
+      taskENTER_CRITICAL();
+      if (uRingRoom(&tx_->ring) >= size_)
+      {
+        uRingWrite(&tx_->ring, s_, size_);
+        vQueuesLevel(&tx_->queue, uRingUsed(&tx_->ring));
+        prvUartTxKick(tx_);
+        sent = 1;
+      }
+      taskEXIT_CRITICAL();
+
+      elapsed = xTaskGetTickCount() - start;
+      if (sent || elapsed >= timeout)
+        break;
+      uFlagsWait(&tx_->wakeup, UART_WAKEUP, FLAGS_ANY, timeout - elapsed);
+    }
+    xSemaphoreGive(tx_->mutex);
+  }
+
+  if (!sent)
+    vQueuesDrop(&tx_->queue, size_);
+  return sent;
+}
+
+// Whole message in the bulk lane or nothing, without the TX lock: the
+// writes to the lane are whole, under the mask
+static int prvUartTxTrySendBulk(uart_tx_t* tx_, const char* s_, int size_,
+                                int timeout_ms_)
+{
+  uart_bulk_t* bulk = tx_->bulk;
+  const portTickType start = xTaskGetTickCount();
+  const portTickType timeout = MS_TO_TICKS(timeout_ms_);
+  portTickType elapsed;
+  int sent = 0;
+
+  if (size_ > bulk->size)
+  {
+    vQueuesDrop(&bulk->queue, size_);
+    return 0;
+  }
+
+  for (;;)
+  {
+    taskENTER_CRITICAL();
+    if (bulk->count < UART_TX_BULK_MESSAGES_NB && !bulk->reserved &&
+        uRingRoom(&bulk->ring) >= size_)
+    {
+      uRingWrite(&bulk->ring, s_, size_);
+      bulk->messages[(bulk->first + bulk->count) % UART_TX_BULK_MESSAGES_NB] =
+        size_;
+      bulk->count++;
+      vQueuesLevel(&bulk->queue, uRingUsed(&bulk->ring));
+      prvUartTxKick(tx_);
+      sent = 1;
+    }
+    taskEXIT_CRITICAL();
+
+    elapsed = xTaskGetTickCount() - start;
+    if (sent || elapsed >= timeout)
+      break;
+    uFlagsWait(&tx_->wakeup, UART_WAKEUP, FLAGS_ANY, timeout - elapsed);
+  }
+
+  if (!sent)
+    vQueuesDrop(&bulk->queue, size_);
+  return sent;
+}
+
+// The same in place: the room of the message, left out of the DMA spans
+// until committed
+static int prvUartTxReserveBulk(uart_tx_t* tx_, ring_slot_t* slot_,
+                                int size_, int timeout_ms_)
+{
+  uart_bulk_t* bulk = tx_->bulk;
+  const portTickType start = xTaskGetTickCount();
+  const portTickType timeout = MS_TO_TICKS(timeout_ms_);
+  portTickType elapsed;
+  int reserved = 0;
+
+  if (size_ > bulk->size)
+  {
+    vQueuesDrop(&bulk->queue, size_);
+    return 0;
+  }
+
+  for (;;)
+  {
+    taskENTER_CRITICAL();
+    if (bulk->count < UART_TX_BULK_MESSAGES_NB && !bulk->reserved &&
+        xRingReserve(&bulk->ring, size_, slot_))
+    {
+      bulk->reserved = 1;
+      reserved = 1;
+    }
+    taskEXIT_CRITICAL();
+
+    elapsed = xTaskGetTickCount() - start;
+    if (reserved || elapsed >= timeout)
+      break;
+    uFlagsWait(&tx_->wakeup, UART_WAKEUP, FLAGS_ANY, timeout - elapsed);
+  }
+
+  if (!reserved)
+    vQueuesDrop(&bulk->queue, size_);
+  return reserved;
+}
+
+static void prvUartTxCommitBulk(uart_tx_t* tx_, int size_)
+{
+  uart_bulk_t* bulk = tx_->bulk;
+
+  taskENTER_CRITICAL();
+  vRingCommit(&bulk->ring, size_);
+  bulk->messages[(bulk->first + bulk->count) % UART_TX_BULK_MESSAGES_NB] =
+    size_;
+  bulk->count++;
+  bulk->reserved = 0;
+  vQueuesLevel(&bulk->queue, uRingUsed(&bulk->ring));
+  prvUartTxKick(tx_);
+  taskEXIT_CRITICAL();
+}
+
+#ifdef TELEMETRY_UART
+// In the main ring, for a transmitter without other writers than the
+// link: the TX lock is held from the reservation to the commit
+static int prvUartTxReserve(uart_tx_t* tx_, ring_slot_t* slot_, int size_,
+                            int timeout_ms_)
+{
+  const portTickType start = xTaskGetTickCount();
+  const portTickType timeout = MS_TO_TICKS(timeout_ms_);
+  portTickType elapsed;
+
+  if (size_ <= tx_->size &&
+      xSemaphoreTake(tx_->mutex, timeout) == pdTRUE)
+  {
+    for (;;)
+    {
+      // The DMA only releases room, no other producer
+      if (xRingReserve(&tx_->ring, size_, slot_))
+        return 1;
+
+      elapsed = xTaskGetTickCount() - start;
+      if (elapsed >= timeout)
+        break;
+      uFlagsWait(&tx_->wakeup, UART_WAKEUP, FLAGS_ANY, timeout - elapsed);
+    }
+    xSemaphoreGive(tx_->mutex);
+  }
+
+  vQueuesDrop(&tx_->queue, size_);
+  return 0;
+}
+
+static void prvUartTxCommit(uart_tx_t* tx_, int size_)
+{
+  taskENTER_CRITICAL();
+  vRingCommit(&tx_->ring, size_);
+  vQueuesLevel(&tx_->queue, uRingUsed(&tx_->ring));
+  prvUartTxKick(tx_);
+  taskEXIT_CRITICAL();
+  xSemaphoreGive(tx_->mutex);
+}
+#endif
+
+// Under the TX lock
+static void prvUartTxDrain(uart_tx_t* tx_)
+{
+  // Each DMA interrupt sets the wakeup, the last one ends the chunk
+  while (uRingUsed(&tx_->ring) || (tx_->bulk && uRingUsed(&tx_->bulk->ring)))
+    uFlagsWait(&tx_->wakeup, UART_WAKEUP, FLAGS_ANY, portMAX_DELAY);
+}
+
+static void prvUartTxFlush(uart_tx_t* tx_)
+{
+  xSemaphoreTake(tx_->mutex, portMAX_DELAY);
+  prvUartTxDrain(tx_);
+  xSemaphoreGive(tx_->mutex);
+}
+
+#if defined(TELEMETRY_UART) || !defined(SDCARD)
+// From the interrupt of the TX DMA channel
+RAMFUNC static void prvUartTxInterrupt(uart_tx_t* tx_,
+                                       portBASE_TYPE* reschedNeeded_)
+{
+  const uint32_t status = DMA1->ISR >> tx_->dmaShift;
+
+  // Clear all the channel flags at once
+  DMA1->IFCR = DMA_IFCR_CGIF1 << tx_->dmaShift;
+
+  uart_bulk_t* bulk = tx_->bulk;
+  ring_t* ring = tx_->dmaBulk ? &bulk->ring : &tx_->ring;
+
+  if (status & DMA_ISR_TCIF1) {
+    // Chunk sent: release it and chain the next one
+    tx_->dma->CCR &= ~DMA_CCR1_EN;
+    vRingRelease(ring, tx_->dmaCount - tx_->dmaReleased);
+    if (tx_->dmaBulk) {
+      bulk->sent += tx_->dmaCount;
+      if (bulk->sent == bulk->messages[bulk->first]) {
+        bulk->first = (bulk->first + 1) % UART_TX_BULK_MESSAGES_NB;
+        bulk->count--;
+        bulk->sent = 0;
+      }
+    }
+    tx_->dmaCount = 0;
+    prvUartTxKick(tx_);
+  }
+  else if (status & DMA_ISR_HTIF1) {
+    // Release the bytes already sent so that writers can go on
+    const uint16_t sent = tx_->dmaCount - tx_->dma->CNDTR;
+
+    vRingRelease(ring, sent - tx_->dmaReleased);
+    tx_->dmaReleased = sent;
+  }
+
+  vFlagsSetFromISR(&tx_->wakeup, UART_WAKEUP, reschedNeeded_);
+}
+#endif
+
+void vUartWrite(const char* s_, int size_)
+{
+  prvUartTxWrite(&tx, s_, size_);
+}
+
 void vUartPutc(char c_)
 {
-  xQueueSend(xUartTxQueue, &c_, portMAX_DELAY);
-  USART1->CR1 |= USART_CR1_TXEIE;
+  vUartWrite(&c_, 1);
 }
 
 void vUartPuts(const char* s_)
 {
-  while (*s_)
-    vUartPutc(*s_++);
+  vUartWrite(s_, strlen(s_));
 }
 
 void vUartSend(const char* s_)
 {
-  xSemaphoreTake(xUartTxMutex, portMAX_DELAY);
+  xSemaphoreTake(tx.mutex, portMAX_DELAY);
   vUartPuts(s_);
   vUartPutc('\r');
-  xSemaphoreGive(xUartTxMutex);
+  xSemaphoreGive(tx.mutex);
 }
 
-void USART1_IRQHandler()
+void vUartSendMessage(const char* s_, int size_)
 {
-  static bool initializedTxPin = FALSE;
-  portBASE_TYPE reschedNeeded = pdFALSE;
-  char c;
+  prvUartTxSendMessage(&tx, s_, size_);
+}
+
+int xUartTrySendMessage(const char* s_, int size_, int timeout_ms_)
+{
+  return prvUartTxTrySendMessage(&tx, s_, size_, timeout_ms_);
+}
+
+int xUartTrySendBulk(const char* s_, int size_, int timeout_ms_)
+{
+  return prvUartTxTrySendBulk(&tx, s_, size_, timeout_ms_);
+}
+
+static int prvUartReserveBulk(ring_slot_t* slot_, int size_, int timeout_ms_)
+{
+  return prvUartTxReserveBulk(&tx, slot_, size_, timeout_ms_);
+}
+
+static void prvUartCommitBulk(int size_)
+{
+  prvUartTxCommitBulk(&tx, size_);
+}
+
+// Bytes or messages, whichever runs out first
+static int prvUartBulkBacklog()
+{
+  const int bytes = uRingUsed(&txBulk.ring) * 1000 / txBulk.size;
+  const int messages = txBulk.count * 1000 / UART_TX_BULK_MESSAGES_NB;
+
+  return bytes > messages ? bytes : messages;
+}
+
+void vUartFlush()
+{
+  prvUartTxFlush(&tx);
+}
+
+static uint32_t prvUartClockHz()
+{
+  RCC_ClocksTypeDef clocks;
+
+  RCC_GetClocksFreq(&clocks);
+  return clocks.PCLK2_Frequency;
+}
+
+static int prvUartCheckLineAt(uint32_t clock_, uint32_t bauds_, int flow_)
+{
+  uint32_t brr, actual;
+
+#ifdef CAN_BUS
+  if (flow_)
+    return 0;
+#endif
+  // 16 samples a bit, 16 bits of divider
+  if (!bauds_ || bauds_ > clock_ / 16)
+    return 0;
+  brr = (clock_ + bauds_ / 2) / bauds_;
+  if (brr > 0xffff)
+    return 0;
+  actual = clock_ / brr;
+  return 50 * (actual > bauds_ ? actual - bauds_ : bauds_ - actual) <= bauds_;
+}
+
+int xUartCheckLine(uint32_t bauds_, int flow_)
+{
+  return prvUartCheckLineAt(prvUartClockHz(), bauds_, flow_);
+}
+
+static void prvUartApply(const uart_line_t* line_)
+{
+  const uint32_t flow = USART_CR3_RTSE | USART_CR3_CTSE;
 
-  if (USART1->SR & USART_SR_RXNE) {
-    c = USART1->DR;
-    xQueueSendFromISR(xUartRxQueue, &c, &reschedNeeded);
-  }
-  else if (USART1->SR & USART_SR_TXE) {
-    if (!initializedTxPin) {
-      // We use registers instead of stm32 lib because we want to save
-      // time inside an interrupt:
-      // Tx (PA9) output push-pull 2MHz:
-      GPIOA->CRH &= ~GPIO_CRH_MODE9_0;
-      GPIOA->CRH |= GPIO_CRH_MODE9_1;
-      GPIOA->CRH &= ~GPIO_CRH_CNF9_0;
-      GPIOA->CRH |= GPIO_CRH_CNF9_1;
-
-      initializedTxPin = TRUE;
+  if (line_->flow != line.flow)
+  {
+    GPIO_InitTypeDef GPIO_InitStruct =
+      {
+        .GPIO_Pin = UART_CTS_Pin | UART_RTS_Pin,
+        .GPIO_Speed = GPIO_Speed_50MHz,
+        .GPIO_Mode = GPIO_Mode_IN_FLOATING,
+      };
+
+    if (line_->flow)
+    {
+      // CTS stays an input, RTS is driven by the USART
+      GPIO_InitStruct.GPIO_Pin = UART_RTS_Pin;
+      GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF_PP;
     }
+    GPIO_Init(UART_GPIOx, &GPIO_InitStruct);
+  }
+
+  // The baud counters restart with BRR, between two bytes
+  USART1->BRR = (prvUartClockHz() + line_->bauds / 2) / line_->bauds;
+  taskENTER_CRITICAL();
+  USART1->CR3 = line_->flow ? USART1->CR3 | flow : USART1->CR3 & ~flow;
+  taskEXIT_CRITICAL();
+  line = *line_;
+}
+
+void vUartSetLine(uint32_t bauds_, int flow_)
+{
+  const uart_line_t next = { bauds_, flow_ != 0 };
+
+  xSemaphoreTake(tx.mutex, portMAX_DELAY);
+  prvUartTxDrain(&tx);
+  // The DMA is done, the last byte still shifts out: two characters
+  vTaskDelay(MS_TO_TICKS(2 + 20000 / line.bauds));
 
-    if (xQueueReceiveFromISR(xUartTxQueue, &c, &reschedNeeded))
-      USART1->DR = c;
-    else
-      USART1->CR1 &= ~USART_CR1_TXEIE;
+  taskENTER_CRITICAL();
+  if (!confirming)
+    previous = line;
+  confirming = 1;
+  taskEXIT_CRITICAL();
+  prvUartApply(&next);
+  xSemaphoreGive(tx.mutex);
+
+  vPeriodicSetPeriod(&confirmTimeout, UART_CONFIRM_MS);
+}
+
+// APB2 divider change: the line, and the line to come back to, must hold
+// at the new rate. The TX lock is kept across the switch, the bytes
+// received meanwhile may be damaged.
+static int prvUartClocks(int phase_, const RCC_ClocksTypeDef* clocks_)
+{
+  switch (phase_)
+  {
+    case HARDWARE_CLOCKS_CHECK:
+      return prvUartCheckLineAt(clocks_->PCLK2_Frequency, line.bauds, 0) &&
+        (!confirming ||
+         prvUartCheckLineAt(clocks_->PCLK2_Frequency, previous.bauds, 0));
+
+    case HARDWARE_CLOCKS_BEFORE:
+      xSemaphoreTake(tx.mutex, portMAX_DELAY);
+      prvUartTxDrain(&tx);
+      vTaskDelay(MS_TO_TICKS(2 + 20000 / line.bauds));
+      break;
+
+    case HARDWARE_CLOCKS_AFTER:
+      prvUartApply(&line);
+      xSemaphoreGive(tx.mutex);
+      break;
+  }
+  return 1;
+}
+
+int xUartConfirmLine()
+{
+  int pending;
+
+  taskENTER_CRITICAL();
+  pending = confirming;
+  confirming = 0;
+  taskEXIT_CRITICAL();
+  vPeriodicSetPeriod(&confirmTimeout, 0);
+  return pending;
+}
+
+// The host did not follow: back to the last confirmed setting
+static void prvUartConfirmTimeout()
+{
+  int pending;
+
+  vPeriodicSetPeriod(&confirmTimeout, 0);
+  taskENTER_CRITICAL();
+  pending = confirming;
+  confirming = 0;
+  taskEXIT_CRITICAL();
+  if (pending)
+    prvUartApply(&previous);
+}
+
+void vUartGetLine(uart_line_t* line_)
+{
+  *line_ = line;
+}
+
+void vUartGetStats(uart_stats_t* stats_)
+{
+  *stats_ = stats;
+}
+
+static uint32_t prvUartErrors()
+{
+  return stats.overruns + stats.framing + stats.noise + stats.dropped;
+}
+
+const link_t xUartLink =
+  {
+    .name = "uart",
+    .init = vUartInit,
+    .read_available = xUartReadAvailable,
+    .write = vUartSendMessage,
+    .try_write = xUartTrySendMessage,
+    .try_write_bulk = xUartTrySendBulk,
+    .reserve_stream = prvUartReserveBulk,
+    .commit_stream = prvUartCommitBulk,
+    .stream_backlog = prvUartBulkBacklog,
+    .flush = vUartFlush,
+    .errors = prvUartErrors,
+  };
+
+#ifdef TELEMETRY_UART
+void vUartTelemetryInit()
+{
+  prvUartTxInit(&telemetry, "telemetry tx", USART3,
+                UART_TELEMETRY_DMA_CHANNEL, 2, telemetryBuffer,
+                UART_TELEMETRY_TX_BUFFER_SIZE);
+
+  NVIC_InitTypeDef NVIC_InitStructure =
+  {
+    .NVIC_IRQChannel = DMA1_Channel2_IRQn,
+    .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_UART,
+    .NVIC_IRQChannelSubPriority = 0,
+    .NVIC_IRQChannelCmd = ENABLE,
+  };
+  NVIC_Init(&NVIC_InitStructure);
+
+  // USART3 is on APB1, which the hardware profiles leave alone
+  RCC_APB1PeriphClockCmd(RCC_APB1Periph_USART3, ENABLE);
+  RCC_APB2PeriphClockCmd(RCC_APB2Periph_AFIO, ENABLE);
+  vGpioClockInit(UART_TELEMETRY_GPIOx);
+  xResourceClaim(RESOURCE_REMAP_USART3, "telemetry tx");
+  GPIO_PinRemapConfig(GPIO_PartialRemap_USART3, ENABLE);
+
+  GPIO_InitTypeDef GPIO_InitStruct =
+    {
+      .GPIO_Pin = UART_TELEMETRY_TX_Pin,
+      .GPIO_Speed = GPIO_Speed_50MHz,
+      .GPIO_Mode = GPIO_Mode_AF_PP,
+    };
+  GPIO_Init(UART_TELEMETRY_GPIOx, &GPIO_InitStruct);
+
+  USART_InitTypeDef UART_InitStructure;
+  USART_StructInit(&UART_InitStructure);
+  UART_InitStructure.USART_BaudRate = UART_TELEMETRY_BAUDS;
+  UART_InitStructure.USART_Mode = USART_Mode_Tx;
+  USART_Init(USART3, &UART_InitStructure);
+  USART_DMACmd(USART3, USART_DMAReq_Tx, ENABLE);
+  USART_Cmd(USART3, ENABLE);
+}
+
+static void prvUartTelemetryWrite(const char* s_, int size_)
+{
+  prvUartTxSendMessage(&telemetry, s_, size_);
+}
+
+static int prvUartTelemetryTryWrite(const char* s_, int size_,
+                                    int timeout_ms_)
+{
+  return prvUartTxTrySendMessage(&telemetry, s_, size_, timeout_ms_);
+}
+
+static int prvUartTelemetryReserve(ring_slot_t* slot_, int size_,
+                                   int timeout_ms_)
+{
+  return prvUartTxReserve(&telemetry, slot_, size_, timeout_ms_);
+}
+
+static void prvUartTelemetryCommit(int size_)
+{
+  prvUartTxCommit(&telemetry, size_);
+}
+
+static int prvUartTelemetryBacklog()
+{
+  return uRingUsed(&telemetry.ring) * 1000 / telemetry.size;
+}
+
+static void prvUartTelemetryFlush()
+{
+  prvUartTxFlush(&telemetry);
+}
+
+const link_t xUartTelemetryLink =
+  {
+    .name = "uart3",
+    .init = vUartTelemetryInit,
+    .write = prvUartTelemetryWrite,
+    .try_write = prvUartTelemetryTryWrite,
+    .reserve_stream = prvUartTelemetryReserve,
+    .commit_stream = prvUartTelemetryCommit,
+    .stream_backlog = prvUartTelemetryBacklog,
+    .flush = prvUartTelemetryFlush,
+  };
+
+RAMFUNC void DMA1_Channel2_IRQHandler()
+{
+  portBASE_TYPE reschedNeeded = pdFALSE;
+  TIMELINE_ISR_ENTER(DMA1_Channel2_IRQn);
+  prvUartTxInterrupt(&telemetry, &reschedNeeded);
+  TIMELINE_ISR_EXIT(DMA1_Channel2_IRQn);
+  portEND_SWITCHING_ISR(reschedNeeded);
+}
+#endif
+
+#ifndef SDCARD
+// The card takes these channels (libperiph/sdcard.h), USART1 unused then
+RAMFUNC void DMA1_Channel4_IRQHandler()
+{
+  portBASE_TYPE reschedNeeded = pdFALSE;
+  TIMELINE_ISR_ENTER(DMA1_Channel4_IRQn);
+  prvUartTxInterrupt(&tx, &reschedNeeded);
+  TIMELINE_ISR_EXIT(DMA1_Channel4_IRQn);
+  portEND_SWITCHING_ISR(reschedNeeded);
+}
+
+RAMFUNC void DMA1_Channel5_IRQHandler()
+{
+  portBASE_TYPE reschedNeeded = pdFALSE;
+  TIMELINE_ISR_ENTER(DMA1_Channel5_IRQn);
+
+  DMA1->IFCR = DMA_IFCR_CGIF5;
+  rxHalves++;
+  if ((USART1->CR3 & USART_CR3_RTSE) &&
+      prvUartRxHead() - rxRead >= UART_RX_PAUSE_LEVEL)
+  {
+    // Reading DR on idle line or on error would drop the byte held there
+    USART1->CR3 &= ~(USART_CR3_DMAR | USART_CR3_EIE);
+    USART1->CR1 &= ~USART_CR1_IDLEIE;
+    rxPaused = 1;
+    stats.pauses++;
+  }
+  prvUartRxMotors(0, &reschedNeeded);
+  vFlagsSetFromISR(&rxWakeup, UART_WAKEUP, &reschedNeeded);
+  TIMELINE_ISR_EXIT(DMA1_Channel5_IRQn);
+  portEND_SWITCHING_ISR(reschedNeeded);
+}
+#endif
+
+RAMFUNC void USART1_IRQHandler()
+{
+  portBASE_TYPE reschedNeeded = pdFALSE;
+  PROFILE_BEGIN(PROFILE_USART1_IRQ);
+  TIMELINE_ISR_ENTER(USART1_IRQn);
+
+  const uint16_t status = USART1->SR;
+
+  // Errors (RX DMA on, EIE) and idle are cleared by reading SR then DR:
+  // the DMA took the byte already, the error flags stay up until then
+  if (status & (USART_SR_ORE | USART_SR_FE | USART_SR_NE)) {
+    if (status & USART_SR_ORE)
+      stats.overruns++;
+    if (status & USART_SR_FE)
+      stats.framing++;
+    if (status & USART_SR_NE)
+      stats.noise++;
+    (void)USART1->DR;
+  }
+  if (status & USART_SR_IDLE) {
+    (void)USART1->DR;
+    prvUartRxMotors(1, &reschedNeeded);
+    vFlagsSetFromISR(&rxWakeup, UART_WAKEUP, &reschedNeeded);
   }
+  PROFILE_END(PROFILE_USART1_IRQ);
+  TIMELINE_ISR_EXIT(USART1_IRQn);
   portEND_SWITCHING_ISR(reschedNeeded);
 }
@@ -1,11 +1,65 @@
 #ifndef LIBPERIPH_UART_H
 # define LIBPERIPH_UART_H
 
+#include <stdint.h>
+
+// USART1, 8N1 at UART_DEFAULT_BAUDS out of reset, without flow control
+#define UART_DEFAULT_BAUDS 115200
+// Time for the host to confirm a new line setting, at the new rate
+#define UART_CONFIRM_MS    1000
+
+typedef struct
+{
+  uint32_t bauds;
+  int flow;                          // RTS (PA12) / CTS (PA11)
+} uart_line_t;
+
+typedef struct
+{
+  uint32_t overruns;                 // Bytes lost in the shift register
+  uint32_t framing;                  // Bytes without their stop bit
+  uint32_t noise;
+  uint32_t dropped;                  // Lapped in the RX ring by the DMA
+  uint32_t pauses;                   // RX DMA stops, with flow control
+} uart_stats_t;
+
 void vUartPutc(char c_);
 void vUartPuts(const char* s_);
+void vUartWrite(const char* s_, int size_);
 void vUartSend(const char* s_);
+// Whole message under the TX lock, from tasks only
+void vUartSendMessage(const char* s_, int size_);
+// Whole message or nothing, waiting up to timeout_ms_ for the TX lock and
+// the room: 1 if sent
+int xUartTrySendMessage(const char* s_, int size_, int timeout_ms_);
+// The same in the bulk lane, which gives way to the other writes at each
+// of its messages (see xLinkTrySendStream)
+int xUartTrySendBulk(const char* s_, int size_, int timeout_ms_);
 void vUartInit();
 char cUartGetc();
+int xUartReadAvailable(char* buf_, int size_);
 void vUartGets(char* s_, int size_);
+// Wait for the TX ring to drain, from tasks only
+void vUartFlush();
+
+// 0 if bauds_ is beyond APB2 / 16 or more than 2% off, or the flow
+// control pins are taken (--can)
+int xUartCheckLine(uint32_t bauds_, int flow_);
+// Switch once the bytes written so far went out, from tasks only. Unless
+// xUartConfirmLine follows within UART_CONFIRM_MS, the previous setting
+// comes back.
+void vUartSetLine(uint32_t bauds_, int flow_);
+// 0 if there was nothing to confirm, or it came back already
+int xUartConfirmLine();
+void vUartGetLine(uart_line_t* line_);
+void vUartGetStats(uart_stats_t* stats_);
+
+#ifdef TELEMETRY_UART
+// USART3, TX only on PC10 (--telemetry-uart), 8N1 at
+// UART_TELEMETRY_BAUDS: the telemetry stream apart from the shell, on the
+// same DMA transmitter as USART1 (xUartTelemetryLink, libperiph/link.h)
+# define UART_TELEMETRY_BAUDS 921600
+void vUartTelemetryInit();
+#endif
 
 #endif /* LIBPERIPH_UART_H */
@@ -0,0 +1,594 @@
+#include <string.h>
+
+#include "libperiph/usbcdc.h"
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+#include "stm32f10x.h"
+#include "stm32f10x_gpio.h"
+#include "stm32f10x_rcc.h"
+#include "misc.h"
+#include "usb_lib.h"
+
+#include "libglobal/fault.h"
+#include "libglobal/queues.h"
+#include "libglobal/ring.h"
+
+#include "libperiph/hardware.h"
+#include "libperiph/link.h"
+#include "libperiph/priorities.h"
+
+// Device side of the USB library: descriptors, control requests and the
+// endpoint callbacks, adapted from the ST virtual COM port example.
+
+// Olimexino D+ pull-up, through a transistor: low connects
+#define USBCDC_DISC_GPIOx GPIOC
+#define USBCDC_DISC_Pin   GPIO_Pin_12
+
+#define USBCDC_PACKET_SIZE 64
+#define USBCDC_NOTIFY_SIZE 8
+
+// TX ring sent by EP1 IN packets. Must be a power of 2.
+#define USBCDC_TX_BUFFER_SIZE 512
+
+// RX ring filled by EP3 OUT packets. Must be a power of 2.
+#define USBCDC_RX_BUFFER_SIZE 256
+
+// CDC class requests
+#define USBCDC_SET_COMM_FEATURE       0x02
+#define USBCDC_SET_LINE_CODING        0x20
+#define USBCDC_GET_LINE_CODING        0x21
+#define USBCDC_SET_CONTROL_LINE_STATE 0x22
+
+#define USBCDC_STRING_SIZE(s) (2 + 2 * (sizeof (s) - 1))
+#define USBCDC_VENDOR  "swiftler"
+#define USBCDC_PRODUCT "swiftler host link"
+#define USBCDC_SERIAL  "00000000" // From the device unique ID
+
+static const uint8_t deviceDescriptor[] =
+  {
+    0x12, 0x01, 0x00, 0x02, // USB 2.0
+    0x02, 0x00, 0x00, USBCDC_PACKET_SIZE, // CDC
+    0x83, 0x04, 0x40, 0x57, // ST virtual COM port VID/PID, known to hosts
+    0x00, 0x02, 1, 2, 3, 1,
+  };
+
+#define USBCDC_CONFIG_SIZE 67
+
+static const uint8_t configDescriptor[USBCDC_CONFIG_SIZE] =
+  {
+    0x09, 0x02, USBCDC_CONFIG_SIZE, 0x00, 2, 1, 0, 0xC0, 0x32, // Self powered
+    // Communication interface: ACM, one notification endpoint
+    0x09, 0x04, 0, 0, 1, 0x02, 0x02, 0x01, 0,
+    0x05, 0x24, 0x00, 0x10, 0x01, // Header
+    0x05, 0x24, 0x01, 0x00, 1,    // Call management
+    0x04, 0x24, 0x02, 0x02,       // ACM: line coding and state
+    0x05, 0x24, 0x06, 0, 1,       // Union
+    0x07, 0x05, 0x82, 0x03, USBCDC_NOTIFY_SIZE, 0x00, 0xFF,
+    // Data interface: bulk OUT EP3, bulk IN EP1
+    0x09, 0x04, 1, 0, 2, 0x0A, 0x00, 0x00, 0,
+    0x07, 0x05, 0x03, 0x02, USBCDC_PACKET_SIZE, 0x00, 0x00,
+    0x07, 0x05, 0x81, 0x02, USBCDC_PACKET_SIZE, 0x00, 0x00,
+  };
+
+static const uint8_t languageString[] = { 0x04, 0x03, 0x09, 0x04 };
+static uint8_t vendorString[USBCDC_STRING_SIZE(USBCDC_VENDOR)];
+static uint8_t productString[USBCDC_STRING_SIZE(USBCDC_PRODUCT)];
+static uint8_t serialString[USBCDC_STRING_SIZE(USBCDC_SERIAL)];
+
+static ONE_DESCRIPTOR device = { (uint8_t*)deviceDescriptor, sizeof (deviceDescriptor) };
+static ONE_DESCRIPTOR config = { (uint8_t*)configDescriptor, sizeof (configDescriptor) };
+static ONE_DESCRIPTOR strings[] =
+  {
+    { (uint8_t*)languageString, sizeof (languageString) },
+    { vendorString, sizeof (vendorString) },
+    { productString, sizeof (productString) },
+    { serialString, sizeof (serialString) },
+  };
+
+// Ignored, there is no UART behind: 115200 8N1 for the terminals
+static uint8_t lineCoding[7] = { 0x00, 0xC2, 0x01, 0x00, 0, 0, 8 };
+
+static xSemaphoreHandle xUsbCdcTxMutex;
+// Signaled on each EP1 IN completion: room was made in the TX ring
+static xSemaphoreHandle xUsbCdcTxSpaceSemphr;
+// Signaled on each EP3 OUT packet
+static xSemaphoreHandle xUsbCdcRxSemphr;
+
+// Produced by the writer task, consumed by the interrupt: a packet is
+// released from the ring once copied to the PMA
+static uint8_t txBuffer[USBCDC_TX_BUFFER_SIZE];
+static ring_t tx;
+// A packet in flight on EP1, a full one is followed by a zero length
+// packet when nothing else is pending
+static volatile uint8_t txBusy;
+static uint8_t txZlp;
+
+// Produced by the interrupt, consumed by the reader task
+static uint8_t rxBuffer[USBCDC_RX_BUFFER_SIZE];
+static ring_t rx;
+// EP3 left NAKing until the reader makes room for a whole packet
+static volatile uint8_t rxPaused;
+static queue_stats_t txQueue;
+static queue_stats_t rxQueue;
+
+// Configured by the host, DTR set
+static volatile uint8_t configured;
+static volatile uint8_t open;
+
+static portBASE_TYPE reschedNeeded;
+
+__IO uint16_t wIstr;
+
+static void prvUsbCdcString(uint8_t* desc_, const char* s_)
+{
+  int size = strlen(s_);
+
+  desc_[0] = 2 + 2 * size;
+  desc_[1] = 0x03;
+  for (int i = 0; i < size; i++)
+  {
+    desc_[2 + 2 * i] = s_[i];
+    desc_[3 + 2 * i] = 0;
+  }
+}
+
+// Start the next EP1 IN packet if none is in flight. Must be called with
+// the USB interrupt masked (critical section or the interrupt itself).
+static void prvUsbCdcTxKick()
+{
+  const uint8_t* span;
+  uint16_t count;
+
+  if (txBusy || !open)
+    return;
+
+  // Up to the end of the ring, the rest goes in the next packet
+  count = uRingReadSpan(&tx, &span);
+  if (count)
+  {
+    if (count > USBCDC_PACKET_SIZE)
+      count = USBCDC_PACKET_SIZE;
+    UserToPMABufferCopy((uint8_t*)span, ENDP1_TXADDR, count);
+    vRingRelease(&tx, count);
+    txZlp = (count == USBCDC_PACKET_SIZE);
+  }
+  else if (txZlp)
+  {
+    // The host waits for a short packet to end the transfer
+    count = 0;
+    txZlp = 0;
+  }
+  else
+    return;
+
+  txBusy = 1;
+  SetEPTxCount(ENDP1, count);
+  SetEPTxValid(ENDP1);
+}
+
+// Port closed: drop what was not sent yet
+static void prvUsbCdcClose()
+{
+  open = 0;
+  vRingRelease(&tx, uRingUsed(&tx));
+  txZlp = 0;
+}
+
+static void prvUsbCdcTxDone()
+{
+  txBusy = 0;
+  prvUsbCdcTxKick();
+
+  xSemaphoreGiveFromISR(xUsbCdcTxSpaceSemphr, &reschedNeeded);
+}
+
+static void prvUsbCdcRxDone()
+{
+  uint8_t packet[USBCDC_PACKET_SIZE];
+  uint16_t count = GetEPRxCount(ENDP3);
+
+  // Room was checked before the endpoint was made valid
+  PMAToUserBufferCopy(packet, ENDP3_RXADDR, count);
+  uRingWrite(&rx, packet, count);
+  vQueuesLevel(&rxQueue, uRingUsed(&rx));
+
+  if (uRingRoom(&rx) >= USBCDC_PACKET_SIZE)
+    SetEPRxValid(ENDP3);
+  else
+    rxPaused = 1;
+
+  xSemaphoreGiveFromISR(xUsbCdcRxSemphr, &reschedNeeded);
+}
+
+void (*pEpInt_IN[7])(void) =
+  {
+    prvUsbCdcTxDone, NOP_Process, NOP_Process, NOP_Process,
+    NOP_Process, NOP_Process, NOP_Process,
+  };
+
+void (*pEpInt_OUT[7])(void) =
+  {
+    NOP_Process, NOP_Process, prvUsbCdcRxDone, NOP_Process,
+    NOP_Process, NOP_Process, NOP_Process,
+  };
+
+static void prvUsbCdcInit()
+{
+  pInformation->Current_Configuration = 0;
+
+  // Power on and reset the peripheral, then enable the interrupts
+  _SetCNTR(CNTR_FRES);
+  _SetCNTR(0);
+  USB_SIL_Init();
+}
+
+static void prvUsbCdcReset()
+{
+  pInformation->Current_Configuration = 0;
+  pInformation->Current_Feature = configDescriptor[7];
+  pInformation->Current_Interface = 0;
+  SetBTABLE(BTABLE_ADDRESS);
+
+  // EP0, control
+  SetEPType(ENDP0, EP_CONTROL);
+  SetEPTxStatus(ENDP0, EP_TX_STALL);
+  SetEPRxAddr(ENDP0, ENDP0_RXADDR);
+  SetEPTxAddr(ENDP0, ENDP0_TXADDR);
+  Clear_Status_Out(ENDP0);
+  SetEPRxCount(ENDP0, Device_Property.MaxPacketSize);
+  SetEPRxValid(ENDP0);
+
+  // EP1, bulk IN
+  SetEPType(ENDP1, EP_BULK);
+  SetEPTxAddr(ENDP1, ENDP1_TXADDR);
+  SetEPTxStatus(ENDP1, EP_TX_NAK);
+  SetEPRxStatus(ENDP1, EP_RX_DIS);
+
+  // EP2, interrupt IN, never sent
+  SetEPType(ENDP2, EP_INTERRUPT);
+  SetEPTxAddr(ENDP2, ENDP2_TXADDR);
+  SetEPRxStatus(ENDP2, EP_RX_DIS);
+  SetEPTxStatus(ENDP2, EP_TX_NAK);
+
+  // EP3, bulk OUT
+  SetEPType(ENDP3, EP_BULK);
+  SetEPRxAddr(ENDP3, ENDP3_RXADDR);
+  SetEPRxCount(ENDP3, USBCDC_PACKET_SIZE);
+  SetEPRxStatus(ENDP3, EP_RX_VALID);
+  SetEPTxStatus(ENDP3, EP_TX_DIS);
+
+  SetDeviceAddress(0);
+
+  // Transfers in flight are lost
+  txBusy = 0;
+  configured = 0;
+  prvUsbCdcClose();
+  rxPaused = 0;
+}
+
+static void prvUsbCdcStatusIn()
+{
+}
+
+static void prvUsbCdcStatusOut()
+{
+}
+
+static uint8_t* prvUsbCdcLineCoding(uint16_t length_)
+{
+  if (!length_)
+  {
+    pInformation->Ctrl_Info.Usb_wLength = sizeof (lineCoding);
+    return NULL;
+  }
+  return lineCoding;
+}
+
+static RESULT prvUsbCdcDataSetup(uint8_t request_)
+{
+  if (Type_Recipient != (CLASS_REQUEST | INTERFACE_RECIPIENT))
+    return USB_UNSUPPORT;
+  if (request_ != USBCDC_GET_LINE_CODING && request_ != USBCDC_SET_LINE_CODING)
+    return USB_UNSUPPORT;
+
+  pInformation->Ctrl_Info.CopyData = prvUsbCdcLineCoding;
+  pInformation->Ctrl_Info.Usb_wOffset = 0;
+  prvUsbCdcLineCoding(0);
+  return USB_SUCCESS;
+}
+
+static RESULT prvUsbCdcNoDataSetup(uint8_t request_)
+{
+  if (Type_Recipient != (CLASS_REQUEST | INTERFACE_RECIPIENT))
+    return USB_UNSUPPORT;
+
+  if (request_ == USBCDC_SET_CONTROL_LINE_STATE)
+  {
+    // Terminals set DTR when they open the port
+    if ((pInformation->USBwValue0 & 0x01) && configured)
+    {
+      open = 1;
+      prvUsbCdcTxKick();
+    }
+    else
+      prvUsbCdcClose();
+    return USB_SUCCESS;
+  }
+  if (request_ == USBCDC_SET_COMM_FEATURE)
+    return USB_SUCCESS;
+  return USB_UNSUPPORT;
+}
+
+static RESULT prvUsbCdcGetInterfaceSetting(uint8_t interface_, uint8_t alternate_)
+{
+  if (alternate_ > 0 || interface_ > 1)
+    return USB_UNSUPPORT;
+  return USB_SUCCESS;
+}
+
+static uint8_t* prvUsbCdcGetDeviceDescriptor(uint16_t length_)
+{
+  return Standard_GetDescriptorData(length_, &device);
+}
+
+static uint8_t* prvUsbCdcGetConfigDescriptor(uint16_t length_)
+{
+  return Standard_GetDescriptorData(length_, &config);
+}
+
+static uint8_t* prvUsbCdcGetStringDescriptor(uint16_t length_)
+{
+  uint8_t index = pInformation->USBwValue0;
+
+  if (index >= sizeof (strings) / sizeof (strings[0]))
+    return NULL;
+  return Standard_GetDescriptorData(length_, &strings[index]);
+}
+
+static void prvUsbCdcSetConfiguration()
+{
+  configured = (pInformation->Current_Configuration != 0);
+  if (!configured)
+    prvUsbCdcClose();
+}
+
+static void prvUsbCdcSetDeviceAddress()
+{
+}
+
+DEVICE Device_Table =
+  {
+    .Total_Endpoint = EP_NUM,
+    .Total_Configuration = 1,
+  };
+
+DEVICE_PROP Device_Property =
+  {
+    .Init = prvUsbCdcInit,
+    .Reset = prvUsbCdcReset,
+    .Process_Status_IN = prvUsbCdcStatusIn,
+    .Process_Status_OUT = prvUsbCdcStatusOut,
+    .Class_Data_Setup = prvUsbCdcDataSetup,
+    .Class_NoData_Setup = prvUsbCdcNoDataSetup,
+    .Class_Get_Interface_Setting = prvUsbCdcGetInterfaceSetting,
+    .GetDeviceDescriptor = prvUsbCdcGetDeviceDescriptor,
+    .GetConfigDescriptor = prvUsbCdcGetConfigDescriptor,
+    .GetStringDescriptor = prvUsbCdcGetStringDescriptor,
+    .RxEP_buffer = 0,
+    .MaxPacketSize = USBCDC_PACKET_SIZE,
+  };
+
+USER_STANDARD_REQUESTS User_Standard_Requests =
+  {
+    .User_GetConfiguration = NOP_Process,
+    .User_SetConfiguration = prvUsbCdcSetConfiguration,
+    .User_GetInterface = NOP_Process,
+    .User_SetInterface = NOP_Process,
+    .User_GetStatus = NOP_Process,
+    .User_ClearFeature = NOP_Process,
+    .User_SetEndPointFeature = NOP_Process,
+    .User_SetDeviceFeature = NOP_Process,
+    .User_SetDeviceAddress = prvUsbCdcSetDeviceAddress,
+  };
+
+void vUsbCdcInit()
+{
+  xUsbCdcTxMutex = xSemaphoreCreateMutex();
+  vSemaphoreCreateBinary(xUsbCdcTxSpaceSemphr);
+  vSemaphoreCreateBinary(xUsbCdcRxSemphr);
+  if (!xUsbCdcTxMutex || !xUsbCdcTxSpaceSemphr || !xUsbCdcRxSemphr)
+    vFaultAllocation("usbcdc");
+  vRingInit(&tx, txBuffer, USBCDC_TX_BUFFER_SIZE);
+  vRingInit(&rx, rxBuffer, USBCDC_RX_BUFFER_SIZE);
+  vQueuesRegister(&txQueue, "usb tx", USBCDC_TX_BUFFER_SIZE);
+  vQueuesRegister(&rxQueue, "usb rx", USBCDC_RX_BUFFER_SIZE);
+  xSemaphoreTake(xUsbCdcTxSpaceSemphr, 0);
+  xSemaphoreTake(xUsbCdcRxSemphr, 0);
+
+  // Serial number from the 96 bits unique ID
+  char serial[sizeof (USBCDC_SERIAL)];
+  const uint32_t hash = uHardwareUid();
+  for (int i = 0; i < 8; i++)
+    serial[i] = "0123456789ABCDEF"[(hash >> (28 - 4 * i)) & 0xF];
+  serial[8] = 0;
+  prvUsbCdcString(vendorString, USBCDC_VENDOR);
+  prvUsbCdcString(productString, USBCDC_PRODUCT);
+  prvUsbCdcString(serialString, serial);
+
+  // Disconnected until the device is ready
+  vGpioClockInit(USBCDC_DISC_GPIOx);
+  GPIO_InitTypeDef GPIO_InitStruct =
+    {
+      .GPIO_Pin = USBCDC_DISC_Pin,
+      .GPIO_Speed = GPIO_Speed_2MHz,
+      .GPIO_Mode = GPIO_Mode_Out_OD,
+    };
+  GPIO_SetBits(USBCDC_DISC_GPIOx, USBCDC_DISC_Pin);
+  GPIO_Init(USBCDC_DISC_GPIOx, &GPIO_InitStruct);
+
+  // 48 MHz from the 72 MHz PLL
+  RCC_USBCLKConfig(RCC_USBCLKSource_PLLCLK_1Div5);
+  RCC_APB1PeriphClockCmd(RCC_APB1Periph_USB, ENABLE);
+
+  NVIC_InitTypeDef NVIC_InitStructure =
+  {
+    .NVIC_IRQChannel = USB_LP_CAN1_RX0_IRQn,
+    .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_USB,
+    .NVIC_IRQChannelSubPriority = 0,
+    .NVIC_IRQChannelCmd = ENABLE,
+  };
+  NVIC_Init(&NVIC_InitStructure);
+
+  USB_Init();
+
+  GPIO_ResetBits(USBCDC_DISC_GPIOx, USBCDC_DISC_Pin);
+}
+
+int iUsbCdcIsOpen()
+{
+  return open;
+}
+
+int xUsbCdcReadAvailable(char* buf_, int size_)
+{
+  int n = 0;
+
+  for (;;)
+  {
+    n = uRingRead(&rx, buf_, size_);
+
+    // Room for a whole packet again: let the host send
+    if (rxPaused)
+    {
+      taskENTER_CRITICAL();
+      if (uRingRoom(&rx) >= USBCDC_PACKET_SIZE)
+      {
+        rxPaused = 0;
+        SetEPRxValid(ENDP3);
+      }
+      taskEXIT_CRITICAL();
+    }
+
+    if (n)
+      return n;
+
+    xSemaphoreTake(xUsbCdcRxSemphr, portMAX_DELAY);
+  }
+}
+
+void vUsbCdcSendMessage(const char* s_, int size_)
+{
+  uint16_t count;
+  uint32_t start;
+  portBASE_TYPE taken;
+
+  xSemaphoreTake(xUsbCdcTxMutex, portMAX_DELAY);
+
+  while (size_ > 0 && open)
+  {
+    // Only the kick needs the interrupt masked, the ring needs no lock
+    count = uRingWrite(&tx, s_, size_);
+    if (count)
+    {
+      vQueuesLevel(&txQueue, uRingUsed(&tx));
+      taskENTER_CRITICAL();
+      prvUsbCdcTxKick();
+      taskEXIT_CRITICAL();
+    }
+
+    s_ += count;
+    size_ -= count;
+
+    // Ring full: wait for the host to take a packet, or give up on a host
+    // that does not read
+    if (size_ > 0)
+    {
+      start = uQueuesBlockStart();
+      taken = xSemaphoreTake(xUsbCdcTxSpaceSemphr,
+                             MS_TO_TICKS(USBCDC_TX_TIMEOUT_MS));
+      vQueuesBlockEnd(&txQueue, start);
+      if (taken != pdTRUE)
+        break;
+    }
+  }
+  // Given up on, or closed in the middle
+  if (size_ > 0)
+    vQueuesDrop(&txQueue, size_);
+
+  xSemaphoreGive(xUsbCdcTxMutex);
+}
+
+static int prvUsbCdcTrySendMessage(const char* s_, int size_, int timeout_ms_)
+{
+  const portTickType start = xTaskGetTickCount();
+  const portTickType timeout = MS_TO_TICKS(timeout_ms_);
+  portTickType elapsed;
+  int sent = 0;
+
+  if (size_ <= USBCDC_TX_BUFFER_SIZE &&
+      xSemaphoreTake(xUsbCdcTxMutex, timeout) == pdTRUE)
+  {
+    while (open)
+    {
+      // The lock keeps the room: the interrupt only frees more
+      if (uRingRoom(&tx) >= size_)
+      {
+        uRingWrite(&tx, s_, size_);
+        vQueuesLevel(&txQueue, uRingUsed(&tx));
+        taskENTER_CRITICAL();
+        prvUsbCdcTxKick();
+        taskEXIT_CRITICAL();
+        sent = 1;
+        break;
+      }
+
+      elapsed = xTaskGetTickCount() - start;
+      if (elapsed >= timeout)
+        break;
+      xSemaphoreTake(xUsbCdcTxSpaceSemphr, timeout - elapsed);
+    }
+    xSemaphoreGive(xUsbCdcTxMutex);
+  }
+
+  if (!sent)
+    vQueuesDrop(&txQueue, size_);
+  return sent;
+}
+
+void vUsbCdcFlush()
+{
+  xSemaphoreTake(xUsbCdcTxMutex, portMAX_DELAY);
+  while (open && (uRingUsed(&tx) || txBusy))
+    if (xSemaphoreTake(xUsbCdcTxSpaceSemphr,
+                       MS_TO_TICKS(USBCDC_TX_TIMEOUT_MS)) != pdTRUE)
+      break;
+  xSemaphoreGive(xUsbCdcTxMutex);
+}
+
+const link_t xUsbCdcLink =
+  {
+    .name = "usb",
+    .init = vUsbCdcInit,
+    .read_available = xUsbCdcReadAvailable,
+    .write = vUsbCdcSendMessage,
+    .try_write = prvUsbCdcTrySendMessage,
+    .flush = vUsbCdcFlush,
+  };
+
+void USB_LP_CAN1_RX0_IRQHandler()
+{
+  reschedNeeded = pdFALSE;
+
+  wIstr = _GetISTR();
+  if (wIstr & ISTR_CTR & wInterrupt_Mask)
+    CTR_LP();
+  if (wIstr & ISTR_RESET & wInterrupt_Mask)
+  {
+    _SetISTR((uint16_t)CLR_RESET);
+    Device_Property.Reset();
+  }
+
+  portEND_SWITCHING_ISR(reschedNeeded);
+}
@@ -0,0 +1,20 @@
+#ifndef LIBPERIPH_USBCDC_H
+# define LIBPERIPH_USBCDC_H
+
+// USB CDC ACM virtual COM port, the same API as the UART. Full speed bulk
+// endpoints, 64 bytes packets, flow controlled both ways.
+
+// Writes to a closed port (no DTR from the host) are dropped, as are the
+// bytes that still find the TX ring full after this long
+#define USBCDC_TX_TIMEOUT_MS 50
+
+void vUsbCdcInit();
+// Whole message under the TX lock, from tasks only
+void vUsbCdcSendMessage(const char* s_, int size_);
+int xUsbCdcReadAvailable(char* buf_, int size_);
+// Wait for the TX ring to drain, or the port to close
+void vUsbCdcFlush();
+// Enumerated and the port opened by the host
+int iUsbCdcIsOpen();
+
+#endif /* LIBPERIPH_USBCDC_H */
@@ -0,0 +1,811 @@
+#include <string.h>
+
+#include "libperiph/usbmsc.h"
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+#include "stm32f10x.h"
+#include "stm32f10x_gpio.h"
+#include "stm32f10x_rcc.h"
+#include "misc.h"
+#include "usb_lib.h"
+
+#include "libglobal/fault.h"
+#include "libglobal/ring.h"
+
+#include "libperiph/hardware.h"
+#include "libperiph/priorities.h"
+#ifdef SDCARD
+# include "libperiph/sdcard.h"
+#endif
+
+// Device side of the USB library, as libperiph/usbcdc.c and on the same
+// endpoints (usb_conf.h): bulk IN EP1, bulk OUT EP3. Adapted from the ST
+// mass storage example.
+
+// Olimexino D+ pull-up, through a transistor: low connects
+#define USBMSC_DISC_GPIOx GPIOC
+#define USBMSC_DISC_Pin   GPIO_Pin_12
+
+#define USBMSC_PACKET_SIZE 64
+
+// Bulk-only transport
+#define USBMSC_CBW_SIGNATURE 0x43425355 // "USBC"
+#define USBMSC_CSW_SIGNATURE 0x53425355 // "USBS"
+#define USBMSC_CBW_SIZE      31
+#define USBMSC_CSW_SIZE      13
+#define USBMSC_CBW_IN        0x80
+#define USBMSC_GET_MAX_LUN   0xFE
+#define USBMSC_RESET         0xFF
+
+enum eUsbMscPhase {
+  USBMSC_IDLE,       // EP3 waits for a command block
+  USBMSC_COMMAND,    // With the daemon, EP3 NAKing
+  USBMSC_DATA_IN,    // The ring to EP1, then the status
+  USBMSC_STATUS,     // Status in flight
+  USBMSC_STALLED,    // EP1 halted, the status sent once the host clears it
+};
+
+// SCSI
+#define SCSI_TEST_UNIT_READY     0x00
+#define SCSI_REQUEST_SENSE       0x03
+#define SCSI_INQUIRY             0x12
+#define SCSI_MODE_SENSE6         0x1A
+#define SCSI_START_STOP_UNIT     0x1B
+#define SCSI_ALLOW_REMOVAL       0x1E
+#define SCSI_READ_FORMAT_CAPS    0x23
+#define SCSI_READ_CAPACITY10     0x25
+#define SCSI_READ10              0x28
+#define SCSI_WRITE10             0x2A
+#define SCSI_VERIFY10            0x2F
+#define SCSI_MODE_SENSE10        0x5A
+
+// Sense key << 8 | additional sense code
+#define SENSE_NONE               0x0000
+#define SENSE_NOT_PRESENT        0x023A
+#define SENSE_MEDIUM_ERROR       0x0311
+#define SENSE_INVALID_COMMAND    0x0520
+#define SENSE_OUT_OF_RANGE       0x0521
+#define SENSE_WRITE_PROTECTED    0x0727
+
+#define USBMSC_RING_SIZE (USBMSC_BUFFER_BLOCKS * USBMSC_BLOCK_SIZE)
+// A host that stops reading in the middle of a transfer
+#define USBMSC_TX_TIMEOUT_MS 1000
+
+#define USBMSC_STRING_SIZE(s) (2 + 2 * (sizeof (s) - 1))
+#define USBMSC_VENDOR  "swiftler"
+#define USBMSC_PRODUCT "swiftler log disk"
+#define USBMSC_SERIAL  "000000000000" // 12 digits at least, the unique ID
+
+typedef struct
+{
+  uint32_t signature;
+  uint32_t tag;
+  uint32_t length;
+  uint8_t flags;
+  uint8_t lun;
+  uint8_t cb_length;
+  uint8_t cb[16];
+} __attribute__((packed)) usbmsc_cbw_t;
+
+typedef struct
+{
+  uint32_t signature;
+  uint32_t tag;
+  uint32_t residue;
+  uint8_t status;
+} __attribute__((packed)) usbmsc_csw_t;
+
+static const uint8_t deviceDescriptor[] =
+  {
+    0x12, 0x01, 0x00, 0x02, // USB 2.0
+    0x00, 0x00, 0x00, USBMSC_PACKET_SIZE, // Class in the interface
+    0x83, 0x04, 0x20, 0x57, // ST mass storage VID/PID
+    0x00, 0x02, 1, 2, 3, 1,
+  };
+
+#define USBMSC_CONFIG_SIZE 32
+
+static const uint8_t configDescriptor[USBMSC_CONFIG_SIZE] =
+  {
+    0x09, 0x02, USBMSC_CONFIG_SIZE, 0x00, 1, 1, 0, 0xC0, 0x32, // Self powered
+    // Mass storage, SCSI transparent, bulk-only
+    0x09, 0x04, 0, 0, 2, 0x08, 0x06, 0x50, 0,
+    0x07, 0x05, 0x81, 0x02, USBMSC_PACKET_SIZE, 0x00, 0x00,
+    0x07, 0x05, 0x03, 0x02, USBMSC_PACKET_SIZE, 0x00, 0x00,
+  };
+
+static const uint8_t languageString[] = { 0x04, 0x03, 0x09, 0x04 };
+static uint8_t vendorString[USBMSC_STRING_SIZE(USBMSC_VENDOR)];
+static uint8_t productString[USBMSC_STRING_SIZE(USBMSC_PRODUCT)];
+static uint8_t serialString[USBMSC_STRING_SIZE(USBMSC_SERIAL)];
+
+static ONE_DESCRIPTOR device = { (uint8_t*)deviceDescriptor, sizeof (deviceDescriptor) };
+static ONE_DESCRIPTOR config = { (uint8_t*)configDescriptor, sizeof (configDescriptor) };
+static ONE_DESCRIPTOR strings[] =
+  {
+    { (uint8_t*)languageString, sizeof (languageString) },
+    { vendorString, sizeof (vendorString) },
+    { productString, sizeof (productString) },
+    { serialString, sizeof (serialString) },
+  };
+
+static uint8_t maxLun;
+
+// Direct access, removable, SPC-2
+static const uint8_t inquiry[36] =
+  {
+    0x00, 0x80, 0x04, 0x02, 31, 0, 0, 0,
+    's', 'w', 'i', 'f', 't', 'l', 'e', 'r',
+    'l', 'o', 'g', ' ', 'd', 'i', 's', 'k',
+    ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+    '1', '.', '0', ' ',
+  };
+
+// Command blocks, from the interrupt to the daemon
+static xSemaphoreHandle xUsbMscCommandSemphr;
+// Signaled on each EP1 IN completion: room was made in the ring
+static xSemaphoreHandle xUsbMscSpaceSemphr;
+// The disk, between the daemon and the service mode switch
+static xSemaphoreHandle xUsbMscDiskMutex;
+
+// Produced by the daemon, consumed by the interrupt by packets: blocks
+// in place, the ring reset at each command so they stay contiguous
+static uint8_t txBuffer[USBMSC_RING_SIZE] __attribute__((aligned(4)));
+static ring_t tx;
+static volatile uint8_t txBusy;
+// Bytes of the data phase not in a packet yet
+static volatile uint32_t dataLeft;
+
+static volatile uint8_t phase;
+// Bad command block: both endpoints halted until a reset
+static volatile uint8_t invalid;
+static usbmsc_cbw_t cbw;
+static usbmsc_csw_t csw;
+static uint16_t sense;
+static volatile uint8_t on;
+
+static usbmsc_stats_t stats;
+
+static portBASE_TYPE reschedNeeded;
+
+__IO uint16_t wIstr;
+
+static void vUsbMscTask(void* pvParameters_);
+
+static void prvUsbMscString(uint8_t* desc_, const char* s_)
+{
+  int size = strlen(s_);
+
+  desc_[0] = 2 + 2 * size;
+  desc_[1] = 0x03;
+  for (int i = 0; i < size; i++)
+  {
+    desc_[2 + 2 * i] = s_[i];
+    desc_[3 + 2 * i] = 0;
+  }
+}
+
+// Disk
+// ----
+
+#ifdef SDCARD
+static uint32_t prvUsbMscBlocks()
+{
+  sdcard_stats_t card;
+
+  vSdGetStats(&card);
+  return card.state == SDCARD_SERVICE ? card.blocks : 0;
+}
+
+static int prvUsbMscRead(uint32_t block_, uint8_t* data_)
+{
+  return xSdRead(block_, data_);
+}
+#else
+extern const uint8_t _sblackbox[];
+extern const uint8_t _eblackbox[];
+
+static uint32_t prvUsbMscBlocks()
+{
+  return (_eblackbox - _sblackbox) / USBMSC_BLOCK_SIZE;
+}
+
+static int prvUsbMscRead(uint32_t block_, uint8_t* data_)
+{
+  memcpy(data_, _sblackbox + block_ * USBMSC_BLOCK_SIZE, USBMSC_BLOCK_SIZE);
+  return 1;
+}
+#endif
+
+// Endpoints
+// ---------
+
+static void prvUsbMscSendStatus()
+{
+  UserToPMABufferCopy((uint8_t*)&csw, ENDP1_TXADDR, USBMSC_CSW_SIZE);
+  SetEPTxCount(ENDP1, USBMSC_CSW_SIZE);
+  phase = USBMSC_STATUS;
+  txBusy = 1;
+  SetEPTxValid(ENDP1);
+}
+
+// The next packet of the data phase, or the status after the last one.
+// Must be called with the USB interrupt masked.
+static void prvUsbMscTxKick()
+{
+  const uint8_t* span;
+  uint16_t count;
+
+  if (txBusy || phase != USBMSC_DATA_IN)
+    return;
+  if (!dataLeft)
+  {
+    prvUsbMscSendStatus();
+    return;
+  }
+
+  count = uRingReadSpan(&tx, &span);
+  if (!count)
+    return;
+  if (count > USBMSC_PACKET_SIZE)
+    count = USBMSC_PACKET_SIZE;
+  if (count > dataLeft)
+    count = dataLeft;
+  UserToPMABufferCopy((uint8_t*)span, ENDP1_TXADDR, count);
+  vRingRelease(&tx, count);
+  dataLeft -= count;
+
+  txBusy = 1;
+  SetEPTxCount(ENDP1, count);
+  SetEPTxValid(ENDP1);
+}
+
+// Failed with data expected in: EP1 halted, the status loaded for when
+// the host clears it. Interrupt masked.
+static void prvUsbMscStall()
+{
+  UserToPMABufferCopy((uint8_t*)&csw, ENDP1_TXADDR, USBMSC_CSW_SIZE);
+  SetEPTxCount(ENDP1, USBMSC_CSW_SIZE);
+  phase = USBMSC_STALLED;
+  txBusy = 1;
+  SetEPTxStatus(ENDP1, EP_TX_STALL);
+}
+
+static void prvUsbMscTxDone()
+{
+  txBusy = 0;
+  if (phase == USBMSC_STATUS || phase == USBMSC_STALLED)
+  {
+    // Next command
+    phase = USBMSC_IDLE;
+    SetEPRxValid(ENDP3);
+  }
+  else
+    prvUsbMscTxKick();
+
+  xSemaphoreGiveFromISR(xUsbMscSpaceSemphr, &reschedNeeded);
+}
+
+static void prvUsbMscRxDone()
+{
+  const uint16_t count = GetEPRxCount(ENDP3);
+
+  if (phase != USBMSC_IDLE)
+    return;
+  PMAToUserBufferCopy((uint8_t*)&cbw, ENDP3_RXADDR, USBMSC_CBW_SIZE);
+  if (count != USBMSC_CBW_SIZE || cbw.signature != USBMSC_CBW_SIGNATURE ||
+      cbw.lun > maxLun || !cbw.cb_length || cbw.cb_length > 16)
+  {
+    invalid = 1;
+    SetEPTxStatus(ENDP1, EP_TX_STALL);
+    SetEPRxStatus(ENDP3, EP_RX_STALL);
+    return;
+  }
+  phase = USBMSC_COMMAND;
+  xSemaphoreGiveFromISR(xUsbMscCommandSemphr, &reschedNeeded);
+}
+
+void (*pEpInt_IN[7])(void) =
+  {
+    prvUsbMscTxDone, NOP_Process, NOP_Process, NOP_Process,
+    NOP_Process, NOP_Process, NOP_Process,
+  };
+
+void (*pEpInt_OUT[7])(void) =
+  {
+    NOP_Process, NOP_Process, prvUsbMscRxDone, NOP_Process,
+    NOP_Process, NOP_Process, NOP_Process,
+  };
+
+// Device
+// ------
+
+static void prvUsbMscInit()
+{
+  pInformation->Current_Configuration = 0;
+
+  _SetCNTR(CNTR_FRES);
+  _SetCNTR(0);
+  USB_SIL_Init();
+}
+
+// Bus reset, and the mass storage reset: a command in the daemon is
+// dropped as the phase changes under it
+static void prvUsbMscRestart()
+{
+  invalid = 0;
+  txBusy = 0;
+  dataLeft = 0;
+  phase = USBMSC_IDLE;
+  sense = SENSE_NONE;
+}
+
+static void prvUsbMscReset()
+{
+  pInformation->Current_Configuration = 0;
+  pInformation->Current_Feature = configDescriptor[7];
+  pInformation->Current_Interface = 0;
+  SetBTABLE(BTABLE_ADDRESS);
+
+  SetEPType(ENDP0, EP_CONTROL);
+  SetEPTxStatus(ENDP0, EP_TX_STALL);
+  SetEPRxAddr(ENDP0, ENDP0_RXADDR);
+  SetEPTxAddr(ENDP0, ENDP0_TXADDR);
+  Clear_Status_Out(ENDP0);
+  SetEPRxCount(ENDP0, Device_Property.MaxPacketSize);
+  SetEPRxValid(ENDP0);
+
+  SetEPType(ENDP1, EP_BULK);
+  SetEPTxAddr(ENDP1, ENDP1_TXADDR);
+  SetEPTxStatus(ENDP1, EP_TX_NAK);
+  SetEPRxStatus(ENDP1, EP_RX_DIS);
+
+  SetEPRxStatus(ENDP2, EP_RX_DIS);
+  SetEPTxStatus(ENDP2, EP_TX_DIS);
+
+  SetEPType(ENDP3, EP_BULK);
+  SetEPRxAddr(ENDP3, ENDP3_RXADDR);
+  SetEPRxCount(ENDP3, USBMSC_PACKET_SIZE);
+  SetEPRxStatus(ENDP3, EP_RX_VALID);
+  SetEPTxStatus(ENDP3, EP_TX_DIS);
+
+  SetDeviceAddress(0);
+  prvUsbMscRestart();
+}
+
+static void prvUsbMscStatusIn()
+{
+}
+
+static void prvUsbMscStatusOut()
+{
+}
+
+static uint8_t* prvUsbMscMaxLun(uint16_t length_)
+{
+  if (!length_)
+  {
+    pInformation->Ctrl_Info.Usb_wLength = sizeof (maxLun);
+    return NULL;
+  }
+  return &maxLun;
+}
+
+static RESULT prvUsbMscDataSetup(uint8_t request_)
+{
+  if (Type_Recipient != (CLASS_REQUEST | INTERFACE_RECIPIENT) ||
+      request_ != USBMSC_GET_MAX_LUN)
+    return USB_UNSUPPORT;
+
+  pInformation->Ctrl_Info.CopyData = prvUsbMscMaxLun;
+  pInformation->Ctrl_Info.Usb_wOffset = 0;
+  prvUsbMscMaxLun(0);
+  return USB_SUCCESS;
+}
+
+static RESULT prvUsbMscNoDataSetup(uint8_t request_)
+{
+  if (Type_Recipient != (CLASS_REQUEST | INTERFACE_RECIPIENT) ||
+      request_ != USBMSC_RESET)
+    return USB_UNSUPPORT;
+
+  ClearDTOG_TX(ENDP1);
+  ClearDTOG_RX(ENDP3);
+  SetEPTxStatus(ENDP1, EP_TX_NAK);
+  SetEPRxStatus(ENDP3, EP_RX_VALID);
+  prvUsbMscRestart();
+  return USB_SUCCESS;
+}
+
+// A bad command block keeps both endpoints halted through the clears
+static void prvUsbMscClearFeature()
+{
+  if (invalid)
+  {
+    SetEPTxStatus(ENDP1, EP_TX_STALL);
+    SetEPRxStatus(ENDP3, EP_RX_STALL);
+  }
+}
+
+static RESULT prvUsbMscGetInterfaceSetting(uint8_t interface_, uint8_t alternate_)
+{
+  if (alternate_ > 0 || interface_ > 0)
+    return USB_UNSUPPORT;
+  return USB_SUCCESS;
+}
+
+static uint8_t* prvUsbMscGetDeviceDescriptor(uint16_t length_)
+{
+  return Standard_GetDescriptorData(length_, &device);
+}
+
+static uint8_t* prvUsbMscGetConfigDescriptor(uint16_t length_)
+{
+  return Standard_GetDescriptorData(length_, &config);
+}
+
+static uint8_t* prvUsbMscGetStringDescriptor(uint16_t length_)
+{
+  uint8_t index = pInformation->USBwValue0;
+
+  if (index >= sizeof (strings) / sizeof (strings[0]))
+    return NULL;
+  return Standard_GetDescriptorData(length_, &strings[index]);
+}
+
+static void prvUsbMscSetDeviceAddress()
+{
+}
+
+DEVICE Device_Table =
+  {
+    .Total_Endpoint = EP_NUM,
+    .Total_Configuration = 1,
+  };
+
+DEVICE_PROP Device_Property =
+  {
+    .Init = prvUsbMscInit,
+    .Reset = prvUsbMscReset,
+    .Process_Status_IN = prvUsbMscStatusIn,
+    .Process_Status_OUT = prvUsbMscStatusOut,
+    .Class_Data_Setup = prvUsbMscDataSetup,
+    .Class_NoData_Setup = prvUsbMscNoDataSetup,
+    .Class_Get_Interface_Setting = prvUsbMscGetInterfaceSetting,
+    .GetDeviceDescriptor = prvUsbMscGetDeviceDescriptor,
+    .GetConfigDescriptor = prvUsbMscGetConfigDescriptor,
+    .GetStringDescriptor = prvUsbMscGetStringDescriptor,
+    .RxEP_buffer = 0,
+    .MaxPacketSize = USBMSC_PACKET_SIZE,
+  };
+
+USER_STANDARD_REQUESTS User_Standard_Requests =
+  {
+    .User_GetConfiguration = NOP_Process,
+    .User_SetConfiguration = NOP_Process,
+    .User_GetInterface = NOP_Process,
+    .User_SetInterface = NOP_Process,
+    .User_GetStatus = NOP_Process,
+    .User_ClearFeature = prvUsbMscClearFeature,
+    .User_SetEndPointFeature = NOP_Process,
+    .User_SetDeviceFeature = NOP_Process,
+    .User_SetDeviceAddress = prvUsbMscSetDeviceAddress,
+  };
+
+void vUsbMscInit(unsigned portBASE_TYPE priority_)
+{
+  vSemaphoreCreateBinary(xUsbMscCommandSemphr);
+  vSemaphoreCreateBinary(xUsbMscSpaceSemphr);
+  xUsbMscDiskMutex = xSemaphoreCreateMutex();
+  if (!xUsbMscCommandSemphr || !xUsbMscSpaceSemphr || !xUsbMscDiskMutex)
+    vFaultAllocation("usbmsc");
+  xSemaphoreTake(xUsbMscCommandSemphr, 0);
+  xSemaphoreTake(xUsbMscSpaceSemphr, 0);
+  vRingInit(&tx, txBuffer, USBMSC_RING_SIZE);
+
+  // Serial number from the 96 bits unique ID
+  char serial[sizeof (USBMSC_SERIAL)];
+  const uint32_t hash = uHardwareUid();
+  memcpy(serial, USBMSC_SERIAL, sizeof (serial));
+  for (int i = 0; i < 8; i++)
+    serial[4 + i] = "0123456789ABCDEF"[(hash >> (28 - 4 * i)) & 0xF];
+  prvUsbMscString(vendorString, USBMSC_VENDOR);
+  prvUsbMscString(productString, USBMSC_PRODUCT);
+  prvUsbMscString(serialString, serial);
+
+  // Disconnected out of the service mode
+  vGpioClockInit(USBMSC_DISC_GPIOx);
+  GPIO_InitTypeDef GPIO_InitStruct =
+    {
+      .GPIO_Pin = USBMSC_DISC_Pin,
+      .GPIO_Speed = GPIO_Speed_2MHz,
+      .GPIO_Mode = GPIO_Mode_Out_OD,
+    };
+  GPIO_SetBits(USBMSC_DISC_GPIOx, USBMSC_DISC_Pin);
+  GPIO_Init(USBMSC_DISC_GPIOx, &GPIO_InitStruct);
+
+  // 48 MHz from the 72 MHz PLL
+  RCC_USBCLKConfig(RCC_USBCLKSource_PLLCLK_1Div5);
+  RCC_APB1PeriphClockCmd(RCC_APB1Periph_USB, ENABLE);
+
+  NVIC_InitTypeDef NVIC_InitStructure =
+  {
+    .NVIC_IRQChannel = USB_LP_CAN1_RX0_IRQn,
+    .NVIC_IRQChannelPreemptionPriority = IRQ_PRIORITY_USB,
+    .NVIC_IRQChannelSubPriority = 0,
+    .NVIC_IRQChannelCmd = ENABLE,
+  };
+  NVIC_Init(&NVIC_InitStructure);
+
+  USB_Init();
+
+  if (xTaskCreate(vUsbMscTask, (const signed char * const)"usbmscd",
+                  USBMSC_STACK_SIZE, NULL, priority_, NULL) != pdPASS)
+    vFaultAllocation("usbmscd");
+}
+
+// Commands
+// --------
+
+static uint32_t prvUsbMscBe32(const uint8_t* p_)
+{
+  return (uint32_t)p_[0] << 24 | (uint32_t)p_[1] << 16 | p_[2] << 8 | p_[3];
+}
+
+static void prvUsbMscPutBe32(uint8_t* p_, uint32_t value_)
+{
+  p_[0] = value_ >> 24;
+  p_[1] = value_ >> 16;
+  p_[2] = value_ >> 8;
+  p_[3] = value_;
+}
+
+// End of the command, no data or none left: the status, or a halt when
+// the host expected data in. Out data is never taken: EP3 halted.
+static void prvUsbMscFinish(int passed_)
+{
+  taskENTER_CRITICAL();
+  if (phase == USBMSC_COMMAND || phase == USBMSC_DATA_IN)
+  {
+    csw.status = !passed_;
+    if (!passed_)
+    {
+      stats.failed++;
+      csw.residue = cbw.length;
+      vRingRelease(&tx, uRingUsed(&tx));
+    }
+    if (cbw.length && !(cbw.flags & USBMSC_CBW_IN) && !passed_)
+      SetEPRxStatus(ENDP3, EP_RX_STALL);
+    if (cbw.length && (cbw.flags & USBMSC_CBW_IN) && !passed_)
+      prvUsbMscStall();
+    else if (phase == USBMSC_COMMAND)
+      prvUsbMscSendStatus();
+  }
+  taskEXIT_CRITICAL();
+}
+
+static void prvUsbMscFail(uint16_t sense_)
+{
+  sense = sense_;
+  prvUsbMscFinish(0);
+}
+
+// A short answer, cut to what the host asked for: the rest is the
+// residue
+static void prvUsbMscReply(const void* data_, uint32_t size_)
+{
+  if (size_ > cbw.length)
+    size_ = cbw.length;
+  csw.residue = cbw.length - size_;
+  uRingWrite(&tx, data_, size_);
+
+  taskENTER_CRITICAL();
+  if (phase == USBMSC_COMMAND)
+  {
+    dataLeft = size_;
+    phase = USBMSC_DATA_IN;
+    prvUsbMscTxKick();
+  }
+  taskEXIT_CRITICAL();
+}
+
+// Blocks to EP1 as they are read, USBMSC_BUFFER_BLOCKS ahead
+static void prvUsbMscRead10()
+{
+  uint32_t block = prvUsbMscBe32(&cbw.cb[2]);
+  uint32_t count = cbw.cb[7] << 8 | cbw.cb[8];
+  uint8_t* span;
+
+  if (block + count > prvUsbMscBlocks() || block + count < block)
+  {
+    prvUsbMscFail(SENSE_OUT_OF_RANGE);
+    return;
+  }
+  if (count * USBMSC_BLOCK_SIZE > cbw.length)
+    count = cbw.length / USBMSC_BLOCK_SIZE;
+  csw.residue = cbw.length - count * USBMSC_BLOCK_SIZE;
+
+  taskENTER_CRITICAL();
+  dataLeft = count * USBMSC_BLOCK_SIZE;
+  phase = USBMSC_DATA_IN;
+  taskEXIT_CRITICAL();
+
+  for (; count; count--, block++)
+  {
+    while (uRingRoom(&tx) < USBMSC_BLOCK_SIZE)
+      if (phase != USBMSC_DATA_IN ||
+          xSemaphoreTake(xUsbMscSpaceSemphr,
+                         MS_TO_TICKS(USBMSC_TX_TIMEOUT_MS)) != pdTRUE)
+        return;
+
+    // Whole blocks from a ring reset: always contiguous
+    uRingWriteSpan(&tx, &span);
+    xSemaphoreTake(xUsbMscDiskMutex, portMAX_DELAY);
+    const int read = on && prvUsbMscRead(block, span);
+    xSemaphoreGive(xUsbMscDiskMutex);
+    if (!read)
+    {
+      prvUsbMscFail(SENSE_MEDIUM_ERROR);
+      return;
+    }
+    stats.blocks++;
+
+    taskENTER_CRITICAL();
+    if (phase == USBMSC_DATA_IN)
+    {
+      vRingCommit(&tx, USBMSC_BLOCK_SIZE);
+      prvUsbMscTxKick();
+    }
+    taskEXIT_CRITICAL();
+  }
+}
+
+static void prvUsbMscCommand()
+{
+  const uint32_t blocks = prvUsbMscBlocks();
+  uint8_t answer[18];
+
+  stats.commands++;
+  // Not in the data phase yet: the interrupt leaves the ring alone
+  vRingInit(&tx, txBuffer, USBMSC_RING_SIZE);
+  csw.signature = USBMSC_CSW_SIGNATURE;
+  csw.tag = cbw.tag;
+  csw.residue = cbw.length;
+  memset(answer, 0, sizeof (answer));
+
+  switch (cbw.cb[0])
+  {
+  case SCSI_TEST_UNIT_READY:
+    if (!blocks)
+      prvUsbMscFail(SENSE_NOT_PRESENT);
+    else
+      prvUsbMscFinish(1);
+    break;
+  case SCSI_REQUEST_SENSE:
+    answer[0] = 0x70;
+    answer[2] = sense >> 8;
+    answer[7] = 10;
+    answer[12] = sense;
+    sense = SENSE_NONE;
+    prvUsbMscReply(answer, 18);
+    break;
+  case SCSI_INQUIRY:
+    prvUsbMscReply(inquiry, sizeof (inquiry));
+    break;
+  case SCSI_MODE_SENSE6:
+    // Write protected
+    answer[0] = 3;
+    answer[2] = 0x80;
+    prvUsbMscReply(answer, 4);
+    break;
+  case SCSI_MODE_SENSE10:
+    answer[1] = 6;
+    answer[3] = 0x80;
+    prvUsbMscReply(answer, 8);
+    break;
+  case SCSI_START_STOP_UNIT:
+  case SCSI_ALLOW_REMOVAL:
+  case SCSI_VERIFY10:
+    prvUsbMscFinish(1);
+    break;
+  case SCSI_READ_FORMAT_CAPS:
+    if (!blocks)
+    {
+      prvUsbMscFail(SENSE_NOT_PRESENT);
+      break;
+    }
+    answer[3] = 8;
+    prvUsbMscPutBe32(&answer[4], blocks);
+    prvUsbMscPutBe32(&answer[8], USBMSC_BLOCK_SIZE);
+    answer[8] = 0x02; // Formatted media
+    prvUsbMscReply(answer, 12);
+    break;
+  case SCSI_READ_CAPACITY10:
+    if (!blocks)
+    {
+      prvUsbMscFail(SENSE_NOT_PRESENT);
+      break;
+    }
+    prvUsbMscPutBe32(&answer[0], blocks - 1);
+    prvUsbMscPutBe32(&answer[4], USBMSC_BLOCK_SIZE);
+    prvUsbMscReply(answer, 8);
+    break;
+  case SCSI_READ10:
+    prvUsbMscRead10();
+    break;
+  case SCSI_WRITE10:
+    prvUsbMscFail(SENSE_WRITE_PROTECTED);
+    break;
+  default:
+    prvUsbMscFail(SENSE_INVALID_COMMAND);
+    break;
+  }
+}
+
+static void vUsbMscTask(void* pvParameters_)
+{
+  for (;;)
+  {
+    xSemaphoreTake(xUsbMscCommandSemphr, portMAX_DELAY);
+    if (phase == USBMSC_COMMAND)
+      prvUsbMscCommand();
+  }
+}
+
+// Service mode
+// ------------
+
+int xUsbMscService(int on_)
+{
+  if (on_ == on)
+    return 1;
+
+  if (on_)
+  {
+#ifdef SDCARD
+    if (!xSdService(1))
+      return 0;
+#endif
+    on = 1;
+    GPIO_ResetBits(USBMSC_DISC_GPIOx, USBMSC_DISC_Pin);
+    return 1;
+  }
+
+  // The host sees it go; a read in progress ends first
+  GPIO_SetBits(USBMSC_DISC_GPIOx, USBMSC_DISC_Pin);
+  xSemaphoreTake(xUsbMscDiskMutex, portMAX_DELAY);
+  on = 0;
+  xSemaphoreGive(xUsbMscDiskMutex);
+#ifdef SDCARD
+  xSdService(0);
+#endif
+  return 1;
+}
+
+int iUsbMscIsOn()
+{
+  return on;
+}
+
+void vUsbMscGetStats(usbmsc_stats_t* stats_)
+{
+  *stats_ = stats;
+}
+
+void USB_LP_CAN1_RX0_IRQHandler()
+{
+  reschedNeeded = pdFALSE;
+
+  wIstr = _GetISTR();
+  if (wIstr & ISTR_CTR & wInterrupt_Mask)
+    CTR_LP();
+  if (wIstr & ISTR_RESET & wInterrupt_Mask)
+  {
+    _SetISTR((uint16_t)CLR_RESET);
+    Device_Property.Reset();
+  }
+
+  portEND_SWITCHING_ISR(reschedNeeded);
+}
@@ -0,0 +1,42 @@
+#ifndef LIBPERIPH_USBMSC_H
+# define LIBPERIPH_USBMSC_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+// USB mass storage service mode (--usb-msc): the board shows as a
+// read-only disk, to copy a whole log with the tools of the host (dd) at
+// the full speed rate, 64 bytes packets, instead of dumps over the shell.
+// Bulk-only transport, the SCSI commands of the hosts for a read-only
+// direct access device. The disk is the raw microSD card with --sdcard
+// (wtools/sdcard.py reads its image), else the black box flash region.
+//
+// Disconnected (D+ pull-up off) out of the service mode; the host link
+// stays on the UART or the probe. The card does not log meanwhile.
+#define USBMSC_BLOCK_SIZE 512
+
+// Blocks read ahead of the host, the ring of the IN packets. Must be a
+// power of 2.
+#define USBMSC_BUFFER_BLOCKS 2
+
+// Daemon stack, in words
+#ifndef USBMSC_STACK_SIZE
+# define USBMSC_STACK_SIZE configMINIMAL_STACK_SIZE
+#endif
+
+typedef struct
+{
+  uint32_t commands;    // Command blocks received
+  uint32_t failed;      // Answered with a failure status
+  uint32_t blocks;      // Read by the host
+} usbmsc_stats_t;
+
+void vUsbMscInit(unsigned portBASE_TYPE priority_);
+// Enter (connect, the disk served) or leave (disconnect) the service
+// mode, from a task. 0 if the disk is not there.
+int xUsbMscService(int on_);
+int iUsbMscIsOn();
+void vUsbMscGetStats(usbmsc_stats_t* stats_);
+
+#endif /* LIBPERIPH_USBMSC_H */
@@ -2,163 +2,3330 @@
 
 #include "FreeRTOS.h"
 #include "task.h"
+#ifdef CO_ROUTINES
+# include "croutine.h"
+#endif
 
+#include "boot/boot.h"
+
+#include "libglobal/actuation.h"
+#include "libglobal/bench.h"
+#include "libglobal/blackbox.h"
 #include "libglobal/interpreter.h"
+#include "libglobal/macros.h"
+#include "libglobal/pack.h"
+#include "libglobal/protocol.h"
+#include "libglobal/samples.h"
+#include "libglobal/startup.h"
 #include "libglobal/strutils.h"
+#include "libglobal/sysmon.h"
+#include "libglobal/telemetry.h"
+#include "libglobal/timeline.h"
+#include "libglobal/topics.h"
+#include "libglobal/behaviour.h"
+#include "libglobal/odometry.h"
+#include "libglobal/params.h"
+#include "libglobal/profile.h"
+#include "libglobal/reflex.h"
+#include "libglobal/events.h"
+#include "libglobal/fault.h"
+#include "libglobal/regmap.h"
+#include "libglobal/polar.h"
+#include "libglobal/pool.h"
+#include "libglobal/queues.h"
+#include "libglobal/vm.h"
+#include "libglobal/wall.h"
 
 #include "libperiph/hardware.h"
-#include "libperiph/uart.h"
+#include "libperiph/link.h"
 #include "libperiph/leds.h"
 #include "libperiph/motors.h"
+#include "libperiph/park.h"
 #include "libperiph/sonar.h"
+#include "libperiph/adc.h"
 #include "libperiph/sharps.h"
+#include "libperiph/power.h"
+#include "libperiph/bumpers.h"
+#include "libperiph/cleaning.h"
+#include "libperiph/can.h"
+#include "libperiph/crc.h"
+#include "libperiph/encoders.h"
 #include "libperiph/i2c.h"
+#include "libperiph/i2cmaster.h"
+#include "libperiph/spi.h"
+#include "libperiph/imu.h"
+#include "libperiph/itm.h"
+#include "libperiph/latency.h"
+#include "libperiph/mpu.h"
+#include "libperiph/periodic.h"
+#include "libperiph/resources.h"
+#include "libperiph/rtc.h"
+#include "libperiph/rtt.h"
+#include "libperiph/sdcard.h"
+#include "libperiph/timebase.h"
+#include "libperiph/uart.h"
+#include "libperiph/usbmsc.h"
+#include "libperiph/priorities.h"
 
-#define CONSOLE_TOKEN_NB 4
+#define FRAME_TOKEN_NB   24
+#define PARAMS_NB        (sizeof (params) / sizeof (params[0]))
 
 static bool bMotorsEnable   = ENABLE;
 
-void process_motor_cmd(char* str);
-void process_sonar_cmd(char* str);
-void process_sharps_cmd(char* str);
-void process_sensors_cmd(char* str);
+void process_motor_frame(const uint8_t* payload, uint8_t size);
+void process_sensors_frame(const uint8_t* payload, uint8_t size);
+void process_telemetry_frame(const uint8_t* payload, uint8_t size);
+void process_samples_frame(const uint8_t* payload, uint8_t size);
+void process_segments_frame(const uint8_t* payload, uint8_t size);
+void process_log_frame(const uint8_t* payload, uint8_t size);
+void process_time_frame(const uint8_t* payload, uint8_t size);
+void process_echo_frame(const uint8_t* payload, uint8_t size);
+void process_polar_frame(const uint8_t* payload, uint8_t size);
+void process_velocity_frame(const uint8_t* payload, uint8_t size);
+void process_dump_frame(const uint8_t* payload, uint8_t size);
+void process_params_set_frame(const uint8_t* payload, uint8_t size);
+void process_params_frame(const uint8_t* payload, uint8_t size);
+void process_behaviour_set_frame(const uint8_t* payload, uint8_t size);
+void process_behaviour_frame(const uint8_t* payload, uint8_t size);
+void process_behaviour_run_frame(const uint8_t* payload, uint8_t size);
+void process_vm_load_frame(const uint8_t* payload, uint8_t size);
+void process_vm_run_frame(const uint8_t* payload, uint8_t size);
+void process_vm_frame(const uint8_t* payload, uint8_t size);
+void process_actuation_frame(const uint8_t* payload, uint8_t size);
+void process_ident_frame(const uint8_t* payload, uint8_t size);
+void process_caps_frame(const uint8_t* payload, uint8_t size);
+void process_schema_frame(const uint8_t* payload, uint8_t size);
+void process_telemetry_delta_frame(const uint8_t* payload, uint8_t size);
+
+// Buffers of the dumps, for the time of a command: the samples ring in
+// one large block, the task and probe tables in the small ones
+#define POOL_LARGE_SIZE (SAMPLES_NB * sizeof (sample_t))
+#define POOL_LARGE_NB   1
+#define POOL_SMALL_SIZE ((SYSMON_TASKS_MAX + 1) * sizeof (sysmon_load_t))
+#define POOL_SMALL_NB   2
+
+static pool_t largePool;
+static pool_t smallPool;
+
+// Parameter keys, saved in the flash: never renumber them
+enum eParam {
+  PARAM_MOTORS_SLEW       = 1,
+  PARAM_MOTORS_TIMEOUT    = 2,
+  PARAM_MOTORS_CLOSED     = 3,
+  PARAM_MOTORS_KP         = 4,
+  PARAM_MOTORS_KI         = 5,
+  PARAM_MOTORS_KD         = 6,
+  PARAM_SONAR_INTERVAL    = 7,
+  PARAM_SHARPS_RATE       = 8,
+  PARAM_CURRENT_LIMIT     = 9,
+  PARAM_REFLEX_STOP       = 10,
+  PARAM_REFLEX_SLOW       = 11,
+  PARAM_SHARP_LEFT_GAIN   = 12,
+  PARAM_SHARP_LEFT_OFFSET = 13,
+  PARAM_SHARP_RIGHT_GAIN  = 14,
+  PARAM_SHARP_RIGHT_OFFSET = 15,
+  PARAM_WALL_KP           = 16,
+  PARAM_WALL_KD           = 17,
+  PARAM_MOTORS_DRIVE      = 18,
+  PARAM_MOTORS_PWM_HZ     = 19,
+  PARAM_MOTORS_LOOP_HZ    = 20,
+  PARAM_NODE_ADDRESS      = 21,
+  PARAM_VREFINT_MV        = 22,
+  PARAM_PARK_DELAY        = 23,
+  PARAM_MOTORS_NOMINAL_MV = 24,
+  PARAM_MOTORS_KC         = 25,
+  PARAM_MOTORS_SLIP       = 26,
+  PARAM_MOTORS_CONTINUOUS = 27,
+  // Linearization of each motor: the deadband then the points, in turn
+  PARAM_MOTORS_LINEAR_LEFT  = 28,
+  PARAM_MOTORS_LINEAR_RIGHT = 28 + MOTORS_LINEAR_NB,
+};
+
+static void apply_motor_slew(int32_t value);
+static void apply_motor_timeout(int32_t value);
+static void apply_motor_closed_loop(int32_t value);
+static void apply_motor_pid(int32_t value);
+static void apply_sonar_interval(int32_t value);
+static void apply_sharps_rate(int32_t value);
+static void apply_current_limit(int32_t value);
+static void apply_reflex_thresholds(int32_t value);
+static void apply_sharps_calibration(int32_t value);
+static void apply_wall_gains(int32_t value);
+static void apply_motor_drive(int32_t value);
+static void apply_motor_pwm(int32_t value);
+static void apply_motor_loop(int32_t value);
+static void apply_node_address(int32_t value);
+static void apply_vrefint(int32_t value);
+static void apply_park_delay(int32_t value);
+static void apply_motor_nominal(int32_t value);
+static void apply_motor_cross_coupling(int32_t value);
+static void apply_motor_slip(int32_t value);
+static void apply_motor_continuous(int32_t value);
+static void apply_motor_linear(int32_t value);
+#ifdef RTC_STANDBY
+static void rtc_standby();
+#endif
+
+// Tuning parameters, sorted by key. The direct commands ("ma", "mp"...)
+// change the running values only, "ps" saves them.
+static const param_t params[] =
+  {
+    { PARAM_MOTORS_SLEW, "motors slew", MOTORS_DEFAULT_SLEW,
+      0, 2 * MOTORS_COMMAND_MAX, &apply_motor_slew },
+    { PARAM_MOTORS_TIMEOUT, "motors timeout ms", 0,
+      0, 60000, &apply_motor_timeout },
+    { PARAM_MOTORS_CLOSED, "motors closed loop", 0,
+      0, 1, &apply_motor_closed_loop },
+    { PARAM_MOTORS_KP, "motors kp", MOTORS_DEFAULT_KP,
+      0, INT16_MAX, &apply_motor_pid },
+    { PARAM_MOTORS_KI, "motors ki", MOTORS_DEFAULT_KI,
+      0, INT16_MAX, &apply_motor_pid },
+    { PARAM_MOTORS_KD, "motors kd", MOTORS_DEFAULT_KD,
+      0, INT16_MAX, &apply_motor_pid },
+    { PARAM_SONAR_INTERVAL, "sonar interval ms", SONAR_DEFAULT_INTERVAL_MS,
+      SONAR_MIN_INTERVAL_MS, 1000, &apply_sonar_interval },
+    { PARAM_SHARPS_RATE, "sharps rate hz", ADC_DEFAULT_RATE_HZ,
+      ADC_MIN_RATE_HZ, ADC_MAX_RATE_HZ, &apply_sharps_rate },
+    { PARAM_CURRENT_LIMIT, "current limit ma", POWER_DEFAULT_CURRENT_LIMIT_MA,
+      100, 6000, &apply_current_limit },
+    { PARAM_REFLEX_STOP, "reflex stop mm", REFLEX_DEFAULT_STOP_MM,
+      0, 4000, &apply_reflex_thresholds },
+    { PARAM_REFLEX_SLOW, "reflex slow mm", REFLEX_DEFAULT_SLOW_MM,
+      0, 4000, &apply_reflex_thresholds },
+    { PARAM_SHARP_LEFT_GAIN, "sharp left gain", SHARPS_GAIN_ONE,
+      SHARPS_GAIN_MIN, SHARPS_GAIN_MAX, &apply_sharps_calibration },
+    { PARAM_SHARP_LEFT_OFFSET, "sharp left offset mm", 0,
+      -SHARPS_OFFSET_MAX, SHARPS_OFFSET_MAX, &apply_sharps_calibration },
+    { PARAM_SHARP_RIGHT_GAIN, "sharp right gain", SHARPS_GAIN_ONE,
+      SHARPS_GAIN_MIN, SHARPS_GAIN_MAX, &apply_sharps_calibration },
+    { PARAM_SHARP_RIGHT_OFFSET, "sharp right offset mm", 0,
+      -SHARPS_OFFSET_MAX, SHARPS_OFFSET_MAX, &apply_sharps_calibration },
+    { PARAM_WALL_KP, "wall kp", WALL_DEFAULT_KP,
+      0, INT16_MAX, &apply_wall_gains },
+    { PARAM_WALL_KD, "wall kd", WALL_DEFAULT_KD,
+      0, INT16_MAX, &apply_wall_gains },
+    { PARAM_MOTORS_DRIVE, "motors drive", MOTORS_DRIVE_ANTIPHASE,
+      MOTORS_DRIVE_ANTIPHASE, MOTORS_DRIVE_COAST, &apply_motor_drive },
+    { PARAM_MOTORS_PWM_HZ, "motors pwm hz", MOTORS_DEFAULT_PWM_HZ,
+      MOTORS_MIN_PWM_HZ, MOTORS_MAX_PWM_HZ, &apply_motor_pwm },
+    { PARAM_MOTORS_LOOP_HZ, "motors loop hz", MOTORS_DEFAULT_LOOP_HZ,
+      MOTORS_MIN_LOOP_HZ, MOTORS_MAX_LOOP_HZ, &apply_motor_loop },
+    { PARAM_NODE_ADDRESS, "node address", 0,
+      0, PROTO_ADDR_MAX, &apply_node_address },
+    { PARAM_VREFINT_MV, "vrefint mv", ADC_VREFINT_MV,
+      ADC_VREFINT_MIN_MV, ADC_VREFINT_MAX_MV, &apply_vrefint },
+    { PARAM_PARK_DELAY, "park delay ms", 0,
+      0, PARK_MAX_DELAY_MS, &apply_park_delay },
+    { PARAM_MOTORS_NOMINAL_MV, "motors nominal mv", 0,
+      0, 30000, &apply_motor_nominal },
+    { PARAM_MOTORS_KC, "motors kc", MOTORS_DEFAULT_KC,
+      0, INT16_MAX, &apply_motor_cross_coupling },
+    { PARAM_MOTORS_SLIP, "motors slip mrad", MOTORS_DEFAULT_SLIP_MRAD,
+      0, 30000, &apply_motor_slip },
+    { PARAM_MOTORS_CONTINUOUS, "motors continuous", MOTORS_DEFAULT_CONTINUOUS,
+      0, MOTORS_COMMAND_MAX, &apply_motor_continuous },
+    { PARAM_MOTORS_LINEAR_LEFT, "motors left deadband", 0,
+      0, MOTORS_COMMAND_MAX, &apply_motor_linear },
+    { PARAM_MOTORS_LINEAR_LEFT + 1, "motors left linear 1",
+      MOTORS_COMMAND_MAX / 4, 0, MOTORS_COMMAND_MAX, &apply_motor_linear },
+    { PARAM_MOTORS_LINEAR_LEFT + 2, "motors left linear 2",
+      MOTORS_COMMAND_MAX / 2, 0, MOTORS_COMMAND_MAX, &apply_motor_linear },
+    { PARAM_MOTORS_LINEAR_LEFT + 3, "motors left linear 3",
+      3 * MOTORS_COMMAND_MAX / 4, 0, MOTORS_COMMAND_MAX, &apply_motor_linear },
+    { PARAM_MOTORS_LINEAR_RIGHT, "motors right deadband", 0,
+      0, MOTORS_COMMAND_MAX, &apply_motor_linear },
+    { PARAM_MOTORS_LINEAR_RIGHT + 1, "motors right linear 1",
+      MOTORS_COMMAND_MAX / 4, 0, MOTORS_COMMAND_MAX, &apply_motor_linear },
+    { PARAM_MOTORS_LINEAR_RIGHT + 2, "motors right linear 2",
+      MOTORS_COMMAND_MAX / 2, 0, MOTORS_COMMAND_MAX, &apply_motor_linear },
+    { PARAM_MOTORS_LINEAR_RIGHT + 3, "motors right linear 3",
+      3 * MOTORS_COMMAND_MAX / 4, 0, MOTORS_COMMAND_MAX, &apply_motor_linear },
+  };
 
 int main(void)
 {
   // Hardware
   vHardwareInit();
-  // Uart
-  vUartInit();
+  vStartupMark(STARTUP_CLOCKS);
+#ifdef ITM_TRACE
+  // SWO trace, the first boot logs included
+  vItmInit();
+#endif
+  // Buffers of the commands
+  vPoolInit(&largePool, "large", POOL_LARGE_SIZE, POOL_LARGE_NB);
+  vPoolInit(&smallPool, "small", POOL_SMALL_SIZE, POOL_SMALL_NB);
+  // Checksums
+  vCrcInit();
+#ifdef RTC_STANDBY
+  // Time of day, and how the board woke up
+  vRtcInit();
+#endif
+  // Black box, logs the boot
+  vBlackboxInit(PRIORITY_BLACKBOX);
+#ifdef PROFILE
+  // Cycle counts of the hot paths
+  vProfileInit();
+#endif
+  // Host link
+#if defined(USB_LINK)
+  vLinkInit(&xUsbCdcLink);
+#elif defined(RTT_LINK)
+  vLinkInit(&xRttLink);
+#else
+  vLinkInit(&xUartLink);
+#endif
+#ifdef TELEMETRY_UART
+  // Telemetry stream apart, so that it does not delay the replies
+  vLinkSetStream(&xUartTelemetryLink);
+#endif
+#ifdef SDCARD
+  // Telemetry stream to the card, off the host link
+  vLinkSetStream(&xSdLogLink);
+#endif
+#ifdef USB_MSC
+  // Log disk, disconnected until "msc 1"
+  vUsbMscInit(PRIORITY_COMMS);
+#endif
   // I2C
   vI2CInit();
-  // Leds
-  vLedsInit(tskIDLE_PRIORITY + 3);
+#ifndef NO_IMU
+  // On-board sensors bus
+  vI2CMasterInit();
+#endif
+#ifdef SPI_LINK
+  // Raspberry Pi frames, the register file over SPI
+  vSpiInit();
+#endif
+#ifdef CAN_BUS
+  // Other boards network
+  vCanInit(CAN_DEFAULT_BITRATE);
+#endif
+#ifndef NO_IMU
+  // Gyro, for the odometry heading
+  vImuInit(PRIORITY_SENSORS);
+#endif
+  // Status LED
+  vLedsInit();
+#ifndef NO_SONAR
   // Sonar
-  vSonarInit(tskIDLE_PRIORITY + 3);
+  vSonarInit(PRIORITY_SENSORS);
+#endif
   // Sharps
   vSharpsInit();
+  // Battery and motors current
+  vPowerInit();
+#ifdef BEMF
+  // Motor terminals, the injected pair
+  vMotorsBemfInit();
+#endif
+  // Analog inputs, once all channels are registered
+  vAdcStart();
+#ifdef CLEANING
+  // Side brush and suction fan, on the ADC trigger timer
+  vCleaningInit();
+#endif
   // Motors
-  vMotorsInit(tskIDLE_PRIORITY + 3);
+  vMotorsInit(PRIORITY_MOTORS);
+  // Overcurrent cut off
+  vPowerStart();
+  // Sensors slowed down while the motors are idle
+  vParkInit();
+  // Obstacle reflex
+  vReflexInit();
+  // Wall following
+  vWallInit();
+  // Coverage behaviours, standalone
+  vBehaviourInit();
+  // Uploaded control logic
+  vVmInit();
+  // Obstacles around the robot
+  vPolarInit();
+  // Bumpers and cliff sensor, cut the motors off on contact
+  vBumpersInit();
+#ifdef LATENCY
+  // Loopback edges, PC10 to PC9
+  vLatencyInit(PRIORITY_SENSORS);
+#endif
+  vEventsInit(PRIORITY_COMMS);
+  // Recorded command sequences
+  vMacrosInit(PRIORITY_COMMS);
+  // Telemetry
+  vTelemetryInit();
+  // I2C register file
+  vRegmapInit();
+  // Saved tuning, over the defaults of the modules above
+  vParamsInit(params, PARAMS_NB);
 
   // Interpreter
-  token_t tokens[CONSOLE_TOKEN_NB];
-  tokens[0].command = 'm';
-  tokens[0].handler = &process_motor_cmd;
-  tokens[1].command = 's';
-  tokens[1].handler = &process_sonar_cmd;
-  tokens[2].command = 'i';
-  tokens[2].handler = &process_sharps_cmd;
-  tokens[3].command = 'a';
-  tokens[3].handler = &process_sensors_cmd;
-  vInterpreterInit("swiftler", &tokens[0], CONSOLE_TOKEN_NB, tskIDLE_PRIORITY + 4);
+  vInterpreterInit("swiftler", PRIORITY_INTERPRETER);
+
+  // Binary protocol
+  frame_token_t frames[FRAME_TOKEN_NB];
+  frames[0].type = PROTO_MOTORS_CMD;
+  frames[0].handler = &process_motor_frame;
+  frames[1].type = PROTO_SENSORS_REQ;
+  frames[1].handler = &process_sensors_frame;
+  frames[2].type = PROTO_TELEM_CFG;
+  frames[2].handler = &process_telemetry_frame;
+  frames[3].type = PROTO_SAMPLES_REQ;
+  frames[3].handler = &process_samples_frame;
+  frames[4].type = PROTO_SEGMENTS;
+  frames[4].handler = &process_segments_frame;
+  frames[5].type = PROTO_LOG_REQ;
+  frames[5].handler = &process_log_frame;
+  frames[6].type = PROTO_TIME_REQ;
+  frames[6].handler = &process_time_frame;
+  frames[7].type = PROTO_ECHO_REQ;
+  frames[7].handler = &process_echo_frame;
+  frames[8].type = PROTO_POLAR_REQ;
+  frames[8].handler = &process_polar_frame;
+  frames[9].type = PROTO_VELOCITY;
+  frames[9].handler = &process_velocity_frame;
+  frames[10].type = PROTO_DUMP_REQ;
+  frames[10].handler = &process_dump_frame;
+  frames[11].type = PROTO_PARAMS_SET;
+  frames[11].handler = &process_params_set_frame;
+  frames[12].type = PROTO_PARAMS_REQ;
+  frames[12].handler = &process_params_frame;
+  frames[13].type = PROTO_BEHAVIOUR_SET;
+  frames[13].handler = &process_behaviour_set_frame;
+  frames[14].type = PROTO_BEHAVIOUR_REQ;
+  frames[14].handler = &process_behaviour_frame;
+  frames[15].type = PROTO_BEHAVIOUR_RUN;
+  frames[15].handler = &process_behaviour_run_frame;
+  frames[16].type = PROTO_VM_LOAD;
+  frames[16].handler = &process_vm_load_frame;
+  frames[17].type = PROTO_VM_RUN;
+  frames[17].handler = &process_vm_run_frame;
+  frames[18].type = PROTO_VM_REQ;
+  frames[18].handler = &process_vm_frame;
+  frames[19].type = PROTO_ACTUATION_REQ;
+  frames[19].handler = &process_actuation_frame;
+  frames[20].type = PROTO_IDENT_REQ;
+  frames[20].handler = &process_ident_frame;
+  frames[21].type = PROTO_CAPS_REQ;
+  frames[21].handler = &process_caps_frame;
+  frames[22].type = PROTO_SCHEMA_REQ;
+  frames[22].handler = &process_schema_frame;
+  frames[23].type = PROTO_TELEM_DELTA_CFG;
+  frames[23].handler = &process_telemetry_delta_frame;
+  vInterpreterSetFrameHandlers(&frames[0], FRAME_TOKEN_NB);
   vInterpreterStart();
 
   if (bMotorsEnable)
     vMotorsEnable();
 
+  // Blink the cause of the fault that reset the board, until cleared,
+  // and report it on the console
+  fault_record_t fault;
+  if (iFaultGet(&fault))
+  {
+    vLedsSetFaultCode(fault.cause);
+    vInterpreterSetStartCommand("fault");
+  }
+#ifdef RTC_STANDBY
+  // The scheduled run, unless a fault wants a look first
+  rtc_schedule_t schedule;
+  vRtcGetSchedule(&schedule);
+  if (iRtcGetWake() == RTC_WAKE_ALARM && schedule.state >= 0 &&
+      !iFaultGet(&fault))
+    xBehaviourStart(schedule.state);
+  vRtcOnStandby(&rtc_standby);
+#endif
+
+#ifdef STACK_GUARD
+  // Hardware stack checks, instead of the kernel ones
+  xMpuInit();
+#endif
+
+  vStartupMark(STARTUP_INIT);
+#ifdef ITM_TRACE
+  vItmLogf("swiftler init done, heap free %d", (int)xPortGetFreeHeapSize());
+#endif
+#ifdef RTT_LINK
+  vRttLogf("swiftler init done, heap free %d", (int)xPortGetFreeHeapSize());
+#endif
   vTaskStartScheduler();
 
   return 0;
 }
 
-void process_sonar_cmd(char* str)
+// Idle task: sleep until the next interrupt, the tick at the latest. The
+// flash and the core stop fetching; the peripherals, the tick and the
+// cycle counter run on (see libperiph/cycles.h).
+void vApplicationIdleHook()
 {
-  char buffer[32];
-  itoa(iSonarMeasureDistCm(), buffer);
-  vUartPuts(buffer);
+#ifdef CO_ROUTINES
+  // One ready co-routine per call: all of them get a turn before the
+  // sleep, the tick wakes the delayed ones
+  for (int i = 0; i < CO_ROUTINES_NB; i++)
+    vCoRoutineSchedule();
+#endif
+  __WFI();
 }
 
+// Kernel tick, from its interrupt
+void vApplicationTickHook()
+{
+  vTimebaseTick();
+  vSysmonTick();
+  vLedsTick();
+#ifdef LATENCY
+  vLatencyTick();
+#endif
+}
 
-void process_sharps_cmd(char* str)
+#if configCHECK_FOR_STACK_OVERFLOW
+// Checked at each context switch (configCHECK_FOR_STACK_OVERFLOW 2): the
+// kernel keeps no task names, see sysmon
+void vApplicationStackOverflowHook(xTaskHandle* pxTask, signed char* pcTaskName)
 {
-  char buffer[32];
-  fltoa(iSharpsMeasureDistCm(SHARP_LEFT), buffer);
-  vUartPuts(buffer);
-  vUartPutc('\t');
-  fltoa(iSharpsMeasureDistCm(SHARP_RIGHT), buffer);
-  vUartPuts(buffer);
+  vFaultStackOverflow(pcSysmonTaskName((void*)pxTask));
 }
+#endif
 
-void process_sensors_cmd(char* str)
+// machine 0/1: terse replies for the host tools
+void process_machine_cmd(int argc, const int32_t* argv)
 {
-  char buffer[32];
-  // Left sharp
-  fltoa(iSharpsMeasureDistCm(SHARP_LEFT), buffer);
-  vUartPuts(buffer);
-  vUartPutc('\t');
-  // Central sonar
-  itoa(iSonarMeasureDistCm(), buffer);
-  vUartPuts(buffer);
-  vUartPutc('\t');
-  // Right sharp
-  fltoa(iSharpsMeasureDistCm(SHARP_RIGHT), buffer);
-  vUartPuts(buffer);
+  vInterpreterSetMachine(argv[0]);
 }
+INTERPRETER_COMMAND(machine, 1, 1, &process_machine_cmd);
 
-void process_motor_cmd(char* str)
+// tm [0/1]: time every command as "time <command>" does, see the
+// interpreter; the setting
+void process_timing_cmd(int argc, const int32_t* argv)
 {
   int value;
-  char buffer[32];
-  char cmd = str[0];
-  char* args = trim_in_place(str + 1);
 
-  if (cmd == 's') // start/stop
+  if (argc)
+    vInterpreterSetTiming(argv[0]);
+  value = iInterpreterIsTiming();
+  vInterpreterValues(&value, 1);
+}
+INTERPRETER_COMMAND(tm, 0, 1, &process_timing_cmd);
+
+// j: background job (see the interpreter), running, progress done and
+// total (0 unknown), ms since it started, jobs run
+void process_job_cmd(int argc, const int32_t* argv)
+{
+  interpreter_job_t job;
+
+  vInterpreterGetJob(&job);
+  const int values[5] =
+    { job.running, job.done, job.total, job.elapsed_ms, job.runs };
+
+  if (iInterpreterIsMachine())
+    vInterpreterValues(values, 5);
+  else if (!job.name)
+    vInterpreterInfo("no job");
+  else
+    vInterpreterInfof("%s %s, %d/%d, %u ms", job.name,
+                      job.running ? "running" : "done", job.done, job.total,
+                      job.elapsed_ms);
+}
+INTERPRETER_COMMAND(j, 0, 0, &process_job_cmd);
+
+// jk: ask the background job to stop
+void process_job_kill_cmd(int argc, const int32_t* argv)
+{
+  if (xInterpreterCancelJob())
+    vInterpreterInfo("job cancelled");
+  else
+    vInterpreterFail("no job running");
+}
+INTERPRETER_COMMAND(jk, 0, 0, &process_job_kill_cmd);
+
+#ifndef NO_SONAR
+void process_sonar_cmd(int argc, const int32_t* argv)
+{
+  int values[SONARS_NB];
+
+  for (int i = 0; i < SONARS_NB; i++)
+    values[i] = iSonarMeasureDistMm(i);
+  vInterpreterValues(values, SONARS_NB);
+}
+INTERPRETER_COMMAND(s, 0, 0, &process_sonar_cmd);
+
+// si ms: quiet interval between pings
+void process_sonar_interval_cmd(int argc, const int32_t* argv)
+{
+  vSonarSetMinInterval(argv[0]);
+  vInterpreterInfo("sonar interval set");
+}
+INTERPRETER_COMMAND(si, 1, 1, &process_sonar_interval_cmd);
+
+// sw [robots index window_ms phase_us]: time slots of a fleet, the phase
+// modulo the frame, 0 robots off. Then the robots, the index, the window
+// and the phase.
+void process_sonar_fleet_cmd(int argc, const int32_t* argv)
+{
+  sonar_fleet_t fleet;
+
+  if (argc)
+  {
+    if (argc < 4 || argv[0] < 0 || argv[1] < 0 || argv[2] < 0 ||
+        argv[2] > UINT16_MAX)
+    {
+      vInterpreterFail("robots index window_ms phase_us");
+      return;
+    }
+    fleet.robots = argv[0] > UINT8_MAX ? UINT8_MAX : argv[0];
+    fleet.index = argv[1] > UINT8_MAX ? UINT8_MAX : argv[1];
+    fleet.window_ms = argv[2];
+    fleet.phase_us = argv[3];
+    if (!xSonarSetFleet(&fleet))
+    {
+      vInterpreterFail("bad schedule");
+      return;
+    }
+  }
+  vSonarGetFleet(&fleet);
+  const int values[4] =
+    { fleet.robots, fleet.index, fleet.window_ms, (int)fleet.phase_us };
+  vInterpreterValues(values, 4);
+}
+INTERPRETER_COMMAND(sw, 0, 4, &process_sonar_fleet_cmd);
+#endif
+
+static const char* const fault_messages[] =
+  {
+    [FAULT_STACK_OVERFLOW] = "stack overflow in '%s'",
+    [FAULT_ALLOCATION]     = "allocation of '%s'",
+    [FAULT_CRASH]          = "crash in '%s'",
+    [FAULT_ASSERT]         = "assert in '%s'",
+    [FAULT_RESOURCE]       = "conflict on '%s', see res",
+  };
+
+// boot: reset into the bootloader, waiting for an update on the UART
+// ("waf update")
+void process_boot_cmd(int argc, const int32_t* argv)
+{
+  vInterpreterInfo("bootloader");
+  vLinkFlush();
+
+  BOOT_REQUEST = BOOT_REQUEST_MAGIC;
+  NVIC_SystemReset();
+}
+INTERPRETER_COMMAND(boot, 0, 0, &process_boot_cmd);
+
+// clk [profile]: switch to the power profile (eHardwareProfile), docked
+// with the motors stopped. Then the profile, and the SYSCLK, HCLK, PCLK1,
+// PCLK2 and ADC clocks in kHz.
+void process_clocks_cmd(int argc, const int32_t* argv)
+{
+  RCC_ClocksTypeDef clocks;
+
+  if (argc)
   {
-    if (bMotorsEnable)
+    if (argv[0] < 0 || argv[0] >= HARDWARE_PROFILES_NB)
+    {
+      vInterpreterFail("no such profile");
+      return;
+    }
+    if (argv[0] == HARDWARE_DOCKED)
+    {
+      vMotorsClearSegments();
+      vSetMotorsCommand(0, 0);
+    }
+    if (!xHardwareSetProfile(argv[0]))
     {
-      vMotorsDisable();
-      vUartPuts("stop motors");
-      vUartPuts("\r\n");
-      bMotorsEnable = DISABLE;
+      vInterpreterFail("the uart line does not hold at that clock");
+      return;
     }
+  }
+
+  RCC_GetClocksFreq(&clocks);
+  const int values[6] =
+    { iHardwareGetProfile(), clocks.SYSCLK_Frequency / 1000,
+      clocks.HCLK_Frequency / 1000, clocks.PCLK1_Frequency / 1000,
+      clocks.PCLK2_Frequency / 1000, clocks.ADCCLK_Frequency / 1000 };
+
+  if (iInterpreterIsMachine())
+    vInterpreterValues(values, 6);
+  else
+    vInterpreterInfof("%s: sys %d hclk %d pclk1 %d pclk2 %d adc %d kHz",
+                      pcHardwareProfileName(values[0]), values[1], values[2],
+                      values[3], values[4], values[5]);
+}
+INTERPRETER_COMMAND(clk, 0, 1, &process_clocks_cmd);
+
+// pk [park [delay_ms]]: park the sensors now (1) until the next setpoint,
+// or leave (0); parks after delay_ms of idle motors, 0 never. Then
+// parked, the delay, the idle time, parks and time parked in ms.
+void process_park_cmd(int argc, const int32_t* argv)
+{
+  park_state_t state;
+
+  if (argc > 1)
+    vParkSetDelay(argv[1]);
+  if (argc > 0)
+    vParkRequest(argv[0]);
+  vParkGetState(&state);
+  const int values[5] =
+    { state.parked, state.delay_ms, state.idle_ms, state.parks,
+      state.parked_ms };
+  vInterpreterValues(values, 5);
+}
+INTERPRETER_COMMAND(pk, 0, 2, &process_park_cmd);
+
+// crc [offset length]: CRC-32 of the application image, and 1 when it
+// matches its descriptor, as the bootloader checks it. With a range, of
+// that part of the application flash, offsets from BOOT_APP_BASE.
+void process_crc_cmd(int argc, const int32_t* argv)
+{
+  const boot_image_t* image = (const boot_image_t*)BOOT_IMAGE_ADDRESS;
+  uint32_t offset = 0, length;
+
+  if (argc == 1)
+  {
+    vInterpreterFail("offset and length");
+    return;
+  }
+  if (argc)
+  {
+    offset = argv[0];
+    length = argv[1];
+  }
+  else if (image->magic == BOOT_IMAGE_MAGIC)
+    length = image->length;
+  else
+  {
+    vInterpreterFail("no image descriptor");
+    return;
+  }
+  if ((offset | length) & 3 || offset > BOOT_APP_SIZE ||
+      length > BOOT_APP_SIZE - offset)
+  {
+    vInterpreterFail("bad range");
+    return;
+  }
+
+  const uint32_t crc = uCrc32((const void*)(BOOT_APP_BASE + offset), length);
+  const int values[2] = { crc, !argc && crc == image->crc };
+
+  if (iInterpreterIsMachine())
+    vInterpreterValues(values, argc ? 1 : 2);
+  else if (argc)
+    vInterpreterInfof("crc %08x", crc);
+  else
+    vInterpreterInfof("crc %08x, image %s", crc, values[1] ? "ok" : "corrupt");
+}
+INTERPRETER_COMMAND(crc, 0, 2, &process_crc_cmd);
+
+// fault [0]: last fault (cause, count, tick) kept across resets, 0 clears.
+// After a crash, an assert or an overflow into the stack guard
+// (--stack-guard), the dump follows: line, pc, lr, psr, then
+// cfsr, hfsr, mmfar, bfar, then r0 to r3, r12, then the stack trace.
+void process_fault_cmd(int argc, const int32_t* argv)
+{
+  fault_record_t record;
+
+  if (argc)
+  {
+    vFaultClear();
+    vLedsSetFaultCode(0);
+    vInterpreterInfo("fault cleared");
+    return;
+  }
+
+  if (!iFaultGet(&record))
+  {
+    vInterpreterInfo("no fault");
+    return;
+  }
+
+  const int values[3] = { record.cause, record.count, record.tick };
+  vInterpreterValues(values, 3);
+  vInterpreterInfof(fault_messages[record.cause], record.task);
+
+  if (record.cause != FAULT_CRASH && record.cause != FAULT_ASSERT &&
+      !(record.cause == FAULT_STACK_OVERFLOW && record.crash.cfsr))
+    return;
+
+  const fault_crash_t* crash = &record.crash;
+  const int state[4] = { record.line, crash->pc, crash->lr, crash->psr };
+  const int status[4] = { crash->cfsr, crash->hfsr, crash->mmfar, crash->bfar };
+  const int regs[5] = { crash->r0, crash->r1, crash->r2, crash->r3, crash->r12 };
+  int depth;
+
+  for (depth = 0; depth < FAULT_TRACE_NB && crash->trace[depth]; depth++);
+  vInterpreterValues(state, 4);
+  vInterpreterValues(status, 4);
+  vInterpreterValues(regs, 5);
+  vInterpreterValues((const int*)crash->trace, depth);
+  vInterpreterInfof("pc %08x lr %08x cfsr %08x", crash->pc, crash->lr,
+                    crash->cfsr);
+}
+INTERPRETER_COMMAND(fault, 0, 1, &process_fault_cmd);
+
+// res: the DMA channels, timers and remaps claimed by the drivers, each
+// one as held (1) and in conflict (1), with the owners in human mode
+void process_resources_cmd(int argc, const int32_t* argv)
+{
+  for (int i = 0; i < RESOURCES_NB; i++)
+  {
+    const char* owner = pcResourceOwner(i);
+    const char* conflict = pcResourceConflict(i);
+    const int values[2] = { owner != NULL, conflict != NULL };
+
+    if (iInterpreterIsMachine())
+      vInterpreterValues(values, 2);
+    else if (conflict)
+      vInterpreterInfof("%-11s %-12s conflict with %s", pcResourceName(i),
+                        owner, conflict);
+    else
+      vInterpreterInfof("%-11s %s", pcResourceName(i), owner ? owner : "-");
+  }
+}
+INTERPRETER_COMMAND(res, 0, 0, &process_resources_cmd);
+
+static void print_log_record(const blackbox_record_t* record, void* context)
+{
+  int* done = context;
+
+  if (iInterpreterCancelled())
+    return;
+  const int values[4] =
+    { record->tick, record->event, record->arg, record->value };
+  vInterpreterValues(values, 4);
+  vInterpreterProgress(++*done, 0);
+}
+
+// log [n]: black box counters (logged, flushed, pending, dropped, flash
+// page sequence), or its last n records (tick, event, arg, value), 0 for
+// all of them. Runs as a background job.
+void process_log_cmd(int argc, const int32_t* argv)
+{
+  blackbox_stats_t stats;
+  int done = 0;
+
+  if (argc)
+  {
+    iBlackboxDump(argv[0], &print_log_record, &done);
+    if (iInterpreterCancelled())
+      vInterpreterFail("cancelled");
+    return;
+  }
+
+  vBlackboxGetStats(&stats);
+  const int values[5] =
+    { stats.logged, stats.flushed, stats.pending, stats.dropped, stats.sequence };
+  vInterpreterValues(values, 5);
+}
+INTERPRETER_BACKGROUND_COMMAND(log, 0, 1, &process_log_cmd);
+
+// up: boot phases in microseconds since the reset, 0 when not reached:
+// clocks, init done, first analog scan, first sonar cycle, gyro
+// calibrated, shell
+void process_startup_cmd(int argc, const int32_t* argv)
+{
+  uint32_t times[STARTUP_NB];
+
+  vStartupGet(times);
+  vInterpreterValues((const int*)times, STARTUP_NB);
+}
+INTERPRETER_COMMAND(up, 0, 0, &process_startup_cmd);
+
+#ifdef RTC_STANDBY
+// rtc [seconds]: time (Unix seconds), running, wake cause (eRtcWake) and
+// wakes from the standby so far. Sets the time first when given.
+void process_rtc_cmd(int argc, const int32_t* argv)
+{
+  rtc_schedule_t schedule;
+
+  if (argc)
+    vRtcSetTime(argv[0]);
+  vRtcGetSchedule(&schedule);
+  const int values[4] =
+    { uRtcGetTime(), iRtcIsRunning(), iRtcGetWake(), schedule.wakes };
+  vInterpreterValues(values, 4);
+}
+INTERPRETER_COMMAND(rtc, 0, 1, &process_rtc_cmd);
+
+// Before the standby
+static void rtc_standby()
+{
+  vBehaviourStop();
+}
+
+// sb [in_s [period_s [run_s [state]]]]: standby until the alarm in_s
+// from now (0: the wake pin only), then every period_s, back to standby
+// run_s after each alarm wake, the behaviour at state meanwhile (-1
+// none). Without arguments, the schedule: alarm, period, run, state. -1
+// clears it, the board stays up.
+void process_standby_cmd(int argc, const int32_t* argv)
+{
+  rtc_schedule_t schedule;
+
+  if (!iRtcIsRunning())
+  {
+    vInterpreterFail("no clock");
+    return;
+  }
+  if (!argc)
+  {
+    vRtcGetSchedule(&schedule);
+    const int values[4] =
+      { schedule.alarm, schedule.period_s, schedule.run_s, schedule.state };
+    vInterpreterValues(values, 4);
+    return;
+  }
+  if (argv[0] < 0)
+  {
+    vRtcClearSchedule();
+    vInterpreterInfo("schedule cleared");
+    return;
+  }
+
+  schedule.alarm = argv[0] ? uRtcGetTime() + argv[0] : 0;
+  schedule.period_s = argc > 1 ? argv[1] : 0;
+  schedule.run_s = argc > 2 ? argv[2] : 0;
+  schedule.state = argc > 3 ? argv[3] : -1;
+  if (argc > 1 && argv[1] < 0)
+    vInterpreterFail("usage: sb [in_s [period_s [run_s [state]]]]");
+  else if (argc > 2 && (argv[2] < 0 || argv[2] > UINT16_MAX))
+    vInterpreterFail("run up to 65535 s");
+  else if (argc > 3 && (argv[3] < -1 || argv[3] >= BEHAVIOUR_STATES_NB))
+    vInterpreterFail("bad state");
+  else if (!xRtcSetSchedule(&schedule) || !xRtcStandby())
+    vInterpreterFail("alarm past");
+  else
+    vInterpreterInfof("standby in %d ms", RTC_STANDBY_DELAY_MS);
+}
+INTERPRETER_COMMAND(sb, 0, 4, &process_standby_cmd);
+#endif
+
+#if !defined(USB_LINK) && !defined(RTT_LINK)
+// ub [bauds [flow]]: line rate and RTS/CTS flow control. With a rate,
+// switches to it once the answer went out: "uc" at the new rate confirms
+// within UART_CONFIRM_MS, else the previous setting comes back ("waf
+// monitor --bauds").
+void process_uart_cmd(int argc, const int32_t* argv)
+{
+  uart_line_t line;
+
+  if (!argc)
+  {
+    vUartGetLine(&line);
+    const int values[2] = { line.bauds, line.flow };
+    vInterpreterValues(values, 2);
+    return;
+  }
+
+  line.bauds = argv[0];
+  line.flow = argc > 1 && argv[1];
+  if (argv[0] <= 0 || !xUartCheckLine(line.bauds, line.flow))
+  {
+    vInterpreterFail("unsupported line setting");
+    return;
+  }
+  const int values[2] = { line.bauds, line.flow };
+  vInterpreterValues(values, 2);
+  vInterpreterInfo("switching, confirm with uc");
+  vUartSetLine(line.bauds, line.flow);
+}
+INTERPRETER_COMMAND(ub, 0, 2, &process_uart_cmd);
+
+// uc: keep the line setting of the last "ub"
+void process_uart_confirm_cmd(int argc, const int32_t* argv)
+{
+  if (!xUartConfirmLine())
+    vInterpreterFail("nothing to confirm");
+}
+INTERPRETER_COMMAND(uc, 0, 0, &process_uart_confirm_cmd);
+
+// us: RX overruns, framing and noise errors, bytes dropped by the ring,
+// RX pauses (flow control)
+void process_uart_stats_cmd(int argc, const int32_t* argv)
+{
+  uart_stats_t stats;
+
+  vUartGetStats(&stats);
+  const int values[5] =
+    { stats.overruns, stats.framing, stats.noise, stats.dropped,
+      stats.pauses };
+  vInterpreterValues(values, 5);
+}
+INTERPRETER_COMMAND(us, 0, 0, &process_uart_stats_cmd);
+#endif
+
+// stats: CPU load of each task over the last second, in permille, and
+// its free stack words, then free heap bytes and load of each profile probe
+void process_stats_cmd(int argc, const int32_t* argv)
+{
+  sysmon_load_t* task_loads =
+    pvPoolAlloc((SYSMON_TASKS_MAX + 1) * sizeof (sysmon_load_t));
+
+  if (!task_loads)
+  {
+    vInterpreterFail("no buffer");
+    return;
+  }
+
+  const int n = iSysmonGetLoads(task_loads, SYSMON_TASKS_MAX + 1);
+  for (int i = 0; i < n; i++)
+  {
+    const int values[2] =
+      { task_loads[i].cpu_permille, task_loads[i].stack_free };
+
+    if (iInterpreterIsMachine())
+      vInterpreterValues(values, 2);
     else
+      vInterpreterInfof("%-12s %3d.%d%% %4d", task_loads[i].name,
+                        values[0] / 10, values[0] % 10, values[1]);
+  }
+  vPoolFree(task_loads);
+
+  // heap_1 only allocates, at init: what is left now stays unused
+  const int heap_free = xPortGetFreeHeapSize();
+  if (iInterpreterIsMachine())
+    vInterpreterValues(&heap_free, 1);
+  else
+    vInterpreterInfof("heap free %d/%d", heap_free,
+                      (int)configTOTAL_HEAP_SIZE);
+  if (!iInterpreterIsMachine())
+    vInterpreterInfof("link %s, %d dropped (%d telemetry)", pcLinkName(),
+                      (int)uLinkDropped(), (int)uTelemetryDropped());
+
+#ifdef PROFILE
+  profile_probe_t* profile_dump =
+    pvPoolAlloc(PROFILE_NB * sizeof (profile_probe_t));
+  uint16_t* probe_loads = pvPoolAlloc(PROFILE_NB * sizeof (uint16_t));
+
+  if (!profile_dump || !probe_loads)
+  {
+    vPoolFree(profile_dump);
+    vPoolFree(probe_loads);
+    vInterpreterFail("no buffer");
+    return;
+  }
+  vProfileGet(profile_dump);
+  vSysmonGetProbeLoads(probe_loads);
+  for (int i = 0; i < PROFILE_NB; i++)
+  {
+    const int value = probe_loads[i];
+
+    if (iInterpreterIsMachine())
+      vInterpreterValues(&value, 1);
+    else
+      vInterpreterInfof("%-12s %3d.%d%%", profile_dump[i].name, value / 10,
+                        value % 10);
+  }
+  vPoolFree(profile_dump);
+  vPoolFree(probe_loads);
+#endif
+}
+INTERPRETER_COMMAND(stats, 0, 0, &process_stats_cmd);
+
+// pool: block size, blocks, used, high water and failed allocations of
+// each pool, by block size
+void process_pool_cmd(int argc, const int32_t* argv)
+{
+  pool_stats_t stats[POOL_MAX];
+  const int n = iPoolGetStats(stats, POOL_MAX);
+
+  for (int i = 0; i < n; i++)
+  {
+    const int values[5] =
+      { stats[i].block_size, stats[i].blocks_nb, stats[i].used,
+        stats[i].high_water, stats[i].failures };
+
+    if (iInterpreterIsMachine())
+      vInterpreterValues(values, 5);
+    else
+      vInterpreterInfof("%-8s %4d %3d %3d %3d %5d", stats[i].name, values[0],
+                        values[1], values[2], values[3], values[4]);
+  }
+}
+INTERPRETER_COMMAND(pool, 0, 0, &process_pool_cmd);
+
+#ifdef RATE_GROUPS
+// rg [0]: runs, us of the longest run and overruns of each rate group,
+// then the group, period in ms, runs and us of the longest run of each
+// periodic job, in the order they run. 0 starts over.
+void process_rate_groups_cmd(int argc, const int32_t* argv)
+{
+  periodic_group_stats_t groups[RATE_GROUPS_NB];
+  periodic_job_stats_t jobs[RATE_JOBS_MAX];
+  int n;
+
+  if (argc)
+  {
+    if (argv[0])
     {
-      vMotorsEnable();
-      vUartPuts("start motors");
-      vUartPuts("\r\n");
-      bMotorsEnable = ENABLE;
+      vInterpreterFail("0 only");
+      return;
     }
+    vPeriodicResetStats();
+    vInterpreterInfo("rate groups reset");
+    return;
+  }
+  n = iPeriodicGetStats(groups, jobs, RATE_JOBS_MAX);
+
+  for (int i = 0; i < RATE_GROUPS_NB; i++)
+  {
+    const int values[3] = { groups[i].runs, groups[i].max_us,
+                            groups[i].overruns };
+
+    if (iInterpreterIsMachine())
+      vInterpreterValues(values, 3);
+    else
+      vInterpreterInfof("%-6s %8d %5d %5d", groups[i].name, values[0],
+                        values[1], values[2]);
+  }
+  for (int i = 0; i < n; i++)
+  {
+    const int values[4] = { jobs[i].group, jobs[i].period_ms, jobs[i].runs,
+                            jobs[i].max_us };
+
+    if (iInterpreterIsMachine())
+      vInterpreterValues(values, 4);
+    else
+      vInterpreterInfof("%-10s %-6s %5d %8d %5d", jobs[i].name,
+                        groups[values[0]].name, values[1], values[2],
+                        values[3]);
+  }
+}
+INTERPRETER_COMMAND(rg, 0, 1, &process_rate_groups_cmd);
+#endif
+
+// q: size, high water, blocked sends, ms blocked and items dropped of
+// each channel between the tasks and the interrupts
+void process_queues_cmd(int argc, const int32_t* argv)
+{
+  queue_stats_t stats[QUEUES_MAX];
+  const int n = iQueuesGetStats(stats, QUEUES_MAX);
+
+  for (int i = 0; i < n; i++)
+  {
+    const int values[5] =
+      { stats[i].size, stats[i].high_water, stats[i].blocked,
+        stats[i].blocked_us / 1000, stats[i].dropped };
+
+    if (iInterpreterIsMachine())
+      vInterpreterValues(values, 5);
+    else
+      vInterpreterInfof("%-8s %4d %4d %5d %6d %5d", stats[i].name, values[0],
+                        values[1], values[2], values[3], values[4]);
   }
-  else if (cmd == 'l')
+}
+INTERPRETER_COMMAND(q, 0, 0, &process_queues_cmd);
+
+void process_queues_reset_cmd(int argc, const int32_t* argv)
+{
+  vQueuesReset();
+  vInterpreterInfo("queues stats reset");
+}
+INTERPRETER_COMMAND(qr, 0, 0, &process_queues_reset_cmd);
+
+void process_sharps_cmd(int argc, const int32_t* argv)
+{
+  const int values[2] =
+    { iSharpsMeasureDistMm(SHARP_LEFT), iSharpsMeasureDistMm(SHARP_RIGHT) };
+
+  vInterpreterValues(values, 2);
+}
+INTERPRETER_COMMAND(i, 0, 0, &process_sharps_cmd);
+
+// ir hz: sample rate
+void process_sharps_rate_cmd(int argc, const int32_t* argv)
+{
+  vAdcSetSampleRate(argv[0]);
+  vInterpreterInfo("sharps sample rate set");
+}
+INTERPRETER_COMMAND(ir, 1, 1, &process_sharps_rate_cmd);
+
+static void apply_vrefint(int32_t value)
+{
+  vAdcSetVrefintMv(value);
+}
+
+static void apply_park_delay(int32_t value)
+{
+  vParkSetDelay(value);
+}
+
+// ia [vdda_mv]: analog supply, die temperature in tenths of a degree and
+// Vrefint. With the supply read on a meter, the Vrefint of this part
+// follows ("ps 22" saves it).
+void process_analog_cmd(int argc, const int32_t* argv)
+{
+  if (argc)
+    vAdcSetVrefintMv(iAdcGetVrefintMv() * argv[0] / iAdcGetVddaMv());
+  const int values[3] =
+    { iAdcGetVddaMv(), iAdcGetTemperatureDc(), iAdcGetVrefintMv() };
+  vInterpreterValues(values, 3);
+}
+INTERPRETER_COMMAND(ia, 0, 1, &process_analog_cmd);
+
+// Calibration run: squarely towards a wall forward at
+// SHARPS_CALIBRATION_SPEED, once a sharp sees it by hops of
+// SHARPS_CALIBRATION_HOP_MS, each one followed by a stop of
+// SHARPS_CALIBRATION_SETTLE_MS for the filters of the sharps and the sonar
+// to catch up, then a pair. Until the central sonar reads
+// SHARPS_CALIBRATION_STOP_MM, a bumper closes or SHARPS_CALIBRATION_MS
+// elapse. The reflex is off for the time of it.
+#define SHARPS_CALIBRATION_SPEED     60
+#define SHARPS_CALIBRATION_HOP_MS    100
+#define SHARPS_CALIBRATION_SETTLE_MS 300
+#define SHARPS_CALIBRATION_STOP_MM   20
+#define SHARPS_CALIBRATION_MS        30000
+#define SHARPS_CALIBRATION_STEP_MS   20
+
+// Pairs of the operator distances, kept across the commands
+static sharps_fit_t sharps_fits[SHARPS_NB];
+
+static void run_sharps_calibration(sharps_fit_t* fits)
+{
+  const int hop_steps = SHARPS_CALIBRATION_HOP_MS / SHARPS_CALIBRATION_STEP_MS;
+  const int cycle_steps = hop_steps +
+    SHARPS_CALIBRATION_SETTLE_MS / SHARPS_CALIBRATION_STEP_MS;
+  const int reflex = iReflexIsEnabled();
+  const portTickType start = xTaskGetTickCount();
+  portTickType wake = start;
+  int seen = 0;
+
+  vReflexEnable(0);
+  for (int step = 0;; step = seen ? (step + 1) % cycle_steps : 0)
   {
-    value = atoi(args);
-    vSetMotorLeftCommand(value);
-    vUartPuts("setting LEFT motor speed: ");
-    itoa(value, buffer);
-    vUartPuts(buffer);
-    vUartPuts("%\r\n");
+    const int sonar_mm = iSonarMeasureDistMm(SONAR_CENTER);
+
+    const uint32_t elapsed_ms = (xTaskGetTickCount() - start) * portTICK_RATE_MS;
+
+    if ((sonar_mm != SONAR_BAD_VALUE && sonar_mm <= SHARPS_CALIBRATION_STOP_MM) ||
+        iBumpersIsPressed(BUMPER_LEFT) || iBumpersIsPressed(BUMPER_RIGHT) ||
+        elapsed_ms >= SHARPS_CALIBRATION_MS || iInterpreterCancelled())
+      break;
+    vInterpreterProgress(elapsed_ms, SHARPS_CALIBRATION_MS);
+    seen = seen || iSharpsMeasureCurveMm(SHARP_LEFT) != SHARPS_BAD_VALUE ||
+      iSharpsMeasureCurveMm(SHARP_RIGHT) != SHARPS_BAD_VALUE;
+    // Sent at each step, the deadman timeout holds
+    if (!seen || step < hop_steps)
+      vSetMotorsCommand(SHARPS_CALIBRATION_SPEED, SHARPS_CALIBRATION_SPEED);
+    else
+      vSetMotorsCommand(0, 0);
+    if (step == cycle_steps - 1 && sonar_mm != SONAR_BAD_VALUE)
+      for (int i = 0; i < SHARPS_NB; i++)
+      {
+        const int curve_mm = iSharpsMeasureCurveMm(i);
+        if (curve_mm != SHARPS_BAD_VALUE)
+          vSharpsFitAdd(&fits[i], curve_mm, iSharpsWallMm(sonar_mm));
+      }
+    vTaskDelayUntil(&wake, SHARPS_CALIBRATION_STEP_MS / portTICK_RATE_MS);
   }
-  else if (cmd == 'r')
+  vSetMotorsCommand(0, 0);
+  vReflexEnable(reflex);
+}
+
+// ic [sharp mm]: calibration of the sharps, saved. Without arguments, the
+// calibration run of both; otherwise one pair of a sharp at a distance
+// measured by the operator, fitted with the previous ones (mm 0 drops
+// them). A background job: "jk" stops the run, nothing saved.
+void process_sharps_calibrate_cmd(int argc, const int32_t* argv)
+{
+  static const uint16_t keys[SHARPS_NB][2] =
+    {
+      [SHARP_LEFT]  = { PARAM_SHARP_LEFT_GAIN, PARAM_SHARP_LEFT_OFFSET },
+      [SHARP_RIGHT] = { PARAM_SHARP_RIGHT_GAIN, PARAM_SHARP_RIGHT_OFFSET },
+    };
+  sharps_fit_t run[SHARPS_NB];
+  sharps_fit_t* fits = sharps_fits;
+  int first = 0, last = SHARPS_NB - 1;
+
+  if (argc == 1 || (argc == 2 && (argv[0] < 0 || argv[0] >= SHARPS_NB ||
+                                  argv[1] < 0)))
   {
-    value = atoi(args);
-    vSetMotorRightCommand(value);
-    vUartPuts("setting RIGHT motor speed: ");
-    itoa(value, buffer);
-    vUartPuts(buffer);
-    vUartPuts("%\r\n");
+    vInterpreterFail("usage: ic [sharp mm]");
+    return;
   }
-  else if (cmd == 'b')
+  if (argc == 2)
   {
-    int sep = 1;
-    while (args[sep++] != ':');
-    value = atoi_eol(args, ':');
-    vSetMotorLeftCommand(value);
-    vUartPuts("setting LEFT motor speed: ");
-    itoa(value, buffer);
-    vUartPuts(buffer);
-    vUartPuts("%\r\n");
+    const int curve_mm = iSharpsMeasureCurveMm(argv[0]);
 
-    value = atoi(args + sep);
-    vSetMotorRightCommand(value);
-    vUartPuts("setting RIGHT motor speed: ");
-    itoa(value, buffer);
-    vUartPuts(buffer);
-    vUartPuts("%\r\n");
+    first = last = argv[0];
+    if (!argv[1])
+    {
+      vSharpsFitReset(&fits[first]);
+      vInterpreterInfo("calibration pairs dropped");
+      return;
+    }
+    if (curve_mm == SHARPS_BAD_VALUE)
+    {
+      vInterpreterFail("sharp out of range");
+      return;
+    }
+    vSharpsFitAdd(&fits[first], curve_mm, argv[1]);
   }
   else
   {
-    vUartPuts("error: undefined subcommand '");
-    vUartPutc(cmd);
-    vUartPuts("' for motor command\r\n");
+    fits = run;
+    for (int i = 0; i < SHARPS_NB; i++)
+      vSharpsFitReset(&fits[i]);
+    run_sharps_calibration(fits);
+    if (iInterpreterCancelled())
+    {
+      vInterpreterFail("cancelled");
+      return;
+    }
+  }
+
+  for (int i = first; i <= last; i++)
+  {
+    int gain, offset_mm;
+
+    if (!iSharpsFitSolve(&fits[i], &gain, &offset_mm))
+    {
+      if (argc)
+        vInterpreterInfof("sharp %d: %d pairs", i, (int)fits[i].n);
+      else
+        vInterpreterFail("no calibration");
+      return;
+    }
+    if (!iParamsSet(keys[i][0], gain) || !iParamsSet(keys[i][1], offset_mm))
+    {
+      vInterpreterFail("calibration not saved");
+      return;
+    }
+    if (iInterpreterIsMachine())
+    {
+      const int values[4] = { i, gain, offset_mm, fits[i].n };
+      vInterpreterValues(values, 4);
+    }
+    else
+      vInterpreterInfof("sharp %d: gain %d offset %d mm, %d pairs", i, gain,
+                        offset_mm, (int)fits[i].n);
   }
 }
+INTERPRETER_BACKGROUND_COMMAND(ic, 0, 2, &process_sharps_calibrate_cmd);
+
+// polar: nearest obstacle of each sector of the histogram, ahead first
+// then counterclockwise, -1 when empty
+void process_polar_cmd(int argc, const int32_t* argv)
+{
+  int values[POLAR_SECTORS];
+
+  for (int s = 0; s < POLAR_SECTORS; s++)
+    values[s] = iPolarSectorMm(s);
+  vInterpreterValues(values, POLAR_SECTORS);
+}
+INTERPRETER_COMMAND(polar, 0, 0, &process_polar_cmd);
+
+void process_sensors_cmd(int argc, const int32_t* argv)
+{
+  // Left sharp, central sonar, right sharp
+  const int values[3] =
+    {
+      iSharpsMeasureDistMm(SHARP_LEFT),
+      iSonarMeasureDistMm(SONAR_CENTER),
+      iSharpsMeasureDistMm(SHARP_RIGHT),
+    };
+
+  vInterpreterValues(values, 3);
+}
+INTERPRETER_COMMAND(a, 0, 0, &process_sensors_cmd);
+
+// t [period_ms [timeout_ms [heartbeat_ms]]]: 0 stops, the timeout is how
+// long a frame waits for the link before it is dropped, -1 forever. With
+// a heartbeat, the channels are reported on change ("td").
+void process_telemetry_cmd(int argc, const int32_t* argv)
+{
+  int period = argc ? argv[0] : 0;
+
+  vTelemetrySetTimeout(argc > 1 ? argv[1] : LINK_DROP);
+  vTelemetrySetHeartbeat(argc > 2 ? argv[2] : 0);
+  vTelemetrySetPeriod(period);
+  if (period)
+    vInterpreterInfoValue("telemetry period (ms): ", period);
+  else
+    vInterpreterInfo("telemetry stopped");
+}
+INTERPRETER_COMMAND(t, 0, 3, &process_telemetry_cmd);
+
+// td [channel deadband]: deadband of a channel (eProtoChannel) reported
+// on change. Then the deadbands of all of them.
+void process_telemetry_deadband_cmd(int argc, const int32_t* argv)
+{
+  int values[PROTO_CHANNELS_NB];
+
+  if (argc == 1 ||
+      (argc == 2 && (argv[0] < 0 || argv[0] >= PROTO_CHANNELS_NB)))
+  {
+    vInterpreterFail("usage: td [channel deadband]");
+    return;
+  }
+  if (argc == 2)
+    vTelemetrySetDeadband(argv[0], argv[1]);
+  for (int i = 0; i < PROTO_CHANNELS_NB; i++)
+    values[i] = iTelemetryGetDeadband(i);
+  vInterpreterValues(values, PROTO_CHANNELS_NB);
+}
+INTERPRETER_COMMAND(td, 0, 2, &process_telemetry_deadband_cmd);
+
+// tr: the telemetry rate control, the samples sent one run out of
+// 2^decimation: decimation, effective period (ms), backlog of the stream
+// lane (permille)
+void process_telemetry_rate_cmd(int argc, const int32_t* argv)
+{
+  const int values[3] =
+    {
+      iTelemetryGetDecimation(),
+      iTelemetryGetEffectivePeriod(),
+      iLinkStreamBacklog(),
+    };
+
+  vInterpreterValues(values, 3);
+}
+INTERPRETER_COMMAND(tr, 0, 0, &process_telemetry_rate_cmd);
+
+#ifdef TIMELINE
+static void print_timeline_event(const timeline_event_t* event, void* context)
+{
+  const int values[3] = { event->cycles, event->event, event->arg };
+  vInterpreterValues(values, 3);
+}
+
+// tl: events since the last dump (cycles, event, arg), oldest first,
+// then the number lost to the wrap. The names of the sysmon slots come
+// first, human mode only ("waf trace").
+void process_timeline_cmd(int argc, const int32_t* argv)
+{
+  uint32_t lost;
+
+  if (!iInterpreterIsMachine())
+  {
+    sysmon_load_t* task_loads =
+      pvPoolAlloc((SYSMON_TASKS_MAX + 1) * sizeof (sysmon_load_t));
+
+    if (!task_loads)
+    {
+      vInterpreterFail("no buffer");
+      return;
+    }
+    const int n = iSysmonGetLoads(task_loads, SYSMON_TASKS_MAX + 1);
+    for (int i = 0; i < n; i++)
+      vInterpreterInfof("task %d %s", i, task_loads[i].name);
+    vPoolFree(task_loads);
+  }
+
+  iTimelineDump(&print_timeline_event, NULL, &lost);
+  const int value = lost;
+  vInterpreterValues(&value, 1);
+}
+INTERPRETER_COMMAND(tl, 0, 0, &process_timeline_cmd);
+#endif
+
+// topics: publishes, sample size and subscribers of each topic
+void process_topics_cmd(int argc, const int32_t* argv)
+{
+  for (int i = 0; i < TOPICS_NB; i++)
+  {
+    const topic_t* topic = pxTopicsGet(i);
+    const int values[3] =
+      { uTopicsSeq(i), topic->size, topic->subscribers_nb };
+
+    if (iInterpreterIsMachine())
+      vInterpreterValues(values, 3);
+    else
+      vInterpreterInfof("%-8s %8u %3d %d", topic->name ? topic->name : "-",
+                        (unsigned)values[0], values[1], values[2]);
+  }
+}
+INTERPRETER_COMMAND(topics, 0, 0, &process_topics_cmd);
+
+void process_samples_cmd(int argc, const int32_t* argv)
+{
+  sample_t* samples_dump = pvPoolAlloc(SAMPLES_NB * sizeof (sample_t));
+
+  if (!samples_dump)
+  {
+    vInterpreterFail("no buffer");
+    return;
+  }
+
+  int n = iSamplesReadLast(samples_dump, argv[0]);
+  for (int i = 0; i < n; i++)
+  {
+    const int values[3] =
+      { samples_dump[i].tick, samples_dump[i].sensor, samples_dump[i].value_mm };
+    vInterpreterValues(values, 3);
+  }
+  vPoolFree(samples_dump);
+}
+INTERPRETER_COMMAND(d, 1, 1, &process_samples_cmd);
+
+void process_power_cmd(int argc, const int32_t* argv)
+{
+  // Battery, current, cut off
+  const int values[3] =
+    { iPowerGetBatteryMv(), iPowerGetCurrentMa(), iMotorsIsCutOff() };
+
+  vInterpreterValues(values, 3);
+}
+INTERPRETER_COMMAND(p, 0, 0, &process_power_cmd);
+
+// pl ma: current limit
+void process_power_limit_cmd(int argc, const int32_t* argv)
+{
+  vPowerSetCurrentLimit(argv[0]);
+  vInterpreterInfo("current limit set");
+}
+INTERPRETER_COMMAND(pl, 1, 1, &process_power_limit_cmd);
+
+#ifdef CLEANING
+// cl [brush [fan [boost [carpet_ma]]]]: side brush and suction fan in
+// permille, the fan adaptive from fan up to boost when given. Then the
+// setpoints and duties of both, eco and boost (0 0 manual), the filtered
+// drive current, the carpet threshold, boosted, boosts and time boosted
+void process_cleaning_cmd(int argc, const int32_t* argv)
+{
+  cleaning_state_t state;
+
+  if (argc > 0)
+    vCleaningSet(CLEANING_BRUSH, argv[0]);
+  if (argc > 2)
+    vCleaningSetAdaptive(argv[1], argv[2]);
+  else if (argc > 1)
+    vCleaningSet(CLEANING_FAN, argv[1]);
+  if (argc > 3)
+    vCleaningSetCarpetMa(argv[3]);
+  vCleaningGetState(&state);
+  const int values[11] =
+    { state.setpoint[CLEANING_BRUSH], state.duty[CLEANING_BRUSH],
+      state.setpoint[CLEANING_FAN], state.duty[CLEANING_FAN], state.eco,
+      state.boost, state.current_ma, state.carpet_ma, state.boosted,
+      state.boosts, state.boost_ms };
+  vInterpreterValues(values, 11);
+}
+INTERPRETER_COMMAND(cl, 0, 4, &process_cleaning_cmd);
+
+// cld: dirt seen, the adaptive fan boosts for a while
+void process_cleaning_dirt_cmd(int argc, const int32_t* argv)
+{
+  vCleaningDirt();
+  vInterpreterInfo("boosted");
+}
+INTERPRETER_COMMAND(cld, 0, 0, &process_cleaning_dirt_cmd);
+#endif
+
+static void apply_motor_slew(int32_t value)
+{
+  vMotorsSetSlewRate(value);
+}
+
+static void apply_motor_timeout(int32_t value)
+{
+  vMotorsSetCommandTimeout(value);
+}
+
+static void apply_motor_closed_loop(int32_t value)
+{
+  vMotorsSetClosedLoop(value);
+}
+
+static void apply_motor_pid(int32_t value)
+{
+  vMotorsSetPid(xParamsGet(PARAM_MOTORS_KP), xParamsGet(PARAM_MOTORS_KI),
+                xParamsGet(PARAM_MOTORS_KD));
+}
+
+static void apply_sonar_interval(int32_t value)
+{
+  vSonarSetMinInterval(value);
+}
+
+static void apply_sharps_rate(int32_t value)
+{
+  vAdcSetSampleRate(value);
+}
+
+static void apply_current_limit(int32_t value)
+{
+  vPowerSetCurrentLimit(value);
+}
+
+static void apply_reflex_thresholds(int32_t value)
+{
+  vReflexSetThresholds(xParamsGet(PARAM_REFLEX_STOP),
+                       xParamsGet(PARAM_REFLEX_SLOW));
+}
+
+static void apply_sharps_calibration(int32_t value)
+{
+  vSharpsSetCalibration(SHARP_LEFT, xParamsGet(PARAM_SHARP_LEFT_GAIN),
+                        xParamsGet(PARAM_SHARP_LEFT_OFFSET));
+  vSharpsSetCalibration(SHARP_RIGHT, xParamsGet(PARAM_SHARP_RIGHT_GAIN),
+                        xParamsGet(PARAM_SHARP_RIGHT_OFFSET));
+}
+
+static void apply_wall_gains(int32_t value)
+{
+  vWallSetGains(xParamsGet(PARAM_WALL_KP), xParamsGet(PARAM_WALL_KD));
+}
+
+static void apply_motor_drive(int32_t value)
+{
+  vMotorsSetDrive(value);
+}
+
+static void apply_motor_pwm(int32_t value)
+{
+  vMotorsSetPwmFrequency(value);
+}
+
+static void apply_motor_loop(int32_t value)
+{
+  vMotorsSetLoopRate(value);
+}
+
+static void apply_motor_nominal(int32_t value)
+{
+  vMotorsSetNominalMv(value);
+}
+
+static void apply_motor_cross_coupling(int32_t value)
+{
+  vMotorsSetCrossCoupling(value);
+}
+
+static void apply_motor_slip(int32_t value)
+{
+  vMotorsSetSlipThreshold(value);
+}
+
+static void apply_motor_continuous(int32_t value)
+{
+  vMotorsSetContinuous(value);
+}
+
+static void apply_motor_linear(int32_t value)
+{
+  static const uint16_t keys[ENCODERS_NB] =
+    { PARAM_MOTORS_LINEAR_LEFT, PARAM_MOTORS_LINEAR_RIGHT };
+  motors_linear_t linear;
+
+  for (int i = 0; i < ENCODERS_NB; i++)
+  {
+    linear.deadband = xParamsGet(keys[i]);
+    for (int k = 1; k < MOTORS_LINEAR_NB; k++)
+      linear.points[k - 1] = xParamsGet(keys[i] + k);
+    vMotorsSetLinear(i, &linear);
+  }
+}
+
+// 0 for a board alone on its links: plain frames, the default I2C address
+static void apply_node_address(int32_t value)
+{
+  vProtoSetAddress(value);
+  vI2CSetAddress(value ? value : I2C_DEFAULT_ADDRESS);
+}
+
+// pd: parameters back to their defaults, saved ones erased
+void process_params_default_cmd(int argc, const int32_t* argv)
+{
+  vParamsReset();
+  vInterpreterInfo("parameters reset");
+}
+INTERPRETER_COMMAND(pd, 0, 0, &process_params_default_cmd);
+
+// pg [key]: parameters (key, value, default) with their names, or the
+// value of one
+void process_params_get_cmd(int argc, const int32_t* argv)
+{
+  if (argc)
+  {
+    if (!pxParamsFind(argv[0]))
+    {
+      vInterpreterFail("unknown parameter");
+      return;
+    }
+    const int value = xParamsGet(argv[0]);
+    vInterpreterValues(&value, 1);
+    return;
+  }
+
+  for (int i = 0; i < PARAMS_NB; i++)
+  {
+    const int values[3] =
+      { params[i].key, xParamsGet(params[i].key), params[i].def };
+
+    if (iInterpreterIsMachine())
+      vInterpreterValues(values, 3);
+    else
+      vInterpreterInfof("%2d %-20s %6d (%d)", values[0], params[i].name,
+                        values[1], values[2]);
+  }
+}
+INTERPRETER_COMMAND(pg, 0, 1, &process_params_get_cmd);
+
+// ps key value: set and save a parameter
+void process_params_set_cmd(int argc, const int32_t* argv)
+{
+  if (!iParamsSet(argv[0], argv[1]))
+  {
+    vInterpreterFail("unknown parameter or out of range");
+    return;
+  }
+  vInterpreterInfo("parameter saved");
+}
+INTERPRETER_COMMAND(ps, 2, 2, &process_params_set_cmd);
+
+// pr: reset fault
+void process_power_reset_cmd(int argc, const int32_t* argv)
+{
+  vPowerResetFault();
+  bMotorsEnable = ENABLE;
+  vInterpreterInfo("power fault reset");
+}
+INTERPRETER_COMMAND(pr, 0, 0, &process_power_reset_cmd);
+
+void process_odometry_cmd(int argc, const int32_t* argv)
+{
+  pose_t pose;
+
+  vOdometryGetPose(&pose);
+  const int values[3] = { pose.x_mm, pose.y_mm, pose.theta_mrad };
+  vInterpreterValues(values, 3);
+}
+INTERPRETER_COMMAND(o, 0, 0, &process_odometry_cmd);
+
+void process_odometry_reset_cmd(int argc, const int32_t* argv)
+{
+  vOdometryReset();
+  vInterpreterInfo("pose reset");
+}
+INTERPRETER_COMMAND(or, 0, 0, &process_odometry_reset_cmd);
+
+// os x:y:theta, mm and mrad
+void process_odometry_set_cmd(int argc, const int32_t* argv)
+{
+  const pose_t pose = { argv[0], argv[1], argv[2] };
+
+  vOdometrySetPose(&pose);
+  vInterpreterInfo("pose set");
+}
+INTERPRETER_COMMAND(os, 3, 3, &process_odometry_set_cmd);
+
+void process_reflex_cmd(int argc, const int32_t* argv)
+{
+  const int values[2] = { iReflexGetClosestMm(), iReflexGetLimit() };
+
+  vInterpreterValues(values, 2);
+}
+INTERPRETER_COMMAND(r, 0, 0, &process_reflex_cmd);
+
+// vw v:omega: forward mm/s, counterclockwise mrad/s
+void process_velocity_cmd(int argc, const int32_t* argv)
+{
+  if (argv[0] < INT16_MIN || argv[0] > INT16_MAX ||
+      argv[1] < INT16_MIN || argv[1] > INT16_MAX)
+  {
+    vInterpreterFail("out of range");
+    return;
+  }
+  vSetMotorsVelocity(argv[0], argv[1]);
+  vInterpreterInfof("setting velocity: %d mm/s %d mrad/s", argv[0], argv[1]);
+}
+INTERPRETER_COMMAND(vw, 2, 2, &process_velocity_cmd);
+
+// wf [sharp mm speed]: follow the wall on the side of a sharp, at mm
+// from it, forward at speed. Without arguments, stop.
+void process_wall_cmd(int argc, const int32_t* argv)
+{
+  if (!argc)
+  {
+    vWallStop();
+    vInterpreterInfo("wall following stopped");
+    return;
+  }
+  if (argc != 3 || argv[0] < 0 || argv[0] >= SHARPS_NB || argv[1] <= 0 ||
+      argv[2] <= 0)
+  {
+    vInterpreterFail("usage: wf [sharp mm speed]");
+    return;
+  }
+  vWallFollow(argv[0], argv[1], argv[2]);
+  vInterpreterInfof("following the %s wall at %d mm",
+                    argv[0] == SHARP_LEFT ? "left" : "right", argv[1]);
+}
+INTERPRETER_COMMAND(wf, 0, 3, &process_wall_cmd);
+
+// bh [state]: enter a state of the behaviour table, -1 stops. Without
+// arguments, the current state.
+void process_behaviour_cmd(int argc, const int32_t* argv)
+{
+  if (argc)
+  {
+    if (argv[0] < 0)
+    {
+      vBehaviourStop();
+      vInterpreterInfo("behaviour stopped");
+    }
+    else if (xBehaviourStart(argv[0]))
+      vInterpreterInfof("behaviour at state %d", argv[0]);
+    else
+      vInterpreterFail("usage: bh [state]");
+    return;
+  }
+
+  const int values[3] =
+    { iBehaviourGetState(), uBehaviourGetStateMs(),
+      uBehaviourGetTransitions() };
+  if (iInterpreterIsMachine())
+    vInterpreterValues(values, 3);
+  else if (values[0] < 0)
+    vInterpreterInfof("behaviour stopped, %d transitions", values[2]);
+  else
+    vInterpreterInfof("behaviour at state %d for %d ms, %d transitions",
+                      values[0], values[1], values[2]);
+}
+INTERPRETER_COMMAND(bh, 0, 1, &process_behaviour_cmd);
+
+// bp state: a state of the behaviour table, the action and its
+// arguments, then the predicate, argument and next state of each
+// transition
+void process_behaviour_state_cmd(int argc, const int32_t* argv)
+{
+  behaviour_state_t state;
+  int values[4 + 3 * PROTO_BEHAVIOUR_TRANSITIONS];
+  int n = 4;
+
+  if (argv[0] < 0 || argv[0] >= BEHAVIOUR_STATES_NB)
+  {
+    vInterpreterFail("usage: bp state");
+    return;
+  }
+  vBehaviourGetState(argv[0], &state);
+  values[0] = state.action;
+  for (int i = 0; i < 3; i++)
+    values[1 + i] = state.args[i];
+  for (int i = 0; i < PROTO_BEHAVIOUR_TRANSITIONS &&
+         state.transitions[i].predicate != BEHAVIOUR_NONE; i++)
+  {
+    values[n++] = state.transitions[i].predicate;
+    values[n++] = state.transitions[i].arg;
+    values[n++] = state.transitions[i].next;
+  }
+
+  if (iInterpreterIsMachine())
+  {
+    vInterpreterValues(values, n);
+    return;
+  }
+  vInterpreterInfof("state %d: action %d (%d %d %d)", argv[0], values[0],
+                    values[1], values[2], values[3]);
+  for (int i = 4; i < n; i += 3)
+    vInterpreterInfof("  predicate %d at %d: to %d", values[i],
+                      values[i + 1], values[i + 2]);
+}
+INTERPRETER_COMMAND(bp, 1, 1, &process_behaviour_state_cmd);
+
+// vm [period [budget]]: run the program loaded, every period ms, 0 stops.
+// Without arguments, its state, error, pc, size, peak of instructions,
+// periods and variables.
+void process_vm_cmd(int argc, const int32_t* argv)
+{
+  vm_status_t status;
+  int error;
+
+  if (argc && !argv[0])
+  {
+    vVmStop();
+    vInterpreterInfo("program stopped");
+    return;
+  }
+  if (argc)
+  {
+    error = iVmStart(argv[0], argc > 1 ? argv[1] : VM_DEFAULT_BUDGET);
+    if (error)
+      vInterpreterFail("bad program or budget");
+    else
+      vInterpreterInfof("program running every %d ms", argv[0]);
+    return;
+  }
+
+  vVmGetStatus(&status);
+  int values[6 + VM_VARS_NB] =
+    { status.state, status.error, status.pc, status.size, status.peak,
+      status.periods };
+  for (int i = 0; i < VM_VARS_NB; i++)
+    values[6 + i] = xVmGetVar(i);
+  if (iInterpreterIsMachine())
+  {
+    vInterpreterValues(values, 6 + VM_VARS_NB);
+    return;
+  }
+  vInterpreterInfof("program of %d bytes, state %d, error %d at %d",
+                    status.size, status.state, status.error, status.pc);
+  vInterpreterInfof("%d periods, at most %d instructions", status.periods,
+                    status.peak);
+  vInterpreterInfof("vars %d %d %d %d %d %d %d %d", values[6], values[7],
+                    values[8], values[9], values[10], values[11], values[12],
+                    values[13]);
+}
+INTERPRETER_COMMAND(vm, 0, 2, &process_vm_cmd);
+
+void process_macro_end_cmd(int argc, const int32_t* argv);
+void process_macro_list_cmd(int argc, const int32_t* argv);
+void process_macro_record_cmd(int argc, const int32_t* argv);
+void process_macro_wait_cmd(int argc, const int32_t* argv);
+
+// While recording: the commands of the console lines are kept instead
+// of run, but the ones that drive the recording
+static int record_command(const char* cmd, const command_t* command)
+{
+  if (command->handler == &process_macro_end_cmd ||
+      command->handler == &process_macro_list_cmd ||
+      command->handler == &process_macro_record_cmd ||
+      command->handler == &process_macro_wait_cmd)
+    return 0;
+  if (!xMacrosAppend(cmd))
+    vInterpreterFail("macro full");
+  return 1;
+}
+
+// xr slot: record the next commands into a slot, up to "xe", with the
+// "xw ms" delays between them
+void process_macro_record_cmd(int argc, const int32_t* argv)
+{
+  if (iMacrosRecording() >= 0 || !xMacrosRecord(argv[0]))
+  {
+    vInterpreterFail(iMacrosRecording() >= 0 ? "recording" :
+                     "bad slot or playing");
+    return;
+  }
+  vInterpreterSetHook(&record_command);
+  vInterpreterInfoValue("recording slot ", argv[0]);
+}
+INTERPRETER_COMMAND(xr, 1, 1, &process_macro_record_cmd);
+
+// xw ms: delay before the next recorded command
+void process_macro_wait_cmd(int argc, const int32_t* argv)
+{
+  if (iMacrosRecording() < 0 || argv[0] < 0 || argv[0] > UINT16_MAX)
+    vInterpreterFail(iMacrosRecording() < 0 ? "not recording" :
+                     "out of range");
+  else if (!xMacrosWait(argv[0]))
+    vInterpreterFail("macro full");
+}
+INTERPRETER_COMMAND(xw, 1, 1, &process_macro_wait_cmd);
+
+// xe: end of the recording
+void process_macro_end_cmd(int argc, const int32_t* argv)
+{
+  if (iMacrosRecording() < 0)
+  {
+    vInterpreterFail("not recording");
+    return;
+  }
+  vInterpreterSetHook(NULL);
+  vInterpreterInfoValue("steps recorded: ", iMacrosEnd());
+}
+INTERPRETER_COMMAND(xe, 0, 0, &process_macro_end_cmd);
+
+// xp slot [times]: play a slot once, times over, or until "xs" with 0
+void process_macro_play_cmd(int argc, const int32_t* argv)
+{
+  if (!xMacrosPlay(argv[0], argc > 1 ? argv[1] : 1))
+    vInterpreterFail(iMacrosPlaying() >= 0 ? "playing" :
+                     "bad slot, empty or without a delay");
+  else
+    vInterpreterInfoValue("playing slot ", argv[0]);
+}
+INTERPRETER_COMMAND(xp, 1, 2, &process_macro_play_cmd);
+
+// xs: stop the slot playing
+void process_macro_stop_cmd(int argc, const int32_t* argv)
+{
+  vMacrosStop();
+  vInterpreterInfo("macro stopped");
+}
+INTERPRETER_COMMAND(xs, 0, 0, &process_macro_stop_cmd);
+
+// xl: slot, steps, bytes used and ms of the delays in one run
+void process_macro_list_cmd(int argc, const int32_t* argv)
+{
+  macro_info_t info;
+
+  for (int i = 0; i < MACROS_NB; i++)
+  {
+    vMacrosGetInfo(i, &info);
+    const int values[4] = { i, info.steps, info.size, info.duration_ms };
+
+    if (iInterpreterIsMachine())
+      vInterpreterValues(values, 4);
+    else
+      vInterpreterInfof("%d: %2d steps %3d/%d bytes %6d ms%s", i, info.steps,
+                        info.size, MACROS_SIZE, (int)info.duration_ms,
+                        i == iMacrosPlaying() ? ", playing" :
+                        i == iMacrosRecording() ? ", recording" : "");
+  }
+}
+INTERPRETER_COMMAND(xl, 0, 0, &process_macro_list_cmd);
+
+// re 0/1
+void process_reflex_enable_cmd(int argc, const int32_t* argv)
+{
+  vReflexEnable(argv[0]);
+  vInterpreterInfo("reflex set");
+}
+INTERPRETER_COMMAND(re, 1, 1, &process_reflex_enable_cmd);
+
+// rt stop:slow, mm
+void process_reflex_thresholds_cmd(int argc, const int32_t* argv)
+{
+  vReflexSetThresholds(argv[0], argv[1]);
+  vInterpreterInfo("reflex thresholds set");
+}
+INTERPRETER_COMMAND(rt, 2, 2, &process_reflex_thresholds_cmd);
+
+void process_i2c_cmd(int argc, const int32_t* argv)
+{
+  i2c_stats_t stats;
+
+  vI2CGetStats(&stats);
+  const int values[4] =
+    { stats.bus_errors, stats.arbitrations, stats.overruns, stats.recoveries };
+  vInterpreterValues(values, 4);
+}
+INTERPRETER_COMMAND(b, 0, 0, &process_i2c_cmd);
+
+#ifndef NO_IMU
+// bs speed:duty, clock of the sensors bus (the I2C2 master), duty 2 for
+// 2, 16 for 16/9
+void process_i2c_clock_cmd(int argc, const int32_t* argv)
+{
+  vI2CMasterSetClock(argv[0],
+                     argv[1] == 16 ? I2C_DutyCycle_16_9 : I2C_DutyCycle_2);
+  vInterpreterInfo("i2c clock set");
+}
+INTERPRETER_COMMAND(bs, 2, 2, &process_i2c_clock_cmd);
+#endif
+
+#ifdef ITM_TRACE
+// itm: ports enabled by the probe, then words dropped on each port
+void process_itm_cmd(int argc, const int32_t* argv)
+{
+  int values[1 + ITM_PORTS_NB] = { uItmEnabledPorts() };
+
+  for (int i = 0; i < ITM_PORTS_NB; i++)
+    values[1 + i] = uItmDropped(i);
+  vInterpreterValues(values, 1 + ITM_PORTS_NB);
+}
+INTERPRETER_COMMAND(itm, 0, 0, &process_itm_cmd);
+
+// pcs N: DWT PC sampling every N x 1024 cycles (1 to 16), 0 stops
+void process_pc_sampling_cmd(int argc, const int32_t* argv)
+{
+  if (argv[0] < 0 || argv[0] > ITM_PC_PERIOD_MAX)
+  {
+    vInterpreterFail("period from 0 to 16");
+    return;
+  }
+  vItmPcSampling(argv[0]);
+  if (argv[0])
+    vInterpreterInfof("PC sampling every %d cycles", (int)argv[0] * 1024);
+  else
+    vInterpreterInfo("PC sampling stopped");
+}
+INTERPRETER_COMMAND(pcs, 1, 1, &process_pc_sampling_cmd);
+#endif
+
+#ifdef CAN_BUS
+// can: received, overruns, TX dropped, TX and RX error counters, bus-off
+void process_can_cmd(int argc, const int32_t* argv)
+{
+  can_stats_t stats;
+
+  vCanGetStats(&stats);
+  const int values[6] =
+    { stats.received, stats.overruns, stats.tx_dropped, stats.tx_errors,
+      stats.rx_errors, stats.bus_off };
+  vInterpreterValues(values, 6);
+}
+INTERPRETER_COMMAND(can, 0, 0, &process_can_cmd);
+#endif
+
+#ifdef SPI_LINK
+// spi: frames, errors, resyncs
+void process_spi_cmd(int argc, const int32_t* argv)
+{
+  spi_stats_t stats;
+
+  vSpiGetStats(&stats);
+  const int values[3] = { stats.frames, stats.errors, stats.resyncs };
+  vInterpreterValues(values, 3);
+}
+INTERPRETER_COMMAND(spi, 0, 0, &process_spi_cmd);
+#endif
+
+#ifdef SDCARD
+// sd [1]: card state (0 mounting, 1 logging, 2 unformatted, 3 full, 4
+// failed, 5 service), high capacity, session, blocks, next log block,
+// blocks written this session, errors. With 1, formats it: the log restarts empty.
+void process_sdcard_cmd(int argc, const int32_t* argv)
+{
+  sdcard_stats_t stats;
+
+  if (argc && argv[0] == 1 && !xSdFormat())
+  {
+    vInterpreterFail("no card");
+    return;
+  }
+  vSdGetStats(&stats);
+  const int values[7] =
+    { stats.state, stats.high_capacity, stats.session, stats.blocks,
+      stats.next, stats.written, stats.errors };
+  vInterpreterValues(values, 7);
+}
+INTERPRETER_COMMAND(sd, 0, 1, &process_sdcard_cmd);
+#endif
+
+#ifdef USB_MSC
+// msc [0|1]: service mode on, command blocks, failed, blocks read. With
+// 1 the board shows as a read-only USB disk of the log, 0 back.
+void process_msc_cmd(int argc, const int32_t* argv)
+{
+  usbmsc_stats_t stats;
+
+  if (argc && !xUsbMscService(argv[0] != 0))
+  {
+    vInterpreterFail("no disk");
+    return;
+  }
+  vUsbMscGetStats(&stats);
+  const int values[4] =
+    { iUsbMscIsOn(), stats.commands, stats.failed, stats.blocks };
+  vInterpreterValues(values, 4);
+}
+INTERPRETER_COMMAND(msc, 0, 1, &process_msc_cmd);
+#endif
+
+#ifdef BENCH
+// bench [samples]: cycles per call, min mean max, the budget and the
+// status (eBenchStatus) of each. Fails on any result not passed.
+void process_bench_cmd(int argc, const int32_t* argv)
+{
+  const int samples = argc ? argv[0] : 1000;
+  bench_result_t* bench_results;
+  int n, failures;
+
+  if (samples <= 0)
+  {
+    vInterpreterFail("bad samples number");
+    return;
+  }
+  bench_results = pvPoolAlloc(BENCH_NB * sizeof (bench_result_t));
+  if (!bench_results)
+  {
+    vInterpreterFail("no buffer");
+    return;
+  }
+
+  n = iBenchRun(bench_results, samples);
+  for (int i = 0; i < n; i++)
+  {
+    static const char* const statuses[] = { "ok", "WRONG", "SLOW" };
+    const int values[5] =
+      { bench_results[i].min, bench_results[i].mean, bench_results[i].max,
+        bench_results[i].budget, bench_results[i].status };
+
+    if (iInterpreterIsMachine())
+      vInterpreterValues(values, 5);
+    else
+      vInterpreterInfof("%-8s %6u %6u %6u /%6u %s", bench_results[i].name,
+                        values[0], values[1], values[2], values[3],
+                        statuses[values[4]]);
+  }
+  failures = iBenchFailures(bench_results, n);
+  vPoolFree(bench_results);
+  if (failures)
+    vInterpreterFail("bench failed");
+}
+INTERPRETER_COMMAND(bench, 0, 1, &process_bench_cmd);
+#endif
+
+#ifdef LATENCY
+// lat [load [samples]]: the interrupt entry and the task wake up after a
+// loopback edge, under a load (eLatencyLoad). Cycles min mean max of
+// each, then the log2 histogram (bin, entries, wake ups) and the count
+// of samples and of missed edges.
+void process_latency_cmd(int argc, const int32_t* argv)
+{
+  const int load = argc ? argv[0] : LATENCY_IDLE;
+  const int samples = argc > 1 ? argv[1] : 1000;
+  latency_result_t* latency;
+
+  if (samples <= 0)
+  {
+    vInterpreterFail("bad samples number");
+    return;
+  }
+  latency = pvPoolAlloc(sizeof (latency_result_t));
+  if (!latency)
+  {
+    vInterpreterFail("no buffer");
+    return;
+  }
+  if (!xLatencyRun(load, samples, latency))
+  {
+    vPoolFree(latency);
+    vInterpreterFail("no such load");
+    return;
+  }
+
+  const latency_stats_t* const stats[2] = { &latency->isr, &latency->wake };
+  for (int i = 0; i < 2; i++)
+  {
+    const int values[3] = { stats[i]->min, stats[i]->mean, stats[i]->max };
+
+    if (iInterpreterIsMachine())
+      vInterpreterValues(values, 3);
+    else
+      vInterpreterInfof("%-5s %6d %6d %6d", i ? "wake" : "isr", values[0],
+                        values[1], values[2]);
+  }
+  for (int i = 0; i < LATENCY_BINS; i++)
+  {
+    const int values[3] =
+      { 1 << i, latency->isr.bins[i], latency->wake.bins[i] };
+
+    if (iInterpreterIsMachine())
+      vInterpreterValues(values, 3);
+    else if (values[1] || values[2])
+      vInterpreterInfof("%6d+ %5d %5d", values[0], values[1], values[2]);
+  }
+  const int counts[2] = { latency->samples, latency->missed };
+  if (iInterpreterIsMachine())
+    vInterpreterValues(counts, 2);
+  else
+    vInterpreterInfof("%s: %d samples, %d missed", pcLatencyLoadName(load),
+                      counts[0], counts[1]);
+  vPoolFree(latency);
+}
+INTERPRETER_COMMAND(lat, 0, 2, &process_latency_cmd);
+#endif
+
+#ifdef ACTUATION_TRACE
+// at [0]: the motor commands from their first byte on USART1, us min mean
+// max of each stage (eActuationStage), then the log2 histogram (bin,
+// then the count of each stage) and the count of commands followed and
+// of incomplete ones. 0 starts over.
+void process_actuation_cmd(int argc, const int32_t* argv)
+{
+  static const char* const stages[ACTUATION_STAGES_NB] =
+    { "frame", "loop", "pwm", "shell" };
+  actuation_result_t* actuation;
+
+  if (argc)
+  {
+    if (argv[0])
+    {
+      vInterpreterFail("0 only");
+      return;
+    }
+    vActuationReset();
+    vInterpreterInfo("actuation reset");
+    return;
+  }
+  actuation = pvPoolAlloc(sizeof (actuation_result_t));
+  if (!actuation)
+  {
+    vInterpreterFail("no buffer");
+    return;
+  }
+  vActuationGet(actuation);
+
+  for (int i = 0; i < ACTUATION_STAGES_NB; i++)
+  {
+    const actuation_stats_t* stats = &actuation->stages[i];
+    const int values[3] = { stats->min_us, stats->mean_us, stats->max_us };
+
+    if (iInterpreterIsMachine())
+      vInterpreterValues(values, 3);
+    else
+      vInterpreterInfof("%-5s %6d %6d %6d", stages[i], values[0], values[1],
+                        values[2]);
+  }
+  for (int i = 0; i < ACTUATION_BINS; i++)
+  {
+    int values[1 + ACTUATION_STAGES_NB] = { 1 << i };
+    int any = 0;
+
+    for (int j = 0; j < ACTUATION_STAGES_NB; j++)
+    {
+      values[1 + j] = actuation->stages[j].bins[i];
+      any |= values[1 + j];
+    }
+    if (iInterpreterIsMachine())
+      vInterpreterValues(values, 1 + ACTUATION_STAGES_NB);
+    else if (any)
+      vInterpreterInfof("%5d+ %5d %5d %5d %5d", values[0], values[1],
+                        values[2], values[3], values[4]);
+  }
+  const int counts[2] = { actuation->samples, actuation->incomplete };
+  if (iInterpreterIsMachine())
+    vInterpreterValues(counts, 2);
+  else
+    vInterpreterInfof("%d commands, %d incomplete", counts[0], counts[1]);
+  vPoolFree(actuation);
+}
+INTERPRETER_COMMAND(at, 0, 1, &process_actuation_cmd);
+#endif
+
+#ifdef PROFILE
+// f: count, then cycles min mean max of each probe
+void process_profile_cmd(int argc, const int32_t* argv)
+{
+  profile_probe_t* profile_dump =
+    pvPoolAlloc(PROFILE_NB * sizeof (profile_probe_t));
+
+  if (!profile_dump)
+  {
+    vInterpreterFail("no buffer");
+    return;
+  }
+  vProfileGet(profile_dump);
+  for (int i = 0; i < PROFILE_NB; i++)
+  {
+    const profile_probe_t* probe = &profile_dump[i];
+    const int values[4] = { probe->count, probe->min, probe->mean, probe->max };
+
+    if (iInterpreterIsMachine())
+      vInterpreterValues(values, 4);
+    else
+      vInterpreterInfof("%-8s %8u %6u %6u %6u", probe->name, values[0],
+                        values[1], values[2], values[3]);
+  }
+  vPoolFree(profile_dump);
+}
+INTERPRETER_COMMAND(f, 0, 0, &process_profile_cmd);
+
+void process_profile_reset_cmd(int argc, const int32_t* argv)
+{
+  vProfileReset();
+  vMotorsResetJitter();
+  vInterpreterInfo("profile reset");
+}
+INTERPRETER_COMMAND(fr, 0, 0, &process_profile_reset_cmd);
+
+// mj: count, then min mean max of the motors loop period, in us, and the
+// period it runs at (human mode)
+void process_motor_jitter_cmd(int argc, const int32_t* argv)
+{
+  motors_jitter_t jitter;
+
+  vMotorsGetJitter(&jitter);
+  const int values[4] =
+    { jitter.count, jitter.min_us, jitter.mean_us, jitter.max_us };
+
+  if (iInterpreterIsMachine())
+    vInterpreterValues(values, 4);
+  else
+  {
+    vInterpreterInfof("%-8s %8u %6u %6u %6u", "period", values[0],
+                      values[1], values[2], values[3]);
+    vInterpreterInfof("%-8s %8d", "target", iMotorsGetLoopPeriodUs());
+  }
+}
+INTERPRETER_COMMAND(mj, 0, 0, &process_motor_jitter_cmd);
+#endif
+
+#ifdef I2C_TRACE
+void process_i2c_trace_cmd(int argc, const int32_t* argv)
+{
+  i2c_trace_t* trace = pvPoolAlloc(I2C_TRACE_NB * sizeof (i2c_trace_t));
+
+  if (!trace)
+  {
+    vInterpreterFail("no buffer");
+    return;
+  }
+
+  int n = iI2CGetTrace(trace, I2C_TRACE_NB);
+  for (int i = 0; i < n; i++)
+  {
+    const int values[4] =
+      { trace[i].tick, trace[i].event, trace[i].sr1, trace[i].pointer };
+    vInterpreterValues(values, 4);
+  }
+  vPoolFree(trace);
+}
+INTERPRETER_COMMAND(bt, 0, 0, &process_i2c_trace_cmd);
+#endif
+
+// ms: start/stop
+void process_motor_start_cmd(int argc, const int32_t* argv)
+{
+  if (bMotorsEnable)
+  {
+    vMotorsDisable();
+    vInterpreterInfo("stop motors");
+    bMotorsEnable = DISABLE;
+  }
+  else
+  {
+    vMotorsEnable();
+    vInterpreterInfo("start motors");
+    bMotorsEnable = ENABLE;
+  }
+}
+INTERPRETER_COMMAND(ms, 0, 0, &process_motor_start_cmd);
+
+void process_motor_left_cmd(int argc, const int32_t* argv)
+{
+  vSetMotorLeftCommand(argv[0]);
+  vInterpreterInfoValue("setting LEFT motor speed: ", argv[0]);
+}
+INTERPRETER_COMMAND(ml, 1, 1, &process_motor_left_cmd);
+
+void process_motor_right_cmd(int argc, const int32_t* argv)
+{
+  vSetMotorRightCommand(argv[0]);
+  vInterpreterInfoValue("setting RIGHT motor speed: ", argv[0]);
+}
+INTERPRETER_COMMAND(mr, 1, 1, &process_motor_right_cmd);
+
+// mb left:right
+void process_motor_both_cmd(int argc, const int32_t* argv)
+{
+  vSetMotorsCommand(argv[0], argv[1]);
+  vInterpreterInfof("setting motor speeds: LEFT %d RIGHT %d", argv[0],
+                    argv[1]);
+}
+INTERPRETER_COMMAND(mb, 2, 2, &process_motor_both_cmd);
+
+// ma: max command change per period
+void process_motor_slew_cmd(int argc, const int32_t* argv)
+{
+  vMotorsSetSlewRate(argv[0]);
+  vInterpreterInfoValue("setting slew rate: ", argv[0]);
+}
+INTERPRETER_COMMAND(ma, 1, 1, &process_motor_slew_cmd);
+
+// md ms: deadman timeout
+void process_motor_timeout_cmd(int argc, const int32_t* argv)
+{
+  vMotorsSetCommandTimeout(argv[0]);
+  vInterpreterInfoValue("setting command timeout (ms): ", argv[0]);
+}
+INTERPRETER_COMMAND(md, 1, 1, &process_motor_timeout_cmd);
+
+// mq duration:left:right
+void process_motor_segment_cmd(int argc, const int32_t* argv)
+{
+  const motors_segment_t segment =
+    {
+      .duration_ms = argv[0],
+      .left        = argv[1],
+      .right       = argv[2],
+    };
+
+  if (iMotorsQueueSegments(&segment, 1))
+    vInterpreterInfo("segment queued");
+  else
+    vInterpreterFail("segment queue full");
+}
+INTERPRETER_COMMAND(mq, 3, 3, &process_motor_segment_cmd);
+
+void process_motor_clear_cmd(int argc, const int32_t* argv)
+{
+  vMotorsClearSegments();
+#ifdef SYSID
+  vMotorsSysidStop();
+#endif
+#ifdef AUTOTUNE
+  vMotorsTuneStop();
+  vMotorsSweepStop();
+#endif
+  vInterpreterInfo("segments cleared");
+}
+INTERPRETER_COMMAND(mx, 0, 0, &process_motor_clear_cmd);
+
+#ifdef SYSID
+// sysid kind amplitude periods [arg]: run an excitation (eMotorsSysid),
+// "mx" stops it. sysid: index, command, pwm, speeds left and right and
+// current of each period of the last run, as a background job.
+void process_sysid_cmd(int argc, const int32_t* argv)
+{
+  motors_sysid_sample_t batch[8];
+  int first = 0, n;
+
+  if (argc)
+  {
+    if (argc < 3)
+      vInterpreterFail("kind amplitude periods [arg]");
+    else if (!xMotorsSysidStart(argv[0], argv[1], argv[2],
+                                argc > 3 ? argv[3] : 0))
+      vInterpreterFail(iMotorsSysidIsRunning() ? "running" : "bad arguments");
+    else
+      vInterpreterInfo("sysid started");
+    return;
+  }
+
+  if (iMotorsSysidIsRunning())
+  {
+    vInterpreterFail("running");
+    return;
+  }
+  while (!iInterpreterCancelled() &&
+         (n = iMotorsSysidRead(batch, first, 8)) > 0)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      const int values[6] =
+        { first + i, batch[i].command, batch[i].pwm_left,
+          batch[i].speed_left, batch[i].speed_right, batch[i].current_ma };
+      vInterpreterValues(values, 6);
+    }
+    first += n;
+    vInterpreterProgress(first, 0);
+  }
+}
+INTERPRETER_BACKGROUND_COMMAND(sysid, 0, 4, &process_sysid_cmd);
+#endif
+
+#ifdef AUTOTUNE
+#define MOTORS_TUNE_POLL_MS 50
+
+// mt rule [bias [relay]]: relay feedback run of both wheels, the robot
+// driving forward for a few seconds, then the PID gains of the rule
+// (eMotorsTuneRule) from the mean Ku and Tu of the wheels, saved. Ku and
+// Tu in us of each wheel follow, then the gains. A background job: "jk",
+// "mx" or a bumper stops the run, nothing saved.
+void process_motor_tune_cmd(int argc, const int32_t* argv)
+{
+  static const uint16_t keys[3] =
+    { PARAM_MOTORS_KP, PARAM_MOTORS_KI, PARAM_MOTORS_KD };
+  motors_tune_wheel_t wheels[ENCODERS_NB];
+  const int bias = argc > 1 ? argv[1] : MOTORS_TUNE_DEFAULT_BIAS;
+  const int relay = argc > 2 ? argv[2] : MOTORS_TUNE_DEFAULT_RELAY;
+  int32_t ku = 0, gains[3];
+  uint32_t tu_us = 0;
+  int16_t kp, ki, kd;
+
+  if (argv[0] < 0 || argv[0] >= MOTORS_TUNE_RULES_NB)
+  {
+    vInterpreterFail("no such rule");
+    return;
+  }
+  if (!xMotorsTuneStart(bias, relay))
+  {
+    vInterpreterFail(iMotorsTuneIsRunning() ? "running" : "bad arguments");
+    return;
+  }
+  for (int elapsed_ms = 0; iMotorsTuneIsRunning();
+       elapsed_ms += MOTORS_TUNE_POLL_MS)
+  {
+    if (iInterpreterCancelled() ||
+        iBumpersIsPressed(BUMPER_LEFT) || iBumpersIsPressed(BUMPER_RIGHT))
+      vMotorsTuneStop();
+    vInterpreterProgress(elapsed_ms, MOTORS_TUNE_MAX_MS);
+    vTaskDelay(MS_TO_TICKS(MOTORS_TUNE_POLL_MS));
+  }
+  if (iInterpreterCancelled())
+  {
+    vInterpreterFail("cancelled");
+    return;
+  }
+  if (!iMotorsTuneResult(wheels))
+  {
+    vInterpreterFail("no limit cycle");
+    return;
+  }
+
+  for (int i = 0; i < ENCODERS_NB; i++)
+  {
+    ku += wheels[i].ku / ENCODERS_NB;
+    tu_us += wheels[i].tu_us / ENCODERS_NB;
+  }
+  if (!iMotorsTuneGains(argv[0], ku, tu_us, &kp, &ki, &kd))
+  {
+    vInterpreterFail("gains out of range");
+    return;
+  }
+  gains[0] = kp;
+  gains[1] = ki;
+  gains[2] = kd;
+  if (!iParamsSetBatch(keys, gains, 3))
+  {
+    vInterpreterFail("gains not saved");
+    return;
+  }
+  if (iInterpreterIsMachine())
+  {
+    const int values[7] =
+      { wheels[ENCODER_LEFT].ku, wheels[ENCODER_LEFT].tu_us,
+        wheels[ENCODER_RIGHT].ku, wheels[ENCODER_RIGHT].tu_us, kp, ki, kd };
+    vInterpreterValues(values, 7);
+  }
+  else
+    vInterpreterInfof("ku %d:%d tu %u:%u us, kp %d ki %d kd %d",
+                      (int)wheels[ENCODER_LEFT].ku,
+                      (int)wheels[ENCODER_RIGHT].ku,
+                      (unsigned)wheels[ENCODER_LEFT].tu_us,
+                      (unsigned)wheels[ENCODER_RIGHT].tu_us, kp, ki, kd);
+}
+INTERPRETER_BACKGROUND_COMMAND(mt, 1, 3, &process_motor_tune_cmd);
+
+// mls: linearization sweep of both motors up to full speed, the robot on
+// a stand, then the deadbands and the points of each motor, saved. A
+// background job: "jk", "mx" or a bumper stops the run, nothing saved.
+void process_motor_sweep_cmd(int argc, const int32_t* argv)
+{
+  static const uint16_t keys[ENCODERS_NB * MOTORS_LINEAR_NB] =
+    { PARAM_MOTORS_LINEAR_LEFT, PARAM_MOTORS_LINEAR_LEFT + 1,
+      PARAM_MOTORS_LINEAR_LEFT + 2, PARAM_MOTORS_LINEAR_LEFT + 3,
+      PARAM_MOTORS_LINEAR_RIGHT, PARAM_MOTORS_LINEAR_RIGHT + 1,
+      PARAM_MOTORS_LINEAR_RIGHT + 2, PARAM_MOTORS_LINEAR_RIGHT + 3 };
+  motors_linear_t linear[ENCODERS_NB];
+  int32_t values[ENCODERS_NB * MOTORS_LINEAR_NB];
+
+  if (!xMotorsSweepStart())
+  {
+    vInterpreterFail("running");
+    return;
+  }
+  for (int elapsed_ms = 0; iMotorsSweepIsRunning();
+       elapsed_ms += MOTORS_TUNE_POLL_MS)
+  {
+    if (iInterpreterCancelled() ||
+        iBumpersIsPressed(BUMPER_LEFT) || iBumpersIsPressed(BUMPER_RIGHT))
+      vMotorsSweepStop();
+    vInterpreterProgress(elapsed_ms, MOTORS_SWEEP_MS);
+    vTaskDelay(MS_TO_TICKS(MOTORS_TUNE_POLL_MS));
+  }
+  if (iInterpreterCancelled())
+  {
+    vInterpreterFail("cancelled");
+    return;
+  }
+  if (!iMotorsSweepResult(linear))
+  {
+    vInterpreterFail("no top speed");
+    return;
+  }
+
+  for (int i = 0; i < ENCODERS_NB; i++)
+  {
+    values[i * MOTORS_LINEAR_NB] = linear[i].deadband;
+    for (int k = 1; k < MOTORS_LINEAR_NB; k++)
+      values[i * MOTORS_LINEAR_NB + k] = linear[i].points[k - 1];
+  }
+  if (!iParamsSetBatch(keys, values, ENCODERS_NB * MOTORS_LINEAR_NB))
+  {
+    vInterpreterFail("table not saved");
+    return;
+  }
+  if (iInterpreterIsMachine())
+  {
+    int out[ENCODERS_NB * MOTORS_LINEAR_NB];
+
+    for (int i = 0; i < ENCODERS_NB * MOTORS_LINEAR_NB; i++)
+      out[i] = values[i];
+    vInterpreterValues(out, ENCODERS_NB * MOTORS_LINEAR_NB);
+  }
+  else
+    vInterpreterInfof("deadband %d:%d, points %d %d %d:%d %d %d",
+                      (int)values[0], (int)values[4], (int)values[1],
+                      (int)values[2], (int)values[3], (int)values[5],
+                      (int)values[6], (int)values[7]);
+}
+INTERPRETER_BACKGROUND_COMMAND(mls, 0, 0, &process_motor_sweep_cmd);
+#endif
+
+// mc 0/1: closed loop
+void process_motor_closed_loop_cmd(int argc, const int32_t* argv)
+{
+  vMotorsSetClosedLoop(argv[0]);
+  vInterpreterInfo(argv[0] ? "closed loop" : "open loop");
+}
+INTERPRETER_COMMAND(mc, 1, 1, &process_motor_closed_loop_cmd);
+
+// mp kp:ki:kd, in 1/256
+void process_motor_pid_cmd(int argc, const int32_t* argv)
+{
+  vMotorsSetPid(argv[0], argv[1], argv[2]);
+  vInterpreterInfo("setting PID gains");
+}
+INTERPRETER_COMMAND(mp, 3, 3, &process_motor_pid_cmd);
+
+// mn [mv]: nominal voltage of the supply feedforward, 0 off. Then the
+// nominal and battery voltages, and the gain applied in permille.
+void process_motor_nominal_cmd(int argc, const int32_t* argv)
+{
+  if (argc)
+    vMotorsSetNominalMv(argv[0]);
+  const int values[3] =
+    { iMotorsGetNominalMv(), iPowerGetBatteryMv(), iMotorsGetSupplyGain() };
+  vInterpreterValues(values, 3);
+}
+INTERPRETER_COMMAND(mn, 0, 1, &process_motor_nominal_cmd);
+
+// mk [kc]: cross coupling gain in 1/256, 0 off. Then the gain and the
+// error of the wheels, in counts, left ahead positive.
+void process_motor_cross_coupling_cmd(int argc, const int32_t* argv)
+{
+  if (argc)
+    vMotorsSetCrossCoupling(argv[0]);
+  const int values[2] = { iMotorsGetCrossCoupling(), iMotorsGetSyncError() };
+  vInterpreterValues(values, 2);
+}
+INTERPRETER_COMMAND(mk, 0, 1, &process_motor_cross_coupling_cmd);
+
+// mw [mrad/s]: slip threshold against the gyro, 0 no traction control.
+// Then the threshold, the slipping wheels (1 left, 2 right) and the slips
+// of each since the boot.
+void process_motor_slip_cmd(int argc, const int32_t* argv)
+{
+  motors_state_t state;
+
+  if (argc)
+    vMotorsSetSlipThreshold(argv[0]);
+  vMotorsGetState(&state);
+  const int values[4] =
+    { iMotorsGetSlipThreshold(), state.slipping,
+      uMotorsGetSlips(ENCODER_LEFT), uMotorsGetSlips(ENCODER_RIGHT) };
+  vInterpreterValues(values, 4);
+}
+INTERPRETER_COMMAND(mw, 0, 1, &process_motor_slip_cmd);
+
+// mh [command]: continuous limit of the thermal model, MOTORS_COMMAND_MAX
+// off. Then the limit and the heats of the left and right motors and of
+// the bridge, in percent of the continuous heat.
+void process_motor_thermal_cmd(int argc, const int32_t* argv)
+{
+  int values[4];
+
+  if (argc)
+    vMotorsSetContinuous(argv[0]);
+  values[0] = iMotorsGetContinuous();
+  vMotorsGetThermal(&values[1]);
+  vInterpreterValues(values, 4);
+}
+INTERPRETER_COMMAND(mh, 0, 1, &process_motor_thermal_cmd);
+
+// mv: measured speeds
+void process_motor_speeds_cmd(int argc, const int32_t* argv)
+{
+  motors_state_t state;
+
+  vMotorsGetState(&state);
+  const int values[2] = { state.speed_left, state.speed_right };
+  vInterpreterValues(values, 2);
+}
+INTERPRETER_COMMAND(mv, 0, 0, &process_motor_speeds_cmd);
+
+#ifdef BEMF
+// mbe [source [gain]]: speed source (0 encoders, 1 back-EMF), gain, then
+// windows, codes off the zero, speeds and zeros left and right, stalled
+// wheels
+void process_motor_bemf_cmd(int argc, const int32_t* argv)
+{
+  motors_bemf_t bemf;
+
+  if (argc > 0)
+    vMotorsSetSpeedSource(argv[0]);
+  if (argc > 1)
+    vMotorsSetBemfGain(argv[1]);
+  vMotorsGetBemf(&bemf);
+  const int values[10] =
+    { iMotorsGetSpeedSource(), iMotorsGetBemfGain(), bemf.windows,
+      bemf.code_left, bemf.code_right, bemf.speed_left, bemf.speed_right,
+      bemf.zero_left, bemf.zero_right, bemf.stalled };
+  vInterpreterValues(values, 10);
+}
+INTERPRETER_COMMAND(mbe, 0, 2, &process_motor_bemf_cmd);
+#endif
+
+void process_motor_frame(const uint8_t* payload, uint8_t size)
+{
+  proto_motors_t cmd;
+  uint8_t type = PROTO_MOTORS_CMD;
+
+  if (size != sizeof (cmd))
+  {
+    vProtoSend(PROTO_NACK, &type, 1);
+    return;
+  }
+
+  memcpy(&cmd, payload, sizeof (cmd));
+  vSetMotorsCommand(cmd.left, cmd.right);
+  vProtoSend(PROTO_ACK, &type, 1);
+  ACTUATION_STAMP(ACTUATION_SHELL, ACTUATION_SETPOINT(cmd.left, cmd.right));
+}
+
+void process_velocity_frame(const uint8_t* payload, uint8_t size)
+{
+  proto_velocity_t cmd;
+  uint8_t type = PROTO_VELOCITY;
+
+  if (size != sizeof (cmd))
+  {
+    vProtoSend(PROTO_NACK, &type, 1);
+    return;
+  }
+
+  memcpy(&cmd, payload, sizeof (cmd));
+  vSetMotorsVelocity(cmd.v_mm_s, cmd.omega_mrad_s);
+  vProtoSend(PROTO_ACK, &type, 1);
+}
+
+void process_sensors_frame(const uint8_t* payload, uint8_t size)
+{
+  proto_sensors_t report =
+    {
+      .sharp_left_mm  = iSharpsMeasureDistMm(SHARP_LEFT),
+      .sonar_mm       = iSonarMeasureDistMm(SONAR_CENTER),
+      .sharp_right_mm = iSharpsMeasureDistMm(SHARP_RIGHT),
+    };
+  vProtoSend(PROTO_SENSORS, &report, sizeof (report));
+}
+
+void process_polar_frame(const uint8_t* payload, uint8_t size)
+{
+  proto_polar_t report;
+
+  vPolarGetFrame(&report);
+  vProtoSend(PROTO_POLAR, &report, sizeof (report));
+}
+
+void process_telemetry_frame(const uint8_t* payload, uint8_t size)
+{
+  proto_telem_cfg_t cfg;
+  uint8_t type = PROTO_TELEM_CFG;
+
+  if (size != sizeof (cfg))
+  {
+    vProtoSend(PROTO_NACK, &type, 1);
+    return;
+  }
+
+  memcpy(&cfg, payload, sizeof (cfg));
+  // Whole PROTO_TELEMETRY frames
+  vTelemetrySetHeartbeat(0);
+  vTelemetrySetPeriod(cfg.period_ms);
+  vProtoSend(PROTO_ACK, &type, 1);
+}
+
+void process_telemetry_delta_frame(const uint8_t* payload, uint8_t size)
+{
+  proto_telem_delta_cfg_t cfg;
+  uint8_t type = PROTO_TELEM_DELTA_CFG;
+  const int n = (size - (int)sizeof (cfg)) / (int)sizeof (uint16_t);
+
+  if (size < sizeof (cfg) || (size - sizeof (cfg)) % sizeof (uint16_t) ||
+      n > PROTO_CHANNELS_NB)
+  {
+    vProtoSend(PROTO_NACK, &type, 1);
+    return;
+  }
+
+  memcpy(&cfg, payload, sizeof (cfg));
+  for (int i = 0; i < n; i++)
+  {
+    uint16_t deadband;
+
+    memcpy(&deadband, payload + sizeof (cfg) + i * sizeof (deadband),
+           sizeof (deadband));
+    vTelemetrySetDeadband(i, deadband);
+  }
+  vTelemetrySetHeartbeat(cfg.heartbeat_ms);
+  vTelemetrySetPeriod(cfg.period_ms);
+  vProtoSend(PROTO_ACK, &type, 1);
+}
+
+void process_samples_frame(const uint8_t* payload, uint8_t size)
+{
+  const int per_frame = PROTO_MAX_PAYLOAD / sizeof (sample_t);
+  uint8_t type = PROTO_SAMPLES_REQ;
+  int n, sent;
+
+  if (size != 1)
+  {
+    vProtoSend(PROTO_NACK, &type, 1);
+    return;
+  }
+
+  sample_t* samples_dump = pvPoolAlloc(SAMPLES_NB * sizeof (sample_t));
+  if (!samples_dump)
+  {
+    vProtoSend(PROTO_NACK, &type, 1);
+    return;
+  }
+
+  // Batch as many samples per frame as possible, an empty frame ends it
+  n = iSamplesReadLast(samples_dump, payload[0]);
+  for (sent = 0; sent < n; sent += per_frame)
+    vProtoSend(PROTO_SAMPLES, &samples_dump[sent],
+               ((n - sent < per_frame) ? n - sent : per_frame) * sizeof (sample_t));
+  vProtoSend(PROTO_SAMPLES, NULL, 0);
+  vPoolFree(samples_dump);
+}
+
+// Records batched into full frames
+typedef struct
+{
+  blackbox_record_t records[PROTO_MAX_PAYLOAD / sizeof (blackbox_record_t)];
+  int n;
+} log_batch_t;
+
+static void send_log_record(const blackbox_record_t* record, void* context)
+{
+  log_batch_t* batch = context;
+  const int per_frame = sizeof (batch->records) / sizeof (batch->records[0]);
+
+  batch->records[batch->n++] = *record;
+  if (batch->n == per_frame)
+  {
+    vProtoSend(PROTO_LOG, batch->records, sizeof (batch->records));
+    batch->n = 0;
+  }
+}
+
+void process_log_frame(const uint8_t* payload, uint8_t size)
+{
+  uint8_t type = PROTO_LOG_REQ;
+  log_batch_t batch = { .n = 0 };
+  uint16_t n;
+
+  if (size != sizeof (n))
+  {
+    vProtoSend(PROTO_NACK, &type, 1);
+    return;
+  }
+
+  // The last records, the black box in one go when 0. An empty frame ends it.
+  memcpy(&n, payload, sizeof (n));
+  iBlackboxDump(n, &send_log_record, &batch);
+  if (batch.n)
+    vProtoSend(PROTO_LOG, batch.records, batch.n * sizeof (blackbox_record_t));
+  vProtoSend(PROTO_LOG, NULL, 0);
+}
+
+static void pack_log_record(const blackbox_record_t* record, void* context)
+{
+  const int32_t values[PROTO_DUMP_LOG_FIELDS] =
+    { record->tick, record->value, record->event, record->arg };
+
+  vPackRecord(context, values);
+}
+
+static int pack_samples(pack_t* pack, int n)
+{
+  sample_t* samples_dump = pvPoolAlloc(SAMPLES_NB * sizeof (sample_t));
+
+  if (!samples_dump)
+    return 0;
+
+  n = iSamplesReadLast(samples_dump, n && n < SAMPLES_NB ? n : SAMPLES_NB);
+  for (int i = 0; i < n; i++)
+  {
+    const int32_t values[PROTO_DUMP_SAMPLES_FIELDS] =
+      { samples_dump[i].tick, samples_dump[i].value_mm,
+        samples_dump[i].sensor };
+    vPackRecord(pack, values);
+  }
+  vPoolFree(samples_dump);
+  return 1;
+}
+
+#ifdef SYSID
+static void pack_sysid(pack_t* pack, int n)
+{
+  motors_sysid_sample_t batch[8];
+  int first = 0, count = 0, got;
+
+  // The latest n periods: counted first
+  while ((got = iMotorsSysidRead(batch, count, 8)) > 0)
+    count += got;
+  if (n && n < count)
+    first = count - n;
+
+  while ((got = iMotorsSysidRead(batch, first, 8)) > 0)
+  {
+    for (int i = 0; i < got; i++)
+    {
+      const int32_t values[PROTO_DUMP_SYSID_FIELDS] =
+        { batch[i].command, batch[i].pwm_left, batch[i].speed_left,
+          batch[i].speed_right, batch[i].current_ma };
+      vPackRecord(pack, values);
+    }
+    first += got;
+  }
+}
+#endif
+
+// The bulk dumps, packed: a few times smaller than PROTO_SAMPLES and
+// PROTO_LOG on the ticks and the slowly varying readings
+void process_dump_frame(const uint8_t* payload, uint8_t size)
+{
+  uint8_t type = PROTO_DUMP_REQ;
+  proto_dump_req_t req;
+  pack_t pack;
+  int ok = 0;
+
+  if (size != sizeof (req))
+  {
+    vProtoSend(PROTO_NACK, &type, 1);
+    return;
+  }
+  memcpy(&req, payload, sizeof (req));
+
+  switch (req.source)
+  {
+    case PROTO_DUMP_SAMPLES:
+      vPackInit(&pack, PROTO_DUMP_SAMPLES_FIELDS, PROTO_DUMP_SAMPLES_FLAGS);
+      ok = pack_samples(&pack, req.n);
+      break;
+
+    case PROTO_DUMP_LOG:
+      vPackInit(&pack, PROTO_DUMP_LOG_FIELDS, PROTO_DUMP_LOG_FLAGS);
+      iBlackboxDump(req.n, &pack_log_record, &pack);
+      ok = 1;
+      break;
+
+#ifdef SYSID
+    case PROTO_DUMP_SYSID:
+      vPackInit(&pack, PROTO_DUMP_SYSID_FIELDS, PROTO_DUMP_SYSID_FLAGS);
+      ok = !iMotorsSysidIsRunning();
+      if (ok)
+        pack_sysid(&pack, req.n);
+      break;
+#endif
+  }
+
+  if (ok)
+    vPackEnd(&pack);
+  else
+    vProtoSend(PROTO_NACK, &type, 1);
+}
+
+// Staged by the PROTO_PARAMS_SET frames with PROTO_PARAMS_MORE
+static struct
+{
+  uint16_t keys[PARAMS_MAX];
+  int32_t values[PARAMS_MAX];
+  uint8_t n;
+  uint8_t overflow;
+} paramsBatch;
+
+void process_params_set_frame(const uint8_t* payload, uint8_t size)
+{
+  uint8_t type = PROTO_PARAMS_SET;
+  proto_param_t param;
+  int ok;
+
+  if (!size || (size - 1) % sizeof (proto_param_t))
+  {
+    paramsBatch.n = paramsBatch.overflow = 0;
+    vProtoSend(PROTO_NACK, &type, 1);
+    return;
+  }
+
+  for (int i = 1; i < size; i += sizeof (param))
+  {
+    if (paramsBatch.n == PARAMS_MAX)
+    {
+      paramsBatch.overflow = 1;
+      break;
+    }
+    memcpy(&param, &payload[i], sizeof (param));
+    paramsBatch.keys[paramsBatch.n] = param.key;
+    paramsBatch.values[paramsBatch.n++] = param.value;
+  }
+  if (payload[0] & PROTO_PARAMS_MORE)
+    return;
+
+  ok = !paramsBatch.overflow &&
+    iParamsSetBatch(paramsBatch.keys, paramsBatch.values, paramsBatch.n);
+  paramsBatch.n = paramsBatch.overflow = 0;
+  vProtoSend(ok ? PROTO_ACK : PROTO_NACK, &type, 1);
+}
+
+void process_params_frame(const uint8_t* payload, uint8_t size)
+{
+  proto_param_t reply[PROTO_MAX_PAYLOAD / sizeof (proto_param_t)];
+  const int per_frame = sizeof (reply) / sizeof (reply[0]);
+  const int n = size ? size / sizeof (uint16_t) : PARAMS_NB;
+  uint8_t type = PROTO_PARAMS_REQ;
+  uint16_t key;
+  int count = 0;
+
+  if (size % sizeof (uint16_t))
+  {
+    vProtoSend(PROTO_NACK, &type, 1);
+    return;
+  }
+  for (int i = 0; i < size; i += sizeof (key))
+  {
+    memcpy(&key, &payload[i], sizeof (key));
+    if (!pxParamsFind(key))
+    {
+      vProtoSend(PROTO_NACK, &type, 1);
+      return;
+    }
+  }
+
+  // The sets run in this task too: never a batch half applied
+  for (int i = 0; i < n; i++)
+  {
+    if (size)
+      memcpy(&key, &payload[i * sizeof (key)], sizeof (key));
+    else
+      key = params[i].key;
+    reply[count].key = key;
+    reply[count++].value = xParamsGet(key);
+    if (count == per_frame || i == n - 1)
+    {
+      vProtoSend(PROTO_PARAMS, reply, count * sizeof (proto_param_t));
+      count = 0;
+    }
+  }
+  vProtoSend(PROTO_PARAMS, NULL, 0);
+}
+
+void process_behaviour_set_frame(const uint8_t* payload, uint8_t size)
+{
+  uint8_t type = PROTO_BEHAVIOUR_SET;
+  behaviour_state_t state;
+
+  if (size != sizeof (state))
+  {
+    vProtoSend(PROTO_NACK, &type, 1);
+    return;
+  }
+  memcpy(&state, payload, sizeof (state));
+  vProtoSend(xBehaviourSetState(&state) ? PROTO_ACK : PROTO_NACK, &type, 1);
+}
+
+void process_behaviour_frame(const uint8_t* payload, uint8_t size)
+{
+  uint8_t type = PROTO_BEHAVIOUR_REQ;
+  behaviour_state_t state;
+
+  if (size != 1 || payload[0] >= BEHAVIOUR_STATES_NB)
+  {
+    vProtoSend(PROTO_NACK, &type, 1);
+    return;
+  }
+  vBehaviourGetState(payload[0], &state);
+  vProtoSend(PROTO_BEHAVIOUR, &state, sizeof (state));
+}
+
+void process_behaviour_run_frame(const uint8_t* payload, uint8_t size)
+{
+  uint8_t type = PROTO_BEHAVIOUR_RUN;
+  int ok = size == 1;
+
+  if (ok && (int8_t)payload[0] < 0)
+    vBehaviourStop();
+  else if (ok)
+    ok = xBehaviourStart(payload[0]);
+  vProtoSend(ok ? PROTO_ACK : PROTO_NACK, &type, 1);
+}
+
+void process_vm_load_frame(const uint8_t* payload, uint8_t size)
+{
+  uint8_t type = PROTO_VM_LOAD;
+  uint16_t offset;
+  int ok = size >= sizeof (offset);
+
+  if (ok)
+  {
+    memcpy(&offset, payload, sizeof (offset));
+    ok = xVmLoad(offset, &payload[sizeof (offset)], size - sizeof (offset));
+  }
+  vProtoSend(ok ? PROTO_ACK : PROTO_NACK, &type, 1);
+}
+
+void process_vm_run_frame(const uint8_t* payload, uint8_t size)
+{
+  uint8_t type = PROTO_VM_RUN;
+  proto_vm_run_t run;
+  int ok = size == sizeof (run);
+
+  if (ok)
+  {
+    memcpy(&run, payload, sizeof (run));
+    if (!run.period_ms)
+      vVmStop();
+    else
+      ok = iVmStart(run.period_ms, run.budget) == VM_OK;
+  }
+  vProtoSend(ok ? PROTO_ACK : PROTO_NACK, &type, 1);
+}
+
+void process_vm_frame(const uint8_t* payload, uint8_t size)
+{
+  uint8_t type = PROTO_VM_REQ;
+  vm_status_t status;
+
+  if (size)
+  {
+    vProtoSend(PROTO_NACK, &type, 1);
+    return;
+  }
+  vVmGetStatus(&status);
+  vProtoSend(PROTO_VM, &status, sizeof (status));
+}
+
+#ifdef ACTUATION_TRACE
+typedef char actuation_stages_check_t[PROTO_ACTUATION_STAGES ==
+                                      ACTUATION_STAGES_NB ? 1 : -1];
+#endif
+
+void process_actuation_frame(const uint8_t* payload, uint8_t size)
+{
+  uint8_t type = PROTO_ACTUATION_REQ;
+#ifdef ACTUATION_TRACE
+  proto_actuation_t reply;
+  uint16_t us[ACTUATION_STAGES_NB];
+  uint32_t setpoint;
+
+  if (!size && xActuationLast(&setpoint, us))
+  {
+    reply.left = (int16_t)setpoint;
+    reply.right = (int16_t)(setpoint >> 16);
+    memcpy(reply.us, us, sizeof (reply.us));
+    vProtoSend(PROTO_ACTUATION, &reply, sizeof (reply));
+    return;
+  }
+#endif
+  vProtoSend(PROTO_NACK, &type, 1);
+}
+
+void process_ident_frame(const uint8_t* payload, uint8_t size)
+{
+  const boot_image_t* image = (const boot_image_t*)BOOT_IMAGE_ADDRESS;
+  proto_ident_t reply =
+    {
+      .uid = uHardwareUid(),
+      .image_crc = image->magic == BOOT_IMAGE_MAGIC ? image->crc : 0,
+      .flash_kb = MCU_FLASH_SIZE / 1024,
+      .address = uProtoGetAddress(),
+    };
+
+  vProtoSend(PROTO_IDENT, &reply, sizeof (reply));
+}
+
+void process_caps_frame(const uint8_t* payload, uint8_t size)
+{
+  const boot_image_t* image = (const boot_image_t*)BOOT_IMAGE_ADDRESS;
+  proto_caps_t reply =
+    {
+      .version = PROTO_VERSION,
+      .image_crc = image->magic == BOOT_IMAGE_MAGIC ? image->crc : 0,
+      .max_payload = PROTO_MAX_PAYLOAD,
+      .schemas = iProtoSchemaCount(),
+    };
+
+#if defined(USB_LINK)
+  reply.link = PROTO_TRANSPORT_USB;
+#elif defined(RTT_LINK)
+  reply.link = PROTO_TRANSPORT_RTT;
+#else
+  // The usual rates of the USB serial adapters, fastest first
+  static const uint32_t rates[] =
+    {
+      4000000, 3000000, 2000000, 1500000, 1000000, 921600, 460800, 230400,
+    };
+
+  reply.link = PROTO_TRANSPORT_UART;
+  reply.max_bauds = UART_DEFAULT_BAUDS;
+  for (int i = 0; i < sizeof (rates) / sizeof (rates[0]); i++)
+    if (xUartCheckLine(rates[i], 0))
+    {
+      reply.max_bauds = rates[i];
+      break;
+    }
+#endif
+  reply.transports = reply.link;
+#ifdef SPI_LINK
+  reply.transports |= PROTO_TRANSPORT_SPI;
+#endif
+#ifdef CAN_BUS
+  reply.transports |= PROTO_TRANSPORT_CAN;
+#endif
+#ifdef TELEMETRY_UART
+  reply.transports |= PROTO_TRANSPORT_TELEMETRY;
+#endif
+
+  vProtoSend(PROTO_CAPS, &reply, sizeof (reply));
+}
+
+void process_schema_frame(const uint8_t* payload, uint8_t size)
+{
+  uint8_t reply[PROTO_MAX_PAYLOAD];
+  proto_schema_t header;
+  const uint8_t* fields;
+  uint8_t type = PROTO_SCHEMA_REQ;
+
+  if (size != 1)
+  {
+    vProtoSend(PROTO_NACK, &type, 1);
+    return;
+  }
+  if (payload[0] >= iProtoSchemaCount())
+  {
+    vProtoSend(PROTO_SCHEMA, NULL, 0);
+    return;
+  }
+
+  const int n = iProtoSchema(payload[0], &header, &fields);
+  memcpy(reply, &header, sizeof (header));
+  memcpy(&reply[sizeof (header)], fields, n);
+  vProtoSend(PROTO_SCHEMA, reply, sizeof (header) + n);
+}
+
+void process_time_frame(const uint8_t* payload, uint8_t size)
+{
+  proto_time_t reply;
+  uint8_t type = PROTO_TIME_REQ;
+
+  if (size != sizeof (reply.cookie))
+  {
+    vProtoSend(PROTO_NACK, &type, 1);
+    return;
+  }
+
+  // Stamped as late as possible: the reply leaves right after
+  memcpy(&reply.cookie, payload, sizeof (reply.cookie));
+  taskENTER_CRITICAL();
+  reply.tick = xTaskGetTickCount();
+  reply.time_us = xTimeNowUs();
+  taskEXIT_CRITICAL();
+  vProtoSend(PROTO_TIME, &reply, sizeof (reply));
+}
+
+void process_echo_frame(const uint8_t* payload, uint8_t size)
+{
+  vProtoSend(PROTO_ECHO, payload, size);
+}
+
+void process_segments_frame(const uint8_t* payload, uint8_t size)
+{
+  motors_segment_t segments[PROTO_MAX_PAYLOAD / sizeof (proto_segment_t)];
+  const int n = size / sizeof (proto_segment_t);
+  uint8_t type = PROTO_SEGMENTS;
+
+  if (size % sizeof (proto_segment_t))
+  {
+    vProtoSend(PROTO_NACK, &type, 1);
+    return;
+  }
+
+  if (!n)
+  {
+    vMotorsClearSegments();
+    vProtoSend(PROTO_ACK, &type, 1);
+    return;
+  }
+
+  // Same packed layout on both sides. On NACK (queue full) the segments
+  // already queued still run.
+  memcpy(segments, payload, size);
+  if (iMotorsQueueSegments(segments, n) == n)
+    vProtoSend(PROTO_ACK, &type, 1);
+  else
+    vProtoSend(PROTO_NACK, &type, 1);
+}
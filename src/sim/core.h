@@ -0,0 +1,21 @@
+#ifndef SIM_CORE_H
+# define SIM_CORE_H
+
+// Host simulation build ("waf sim"): included ahead of each firmware
+// source. The Cortex-M3 intrinsics of core_cm3.h are inline assembly,
+// their calls go to the simulation port (FreeRTOS Posix port) and to the
+// simulated reset instead.
+
+#include "stm32f10x.h"
+
+void vPortWaitForInterrupt(void);
+void vPortDisableInterrupts(void);
+void vPortEnableInterrupts(void);
+void vSimReset(void) __attribute__((noreturn));
+
+#define __WFI()          vPortWaitForInterrupt()
+#define __disable_irq()  vPortDisableInterrupts()
+#define __enable_irq()   vPortEnableInterrupts()
+#define NVIC_SystemReset vSimReset
+
+#endif /* SIM_CORE_H */
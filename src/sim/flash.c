@@ -0,0 +1,29 @@
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "libperiph/flash.h"
+
+// Replaces libperiph/flash.c: the flash image is mapped at its address
+// (sim/sim.c), erased to ones, programmed by clearing bits
+void vFlashErasePage(uint32_t address_)
+{
+  vTaskSuspendAll();
+  memset((void*)(uintptr_t)(address_ & ~(FLASH_PAGE_SIZE - 1)), 0xff,
+         FLASH_PAGE_SIZE);
+  xTaskResumeAll();
+}
+
+void vFlashProgram(uint32_t address_, const uint32_t* words_, int n_)
+{
+  volatile uint16_t* flash = (volatile uint16_t*)(uintptr_t)address_;
+
+  vTaskSuspendAll();
+  for (int i = 0; i < n_; i++)
+  {
+    flash[2 * i] &= words_[i] & 0xffff;
+    flash[2 * i + 1] &= words_[i] >> 16;
+  }
+  xTaskResumeAll();
+}
@@ -0,0 +1,1027 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "stm32f10x.h"
+
+#include "libglobal/regmap.h"
+#include "libperiph/adc.h"
+#include "libperiph/bumpers.h"
+#include "libperiph/power.h"
+#include "libperiph/sonar.h"
+
+#include "sim/sim.h"
+
+// Register level models of the peripherals the drivers use, run by the
+// hardware thread, their handlers under the interrupt mask. The memory
+// of a register holds what the firmware last wrote, the models reconcile
+// it at each step and after each handler:
+//   rc_w0 flags (TIMx->SR, ADC->SR, I2C->SR1) are written ~flag: kept in
+//     a shadow ANDed with the register
+//   DMA IFCR, the GPIO BSRR/BRR, NVIC ISER/ICER: each write is caught
+//     (vSimWatch), none lost between two steps
+//   CRC DR and CR: each write is folded at once (vSimWatchWrites)
+//   flags cleared by a read sequence (USART IDLE, I2C ADDR and STOPF,
+//     EXTI lines) are cleared once their handler ran
+// The DMA channels latch a new transfer when enabled again or when
+// CNDTR/CMAR changed since the model last wrote them.
+
+// The registers of the watched pages through their alias (sim/sim.c):
+// the models write there freely
+#define SIM_ALIAS(type, base) ((type*)((base) + SIM_ALIAS_OFFSET))
+#undef AFIO
+#define AFIO          SIM_ALIAS(AFIO_TypeDef, AFIO_BASE)
+#undef EXTI
+#define EXTI          SIM_ALIAS(EXTI_TypeDef, EXTI_BASE)
+#undef GPIOA
+#define GPIOA         SIM_ALIAS(GPIO_TypeDef, GPIOA_BASE)
+#undef GPIOB
+#define GPIOB         SIM_ALIAS(GPIO_TypeDef, GPIOB_BASE)
+#undef GPIOC
+#define GPIOC         SIM_ALIAS(GPIO_TypeDef, GPIOC_BASE)
+#undef GPIOD
+#define GPIOD         SIM_ALIAS(GPIO_TypeDef, GPIOD_BASE)
+#undef DMA1
+#define DMA1          SIM_ALIAS(DMA_TypeDef, DMA1_BASE)
+#undef DMA1_Channel1
+#define DMA1_Channel1 SIM_ALIAS(DMA_Channel_TypeDef, DMA1_Channel1_BASE)
+#undef DMA1_Channel2
+#define DMA1_Channel2 SIM_ALIAS(DMA_Channel_TypeDef, DMA1_Channel2_BASE)
+#undef DMA1_Channel3
+#define DMA1_Channel3 SIM_ALIAS(DMA_Channel_TypeDef, DMA1_Channel3_BASE)
+#undef DMA1_Channel4
+#define DMA1_Channel4 SIM_ALIAS(DMA_Channel_TypeDef, DMA1_Channel4_BASE)
+#undef DMA1_Channel5
+#define DMA1_Channel5 SIM_ALIAS(DMA_Channel_TypeDef, DMA1_Channel5_BASE)
+#undef DMA1_Channel6
+#define DMA1_Channel6 SIM_ALIAS(DMA_Channel_TypeDef, DMA1_Channel6_BASE)
+#undef DMA1_Channel7
+#define DMA1_Channel7 SIM_ALIAS(DMA_Channel_TypeDef, DMA1_Channel7_BASE)
+#undef CRC
+#define CRC           SIM_ALIAS(CRC_TypeDef, CRC_BASE)
+#undef NVIC
+#define NVIC          SIM_ALIAS(NVIC_Type, NVIC_BASE)
+
+#define SIM_UART_BAUDS     115200
+#define SIM_UART_FIFO_SIZE 64
+#define SIM_UART_BURST_MAX 16
+
+// Master reads of the whole register file, as the Raspberry Pi does
+#define SIM_I2C_PERIOD_MS   100
+#define SIM_I2C_STALL_NS    10000000
+
+// HC-SR04: the echo rises after the 8 cycles burst, 38 ms without any
+// obstacle
+#define SIM_SONAR_DELAY_US   460
+#define SIM_SONAR_TIMEOUT_US 38000
+
+// Interrupt handlers dispatched in one step before giving up on a
+// handler not clearing its flags
+#define SIM_DISPATCH_MAX 64
+
+#define SIM_RC_W0_SYNC(reg, shadow) ((shadow) &= (reg), (reg) = (shadow))
+
+typedef struct
+{
+  DMA_Channel_TypeDef* regs;
+  int active;
+  uint16_t count;
+  uint16_t remaining;
+  uint32_t memory;
+  uint16_t lastCndtr;
+  uint32_t lastCmar;
+} sim_dma_t;
+
+typedef struct
+{
+  IRQn_Type irq;
+  void (*handler)(void);
+  int (*pending)(void);
+  void (*served)(void);
+} sim_irq_t;
+
+enum eSimI2CState {
+  SIM_I2C_IDLE = 0,
+  SIM_I2C_POINTER,
+  SIM_I2C_RESTART,
+  SIM_I2C_READ,
+};
+
+extern void DMA1_Channel1_IRQHandler(void) __attribute__((weak));
+extern void DMA1_Channel3_IRQHandler(void) __attribute__((weak));
+extern void DMA1_Channel4_IRQHandler(void) __attribute__((weak));
+extern void DMA1_Channel5_IRQHandler(void) __attribute__((weak));
+extern void DMA1_Channel6_IRQHandler(void) __attribute__((weak));
+extern void DMA1_Channel7_IRQHandler(void) __attribute__((weak));
+extern void ADC1_2_IRQHandler(void) __attribute__((weak));
+extern void TIM2_IRQHandler(void) __attribute__((weak));
+extern void TIM3_IRQHandler(void) __attribute__((weak));
+extern void I2C1_EV_IRQHandler(void) __attribute__((weak));
+extern void I2C1_ER_IRQHandler(void) __attribute__((weak));
+extern void USART1_IRQHandler(void) __attribute__((weak));
+extern void EXTI0_IRQHandler(void) __attribute__((weak));
+extern void EXTI1_IRQHandler(void) __attribute__((weak));
+extern void EXTI4_IRQHandler(void) __attribute__((weak));
+extern void EXTI15_10_IRQHandler(void) __attribute__((weak));
+
+static uint32_t nvicEnabled[2];
+// Step under the interrupt mask, the handlers may run
+static int interrupts;
+
+static GPIO_TypeDef* const ports[] = { GPIOA, GPIOB, GPIOC, GPIOD };
+#define SIM_PORTS_NB (sizeof (ports) / sizeof (ports[0]))
+// Input pins driven by the models, and their levels
+static uint16_t driven[SIM_PORTS_NB];
+static uint16_t levels[SIM_PORTS_NB];
+
+static uint32_t extiPending;
+
+static sim_dma_t dma[7];
+static uint32_t dmaIsr;
+
+static uint32_t crc = 0xffffffff;
+
+static uint16_t tim2Sr;
+static uint16_t tim3Sr;
+static uint32_t adcSr[2];
+static uint16_t i2cSr1;
+
+static int pty;
+static double uartTxCredit, uartRxCredit;
+static uint8_t uartFifo[SIM_UART_FIFO_SIZE];
+static int uartFifoHead, uartFifoCount;
+static int uartReceiving;
+
+static uint64_t adcPhaseNs;
+
+// TIM2 timer clocks since the last update event, and the events of this
+// step not served yet: the handler runs for each, as on the board where
+// they are 55 us apart, not once per step
+static uint64_t tim2LastNs;
+static uint32_t tim2Clocks;
+static int tim2Updates;
+
+static uint64_t tim3Ticks;
+// Echo edges of each TIM3 channel in timer ticks, 0 when none
+static uint64_t echoRise[4], echoFall[4];
+
+static uint16_t tim4Written;
+static int32_t tim4Offset;
+static int32_t rightPosition;
+
+static int i2cState;
+static uint64_t i2cNextNs, i2cStallNs;
+static int i2cIndex;
+static uint8_t i2cData[1 + sizeof (regmap_t)];
+static uint32_t i2cReads, i2cErrors;
+
+// Interrupts
+// ----------
+
+static int prvDmaIrqPending(int channel_)
+{
+  const uint32_t flags = (dmaIsr >> (4 * channel_)) & 0xe;
+
+  // TCIE, HTIE, TEIE line up with TCIF, HTIF, TEIF
+  return flags & dma[channel_].regs->CCR & 0xe;
+}
+
+static int prvDma1Pending() { return prvDmaIrqPending(0); }
+static int prvDma3Pending() { return prvDmaIrqPending(2); }
+static int prvDma4Pending() { return prvDmaIrqPending(3); }
+static int prvDma5Pending() { return prvDmaIrqPending(4); }
+static int prvDma6Pending() { return prvDmaIrqPending(5); }
+static int prvDma7Pending() { return prvDmaIrqPending(6); }
+
+static int prvAdcPending()
+{
+  return ((ADC1->CR1 & ADC_CR1_AWDIE) && (adcSr[0] & ADC_SR_AWD)) ||
+    ((ADC2->CR1 & ADC_CR1_AWDIE) && (adcSr[1] & ADC_SR_AWD));
+}
+
+static int prvTim2Pending()
+{
+  return tim2Sr & TIM2->DIER & TIM_DIER_UIE;
+}
+
+// The next update event of the step, once the handler cleared this one
+static void prvTim2Served()
+{
+  SIM_RC_W0_SYNC(TIM2->SR, tim2Sr);
+  if (--tim2Updates > 0)
+  {
+    tim2Sr |= TIM_SR_UIF;
+    TIM2->SR = tim2Sr;
+  }
+  else
+    tim2Updates = 0;
+}
+
+static int prvTim3Pending()
+{
+  return tim3Sr & TIM3->DIER & 0x1f;
+}
+
+static int prvI2CEvPending()
+{
+  const uint16_t cr2 = I2C1->CR2;
+
+  if (!(cr2 & I2C_CR2_ITEVTEN))
+    return 0;
+  if (i2cSr1 & (I2C_SR1_ADDR | I2C_SR1_STOPF))
+    return 1;
+  return (cr2 & I2C_CR2_ITBUFEN) && (i2cSr1 & (I2C_SR1_TXE | I2C_SR1_RXNE));
+}
+
+static int prvI2CErPending()
+{
+  return (I2C1->CR2 & I2C_CR2_ITERREN) &&
+    (i2cSr1 & (I2C_SR1_AF | I2C_SR1_BERR | I2C_SR1_ARLO | I2C_SR1_OVR));
+}
+
+static int prvUsartPending()
+{
+  return (USART1->CR1 & USART_CR1_IDLEIE) && (USART1->SR & USART_SR_IDLE);
+}
+
+static int prvExtiPending(uint32_t lines_)
+{
+  return extiPending & EXTI->IMR & lines_;
+}
+
+static int prvExti0Pending() { return prvExtiPending(1 << 0); }
+static int prvExti1Pending() { return prvExtiPending(1 << 1); }
+static int prvExti4Pending() { return prvExtiPending(1 << 4); }
+static int prvExti15_10Pending() { return prvExtiPending(0xfc00); }
+
+// A read of SR then DR in the handler
+static void prvUsartServed()
+{
+  USART1->SR &= ~USART_SR_IDLE;
+}
+
+// ADDR: SR1 then SR2, STOPF: SR1 then CR1, RXNE: DR
+static void prvI2CEvServed()
+{
+  i2cSr1 &= ~(I2C_SR1_ADDR | I2C_SR1_STOPF | I2C_SR1_RXNE);
+  I2C1->SR1 = i2cSr1;
+}
+
+static void prvExtiServed(uint32_t lines_)
+{
+  extiPending &= ~lines_;
+  EXTI->PR = extiPending;
+}
+
+static void prvExti0Served() { prvExtiServed(1 << 0); }
+static void prvExti1Served() { prvExtiServed(1 << 1); }
+static void prvExti4Served() { prvExtiServed(1 << 4); }
+static void prvExti15_10Served() { prvExtiServed(0xfc00); }
+
+static const sim_irq_t irqs[] =
+  {
+    { DMA1_Channel1_IRQn, DMA1_Channel1_IRQHandler, prvDma1Pending, NULL },
+    { DMA1_Channel3_IRQn, DMA1_Channel3_IRQHandler, prvDma3Pending, NULL },
+    { DMA1_Channel4_IRQn, DMA1_Channel4_IRQHandler, prvDma4Pending, NULL },
+    { DMA1_Channel5_IRQn, DMA1_Channel5_IRQHandler, prvDma5Pending, NULL },
+    { DMA1_Channel6_IRQn, DMA1_Channel6_IRQHandler, prvDma6Pending, NULL },
+    { DMA1_Channel7_IRQn, DMA1_Channel7_IRQHandler, prvDma7Pending, NULL },
+    { ADC1_2_IRQn, ADC1_2_IRQHandler, prvAdcPending, NULL },
+    { TIM2_IRQn, TIM2_IRQHandler, prvTim2Pending, prvTim2Served },
+    { TIM3_IRQn, TIM3_IRQHandler, prvTim3Pending, NULL },
+    { I2C1_EV_IRQn, I2C1_EV_IRQHandler, prvI2CEvPending, prvI2CEvServed },
+    { I2C1_ER_IRQn, I2C1_ER_IRQHandler, prvI2CErPending, NULL },
+    { USART1_IRQn, USART1_IRQHandler, prvUsartPending, prvUsartServed },
+    { EXTI0_IRQn, EXTI0_IRQHandler, prvExti0Pending, prvExti0Served },
+    { EXTI1_IRQn, EXTI1_IRQHandler, prvExti1Pending, prvExti1Served },
+    { EXTI4_IRQn, EXTI4_IRQHandler, prvExti4Pending, prvExti4Served },
+    { EXTI15_10_IRQn, EXTI15_10_IRQHandler, prvExti15_10Pending,
+      prvExti15_10Served },
+  };
+
+#define SIM_IRQS_NB (sizeof (irqs) / sizeof (irqs[0]))
+
+static void prvDmaSync(sim_dma_t* channel_);
+
+// Registers written by the firmware since the last look
+static void prvSync()
+{
+  // The system clock switches at once
+  RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SWS) | (RCC->CFGR & RCC_CFGR_SW) << 2;
+
+  for (int i = 0; i < 2; i++)
+  {
+    nvicEnabled[i] |= uSimWritten(&NVIC->ISER[i]);
+    nvicEnabled[i] &= ~uSimWritten(&NVIC->ICER[i]);
+  }
+
+  for (unsigned p = 0; p < SIM_PORTS_NB; p++)
+  {
+    GPIO_TypeDef* port = ports[p];
+    const uint32_t bsrr = uSimWritten(&port->BSRR);
+    const uint32_t brr = uSimWritten(&port->BRR);
+    uint32_t odr = port->ODR;
+    // Set wins over reset in a BSRR write
+    odr &= ~(bsrr >> 16);
+    odr |= bsrr & 0xffff;
+    odr &= ~brr;
+    port->ODR = odr;
+    port->IDR = (odr & ~driven[p]) | (levels[p] & driven[p]);
+  }
+
+  const uint32_t clear = uSimWritten(&DMA1->IFCR);
+  for (int c = 0; c < 7; c++)
+  {
+    uint32_t group = (clear >> (4 * c)) & 0xf;
+    if (group & 1)
+      group = 0xf;
+    dmaIsr &= ~(group << (4 * c));
+    prvDmaSync(&dma[c]);
+  }
+  DMA1->ISR = dmaIsr;
+
+  SIM_RC_W0_SYNC(TIM2->SR, tim2Sr);
+  SIM_RC_W0_SYNC(TIM3->SR, tim3Sr);
+  SIM_RC_W0_SYNC(ADC1->SR, adcSr[0]);
+  SIM_RC_W0_SYNC(ADC2->SR, adcSr[1]);
+  SIM_RC_W0_SYNC(I2C1->SR1, i2cSr1);
+
+  // Calibration done at once
+  __atomic_and_fetch(&ADC1->CR2, ~(ADC_CR2_CAL | ADC_CR2_RSTCAL),
+                     __ATOMIC_SEQ_CST);
+  __atomic_and_fetch(&ADC2->CR2, ~(ADC_CR2_CAL | ADC_CR2_RSTCAL),
+                     __ATOMIC_SEQ_CST);
+}
+
+// Handlers of the pending interrupts, the most urgent first (lowest
+// priority value), until none is pending
+static void prvDispatch()
+{
+  if (!interrupts)
+    return;
+  for (int n = 0; n < SIM_DISPATCH_MAX; n++)
+  {
+    const sim_irq_t* best = NULL;
+
+    prvSync();
+    for (unsigned i = 0; i < SIM_IRQS_NB; i++)
+    {
+      const sim_irq_t* irq = &irqs[i];
+      if (!irq->handler || !(nvicEnabled[irq->irq >> 5] & (1 << (irq->irq & 31)))
+          || !irq->pending())
+        continue;
+      if (!best || NVIC->IP[irq->irq] < NVIC->IP[best->irq])
+        best = irq;
+    }
+    if (!best)
+      return;
+
+    best->handler();
+    if (best->served)
+      best->served();
+  }
+  prvSync();
+}
+
+// DMA
+// ---
+
+static void prvDmaSync(sim_dma_t* channel_)
+{
+  DMA_Channel_TypeDef* regs = channel_->regs;
+
+  if (!(regs->CCR & DMA_CCR1_EN))
+  {
+    channel_->active = 0;
+    return;
+  }
+  if (channel_->active && regs->CNDTR == channel_->lastCndtr &&
+      regs->CMAR == channel_->lastCmar)
+    return;
+
+  channel_->active = 1;
+  channel_->count = regs->CNDTR;
+  channel_->remaining = channel_->count;
+  channel_->memory = regs->CMAR;
+  channel_->lastCndtr = regs->CNDTR;
+  channel_->lastCmar = regs->CMAR;
+}
+
+static void prvDmaFlags(int channel_, uint32_t flags_)
+{
+  dmaIsr |= (flags_ | DMA_ISR_GIF1) << (4 * channel_);
+  DMA1->ISR = dmaIsr;
+}
+
+// One request of the peripheral: value_ to the memory or from it, 0 when
+// the channel has nothing to transfer
+static int prvDmaRequest(int channel_, uint32_t* value_)
+{
+  sim_dma_t* channel = &dma[channel_];
+  DMA_Channel_TypeDef* regs = channel->regs;
+  const uint32_t ccr = regs->CCR;
+
+  if (!channel->active || !channel->remaining)
+    return 0;
+
+  const int size = 1 << ((ccr >> 10) & 3);
+  const uint32_t offset = (ccr & DMA_CCR1_MINC) ?
+    (uint32_t)(channel->count - channel->remaining) * size : 0;
+  volatile void* memory = (volatile void*)(uintptr_t)(channel->memory + offset);
+
+  if (ccr & DMA_CCR1_DIR)
+  {
+    if (size == 1)
+      *value_ = *(volatile uint8_t*)memory;
+    else if (size == 2)
+      *value_ = *(volatile uint16_t*)memory;
+    else
+      *value_ = *(volatile uint32_t*)memory;
+  }
+  else if (size == 1)
+    *(volatile uint8_t*)memory = *value_;
+  else if (size == 2)
+    *(volatile uint16_t*)memory = *value_;
+  else
+    *(volatile uint32_t*)memory = *value_;
+
+  channel->remaining--;
+  if (channel->count - channel->remaining == channel->count / 2)
+    prvDmaFlags(channel_, DMA_ISR_HTIF1);
+  if (!channel->remaining)
+  {
+    prvDmaFlags(channel_, DMA_ISR_TCIF1);
+    if (ccr & DMA_CCR1_CIRC)
+      channel->remaining = channel->count;
+  }
+  regs->CNDTR = channel->remaining;
+  channel->lastCndtr = channel->remaining;
+  return 1;
+}
+
+// CRC and memory to memory DMA
+// ----------------------------
+
+// MSB first, 32 bits at a time
+static void prvCrcData(uint32_t value_)
+{
+  crc ^= value_;
+  for (int b = 0; b < 32; b++)
+    crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+  CRC->DR = crc;
+}
+
+static void prvCrcControl(uint32_t value_)
+{
+  if (value_ & CRC_CR_RESET)
+  {
+    crc = 0xffffffff;
+    CRC->DR = crc;
+  }
+}
+
+// The whole transfer of a memory to memory channel in one step, from the
+// memory to the address of the "peripheral": the CRC unit here
+static void prvMem2MemStep()
+{
+  for (int c = 0; c < 7; c++)
+  {
+    const uint32_t ccr = dma[c].regs->CCR;
+    uint32_t value;
+
+    if (!dma[c].active || !(ccr & DMA_CCR1_MEM2MEM) || !(ccr & DMA_CCR1_DIR))
+      continue;
+    while (prvDmaRequest(c, &value))
+      if (dma[c].regs->CPAR == (uint32_t)&CRC->DR - SIM_ALIAS_OFFSET)
+        prvCrcData(value);
+  }
+}
+
+// GPIO and EXTI
+// -------------
+
+static void prvGpioDrive(int port_, int pin_, int level_)
+{
+  const uint16_t bit = 1 << pin_;
+  const int was = levels[port_] & bit;
+
+  driven[port_] |= bit;
+  if (level_)
+    levels[port_] |= bit;
+  else
+    levels[port_] &= ~bit;
+  ports[port_]->IDR = (ports[port_]->ODR & ~driven[port_]) |
+    (levels[port_] & driven[port_]);
+
+  if (!was == !level_)
+    return;
+  // Edge on the line of the pin, when its port is the one selected
+  if (((AFIO->EXTICR[pin_ >> 2] >> (4 * (pin_ & 3))) & 0xf) != port_)
+    return;
+  if ((level_ && (EXTI->RTSR & bit)) || (!level_ && (EXTI->FTSR & bit)))
+  {
+    extiPending |= bit;
+    EXTI->PR = extiPending;
+    prvDispatch();
+  }
+}
+
+static void prvBumpersStep()
+{
+  // Active low, pulled up: left PB0, right PB1, cliff PA4
+  prvGpioDrive(1, 0, !iSimWorldBumper(BUMPER_LEFT));
+  prvGpioDrive(1, 1, !iSimWorldBumper(BUMPER_RIGHT));
+  prvGpioDrive(0, 4, !iSimWorldBumper(BUMPER_CLIFF));
+}
+
+// Encoders
+// --------
+
+static void prvEncodersStep()
+{
+  // Left: TIM4 in encoder mode, the firmware may set the counter
+  const int32_t left = iSimWorldEncoder(SIM_WHEEL_LEFT);
+  if (TIM4->CNT != tim4Written)
+    tim4Offset = TIM4->CNT - left;
+  if (TIM4->CR1 & TIM_CR1_CEN)
+  {
+    tim4Written = (uint16_t)(left + tim4Offset);
+    TIM4->CNT = tim4Written;
+  }
+
+  // Right: quadrature on PB12 (A) / PB13 (B), one EXTI edge at a time
+  static const uint8_t sequence[4] = { 0, 2, 3, 1 };
+  const int32_t right = iSimWorldEncoder(SIM_WHEEL_RIGHT);
+  while (rightPosition != right)
+  {
+    rightPosition += right > rightPosition ? 1 : -1;
+    const uint8_t state = sequence[rightPosition & 3];
+    prvGpioDrive(1, 12, state & 1);
+    prvGpioDrive(1, 13, state & 2);
+  }
+}
+
+// Motors
+// ------
+
+// Mean output of a leg, high below its compare value (PWM1), or above
+// it with the opposed polarity: the B legs
+static double prvMotorLeg(volatile uint16_t* ccr_, int channel_)
+{
+  const double arr = TIM2->ARR;
+  const double on = *ccr_ > arr ? 1 : *ccr_ / arr;
+
+  if (!(TIM2->CCER & (TIM_CCER_CC1E << (4 * channel_))))
+    return 0;
+  return (TIM2->CCER & (TIM_CCER_CC1P << (4 * channel_))) ? 1 - on : on;
+}
+
+// Mean voltage across the motor of channels A and A + 1, in [-1, 1]
+static double prvMotorDuty(volatile uint16_t* ccr_, int channel_, int pin_)
+{
+  if (!(TIM2->CR1 & TIM_CR1_CEN) || !TIM2->ARR || !(GPIOC->ODR & (1 << pin_)))
+    return 0;
+  return prvMotorLeg(ccr_, channel_) - prvMotorLeg(ccr_ + 2, channel_ + 1);
+}
+
+// Update events of TIM2, two per PWM period: the interrupt, and the DMA
+// burst through DMAR, one request per register from the DCR base, once
+// per step
+static void prvMotorsUpdate(uint64_t now_ns_)
+{
+  volatile uint16_t* base = &TIM2->CR1;
+  const int first = TIM2->DCR & 0x1f;
+  const int length = ((TIM2->DCR >> 8) & 0x1f) + 1;
+  const uint64_t elapsed_ns = now_ns_ - tim2LastNs;
+  uint32_t value, events;
+
+  tim2LastNs = now_ns_;
+  if (!(TIM2->CR1 & TIM_CR1_CEN) || (TIM2->CR1 & TIM_CR1_UDIS))
+    return;
+  tim2Clocks += elapsed_ns * SIM_CYCLES_PER_US / 1000;
+  events = tim2Clocks / (TIM2->ARR + 1);
+  tim2Clocks %= TIM2->ARR + 1;
+  if (!events)
+    return;
+
+  // Under the interrupt mask, they merge into one
+  tim2Updates = interrupts ? tim2Updates + events : 1;
+  tim2Sr |= TIM_SR_UIF;
+  TIM2->SR = tim2Sr;
+
+  if (!(TIM2->DIER & TIM_DIER_UDE) ||
+      dma[1].regs->CPAR != (uint32_t)&TIM2->DMAR)
+    return;
+  for (int i = 0; i < length && first + i < 20; i++)
+    if (prvDmaRequest(1, &value))
+      base[2 * (first + i)] = value;
+}
+
+static void prvMotorsStep(uint64_t now_ns_)
+{
+  prvMotorsUpdate(now_ns_);
+
+  // TIM2 legs: CCR1 / CCR2 left, CCR3 / CCR4 right, bridges enabled by
+  // PC0 / PC1
+  vSimWorldMotors(prvMotorDuty(&TIM2->CCR1, 0, 0),
+                  prvMotorDuty(&TIM2->CCR3, 2, 1));
+}
+
+// ADC, triggered by TIM1
+// ----------------------
+
+static int prvAdcSequence(ADC_TypeDef* adc_, int rank_)
+{
+  if (rank_ < 6)
+    return (adc_->SQR3 >> (5 * rank_)) & 0x1f;
+  if (rank_ < 12)
+    return (adc_->SQR2 >> (5 * (rank_ - 6))) & 0x1f;
+  return (adc_->SQR1 >> (5 * (rank_ - 12))) & 0x1f;
+}
+
+// One conversion, with the analog watchdog of the converter
+static int32_t prvAdcConvert(ADC_TypeDef* adc_, uint32_t* sr_, int rank_)
+{
+  static uint32_t noise = 1;
+  const uint32_t cr1 = adc_->CR1;
+  const int channel = prvAdcSequence(adc_, rank_);
+
+  // The internal channels of ADC2 are on Vss
+  const int mv = adc_ == ADC2 && channel >= ADC_Channel_16 ? 0 :
+    iSimWorldAnalogMv(channel);
+
+  noise = noise * 1103515245 + 12345;
+  int32_t code = mv * ADC_MAX_VALUE / POWER_VREF_MV +
+    (int32_t)((noise >> 16) % 5) - 2;
+  if (code < 0)
+    code = 0;
+  if (code > ADC_MAX_VALUE - 1)
+    code = ADC_MAX_VALUE - 1;
+
+  *sr_ |= ADC_SR_EOC;
+  if ((cr1 & ADC_CR1_AWDEN) &&
+      (!(cr1 & ADC_CR1_AWDSGL) || (int)(cr1 & ADC_CR1_AWDCH) == channel) &&
+      (code > (int32_t)adc_->HTR || code < (int32_t)adc_->LTR))
+    *sr_ |= ADC_SR_AWD;
+  adc_->SR = *sr_;
+  return code;
+}
+
+static void prvAdcScan()
+{
+  const uint32_t cr2 = ADC1->CR2;
+  const int n = ((ADC1->SQR1 >> 20) & 0xf) + 1;
+  // Regular simultaneous: ADC2 converts its sequence with ADC1, both
+  // results in the data register of ADC1
+  const int dual = (ADC1->CR1 & ADC_CR1_DUALMOD) == ADC_Mode_RegSimult &&
+    (ADC2->CR2 & ADC_CR2_ADON);
+
+  if (!(cr2 & ADC_CR2_ADON) || !(cr2 & ADC_CR2_EXTTRIG))
+    return;
+
+  for (int rank = 0; rank < n; rank++)
+  {
+    uint32_t value = prvAdcConvert(ADC1, &adcSr[0], rank);
+    if (dual)
+    {
+      const int32_t code = prvAdcConvert(ADC2, &adcSr[1], rank);
+      ADC2->DR = code;
+      value |= (uint32_t)code << 16;
+    }
+
+    ADC1->DR = value;
+    if (cr2 & ADC_CR2_DMA)
+      prvDmaRequest(0, &value);
+  }
+  prvDispatch();
+}
+
+static void prvAdcStep()
+{
+  // One scan per period of TIM1, on its channel 1 compare
+  const uint64_t period_ns =
+    (uint64_t)(TIM1->ARR + 1) * (TIM1->PSC + 1) * 1000 / SIM_CYCLES_PER_US;
+
+  if (!(TIM1->CR1 & TIM_CR1_CEN) || !period_ns)
+    return;
+  adcPhaseNs += SIM_STEP_NS;
+  while (adcPhaseNs >= period_ns)
+  {
+    adcPhaseNs -= period_ns;
+    prvAdcScan();
+  }
+}
+
+// USART1 on the pty
+// -----------------
+
+static double prvUartBytesPerStep()
+{
+  const uint32_t brr = USART1->BRR;
+  const double bauds = brr ? 72e6 / brr : SIM_UART_BAUDS;
+
+  // 8N1: 10 bits a byte
+  return bauds / 10 * SIM_STEP_NS / 1e9;
+}
+
+static void prvUartStep()
+{
+  const uint32_t cr1 = USART1->CR1;
+  const uint32_t cr3 = USART1->CR3;
+  const double bytes = prvUartBytesPerStep();
+  uint8_t out[SIM_UART_BURST_MAX];
+  int n = 0, received = 0;
+  uint32_t value;
+
+  if (!(cr1 & USART_CR1_UE))
+    return;
+
+  // Transmitter: the TX DMA requests as fast as the line goes. The bytes
+  // nobody reads are lost, as on the wire.
+  uartTxCredit += bytes;
+  if (uartTxCredit > SIM_UART_BURST_MAX)
+    uartTxCredit = SIM_UART_BURST_MAX;
+  while (uartTxCredit >= 1 && (cr1 & USART_CR1_TE) && (cr3 & USART_CR3_DMAT) &&
+         prvDmaRequest(3, &value))
+  {
+    out[n++] = value;
+    uartTxCredit -= 1;
+  }
+  if (n && write(pty, out, n) < 0 && errno != EAGAIN)
+    vSimLog("uart: write failed");
+  if (n)
+    prvDispatch();
+
+  // Receiver: to the RX DMA, left in the pty until it runs
+  uartRxCredit += bytes;
+  if (uartRxCredit > SIM_UART_BURST_MAX)
+    uartRxCredit = SIM_UART_BURST_MAX;
+  if (!(cr1 & USART_CR1_RE) || !(cr3 & USART_CR3_DMAR) || !dma[4].active)
+    return;
+  if (!uartFifoCount)
+  {
+    const ssize_t r = read(pty, uartFifo, sizeof (uartFifo));
+    uartFifoHead = 0;
+    uartFifoCount = r > 0 ? r : 0;
+  }
+  while (uartRxCredit >= 1 && uartFifoCount)
+  {
+    value = uartFifo[uartFifoHead];
+    if (!prvDmaRequest(4, &value))
+      break;
+    uartFifoHead++;
+    uartFifoCount--;
+    uartRxCredit -= 1;
+    received++;
+  }
+
+  // A quiet step after bytes: idle line
+  if (received || uartFifoCount)
+    uartReceiving = 1;
+  else if (uartReceiving)
+  {
+    uartReceiving = 0;
+    USART1->SR |= USART_SR_IDLE;
+  }
+  prvDispatch();
+}
+
+// TIM3 and the sonars
+// -------------------
+
+static int prvTim3Capture(int channel_)
+{
+  const uint16_t ccmr = channel_ < 2 ? TIM3->CCMR1 : TIM3->CCMR2;
+
+  return ((ccmr >> (8 * (channel_ & 1))) & 3) == 1;
+}
+
+// Next event of a channel after from_, up to to_: 0 when none
+static uint64_t prvTim3Next(int channel_, uint64_t from_, uint64_t to_)
+{
+  const uint64_t modulo = (uint64_t)TIM3->ARR + 1;
+  const uint16_t ccer = TIM3->CCER >> (4 * channel_);
+  uint64_t at = 0;
+
+  if (!prvTim3Capture(channel_))
+  {
+    // Compare match of the counter
+    const uint64_t ccr = *(&TIM3->CCR1 + 2 * channel_) % modulo;
+    at = from_ + 1 + (ccr + modulo - (from_ + 1) % modulo) % modulo;
+  }
+  else if (ccer & TIM_CCER_CC1E)
+    at = (ccer & TIM_CCER_CC1P) ? echoFall[channel_] : echoRise[channel_];
+
+  // The unheard edges are gone
+  if (echoRise[channel_] && echoRise[channel_] <= from_)
+    echoRise[channel_] = 0;
+  if (echoFall[channel_] && echoFall[channel_] <= from_)
+    echoFall[channel_] = 0;
+
+  return at > from_ && at <= to_ ? at : 0;
+}
+
+static void prvTim3Step(uint64_t now_ns_)
+{
+  // Sonar of each channel: TIM3 fully remapped on PC6..PC9
+  static const int sonars[4] = { SONAR_LEFT, SONAR_RIGHT, SONAR_CENTER, -1 };
+  const uint64_t psc = (uint64_t)TIM3->PSC + 1;
+  const uint64_t ticks = now_ns_ * SIM_CYCLES_PER_US / 1000 / psc;
+  const uint64_t ticks_per_us = SIM_CYCLES_PER_US / psc ? SIM_CYCLES_PER_US / psc : 1;
+  uint64_t from = tim3Ticks;
+
+  tim3Ticks = ticks;
+  if (!(TIM3->CR1 & TIM_CR1_CEN))
+    return;
+
+  // Events in time order, the simultaneous ones in the same interrupt
+  for (;;)
+  {
+    uint64_t at = 0;
+    for (int c = 0; c < 4; c++)
+    {
+      const uint64_t next = prvTim3Next(c, from, ticks);
+      if (next && (!at || next < at))
+        at = next;
+    }
+    if (!at)
+      break;
+
+    for (int c = 0; c < 4; c++)
+    {
+      if (prvTim3Next(c, from, ticks) != at)
+        continue;
+      if (prvTim3Capture(c))
+      {
+        *(&TIM3->CCR1 + 2 * c) = at % ((uint64_t)TIM3->ARR + 1);
+        if (at == echoRise[c])
+          echoRise[c] = 0;
+        else
+          echoFall[c] = 0;
+      }
+      // End of a trigger pulse: the sonar answers
+      else if ((GPIOC->ODR & (1 << (6 + c))) && sonars[c] >= 0)
+      {
+        const int us = iSimWorldSonarUs(sonars[c]);
+        echoRise[c] = at + SIM_SONAR_DELAY_US * ticks_per_us;
+        echoFall[c] = echoRise[c] +
+          (us ? us : SIM_SONAR_TIMEOUT_US) * ticks_per_us;
+      }
+      tim3Sr |= TIM_SR_CC1IF << c;
+    }
+    TIM3->SR = tim3Sr;
+    TIM3->CNT = at % ((uint64_t)TIM3->ARR + 1);
+    prvDispatch();
+    from = at;
+  }
+  TIM3->CNT = ticks % ((uint64_t)TIM3->ARR + 1);
+}
+
+// I2C1 slave, read by a simulated master
+// --------------------------------------
+
+static void prvI2CStop(int ok_)
+{
+  I2C1->SR2 = 0;
+  i2cState = SIM_I2C_IDLE;
+  if (!ok_)
+    i2cErrors++;
+  else if (i2cData[0] != REGMAP_DEVICE_ID)
+  {
+    // Before the first answer, the register file may not be filled yet
+    if (i2cReads && !i2cErrors++)
+      vSimLog("i2c: register 0 reads 0x%02x", i2cData[0]);
+  }
+  else if (!i2cReads++)
+    vSimLog("i2c: board answers at 0x%02x", (I2C1->OAR1 >> 1) & 0x7f);
+}
+
+static void prvI2CStep(uint64_t now_ns_)
+{
+  uint32_t value;
+
+  if (i2cState != SIM_I2C_IDLE && now_ns_ - i2cStallNs > SIM_I2C_STALL_NS)
+  {
+    // Clock stretched for too long: the master gives up
+    prvI2CStop(0);
+    return;
+  }
+
+  // One byte time per step, about 100 kHz
+  switch (i2cState)
+  {
+  case SIM_I2C_IDLE:
+    if (now_ns_ < i2cNextNs || !(I2C1->CR1 & I2C_CR1_PE))
+      return;
+    i2cNextNs = now_ns_ + SIM_I2C_PERIOD_MS * 1000000ull;
+    i2cStallNs = now_ns_;
+    // Write of the register pointer
+    I2C1->SR2 = I2C_SR2_BUSY;
+    i2cSr1 |= I2C_SR1_ADDR;
+    I2C1->SR1 = i2cSr1;
+    i2cState = SIM_I2C_POINTER;
+    break;
+
+  case SIM_I2C_POINTER:
+    value = 0;
+    if (!((I2C1->CR2 & I2C_CR2_DMAEN) && prvDmaRequest(6, &value)))
+    {
+      i2cSr1 |= I2C_SR1_RXNE;
+      I2C1->SR1 = i2cSr1;
+    }
+    i2cState = SIM_I2C_RESTART;
+    break;
+
+  case SIM_I2C_RESTART:
+    I2C1->SR2 = I2C_SR2_BUSY | I2C_SR2_TRA;
+    i2cSr1 |= I2C_SR1_ADDR;
+    I2C1->SR1 = i2cSr1;
+    i2cIndex = 0;
+    i2cState = SIM_I2C_READ;
+    break;
+
+  case SIM_I2C_READ:
+    if (!((I2C1->CR2 & I2C_CR2_DMAEN) && prvDmaRequest(5, &value)))
+    {
+      // Past the register file: padded by the handler, SCL stretched
+      // until the buffer interrupt is enabled
+      if (!(I2C1->CR2 & I2C_CR2_ITBUFEN))
+        break;
+      i2cSr1 |= I2C_SR1_TXE;
+      I2C1->SR1 = i2cSr1;
+      prvDispatch();
+      i2cSr1 &= ~I2C_SR1_TXE;
+      I2C1->SR1 = i2cSr1;
+      value = I2C1->DR;
+    }
+    i2cData[i2cIndex++] = value;
+    i2cStallNs = now_ns_;
+    if (i2cIndex < (int)sizeof (i2cData))
+      break;
+    // Last byte not acknowledged, then the stop
+    i2cSr1 |= I2C_SR1_AF;
+    I2C1->SR1 = i2cSr1;
+    prvDispatch();
+    prvI2CStop(1);
+    break;
+  }
+  prvDispatch();
+}
+
+void vSimPeriphInit(int pty_)
+{
+  static DMA_Channel_TypeDef* const channels[7] =
+    {
+      DMA1_Channel1, DMA1_Channel2, DMA1_Channel3, DMA1_Channel4,
+      DMA1_Channel5, DMA1_Channel6, DMA1_Channel7
+    };
+
+  pty = pty_;
+  for (int c = 0; c < 7; c++)
+    dma[c].regs = channels[c];
+
+  for (int i = 0; i < 2; i++)
+  {
+    vSimWatch(&NVIC->ISER[i]);
+    vSimWatch(&NVIC->ICER[i]);
+  }
+  for (unsigned p = 0; p < SIM_PORTS_NB; p++)
+  {
+    vSimWatch(&ports[p]->BSRR);
+    vSimWatch(&ports[p]->BRR);
+  }
+  vSimWatch(&DMA1->IFCR);
+  vSimWatchWrites(&CRC->DR, prvCrcData);
+  vSimWatchWrites(&CRC->CR, prvCrcControl);
+  CRC->DR = crc;
+
+  // Oscillators ready at once, the transmitter always empty
+  RCC->CR |= RCC_CR_HSERDY | RCC_CR_PLLRDY;
+  USART1->SR = USART_SR_TXE | USART_SR_TC;
+  I2C1->SR1 = 0;
+
+  // Pull-ups: released bumpers, the right encoder at rest
+  prvGpioDrive(1, 0, 1);
+  prvGpioDrive(1, 1, 1);
+  prvGpioDrive(0, 4, 1);
+  prvGpioDrive(1, 12, 0);
+  prvGpioDrive(1, 13, 0);
+  rightPosition = iSimWorldEncoder(SIM_WHEEL_RIGHT);
+}
+
+void vSimPeriphStep(uint64_t now_ns_, int interrupts_)
+{
+  interrupts = interrupts_;
+  prvSync();
+  prvMotorsStep(now_ns_);
+  prvEncodersStep();
+  prvBumpersStep();
+  prvTim3Step(now_ns_);
+  prvAdcStep();
+  prvUartStep();
+  prvMem2MemStep();
+  if (interrupts)
+    prvI2CStep(now_ns_);
+  prvDispatch();
+}
@@ -0,0 +1,100 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FreeRTOS.h"
+
+#include "libglobal/protocol.h"
+#include "libperiph/sharps.h"
+#include "libperiph/sonar.h"
+
+#include "sim/sim.h"
+
+// Binary telemetry log of the monitor (wtools/telemetry.py RECORD): the
+// host time, then the frame as sent
+typedef struct
+{
+  double host_s;
+  proto_telemetry_t frame;
+} __attribute__((packed)) sim_record_t;
+
+// The first record holds until the firmware runs its sensors
+#define SIM_REPLAY_START_NS 1000000000ull
+
+static sim_record_t* records;
+static size_t recordsNb;
+static size_t current;
+// Record times, from the tick of the first one, unwrapped
+static uint64_t* recordNs;
+
+int xSimReplayInit()
+{
+  const char* path = getenv("SWIFTLER_SIM_REPLAY");
+  FILE* file;
+  long size;
+
+  if (!path)
+    return 0;
+  file = fopen(path, "rb");
+  if (!file || fseek(file, 0, SEEK_END) < 0 || (size = ftell(file)) < 0)
+  {
+    perror(path);
+    exit(1);
+  }
+  rewind(file);
+  recordsNb = size / sizeof (sim_record_t);
+  records = malloc(recordsNb * sizeof (sim_record_t));
+  recordNs = malloc(recordsNb * sizeof (uint64_t));
+  if (!recordsNb || !records || !recordNs ||
+      fread(records, sizeof (sim_record_t), recordsNb, file) != recordsNb)
+  {
+    fprintf(stderr, "sim: %s: no telemetry records\n", path);
+    exit(1);
+  }
+  fclose(file);
+
+  // Ticks of 1 ms, wrapping at 32 bits
+  uint64_t ns = SIM_REPLAY_START_NS;
+  recordNs[0] = ns;
+  for (size_t i = 1; i < recordsNb; i++)
+  {
+    ns += (uint32_t)(records[i].frame.tick - records[i - 1].frame.tick) *
+      (1000000000ull / configTICK_RATE_HZ);
+    recordNs[i] = ns;
+  }
+  fprintf(stderr, "sim: replay of %s, %u records, %.1f s\n", path,
+          (unsigned)recordsNb, (ns - SIM_REPLAY_START_NS) / 1e9);
+  return 1;
+}
+
+int xSimReplayAt(uint64_t now_ns_, sim_replay_t* state_)
+{
+  while (current + 1 < recordsNb && recordNs[current + 1] <= now_ns_)
+    current++;
+  if (current + 1 == recordsNb && now_ns_ > recordNs[current])
+    return 0;
+
+  // Distances and power held from the last record, as sampled
+  const proto_telemetry_t* last = &records[current].frame;
+  state_->sonar_mm[SONAR_LEFT] = last->sonar_left_mm;
+  state_->sonar_mm[SONAR_CENTER] = last->sonar_mm;
+  state_->sonar_mm[SONAR_RIGHT] = last->sonar_right_mm;
+  state_->sharp_mm[SHARP_LEFT] = last->sharp_left_mm;
+  state_->sharp_mm[SHARP_RIGHT] = last->sharp_right_mm;
+  state_->battery_mv = last->battery_mv;
+  state_->current_ma = last->current_ma;
+
+  // The pose interpolated to the next one: steady wheel counts
+  const proto_telemetry_t* next =
+    current + 1 < recordsNb ? &records[current + 1].frame : last;
+  const double span = current + 1 < recordsNb ?
+    (double)(recordNs[current + 1] - recordNs[current]) : 1;
+  const double f = now_ns_ < recordNs[current] ? 0 :
+    (now_ns_ - recordNs[current]) / span;
+  const double turn = remainder((next->theta_mrad - last->theta_mrad) / 1000.0,
+                                2 * M_PI);
+  state_->x_mm = last->x_mm + f * (int16_t)(next->x_mm - last->x_mm);
+  state_->y_mm = last->y_mm + f * (int16_t)(next->y_mm - last->y_mm);
+  state_->heading = last->theta_mrad / 1000.0 + f * turn;
+  return 1;
+}
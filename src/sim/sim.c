@@ -0,0 +1,461 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "boot/boot.h"
+
+#include "libperiph/mcu.h"
+
+#include "sim/sim.h"
+
+// Memory of the STM32F103 (libperiph/mcu.h), at its own addresses: the
+// firmware and the StdPeriph library use them as they are.
+#define SIM_FLASH_BASE  MCU_FLASH_BASE
+#define SIM_FLASH_SIZE  MCU_FLASH_SIZE
+
+static const struct
+{
+  uintptr_t base;
+  size_t size;
+  int alias;                         // Also at SIM_ALIAS_OFFSET
+} regions[] =
+  {
+    { MCU_RAM_BASE, MCU_RAM_SIZE, 0 }, // SRAM
+    { 0x40000000, 0x30000, 1 },      // APB1, APB2, AHB
+    { 0x42000000, 0x2000000, 0 },    // Peripheral bit-band alias
+    { 0xE0000000, 0x100000, 1 },     // Core: DWT, NVIC, SysTick, SCB, DBGMCU
+  };
+
+// Pages of the write-1 registers, read only for the firmware: AFIO, EXTI,
+// GPIOA, GPIOB; GPIOC, GPIOD; DMA1; CRC; NVIC, SCB
+static const uintptr_t watchedPages[] =
+  { 0x40010000, 0x40011000, 0x40020000, 0x40023000, 0xE000E000 };
+
+#define SIM_PAGE_SIZE 4096
+#define SIM_WATCH_MAX 16
+// Trap flag: single step
+#define SIM_EFLAGS_TF 0x100
+
+#define SIM_FLASH_DEFAULT "swiftler-sim.flash"
+// Pty kept across the simulated resets: "master,slave" descriptors
+#define SIM_PTY_ENV "SWIFTLER_SIM_PTY"
+// Lag behind the host clock worth a warning
+#define SIM_LAG_WARNING_NS 100000000
+// Unpaced: longest wait of a step for the firmware to sleep, for a task
+// that computes or busy waits
+#define SIM_BUSY_MAX_NS 200000
+
+// Host time of the simulated time 0
+static uint64_t startNs;
+// Simulated time per host time, 0 unpaced
+static double speed = 1.0;
+
+// Simulated time and host time of the step being run, the pair whole
+// with an even sequence count
+static volatile uint64_t stepNs, stepHostNs;
+static volatile uint32_t stepSequence;
+
+static volatile int ticking;
+// SysTick counted down, its handler not run yet (PENDSTSET)
+static int tickPending;
+
+static char** savedArgv;
+
+// Write-1 registers (alias addresses), and what the firmware wrote there
+static volatile uint32_t* watched[SIM_WATCH_MAX];
+static uint32_t written[SIM_WATCH_MAX];
+// Or run on each write, in the firmware thread
+static void (*onWrite[SIM_WATCH_MAX])(uint32_t value_);
+static int watchedNb;
+
+// A write of the firmware being stepped, one at a time
+static int trapLock;
+static __thread uintptr_t trapPage;
+
+// Provided by the firmware (FreeRTOS port, libglobal/fault.c)
+extern void SysTick_Handler(void);
+extern void HardFault_Handler(void) __attribute__((weak));
+
+static uint64_t prvHostNs()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// The step time, and within the step the host time since it began, for
+// the busy waits. Never past the next step: the core clock, ticks and
+// peripherals agree, also when the steps are late.
+uint64_t uSimTimeNs()
+{
+  uint64_t step, host, within;
+  uint32_t sequence;
+
+  do
+  {
+    sequence = __atomic_load_n(&stepSequence, __ATOMIC_SEQ_CST);
+    step = stepNs;
+    host = stepHostNs;
+  }
+  while ((sequence & 1) ||
+         sequence != __atomic_load_n(&stepSequence, __ATOMIC_SEQ_CST));
+
+  const uint64_t now = prvHostNs();
+  within = now > host ? (uint64_t)((now - host) * (speed > 0 ? speed : 1)) : 0;
+  if (within >= SIM_STEP_NS)
+    within = SIM_STEP_NS - 1;
+  return step + within;
+}
+
+static void prvStepBegin(uint64_t step_ns_)
+{
+  __atomic_add_fetch(&stepSequence, 1, __ATOMIC_SEQ_CST);
+  stepNs = step_ns_;
+  stepHostNs = prvHostNs();
+  __atomic_add_fetch(&stepSequence, 1, __ATOMIC_SEQ_CST);
+}
+
+uint32_t uSimCycles()
+{
+  return (uint32_t)(uSimTimeNs() * SIM_CYCLES_PER_US / 1000);
+}
+
+void vSimLog(const char* format_, ...)
+{
+  char line[256];
+  va_list args;
+  int n;
+
+  n = snprintf(line, sizeof (line), "sim %8.3f: ", uSimTimeNs() / 1e9);
+  va_start(args, format_);
+  n += vsnprintf(line + n, sizeof (line) - n - 1, format_, args);
+  va_end(args);
+  if (n > (int)sizeof (line) - 2)
+    n = sizeof (line) - 2;
+  line[n++] = '\n';
+  // Also from the fault path: a single write
+  if (write(STDERR_FILENO, line, n) < 0)
+    return;
+}
+
+static void prvDie(const char* what_)
+{
+  fprintf(stderr, "sim: %s: %s\n", what_, strerror(errno));
+  exit(1);
+}
+
+static void prvMap(uintptr_t base_, size_t size_, int fd_)
+{
+  void* p = mmap((void*)base_, size_, PROT_READ | PROT_WRITE,
+                 MAP_FIXED_NOREPLACE | (fd_ < 0 ? MAP_PRIVATE | MAP_ANONYMOUS
+                                                : MAP_SHARED), fd_, 0);
+
+  if (p != (void*)base_)
+    prvDie("memory map");
+}
+
+// Memory shared by both addresses of an aliased region
+static void prvRegionInit(uintptr_t base_, size_t size_, int alias_)
+{
+  int fd = -1;
+
+  if (alias_)
+  {
+    fd = memfd_create("swiftler-sim", 0);
+    if (fd < 0 || ftruncate(fd, size_) < 0)
+      prvDie("memory map");
+  }
+  prvMap(base_, size_, fd);
+  if (alias_)
+  {
+    prvMap(base_ + SIM_ALIAS_OFFSET, size_, fd);
+    close(fd);
+  }
+}
+
+static void prvFlashInit()
+{
+  const char* path = getenv("SWIFTLER_SIM_FLASH");
+  const int fd = open(path ? path : SIM_FLASH_DEFAULT, O_RDWR | O_CREAT, 0644);
+  const off_t size = fd < 0 ? 0 : lseek(fd, 0, SEEK_END);
+
+  if (fd < 0)
+    prvDie("flash image");
+  if (size != SIM_FLASH_SIZE && ftruncate(fd, SIM_FLASH_SIZE) < 0)
+    prvDie("flash image");
+  prvMap(SIM_FLASH_BASE, SIM_FLASH_SIZE, fd);
+  close(fd);
+  // A new image is erased
+  if (size == 0)
+    memset((void*)SIM_FLASH_BASE, 0xff, SIM_FLASH_SIZE);
+}
+
+static int prvPtyInit()
+{
+  const char* env = getenv(SIM_PTY_ENV);
+  const char* link = getenv("SWIFTLER_SIM_TTY");
+  struct termios termios;
+  int master, slave;
+  char value[32];
+
+  // Same pty after a simulated reset, the host tools stay connected
+  if (env && sscanf(env, "%d,%d", &master, &slave) == 2)
+    return master;
+
+  master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+    prvDie("pty");
+  const char* name = ptsname(master);
+  // Held open: no hang up when a client closes it, raw as the UART is
+  slave = open(name, O_RDWR | O_NOCTTY);
+  if (slave < 0 || tcgetattr(slave, &termios) < 0)
+    prvDie(name);
+  cfmakeraw(&termios);
+  tcsetattr(slave, TCSANOW, &termios);
+
+  snprintf(value, sizeof (value), "%d,%d", master, slave);
+  setenv(SIM_PTY_ENV, value, 1);
+
+  if (link)
+  {
+    unlink(link);
+    if (symlink(name, link) < 0)
+      prvDie(link);
+  }
+  fprintf(stderr, "sim: USART1 on %s%s%s\n", name, link ? ", linked as " : "",
+          link ? link : "");
+  return master;
+}
+
+static void prvHardwareStep(int interrupts_)
+{
+  vSimWorldStep(stepNs);
+  vSimPeriphStep(stepNs, interrupts_);
+  if (interrupts_ && tickPending)
+  {
+    tickPending = 0;
+    SysTick_Handler();
+  }
+}
+
+static void prvInterruptStep()
+{
+  prvHardwareStep(1);
+}
+
+static void* prvHardwareThread(void* unused_)
+{
+  uint64_t sim_ns = 0, host_ns;
+  uint32_t steps = 0;
+  struct timespec deadline;
+  int warned = 0;
+
+  (void)unused_;
+  for (;;)
+  {
+    // Host time of the next step
+    sim_ns += SIM_STEP_NS;
+    // Unpaced from the kernel start on, the initialization busy waits
+    // in real time
+    if (speed > 0 || !ticking)
+    {
+      host_ns = startNs + (uint64_t)(sim_ns / (speed > 0 ? speed : 1));
+      deadline.tv_sec = host_ns / 1000000000;
+      deadline.tv_nsec = host_ns % 1000000000;
+      // Behind, no sleep at all: even a deadline past costs a wake up here
+      while (prvHostNs() < host_ns &&
+             clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)
+             == EINTR);
+
+      if (!warned && prvHostNs() > host_ns + SIM_LAG_WARNING_NS)
+      {
+        vSimLog("steps behind the host clock");
+        warned = 1;
+      }
+    }
+
+    prvStepBegin(sim_ns);
+    if (ticking && ++steps % SIM_TICK_STEPS == 0)
+      tickPending = 1;
+    // Masked: the peripherals run on (the busy waits of the initialization
+    // count on them), the interrupts wait for a later step
+    if (!xPortInterrupt(prvInterruptStep))
+      prvHardwareStep(0);
+
+    // Unpaced: the firmware done with the step before the next one, as a
+    // core infinitely fast
+    if (speed == 0 && ticking)
+    {
+      const uint64_t until = prvHostNs() + SIM_BUSY_MAX_NS;
+      while (!xPortWaitingForInterrupt() && prvHostNs() < until)
+        sched_yield();
+    }
+  }
+  return NULL;
+}
+
+// Called by xPortStartScheduler: the SysTick starts with the kernel
+void vPortSetupTimerInterrupt()
+{
+  ticking = 1;
+}
+
+void vSimReset()
+{
+  if (BOOT_REQUEST == BOOT_REQUEST_MAGIC)
+    vSimLog("reset to the bootloader, not simulated: application again");
+  else
+    vSimLog("reset");
+  // The pty and the flash image are kept, the rest starts over
+  execv("/proc/self/exe", savedArgv);
+  prvDie("reset");
+  for (;;);
+}
+
+void vSimWatch(volatile uint32_t* reg_)
+{
+  if (watchedNb == SIM_WATCH_MAX)
+  {
+    errno = ENOMEM;
+    prvDie("watched registers");
+  }
+  watched[watchedNb++] = reg_;
+}
+
+void vSimWatchWrites(volatile uint32_t* reg_, void (*write_)(uint32_t value_))
+{
+  vSimWatch(reg_);
+  onWrite[watchedNb - 1] = write_;
+}
+
+uint32_t uSimWritten(volatile uint32_t* reg_)
+{
+  for (int i = 0; i < watchedNb; i++)
+    if (watched[i] == reg_)
+      return __atomic_exchange_n(&written[i], 0, __ATOMIC_SEQ_CST) |
+        __atomic_exchange_n(reg_, 0, __ATOMIC_SEQ_CST);
+  return 0;
+}
+
+static uintptr_t prvWatchedPage(uintptr_t address_)
+{
+  const uintptr_t page = address_ & ~(uintptr_t)(SIM_PAGE_SIZE - 1);
+
+  for (size_t p = 0; p < sizeof (watchedPages) / sizeof (watchedPages[0]); p++)
+    if (watchedPages[p] == page)
+      return page;
+  return 0;
+}
+
+static void prvWatchedProtect(int protection_)
+{
+  for (size_t p = 0; p < sizeof (watchedPages) / sizeof (watchedPages[0]); p++)
+    if (mprotect((void*)watchedPages[p], SIM_PAGE_SIZE, protection_) < 0)
+      prvDie("memory protection");
+}
+
+// A crash of the firmware, as the HardFault of the board: recorded, then
+// a reset
+static void prvFault(int signal_)
+{
+  vSimLog("fault: signal %d", signal_);
+  if (HardFault_Handler)
+    HardFault_Handler();
+  _exit(1);
+}
+
+// A write to a watched page: done again on the page made writable, one
+// instruction, then prvTrap takes what it wrote
+static void prvSegv(int signal_, siginfo_t* info_, void* context_)
+{
+  ucontext_t* context = context_;
+  const uintptr_t page = prvWatchedPage((uintptr_t)info_->si_addr);
+
+  if (!page || !(context->uc_mcontext.gregs[REG_ERR] & 2))
+    prvFault(signal_);
+
+  while (__atomic_exchange_n(&trapLock, 1, __ATOMIC_ACQUIRE))
+    ;
+  trapPage = page;
+  mprotect((void*)page, SIM_PAGE_SIZE, PROT_READ | PROT_WRITE);
+  context->uc_mcontext.gregs[REG_EFL] |= SIM_EFLAGS_TF;
+}
+
+static void prvTrap(int signal_, siginfo_t* info_, void* context_)
+{
+  ucontext_t* context = context_;
+
+  (void)signal_;
+  (void)info_;
+  context->uc_mcontext.gregs[REG_EFL] &= ~SIM_EFLAGS_TF;
+  if (!trapPage)
+    return;
+
+  // Each write acted on, the register reads 0 again
+  for (int i = 0; i < watchedNb; i++)
+  {
+    const uintptr_t address = (uintptr_t)watched[i] - SIM_ALIAS_OFFSET;
+    if ((address & ~(uintptr_t)(SIM_PAGE_SIZE - 1)) != trapPage)
+      continue;
+    const uint32_t value = __atomic_exchange_n(watched[i], 0, __ATOMIC_SEQ_CST);
+    if (onWrite[i])
+      onWrite[i](value);
+    else
+      __atomic_or_fetch(&written[i], value, __ATOMIC_SEQ_CST);
+  }
+  mprotect((void*)trapPage, SIM_PAGE_SIZE, PROT_READ);
+  trapPage = 0;
+  __atomic_store_n(&trapLock, 0, __ATOMIC_RELEASE);
+}
+
+__attribute__((constructor))
+static void prvSimInit(int argc_, char** argv_)
+{
+  const char* env = getenv("SWIFTLER_SIM_SPEED");
+  struct sigaction action;
+  pthread_t thread;
+  sigset_t all;
+
+  (void)argc_;
+  savedArgv = argv_;
+  startNs = prvHostNs();
+  if (env && atof(env) >= 0)
+    speed = atof(env);
+
+  // Left blocked by the signal handler of a crash before the reset
+  sigemptyset(&all);
+  sigprocmask(SIG_SETMASK, &all, NULL);
+  memset(&action, 0, sizeof (action));
+  action.sa_sigaction = prvSegv;
+  action.sa_flags = SA_SIGINFO | SA_NODEFER;
+  sigaction(SIGSEGV, &action, NULL);
+  action.sa_sigaction = prvTrap;
+  sigaction(SIGTRAP, &action, NULL);
+  signal(SIGBUS, prvFault);
+  signal(SIGPIPE, SIG_IGN);
+
+  for (size_t i = 0; i < sizeof (regions) / sizeof (regions[0]); i++)
+    prvRegionInit(regions[i].base, regions[i].size, regions[i].alias);
+  prvFlashInit();
+
+  vSimWorldInit();
+  vSimPeriphInit(prvPtyInit());
+  prvWatchedProtect(PROT_READ);
+
+  if (pthread_create(&thread, NULL, prvHardwareThread, NULL) != 0)
+    prvDie("hardware thread");
+}
@@ -0,0 +1,89 @@
+#ifndef SIM_SIM_H
+# define SIM_SIM_H
+
+#include <stdint.h>
+
+// Host simulation of the board: the firmware runs unchanged on the Posix
+// port of FreeRTOS, over the memory of the STM32F103 mapped at its own
+// addresses. One hardware thread advances the simulated time by steps,
+// runs the models of the peripherals against their registers, then the
+// handlers of the interrupts they raise, under the interrupt mask. While
+// the firmware holds the mask, the models run on and the interrupts stay
+// pending, as on the board.
+//
+// Environment:
+//   SWIFTLER_SIM_SPEED  simulated time per host time, 1 by default, 0 as
+//                       fast as the firmware goes (each step waits for
+//                       the idle task)
+//   SWIFTLER_SIM_TTY    link to the pty of USART1, for the host tools
+//   SWIFTLER_SIM_FLASH  flash image, kept across runs (swiftler-sim.flash)
+//   SWIFTLER_SIM_REPLAY binary telemetry log ("waf monitor --telemetry
+//                       run.bin") played instead of the arena
+
+// Hardware step, SysTick every SIM_TICK_STEPS
+#define SIM_STEP_NS    100000
+#define SIM_TICK_STEPS 10
+
+// Core clock, as the DWT counter
+#define SIM_CYCLES_PER_US 72
+
+// Simulated time since the start, in ns
+uint64_t uSimTimeNs();
+uint32_t uSimCycles();
+
+void vSimLog(const char* format_, ...)
+  __attribute__((format(printf, 1, 2)));
+
+// Second mapping of the peripheral and core registers, for the models.
+// The pages with write-1 registers (set, clear) are read only at their
+// own address: each firmware write there is stepped and caught.
+#define SIM_ALIAS_OFFSET 0x10000000
+
+// Write-1 register, at its alias address: the values the firmware wrote
+// since the last call, ORed, the register reads 0
+void vSimWatch(volatile uint32_t* reg_);
+uint32_t uSimWritten(volatile uint32_t* reg_);
+// Register fed a stream of values (FIFO, accumulator): write_ takes each
+// of them at once, in the firmware thread, and sets what it reads
+void vSimWatchWrites(volatile uint32_t* reg_, void (*write_)(uint32_t value_));
+
+// Peripheral models (sim/periph.c), run by the hardware thread
+void vSimPeriphInit(int pty_);
+// Step, with the handlers of the interrupts when interrupts_ is set
+void vSimPeriphStep(uint64_t now_ns_, int interrupts_);
+
+// Robot and arena (sim/world.c)
+void vSimWorldInit();
+void vSimWorldStep(uint64_t now_ns_);
+// Motor commands: duty in [-1, 1], 0 when the bridge is off
+void vSimWorldMotors(double left_, double right_);
+// Wheel positions, in encoder counts
+int32_t iSimWorldEncoder(int wheel_);
+// Analog input, in mV at the pin of the ADC channel
+int iSimWorldAnalogMv(int channel_);
+// Echo time of a sonar, in us, 0 without any obstacle in range
+int iSimWorldSonarUs(int sonar_);
+// Bumper switches, non zero when pressed
+int iSimWorldBumper(int bumper_);
+
+#define SIM_WHEEL_LEFT  0
+#define SIM_WHEEL_RIGHT 1
+
+// Recorded run (sim/replay.c), from 1 s of simulated time on: the sensors
+// read the recorded distances and power, the wheels follow the recorded
+// pose whatever the motors do. The simulation ends with the log; "waf
+// monitor --port <SWIFTLER_SIM_TTY> --telemetry" records what it made of it.
+typedef struct
+{
+  double x_mm, y_mm, heading;
+  int sonar_mm[3];                   // By SONAR_x, -1 without any echo
+  int sharp_mm[2];                   // By SHARP_x, -1 out of range
+  int battery_mv, current_ma;
+} sim_replay_t;
+
+// Non zero when SWIFTLER_SIM_REPLAY names a log, loaded
+int xSimReplayInit();
+// The recorded state at now_ns_, 0 past the last record
+int xSimReplayAt(uint64_t now_ns_, sim_replay_t* state_);
+
+#endif /* SIM_SIM_H */
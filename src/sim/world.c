@@ -0,0 +1,325 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "libglobal/odometry.h"
+#include "libperiph/adc.h"
+#include "libperiph/bumpers.h"
+#include "libperiph/power.h"
+#include "libperiph/sharps.h"
+#include "libperiph/sonar.h"
+
+#include "sim/sim.h"
+
+// The robot in a walled arena with one box, on a flat floor. Distances
+// in mm, angles in radians counterclockwise, wheel speeds in encoder
+// counts per second.
+
+#define ARENA_X_MM 3000.0
+#define ARENA_Y_MM 2000.0
+
+static const struct
+{
+  double x0, y0, x1, y1;
+} boxes[] =
+  {
+    { 0, 0, ARENA_X_MM, ARENA_Y_MM },   // Walls, from inside
+    { 2100, 800, 2400, 1100 },          // Box
+  };
+
+#define BOXES_NB (sizeof (boxes) / sizeof (boxes[0]))
+
+#define ROBOT_RADIUS_MM 120.0
+
+// DC motors: no load speed at full duty, above the PID maximum, and the
+// time constant of the speed response
+#define MOTOR_NO_LOAD_CPS 10000.0
+#define MOTOR_TAU_S       0.05
+
+// Battery, and the currents drawn: electronics, motors running, motors
+// stalled against an obstacle (beyond the default current limit)
+#define BATTERY_MV        7400
+#define BATTERY_MOHM      200
+#define IDLE_MA           150.0
+#define MOTOR_RUNNING_MA  400.0
+#define MOTOR_STALLED_MA  1500.0
+
+// Sensor directions from the heading
+#define SONAR_SIDE_ANGLE  (M_PI / 6)
+#define SHARP_SIDE_ANGLE  (M_PI / 3)
+#define SONAR_RANGE_MM    4000.0
+#define SHARP_NEAR_MM     36.0
+
+// Sharp output: V ~ K / (d + D0), fitted on the table of libperiph/sharps.c
+#define SHARP_K_MV_MM     129700.0
+#define SHARP_D0_MM       7.4
+// Past the range of the sharps, for the replay of an out of range reading
+#define SHARP_FAR_MM      2000.0
+
+// ADC channels of the analog inputs (libperiph/sharps.c, power.c)
+#define CHANNEL_SHARP_LEFT  6
+#define CHANNEL_SHARP_RIGHT 13
+#define CHANNEL_CURRENT     12
+#define CHANNEL_BATTERY     14
+#define CHANNEL_TEMP        16
+#define CHANNEL_VREFINT     17
+
+static double x, y, heading;
+static double duty[2], speed[2], position[2];
+static int stalled;
+static int bumper[BUMPERS_NB];
+static uint64_t lastNs;
+
+// Recorded run in place of the arena
+static int replaying;
+static sim_replay_t replay;
+
+// Distance to the first wall or box along a ray, beyond range_ if none
+static double prvRaycast(double angle_, double range_)
+{
+  const double dx = cos(angle_), dy = sin(angle_);
+  double best = range_ + 1;
+
+  for (unsigned b = 0; b < BOXES_NB; b++)
+  {
+    const double xs[2] = { boxes[b].x0, boxes[b].x1 };
+    const double ys[2] = { boxes[b].y0, boxes[b].y1 };
+    for (int i = 0; i < 2; i++)
+    {
+      if (dx != 0)
+      {
+        const double t = (xs[i] - x) / dx;
+        const double yt = y + t * dy;
+        if (t > 0 && t < best && yt >= boxes[b].y0 && yt <= boxes[b].y1)
+          best = t;
+      }
+      if (dy != 0)
+      {
+        const double t = (ys[i] - y) / dy;
+        const double xt = x + t * dx;
+        if (t > 0 && t < best && xt >= boxes[b].x0 && xt <= boxes[b].x1)
+          best = t;
+      }
+    }
+  }
+  return best;
+}
+
+// Point of contact with the robot at x_, y_, NAN when clear
+static double prvContactAngle(double x_, double y_)
+{
+  // Walls, from inside
+  if (x_ < ROBOT_RADIUS_MM)
+    return M_PI;
+  if (x_ > ARENA_X_MM - ROBOT_RADIUS_MM)
+    return 0;
+  if (y_ < ROBOT_RADIUS_MM)
+    return -M_PI / 2;
+  if (y_ > ARENA_Y_MM - ROBOT_RADIUS_MM)
+    return M_PI / 2;
+
+  // Boxes, from outside: the nearest point of the box
+  for (unsigned b = 1; b < BOXES_NB; b++)
+  {
+    const double nx = fmax(boxes[b].x0, fmin(x_, boxes[b].x1));
+    const double ny = fmax(boxes[b].y0, fmin(y_, boxes[b].y1));
+    if (hypot(nx - x_, ny - y_) < ROBOT_RADIUS_MM)
+      return atan2(ny - y_, nx - x_);
+  }
+  return NAN;
+}
+
+void vSimWorldInit()
+{
+  x = 800;
+  y = ARENA_Y_MM / 2;
+  heading = 0;
+
+  replaying = xSimReplayInit();
+  if (replaying)
+  {
+    xSimReplayAt(0, &replay);
+    x = replay.x_mm;
+    y = replay.y_mm;
+    heading = replay.heading;
+  }
+}
+
+void vSimWorldMotors(double left_, double right_)
+{
+  duty[SIM_WHEEL_LEFT] = left_;
+  duty[SIM_WHEEL_RIGHT] = right_;
+}
+
+// The wheels turned by the recorded motion, whatever the motors do
+static void prvReplayStep(uint64_t now_ns_)
+{
+  const double mm_per_count = ODOMETRY_UM_PER_COUNT / 1000.0;
+
+  if (!xSimReplayAt(now_ns_, &replay))
+  {
+    vSimLog("replay: end of the log");
+    exit(0);
+  }
+  const double turn = remainder(replay.heading - heading, 2 * M_PI);
+  const double forward = (replay.x_mm - x) * cos(heading + turn / 2) +
+    (replay.y_mm - y) * sin(heading + turn / 2);
+  position[SIM_WHEEL_LEFT] +=
+    (forward - turn * ODOMETRY_TRACK_MM / 2) / mm_per_count;
+  position[SIM_WHEEL_RIGHT] +=
+    (forward + turn * ODOMETRY_TRACK_MM / 2) / mm_per_count;
+  x = replay.x_mm;
+  y = replay.y_mm;
+  heading = replay.heading;
+}
+
+void vSimWorldStep(uint64_t now_ns_)
+{
+  if (replaying)
+  {
+    prvReplayStep(now_ns_);
+    return;
+  }
+
+  const double dt = (now_ns_ - lastNs) / 1e9;
+  const double mm_per_count = ODOMETRY_UM_PER_COUNT / 1000.0;
+  double moved[2];
+
+  lastNs = now_ns_;
+  for (int w = 0; w < 2; w++)
+  {
+    const double target = stalled ? 0 : duty[w] * MOTOR_NO_LOAD_CPS;
+    speed[w] += (target - speed[w]) * fmin(dt / MOTOR_TAU_S, 1);
+    moved[w] = speed[w] * dt;
+  }
+
+  // Differential drive
+  const double forward = (moved[0] + moved[1]) / 2 * mm_per_count;
+  const double turn = (moved[1] - moved[0]) * mm_per_count / ODOMETRY_TRACK_MM;
+  const double nx = x + forward * cos(heading + turn / 2);
+  const double ny = y + forward * sin(heading + turn / 2);
+  const double contact = prvContactAngle(nx, ny);
+
+  for (int b = 0; b < BUMPERS_NB; b++)
+    bumper[b] = 0;
+  if (isnan(contact))
+  {
+    x = nx;
+    y = ny;
+    heading = remainder(heading + turn, 2 * M_PI);
+    position[0] += moved[0];
+    position[1] += moved[1];
+    stalled = 0;
+    return;
+  }
+
+  // Against an obstacle: the wheels stall, the front bumpers close
+  // towards it. Backing off or turning away is still possible.
+  stalled = (duty[0] != 0 || duty[1] != 0) &&
+    cos(contact - heading) * (duty[0] + duty[1]) > 0;
+  const double side = remainder(contact - heading, 2 * M_PI);
+  if (fabs(side) < M_PI / 2)
+  {
+    bumper[BUMPER_LEFT] = side > -M_PI / 12;
+    bumper[BUMPER_RIGHT] = side < M_PI / 12;
+  }
+  if (!stalled)
+  {
+    x = nx;
+    y = ny;
+    heading = remainder(heading + turn, 2 * M_PI);
+    position[0] += moved[0];
+    position[1] += moved[1];
+  }
+  else
+    speed[0] = speed[1] = 0;
+}
+
+int32_t iSimWorldEncoder(int wheel_)
+{
+  return (int32_t)floor(position[wheel_]);
+}
+
+static int prvSharpMvAt(double d_)
+{
+  // Closer than its range, the output folds back: read as the nearest
+  if (d_ < SHARP_NEAR_MM)
+    d_ = SHARP_NEAR_MM;
+  return (int)(SHARP_K_MV_MM / (d_ + SHARP_D0_MM));
+}
+
+static int prvSharpMv(double angle_)
+{
+  return prvSharpMvAt(prvRaycast(heading + angle_, SONAR_RANGE_MM) -
+                      ROBOT_RADIUS_MM);
+}
+
+static int prvReplayAnalogMv(int channel_)
+{
+  const int sharp = channel_ == CHANNEL_SHARP_LEFT ? SHARP_LEFT : SHARP_RIGHT;
+
+  switch (channel_)
+  {
+  case CHANNEL_SHARP_LEFT:
+  case CHANNEL_SHARP_RIGHT:
+    return prvSharpMvAt(replay.sharp_mm[sharp] < 0 ? SHARP_FAR_MM :
+                        replay.sharp_mm[sharp]);
+  case CHANNEL_CURRENT:
+    return replay.current_ma * POWER_SENSE_MOHM / 1000;
+  case CHANNEL_BATTERY:
+    return replay.battery_mv / POWER_BATTERY_DIVIDER;
+  }
+  return 0;
+}
+
+int iSimWorldAnalogMv(int channel_)
+{
+  const double running = fabs(duty[0]) + fabs(duty[1]);
+  const double ma = IDLE_MA + running *
+    (stalled ? MOTOR_STALLED_MA : MOTOR_RUNNING_MA) / 2;
+
+  // Internal channels, a part of the typical values in air at 20 C, the
+  // speed of sound of the sonar model
+  if (channel_ == CHANNEL_VREFINT)
+    return ADC_VREFINT_MV;
+  if (channel_ == CHANNEL_TEMP)
+    return ADC_TEMP_V25_MV + 5 * ADC_TEMP_SLOPE_UV / 1000;
+  if (replaying)
+    return prvReplayAnalogMv(channel_);
+  switch (channel_)
+  {
+  case CHANNEL_SHARP_LEFT:
+    return prvSharpMv(SHARP_SIDE_ANGLE);
+  case CHANNEL_SHARP_RIGHT:
+    return prvSharpMv(-SHARP_SIDE_ANGLE);
+  case CHANNEL_CURRENT:
+    return (int)(ma * POWER_SENSE_MOHM / 1000);
+  case CHANNEL_BATTERY:
+    return (int)((BATTERY_MV - ma * BATTERY_MOHM / 1000) /
+                 POWER_BATTERY_DIVIDER);
+  }
+  return 0;
+}
+
+int iSimWorldSonarUs(int sonar_)
+{
+  const double angle = sonar_ == SONAR_LEFT ? SONAR_SIDE_ANGLE :
+    sonar_ == SONAR_RIGHT ? -SONAR_SIDE_ANGLE : 0;
+  double d;
+
+  if (!replaying)
+    d = prvRaycast(heading + angle, SONAR_RANGE_MM + ROBOT_RADIUS_MM) -
+      ROBOT_RADIUS_MM;
+  else
+    d = replay.sonar_mm[sonar_] < 0 ? SONAR_RANGE_MM + 1 :
+      replay.sonar_mm[sonar_];
+
+  if (d > SONAR_RANGE_MM)
+    return 0;
+  // There and back at 343 m/s
+  return (int)(2 * d / 0.343);
+}
+
+int iSimWorldBumper(int bumper_)
+{
+  return bumper[bumper_];
+}
@@ -0,0 +1,24 @@
+#ifndef USB_CONF_H
+# define USB_CONF_H
+
+// Configuration of the STM32 USB-FS device library, for the virtual COM
+// port of libperiph/usbcdc.c, or the mass storage of libperiph/usbmsc.c
+// on the same endpoints (EP2 unused there)
+
+// Control, bulk IN (TX), interrupt IN (notifications, unused) and bulk
+// OUT (RX)
+#define EP_NUM 4
+
+// Packet memory: buffer table, then the endpoint buffers. Offsets in
+// bytes, 512 in all.
+#define BTABLE_ADDRESS 0x00
+#define ENDP0_RXADDR   0x40
+#define ENDP0_TXADDR   0x80
+#define ENDP1_TXADDR   0xC0
+#define ENDP2_TXADDR   0x100
+#define ENDP3_RXADDR   0x110
+
+// Transfers and bus resets only: the board is self powered, no suspend
+#define IMR_MSK (CNTR_CTRM | CNTR_RESETM)
+
+#endif /* USB_CONF_H */
@@ -0,0 +1,156 @@
+#! /usr/bin/env python
+# encoding: utf-8
+
+# Host side of the resident bootloader (src/boot): image descriptor and
+# serial update, only the pages that changed are written
+
+import struct, time
+
+# Kept in step with src/boot/boot.h, the application size and the page
+# size by target (MCUS in wscript, BOOT_INFO from the bootloader)
+APP_BASE = 0x08002000
+IMAGE_MAGIC = 0x1AA6E0C5
+MAX_DATA = 128
+
+SYNC = 0xA5
+INFO_REQ = 0x20
+CRC_REQ = 0x21
+ERASE = 0x22
+WRITE = 0x23
+COMMIT = 0x24
+RUN = 0x25
+ACK = 0x80
+NACK = 0x81
+INFO = 0xA0
+CRC = 0xA1
+
+# Frames lost on the line are sent again
+RETRIES = 5
+
+class BootError(Exception):
+    pass
+
+def crc8(data, crc=0):
+    # Same as uProtoCrc8 (src/libglobal/protocol.c)
+    for c in bytearray(data):
+        crc ^= c
+        for i in range(8):
+            crc = ((crc << 1) ^ 0x07) if crc & 0x80 else (crc << 1)
+            crc &= 0xFF
+    return crc
+
+def crc32(data):
+    # CRC unit of the STM32: little endian words, MSB first, not reflected
+    crc = 0xFFFFFFFF
+    for offset in range(0, len(data), 4):
+        crc ^= struct.unpack_from('<I', data, offset)[0]
+        for i in range(32):
+            crc = ((crc << 1) ^ 0x04C11DB7) if crc & 0x80000000 else (crc << 1)
+            crc &= 0xFFFFFFFF
+    return crc
+
+def pad(image):
+    # Words, erased flash past the end
+    return image + b'\xff' * (-len(image) % 4)
+
+def descriptor(image, app_size):
+    """boot_image_t of a flash.bin"""
+    image = pad(image)
+    if len(image) > app_size:
+        raise BootError('Image of %d bytes, %d at most' % (len(image), app_size))
+    return struct.pack('<III', IMAGE_MAGIC, len(image), crc32(image))
+
+class Boot:
+    def __init__(self, ser):
+        self.ser = ser
+        self.ser.timeout = 0.5
+
+    def send(self, type, payload=b''):
+        header = bytearray([type, len(payload)])
+        frame = bytearray([SYNC]) + header + bytearray(payload)
+        frame.append(crc8(payload, crc8(header)))
+        self.ser.write(bytes(frame))
+
+    def receive(self):
+        while True:
+            c = self.ser.read(1)
+            if not c:
+                return None
+            if bytearray(c)[0] == SYNC:
+                break
+        header = bytearray(self.ser.read(2))
+        if len(header) != 2:
+            return None
+        payload = self.ser.read(header[1])
+        crc = bytearray(self.ser.read(1))
+        if len(payload) != header[1] or not crc or crc[0] != crc8(payload, crc8(header)):
+            return None
+        return header[0], payload
+
+    def request(self, type, payload=b'', reply=None):
+        """One frame, its reply payload. The erase and write are checked
+        by the bootloader: a NACK is final."""
+        for i in range(RETRIES):
+            self.ser.flushInput()
+            self.send(type, payload)
+            answer = self.receive()
+            if not answer:
+                continue
+            if reply is not None and answer[0] == reply:
+                return answer[1]
+            if reply is None and answer[0] == ACK:
+                return answer[1]
+            if answer[0] == NACK:
+                raise BootError('Frame 0x%02x rejected' % type)
+        raise BootError('No reply to frame 0x%02x' % type)
+
+    def info(self):
+        version, page_size, app_base, app_size, valid = \
+            struct.unpack('<HHIIB', self.request(INFO_REQ, reply=INFO))
+        return {'version': version, 'page_size': page_size,
+                'app_base': app_base, 'app_size': app_size,
+                'image_valid': valid}
+
+    def crc(self, offset, length):
+        reply = self.request(CRC_REQ, struct.pack('<II', offset, length), CRC)
+        return struct.unpack('<I', reply)[0]
+
+    def update(self, image, log):
+        """Write the pages of image that differ, then commit and run it.
+        Returns the count of pages written."""
+        image = pad(image)
+        info = self.info()
+        page_size = info['page_size']
+        magic, length, crc = struct.unpack('<III',
+                                           descriptor(image, info['app_size']))
+        written = 0
+
+        for offset in range(0, length, page_size):
+            page = image[offset:offset + page_size]
+            if self.crc(offset, len(page)) == crc32(page):
+                continue
+            self.request(ERASE, struct.pack('<H', offset // page_size))
+            for chunk in range(0, len(page), MAX_DATA):
+                self.request(WRITE, struct.pack('<I', offset + chunk) +
+                             page[chunk:chunk + MAX_DATA])
+            written += 1
+            log('Page %d written' % (offset // page_size))
+
+        self.request(COMMIT, struct.pack('<II', length, crc))
+        self.request(RUN)
+        return written
+
+def enter(ser):
+    """Reach the bootloader, from the application shell if it runs"""
+    boot = Boot(ser)
+    try:
+        boot.info()
+        return boot
+    except BootError:
+        pass
+    ser.write(b'\rboot\r')
+    # Reset, then the bootloader starts on the HSI
+    time.sleep(0.5)
+    ser.flushInput()
+    boot.info()
+    return boot
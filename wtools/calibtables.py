@@ -0,0 +1,54 @@
+#! /usr/bin/env python
+# encoding: utf-8
+
+# Calibration curves (calib/*.csv) to C lookup tables in the flash: the
+# measured points resampled every 1 << shift of the input, linearly
+# between them, a marker value beyond them
+
+def points(path):
+    """(x, y) pairs of a two columns CSV, sorted by x. Comment (#) and
+    header lines are skipped."""
+    pairs = []
+    with open(path) as f:
+        for line in f:
+            line = line.split('#')[0].strip()
+            if not line:
+                continue
+            fields = line.split(',')
+            try:
+                pairs.append((int(fields[0]), int(fields[1])))
+            except ValueError:
+                continue
+    pairs.sort()
+    if len(pairs) < 2:
+        raise ValueError('%s: at least two points needed' % path)
+    return pairs
+
+def resample(pairs, shift, size, beyond):
+    """size entries, entry i at input i << shift"""
+    table = []
+    for i in range(size):
+        x = i << shift
+        if x < pairs[0][0] or x > pairs[-1][0]:
+            table.append(beyond)
+            continue
+        for (x0, y0), (x1, y1) in zip(pairs, pairs[1:]):
+            if x <= x1:
+                break
+        if x1 == x0:
+            table.append(y1)
+        else:
+            table.append(int(round(y0 + float(y1 - y0) * (x - x0) / (x1 - x0))))
+    return table
+
+def header(name, ctype, table, source, per_line=10):
+    """Definition of the const array, to include by its only user"""
+    lines = ['/* Generated from %s by wtools/calibtables.py, do not edit */'
+             % source,
+             '',
+             'static const %s %s[%d] = {' % (ctype, name, len(table))]
+    for i in range(0, len(table), per_line):
+        lines.append('  ' + ''.join('%6d,' % v
+                                    for v in table[i:i + per_line]))
+    lines.append('};')
+    return '\n'.join(lines) + '\n'
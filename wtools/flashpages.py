@@ -0,0 +1,51 @@
+#! /usr/bin/env python
+# encoding: utf-8
+
+# Incremental upload: the expected flash content against the one read
+# back from the board, only the pages that differ are erased and written
+
+import os
+
+ERASED = b'\xff'
+
+# Page size and pages written by "waf upload" come from the target (MCUS
+# in wscript): the parameters and black box after them stay
+
+def expected(parts, page_size, pages_nb):
+    """Flash content from (offset, data) parts, erased between them"""
+    image = bytearray(ERASED * (pages_nb * page_size))
+    for offset, data in parts:
+        image[offset:offset + len(data)] = bytearray(data)
+    return image
+
+def changed_runs(image, device, page_size):
+    """Runs of consecutive differing pages, as (first, last) pages"""
+    runs = []
+    for page in range(len(image) // page_size):
+        start = page * page_size
+        new = image[start:start + page_size]
+        old = bytearray(device[start:start + page_size])
+        if new == old:
+            continue
+        if runs and runs[-1][1] == page - 1:
+            runs[-1] = (runs[-1][0], page)
+        else:
+            runs.append((page, page))
+    return runs
+
+def write_runs(image, runs, directory, page_size):
+    """One file per run, returns the arguments of the flash_runs proc
+    (flash/flash.cfg): first page, last page, file, offset. The erased
+    end of a run is not written, "-" when the run is only erased."""
+    args = []
+    for first, last in runs:
+        start = first * page_size
+        data = image[start:(last + 1) * page_size].rstrip(ERASED)
+        data += ERASED * (-len(data) % 4)
+        path = '-'
+        if data:
+            path = os.path.join(directory, 'run-%03d.bin' % first)
+            with open(path, 'wb') as f:
+                f.write(bytes(data))
+        args += [str(first), str(last), '{%s}' % path, '0x%x' % start]
+    return args
@@ -1,5 +1,20 @@
 import sys, termios, select, serial, threading, signal, traceback
-import contextlib, os, codecs, tty
+import contextlib, os, codecs, tty, time, binascii, struct
+
+# Binary frames (src/libglobal/protocol.h)
+PROTO_SYNC = 0xA5
+PROTO_MAX_PAYLOAD = 32
+PROTO_ASCII = 0x00
+PROTO_CAPS_REQ = 0x16
+PROTO_SCHEMA_REQ = 0x17
+PROTO_ACK = 0x80
+PROTO_CAPS = 0x90
+PROTO_SCHEMA = 0x91
+PROTO_TRANSPORT_UART = 0x01
+PROTO_SCHEMA_ARRAY = 0x01
+# proto_caps_t, then the struct format of each eProtoField
+CAPS_FORMAT = '<HIBBIBB'
+FIELD_FORMATS = 'BbHhIi'
 
 class TimeoutException(Exception):
     def __init__(self,what):
@@ -16,7 +31,7 @@ def timeoutmanager(f):
         signal.alarm(1)
 
         try:
-            f(*args)
+            return f(*args)
 
         except TimeoutException as e:
             raise
@@ -24,28 +39,167 @@ def timeoutmanager(f):
         finally:
             signal.signal(signal.SIGALRM, old_handler)
             signal.alarm(0)
-
-        return
     return f2
 
+def readAvailable(ser):
+    """All the bytes received so far, at least one unless the read timed
+    out: one call per burst, not per byte"""
+    return ser.read(ser.inWaiting() or 1)
+
 @timeoutmanager
 def checkPrompt(*args):
-    prompt = []
+    prompt = ''
     while True:
-        data = args[0].ser.read(1)
+        data = readAvailable(args[0].ser)
 
         if not data:
             continue
 
-        if ((ord(data) >= 32 and ord(data) < 128) or
-            data == '\r' or data == '\n' or data == '\t'):
-            prompt += data
+        prompt += data
 
         for elem in args[1]:
-            if elem in ''.join(prompt):
-                return
+            if elem in prompt:
+                return elem
+
+def setLine(term, bauds, rtscts):
+    """Switch the link to bauds, RTS/CTS if rtscts ("ub" of src/main.c),
+    and confirm at the new rate ("uc"). Without the confirmation the
+    firmware goes back to the previous setting, so does the port here."""
+    ser = term.ser
+    old = (ser.baudrate, ser.rtscts)
+    ser.flushInput()
+    ser.write('#1 ub %d %d\r' % (bauds, 1 if rtscts else 0))
+    if checkPrompt(term, ['#1 %d\t' % bauds, '#1 e']) != '#1 %d\t' % bauds:
+        raise TimeoutException('Line setting refused')
+    # The firmware sends out its last bytes before switching
+    time.sleep(0.05)
+    ser.baudrate = bauds
+    ser.rtscts = rtscts
+    ser.flushInput()
+    try:
+        # The line may have caught noise meanwhile: end it first
+        ser.write('\r#2 uc\r')
+        checkPrompt(term, ['#2 ok'])
+    except TimeoutException:
+        ser.baudrate, ser.rtscts = old
+        raise
+
+def crc8(data, crc = 0):
+    # Same as uProtoCrc8 (src/libglobal/protocol.c)
+    for c in data:
+        crc ^= ord(c)
+        for i in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+def frame(type, payload = ''):
+    body = chr(type) + chr(len(payload)) + payload
+    return chr(PROTO_SYNC) + body + chr(crc8(body))
 
-        sys.stdout.flush()
+@timeoutmanager
+def request(term, type, payload, reply):
+    """Send a frame, return the payload of the first reply frame of type
+    reply. The console text meanwhile is dropped."""
+    got = []
+    def on_frame(t, p, host_s):
+        if t == reply:
+            got.append(p)
+        return True
+    decoder = Decoder(on_frame)
+    term.ser.write(frame(type, payload))
+    while not got:
+        decoder.feed(readAvailable(term.ser))
+    return got[0]
+
+class Capabilities:
+    """What the board speaks (PROTO_CAPS), and the struct format of each
+    of its fixed frame types (PROTO_SCHEMA), asked in binary mode: the
+    shell comes back after."""
+
+    def __init__(self, term):
+        term.ser.flushInput()
+        # A frame at the start of a line switches to binary mode
+        term.ser.write('\r')
+        time.sleep(0.05)
+        term.ser.flushInput()
+        (self.version, self.image_crc, self.transports, self.link,
+         self.max_bauds, self.max_payload, count) = struct.unpack(
+             CAPS_FORMAT, request(term, PROTO_CAPS_REQ, '', PROTO_CAPS))
+        # type: (array, struct.Struct)
+        self.formats = {}
+        for i in range(count):
+            payload = request(term, PROTO_SCHEMA_REQ, chr(i), PROTO_SCHEMA)
+            index, type, flags, size = struct.unpack('<BBBB', payload[:4])
+            fmt = '<' + ''.join(FIELD_FORMATS[ord(f) >> 5] * (ord(f) & 0x1F)
+                                for f in payload[4:])
+            if struct.calcsize(fmt) != size:
+                raise TimeoutException('Schema of %02x does not add up' % type)
+            self.formats[type] = (bool(flags & PROTO_SCHEMA_ARRAY),
+                                  struct.Struct(fmt))
+        request(term, PROTO_ASCII, '', PROTO_ACK)
+
+    def agrees(self, type, fmt):
+        """True if the board lays out the frames of type as fmt, a format
+        without counts ('<IhhB')"""
+        return type in self.formats and self.formats[type][1].format == fmt
+
+    def decode(self, type, payload):
+        """Tuple of the fields, list of them for the arrays, None for an
+        unknown type or a size that does not match"""
+        if type not in self.formats:
+            return None
+        array, s = self.formats[type]
+        if array:
+            if len(payload) % s.size:
+                return None
+            return [s.unpack_from(payload, i)
+                    for i in range(0, len(payload), s.size)]
+        if len(payload) != s.size:
+            return None
+        return s.unpack(payload)
+
+def printable(c):
+    if ord(c) == 0x7f or ord(c) == 0x8:
+        return '\b'
+    if (ord(c) >= 32 and ord(c) < 128) or c == '\r' or c == '\n' or c == '\t':
+        return c
+    return '\\x%02x' % ord(c)
+
+class Decoder:
+    """Console text from the raw bytes, fed by chunks. Valid binary frames
+    show as <type: payload bytes>, unless on_frame(type, payload, host_s)
+    takes them and returns True; a frame cut between two chunks waits for
+    the rest."""
+
+    def __init__(self, on_frame = None):
+        self.pending = ''
+        self.on_frame = on_frame
+
+    def feed(self, data, host_s = None):
+        data = self.pending + data
+        out = []
+        i = 0
+        while i < len(data):
+            if ord(data[i]) == PROTO_SYNC:
+                if len(data) - i < 3:
+                    break
+                size = ord(data[i + 2])
+                if size <= PROTO_MAX_PAYLOAD:
+                    if len(data) - i < size + 4:
+                        break
+                    frame = data[i + 1:i + 3 + size]
+                    if crc8(frame) == ord(data[i + 3 + size]):
+                        i += size + 4
+                        if self.on_frame and \
+                                self.on_frame(ord(frame[0]), frame[2:], host_s):
+                            continue
+                        out.append('<%02x:%s>' % (ord(frame[0]),
+                            ''.join(' %02x' % ord(c) for c in frame[2:])))
+                        continue
+            out.append(printable(data[i]))
+            i += 1
+        self.pending = data[i:]
+        return ''.join(out)
 
 @contextlib.contextmanager
 def console():
@@ -57,10 +211,16 @@ def console():
         termios.tcsetattr(sys.stdin, termios.TCSADRAIN, old_attrs)
 
 class Term:
-    def __init__(self, ser, termName):
+    def __init__(self, ser, termName, record = None):
         self.ser = ser
         self.termName = termName
         self.threads = []
+        self.decoder = Decoder()
+        # Raw traffic, a line per read: host time in seconds, hex bytes;
+        # the keys sent as well, "> " before their bytes (replayed by
+        # raspberry/client/loadgen)
+        self.record = record
+        self.recordLock = threading.Lock()
 
     def getkey(self):
         # Return -1 if we don't get input in 0.1 seconds, so that
@@ -99,23 +259,25 @@ class Term:
             while thread.isAlive():
                 thread.join(0.1)
 
+    def recordTraffic(self, now, prefix, data):
+        if not self.record:
+            return
+        with self.recordLock:
+            self.record.write('%.6f %s%s\n' %
+                              (now, prefix, binascii.hexlify(data)))
+
     def reader(self):
         try:
             while self.alive:
-                data = self.ser.read(1)
+                data = readAvailable(self.ser)
                 if not data:
                     continue
 
-                if ((ord(data) >= 32 and ord(data) < 128) or
-                    data == '\r' or data == '\n' or data == '\t'):
-
-                    if ord(data) == 0x7f or ord(data) == 0x8:
-                        data = '\b'
-                    sys.stdout.write(data)
-
-                else:
-                    sys.stdout.write('\\x'+("0"+hex(ord(data))[2:])[-2:])
+                now = time.time()
+                self.recordTraffic(now, '', data)
 
+                # One write and flush per burst
+                sys.stdout.write(self.decoder.feed(data, now))
                 sys.stdout.flush()
 
         except Exception as e:
@@ -142,19 +304,91 @@ class Term:
                 else:
                     # send character
                     self.ser.write(c)
+                    self.recordTraffic(time.time(), '> ', c)
 
         except Exception as e:
             sys.stdout.flush()
             traceback.print_exc()
             os._exit(1)
 
-    def run(self):
+    def run(self, foreground = None):
         # Set timeout
         self.ser.timeout = 0.1
 
         # Handle SIGINT gracefully
         signal.signal(signal.SIGINT, lambda *args: self.stop())
 
-        # Go
+        # Go, foreground(alive) runs in the main thread meanwhile (plots)
         self.start()
+        if foreground:
+            foreground(lambda: self.alive)
+            self.stop()
         self.join()
+
+class CommandError(Exception):
+    def __init__(self, line, status):
+        self.line = line
+        self.status = status
+    def __str__(self):
+        return '%s: %s' % (self.line, self.status)
+
+class Machine:
+    """Scripted access to the shell in machine mode: no echo, no prompt,
+    each command answered by its values lines then a status line."""
+
+    def __init__(self, ser):
+        self.ser = ser
+        self.ser.timeout = 1
+        self.ser.write('\rmachine 1\r')
+        # Skip the prompt and the echo of the switch itself
+        while self.readline() != 'ok':
+            pass
+
+    def readline(self):
+        line = ''
+        while True:
+            c = self.ser.read(1)
+            if not c:
+                raise TimeoutException('Timeout')
+            if c == '\n':
+                return line.strip()
+            line += c
+
+    def command(self, line):
+        """Send a command, return its values lines as lists of ints"""
+        self.ser.write(line + '\r')
+        values = []
+        while True:
+            reply = self.readline()
+            if reply == 'ok':
+                return values
+            if reply[:1] == 'e' and reply[1:].isdigit():
+                raise CommandError(line, reply)
+            values.append([int(v) for v in reply.split('\t')])
+
+    def close(self):
+        self.ser.write('machine 0\r')
+
+    def pipeline(self, lines, window = 7):
+        """Send commands back to back, tagged with sequence numbers, with
+        at most window of them unanswered (INTERPRETER_WINDOW). Returns
+        the values of each command, in order."""
+        results = [None] * len(lines)
+        values = {}
+        sent = 0
+        done = 0
+        while done < len(lines):
+            while sent < len(lines) and sent - done < window:
+                self.ser.write('#%d %s\r' % (sent, lines[sent]))
+                sent += 1
+            tag, reply = self.readline().split(' ', 1)
+            seq = int(tag[1:])
+            if reply == 'ok':
+                results[seq] = values.pop(seq, [])
+                done += 1
+            elif reply[:1] == 'e' and reply[1:].isdigit():
+                raise CommandError(lines[seq], reply)
+            else:
+                values.setdefault(seq, []).append(
+                    [int(v) for v in reply.split('\t')])
+        return results
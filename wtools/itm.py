@@ -0,0 +1,78 @@
+#! /usr/bin/env python
+# encoding: utf-8
+
+# SWO capture of a --itm build (src/libperiph/itm.h): ITM packets to the
+# log lines, profile samples and task switches of "waf swo", and the DWT
+# PC samples of "waf pcprofile"
+
+PORT_LOG = 0
+PORT_PROFILE = 1
+PORT_TASKS = 2
+# Out of the stimulus ports: DWT hardware packets of id 2, periodic PC
+PORT_PC = 32
+DWT_PC_SAMPLE = 2
+
+# Kept in step with eProfileProbe, src/libglobal/profile.h
+PROBES = ['usart1', 'tim3', 'i2c1ev', 'motors', 'sonar', 'tim2', 'adc', 'enc']
+
+class Decoder:
+    """Stimulus port writes out of the raw SWO bytes: sync, overflow and
+    timestamp packets are skipped, hardware source packets too but the
+    PC samples"""
+
+    def __init__(self):
+        self.pending = b''
+        self.line = ''
+
+    def feed(self, data):
+        """Yields (port, value, size) for each complete packet"""
+        data = self.pending + data
+        i = 0
+        while i < len(data):
+            header = ord(data[i:i + 1])
+            size = [0, 1, 2, 4][header & 3]
+            if size == 0:
+                # Sync (zeros then 0x80) and overflow alone; timestamps and
+                # extensions: header then bytes while bit 7 is set
+                j = i + 1
+                if header & 0x80 and header != 0x80:
+                    while j < len(data) and ord(data[j:j + 1]) & 0x80:
+                        j += 1
+                    if j == len(data):
+                        break
+                    j += 1
+                i = j
+                continue
+            if i + 1 + size > len(data):
+                break
+            payload = data[i + 1:i + 1 + size]
+            i += 1 + size
+            if header & 4 and header >> 3 != DWT_PC_SAMPLE:
+                continue
+            value = 0
+            for k in range(size):
+                value |= ord(payload[k:k + 1]) << (8 * k)
+            yield PORT_PC if header & 4 else header >> 3, value, size
+        self.pending = data[i:]
+
+    def events(self, data):
+        """Yields readable lines for the log port, profile samples as
+        (probe, cycles), task switches as (slot, cycles low 24 bits) and
+        PC samples, None for a core asleep"""
+        for port, value, size in self.feed(data):
+            if port == PORT_LOG:
+                for k in range(size):
+                    c = chr((value >> (8 * k)) & 0xff)
+                    if c == '\n':
+                        yield 'log', self.line
+                        self.line = ''
+                    else:
+                        self.line += c
+            elif port == PORT_PROFILE:
+                probe = value >> 24
+                name = PROBES[probe] if probe < len(PROBES) else str(probe)
+                yield 'profile', (name, value & 0xffffff)
+            elif port == PORT_TASKS:
+                yield 'task', (value >> 24, value & 0xffffff)
+            elif port == PORT_PC:
+                yield 'pc', value if size == 4 else None
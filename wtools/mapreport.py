@@ -0,0 +1,129 @@
+#! /usr/bin/env python
+# encoding: utf-8
+
+# Flash and RAM use per module from a GNU ld map file (-Wl,-Map)
+
+import re, os
+
+# Input section line, the name is on the previous line when it is long
+SECTION = re.compile(r'^ (\S+)?\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$')
+MEMORY = re.compile(r'^(\w+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)')
+
+# Our libraries are detailed per object, the toolchain ones are not
+DETAILED = ['libperiph.a', 'libglobal.a', 'libstm32.a']
+
+def module(path):
+    m = re.match(r'^(.*)\((.*)\)$', path)
+    if m:
+        archive = os.path.basename(m.group(1))
+        if archive not in DETAILED:
+            return archive
+        path = m.group(2)
+    # waf objects are named <source>.<index>.o
+    return re.sub(r'\.\d+\.o$', '', os.path.basename(path))
+
+def kind(section):
+    # RAMFUNC code, stored in flash and copied to RAM like .data
+    if section.startswith('.ramfunc'):
+        return 'ramfunc'
+    if section.startswith('.text') or section.startswith('.rodata') \
+            or section.startswith('.isr_vector'):
+        return 'text'
+    if section.startswith('.data'):
+        return 'data'
+    if section.startswith('.bss') or section == 'COMMON' \
+            or section.startswith('.noinit'):
+        return 'bss'
+    return None
+
+def parse(path):
+    modules = {}
+    memory = {}
+    state = 'start'
+    pending = None
+
+    for line in open(path):
+        line = line.rstrip('\n')
+
+        if line.startswith('Memory Configuration'):
+            state = 'memory'
+            continue
+        if line.startswith('Linker script and memory map'):
+            state = 'map'
+            continue
+
+        if state == 'memory':
+            m = MEMORY.match(line)
+            if m and m.group(1) != 'Name':
+                memory[m.group(1)] = int(m.group(3), 16)
+            continue
+        if state != 'map':
+            continue
+
+        m = SECTION.match(line)
+        if not m:
+            # A lone long section name, its address and size follow
+            if line.startswith(' .') and len(line.split()) == 1:
+                pending = line.split()[0]
+            else:
+                pending = None
+            continue
+
+        section = m.group(1) or pending
+        pending = None
+        size = int(m.group(3), 16)
+        what = kind(section or '')
+        # Discarded (address 0) and empty sections
+        if not what or not size or int(m.group(2), 16) == 0:
+            continue
+
+        sizes = modules.setdefault(module(m.group(4).strip()),
+                                   {'text': 0, 'data': 0, 'bss': 0,
+                                    'ramfunc': 0})
+        sizes[what] += size
+
+    return modules, memory
+
+def sum_sizes(modules):
+    total = {'text': 0, 'data': 0, 'bss': 0, 'ramfunc': 0}
+    for sizes in modules.values():
+        for k in total:
+            total[k] += sizes[k]
+    return total
+
+def totals(path):
+    # Flash and RAM bytes
+    total = sum_sizes(parse(path)[0])
+    copied = total['data'] + total['ramfunc']
+    return total['text'] + copied, copied + total['bss']
+
+def report(path, detail=True):
+    modules, memory = parse(path)
+    lines = []
+
+    total = sum_sizes(modules)
+
+    if detail:
+        row = '%-24s %7s %7s %7s %7s'
+        lines.append(row % ('module', 'text', 'data', 'bss', 'ramfunc'))
+        order = sorted(modules.items(),
+                       key=lambda i: -(i[1]['text'] + i[1]['bss'] +
+                                       2 * (i[1]['data'] + i[1]['ramfunc'])))
+        for name, sizes in order + [('total', total)]:
+            lines.append(row % (name, sizes['text'], sizes['data'],
+                                sizes['bss'], sizes['ramfunc']))
+
+    # .data and .ramfunc are stored in flash and copied to RAM at boot
+    copied = total['data'] + total['ramfunc']
+    flash = total['text'] + copied
+    ram = copied + total['bss']
+    def used(name, value):
+        if name in memory and memory[name]:
+            return '%s %d/%d (%d%%)' % (name, value, memory[name],
+                                        100 * value // memory[name])
+        return '%s %d' % (name, value)
+    lines.append('%s, %s, of which %d of code' % (used('FLASH', flash),
+                                                  used('RAM', ram),
+                                                  total['ramfunc']))
+
+    return lines
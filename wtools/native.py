@@ -0,0 +1,207 @@
+#! /usr/bin/env python
+# encoding: utf-8
+
+# The native link library (raspberry/client/swiftler_c.h, "waf client")
+# from the scripts, through ctypes: the port read and decoded in C++, the
+# telemetry taken in bulk as records of telemetry.RECORD, into a numpy
+# array when numpy is there, else a bytearray. Machine is a drop-in for
+# interpreter.Machine on a device path instead of a serial object.
+
+import ctypes, os, struct, time
+
+from wtools import telemetry
+
+PROTO_MAX_PAYLOAD = 32
+
+FRAME_FORMAT = '<dBB%ds' % PROTO_MAX_PAYLOAD
+FRAME_SIZE = struct.calcsize(FRAME_FORMAT)
+
+# Taken at once, at most
+BATCH = 4096
+
+def _library(path = None):
+    """libswiftler.so: the given path, $SWIFTLER_LIB, then the build
+    tree of waf"""
+    here = os.path.dirname(os.path.abspath(__file__))
+    for p in [path, os.environ.get('SWIFTLER_LIB'),
+              os.path.join(here, '..', 'build', 'host', 'libswiftler.so')]:
+        if p and os.path.exists(p):
+            lib = ctypes.CDLL(p)
+            break
+    else:
+        raise OSError('libswiftler.so not found, build it with "waf client"')
+
+    c = ctypes
+    lib.swiftler_open.argtypes = [c.c_char_p, c.c_int]
+    lib.swiftler_open.restype = c.c_void_p
+    lib.swiftler_close.argtypes = [c.c_void_p]
+    lib.swiftler_last_error.restype = c.c_char_p
+    lib.swiftler_poll.argtypes = [c.c_void_p, c.c_int]
+    for name in ['swiftler_take_telemetry', 'swiftler_take_frames',
+                 'swiftler_take_lines']:
+        getattr(lib, name).argtypes = [c.c_void_p, c.c_void_p, c.c_size_t]
+        getattr(lib, name).restype = c.c_size_t
+    lib.swiftler_dropped.argtypes = [c.c_void_p]
+    lib.swiftler_dropped.restype = c.c_uint64
+    lib.swiftler_send_line.argtypes = [c.c_void_p, c.c_char_p]
+    lib.swiftler_send_frame.argtypes = [c.c_void_p, c.c_uint8, c.c_char_p,
+                                        c.c_uint8]
+    lib.swiftler_set_telemetry.argtypes = [c.c_void_p, c.c_uint16,
+                                           c.c_uint16]
+    return lib
+
+class NativeError(Exception):
+    pass
+
+class Stream:
+    """The link on a device path, raw 8N1. poll() reads and decodes what
+    came; the telemetry, the other frames and the console lines then wait
+    to be taken, each in one call."""
+
+    def __init__(self, device, bauds = 115200, library = None):
+        self.lib = _library(library)
+        self.handle = self.lib.swiftler_open(device.encode(), bauds)
+        if not self.handle:
+            raise NativeError(self.lib.swiftler_last_error().decode())
+        self.record_size = struct.calcsize(telemetry.RECORD)
+        self.lines = ''
+        try:
+            import numpy
+            self.numpy = numpy
+        except ImportError:
+            self.numpy = None
+
+    def close(self):
+        if self.handle:
+            self.lib.swiftler_close(self.handle)
+            self.handle = None
+
+    def __del__(self):
+        self.close()
+
+    def poll(self, timeout_ms = -1):
+        """Bytes read, after up to timeout_ms for the first ones"""
+        n = self.lib.swiftler_poll(self.handle, timeout_ms)
+        if n < 0:
+            raise NativeError(self.lib.swiftler_last_error().decode())
+        return n
+
+    def _take(self, take, size, max):
+        buf = ctypes.create_string_buffer(size * max)
+        n = take(self.handle, buf, max)
+        return buf.raw[:n * size] if size > 1 else buf.raw[:n]
+
+    def telemetry(self, max = BATCH):
+        """The pending telemetry samples, merged from the report on change
+        frames: a numpy record array of telemetry.DTYPE, else the raw
+        records of telemetry.RECORD in a bytearray"""
+        if self.numpy:
+            out = self.numpy.empty(max, dtype=telemetry.DTYPE)
+            n = self.lib.swiftler_take_telemetry(
+                self.handle, out.ctypes.data_as(ctypes.c_void_p), max)
+            return out[:n]
+        return bytearray(self._take(self.lib.swiftler_take_telemetry,
+                                    self.record_size, max))
+
+    def frames(self, max = BATCH):
+        """The other frames: (host_s, type, payload) tuples"""
+        raw = self._take(self.lib.swiftler_take_frames, FRAME_SIZE, max)
+        out = []
+        for i in range(0, len(raw), FRAME_SIZE):
+            host_s, type, size, payload = struct.unpack_from(FRAME_FORMAT,
+                                                             raw, i)
+            out.append((host_s, type, payload[:size]))
+        return out
+
+    def readlines(self, size = 1 << 16):
+        """The whole console lines received, without their line ending"""
+        self.lines += self._take(self.lib.swiftler_take_lines, 1,
+                                 size).decode('latin-1')
+        lines = self.lines.split('\n')
+        self.lines = lines.pop()
+        return lines
+
+    def dropped(self):
+        """Samples, frames and lines nobody took in time"""
+        return self.lib.swiftler_dropped(self.handle)
+
+    def send_line(self, line):
+        if not self.lib.swiftler_send_line(self.handle, line.encode()):
+            raise NativeError(self.lib.swiftler_last_error().decode())
+
+    def send_frame(self, type, payload = ''):
+        if not isinstance(payload, bytes):
+            payload = payload.encode('latin-1')
+        if not self.lib.swiftler_send_frame(self.handle, type, payload,
+                                            len(payload)):
+            raise NativeError(self.lib.swiftler_last_error().decode())
+
+    def set_telemetry(self, period_ms, heartbeat_ms = 0):
+        """PROTO_TELEM_CFG, report on change with a heartbeat"""
+        if not self.lib.swiftler_set_telemetry(self.handle, period_ms,
+                                               heartbeat_ms):
+            raise NativeError(self.lib.swiftler_last_error().decode())
+
+class Machine:
+    """interpreter.Machine on a Stream: the same commands and replies,
+    the lines read natively instead of a byte at a time"""
+
+    def __init__(self, device, bauds = 115200, timeout = 1.0):
+        from wtools import interpreter
+        self.interpreter = interpreter
+        self.stream = Stream(device, bauds)
+        self.timeout = timeout
+        self.pending = []
+        self.stream.send_line('')
+        self.stream.send_line('machine 1')
+        # Skip the prompt and the echo of the switch itself
+        while self.readline() != 'ok':
+            pass
+
+    def readline(self):
+        deadline = time.time() + self.timeout
+        while not self.pending:
+            left = deadline - time.time()
+            if left <= 0:
+                raise self.interpreter.TimeoutException('Timeout')
+            self.stream.poll(int(left * 1000) + 1)
+            self.pending = self.stream.readlines()
+        return self.pending.pop(0).strip()
+
+    def command(self, line):
+        """Send a command, return its values lines as lists of ints"""
+        self.stream.send_line(line)
+        values = []
+        while True:
+            reply = self.readline()
+            if reply == 'ok':
+                return values
+            if reply[:1] == 'e' and reply[1:].isdigit():
+                raise self.interpreter.CommandError(line, reply)
+            values.append([int(v) for v in reply.split('\t')])
+
+    def close(self):
+        self.stream.send_line('machine 0')
+        self.stream.close()
+
+    def pipeline(self, lines, window = 7):
+        """As interpreter.Machine.pipeline"""
+        results = [None] * len(lines)
+        values = {}
+        sent = 0
+        done = 0
+        while done < len(lines):
+            while sent < len(lines) and sent - done < window:
+                self.stream.send_line('#%d %s' % (sent, lines[sent]))
+                sent += 1
+            tag, reply = self.readline().split(' ', 1)
+            seq = int(tag[1:])
+            if reply == 'ok':
+                results[seq] = values.pop(seq, [])
+                done += 1
+            elif reply[:1] == 'e' and reply[1:].isdigit():
+                raise self.interpreter.CommandError(lines[seq], reply)
+            else:
+                values.setdefault(seq, []).append(
+                    [int(v) for v in reply.split('\t')])
+        return results
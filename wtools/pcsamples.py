@@ -0,0 +1,80 @@
+#! /usr/bin/env python
+# encoding: utf-8
+
+# Flat profile of a --itm build out of the DWT PC samples ("pcs N"): each
+# sample to the function of the ELF symbol table it falls in, and to the
+# task of the last switch on ITM_PORT_TASKS (src/libperiph/itm.h)
+
+import bisect, subprocess
+
+SLEEP = '(sleep)'
+UNKNOWN = '(unknown)'
+
+class Symbols:
+    """Functions of an ELF by address, RAMFUNC ones at their RAM address"""
+
+    def __init__(self, elf, nm = 'arm-none-eabi-nm'):
+        out = subprocess.check_output([nm, '-n', '-S', '--defined-only', elf])
+        self.starts = []
+        self.ends = []
+        self.names = []
+        for line in out.decode().splitlines():
+            fields = line.split()
+            # Sizeless symbols (labels of the startup code) are skipped
+            if len(fields) != 4 or fields[2] not in 'tTwW':
+                continue
+            start = int(fields[0], 16)
+            self.starts.append(start)
+            self.ends.append(start + int(fields[1], 16))
+            self.names.append(fields[3])
+
+    def name(self, pc):
+        # Thumb: bit 0 is never set in a sampled PC, but in the symbols
+        i = bisect.bisect_right(self.starts, pc | 1) - 1
+        if i < 0 or pc >= self.ends[i]:
+            return UNKNOWN
+        return self.names[i]
+
+class Profile:
+    def __init__(self, symbols):
+        self.symbols = symbols
+        self.task = None
+        self.total = 0
+        self.functions = {}
+        self.tasks = {}
+
+    def event(self, kind, value):
+        """Takes the events of itm.Decoder"""
+        if kind == 'task':
+            self.task = value[0]
+        elif kind == 'pc':
+            name = SLEEP if value is None else self.symbols.name(value)
+            self.total += 1
+            self.functions[name] = self.functions.get(name, 0) + 1
+            per = self.tasks.setdefault(self.task, {})
+            per[name] = per.get(name, 0) + 1
+
+    def report(self, top = 30):
+        """Lines of the flat profile, then the share of each task"""
+        if not self.total:
+            return ['No PC samples: "pcs N" on the console, and the probe '
+                    'enabled the DWT packets?']
+        lines = ['%8s %6s  %s' % ('samples', '%', 'function')]
+        ranked = sorted(self.functions.items(), key=lambda f: -f[1])
+        for name, n in ranked[:top]:
+            lines.append('%8d %6.2f  %s' % (n, 100.0 * n / self.total, name))
+        if len(ranked) > top:
+            rest = sum(n for name, n in ranked[top:])
+            lines.append('%8d %6.2f  (%d others)' %
+                         (rest, 100.0 * rest / self.total, len(ranked) - top))
+        lines.append('')
+        lines.append('%8s %6s  %s' % ('samples', '%', 'task: top function'))
+        for task, per in sorted(self.tasks.items(),
+                                key=lambda t: -sum(t[1].values())):
+            n = sum(per.values())
+            name, hot = max(per.items(), key=lambda f: f[1])
+            lines.append('%8d %6.2f  %s: %s %d%%' %
+                         (n, 100.0 * n / self.total,
+                          'slot %d' % task if task is not None else '?',
+                          name, 100 * hot // n))
+        return lines
@@ -0,0 +1,136 @@
+#! /usr/bin/env python
+# encoding: utf-8
+
+# Schedulability of a --profile build (src/libglobal/profile.h): the
+# worst case cycles of the "f" probes with the periods and priorities of
+# the model below, to the response times and the CPU budget of "waf
+# sched"
+
+import math, time
+
+ISR = 'isr'
+TASK = 'task'
+
+# name, probe, kind, priority, minimum period or inter-arrival (us). ISR
+# priorities are the NVIC ones (src/libperiph/priorities.h, 0 the
+# highest), task ones those of the kernel (the highest number first).
+# The deadline is the period: an interrupt not served by then loses an
+# event, a task misses its next release. Kept in step with the defaults.
+MODEL = [
+    # Update events of the centre aligned PWM, twice per 9 kHz period
+    ('TIM2',      'tim2',   ISR,  5, 55),
+    # Right wheel edges, MOTORS_MAX_SPEED counts per 5 ms
+    ('EXTI15_10', 'enc',    ISR,  5, 125),
+    # Sonar echo edges, a 2.5 cm echo the shortest pulse
+    ('TIM3',      'tim3',   ISR,  6, 150),
+    # Half of the ADC DMA buffer, ADC_OVERSAMPLE scans at 1 kHz
+    ('DMA1_Ch1',  'adc',    ISR,  6, 16000),
+    # Register file bytes, 9 clocks each at 400 kHz
+    ('I2C1_EV',   'i2c1ev', ISR,  7, 22),
+    # Console bytes at 115200 bauds
+    ('USART1',    'usart1', ISR,  7, 86),
+    ('motorsd',   'motors', TASK, 4, 5000),
+    ('sonard',    'sonar',  TASK, 3, 10000),
+]
+
+CYCLES_PER_US = 72.0
+PROMPT = 'swiftler # '
+# Response time over its deadline by this much: at risk
+RISK_RATIO = 0.8
+
+def request(ser, timeout_s = 5):
+    """The lines of a "f" in human mode, None without an answer"""
+    ser.timeout = 0.1
+    ser.flushInput()
+    ser.write('\rf\r')
+    data = ''
+    start = time.time()
+    while time.time() - start < timeout_s:
+        data += ser.read(ser.inWaiting() or 1)
+        answer = data.split('f\r\n', 1)
+        if len(answer) == 2 and PROMPT in answer[1]:
+            return answer[1].split(PROMPT)[0].splitlines()
+    return None
+
+def parse(lines):
+    """Probe name: (count, min, mean, max) cycles"""
+    probes = {}
+    for line in lines:
+        fields = line.split()
+        if len(fields) == 5 and all(f.isdigit() for f in fields[1:]):
+            probes[fields[0]] = tuple(int(f) for f in fields[1:])
+    return probes
+
+def rates(first, second, window_s):
+    """Probe name: mean inter-arrival in us between two dumps"""
+    periods = {}
+    for name, stats in second.items():
+        if name in first and stats[0] > first[name][0]:
+            periods[name] = window_s * 1e6 / (stats[0] - first[name][0])
+    return periods
+
+def _preempts(a, b):
+    """a runs before b, or delays it: ISRs before the tasks, then the
+    NVIC order (equal ones do not preempt each other), the kernel one"""
+    if a['kind'] != b['kind']:
+        return a['kind'] == ISR
+    if a['kind'] == ISR:
+        return a['priority'] < b['priority']
+    # Round robin between equal tasks: counted against each other
+    return a['priority'] >= b['priority']
+
+def _response(entry, entries):
+    """Fixed point of R = B + C + sum ceil(R / Tj) Cj, None past the
+    deadline"""
+    # An interrupt of the same priority already running goes first
+    blocking = 0
+    if entry['kind'] == ISR:
+        blocking = max([e['wcet'] for e in entries
+                        if e is not entry and e['kind'] == ISR and
+                        e['priority'] == entry['priority']] or [0])
+    higher = [e for e in entries if e is not entry and _preempts(e, entry)]
+    response = blocking + entry['wcet']
+    while True:
+        demand = blocking + entry['wcet'] + \
+            sum(math.ceil(response / e['period']) * e['wcet'] for e in higher)
+        if demand > entry['period']:
+            return None
+        if demand == response:
+            return response
+        response = demand
+
+def analyse(probes, periods = {}):
+    """Per model entry: its fields, the worst case, utilization, response
+    time (None: misses) and a status; then the total utilization and
+    the entries without a measure"""
+    entries = []
+    unmeasured = []
+    for name, probe, kind, priority, period in MODEL:
+        stats = probes.get(probe)
+        if not stats or not stats[0]:
+            unmeasured.append(name)
+            continue
+        entry = {'name': name, 'probe': probe, 'kind': kind,
+                 'priority': priority, 'period': float(period),
+                 'wcet': stats[3] / CYCLES_PER_US, 'faster': False}
+        # Running faster than the model: the measured rate is the bound
+        if probe in periods and periods[probe] < period:
+            entry['period'] = periods[probe]
+            entry['faster'] = True
+        entry['utilization'] = entry['wcet'] / entry['period']
+        entries.append(entry)
+
+    for entry in entries:
+        entry['response'] = _response(entry, entries)
+        if entry['response'] is None:
+            entry['status'] = 'MISS'
+        elif entry['response'] > RISK_RATIO * entry['period']:
+            entry['status'] = 'risk'
+        else:
+            entry['status'] = 'ok'
+    total = sum(e['utilization'] for e in entries)
+    return entries, total, unmeasured
+
+def bound(n):
+    """Liu and Layland utilization bound of n rate monotonic entries"""
+    return n * (2 ** (1.0 / n) - 1) if n else 1.0
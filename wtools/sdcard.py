@@ -0,0 +1,57 @@
+#! /usr/bin/env python
+# encoding: utf-8
+
+# Log of a --sdcard build read back from the raw card, or an image of it
+# (src/libperiph/sdcard.h): the stream bytes of each session, the frames
+# as on the host link
+
+import struct
+
+BLOCK_SIZE = 512
+MAGIC = 0x474C5753
+FORMAT_MAGIC = 0x44535753
+LOG_FIRST_BLOCK = 1
+
+# sdcard_format_t and sdcard_block_t, packed
+FORMAT = '<III'
+HEADER = '<IIIHH'
+HEADER_SIZE = struct.calcsize(HEADER)
+
+class FormatError(Exception):
+    pass
+
+def blocks(path):
+    """(session, tick, payload) of the log blocks, in order, up to the
+    first one of another format"""
+    with open(path, 'rb') as card:
+        magic, epoch, _ = struct.unpack(FORMAT, card.read(BLOCK_SIZE)[:12])
+        if magic != FORMAT_MAGIC:
+            raise FormatError('no log format on %s' % path)
+        card.seek(LOG_FIRST_BLOCK * BLOCK_SIZE)
+        while True:
+            block = card.read(BLOCK_SIZE)
+            if len(block) < BLOCK_SIZE:
+                return
+            magic, block_epoch, tick, session, used = \
+                struct.unpack(HEADER, block[:HEADER_SIZE])
+            if magic != MAGIC or block_epoch != epoch:
+                return
+            yield session, tick, block[HEADER_SIZE:HEADER_SIZE + used]
+
+def sessions(path):
+    """Per session: number, first and last ticks, blocks, bytes"""
+    summary = []
+    for session, tick, payload in blocks(path):
+        if not summary or summary[-1][0] != session:
+            summary.append([session, tick, tick, 0, 0])
+        summary[-1][2] = tick
+        summary[-1][3] += 1
+        summary[-1][4] += len(payload)
+    return summary
+
+def stream(path, session):
+    """(board time in seconds, bytes) of a session, block by block: a
+    frame may span two of them"""
+    for s, tick, payload in blocks(path):
+        if s == session:
+            yield tick / 1000.0, payload
@@ -0,0 +1,269 @@
+#! /usr/bin/env python
+# encoding: utf-8
+
+# Session archives of the telemetry (.ses), written by the recorder of
+# "waf monitor" and "waf sdlog": the records of telemetry.RECORD back to
+# back after a header, mapped as is (numpy.memmap, offset HEADER_SIZE),
+# in chunks of CHUNK_RECORDS. At the end, an index of the chunks: their
+# time span and the min and max of each field, then a trailer. A tool
+# finds the chunks of a time range, or of a field range, from the index
+# alone and reads those only, across any number of sessions.
+#
+# A session cut short (no trailer) is still read, its index rebuilt from
+# the records.
+
+import bisect, glob, os, struct
+
+from wtools import telemetry
+
+MAGIC = b'SWSESS\r\n'
+INDEX_MAGIC = b'SWSESIDX'
+VERSION = 1
+CHUNK_RECORDS = 1024
+
+# magic, version, record size, chunk records, record format
+HEADER = '<8sHHI48s'
+HEADER_SIZE = struct.calcsize(HEADER)
+# magic, index offset, chunks, records
+TRAILER = '<8sQII'
+TRAILER_SIZE = struct.calcsize(TRAILER)
+# Per chunk: first record, records, first and last host_s, then the min
+# and max of each field of telemetry.FIELDS
+ENTRY = '<II2d%dd' % (2 * len(telemetry.FIELDS))
+ENTRY_SIZE = struct.calcsize(ENTRY)
+
+RECORD_SIZE = struct.calcsize(telemetry.RECORD)
+
+class FormatError(Exception):
+    pass
+
+class Chunk:
+    def __init__(self, first, count, t_first, t_last, mins, maxs):
+        self.first = first
+        self.count = count
+        self.t_first = t_first
+        self.t_last = t_last
+        self.mins = mins
+        self.maxs = maxs
+
+    def pack(self):
+        stats = []
+        for lo, hi in zip(self.mins, self.maxs):
+            stats += [lo, hi]
+        return struct.pack(ENTRY, self.first, self.count, self.t_first,
+                           self.t_last, *stats)
+
+    @staticmethod
+    def unpack(data):
+        fields = struct.unpack(ENTRY, data)
+        return Chunk(fields[0], fields[1], fields[2], fields[3],
+                     list(fields[4::2]), list(fields[5::2]))
+
+    def matches(self, where):
+        """where: {field: (lo, hi)}, None for no bound on a side"""
+        for field, (lo, hi) in where.items():
+            i = telemetry.FIELDS.index(field)
+            if lo is not None and self.maxs[i] < lo:
+                return False
+            if hi is not None and self.mins[i] > hi:
+                return False
+        return True
+
+class _Stats:
+    """Of the chunk being written"""
+
+    def __init__(self, first):
+        self.first = first
+        self.count = 0
+
+    def add(self, host_s, values):
+        if not self.count:
+            self.t_first = host_s
+            self.mins = list(values)
+            self.maxs = list(values)
+        else:
+            self.mins = [min(a, b) for a, b in zip(self.mins, values)]
+            self.maxs = [max(a, b) for a, b in zip(self.maxs, values)]
+        self.t_last = host_s
+        self.count += 1
+
+    def chunk(self):
+        return Chunk(self.first, self.count, self.t_first, self.t_last,
+                     self.mins, self.maxs)
+
+class Writer:
+    """Records appended as they come, the index written by close()"""
+
+    def __init__(self, path):
+        self.out = open(path, 'wb', 1 << 16)
+        self.out.write(struct.pack(HEADER, MAGIC, VERSION, RECORD_SIZE,
+                                   CHUNK_RECORDS,
+                                   telemetry.RECORD.encode('ascii')))
+        self.chunks = []
+        self.stats = _Stats(0)
+        self.count = 0
+
+    def add(self, host_s, values):
+        self.out.write(struct.pack(telemetry.RECORD, host_s, *values))
+        self.stats.add(host_s, values)
+        self.count += 1
+        if self.stats.count == CHUNK_RECORDS:
+            self.chunks.append(self.stats.chunk())
+            self.stats = _Stats(self.count)
+
+    def close(self):
+        if self.stats.count:
+            self.chunks.append(self.stats.chunk())
+        offset = HEADER_SIZE + self.count * RECORD_SIZE
+        for chunk in self.chunks:
+            self.out.write(chunk.pack())
+        self.out.write(struct.pack(TRAILER, INDEX_MAGIC, offset,
+                                   len(self.chunks), self.count))
+        self.out.close()
+
+class Session:
+    """A session archive, its header and index read on opening: the
+    records are read by chunks, on demand"""
+
+    def __init__(self, path):
+        self.path = path
+        with open(path, 'rb') as f:
+            header = f.read(HEADER_SIZE)
+            if len(header) < HEADER_SIZE:
+                raise FormatError('%s: too short' % path)
+            magic, version, record_size, chunk_records, fmt = \
+                struct.unpack(HEADER, header)
+            if magic != MAGIC or version != VERSION:
+                raise FormatError('%s: not a session archive' % path)
+            if fmt.rstrip(b'\0').decode('ascii') != telemetry.RECORD or \
+                    record_size != RECORD_SIZE:
+                raise FormatError('%s: other record format' % path)
+            f.seek(0, os.SEEK_END)
+            size = f.tell()
+            self.chunks = self._index(f, size, chunk_records)
+        self.count = sum(c.count for c in self.chunks)
+        self._lasts = [c.t_last for c in self.chunks]
+
+    def _index(self, f, size, chunk_records):
+        if size >= HEADER_SIZE + TRAILER_SIZE:
+            f.seek(size - TRAILER_SIZE)
+            magic, offset, n, count = struct.unpack(TRAILER,
+                                                    f.read(TRAILER_SIZE))
+            if magic == INDEX_MAGIC and \
+                    offset + n * ENTRY_SIZE + TRAILER_SIZE == size:
+                f.seek(offset)
+                data = f.read(n * ENTRY_SIZE)
+                return [Chunk.unpack(data[i:i + ENTRY_SIZE])
+                        for i in range(0, len(data), ENTRY_SIZE)]
+        # Cut short: the whole records there are
+        count = (size - HEADER_SIZE) // RECORD_SIZE
+        f.seek(HEADER_SIZE)
+        chunks = []
+        for first in range(0, count, chunk_records):
+            stats = _Stats(first)
+            n = min(chunk_records, count - first)
+            data = f.read(n * RECORD_SIZE)
+            for i in range(n):
+                record = struct.unpack_from(telemetry.RECORD, data,
+                                            i * RECORD_SIZE)
+                stats.add(record[0], record[1:])
+            chunks.append(stats.chunk())
+        return chunks
+
+    def span(self):
+        """host_s of the first and last records, None when empty"""
+        if not self.chunks:
+            return None
+        return (self.chunks[0].t_first, self.chunks[-1].t_last)
+
+    def select(self, t_from = None, t_to = None, where = None):
+        """Chunks overlapping [t_from, t_to] whose statistics may hold
+        records within where ({field: (lo, hi)})"""
+        start = 0 if t_from is None else bisect.bisect_left(self._lasts,
+                                                             t_from)
+        selected = []
+        for chunk in self.chunks[start:]:
+            if t_to is not None and chunk.t_first > t_to:
+                break
+            if not where or chunk.matches(where):
+                selected.append(chunk)
+        return selected
+
+    def read(self, t_from = None, t_to = None, where = None):
+        """The records of the selected chunks within the time range: a
+        numpy record array of telemetry.DTYPE mapped on the file when
+        numpy is there, else a list of tuples. where only skips chunks,
+        the records are not filtered."""
+        chunks = self.select(t_from, t_to, where)
+        try:
+            import numpy
+        except ImportError:
+            numpy = None
+
+        if numpy is not None:
+            mapped = numpy.memmap(self.path, dtype=telemetry.DTYPE, mode='r',
+                                  offset=HEADER_SIZE, shape=(self.count,))
+            parts = [mapped[c.first:c.first + c.count] for c in chunks]
+            if not parts:
+                return mapped[:0]
+            records = numpy.concatenate(parts) if len(parts) > 1 else parts[0]
+            keep = numpy.ones(len(records), dtype=bool)
+            if t_from is not None:
+                keep &= records['host_s'] >= t_from
+            if t_to is not None:
+                keep &= records['host_s'] <= t_to
+            return records[keep]
+
+        records = []
+        with open(self.path, 'rb') as f:
+            for c in chunks:
+                f.seek(HEADER_SIZE + c.first * RECORD_SIZE)
+                data = f.read(c.count * RECORD_SIZE)
+                for i in range(c.count):
+                    record = struct.unpack_from(telemetry.RECORD, data,
+                                                i * RECORD_SIZE)
+                    if (t_from is None or record[0] >= t_from) and \
+                            (t_to is None or record[0] <= t_to):
+                        records.append(record)
+        return records
+
+def scan(patterns):
+    """The sessions of the paths or glob patterns, by start time, from
+    their index only; the files that are not archives are skipped"""
+    sessions = []
+    for pattern in patterns:
+        for path in sorted(glob.glob(pattern)):
+            try:
+                session = Session(path)
+            except (IOError, FormatError):
+                continue
+            if session.span():
+                sessions.append(session)
+    sessions.sort(key=lambda s: s.span()[0])
+    return sessions
+
+def query(sessions, t_from = None, t_to = None, where = None):
+    """(session, records) of the sessions with records in the range"""
+    for session in sessions:
+        first, last = session.span()
+        if (t_to is not None and first > t_to) or \
+                (t_from is not None and last < t_from):
+            continue
+        records = session.read(t_from, t_to, where)
+        if len(records):
+            yield session, records
+
+def convert(bin_path, path):
+    """A binary log of telemetry.Recorder (.bin) to a session archive"""
+    writer = Writer(path)
+    with open(bin_path, 'rb') as f:
+        while True:
+            data = f.read(RECORD_SIZE * CHUNK_RECORDS)
+            for i in range(len(data) // RECORD_SIZE):
+                record = struct.unpack_from(telemetry.RECORD, data,
+                                            i * RECORD_SIZE)
+                writer.add(record[0], record[1:])
+            if len(data) < RECORD_SIZE * CHUNK_RECORDS:
+                break
+    writer.close()
+    return writer.count
@@ -0,0 +1,166 @@
+#! /usr/bin/env python
+# encoding: utf-8
+
+# Telemetry frames (proto_telemetry_t, src/libglobal/protocol.h) of the
+# monitor: columnar log and live plot
+
+import struct, threading, collections
+
+PROTO_TELEMETRY = 0x83
+PROTO_TELEMETRY_DELTA = 0x92
+
+# Kept in step with proto_telemetry_t, packed
+FIELDS = ['tick', 'sharp_left_mm', 'sonar_mm', 'sharp_right_mm',
+          'motor_left', 'motor_right', 'battery_mv', 'current_ma', 'cut_off',
+          'x_mm', 'y_mm', 'theta_mrad', 'sonar_left_mm', 'sonar_right_mm',
+          'cpu_permille', 'link_errors']
+FORMAT = '<IhhhhhHHBhhhhhHB'
+SIZE = struct.calcsize(FORMAT)
+
+# Binary log: fixed records, the host time in seconds first, no header.
+# numpy.memmap(path, dtype=DTYPE) maps it as is.
+RECORD = '<d' + FORMAT[1:]
+DTYPE = [('host_s', '<f8'), ('tick', '<u4'), ('sharp_left_mm', '<i2'),
+         ('sonar_mm', '<i2'), ('sharp_right_mm', '<i2'),
+         ('motor_left', '<i2'), ('motor_right', '<i2'),
+         ('battery_mv', '<u2'), ('current_ma', '<u2'), ('cut_off', 'u1'),
+         ('x_mm', '<i2'), ('y_mm', '<i2'), ('theta_mrad', '<i2'),
+         ('sonar_left_mm', '<i2'), ('sonar_right_mm', '<i2'),
+         ('cpu_permille', '<u2'), ('link_errors', 'u1')]
+
+def decode(payload):
+    if len(payload) != SIZE:
+        return None
+    return struct.unpack(FORMAT, payload)
+
+# proto_telemetry_delta_t, then an int16 per channel of the mask: the
+# fields after the tick, in order, then the effective period
+DELTA_FORMAT = '<BIH'
+DELTA_SIZE = struct.calcsize(DELTA_FORMAT)
+CHANNELS = len(FIELDS) - 1
+CHANNEL_PERIOD = CHANNELS
+# Back to the field types from their int16
+MASKS = [{'H': 0xFFFF, 'B': 0xFF}.get(f) for f in FORMAT[2:]]
+
+class Decoder:
+    """Both telemetry frames to the values of proto_telemetry_t: the
+    report on change ones ("t period 0 heartbeat") merged over the last
+    values, None until every channel was seen. Counts the lost frames
+    from the gaps of the sequence, keeps the period of the samples as
+    the board sends them (slowed down on a congested link)."""
+
+    def __init__(self):
+        self.values = [None] * CHANNELS
+        self.seq = None
+        self.lost = 0
+        self.period_ms = None
+
+    def decode(self, type, payload):
+        if type == PROTO_TELEMETRY:
+            return decode(payload)
+        if type != PROTO_TELEMETRY_DELTA or len(payload) < DELTA_SIZE:
+            return None
+        seq, tick, mask = struct.unpack(DELTA_FORMAT, payload[:DELTA_SIZE])
+        indexes = [i for i in range(CHANNELS + 1) if mask & (1 << i)]
+        if len(payload) != DELTA_SIZE + 2 * len(indexes):
+            return None
+        if self.seq is not None:
+            self.lost += (seq - self.seq - 1) & 0xFF
+        self.seq = seq
+        channels = struct.unpack('<%dh' % len(indexes), payload[DELTA_SIZE:])
+        for i, value in zip(indexes, channels):
+            if i == CHANNEL_PERIOD:
+                self.period_ms = value
+            else:
+                self.values[i] = value & MASKS[i] if MASKS[i] else value
+        if None in self.values:
+            return None
+        return tuple([tick] + self.values)
+
+class Recorder:
+    """Telemetry frames to a file: CSV, binary records for a .bin path, a
+    session archive (wtools/session.py) for a .ses one. Buffered, written
+    from the reader thread as the frames come."""
+
+    def __init__(self, path):
+        self.binary = path.endswith('.bin')
+        self.session = None
+        self.count = 0
+        if path.endswith('.ses'):
+            from wtools import session
+            self.session = session.Writer(path)
+            return
+        self.out = open(path, 'wb' if self.binary else 'w', 1 << 16)
+        if not self.binary:
+            self.out.write('host_s,%s\n' % ','.join(FIELDS))
+
+    def add(self, host_s, values):
+        if self.session:
+            self.session.add(host_s, values)
+        elif self.binary:
+            self.out.write(struct.pack(RECORD, host_s, *values))
+        else:
+            self.out.write('%.6f,%s\n' % (host_s, ','.join(map(str, values))))
+        self.count += 1
+
+    def close(self):
+        if self.session:
+            self.session.close()
+        else:
+            self.out.close()
+
+def load(path):
+    """A binary log as a numpy record array, mapped"""
+    import numpy
+    return numpy.memmap(path, dtype=DTYPE, mode='r')
+
+class Plot:
+    """Live plot of some channels over the last points, redrawn by the
+    main thread: the reader only appends to the rings"""
+
+    def __init__(self, channels, points = 2000):
+        for channel in channels:
+            if channel not in FIELDS:
+                raise ValueError('Unknown channel %s, one of %s' %
+                                 (channel, ', '.join(FIELDS)))
+        self.channels = channels
+        self.indexes = [FIELDS.index(c) for c in channels]
+        self.times = collections.deque(maxlen=points)
+        self.rings = [collections.deque(maxlen=points) for c in channels]
+        self.lock = threading.Lock()
+
+    def add(self, host_s, values):
+        with self.lock:
+            self.times.append(host_s)
+            for ring, index in zip(self.rings, self.indexes):
+                ring.append(values[index])
+
+    def run(self, alive, interval_ms = 100):
+        """Until the window is closed or alive() is false"""
+        import matplotlib.pyplot as plt
+        import matplotlib.animation as animation
+
+        figure, axes = plt.subplots(len(self.channels), 1, sharex=True,
+                                    squeeze=False)
+        lines = []
+        for axis, channel in zip(axes[:, 0], self.channels):
+            axis.set_ylabel(channel)
+            lines.append(axis.plot([], [])[0])
+        axes[-1, 0].set_xlabel('host s')
+
+        def update(frame):
+            if not alive():
+                plt.close(figure)
+                return lines
+            with self.lock:
+                times = list(self.times)
+                values = [list(ring) for ring in self.rings]
+            for line, axis, ys in zip(lines, axes[:, 0], values):
+                line.set_data(times, ys)
+                axis.relim()
+                axis.autoscale_view()
+            return lines
+
+        self.animation = animation.FuncAnimation(figure, update,
+                                                 interval=interval_ms)
+        plt.show()
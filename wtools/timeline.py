@@ -0,0 +1,113 @@
+#! /usr/bin/env python
+# encoding: utf-8
+
+# Scheduling timeline of a --timeline build (src/libglobal/timeline.h):
+# the "tl" dump to the Chrome trace event format of "waf trace", opened
+# by chrome://tracing or ui.perfetto.dev
+
+import json, time
+
+# Kept in step with eTimelineEvent
+SWITCH_IN = 1
+SWITCH_OUT = 2
+WAIT_QUEUE = 3
+WAIT_FLAGS = 4
+WAIT_DELAY = 5
+WAKE = 6
+ISR_ENTER = 7
+ISR_EXIT = 8
+
+WAITS = {WAIT_QUEUE: 'wait queue', WAIT_FLAGS: 'wait flags',
+         WAIT_DELAY: 'delay'}
+
+# IRQn_Type of the STM32F10x medium density parts, the marked handlers
+IRQS = {14: 'DMA1_Channel4', 15: 'DMA1_Channel5', 28: 'TIM2', 29: 'TIM3',
+        31: 'I2C1_EV', 33: 'I2C2_EV', 37: 'USART1'}
+
+CYCLES_PER_US = 72.0
+PROMPT = 'swiftler # '
+
+def request(ser, timeout_s = 5):
+    """The lines of a "tl" in human mode, None without an answer"""
+    ser.timeout = 0.1
+    ser.flushInput()
+    ser.write('\rtl\r')
+    data = ''
+    start = time.time()
+    while time.time() - start < timeout_s:
+        data += ser.read(ser.inWaiting() or 1)
+        # Echo of the command, the dump, then the next prompt
+        answer = data.split('tl\r\n', 1)
+        if len(answer) == 2 and PROMPT in answer[1]:
+            return answer[1].split(PROMPT)[0].splitlines()
+    return None
+
+def parse(lines):
+    """Slot names, events (cycles, event, arg) and the count lost"""
+    names = {}
+    events = []
+    lost = 0
+    for line in lines:
+        fields = line.strip().split('\t')
+        if line.startswith('task '):
+            words = line.split(None, 2)
+            names[int(words[1])] = words[2] if len(words) > 2 else '?'
+        elif len(fields) == 3:
+            cycles, event, arg = [int(v) for v in fields]
+            events.append((cycles & 0xffffffff, event, arg))
+        elif len(fields) == 1 and fields[0].lstrip('-').isdigit():
+            lost = int(fields[0])
+    return names, events, lost
+
+def chrome(names, events):
+    """Trace events: the tasks as the threads of process 0, the
+    interrupts as those of process 1"""
+    trace = []
+    for slot, name in names.items():
+        trace.append({'ph': 'M', 'name': 'thread_name', 'pid': 0,
+                      'tid': slot, 'args': {'name': name}})
+    for irq, name in IRQS.items():
+        trace.append({'ph': 'M', 'name': 'thread_name', 'pid': 1,
+                      'tid': irq, 'args': {'name': name}})
+    trace.append({'ph': 'M', 'name': 'process_name', 'pid': 0,
+                  'args': {'name': 'tasks'}})
+    trace.append({'ph': 'M', 'name': 'process_name', 'pid': 1,
+                  'args': {'name': 'interrupts'}})
+
+    # The cycle counter wraps every 59 s, the dumps are much shorter
+    base = events[0][0] if events else 0
+    wraps = 0
+    last = base
+    opened = set()
+    for cycles, event, arg in events:
+        if cycles < last:
+            wraps += 1
+        last = cycles
+        ts = ((cycles + (wraps << 32)) - base) / CYCLES_PER_US
+        name = names.get(arg, 'slot %d' % arg)
+        if event == SWITCH_IN:
+            trace.append({'ph': 'B', 'name': name, 'pid': 0, 'tid': arg,
+                          'ts': ts})
+            opened.add((0, arg))
+        elif event == ISR_ENTER:
+            trace.append({'ph': 'B', 'name': IRQS.get(arg, 'irq %d' % arg),
+                          'pid': 1, 'tid': arg, 'ts': ts})
+            opened.add((1, arg))
+        elif event in (SWITCH_OUT, ISR_EXIT):
+            # The ends of the spans begun before the dump are dropped
+            pid = 0 if event == SWITCH_OUT else 1
+            if (pid, arg) in opened:
+                trace.append({'ph': 'E', 'pid': pid, 'tid': arg, 'ts': ts})
+                opened.discard((pid, arg))
+        elif event in WAITS:
+            trace.append({'ph': 'i', 'name': WAITS[event], 'pid': 0,
+                          'tid': arg, 'ts': ts, 's': 't'})
+        elif event == WAKE:
+            trace.append({'ph': 'i', 'name': 'woken', 'pid': 0, 'tid': arg,
+                          'ts': ts, 's': 't'})
+    return trace
+
+def write(path, names, events):
+    with open(path, 'w') as out:
+        json.dump({'traceEvents': chrome(names, events),
+                   'displayTimeUnit': 'ms'}, out)